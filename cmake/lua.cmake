@@ -0,0 +1,24 @@
+if (NOT __LUA_INCLUDED) # guard against multiple includes
+    set(__LUA_INCLUDED TRUE)
+
+    # build directory
+    set(lua_PREFIX ${CMAKE_BUILD_DIRECTORY}/external/lua-prefix)
+    set(LUA_SOURCE_DIR ${lua_PREFIX}/src/lua)
+
+    ExternalProject_Add(lua
+        PREFIX ${lua_PREFIX}
+        URL "https://www.lua.org/ftp/lua-5.1.5.tar.gz"
+        # the checksum published by lua.org, the download fails if the tarball is changed
+        URL_HASH SHA256=2640fc56a795f29d28ef15e13c34a47e223960b0240e8cb0a82d9b0738695333
+        BUILD_IN_SOURCE 1
+        CONFIGURE_COMMAND ""
+        BUILD_COMMAND make -C src liblua.a "MYCFLAGS=-fPIC"
+        INSTALL_COMMAND ""
+        LOG_DOWNLOAD 1
+        LOG_BUILD 1
+        )
+
+    set(lua_FOUND TRUE)
+    set(lua_INCLUDE_DIRS ${LUA_SOURCE_DIR}/src)
+    set(lua_LIBRARIES ${LUA_SOURCE_DIR}/src/liblua.a m)
+endif()
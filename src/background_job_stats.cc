@@ -0,0 +1,159 @@
+#include "background_job_stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+RollingCounters::RollingCounters(size_t n_counters)
+    : n_counters_(n_counters),
+      slot_epochs_(kSlots, -1),
+      slot_values_(kSlots * n_counters, 0),
+      totals_(n_counters, 0) {}
+
+void RollingCounters::Add(uint64_t now_us, size_t counter, uint64_t value) {
+  auto epoch = static_cast<int64_t>(now_us / 1000000 / kSlotSeconds);
+  size_t slot = static_cast<size_t>(epoch % kSlots);
+  if (slot_epochs_[slot] != epoch) {
+    // the slot is left by the epoch of the previous round
+    slot_epochs_[slot] = epoch;
+    std::fill(slot_values_.begin() + slot * n_counters_, slot_values_.begin() + (slot + 1) * n_counters_, 0);
+  }
+  slot_values_[slot * n_counters_ + counter] += value;
+  totals_[counter] += value;
+}
+
+void RollingCounters::Sum(uint64_t now_us, int seconds, std::vector<uint64_t> *sums) const {
+  if (seconds == 0) {
+    *sums = totals_;
+    return;
+  }
+  sums->assign(n_counters_, 0);
+  auto epoch = static_cast<int64_t>(now_us / 1000000 / kSlotSeconds);
+  int64_t n_slots = std::min<int64_t>(seconds / kSlotSeconds, kSlots);
+  for (size_t slot = 0; slot < static_cast<size_t>(kSlots); slot++) {
+    if (slot_epochs_[slot] <= epoch - n_slots || slot_epochs_[slot] > epoch) continue;
+    for (size_t i = 0; i < n_counters_; i++) (*sums)[i] += slot_values_[slot * n_counters_ + i];
+  }
+}
+
+BackgroundJobStats::BackgroundJobStats() : errors_(kNumErrorReasons) {}
+
+uint64_t BackgroundJobStats::NowUS() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+}
+
+RollingCounters *BackgroundJobStats::getCounters(std::map<std::string, RollingCounters> *counters,
+                                                 const std::string &cf_name, size_t n_counters) {
+  auto iter = counters->find(cf_name);
+  if (iter == counters->end()) iter = counters->emplace(cf_name, RollingCounters(n_counters)).first;
+  return &iter->second;
+}
+
+void BackgroundJobStats::RecordFlushBegin(int job_id, uint64_t now_us) {
+  std::lock_guard<std::mutex> guard(mu_);
+  flush_begins_[job_id] = now_us;
+}
+
+void BackgroundJobStats::RecordFlushCompleted(const std::string &cf_name, int job_id, uint64_t output_bytes,
+                                              uint64_t now_us) {
+  std::lock_guard<std::mutex> guard(mu_);
+  auto counters = getCounters(&flushes_, cf_name, kNumFlushCounters);
+  counters->Add(now_us, kFlushCount, 1);
+  counters->Add(now_us, kFlushOutputBytes, output_bytes);
+  auto iter = flush_begins_.find(job_id);
+  if (iter != flush_begins_.end()) {
+    if (now_us > iter->second) counters->Add(now_us, kFlushDurationUS, now_us - iter->second);
+    flush_begins_.erase(iter);
+  }
+}
+
+void BackgroundJobStats::RecordCompaction(const std::string &cf_name, int output_level, uint64_t duration_us,
+                                          uint64_t input_bytes, uint64_t output_level_bytes, uint64_t output_bytes,
+                                          uint64_t now_us) {
+  std::lock_guard<std::mutex> guard(mu_);
+  auto key = std::make_pair(cf_name, output_level);
+  auto iter = compactions_.find(key);
+  if (iter == compactions_.end()) iter = compactions_.emplace(key, RollingCounters(kNumCompactionCounters)).first;
+  auto &counters = iter->second;
+  counters.Add(now_us, kCompactionCount, 1);
+  counters.Add(now_us, kCompactionDurationUS, duration_us);
+  counters.Add(now_us, kCompactionInputBytes, input_bytes);
+  uint64_t upper_level_bytes = input_bytes > output_level_bytes ? input_bytes - output_level_bytes : 0;
+  counters.Add(now_us, kCompactionUpperLevelBytes, upper_level_bytes);
+  counters.Add(now_us, kCompactionOutputBytes, output_bytes);
+}
+
+void BackgroundJobStats::RecordStallChanged(const std::string &cf_name, StallCondition prev, StallCondition cur,
+                                            uint64_t now_us) {
+  std::lock_guard<std::mutex> guard(mu_);
+  auto counters = getCounters(&stalls_, cf_name, kNumStallCounters);
+  auto &state = stall_states_[cf_name];
+  // the state is trusted rather than the prev, since it knows when the stall is started
+  if (state.condition != kStallNormal && now_us > state.since_us) {
+    counters->Add(now_us, state.condition == kStallDelayed ? kStallDelayedUS : kStallStoppedUS,
+                  now_us - state.since_us);
+  }
+  if (cur != kStallNormal) counters->Add(now_us, cur == kStallDelayed ? kStallDelayedCount : kStallStoppedCount, 1);
+  state.condition = cur;
+  state.since_us = now_us;
+}
+
+void BackgroundJobStats::RecordBackgroundError(ErrorReason reason, uint64_t now_us) {
+  std::lock_guard<std::mutex> guard(mu_);
+  errors_.Add(now_us, reason, 1);
+}
+
+void BackgroundJobStats::GetInfo(uint64_t now_us, std::string *info) {
+  static const std::vector<std::pair<const char *, int>> kWindows = {
+      {"1m", 60}, {"5m", 300}, {"15m", 900}, {"all", 0}};
+  auto amplification = [](uint64_t bytes, uint64_t upper_level_bytes) {
+    return upper_level_bytes == 0 ? 0 : static_cast<double>(bytes) / upper_level_bytes;
+  };
+
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(2);
+  std::vector<uint64_t> sums;
+  std::lock_guard<std::mutex> guard(mu_);
+  for (const auto &iter : flushes_) {
+    for (const auto &window : kWindows) {
+      iter.second.Sum(now_us, window.second, &sums);
+      out << "flush_" << iter.first << "_" << window.first << ":count=" << sums[kFlushCount]
+          << ",duration_us=" << sums[kFlushDurationUS] << ",output_bytes=" << sums[kFlushOutputBytes] << "\r\n";
+    }
+  }
+  for (const auto &iter : compactions_) {
+    for (const auto &window : kWindows) {
+      iter.second.Sum(now_us, window.second, &sums);
+      uint64_t upper_level_bytes = sums[kCompactionUpperLevelBytes];
+      // the read amplification counts the bytes of both levels, and the write amplification
+      // counts the bytes written into the output level, both per byte of the upper level
+      out << "compaction_" << iter.first.first << "_L" << iter.first.second << "_" << window.first
+          << ":count=" << sums[kCompactionCount] << ",duration_us=" << sums[kCompactionDurationUS]
+          << ",input_bytes=" << sums[kCompactionInputBytes] << ",output_bytes=" << sums[kCompactionOutputBytes]
+          << ",read_amp=" << amplification(sums[kCompactionInputBytes], upper_level_bytes)
+          << ",write_amp=" << amplification(sums[kCompactionOutputBytes], upper_level_bytes) << "\r\n";
+    }
+  }
+  for (const auto &iter : stalls_) {
+    const auto &state = stall_states_[iter.first];
+    for (const auto &window : kWindows) {
+      iter.second.Sum(now_us, window.second, &sums);
+      out << "stall_" << iter.first << "_" << window.first << ":delayed=" << sums[kStallDelayedCount]
+          << ",delayed_us=" << sums[kStallDelayedUS] << ",stopped=" << sums[kStallStoppedCount]
+          << ",stopped_us=" << sums[kStallStoppedUS] << "\r\n";
+    }
+    // the duration of the ongoing stall isn't added until it is ended
+    const char *conditions[] = {"normal", "delayed", "stopped"};
+    out << "stall_" << iter.first << "_condition:" << conditions[state.condition]
+        << ",since_us=" << (state.condition == kStallNormal ? 0 : now_us - state.since_us) << "\r\n";
+  }
+  for (const auto &window : kWindows) {
+    errors_.Sum(now_us, window.second, &sums);
+    out << "background_errors_" << window.first << ":flush=" << sums[kErrorFlush]
+        << ",compaction=" << sums[kErrorCompaction] << ",writecallback=" << sums[kErrorWriteCallback]
+        << ",memtable=" << sums[kErrorMemTable] << "\r\n";
+  }
+  *info = out.str();
+}
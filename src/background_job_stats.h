@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// RollingCounters adds the counters into the ring of the slots of kSlotSeconds, so the sums
+// of the last minutes are read from the slots which aren't overwritten by the later ones,
+// besides the totals since it is created
+class RollingCounters {
+ public:
+  static const int kSlotSeconds = 10;
+  static const int kSlots = 90;
+
+  explicit RollingCounters(size_t n_counters);
+  void Add(uint64_t now_us, size_t counter, uint64_t value);
+  // Sum returns the sums of the counters in the last @seconds, or the totals if it is 0
+  void Sum(uint64_t now_us, int seconds, std::vector<uint64_t> *sums) const;
+
+ private:
+  size_t n_counters_;
+  std::vector<int64_t> slot_epochs_;
+  std::vector<uint64_t> slot_values_;
+  std::vector<uint64_t> totals_;
+};
+
+// BackgroundJobStats aggregates the flushes and the compactions of each column family and output
+// level, the write stalls and the background errors reported by the event listener. The events
+// are rare, so they are recorded under the mutex, and shown in the windows of 1, 5 and 15 minutes
+// like the load average, so the effects of tuning the compaction options could be told.
+class BackgroundJobStats {
+ public:
+  enum StallCondition { kStallNormal = 0, kStallDelayed, kStallStopped };
+  enum ErrorReason { kErrorFlush = 0, kErrorCompaction, kErrorWriteCallback, kErrorMemTable, kNumErrorReasons };
+
+  BackgroundJobStats();
+  BackgroundJobStats(const BackgroundJobStats &) = delete;
+  BackgroundJobStats &operator=(const BackgroundJobStats &) = delete;
+
+  // NowUS returns the microseconds of the steady clock, which the events are recorded by
+  static uint64_t NowUS();
+
+  void RecordFlushBegin(int job_id, uint64_t now_us);
+  void RecordFlushCompleted(const std::string &cf_name, int job_id, uint64_t output_bytes, uint64_t now_us);
+  // @output_level_bytes: the input bytes from the output level, the others are read from the
+  // upper levels, and the amplifications are relative to them like the compaction stats of the rocksdb
+  void RecordCompaction(const std::string &cf_name, int output_level, uint64_t duration_us, uint64_t input_bytes,
+                        uint64_t output_level_bytes, uint64_t output_bytes, uint64_t now_us);
+  // RecordStallChanged adds the duration of the stall once the column family left the condition
+  void RecordStallChanged(const std::string &cf_name, StallCondition prev, StallCondition cur, uint64_t now_us);
+  void RecordBackgroundError(ErrorReason reason, uint64_t now_us);
+  void GetInfo(uint64_t now_us, std::string *info);
+
+ private:
+  enum FlushCounter { kFlushCount = 0, kFlushDurationUS, kFlushOutputBytes, kNumFlushCounters };
+  enum CompactionCounter {
+    kCompactionCount = 0,
+    kCompactionDurationUS,
+    kCompactionInputBytes,
+    kCompactionUpperLevelBytes,
+    kCompactionOutputBytes,
+    kNumCompactionCounters,
+  };
+  enum StallCounter { kStallDelayedCount = 0, kStallDelayedUS, kStallStoppedCount, kStallStoppedUS,
+                      kNumStallCounters };
+  struct StallState {
+    StallCondition condition = kStallNormal;
+    uint64_t since_us = 0;
+  };
+
+  std::mutex mu_;
+  std::map<std::string, RollingCounters> flushes_;
+  // the begin time of the running flushes by the job id
+  std::map<int, uint64_t> flush_begins_;
+  std::map<std::pair<std::string, int>, RollingCounters> compactions_;
+  std::map<std::string, RollingCounters> stalls_;
+  std::map<std::string, StallState> stall_states_;
+  RollingCounters errors_;
+
+  static RollingCounters *getCounters(std::map<std::string, RollingCounters> *counters, const std::string &cf_name,
+                                      size_t n_counters);
+};
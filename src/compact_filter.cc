@@ -3,6 +3,7 @@
 #include <string>
 #include <utility>
 
+#include "encoding.h"
 #include "redis_bitmap.h"
 
 namespace Engine {
@@ -13,77 +14,107 @@ bool MetadataFilter::Filter(int level,
                                     const Slice &value,
                                     std::string *new_value,
                                     bool *modified) const {
-  std::string ns, user_key, bytes = value.ToString();
-  Metadata metadata(kRedisNone);
-  rocksdb::Status s = metadata.Decode(bytes);
+  // the metadata is checked in place without copying the value or the key, and the
+  // current time is refreshed per batch of keys instead of per key
+  if (n_filtered_++ % kRefreshTimeInterval == 0) rocksdb::Env::Default()->GetCurrentTime(&now_);
+  bool expired = false;
+  Slice ns, user_key;
   ExtractNamespaceKey(key, &ns, &user_key);
-  if (!s.ok()) {
+  if (!Metadata::DecodeExpired(value, now_, &expired)) {
     LOG(WARNING) << "[compact_filter/metadata] Failed to decode,"
-                 << ", namespace: " << ns
-                 << ", key: " << user_key
-                 << ", err: " << s.ToString();
+                 << ", namespace: " << ns.ToString()
+                 << ", key: " << user_key.ToString()
+                 << ", err: the metadata was too short";
     return false;
   }
   DLOG(INFO) << "[compact_filter/metadata] "
-             << "namespace: " << ns
-             << ", key: " << user_key
-             << ", result: " << (metadata.Expired() ? "deleted" : "reserved");
-  return metadata.Expired();
+             << "namespace: " << ns.ToString()
+             << ", key: " << user_key.ToString()
+             << ", result: " << (expired ? "deleted" : "reserved");
+  return expired;
 }
 
-bool SubKeyFilter::IsKeyExpired(const InternalKey &ikey, const Slice &value) const {
-  std::string metadata_key;
+bool SubKeyFilter::decodeMetadataHint(const Slice &bytes, MetadataHint *hint) {
+  // flags(1byte) + expire (4byte) + version(8byte) + size(4byte), the string has no version and size
+  // except the string whose value is separated into the blob column family
+  Slice input(bytes);
+  if (!GetFixed8(&input, &hint->flags)) return false;
+  if (!GetFixed32(&input, reinterpret_cast<uint32_t *>(&hint->expire))) return false;
+  if ((hint->flags & 0x0f) == kRedisString && !(hint->flags & kStringBlobFlag)) return true;
+  return GetFixed64(&input, &hint->version) && GetFixed32(&input, &hint->size);
+}
+
+bool SubKeyFilter::inPrefetchedRange(const std::string &metadata_key) const {
+  return prefetch_valid_ && metadata_key >= prefetch_begin_
+      && (prefetch_exhausted_ || metadata_key <= prefetch_end_);
+}
 
+bool SubKeyFilter::prefetchMetadata(const std::string &metadata_key) const {
+  const int batch_size = 64;
   auto db = stor_->GetDB();
   auto cf_handles = stor_->GetCFHandles();
   // storage close the would delete the column familiy handler and DB
   if (!db || cf_handles.size() < 2)  return false;
-
-  ComposeNamespaceKey(ikey.GetNamespace(), ikey.GetKey(), &metadata_key);
-  if (cached_key_.empty() || metadata_key != cached_key_) {
-    std::string bytes;
-    if (!stor_->IncrDBRefs().IsOK()) {  // the db is closing, don't use DB and cf_handles
-      return false;
+  if (!stor_->IncrDBRefs().IsOK()) {  // the db is closing, don't use DB and cf_handles
+    return false;
+  }
+  prefetch_valid_ = false;
+  prefetch_exhausted_ = true;
+  prefetched_.clear();
+  rocksdb::ReadOptions read_options;
+  read_options.fill_cache = false;
+  Engine::Storage::SetTotalOrderIfMetadata(cf_handles[1], &read_options);
+  auto iter = db->NewIterator(read_options, cf_handles[1]);
+  int n = 0;
+  for (iter->Seek(metadata_key); iter->Valid(); iter->Next()) {
+    if (n++ == batch_size) {
+      prefetch_exhausted_ = false;
+      break;
     }
-    rocksdb::Status s = db->Get(rocksdb::ReadOptions(), cf_handles[1], metadata_key, &bytes);
-    stor_->DecrDBRefs();
-    cached_key_ = std::move(metadata_key);
-    if (s.ok()) {
-      cached_metadata_ = std::move(bytes);
-    } else if (s.IsNotFound()) {
-      // metadata was deleted(perhaps compaction or manual)
-      // clear the metadata
-      cached_metadata_.clear();
-      return true;
-    } else {
-      LOG(ERROR) << "[compact_filter/subkey] Failed to fetch metadata"
-                 << ", namespace: " << ikey.GetNamespace().ToString()
-                 << ", key: " << ikey.GetKey().ToString()
-                 << ", err: " << s.ToString();
-      cached_key_.clear();
-      cached_metadata_.clear();
-      return false;
+    MetadataHint hint;
+    prefetch_end_ = iter->key().ToString();
+    if (!decodeMetadataHint(iter->value(), &hint)) {
+      LOG(ERROR) << "[compact_filter/subkey] Failed to decode metadata, key: " << prefetch_end_;
+      hint.decoded = false;
     }
+    prefetched_.emplace_hint(prefetched_.end(), prefetch_end_, hint);
   }
-  // the metadata was not found
-  if (cached_metadata_.empty()) return true;
-  // the metadata is cached
-  Metadata metadata(kRedisNone);
-  rocksdb::Status s = metadata.Decode(cached_metadata_);
+  auto s = iter->status();
+  delete iter;
+  stor_->DecrDBRefs();
   if (!s.ok()) {
-    cached_key_.clear();
-    LOG(ERROR) << "[compact_filter/subkey] Failed to decode metadata"
-               << ", namespace: " << ikey.GetNamespace().ToString()
-               << ", key: " << ikey.GetKey().ToString()
-               << ", err: " << s.ToString();
+    LOG(ERROR) << "[compact_filter/subkey] Failed to prefetch metadata, err: " << s.ToString();
+    prefetched_.clear();
+    return false;
+  }
+  if (prefetched_.empty()) prefetch_end_ = metadata_key;
+  prefetch_begin_ = metadata_key;
+  prefetch_valid_ = true;
+  rocksdb::Env::Default()->GetCurrentTime(&now_);
+  return true;
+}
+
+bool SubKeyFilter::IsKeyExpired(const InternalKey &ikey, const Slice &value) const {
+  // the buffer of the metadata key is reused by the subkeys
+  auto &metadata_key = metadata_key_;
+  ComposeNamespaceKey(ikey.GetNamespace(), ikey.GetKey(), &metadata_key);
+  if (!inPrefetchedRange(metadata_key) && !prefetchMetadata(metadata_key)) {
     return false;
   }
-  if (metadata.Type() == kRedisString  // metadata key was overwrite by set command
-      || metadata.Expired()
-      || ikey.GetVersion() != metadata.version) {
+  auto iter = prefetched_.find(metadata_key);
+  // metadata is deleted(perhaps compaction or manual)
+  if (iter == prefetched_.end()) return true;
+  const auto &hint = iter->second;
+  if (!hint.decoded) return false;
+  // check the version first as it is the most common case of the stale subkeys
+  if (ikey.GetVersion() != hint.version) return true;
+  auto type = static_cast<RedisType>(hint.flags & 0x0f);
+  if ((type == kRedisString && !(hint.flags & kStringBlobFlag))  // metadata key is overwritten by set command
+      || (hint.expire > 0 && hint.expire < now_)
+      || hint.size == 0) {
     return true;
   }
-  return metadata.Type() == kRedisBitmap && Redis::Bitmap::IsEmptySegment(value);
+  return type == kRedisBitmap && Redis::Bitmap::IsEmptySegment(value);
 }
 
 bool SubKeyFilter::Filter(int level,
@@ -2,6 +2,7 @@
 
 #include <rocksdb/db.h>
 #include <rocksdb/compaction_filter.h>
+#include <map>
 #include <vector>
 #include <memory>
 #include <string>
@@ -14,6 +15,11 @@ class MetadataFilter : public rocksdb::CompactionFilter {
   const char *Name() const override { return "MetadataFilter"; }
   bool Filter(int level, const Slice &key, const Slice &value,
               std::string *new_value, bool *modified) const override;
+
+ private:
+  static const uint64_t kRefreshTimeInterval = 1024;
+  mutable uint64_t n_filtered_ = 0;
+  mutable int64_t now_ = 0;
 };
 
 class MetadataFilterFactory : public rocksdb::CompactionFilterFactory {
@@ -28,10 +34,7 @@ class MetadataFilterFactory : public rocksdb::CompactionFilterFactory {
 
 class SubKeyFilter : public rocksdb::CompactionFilter {
  public:
-  explicit SubKeyFilter(Storage *storage)
-      : cached_key_(""),
-        cached_metadata_(""),
-        stor_(storage) {}
+  explicit SubKeyFilter(Storage *storage) : stor_(storage) {}
 
   const char *Name() const override { return "SubkeyFilter"; }
   bool IsKeyExpired(const InternalKey &ikey, const Slice &value) const;
@@ -39,8 +42,28 @@ class SubKeyFilter : public rocksdb::CompactionFilter {
               std::string *new_value, bool *modified) const override;
 
  protected:
-  mutable std::string cached_key_;
-  mutable std::string cached_metadata_;
+  // MetadataHint is the fields of the metadata used to check the subkeys
+  struct MetadataHint {
+    uint8_t flags = 0;
+    int expire = 0;
+    uint64_t version = 0;
+    uint32_t size = 0;
+    bool decoded = true;
+  };
+  static bool decodeMetadataHint(const Slice &bytes, MetadataHint *hint);
+  bool prefetchMetadata(const std::string &metadata_key) const;
+  bool inPrefetchedRange(const std::string &metadata_key) const;
+
+  // The compaction walks through the keys in order, so the metadata is prefetched
+  // by reading a batch of the following keys from the metadata column family on miss,
+  // and the keys in the prefetched range but not in the batch are known deleted.
+  mutable std::map<std::string, MetadataHint> prefetched_;
+  mutable bool prefetch_valid_ = false;
+  mutable bool prefetch_exhausted_ = false;
+  mutable std::string prefetch_begin_;
+  mutable std::string prefetch_end_;
+  mutable int64_t now_ = 0;
+  mutable std::string metadata_key_;
   Engine::Storage *stor_;
 };
 
@@ -0,0 +1,86 @@
+#include "compaction_checker.h"
+
+#include <glog/logging.h>
+#include <rocksdb/table_properties.h>
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include "config.h"
+
+// the files with few keys are cheap to scan over, no need to compact them
+static const uint64_t kCompactionCheckMinFileKeys = 10000;
+static const uint64_t kCompactionBehindPendingBytes = 32 * GiB;
+
+int CompactionChecker::PickCompactionFiles(double min_deleted_ratio, int max_files) {
+  struct CompactionFile {
+    rocksdb::ColumnFamilyHandle *cf_handle;
+    std::string start_key;
+    std::string stop_key;
+    double deleted_ratio;
+  };
+
+  auto db = storage_->GetDB();
+  std::map<std::string, rocksdb::ColumnFamilyHandle *> cf_handles;
+  for (auto cf_handle : storage_->GetCFHandles()) cf_handles[cf_handle->GetName()] = cf_handle;
+  std::vector<rocksdb::LiveFileMetaData> files_meta;
+  db->GetLiveFilesMetaData(&files_meta);
+
+  std::vector<CompactionFile> candidates;
+  for (const auto &cf_iter : cf_handles) {
+    rocksdb::TablePropertiesCollection props;
+    auto s = db->GetPropertiesOfAllTables(cf_iter.second, &props);
+    if (!s.ok()) {
+      LOG(WARNING) << "[compaction checker] Failed to get the table properties of " << cf_iter.first
+                   << ", err: " << s.ToString();
+      continue;
+    }
+    for (const auto &meta : files_meta) {
+      if (meta.column_family_name != cf_iter.first || meta.being_compacted) continue;
+      auto prop_iter = props.find(meta.db_path + meta.name);
+      if (prop_iter == props.end()) continue;
+      uint64_t n_keys = prop_iter->second->num_entries;
+      if (n_keys < kCompactionCheckMinFileKeys) continue;
+      // the deleted keys are recorded by the internal collector, which is always on
+      uint64_t n_deleted = rocksdb::GetDeletedKeys(prop_iter->second->user_collected_properties);
+      double deleted_ratio = static_cast<double>(n_deleted) / n_keys;
+      if (deleted_ratio < min_deleted_ratio) continue;
+      candidates.emplace_back(CompactionFile{cf_iter.second, meta.smallestkey, meta.largestkey, deleted_ratio});
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [](const CompactionFile &a, const CompactionFile &b) {
+    return a.deleted_ratio > b.deleted_ratio;
+  });
+  if (candidates.size() > static_cast<size_t>(max_files)) candidates.resize(max_files);
+
+  int n_compacted = 0;
+  rocksdb::CompactRangeOptions compact_opts;
+  for (const auto &file : candidates) {
+    rocksdb::Slice start_key(file.start_key), stop_key(file.stop_key);
+    auto s = db->CompactRange(compact_opts, file.cf_handle, &start_key, &stop_key);
+    if (!s.ok()) {
+      LOG(WARNING) << "[compaction checker] Failed to compact the range of " << file.cf_handle->GetName()
+                   << ", err: " << s.ToString();
+      continue;
+    }
+    LOG(INFO) << "[compaction checker] Compacted the range of " << file.cf_handle->GetName()
+              << " whose deleted ratio was " << file.deleted_ratio;
+    n_compacted++;
+  }
+  return n_compacted;
+}
+
+bool CompactionChecker::IsCompactionBehind() {
+  auto db = storage_->GetDB();
+  uint64_t pending_bytes = 0;
+  db->GetAggregatedIntProperty("rocksdb.estimate-pending-compaction-bytes", &pending_bytes);
+  if (pending_bytes >= kCompactionBehindPendingBytes) return true;
+  int slowdown_trigger = storage_->GetConfig()->rocksdb_options.level0_slowdown_writes_trigger;
+  for (auto cf_handle : storage_->GetCFHandles()) {
+    std::string n_files;
+    if (!db->GetProperty(cf_handle, "rocksdb.num-files-at-level0", &n_files)) continue;
+    if (std::atoi(n_files.c_str()) >= slowdown_trigger) return true;
+  }
+  return false;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+
+#include "storage.h"
+
+// CompactionChecker picks the sst files full of the tombstones and compacts their key ranges,
+// the deletes of the huge keys and the expired keys left the tombstones in the files which
+// the rocksdb's compactions may never reach, while the scans have to skip them over and over.
+class CompactionChecker {
+ public:
+  explicit CompactionChecker(Engine::Storage *storage) : storage_(storage) {}
+  ~CompactionChecker() = default;
+
+  // PickCompactionFiles compacts the key ranges of at most max_files files whose ratio of the
+  // deleted keys is at least min_deleted_ratio, and returns the number of the compacted files
+  int PickCompactionFiles(double min_deleted_ratio, int max_files);
+  // IsCompactionBehind returns true if the L0 files are about to slow down the writes or the
+  // pending compaction bytes piled up, the extra compactions should give way to the rocksdb then
+  bool IsCompactionBehind();
+
+ private:
+  Engine::Storage *storage_ = nullptr;
+};
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <sstream>
 #include <vector>
+#include <unordered_map>
 #include <utility>
 #include <limits>
 
@@ -81,6 +82,145 @@ void Config::array2String(const std::vector<std::string> &array,
   }
 }
 
+// the range is `start-stop` in hours, e.g. 0-7 or 22-5 which crosses the midnight
+Status Config::parseCompactionCheckerRange(const std::string &range) {
+  std::vector<std::string> hours;
+  Util::Split(range, "-", &hours);
+  if (hours.size() != 2) {
+    return Status(Status::NotOK, "compaction-checker-range should be like 0-7");
+  }
+  int64_t start, stop;
+  auto s = Util::StringToNum(hours[0], &start, 0, 23);
+  if (!s.IsOK()) return s;
+  s = Util::StringToNum(hours[1], &stop, 0, 23);
+  if (!s.IsOK()) return s;
+  compaction_checker_range_start = static_cast<int>(start);
+  compaction_checker_range_stop = static_cast<int>(stop);
+  return Status::OK();
+}
+
+std::string Config::compactionCheckerRangeString() {
+  if (compaction_checker_range_start < 0) return "";
+  return std::to_string(compaction_checker_range_start) + "-" + std::to_string(compaction_checker_range_stop);
+}
+
+std::string Config::unixsocketPermString() {
+  char buf[8];
+  snprintf(buf, sizeof(buf), "%o", unixsocketperm);
+  return buf;
+}
+
+Status Config::parseDBPaths(const std::string &value) {
+  std::vector<std::string> paths;
+  Util::Split(value, ",", &paths);
+  std::vector<std::pair<std::string, uint64_t>> db_paths;
+  for (const auto &path : paths) {
+    auto pos = path.rfind(':');
+    if (pos == std::string::npos || pos == 0) {
+      return Status(Status::NotOK, "db_paths should be like /mnt/nvme/db:204800,/mnt/hdd/db:0");
+    }
+    int64_t size;
+    auto s = Util::StringToNum(path.substr(pos + 1), &size, 0);
+    if (!s.IsOK()) return s;
+    db_paths.emplace_back(path.substr(0, pos), static_cast<uint64_t>(size) * MiB);
+  }
+  rocksdb_options.db_paths = std::move(db_paths);
+  return Status::OK();
+}
+
+// isSamePath compares the paths without the trailing slashes
+static bool isSamePath(std::string a, std::string b) {
+  while (a.size() > 1 && a.back() == '/') a.pop_back();
+  while (b.size() > 1 && b.back() == '/') b.pop_back();
+  return a == b;
+}
+
+std::string Config::dbPathsString() {
+  std::string paths;
+  for (const auto &path : rocksdb_options.db_paths) {
+    if (!paths.empty()) paths.append(",");
+    paths.append(path.first + ":" + std::to_string(path.second / MiB));
+  }
+  return paths;
+}
+
+Status Config::parseCompressionPerLevel(const std::string &value) {
+  std::vector<std::string> names;
+  Util::Split(value, ":", &names);
+  std::vector<rocksdb::CompressionType> compressions;
+  for (const auto &name : names) {
+    size_t i = 0;
+    for (; i < kNumCompressionType; i++) {
+      if (Util::ToLower(name) == kCompressionType[i]) break;
+    }
+    if (i == kNumCompressionType) return Status(Status::NotOK, "unknown compression: " + name);
+    compressions.emplace_back(static_cast<rocksdb::CompressionType>(i));
+  }
+  rocksdb_options.compression_per_level = std::move(compressions);
+  return Status::OK();
+}
+
+std::string Config::compressionPerLevelString() {
+  std::string compressions;
+  for (const auto &compression : rocksdb_options.compression_per_level) {
+    if (!compressions.empty()) compressions.append(":");
+    compressions.append(kCompressionType[compression]);
+  }
+  return compressions;
+}
+
+bool Config::IsCompactionCheckerTime(int hour) {
+  int start = compaction_checker_range_start, stop = compaction_checker_range_stop;
+  if (start < 0 || stop < 0) return false;
+  if (start <= stop) return hour >= start && hour <= stop;
+  return hour >= start || hour <= stop;
+}
+
+static const char *kClientClassNames[kNumClientClasses] = {"normal", "pubsub", "monitor"};
+
+Status Config::parseClientOutputBufferLimit(const std::vector<std::string> &args) {
+  if (args.empty() || args.size() % 4 != 0) {
+    return Status(Status::NotOK, "client-output-buffer-limit should be like: pubsub 32 8 60");
+  }
+  // validate all the classes before applying any of them
+  std::vector<std::pair<int, ClientOutputBufferLimit>> limits;
+  for (size_t i = 0; i < args.size(); i += 4) {
+    int client_class = -1;
+    for (int j = 0; j < kNumClientClasses; j++) {
+      if (Util::ToLower(args[i]) == kClientClassNames[j]) client_class = j;
+    }
+    if (client_class < 0) {
+      return Status(Status::NotOK, "the client class should be normal, pubsub or monitor");
+    }
+    int64_t hard, soft, seconds;
+    auto s = Util::StringToNum(args[i+1], &hard, 0);
+    if (!s.IsOK()) return s;
+    s = Util::StringToNum(args[i+2], &soft, 0);
+    if (!s.IsOK()) return s;
+    s = Util::StringToNum(args[i+3], &seconds, 0, INT_MAX);
+    if (!s.IsOK()) return s;
+    limits.emplace_back(client_class, ClientOutputBufferLimit{static_cast<uint64_t>(hard),
+                                                              static_cast<uint64_t>(soft),
+                                                              static_cast<int>(seconds)});
+  }
+  for (const auto &limit : limits) {
+    client_output_buffer_limits[limit.first] = limit.second;
+  }
+  return Status::OK();
+}
+
+std::string Config::clientOutputBufferLimitString(int client_class) {
+  std::string output;
+  for (int i = 0; i < kNumClientClasses; i++) {
+    if (client_class >= 0 && i != client_class) continue;
+    const auto &limit = client_output_buffer_limits[i];
+    if (!output.empty()) output.append(" ");
+    output.append(std::string(kClientClassNames[i]) + " " + std::to_string(limit.hard_limit_mb) + " "
+                      + std::to_string(limit.soft_limit_mb) + " " + std::to_string(limit.soft_limit_seconds));
+  }
+  return output;
+}
+
 int Config::yesnotoi(std::string input) {
   if (strcasecmp(input.data(), "yes") == 0) {
     return 1;
@@ -91,6 +231,10 @@ int Config::yesnotoi(std::string input) {
 }
 
 Status Config::parseRocksdbOption(const std::string &key, std::string value) {
+  auto pos = key.find('.');
+  if (pos != std::string::npos) {
+    return parseTypeCFOption(key.substr(0, pos), key.substr(pos + 1), value);
+  }
   if (key == "compression") {
     for (size_t i = 0; i < kNumCompressionType; i++) {
       if (Util::ToLower(value) == kCompressionType[i]) {
@@ -100,17 +244,107 @@ Status Config::parseRocksdbOption(const std::string &key, std::string value) {
     }
   } else if (key == "enable_pipelined_write")  {
     rocksdb_options.enable_pipelined_write = value == "yes";
+  } else if (key == "block_cache_type") {
+    if (Util::ToLower(value) == "lru") {
+      rocksdb_options.block_cache_clock = false;
+    } else if (Util::ToLower(value) == "clock") {
+      rocksdb_options.block_cache_clock = true;
+    } else {
+      return Status(Status::NotOK, "block_cache_type should be 'lru' or 'clock'");
+    }
+  } else if (key == "use_direct_reads" || key == "use_direct_io_for_flush_and_compaction"
+             || key == "use_adaptive_mutex" || key == "partitioned_index_and_filters"
+             || key == "pin_top_level_index_and_filter" || key == "optimize_filters_for_hits"
+             || key == "metadata_memtable_bloom" || key == "data_block_hash_index") {
+    int i;
+    if ((i = yesnotoi(value)) == -1) {
+      return Status(Status::NotOK, "argument must be 'yes' or 'no'");
+    }
+    if (key == "use_direct_reads") {
+      rocksdb_options.use_direct_reads = (i == 1);
+    } else if (key == "use_direct_io_for_flush_and_compaction") {
+      rocksdb_options.use_direct_io_for_flush_and_compaction = (i == 1);
+    } else if (key == "partitioned_index_and_filters") {
+      rocksdb_options.partitioned_index_and_filters = (i == 1);
+    } else if (key == "pin_top_level_index_and_filter") {
+      rocksdb_options.pin_top_level_index_and_filter = (i == 1);
+    } else if (key == "optimize_filters_for_hits") {
+      rocksdb_options.optimize_filters_for_hits = (i == 1);
+    } else if (key == "metadata_memtable_bloom") {
+      rocksdb_options.metadata_memtable_bloom = (i == 1);
+    } else if (key == "data_block_hash_index") {
+      rocksdb_options.data_block_hash_index = (i == 1);
+    } else {
+      rocksdb_options.use_adaptive_mutex = (i == 1);
+    }
+  } else if (key == "db_paths") {
+    return parseDBPaths(value);
+  } else if (key == "compression_per_level") {
+    return parseCompressionPerLevel(value);
+  } else if (key == "block_cache_strict_capacity") {
+    int i;
+    if ((i = yesnotoi(value)) == -1) {
+      return Status(Status::NotOK, "argument must be 'yes' or 'no'");
+    }
+    rocksdb_options.block_cache_strict_capacity = (i == 1);
+  } else if (key == "block_cache_high_pri_pool_ratio") {
+    char *end = nullptr;
+    double ratio = strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || ratio < 0 || ratio > 1) {
+      return Status(Status::NotOK, "block_cache_high_pri_pool_ratio value should between 0 and 1");
+    }
+    rocksdb_options.block_cache_high_pri_pool_ratio = ratio;
   } else {
     return parseRocksdbIntOption(key, value);
   }
   return Status::OK();
 }
 
+Status Config::parseTypeCFOption(const std::string &cf_name, const std::string &key, const std::string &value) {
+  auto iter = rocksdb_options.type_cf_options.find(cf_name);
+  if (iter == rocksdb_options.type_cf_options.end()) {
+    return Status(Status::NotOK, "unknown column family: " + cf_name);
+  }
+  auto cf_options = &iter->second;
+  if (key == "compression") {
+    for (size_t i = 0; i < kNumCompressionType; i++) {
+      if (Util::ToLower(value) == kCompressionType[i]) {
+        cf_options->compression = static_cast<int>(i);
+        return Status::OK();
+      }
+    }
+    return Status(Status::NotOK, "unknown compression type: " + value);
+  } else if (key == "compaction_style") {
+    if (Util::ToLower(value) == "level") {
+      cf_options->universal_compaction = false;
+    } else if (Util::ToLower(value) == "universal") {
+      cf_options->universal_compaction = true;
+    } else {
+      return Status(Status::NotOK, "compaction_style should be 'level' or 'universal'");
+    }
+  } else if (key == "block_size") {
+    int64_t n;
+    auto s = Util::StringToNum(value, &n, 1 * KiB, 64 * MiB);
+    if (!s.IsOK()) return s;
+    cf_options->block_size = static_cast<int>(n);
+  } else if (key == "bloom_bits") {
+    int64_t n;
+    auto s = Util::StringToNum(value, &n, 0, 64);
+    if (!s.IsOK()) return s;
+    cf_options->bloom_bits = static_cast<int>(n);
+  } else {
+    return Status(Status::NotOK, "Bad directive or wrong number of arguments");
+  }
+  return Status::OK();
+}
+
 Status Config::parseRocksdbIntOption(std::string key, std::string value) {
   int64_t n;
   auto s = Util::StringToNum(value, &n);
   if (key == "max_open_files") {
     rocksdb_options.max_open_files = static_cast<int>(n);
+  } else if (key == "max_file_opening_threads") {
+    rocksdb_options.max_file_opening_threads = static_cast<int>(n);
   } else if (!strncasecmp(key.data(), "write_buffer_size" , strlen("write_buffer_size"))) {
     rocksdb_options.write_buffer_size = static_cast<size_t>(n) * MiB;
   }  else if (key == "max_write_buffer_number") {
@@ -129,10 +363,20 @@ Status Config::parseRocksdbIntOption(std::string key, std::string value) {
     rocksdb_options.metadata_block_cache_size = static_cast<size_t>(n) * MiB;
   } else if (key == "subkey_block_cache_size") {
     rocksdb_options.subkey_block_cache_size = static_cast<size_t>(n) * MiB;
+  } else if (key == "shared_block_cache_size") {
+    rocksdb_options.shared_block_cache_size = static_cast<size_t>(n) * MiB;
+  } else if (key == "compressed_block_cache_size") {
+    rocksdb_options.compressed_block_cache_size = static_cast<size_t>(n) * MiB;
   } else if (key == "delayed_write_rate") {
     rocksdb_options.delayed_write_rate = static_cast<uint64_t>(n);
   } else if (key == "compaction_readahead_size") {
     rocksdb_options.compaction_readahead_size = static_cast<size_t>(n);
+  } else if (key == "scan_readahead_size") {
+    rocksdb_options.scan_readahead_size = static_cast<size_t>(n);
+  } else if (key == "bytes_per_sync") {
+    rocksdb_options.bytes_per_sync = static_cast<uint64_t>(n);
+  } else if (key == "wal_bytes_per_sync") {
+    rocksdb_options.wal_bytes_per_sync = static_cast<uint64_t>(n);
   } else if (key == "wal_ttl_seconds") {
     rocksdb_options.WAL_ttl_seconds = static_cast<uint64_t>(n);
   } else if (key == "wal_size_limit_mb") {
@@ -140,6 +384,9 @@ Status Config::parseRocksdbIntOption(std::string key, std::string value) {
   } else if (key == "level0_slowdown_writes_trigger") {
     rocksdb_options.level0_slowdown_writes_trigger = static_cast<int>(n);
     rocksdb_options.level0_stop_writes_trigger = static_cast<int>(n*2);
+  } else if (key == "level0_stop_writes_trigger") {
+    // should follow the level0_slowdown_writes_trigger which resets it
+    rocksdb_options.level0_stop_writes_trigger = static_cast<int>(n);
   } else {
     return Status(Status::NotOK, "Bad directive or wrong number of arguments");
   }
@@ -157,6 +404,11 @@ Status Config::parseConfigFromString(std::string input) {
   if (size == 2 && args[0] == "port") {
     port = std::atoi(args[1].c_str());
     repl_port = port + 1;
+  } else if (size == 2 && args[0] == "metrics-port") {
+    metrics_port = std::atoi(args[1].c_str());
+    if (metrics_port < 0 || metrics_port > 65535) {
+      return Status(Status::NotOK, "metrics-port value should between 0 and 65535");
+    }
   } else if (size == 2 && args[0] == "timeout") {
     timeout = std::atoi(args[1].c_str());
   } else if (size == 2 && args[0] == "workers") {
@@ -169,6 +421,20 @@ Status Config::parseConfigFromString(std::string input) {
     if (workers < 1 || workers > 1024) {
       return Status(Status::NotOK, "too many replication worker threads");
     }
+  } else if (size == 2 && args[0] == "slow-command-threads") {
+    slow_command_threads = std::atoi(args[1].c_str());
+    if (slow_command_threads < 0 || slow_command_threads > 256) {
+      return Status(Status::NotOK, "slow-command-threads value should between 0 and 256");
+    }
+  } else if (size == 2 && args[0] == "io-read-threads") {
+    io_read_threads = std::atoi(args[1].c_str());
+    if (io_read_threads < 0 || io_read_threads > 256) {
+      return Status(Status::NotOK, "io-read-threads value should between 0 and 256");
+    }
+  } else if (size == 2 && args[0] == "worker-cpu-affinity") {
+    auto s = Util::ParseCPUList(args[1], &worker_cpus);
+    if (!s.IsOK()) return s;
+    worker_cpu_affinity = args[1];
   } else if (size >= 2 && args[0] == "bind") {
     binds.clear();
     for (unsigned i = 1; i < args.size(); i++) {
@@ -195,6 +461,31 @@ Status Config::parseConfigFromString(std::string input) {
     slave_priority = std::atoi(args[1].c_str());
   } else if (size == 2 && args[0] == "tcp-backlog") {
     backlog = std::atoi(args[1].c_str());
+  } else if (size == 2 && args[0] == "unixsocket") {
+    unixsocket = args[1];
+  } else if (size == 2 && args[0] == "unixsocketperm") {
+    char *end = nullptr;
+    unixsocketperm = static_cast<int>(std::strtol(args[1].c_str(), &end, 8));
+    if (*end != '\0' || unixsocketperm < 0 || unixsocketperm > 0777) {
+      return Status(Status::NotOK, "unixsocketperm should be the octal permission like 700");
+    }
+  } else if (size == 2 && args[0] == "tcp-nodelay") {
+    int i;
+    if ((i = yesnotoi(args[1])) == -1) {
+      return Status(Status::NotOK, "argument must be 'yes' or 'no'");
+    }
+    tcp_nodelay = (i == 1);
+  } else if (size == 2 && (args[0] == "tcp-sndbuf" || args[0] == "tcp-rcvbuf" || args[0] == "tcp-defer-accept")) {
+    int64_t n;
+    auto s = Util::StringToNum(args[1], &n, 0, INT_MAX);
+    if (!s.IsOK()) return Status(Status::NotOK, args[0] + " should be a non-negative integer");
+    if (args[0] == "tcp-sndbuf") {
+      tcp_sndbuf = static_cast<int>(n);
+    } else if (args[0] == "tcp-rcvbuf") {
+      tcp_rcvbuf = static_cast<int>(n);
+    } else {
+      tcp_defer_accept = static_cast<int>(n);
+    }
   } else if (size == 2 && args[0] == "dir") {
     dir = args[1];
     db_dir = dir + "/db";
@@ -210,6 +501,13 @@ Status Config::parseConfigFromString(std::string input) {
     masterauth = args[1];
   } else if (size == 2 && args[0] == "max-backup-to-keep") {
     max_backup_to_keep = static_cast<uint32_t>(std::atoi(args[1].c_str()));
+  } else if (size == 2 && args[0] == "max-backup-mb") {
+    max_backup_mb = static_cast<uint64_t>(std::atoi(args[1].c_str()));
+  } else if (size == 2 && args[0] == "backup-threads") {
+    backup_threads = std::atoi(args[1].c_str());
+    if (backup_threads < 1 || backup_threads > 64) {
+      return Status(Status::NotOK, "backup-threads value should between 1 and 64");
+    }
   } else if (size == 2 && args[0] == "max-backup-keep-hours") {
     max_backup_keep_hours = static_cast<uint32_t>(std::atoi(args[1].c_str()));
   } else if (size == 2 && args[0] == "requirepass") {
@@ -233,16 +531,138 @@ Status Config::parseConfigFromString(std::string input) {
     }
   } else if (size == 2 && args[0] == "max-db-size") {
     max_db_size = static_cast<uint32_t>(std::atoi(args[1].c_str()));
+  } else if (size == 2 && args[0] == "active-expire-keys-per-sec") {
+    active_expire_keys_per_sec = std::atoi(args[1].c_str());
+    if (active_expire_keys_per_sec < 0) {
+      return Status(Status::NotOK, "active_expire_keys_per_sec value should be >= 0");
+    }
   } else if (size == 2 && args[0] == "max-replication-mb") {
     max_replication_mb = static_cast<uint64_t>(std::atoi(args[1].c_str()));
   } else if (size == 2 && args[0] == "max-io-mb") {
     max_io_mb = static_cast<uint64_t>(std::atoi(args[1].c_str()));
+  } else if (size == 2 && args[0] == "metadata-cache-size") {
+    metadata_cache_size = static_cast<size_t>(std::atoll(args[1].c_str())) * MiB;
+  } else if (size == 2 && args[0] == "scan-iterator-cache-size") {
+    scan_iterator_cache_size = std::atoi(args[1].c_str());
+    if (scan_iterator_cache_size < 0 || scan_iterator_cache_size > 65536) {
+      return Status(Status::NotOK, "scan-iterator-cache-size value should between 0 and 65536");
+    }
+  } else if (size == 2 && args[0] == "write-stall-max-wait-ms") {
+    write_stall_max_wait_ms = std::atoi(args[1].c_str());
+    if (write_stall_max_wait_ms < 0 || write_stall_max_wait_ms > 60000) {
+      return Status(Status::NotOK, "write-stall-max-wait-ms value should between 0 and 60000");
+    }
+  } else if (size == 2 && args[0] == "repl-wait-max-ms") {
+    repl_wait_max_ms = std::atoi(args[1].c_str());
+    if (repl_wait_max_ms < 0 || repl_wait_max_ms > 60000) {
+      return Status(Status::NotOK, "repl-wait-max-ms value should between 0 and 60000");
+    }
+  } else if (size == 2 && args[0] == "repl-min-ack-slaves") {
+    repl_min_ack_slaves = std::atoi(args[1].c_str());
+    if (repl_min_ack_slaves < 0 || repl_min_ack_slaves > 64) {
+      return Status(Status::NotOK, "repl-min-ack-slaves value should between 0 and 64");
+    }
+  } else if (size == 2 && args[0] == "repl-ack-timeout-ms") {
+    repl_ack_timeout_ms = std::atoi(args[1].c_str());
+    if (repl_ack_timeout_ms < 0 || repl_ack_timeout_ms > 60000) {
+      return Status(Status::NotOK, "repl-ack-timeout-ms value should between 0 and 60000");
+    }
+  } else if (size == 2 && args[0] == "warmup-max-keys") {
+    warmup_max_keys = std::atoi(args[1].c_str());
+    if (warmup_max_keys < 0) {
+      return Status(Status::NotOK, "warmup-max-keys value should be >= 0");
+    }
+  } else if (size == 2 && args[0] == "tracking-table-max-keys") {
+    tracking_table_max_keys = std::atoi(args[1].c_str());
+    if (tracking_table_max_keys < 0) {
+      return Status(Status::NotOK, "tracking-table-max-keys value should be >= 0");
+    }
+  } else if (size == 2 && args[0] == "warmup-keys-per-sec") {
+    warmup_keys_per_sec = std::atoi(args[1].c_str());
+    if (warmup_keys_per_sec < 1) {
+      return Status(Status::NotOK, "warmup-keys-per-sec value should be > 0");
+    }
+  } else if (size == 2 && args[0] == "lua-time-limit") {
+    lua_time_limit = std::atoi(args[1].c_str());
+    if (lua_time_limit < 0) {
+      return Status(Status::NotOK, "lua-time-limit value should be >= 0");
+    }
+  } else if (size == 2 && args[0] == "streaming-reply-min-elements") {
+    streaming_reply_min_elements = std::atoi(args[1].c_str());
+    if (streaming_reply_min_elements < 0) {
+      return Status(Status::NotOK, "streaming-reply-min-elements value should be >= 0");
+    }
+  } else if (size == 2 && args[0] == "zset-rank-index") {
+    int i;
+    if ((i = yesnotoi(args[1])) == -1) {
+      return Status(Status::NotOK, "argument must be 'yes' or 'no'");
+    }
+    zset_rank_index = (i == 1);
+  } else if (size == 2 && args[0] == "type-column-families") {
+    int i;
+    if ((i = yesnotoi(args[1])) == -1) {
+      return Status(Status::NotOK, "argument must be 'yes' or 'no'");
+    }
+    type_column_families = (i == 1);
+  } else if (size == 2 && args[0] == "list-chunk-size") {
+    list_chunk_size = std::atoi(args[1].c_str());
+    if (list_chunk_size < 0 || list_chunk_size > 65536) {
+      return Status(Status::NotOK, "list-chunk-size value should between 0 and 65536");
+    }
+  } else if (size == 2 && args[0] == "sortedint-block-size") {
+    sortedint_block_size = std::atoi(args[1].c_str());
+    if (sortedint_block_size < 0 || sortedint_block_size > 65536) {
+      return Status(Status::NotOK, "sortedint-block-size value should between 0 and 65536");
+    }
+  } else if (size == 2 && args[0] == "hash-inline-max-entries") {
+    hash_inline_max_entries = std::atoi(args[1].c_str());
+    if (hash_inline_max_entries < 0 || hash_inline_max_entries > 1024) {
+      return Status(Status::NotOK, "hash-inline-max-entries value should between 0 and 1024");
+    }
+  } else if (size == 2 && args[0] == "hash-inline-max-value") {
+    hash_inline_max_value = std::atoi(args[1].c_str());
+    if (hash_inline_max_value < 0 || hash_inline_max_value > 65536) {
+      return Status(Status::NotOK, "hash-inline-max-value value should between 0 and 65536");
+    }
+  } else if (size == 2 && args[0] == "counter-merge-mode") {
+    int i;
+    if ((i = yesnotoi(args[1])) == -1) {
+      return Status(Status::NotOK, "argument must be 'yes' or 'no'");
+    }
+    counter_merge_mode = (i == 1);
+  } else if (size == 2 && args[0] == "string-blob-min-size") {
+    string_blob_min_size = std::atoi(args[1].c_str());
+    if (string_blob_min_size < 0) {
+      return Status(Status::NotOK, "string-blob-min-size value should be >= 0");
+    }
   } else if (size >= 2 && args[0] == "compact-cron") {
     args.erase(args.begin());
     Status s = compact_cron.SetScheduleTime(args);
     if (!s.IsOK()) {
       return Status(Status::NotOK, "compact-cron time expression format error : "+s.Msg());
     }
+  } else if (size == 2 && args[0] == "compaction-checker-range") {
+    Status s = parseCompactionCheckerRange(args[1]);
+    if (!s.IsOK()) return s;
+  } else if (size == 2 && args[0] == "io-rate-limit-peak-qps") {
+    io_rate_limit_peak_qps = std::atoi(args[1].c_str());
+    if (io_rate_limit_peak_qps < 0) {
+      return Status(Status::NotOK, "io-rate-limit-peak-qps value should be >= 0");
+    }
+  } else if (size == 2 && args[0] == "namespace-max-qps") {
+    namespace_max_qps = std::atoi(args[1].c_str());
+    if (namespace_max_qps < 0) {
+      return Status(Status::NotOK, "namespace-max-qps value should be >= 0");
+    }
+  } else if (size == 2 && args[0] == "namespace-max-net-out-mb") {
+    namespace_max_net_out_mb = std::atoi(args[1].c_str());
+    if (namespace_max_net_out_mb < 0) {
+      return Status(Status::NotOK, "namespace-max-net-out-mb value should be >= 0");
+    }
+  } else if (size == 5 && args[0] == "client-output-buffer-limit") {
+    args.erase(args.begin());
+    Status s = parseClientOutputBufferLimit(args);
+    if (!s.IsOK()) return s;
   } else if (size >=2 && args[0] == "bgsave-cron") {
     args.erase(args.begin());
     Status s = bgsave_cron.SetScheduleTime(args);
@@ -254,6 +674,23 @@ Status Config::parseConfigFromString(std::string input) {
     if (profiling_sample_ratio < 0 || profiling_sample_ratio > 100) {
       return Status(Status::NotOK, "profiling_sample_ratio value should between 0 and 100");
     }
+  } else if (size == 2 && args[0] == "perf-stats-sample-ratio") {
+    perf_stats_sample_ratio = std::atoi(args[1].c_str());
+    if (perf_stats_sample_ratio < 0 || perf_stats_sample_ratio > 100) {
+      return Status(Status::NotOK, "perf_stats_sample_ratio value should between 0 and 100");
+    }
+  } else if (size == 2 && args[0] == "trace-sample-ratio") {
+    trace_sample_ratio = std::atoi(args[1].c_str());
+    if (trace_sample_ratio < 0 || trace_sample_ratio > 100) {
+      return Status(Status::NotOK, "trace_sample_ratio value should between 0 and 100");
+    }
+  } else if (size == 2 && args[0] == "trace-max-len") {
+    trace_max_len = std::atoi(args[1].c_str());
+  } else if (size == 2 && args[0] == "hotkeys-sample-ratio") {
+    hotkeys_sample_ratio = std::atoi(args[1].c_str());
+    if (hotkeys_sample_ratio < 0 || hotkeys_sample_ratio > 100) {
+      return Status(Status::NotOK, "hotkeys_sample_ratio value should between 0 and 100");
+    }
   } else if (size == 2 && args[0] == "profiling-sample-record-max-len") {
     profiling_sample_record_max_len = std::atoi(args[1].c_str());
   } else if (size == 2 && args[0] == "profiling-sample-record-threshold-ms") {
@@ -322,6 +759,11 @@ Status Config::Load(std::string path) {
     file.close();
     return Status(Status::NotOK, "requirepass was required when namespace isn't empty");
   }
+  // the restores of the slave only write the sst files into the db-dir, which must be the first path
+  if (!rocksdb_options.db_paths.empty() && !isSamePath(rocksdb_options.db_paths[0].first, db_dir)) {
+    file.close();
+    return Status(Status::NotOK, "the first path of the rocksdb.db_paths must be the db-dir: " + db_dir);
+  }
   auto s = rocksdb::Env::Default()->CreateDirIfMissing(dir);
   if (!s.ok()) {
     file.close();
@@ -368,9 +810,19 @@ void Config::Get(std::string key, std::vector<std::string> *values) {
   PUSH_IF_MATCH("db-dir", db_dir);
   PUSH_IF_MATCH("backup-dir", backup_dir);
   PUSH_IF_MATCH("port", std::to_string(port));
+  PUSH_IF_MATCH("metrics-port", std::to_string(metrics_port));
   PUSH_IF_MATCH("workers", std::to_string(workers));
+  PUSH_IF_MATCH("slow-command-threads", std::to_string(slow_command_threads));
+  PUSH_IF_MATCH("io-read-threads", std::to_string(io_read_threads));
+  PUSH_IF_MATCH("worker-cpu-affinity", worker_cpu_affinity);
   PUSH_IF_MATCH("timeout", std::to_string(timeout));
   PUSH_IF_MATCH("tcp-backlog", std::to_string(backlog));
+  PUSH_IF_MATCH("unixsocket", unixsocket);
+  PUSH_IF_MATCH("unixsocketperm", unixsocketPermString());
+  PUSH_IF_MATCH("tcp-nodelay", (tcp_nodelay ? "yes" : "no"));
+  PUSH_IF_MATCH("tcp-sndbuf", std::to_string(tcp_sndbuf));
+  PUSH_IF_MATCH("tcp-rcvbuf", std::to_string(tcp_rcvbuf));
+  PUSH_IF_MATCH("tcp-defer-accept", std::to_string(tcp_defer_accept));
   PUSH_IF_MATCH("daemonize", (daemonize ? "yes" : "no"));
   PUSH_IF_MATCH("supervised", configEnumGetName(supervised_mode_enum, supervised_mode));
   PUSH_IF_MATCH("maxclients", std::to_string(maxclients));
@@ -378,7 +830,14 @@ void Config::Get(std::string key, std::vector<std::string> *values) {
   PUSH_IF_MATCH("slave-priority", std::to_string(slave_priority));
   PUSH_IF_MATCH("max-backup-to-keep", std::to_string(max_backup_to_keep));
   PUSH_IF_MATCH("max-backup-keep-hours", std::to_string(max_backup_keep_hours));
+  PUSH_IF_MATCH("max-backup-mb", std::to_string(max_backup_mb));
+  PUSH_IF_MATCH("backup-threads", std::to_string(backup_threads));
   PUSH_IF_MATCH("compact-cron", compact_cron.ToString());
+  PUSH_IF_MATCH("compaction-checker-range", compactionCheckerRangeString());
+  PUSH_IF_MATCH("io-rate-limit-peak-qps", std::to_string(io_rate_limit_peak_qps));
+  PUSH_IF_MATCH("namespace-max-qps", std::to_string(namespace_max_qps));
+  PUSH_IF_MATCH("namespace-max-net-out-mb", std::to_string(namespace_max_net_out_mb));
+  PUSH_IF_MATCH("client-output-buffer-limit", clientOutputBufferLimitString());
   PUSH_IF_MATCH("bgsave-cron", bgsave_cron.ToString());
   PUSH_IF_MATCH("loglevel", kLogLevels[loglevel]);
   PUSH_IF_MATCH("requirepass", requirepass);
@@ -388,21 +847,67 @@ void Config::Get(std::string key, std::vector<std::string> *values) {
   PUSH_IF_MATCH("db-name", db_name);
   PUSH_IF_MATCH("binds", binds_str);
   PUSH_IF_MATCH("max-io-mb", std::to_string(max_io_mb));
+  PUSH_IF_MATCH("metadata-cache-size", std::to_string(metadata_cache_size/MiB));
+  PUSH_IF_MATCH("scan-iterator-cache-size", std::to_string(scan_iterator_cache_size));
+  PUSH_IF_MATCH("write-stall-max-wait-ms", std::to_string(write_stall_max_wait_ms));
+  PUSH_IF_MATCH("repl-wait-max-ms", std::to_string(repl_wait_max_ms));
+  PUSH_IF_MATCH("repl-min-ack-slaves", std::to_string(repl_min_ack_slaves));
+  PUSH_IF_MATCH("repl-ack-timeout-ms", std::to_string(repl_ack_timeout_ms));
+  PUSH_IF_MATCH("warmup-max-keys", std::to_string(warmup_max_keys));
+  PUSH_IF_MATCH("warmup-keys-per-sec", std::to_string(warmup_keys_per_sec));
+  PUSH_IF_MATCH("tracking-table-max-keys", std::to_string(tracking_table_max_keys));
+  PUSH_IF_MATCH("streaming-reply-min-elements", std::to_string(streaming_reply_min_elements));
+  PUSH_IF_MATCH("lua-time-limit", std::to_string(lua_time_limit));
+  PUSH_IF_MATCH("zset-rank-index", (zset_rank_index ? "yes" : "no"));
+  PUSH_IF_MATCH("list-chunk-size", std::to_string(list_chunk_size));
+  PUSH_IF_MATCH("sortedint-block-size", std::to_string(sortedint_block_size));
+  PUSH_IF_MATCH("hash-inline-max-entries", std::to_string(hash_inline_max_entries));
+  PUSH_IF_MATCH("hash-inline-max-value", std::to_string(hash_inline_max_value));
+  PUSH_IF_MATCH("counter-merge-mode", (counter_merge_mode ? "yes" : "no"));
+  PUSH_IF_MATCH("string-blob-min-size", std::to_string(string_blob_min_size));
+  PUSH_IF_MATCH("type-column-families", (type_column_families ? "yes" : "no"));
   PUSH_IF_MATCH("max-db-size", std::to_string(max_db_size));
+  PUSH_IF_MATCH("active-expire-keys-per-sec", std::to_string(active_expire_keys_per_sec));
   PUSH_IF_MATCH("slowlog-max-len", std::to_string(slowlog_max_len));
   PUSH_IF_MATCH("max-replication-mb", std::to_string(max_replication_mb));
   PUSH_IF_MATCH("profiling-sample-commands", sample_commands_str);
   PUSH_IF_MATCH("profiling-sample-ratio", std::to_string(profiling_sample_ratio));
   PUSH_IF_MATCH("profiling-sample-record-max-len", std::to_string(profiling_sample_record_max_len));
   PUSH_IF_MATCH("profiling-sample-record-threshold-ms", std::to_string(profiling_sample_record_threshold_ms));
+  PUSH_IF_MATCH("perf-stats-sample-ratio", std::to_string(perf_stats_sample_ratio));
+  PUSH_IF_MATCH("trace-sample-ratio", std::to_string(trace_sample_ratio));
+  PUSH_IF_MATCH("trace-max-len", std::to_string(trace_max_len));
+  PUSH_IF_MATCH("hotkeys-sample-ratio", std::to_string(hotkeys_sample_ratio));
   PUSH_IF_MATCH("slowlog-log-slower-than", std::to_string(slowlog_log_slower_than));
   PUSH_IF_MATCH("rocksdb.max_open_files", std::to_string(rocksdb_options.max_open_files));
+  PUSH_IF_MATCH("rocksdb.max_file_opening_threads", std::to_string(rocksdb_options.max_file_opening_threads));
   PUSH_IF_MATCH("rocksdb.write_buffer_size", std::to_string(rocksdb_options.write_buffer_size/MiB));
   PUSH_IF_MATCH("rocksdb.max_write_buffer_number", std::to_string(rocksdb_options.max_write_buffer_number));
   PUSH_IF_MATCH("rocksdb.max_background_compactions", std::to_string(rocksdb_options.max_background_compactions));
   PUSH_IF_MATCH("rocksdb.metadata_block_cache_size", std::to_string(rocksdb_options.metadata_block_cache_size/MiB));
   PUSH_IF_MATCH("rocksdb.subkey_block_cache_size", std::to_string(rocksdb_options.subkey_block_cache_size/MiB));
+  PUSH_IF_MATCH("rocksdb.shared_block_cache_size", std::to_string(rocksdb_options.shared_block_cache_size/MiB));
+  PUSH_IF_MATCH("rocksdb.compressed_block_cache_size",
+                std::to_string(rocksdb_options.compressed_block_cache_size/MiB));
+  PUSH_IF_MATCH("rocksdb.block_cache_type", (rocksdb_options.block_cache_clock ? "clock" : "lru"));
+  PUSH_IF_MATCH("rocksdb.block_cache_strict_capacity", (rocksdb_options.block_cache_strict_capacity ? "yes" : "no"));
+  PUSH_IF_MATCH("rocksdb.block_cache_high_pri_pool_ratio",
+                std::to_string(rocksdb_options.block_cache_high_pri_pool_ratio));
   PUSH_IF_MATCH("rocksdb.compaction_readahead_size", std::to_string(rocksdb_options.compaction_readahead_size));
+  PUSH_IF_MATCH("rocksdb.scan_readahead_size", std::to_string(rocksdb_options.scan_readahead_size));
+  PUSH_IF_MATCH("rocksdb.use_direct_reads", (rocksdb_options.use_direct_reads ? "yes" : "no"));
+  PUSH_IF_MATCH("rocksdb.use_direct_io_for_flush_and_compaction",
+                (rocksdb_options.use_direct_io_for_flush_and_compaction ? "yes" : "no"));
+  PUSH_IF_MATCH("rocksdb.bytes_per_sync", std::to_string(rocksdb_options.bytes_per_sync));
+  PUSH_IF_MATCH("rocksdb.wal_bytes_per_sync", std::to_string(rocksdb_options.wal_bytes_per_sync));
+  PUSH_IF_MATCH("rocksdb.use_adaptive_mutex", (rocksdb_options.use_adaptive_mutex ? "yes" : "no"));
+  PUSH_IF_MATCH("rocksdb.partitioned_index_and_filters",
+                (rocksdb_options.partitioned_index_and_filters ? "yes" : "no"));
+  PUSH_IF_MATCH("rocksdb.pin_top_level_index_and_filter",
+                (rocksdb_options.pin_top_level_index_and_filter ? "yes" : "no"));
+  PUSH_IF_MATCH("rocksdb.optimize_filters_for_hits", (rocksdb_options.optimize_filters_for_hits ? "yes" : "no"));
+  PUSH_IF_MATCH("rocksdb.metadata_memtable_bloom", (rocksdb_options.metadata_memtable_bloom ? "yes" : "no"));
+  PUSH_IF_MATCH("rocksdb.data_block_hash_index", (rocksdb_options.data_block_hash_index ? "yes" : "no"));
   PUSH_IF_MATCH("rocksdb.max_background_flushes", std::to_string(rocksdb_options.max_background_flushes));
   PUSH_IF_MATCH("rocksdb.enable_pipelined_write", (rocksdb_options.enable_pipelined_write ? "yes": "no"))
   PUSH_IF_MATCH("rocksdb.stats_dump_period_sec", std::to_string(rocksdb_options.stats_dump_period_sec));
@@ -415,54 +920,122 @@ void Config::Get(std::string key, std::vector<std::string> *values) {
                 std::to_string(rocksdb_options.level0_slowdown_writes_trigger));
   PUSH_IF_MATCH("rocksdb.level0_stop_writes_trigger", std::to_string(rocksdb_options.level0_stop_writes_trigger));
   PUSH_IF_MATCH("rocksdb.compression", kCompressionType[rocksdb_options.compression]);
+  PUSH_IF_MATCH("rocksdb.compression_per_level", compressionPerLevelString());
+  PUSH_IF_MATCH("rocksdb.db_paths", dbPathsString());
+  for (const auto &iter : rocksdb_options.type_cf_options) {
+    const auto &cf_options = iter.second;
+    std::string prefix = "rocksdb." + iter.first + ".";
+    int compression = cf_options.compression >= 0 ? cf_options.compression : rocksdb_options.compression;
+    PUSH_IF_MATCH(prefix + "block_size", std::to_string(cf_options.block_size));
+    PUSH_IF_MATCH(prefix + "compression", kCompressionType[compression]);
+    PUSH_IF_MATCH(prefix + "bloom_bits", std::to_string(cf_options.bloom_bits));
+    PUSH_IF_MATCH(prefix + "compaction_style", (cf_options.universal_compaction ? "universal" : "level"));
+  }
 }
 
 Status Config::setRocksdbOption(Engine::Storage *storage, const std::string &key, const std::string &value) {
   int64_t i;
-  bool is_cf_mutal_option = false;
-  auto db = storage->GetDB();
   auto s = Util::StringToNum(value, &i, 0);
   if (!s.IsOK()) return s;
+  // the block caches in use are resized in place, but they can't be enabled or disabled in-flight
+  std::string cache_name;
+  if (key == "shared_block_cache_size") {
+    cache_name = "shared";
+  } else if (key == "metadata_block_cache_size") {
+    cache_name = "metadata";
+  } else if (key == "subkey_block_cache_size") {
+    cache_name = "subkey";
+  } else if (key == "compressed_block_cache_size") {
+    cache_name = "compressed";
+  }
+  // the scans read the option while creating the iterators, it's not a rocksdb option
+  if (key == "scan_readahead_size") {
+    rocksdb_options.scan_readahead_size = static_cast<size_t>(i);
+    return Status::OK();
+  }
+  if (!cache_name.empty()) {
+    if (i == 0) return Status(Status::NotOK, "the block cache can't be disabled in-flight");
+    auto capacity = static_cast<size_t>(i) * MiB;
+    s = storage->SetBlockCacheCapacity(cache_name, capacity);
+    if (!s.IsOK()) return s;
+    if (key == "shared_block_cache_size") {
+      rocksdb_options.shared_block_cache_size = capacity;
+    } else if (key == "metadata_block_cache_size") {
+      rocksdb_options.metadata_block_cache_size = capacity;
+    } else if (key == "subkey_block_cache_size") {
+      rocksdb_options.subkey_block_cache_size = capacity;
+    } else {
+      rocksdb_options.compressed_block_cache_size = capacity;
+    }
+    return Status::OK();
+  }
+
+  // the options are updated after the rocksdb accepts them
+  auto options = rocksdb_options;
+  std::unordered_map<std::string, std::string> db_options, cf_options;
   if (key == "stats_dump_period_sec") {
-    rocksdb_options.stats_dump_period_sec = static_cast<int>(i);
+    options.stats_dump_period_sec = static_cast<int>(i);
+    db_options[key] = value;
   } else if (key == "max_open_files") {
-    rocksdb_options.max_open_files = static_cast<int>(i);
+    options.max_open_files = static_cast<int>(i);
+    db_options[key] = value;
   } else if (key == "delayed_write_rate") {
-    rocksdb_options.delayed_write_rate = static_cast<uint64_t>(i);
+    options.delayed_write_rate = static_cast<uint64_t>(i);
+    db_options[key] = value;
   } else if (key == "max_background_compactions") {
-    rocksdb_options.max_background_compactions = static_cast<int>(i);
+    options.max_background_compactions = static_cast<int>(i);
+    db_options[key] = value;
   } else if (key == "max_background_flushes") {
-    rocksdb_options.max_background_flushes = static_cast<int>(i);
+    options.max_background_flushes = static_cast<int>(i);
+    db_options[key] = value;
   } else if (key == "compaction_readahead_size") {
-    rocksdb_options.compaction_readahead_size = static_cast<size_t>(i);
+    options.compaction_readahead_size = static_cast<size_t>(i);
+    db_options[key] = value;
+  } else if (key == "bytes_per_sync") {
+    options.bytes_per_sync = static_cast<uint64_t>(i);
+    db_options[key] = value;
+  } else if (key == "wal_bytes_per_sync") {
+    options.wal_bytes_per_sync = static_cast<uint64_t>(i);
+    db_options[key] = value;
   } else if (key == "target_file_size_base") {
-    is_cf_mutal_option = true;
-    rocksdb_options.target_file_size_base = static_cast<uint64_t>(i);
+    options.target_file_size_base = static_cast<uint64_t>(i);
+    cf_options[key] = value;
   } else if (key == "write_buffer_size") {
-    is_cf_mutal_option = true;
-    rocksdb_options.write_buffer_size = static_cast<uint64_t>(i*MiB);
+    // the config is in MiB, while the rocksdb option is in bytes
+    options.write_buffer_size = static_cast<uint64_t>(i * MiB);
+    cf_options[key] = std::to_string(options.write_buffer_size);
   } else if (key == "max_write_buffer_number") {
-    is_cf_mutal_option = true;
-    rocksdb_options.max_write_buffer_number =  static_cast<int>(i);
+    options.max_write_buffer_number = static_cast<int>(i);
+    cf_options[key] = value;
   } else if (key == "level0_slowdown_writes_trigger") {
-    is_cf_mutal_option = true;
-    rocksdb_options.level0_slowdown_writes_trigger = static_cast<int>(i);
-    rocksdb_options.level0_stop_writes_trigger = static_cast<int>(i * 2);
+    // the stop trigger follows the slowdown trigger as the InitOptions did
+    options.level0_slowdown_writes_trigger = static_cast<int>(i);
+    options.level0_stop_writes_trigger = static_cast<int>(i * 2);
+    cf_options[key] = value;
+    cf_options["level0_stop_writes_trigger"] = std::to_string(options.level0_stop_writes_trigger);
+  } else if (key == "level0_stop_writes_trigger") {
+    if (i < options.level0_slowdown_writes_trigger) {
+      return Status(Status::NotOK, "level0_stop_writes_trigger should be >= the level0_slowdown_writes_trigger");
+    }
+    options.level0_stop_writes_trigger = static_cast<int>(i);
+    cf_options[key] = value;
   } else {
     return Status(Status::NotOK, "option can't be set in-flight");
   }
+  auto db = storage->GetDB();
+  if (!db) return Status(Status::NotOK, "the db wasn't opened");
   rocksdb::Status r_status;
-  if (!is_cf_mutal_option) {
-    r_status = db->SetDBOptions({{key, value}});
+  if (!db_options.empty()) {
+    r_status = db->SetDBOptions(db_options);
   } else {
-    auto cf_handles = storage->GetCFHandles();
-    for (auto & cf_handle : cf_handles) {
-      r_status = db->SetOptions(cf_handle, {{key, value}});
+    for (auto &cf_handle : storage->GetCFHandles()) {
+      r_status = db->SetOptions(cf_handle, cf_options);
       if (!r_status.ok()) break;
     }
   }
-  if (r_status.ok()) return Status::OK();
-  return Status(Status::NotOK, r_status.ToString());
+  if (!r_status.ok()) return Status(Status::NotOK, r_status.ToString());
+  rocksdb_options = options;
+  return Status::OK();
 }
 
 Status Config::Set(std::string key, const std::string &value, Server *svr) {
@@ -489,6 +1062,14 @@ Status Config::Set(std::string key, const std::string &value, Server *svr) {
     max_backup_keep_hours = static_cast<uint32_t>(std::atoi(value.c_str()));
     return Status::OK();
   }
+  if (key == "max-backup-mb") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0);
+    if (!s.IsOK()) return s;
+    max_backup_mb = i;
+    svr->storage_->SetBackupRateLimit(max_backup_mb);
+    return Status::OK();
+  }
   if (key == "masterauth") {
     masterauth = value;
     return Status::OK();
@@ -512,6 +1093,22 @@ Status Config::Set(std::string key, const std::string &value, Server *svr) {
     slave_priority = std::atoi(value.c_str());
     return Status::OK();
   }
+  // the tcp options are applied to the new connections
+  if (key == "tcp-nodelay") {
+    int i;
+    if ((i = yesnotoi(value)) == -1) {
+      return Status(Status::NotOK, "argument must be 'yes' or 'no'");
+    }
+    tcp_nodelay = (i == 1);
+    return Status::OK();
+  }
+  if (key == "tcp-sndbuf" || key == "tcp-rcvbuf") {
+    int64_t n;
+    auto s = Util::StringToNum(value, &n, 0, INT_MAX);
+    if (!s.IsOK()) return s;
+    (key == "tcp-sndbuf" ? tcp_sndbuf : tcp_rcvbuf) = static_cast<int>(n);
+    return Status::OK();
+  }
   if (key == "loglevel") {
     for (size_t i = 0; i < kNumLogLevel; i++) {
       if (Util::ToLower(value) == kLogLevels[i]) {
@@ -526,6 +1123,39 @@ Status Config::Set(std::string key, const std::string &value, Server *svr) {
     Util::Split(value, " ", &args);
     return compact_cron.SetScheduleTime(args);
   }
+  if (key == "compaction-checker-range") {
+    if (value.empty()) {
+      compaction_checker_range_start = compaction_checker_range_stop = -1;
+      return Status::OK();
+    }
+    return parseCompactionCheckerRange(value);
+  }
+  if (key == "io-rate-limit-peak-qps") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, INT_MAX);
+    if (!s.IsOK()) return s;
+    io_rate_limit_peak_qps = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "namespace-max-qps") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, INT_MAX);
+    if (!s.IsOK()) return s;
+    namespace_max_qps = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "namespace-max-net-out-mb") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, INT_MAX);
+    if (!s.IsOK()) return s;
+    namespace_max_net_out_mb = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "client-output-buffer-limit") {
+    std::vector<std::string> args;
+    Util::Split(value, " ", &args);
+    return parseClientOutputBufferLimit(args);
+  }
   if (key == "bgsave-cron") {
     std::vector<std::string> args;
     Util::Split(value, " ", &args);
@@ -553,6 +1183,13 @@ Status Config::Set(std::string key, const std::string &value, Server *svr) {
     svr->storage_->CheckDBSizeLimit();
     return Status::OK();
   }
+  if (key == "active-expire-keys-per-sec") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, INT_MAX);
+    if (!s.IsOK()) return s;
+    active_expire_keys_per_sec = static_cast<int>(i);
+    return Status::OK();
+  }
   if (key == "max-replication-mb") {
     int64_t i;
     auto s = Util::StringToNum(value, &i, 0);
@@ -565,7 +1202,137 @@ Status Config::Set(std::string key, const std::string &value, Server *svr) {
     auto s = Util::StringToNum(value, &i, 0);
     if (!s.IsOK()) return s;
     max_io_mb = i;
-    svr->storage_->SetIORateLimit(static_cast<uint64_t>(i));
+    svr->AdjustIORateLimit();
+    return Status::OK();
+  }
+  if (key == "zset-rank-index") {
+    int i;
+    if ((i = yesnotoi(value)) == -1) {
+      return Status(Status::RedisParseErr, "argument must be 'yes' or 'no'");
+    }
+    zset_rank_index = (i == 1);
+    return Status::OK();
+  }
+  if (key == "list-chunk-size") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, 65536);
+    if (!s.IsOK()) return s;
+    list_chunk_size = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "sortedint-block-size") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, 65536);
+    if (!s.IsOK()) return s;
+    sortedint_block_size = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "hash-inline-max-entries") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, 1024);
+    if (!s.IsOK()) return s;
+    hash_inline_max_entries = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "hash-inline-max-value") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, 65536);
+    if (!s.IsOK()) return s;
+    hash_inline_max_value = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "counter-merge-mode") {
+    int i;
+    if ((i = yesnotoi(value)) == -1) {
+      return Status(Status::NotOK, "argument must be 'yes' or 'no'");
+    }
+    counter_merge_mode = (i == 1);
+    return Status::OK();
+  }
+  if (key == "string-blob-min-size") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, INT_MAX);
+    if (!s.IsOK()) return s;
+    string_blob_min_size = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "metadata-cache-size") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0);
+    if (!s.IsOK()) return s;
+    metadata_cache_size = static_cast<size_t>(i) * MiB;
+    svr->storage_->GetMetadataCache()->SetCapacity(metadata_cache_size);
+    return Status::OK();
+  }
+  if (key == "scan-iterator-cache-size") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, 65536);
+    if (!s.IsOK()) return s;
+    scan_iterator_cache_size = static_cast<int>(i);
+    svr->storage_->GetScanIteratorCache()->SetCapacity(static_cast<size_t>(scan_iterator_cache_size));
+    return Status::OK();
+  }
+  if (key == "write-stall-max-wait-ms") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, 60000);
+    if (!s.IsOK()) return s;
+    write_stall_max_wait_ms = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "repl-wait-max-ms") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, 60000);
+    if (!s.IsOK()) return s;
+    repl_wait_max_ms = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "repl-min-ack-slaves") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, 64);
+    if (!s.IsOK()) return s;
+    repl_min_ack_slaves = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "repl-ack-timeout-ms") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, 60000);
+    if (!s.IsOK()) return s;
+    repl_ack_timeout_ms = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "warmup-max-keys") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, INT_MAX);
+    if (!s.IsOK()) return s;
+    warmup_max_keys = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "tracking-table-max-keys") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, INT_MAX);
+    if (!s.IsOK()) return s;
+    tracking_table_max_keys = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "warmup-keys-per-sec") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 1, INT_MAX);
+    if (!s.IsOK()) return s;
+    warmup_keys_per_sec = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "lua-time-limit") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, INT_MAX);
+    if (!s.IsOK()) return s;
+    lua_time_limit = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "streaming-reply-min-elements") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, INT_MAX);
+    if (!s.IsOK()) return s;
+    streaming_reply_min_elements = static_cast<int>(i);
     return Status::OK();
   }
   if (key == "profiling-sample-ratio") {
@@ -575,6 +1342,35 @@ Status Config::Set(std::string key, const std::string &value, Server *svr) {
     profiling_sample_ratio = static_cast<int>(i);
     return Status::OK();
   }
+  if (key == "perf-stats-sample-ratio") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, 100);
+    if (!s.IsOK()) return s;
+    perf_stats_sample_ratio = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "trace-sample-ratio") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, 100);
+    if (!s.IsOK()) return s;
+    trace_sample_ratio = static_cast<int>(i);
+    return Status::OK();
+  }
+  if (key == "trace-max-len") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, INT_MAX);
+    if (!s.IsOK()) return s;
+    trace_max_len = static_cast<int>(i);
+    svr->GetTraceLog()->SetMaxEntries(trace_max_len);
+    return Status::OK();
+  }
+  if (key == "hotkeys-sample-ratio") {
+    int64_t i;
+    auto s = Util::StringToNum(value, &i, 0, 100);
+    if (!s.IsOK()) return s;
+    hotkeys_sample_ratio = static_cast<int>(i);
+    return Status::OK();
+  }
   if (key == "profiling-sample-record-threshold-ms") {
     int64_t i;
     auto s = Util::StringToNum(value, &i, 0, INT_MAX);
@@ -641,11 +1437,15 @@ Status Config::Rewrite() {
   string_stream << "################################ GERNERAL #####################################\n";
   WRITE_TO_FILE("bind", binds_str);
   WRITE_TO_FILE("port", port);
+  WRITE_TO_FILE("metrics-port", metrics_port);
   WRITE_TO_FILE("repl-bind", repl_binds_str);
   WRITE_TO_FILE("timeout", timeout);
   WRITE_TO_FILE("workers", workers);
   WRITE_TO_FILE("maxclients", maxclients);
   WRITE_TO_FILE("repl-workers", repl_workers);
+  WRITE_TO_FILE("slow-command-threads", slow_command_threads);
+  WRITE_TO_FILE("io-read-threads", io_read_threads);
+  if (!worker_cpu_affinity.empty()) WRITE_TO_FILE("worker-cpu-affinity", worker_cpu_affinity);
   WRITE_TO_FILE("loglevel", kLogLevels[loglevel]);
   WRITE_TO_FILE("daemonize", (daemonize?"yes":"no"));
   WRITE_TO_FILE("supervised", (configEnumGetName(supervised_mode_enum, supervised_mode)));
@@ -653,42 +1453,119 @@ Status Config::Rewrite() {
   WRITE_TO_FILE("dir", dir);
   WRITE_TO_FILE("backup-dir", backup_dir);
   WRITE_TO_FILE("tcp-backlog", backlog);
+  if (!unixsocket.empty()) {
+    WRITE_TO_FILE("unixsocket", unixsocket);
+    WRITE_TO_FILE("unixsocketperm", unixsocketPermString());
+  }
+  WRITE_TO_FILE("tcp-nodelay", (tcp_nodelay ? "yes" : "no"));
+  WRITE_TO_FILE("tcp-sndbuf", tcp_sndbuf);
+  WRITE_TO_FILE("tcp-rcvbuf", tcp_rcvbuf);
+  WRITE_TO_FILE("tcp-defer-accept", tcp_defer_accept);
   WRITE_TO_FILE("slave-read-only", (slave_readonly? "yes":"no"));
   WRITE_TO_FILE("slave-priority", slave_priority);
   WRITE_TO_FILE("slowlog-max-len", slowlog_max_len);
   WRITE_TO_FILE("slowlog-log-slower-than", slowlog_log_slower_than);
   WRITE_TO_FILE("max-backup-to-keep", max_backup_to_keep);
   WRITE_TO_FILE("max-backup-keep-hours", max_backup_keep_hours);
+  WRITE_TO_FILE("max-backup-mb", max_backup_mb);
+  WRITE_TO_FILE("backup-threads", backup_threads);
   WRITE_TO_FILE("max-db-size", max_db_size);
+  WRITE_TO_FILE("active-expire-keys-per-sec", active_expire_keys_per_sec);
   WRITE_TO_FILE("max-replication-mb", max_replication_mb);
   WRITE_TO_FILE("max-io-mb", max_io_mb);
+  WRITE_TO_FILE("metadata-cache-size", metadata_cache_size/MiB);
+  WRITE_TO_FILE("scan-iterator-cache-size", scan_iterator_cache_size);
+  WRITE_TO_FILE("write-stall-max-wait-ms", write_stall_max_wait_ms);
+  WRITE_TO_FILE("repl-wait-max-ms", repl_wait_max_ms);
+  WRITE_TO_FILE("repl-min-ack-slaves", repl_min_ack_slaves);
+  WRITE_TO_FILE("repl-ack-timeout-ms", repl_ack_timeout_ms);
+  WRITE_TO_FILE("warmup-max-keys", warmup_max_keys);
+  WRITE_TO_FILE("warmup-keys-per-sec", warmup_keys_per_sec);
+  WRITE_TO_FILE("tracking-table-max-keys", tracking_table_max_keys);
+  WRITE_TO_FILE("streaming-reply-min-elements", streaming_reply_min_elements);
+  WRITE_TO_FILE("lua-time-limit", lua_time_limit);
+  WRITE_TO_FILE("zset-rank-index", (zset_rank_index ? "yes" : "no"));
+  WRITE_TO_FILE("list-chunk-size", list_chunk_size);
+  WRITE_TO_FILE("sortedint-block-size", sortedint_block_size);
+  WRITE_TO_FILE("hash-inline-max-entries", hash_inline_max_entries);
+  WRITE_TO_FILE("hash-inline-max-value", hash_inline_max_value);
+  WRITE_TO_FILE("counter-merge-mode", (counter_merge_mode ? "yes" : "no"));
+  WRITE_TO_FILE("string-blob-min-size", string_blob_min_size);
+  WRITE_TO_FILE("type-column-families", (type_column_families ? "yes" : "no"));
   if (!requirepass.empty()) WRITE_TO_FILE("requirepass", requirepass);
   if (!masterauth.empty()) WRITE_TO_FILE("masterauth", masterauth);
   if (!master_host.empty())  WRITE_TO_FILE("slaveof", master_host+" "+std::to_string(master_port));
   if (compact_cron.IsEnabled()) WRITE_TO_FILE("compact-cron", compact_cron.ToString());
   if (bgsave_cron.IsEnabled()) WRITE_TO_FILE("bgave-cron", bgsave_cron.ToString());
+  if (compaction_checker_range_start >= 0) {
+    WRITE_TO_FILE("compaction-checker-range", compactionCheckerRangeString());
+  }
+  WRITE_TO_FILE("io-rate-limit-peak-qps", io_rate_limit_peak_qps);
+  WRITE_TO_FILE("namespace-max-qps", namespace_max_qps);
+  WRITE_TO_FILE("namespace-max-net-out-mb", namespace_max_net_out_mb);
+  for (int i = 0; i < kNumClientClasses; i++) {
+    WRITE_TO_FILE("client-output-buffer-limit", clientOutputBufferLimitString(i));
+  }
   WRITE_TO_FILE("profiling-sample-ratio", profiling_sample_ratio);
   if (!sample_commands_str.empty()) WRITE_TO_FILE("profiling-sample-commands", sample_commands_str);
   WRITE_TO_FILE("profiling-sample-record-max-len", profiling_sample_record_max_len);
   WRITE_TO_FILE("profiling-sample-record-threshold-ms", profiling_sample_record_threshold_ms);
+  WRITE_TO_FILE("perf-stats-sample-ratio", perf_stats_sample_ratio);
+  WRITE_TO_FILE("trace-sample-ratio", trace_sample_ratio);
+  WRITE_TO_FILE("trace-max-len", trace_max_len);
+  WRITE_TO_FILE("hotkeys-sample-ratio", hotkeys_sample_ratio);
 
   string_stream << "\n################################ ROCKSDB #####################################\n";
   WRITE_TO_FILE("rocksdb.max_open_files", rocksdb_options.max_open_files);
+  WRITE_TO_FILE("rocksdb.max_file_opening_threads", rocksdb_options.max_file_opening_threads);
   WRITE_TO_FILE("rocksdb.write_buffer_size", rocksdb_options.write_buffer_size/MiB);
   WRITE_TO_FILE("rocksdb.max_write_buffer_number", rocksdb_options.max_write_buffer_number);
   WRITE_TO_FILE("rocksdb.max_background_compactions", rocksdb_options.max_background_compactions);
   WRITE_TO_FILE("rocksdb.metadata_block_cache_size", rocksdb_options.metadata_block_cache_size/MiB);
   WRITE_TO_FILE("rocksdb.subkey_block_cache_size", rocksdb_options.subkey_block_cache_size/MiB);
+  WRITE_TO_FILE("rocksdb.shared_block_cache_size", rocksdb_options.shared_block_cache_size/MiB);
+  WRITE_TO_FILE("rocksdb.compressed_block_cache_size", rocksdb_options.compressed_block_cache_size/MiB);
+  WRITE_TO_FILE("rocksdb.block_cache_type", (rocksdb_options.block_cache_clock ? "clock" : "lru"));
+  WRITE_TO_FILE("rocksdb.block_cache_strict_capacity", (rocksdb_options.block_cache_strict_capacity ? "yes" : "no"));
+  WRITE_TO_FILE("rocksdb.block_cache_high_pri_pool_ratio", rocksdb_options.block_cache_high_pri_pool_ratio);
   WRITE_TO_FILE("rocksdb.max_background_flushes", rocksdb_options.max_background_flushes);
   WRITE_TO_FILE("rocksdb.max_sub_compactions", rocksdb_options.max_sub_compactions);
   WRITE_TO_FILE("rocksdb.compression", kCompressionType[rocksdb_options.compression]);
+  if (!rocksdb_options.compression_per_level.empty()) {
+    WRITE_TO_FILE("rocksdb.compression_per_level", compressionPerLevelString());
+  }
+  if (!rocksdb_options.db_paths.empty()) WRITE_TO_FILE("rocksdb.db_paths", dbPathsString());
   WRITE_TO_FILE("rocksdb.enable_pipelined_write", (rocksdb_options.enable_pipelined_write ? "yes" : "no"));
   WRITE_TO_FILE("rocksdb.delayed_write_rate", rocksdb_options.delayed_write_rate);
   WRITE_TO_FILE("rocksdb.compaction_readahead_size", rocksdb_options.compaction_readahead_size);
+  WRITE_TO_FILE("rocksdb.scan_readahead_size", rocksdb_options.scan_readahead_size);
+  WRITE_TO_FILE("rocksdb.use_direct_reads", (rocksdb_options.use_direct_reads ? "yes" : "no"));
+  WRITE_TO_FILE("rocksdb.use_direct_io_for_flush_and_compaction",
+                (rocksdb_options.use_direct_io_for_flush_and_compaction ? "yes" : "no"));
+  WRITE_TO_FILE("rocksdb.bytes_per_sync", rocksdb_options.bytes_per_sync);
+  WRITE_TO_FILE("rocksdb.wal_bytes_per_sync", rocksdb_options.wal_bytes_per_sync);
+  WRITE_TO_FILE("rocksdb.use_adaptive_mutex", (rocksdb_options.use_adaptive_mutex ? "yes" : "no"));
+  WRITE_TO_FILE("rocksdb.partitioned_index_and_filters",
+                (rocksdb_options.partitioned_index_and_filters ? "yes" : "no"));
+  WRITE_TO_FILE("rocksdb.pin_top_level_index_and_filter",
+                (rocksdb_options.pin_top_level_index_and_filter ? "yes" : "no"));
+  WRITE_TO_FILE("rocksdb.optimize_filters_for_hits", (rocksdb_options.optimize_filters_for_hits ? "yes" : "no"));
+  WRITE_TO_FILE("rocksdb.metadata_memtable_bloom", (rocksdb_options.metadata_memtable_bloom ? "yes" : "no"));
+  WRITE_TO_FILE("rocksdb.data_block_hash_index", (rocksdb_options.data_block_hash_index ? "yes" : "no"));
   WRITE_TO_FILE("rocksdb.target_file_size_base", rocksdb_options.target_file_size_base);
   WRITE_TO_FILE("rocksdb.level0_slowdown_writes_trigger", rocksdb_options.level0_slowdown_writes_trigger);
+  WRITE_TO_FILE("rocksdb.level0_stop_writes_trigger", rocksdb_options.level0_stop_writes_trigger);
   WRITE_TO_FILE("rocksdb.wal_ttl_seconds", rocksdb_options.WAL_ttl_seconds);
   WRITE_TO_FILE("rocksdb.wal_size_limit_mb", rocksdb_options.WAL_size_limit_MB);
+  for (const auto &iter : rocksdb_options.type_cf_options) {
+    const auto &cf_options = iter.second;
+    std::string prefix = "rocksdb." + iter.first + ".";
+    int compression = cf_options.compression >= 0 ? cf_options.compression : rocksdb_options.compression;
+    WRITE_TO_FILE(prefix + "block_size", cf_options.block_size);
+    WRITE_TO_FILE(prefix + "compression", kCompressionType[compression]);
+    WRITE_TO_FILE(prefix + "bloom_bits", cf_options.bloom_bits);
+    WRITE_TO_FILE(prefix + "compaction_style", (cf_options.universal_compaction ? "universal" : "level"));
+  }
 
   string_stream << "\n################################ Namespace #####################################\n";
   for (const auto &iter : tokens) {
@@ -28,27 +28,86 @@ const size_t KiB = 1024L;
 const size_t MiB = 1024L * KiB;
 const size_t GiB = 1024L * MiB;
 
+// TypeCFOptions is the options of the column family which holds the subkeys of
+// one data type, they are used when the type column families are enabled
+struct TypeCFOptions {
+  int block_size = 4 * KiB;
+  int compression = -1;  // -1: the same as rocksdb.compression
+  int bloom_bits = 10;
+  bool universal_compaction = false;
+};
+
+// the client classes of the output buffer limits, the slaves are fed by the blocking
+// sends of the feed slave threads, so they don't buffer the outputs
+enum ClientClass {
+  kClientClassNormal = 0,
+  kClientClassPubSub,
+  kClientClassMonitor,
+  kNumClientClasses,
+};
+
+// the client is disconnected once its output buffer reaches the hard limit, or stays
+// over the soft limit for soft_limit_seconds, 0 is unlimited
+struct ClientOutputBufferLimit {
+  uint64_t hard_limit_mb;
+  uint64_t soft_limit_mb;
+  int soft_limit_seconds;
+};
+
 struct Config{
  public:
   int port = 6666;
   int repl_port = port + 1;
+  int metrics_port = 0;
   int workers = 4;
   int repl_workers = 1;
+  int slow_command_threads = 2;
+  int io_read_threads = 0;
+  std::string worker_cpu_affinity;
+  std::vector<int> worker_cpus;
   int timeout = 0;
   int loglevel = 0;
   int backlog = 1024;
+  std::string unixsocket;
+  int unixsocketperm = 0;
+  bool tcp_nodelay = true;
+  int tcp_sndbuf = 0;  // unit is byte, 0 is the default of the system
+  int tcp_rcvbuf = 0;
+  int tcp_defer_accept = 0;  // unit is second
   int maxclients = 10240;
   uint32_t max_backup_to_keep = 1;
   uint32_t max_backup_keep_hours = 0;
+  uint64_t max_backup_mb = 0;  // unit is MB
+  int backup_threads = 1;
   int64_t slowlog_log_slower_than = 200000;  // 200ms
+  int write_stall_max_wait_ms = 1000;
+  int repl_wait_max_ms = 5000;
+  int repl_min_ack_slaves = 0;
+  int repl_ack_timeout_ms = 1000;
+  int warmup_max_keys = 0;
+  int warmup_keys_per_sec = 10000;
+  int tracking_table_max_keys = 1000000;
+  int streaming_reply_min_elements = 10000;
+  int lua_time_limit = 5000;  // ms
   unsigned int slowlog_max_len = 0;
   bool daemonize = false;
   int supervised_mode = SUPERVISED_NONE;
   bool slave_readonly = true;
   uint32_t slave_priority = 100;
   uint32_t max_db_size = 0;  // unit is GB
+  int active_expire_keys_per_sec = 100;
   uint64_t max_replication_mb = 0;  // unit is MB
   uint64_t max_io_mb = 500;  // unit is MB
+  size_t metadata_cache_size = 64 * MiB;
+  int scan_iterator_cache_size = 64;
+  bool zset_rank_index = false;
+  int list_chunk_size = 0;
+  int sortedint_block_size = 0;
+  int hash_inline_max_entries = 0;
+  int hash_inline_max_value = 64;
+  bool counter_merge_mode = false;
+  int string_blob_min_size = 0;
+  bool type_column_families = false;
 
   std::vector<std::string> binds{"127.0.0.1"};
   std::vector<std::string> repl_binds{"127.0.0.1"};
@@ -63,6 +122,15 @@ struct Config{
   int master_port = 0;
   Cron compact_cron;
   Cron bgsave_cron;
+  // the hours range of the compaction checker, -1 is disabled
+  int compaction_checker_range_start = -1;
+  int compaction_checker_range_stop = -1;
+  int io_rate_limit_peak_qps = 0;
+  // the budgets per second of each namespace except the admin, 0 is unlimited
+  int namespace_max_qps = 0;
+  int namespace_max_net_out_mb = 0;
+  ClientOutputBufferLimit client_output_buffer_limits[kNumClientClasses] = {
+      {0, 0, 0}, {32, 8, 60}, {256, 64, 60}};
   std::map<std::string, std::string> tokens;
 
   // profiling
@@ -71,11 +139,22 @@ struct Config{
   int profiling_sample_record_max_len = 256;
   std::set<std::string> profiling_sample_commands;
   bool profiling_sample_all_commands = false;
+  int perf_stats_sample_ratio = 1;
+  int trace_sample_ratio = 0;
+  int trace_max_len = 128;
+  int hotkeys_sample_ratio = 1;
 
   struct {
     size_t metadata_block_cache_size = 4 * GiB;
     size_t subkey_block_cache_size = 8 * GiB;
+    // all column families share one block cache if it's not zero
+    size_t shared_block_cache_size = 0;
+    size_t compressed_block_cache_size = 0;
+    bool block_cache_clock = false;
+    bool block_cache_strict_capacity = false;
+    double block_cache_high_pri_pool_ratio = 0.75;
     int max_open_files = 4096;
+    int max_file_opening_threads = 16;
     uint64_t write_buffer_size = 256 * MiB;
     int max_write_buffer_number = 2;
     int max_background_compactions = 2;
@@ -86,11 +165,31 @@ struct Config{
     bool enable_pipelined_write = true;
     uint64_t delayed_write_rate = 0;
     size_t compaction_readahead_size = 2 * MiB;
+    // the readahead size of the long scans(KEYS, DBSIZE scan, SCAN of the subkeys)
+    size_t scan_readahead_size = 2 * MiB;
+    bool use_direct_reads = false;
+    bool use_direct_io_for_flush_and_compaction = false;
+    uint64_t bytes_per_sync = 1 * MiB;
+    uint64_t wal_bytes_per_sync = 512 * KiB;
+    bool use_adaptive_mutex = false;
+    bool partitioned_index_and_filters = false;
+    bool pin_top_level_index_and_filter = true;
+    bool optimize_filters_for_hits = false;
+    bool metadata_memtable_bloom = false;
+    bool data_block_hash_index = false;
     uint64_t target_file_size_base = 256 * MiB;
     uint64_t WAL_ttl_seconds = 7 * 24 * 3600;
     uint64_t WAL_size_limit_MB = 5 * 1024;
     int level0_slowdown_writes_trigger = 20;
     int level0_stop_writes_trigger = 36;
+    // the sst files are placed into the paths in order by their target sizes in bytes,
+    // the last path takes the rest, and all of them are in the db_dir if it's empty
+    std::vector<std::pair<std::string, uint64_t>> db_paths;
+    // the compressions of the levels from L0, the compression is used by all levels if it's empty
+    std::vector<rocksdb::CompressionType> compression_per_level;
+    // column family name => options
+    std::map<std::string, TypeCFOptions> type_cf_options{
+        {"hash", {}}, {"set", {}}, {"list", {}}, {"bitmap", {}}, {"sortedint", {}}, {"zset", {}}};
   } rocksdb_options;
 
  public:
@@ -103,6 +202,8 @@ struct Config{
   Status AddNamespace(const std::string &ns, const std::string &token);
   Status SetNamespace(const std::string &ns, const std::string &token);
   Status DelNamespace(const std::string &ns);
+  // IsCompactionCheckerTime returns true if the hour is in the range of the compaction checker
+  bool IsCompactionCheckerTime(int hour);
   Config() = default;
   ~Config() = default;
 
@@ -113,6 +214,20 @@ struct Config{
   Status parseConfigFromString(std::string input);
   Status parseRocksdbOption(const std::string &key, std::string value);
   Status parseRocksdbIntOption(std::string key, std::string value);
+  Status parseTypeCFOption(const std::string &cf_name, const std::string &key, const std::string &value);
   void array2String(const std::vector<std::string> &array, const std::string &delim, std::string *output);
   Status isNamespaceLegal(const std::string &ns);
+  Status parseCompactionCheckerRange(const std::string &range);
+  std::string compactionCheckerRangeString();
+  // the permission of the unix socket is in octal like 700
+  std::string unixsocketPermString();
+  // the db paths are like `/mnt/nvme/db:204800,/mnt/hdd/db:0`, the sizes are in MiB
+  Status parseDBPaths(const std::string &value);
+  std::string dbPathsString();
+  // the compressions are like `no:no:snappy`
+  Status parseCompressionPerLevel(const std::string &value);
+  std::string compressionPerLevelString();
+  // the args are the groups of `<class> <hard limit mb> <soft limit mb> <soft limit seconds>`
+  Status parseClientOutputBufferLimit(const std::vector<std::string> &args);
+  std::string clientOutputBufferLimitString(int client_class = -1);
 };
@@ -179,6 +179,31 @@ bool GetDouble(rocksdb::Slice *input, double *value) {
   return true;
 }
 
+bool GetVarint64(rocksdb::Slice *input, uint64_t *value) {
+  uint64_t result = 0;
+  for (size_t i = 0; i < input->size() && i < 10; i++) {
+    auto byte = static_cast<uint8_t>((*input)[i]);
+    result |= static_cast<uint64_t>(byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      input->remove_prefix(i + 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+void PutVarint64(std::string *dst, uint64_t value) {
+  char buf[10];
+  size_t n = 0;
+  while (value >= 0x80) {
+    buf[n++] = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  buf[n++] = static_cast<char>(value);
+  dst->append(buf, n);
+}
+
 uint32_t DecodeFixed32(const char *ptr) {
   if (BYTE_ORDER == BIG_ENDIAN) {
     uint32_t value;
@@ -12,6 +12,9 @@ void PutFixed8(std::string *dst, uint8_t value);
 void PutFixed32(std::string *dst, uint32_t value);
 void PutFixed64(std::string *dst, uint64_t value);
 void PutDouble(std::string *dst, double value);
+// the varint is encoded as the little-endian base 128, at most 10 bytes for uint64
+bool GetVarint64(rocksdb::Slice *input, uint64_t *value);
+void PutVarint64(std::string *dst, uint64_t value);
 
 void EncodeFixed8(char *buf, uint8_t value);
 void EncodeFixed32(char *buf, uint32_t value);
@@ -1,6 +1,11 @@
 #include "event_listener.h"
+#include <algorithm>
 #include <string>
 
+static uint64_t tableFileSize(const rocksdb::TableProperties &props) {
+  return props.data_size + props.index_size + props.filter_size;
+}
+
 void EventListener::OnCompactionCompleted(rocksdb::DB *db, const rocksdb::CompactionJobInfo &ci) {
   LOG(INFO) << "[event_listener/compaction_completed] column family: " << ci.cf_name
             << ", reason: " << static_cast<int>(ci.compaction_reason)
@@ -11,17 +16,37 @@ void EventListener::OnCompactionCompleted(rocksdb::DB *db, const rocksdb::Compac
             << ", output bytes:" << ci.stats.total_output_bytes
             << ", is_maunal:" << ci.stats.is_manual_compaction
             << ", elapsed(micro): " << ci.stats.elapsed_micros;
+  // the input files are sorted by the levels, so the files of the output level are the last ones,
+  // and the input bytes from the output level are estimated by the sizes of the tables
+  uint64_t all_files_size = 0, output_level_files_size = 0;
+  size_t output_level_start = ci.input_files.size() - std::min(ci.input_files.size(),
+                                                               ci.stats.num_input_files_at_output_level);
+  for (size_t i = 0; i < ci.input_files.size(); i++) {
+    auto iter = ci.table_properties.find(ci.input_files[i]);
+    if (iter == ci.table_properties.end() || !iter->second) continue;
+    uint64_t size = tableFileSize(*iter->second);
+    all_files_size += size;
+    if (i >= output_level_start) output_level_files_size += size;
+  }
+  uint64_t output_level_bytes = all_files_size == 0 ? 0 :
+      static_cast<uint64_t>(static_cast<double>(ci.stats.total_input_bytes) * output_level_files_size / all_files_size);
+  storage_->GetBackgroundJobStats()->RecordCompaction(ci.cf_name, ci.output_level, ci.stats.elapsed_micros,
+                                                      ci.stats.total_input_bytes, output_level_bytes,
+                                                      ci.stats.total_output_bytes, BackgroundJobStats::NowUS());
   storage_->IncrCompactionCount(1);
   storage_->CheckDBSizeLimit();
 }
 
 void EventListener::OnFlushBegin(rocksdb::DB *db, const rocksdb::FlushJobInfo &fi) {
+  storage_->GetBackgroundJobStats()->RecordFlushBegin(fi.job_id, BackgroundJobStats::NowUS());
   LOG(INFO) << "[event_listener/flush_begin] column family: " << fi.cf_name
             << ", thread_id: " << fi.thread_id << ", job_id: " << fi.job_id
             << ", reason: " << static_cast<int>(fi.flush_reason);
 }
 
 void EventListener::OnFlushCompleted(rocksdb::DB *db, const rocksdb::FlushJobInfo &fi) {
+  storage_->GetBackgroundJobStats()->RecordFlushCompleted(fi.cf_name, fi.job_id, tableFileSize(fi.table_properties),
+                                                          BackgroundJobStats::NowUS());
   storage_->IncrFlushCount(1);
   storage_->CheckDBSizeLimit();
   LOG(INFO) << "[event_listener/flush_completed] column family: " << fi.cf_name
@@ -36,14 +61,19 @@ void EventListener::OnFlushCompleted(rocksdb::DB *db, const rocksdb::FlushJobInf
 
 void EventListener::OnBackgroundError(rocksdb::BackgroundErrorReason reason, rocksdb::Status *status) {
   std::string reason_str;
+  auto stats = storage_->GetBackgroundJobStats();
   switch (reason) {
     case rocksdb::BackgroundErrorReason::kCompaction:reason_str = "compact";
+      stats->RecordBackgroundError(BackgroundJobStats::kErrorCompaction, BackgroundJobStats::NowUS());
       break;
     case rocksdb::BackgroundErrorReason::kFlush:reason_str = "flush";
+      stats->RecordBackgroundError(BackgroundJobStats::kErrorFlush, BackgroundJobStats::NowUS());
       break;
     case rocksdb::BackgroundErrorReason::kMemTable:reason_str = "memtable";
+      stats->RecordBackgroundError(BackgroundJobStats::kErrorMemTable, BackgroundJobStats::NowUS());
       break;
     case rocksdb::BackgroundErrorReason::kWriteCallback:reason_str = "writecallback";
+      stats->RecordBackgroundError(BackgroundJobStats::kErrorWriteCallback, BackgroundJobStats::NowUS());
       break;
     default:
       // Should not arrive here
@@ -65,4 +95,8 @@ void EventListener::OnStallConditionsChanged(const rocksdb::WriteStallInfo &info
                << " write stall condition was changed, from "
                << stall_condition_strings[static_cast<int>(info.condition.prev)]
                << " to " << stall_condition_strings[static_cast<int>(info.condition.cur)];
+  storage_->SetWriteStallCondition(info.condition.prev, info.condition.cur);
+  storage_->GetBackgroundJobStats()->RecordStallChanged(
+      info.cf_name, static_cast<BackgroundJobStats::StallCondition>(info.condition.prev),
+      static_cast<BackgroundJobStats::StallCondition>(info.condition.cur), BackgroundJobStats::NowUS());
 }
@@ -0,0 +1,431 @@
+// NOTE: this file is ported from redis's source: `src/geohash.c` and `src/geohash_helper.c`,
+// which are under the BSD license, Copyright (c) 2013-2014, yinqiwen, Matt Stancliff and
+// Salvatore Sanfilippo. The interfaces are changed to C++.
+
+#include "geohash.h"
+
+#include <math.h>
+
+#define D_R (M_PI / 180.0)
+
+/// @brief Earth's quatratic mean radius for WGS-84
+const double EARTH_RADIUS_IN_METERS = 6372797.560856;
+
+const double MERCATOR_MAX = 20037726.37;
+
+static inline double deg_rad(double ang) { return ang * D_R; }
+static inline double rad_deg(double ang) { return ang / D_R; }
+
+/* Interleave lower bits of x and y, so the bits of x
+ * are in the even positions and bits from y in the odd;
+ * x and y must initially be less than 2**32 (65536).
+ * From:  https://graphics.stanford.edu/~seander/bithacks.html#InterleaveBMN
+ */
+static inline uint64_t interleave64(uint32_t xlo, uint32_t ylo) {
+  static const uint64_t B[] = {0x5555555555555555ULL, 0x3333333333333333ULL,
+                               0x0F0F0F0F0F0F0F0FULL, 0x00FF00FF00FF00FFULL,
+                               0x0000FFFF0000FFFFULL};
+  static const unsigned int S[] = {1, 2, 4, 8, 16};
+
+  uint64_t x = xlo;
+  uint64_t y = ylo;
+
+  x = (x | (x << S[4])) & B[4];
+  y = (y | (y << S[4])) & B[4];
+
+  x = (x | (x << S[3])) & B[3];
+  y = (y | (y << S[3])) & B[3];
+
+  x = (x | (x << S[2])) & B[2];
+  y = (y | (y << S[2])) & B[2];
+
+  x = (x | (x << S[1])) & B[1];
+  y = (y | (y << S[1])) & B[1];
+
+  x = (x | (x << S[0])) & B[0];
+  y = (y | (y << S[0])) & B[0];
+
+  return x | (y << 1);
+}
+
+/* reverse the interleave process
+ * derived from http://stackoverflow.com/questions/4909263
+ */
+static inline uint64_t deinterleave64(uint64_t interleaved) {
+  static const uint64_t B[] = {0x5555555555555555ULL, 0x3333333333333333ULL,
+                               0x0F0F0F0F0F0F0F0FULL, 0x00FF00FF00FF00FFULL,
+                               0x0000FFFF0000FFFFULL, 0x00000000FFFFFFFFULL};
+  static const unsigned int S[] = {0, 1, 2, 4, 8, 16};
+
+  uint64_t x = interleaved;
+  uint64_t y = interleaved >> 1;
+
+  x = (x | (x >> S[0])) & B[0];
+  y = (y | (y >> S[0])) & B[0];
+
+  x = (x | (x >> S[1])) & B[1];
+  y = (y | (y >> S[1])) & B[1];
+
+  x = (x | (x >> S[2])) & B[2];
+  y = (y | (y >> S[2])) & B[2];
+
+  x = (x | (x >> S[3])) & B[3];
+  y = (y | (y >> S[3])) & B[3];
+
+  x = (x | (x >> S[4])) & B[4];
+  y = (y | (y >> S[4])) & B[4];
+
+  x = (x | (x >> S[5])) & B[5];
+  y = (y | (y >> S[5])) & B[5];
+
+  return x | (y << 32);
+}
+
+static bool geohashEncode(const GeoHashRange &long_range, const GeoHashRange &lat_range,
+                          double longitude, double latitude, uint8_t step, GeoHashBits *hash) {
+  /* Check basic arguments sanity. */
+  if (step > 32 || step == 0 || lat_range.max == lat_range.min || long_range.max == long_range.min) return false;
+
+  /* Return an error when trying to index outside the supported
+   * constraints. */
+  if (longitude > GEO_LONG_MAX || longitude < GEO_LONG_MIN ||
+      latitude > GEO_LAT_MAX || latitude < GEO_LAT_MIN) return false;
+
+  hash->bits = 0;
+  hash->step = step;
+
+  if (latitude < lat_range.min || latitude > lat_range.max ||
+      longitude < long_range.min || longitude > long_range.max) {
+    return false;
+  }
+
+  double lat_offset = (latitude - lat_range.min) / (lat_range.max - lat_range.min);
+  double long_offset = (longitude - long_range.min) / (long_range.max - long_range.min);
+
+  /* convert to fixed point based on the step size */
+  lat_offset *= (1ULL << step);
+  long_offset *= (1ULL << step);
+  hash->bits = interleave64(static_cast<uint32_t>(lat_offset), static_cast<uint32_t>(long_offset));
+  return true;
+}
+
+static void geohashDecode(const GeoHashRange &long_range, const GeoHashRange &lat_range,
+                          const GeoHashBits &hash, GeoHashArea *area) {
+  area->hash = hash;
+  uint8_t step = hash.step;
+  uint64_t hash_sep = deinterleave64(hash.bits); /* hash = [LAT][LONG] */
+
+  double lat_scale = lat_range.max - lat_range.min;
+  double long_scale = long_range.max - long_range.min;
+
+  uint32_t ilato = static_cast<uint32_t>(hash_sep);        /* get lat part of deinterleaved hash */
+  uint32_t ilono = static_cast<uint32_t>(hash_sep >> 32);  /* shift over to get long part of hash */
+
+  /* divide by 2**step.
+   * Then, for 0-1 coordinate, multiply times scale and add
+     to the min to get the absolute coordinate. */
+  area->latitude.min = lat_range.min + (ilato * 1.0 / (1ull << step)) * lat_scale;
+  area->latitude.max = lat_range.min + ((ilato + 1) * 1.0 / (1ull << step)) * lat_scale;
+  area->longitude.min = long_range.min + (ilono * 1.0 / (1ull << step)) * long_scale;
+  area->longitude.max = long_range.min + ((ilono + 1) * 1.0 / (1ull << step)) * long_scale;
+}
+
+static GeoHashRange wgs84LongRange() {
+  GeoHashRange range;
+  range.min = GEO_LONG_MIN;
+  range.max = GEO_LONG_MAX;
+  return range;
+}
+
+static GeoHashRange wgs84LatRange() {
+  GeoHashRange range;
+  range.min = GEO_LAT_MIN;
+  range.max = GEO_LAT_MAX;
+  return range;
+}
+
+static void geohash_move_x(GeoHashBits *hash, int8_t d) {
+  if (d == 0) return;
+
+  uint64_t x = hash->bits & 0xaaaaaaaaaaaaaaaaULL;
+  uint64_t y = hash->bits & 0x5555555555555555ULL;
+
+  uint64_t zz = 0x5555555555555555ULL >> (64 - hash->step * 2);
+
+  if (d > 0) {
+    x = x + (zz + 1);
+  } else {
+    x = x | zz;
+    x = x - (zz + 1);
+  }
+
+  x &= (0xaaaaaaaaaaaaaaaaULL >> (64 - hash->step * 2));
+  hash->bits = (x | y);
+}
+
+static void geohash_move_y(GeoHashBits *hash, int8_t d) {
+  if (d == 0) return;
+
+  uint64_t x = hash->bits & 0xaaaaaaaaaaaaaaaaULL;
+  uint64_t y = hash->bits & 0x5555555555555555ULL;
+
+  uint64_t zz = 0xaaaaaaaaaaaaaaaaULL >> (64 - hash->step * 2);
+  if (d > 0) {
+    y = y + (zz + 1);
+  } else {
+    y = y | zz;
+    y = y - (zz + 1);
+  }
+  y &= (0x5555555555555555ULL >> (64 - hash->step * 2));
+  hash->bits = (x | y);
+}
+
+/* This function is used in order to estimate the step (bits precision)
+ * of the 9 search area boxes during radius queries. */
+static uint8_t geohashEstimateStepsByRadius(double range_meters, double lat) {
+  if (range_meters == 0) return 26;
+  int step = 1;
+  while (range_meters < MERCATOR_MAX) {
+    range_meters *= 2;
+    step++;
+  }
+  step -= 2; /* Make sure range is included in most of the base cases. */
+
+  /* Wider range towards the poles... Note: it is possible to do better
+   * than this approximation by computing the distance between meridians
+   * at this latitude, but this does the trick for now. */
+  if (lat > 66 || lat < -66) {
+    step--;
+    if (lat > 80 || lat < -80) step--;
+  }
+
+  /* Frame to valid range. */
+  if (step < 1) step = 1;
+  if (step > 26) step = 26;
+  return static_cast<uint8_t>(step);
+}
+
+/* Return the bounding box of the search area by shape (see geohash.h GeoShape)
+ * bounds[0] - bounds[2] is the minimum and maximum longitude
+ * while bounds[1] - bounds[3] is the minimum and maximum latitude.
+ * since the higher the latitude, the shorter the arc length, the box shape is as follows
+ * (left and right edges are actually bent), as shown in the following diagram:
+ *
+ *    \-----------------/          --------               \-----------------/
+ *     \               /         /          \              \               /
+ *      \  (long,lat) /         / (long,lat) \              \  (long,lat) /
+ *       \           /         /              \             /             \
+ *         ---------          /----------------\           /---------------\
+ *  Northern Hemisphere       Southern Hemisphere         Around the equator
+ */
+static void geohashBoundingBox(const GeoShape &shape, double *bounds) {
+  double longitude = shape.xy[0];
+  double latitude = shape.xy[1];
+  double height = shape.conversion * (shape.type == kGeoShapeTypeCircular ? shape.radius : shape.height / 2);
+  double width = shape.conversion * (shape.type == kGeoShapeTypeCircular ? shape.radius : shape.width / 2);
+
+  const double lat_delta = rad_deg(height / EARTH_RADIUS_IN_METERS);
+  const double long_delta_top = rad_deg(width / EARTH_RADIUS_IN_METERS / cos(deg_rad(latitude + lat_delta)));
+  const double long_delta_bottom = rad_deg(width / EARTH_RADIUS_IN_METERS / cos(deg_rad(latitude - lat_delta)));
+  /* The directions of the northern and southern hemispheres
+   * are opposite, so we choice different points as min/max long/lat */
+  bool southern_hemisphere = latitude < 0;
+  bounds[0] = southern_hemisphere ? longitude - long_delta_bottom : longitude - long_delta_top;
+  bounds[2] = southern_hemisphere ? longitude + long_delta_bottom : longitude + long_delta_top;
+  bounds[1] = latitude - lat_delta;
+  bounds[3] = latitude + lat_delta;
+}
+
+/* Return the distance (in meters) between two points on the Earth's surface
+ * used the latitude only, as the longitudes are practically the same */
+static double geohashGetLatDistance(double lat1d, double lat2d) {
+  return EARTH_RADIUS_IN_METERS * fabs(deg_rad(lat2d) - deg_rad(lat1d));
+}
+
+namespace GeoHash {
+
+bool EncodeWGS84(double longitude, double latitude, uint8_t step, GeoHashBits *hash) {
+  return geohashEncode(wgs84LongRange(), wgs84LatRange(), longitude, latitude, step, hash);
+}
+
+bool EncodeStandard(double longitude, double latitude, uint8_t step, GeoHashBits *hash) {
+  // the standard geohash uses the latitude range -90,90 instead of the limits of EPSG:900913
+  GeoHashRange long_range, lat_range;
+  long_range.min = -180;
+  long_range.max = 180;
+  lat_range.min = -90;
+  lat_range.max = 90;
+  return geohashEncode(long_range, lat_range, longitude, latitude, step, hash);
+}
+
+bool DecodeToLongLatWGS84(const GeoHashBits &hash, double *xy) {
+  if (hash.IsZero()) return false;
+  GeoHashArea area;
+  geohashDecode(wgs84LongRange(), wgs84LatRange(), hash, &area);
+  xy[0] = (area.longitude.min + area.longitude.max) / 2;
+  if (xy[0] > GEO_LONG_MAX) xy[0] = GEO_LONG_MAX;
+  if (xy[0] < GEO_LONG_MIN) xy[0] = GEO_LONG_MIN;
+  xy[1] = (area.latitude.min + area.latitude.max) / 2;
+  if (xy[1] > GEO_LAT_MAX) xy[1] = GEO_LAT_MAX;
+  if (xy[1] < GEO_LAT_MIN) xy[1] = GEO_LAT_MIN;
+  return true;
+}
+
+void Neighbors(const GeoHashBits &hash, GeoHashNeighbors *neighbors) {
+  neighbors->east = hash;
+  neighbors->west = hash;
+  neighbors->north = hash;
+  neighbors->south = hash;
+  neighbors->south_east = hash;
+  neighbors->south_west = hash;
+  neighbors->north_east = hash;
+  neighbors->north_west = hash;
+
+  geohash_move_x(&neighbors->east, 1);
+  geohash_move_y(&neighbors->east, 0);
+
+  geohash_move_x(&neighbors->west, -1);
+  geohash_move_y(&neighbors->west, 0);
+
+  geohash_move_x(&neighbors->south, 0);
+  geohash_move_y(&neighbors->south, -1);
+
+  geohash_move_x(&neighbors->north, 0);
+  geohash_move_y(&neighbors->north, 1);
+
+  geohash_move_x(&neighbors->north_west, -1);
+  geohash_move_y(&neighbors->north_west, 1);
+
+  geohash_move_x(&neighbors->south_west, -1);
+  geohash_move_y(&neighbors->south_west, -1);
+
+  geohash_move_x(&neighbors->north_east, 1);
+  geohash_move_y(&neighbors->north_east, 1);
+
+  geohash_move_x(&neighbors->south_east, 1);
+  geohash_move_y(&neighbors->south_east, -1);
+}
+
+uint64_t Align52Bits(const GeoHashBits &hash) {
+  uint64_t bits = hash.bits;
+  bits <<= (52 - hash.step * 2);
+  return bits;
+}
+
+GeoHashRadius CalculateAreasByShapeWGS84(const GeoShape &shape) {
+  GeoHashRange long_range = wgs84LongRange(), lat_range = wgs84LatRange();
+  GeoHashRadius radius;
+  GeoHashBits hash;
+  GeoHashNeighbors neighbors;
+  GeoHashArea area;
+  double bounds[4];
+
+  geohashBoundingBox(shape, bounds);
+  double min_lon = bounds[0];
+  double min_lat = bounds[1];
+  double max_lon = bounds[2];
+  double max_lat = bounds[3];
+
+  double longitude = shape.xy[0];
+  double latitude = shape.xy[1];
+  /* radius_meters is calculated differently in different search types:
+   * 1) CIRCULAR_TYPE, just use radius.
+   * 2) RECTANGLE_TYPE, we use sqrt((width/2)^2 + (height/2)^2) to
+   * calculate the distance from the center point to the corner */
+  double radius_meters = shape.type == kGeoShapeTypeCircular ? shape.radius :
+      sqrt((shape.width / 2) * (shape.width / 2) + (shape.height / 2) * (shape.height / 2));
+  radius_meters *= shape.conversion;
+
+  uint8_t steps = geohashEstimateStepsByRadius(radius_meters, latitude);
+
+  geohashEncode(long_range, lat_range, longitude, latitude, steps, &hash);
+  Neighbors(hash, &neighbors);
+  geohashDecode(long_range, lat_range, hash, &area);
+
+  /* Check if the step is enough at the limits of the covered area.
+   * Sometimes when the search area is near an edge of the
+   * area, the estimated step is not small enough, since one of the
+   * north / south / west / east square is too near to the search area
+   * to cover everything. */
+  bool decrease_step = false;
+  {
+    GeoHashArea north, south, east, west;
+
+    geohashDecode(long_range, lat_range, neighbors.north, &north);
+    geohashDecode(long_range, lat_range, neighbors.south, &south);
+    geohashDecode(long_range, lat_range, neighbors.east, &east);
+    geohashDecode(long_range, lat_range, neighbors.west, &west);
+
+    if (north.latitude.max < max_lat) decrease_step = true;
+    if (south.latitude.min > min_lat) decrease_step = true;
+    if (east.longitude.max < max_lon) decrease_step = true;
+    if (west.longitude.min > min_lon) decrease_step = true;
+  }
+
+  if (steps > 1 && decrease_step) {
+    steps--;
+    geohashEncode(long_range, lat_range, longitude, latitude, steps, &hash);
+    Neighbors(hash, &neighbors);
+    geohashDecode(long_range, lat_range, hash, &area);
+  }
+
+  /* Exclude the search areas that are useless. */
+  if (steps >= 2) {
+    if (area.latitude.min < min_lat) {
+      neighbors.south = GeoHashBits();
+      neighbors.south_west = GeoHashBits();
+      neighbors.south_east = GeoHashBits();
+    }
+    if (area.latitude.max > max_lat) {
+      neighbors.north = GeoHashBits();
+      neighbors.north_east = GeoHashBits();
+      neighbors.north_west = GeoHashBits();
+    }
+    if (area.longitude.min < min_lon) {
+      neighbors.west = GeoHashBits();
+      neighbors.south_west = GeoHashBits();
+      neighbors.north_west = GeoHashBits();
+    }
+    if (area.longitude.max > max_lon) {
+      neighbors.east = GeoHashBits();
+      neighbors.south_east = GeoHashBits();
+      neighbors.north_east = GeoHashBits();
+    }
+  }
+  radius.hash = hash;
+  radius.neighbors = neighbors;
+  radius.area = area;
+  return radius;
+}
+
+/* Calculate distance using haversine great circle distance formula. */
+double GetDistance(double lon1d, double lat1d, double lon2d, double lat2d) {
+  double lon1r = deg_rad(lon1d);
+  double lon2r = deg_rad(lon2d);
+  double v = sin((lon2r - lon1r) / 2);
+  /* if v == 0 we can avoid doing expensive math when lons are practically the same */
+  if (v == 0.0) return geohashGetLatDistance(lat1d, lat2d);
+  double lat1r = deg_rad(lat1d);
+  double lat2r = deg_rad(lat2d);
+  double u = sin((lat2r - lat1r) / 2);
+  double a = u * u + cos(lat1r) * cos(lat2r) * v * v;
+  return 2.0 * EARTH_RADIUS_IN_METERS * asin(sqrt(a));
+}
+
+bool GetDistanceIfInShape(const GeoShape &shape, double longitude, double latitude, double *distance) {
+  if (shape.type == kGeoShapeTypeCircular) {
+    *distance = GetDistance(shape.xy[0], shape.xy[1], longitude, latitude);
+    return *distance <= shape.radius * shape.conversion;
+  }
+  /* Judge whether the point is in the rectangle, the width and height were converted
+   * into meters, and the distance was measured along the latitude and the longitude */
+  double lon_distance = GetDistance(longitude, latitude, shape.xy[0], latitude);
+  double lat_distance = geohashGetLatDistance(latitude, shape.xy[1]);
+  if (lon_distance > shape.width * shape.conversion / 2 || lat_distance > shape.height * shape.conversion / 2) {
+    return false;
+  }
+  *distance = GetDistance(shape.xy[0], shape.xy[1], longitude, latitude);
+  return true;
+}
+
+}  // namespace GeoHash
@@ -0,0 +1,83 @@
+// NOTE: this file is ported from redis's source: `src/geohash.h` and `src/geohash_helper.h`,
+// which are under the BSD license, Copyright (c) 2013-2014, yinqiwen, Matt Stancliff and
+// Salvatore Sanfilippo. The interfaces are changed to C++.
+
+#pragma once
+
+#include <stdint.h>
+
+#define GEO_STEP_MAX 26 /* 26*2 = 52 bits. */
+
+/* Limits from EPSG:900913 / EPSG:3785 / OSGEO:41001 */
+#define GEO_LAT_MIN -85.05112878
+#define GEO_LAT_MAX 85.05112878
+#define GEO_LONG_MIN -180
+#define GEO_LONG_MAX 180
+
+struct GeoHashBits {
+  uint64_t bits = 0;
+  uint8_t step = 0;
+  bool IsZero() const { return bits == 0 && step == 0; }
+};
+
+struct GeoHashRange {
+  double min = 0;
+  double max = 0;
+};
+
+struct GeoHashArea {
+  GeoHashBits hash;
+  GeoHashRange longitude;
+  GeoHashRange latitude;
+};
+
+struct GeoHashNeighbors {
+  GeoHashBits north;
+  GeoHashBits east;
+  GeoHashBits west;
+  GeoHashBits south;
+  GeoHashBits north_east;
+  GeoHashBits south_east;
+  GeoHashBits north_west;
+  GeoHashBits south_west;
+};
+
+struct GeoHashRadius {
+  GeoHashBits hash;
+  GeoHashArea area;
+  GeoHashNeighbors neighbors;
+};
+
+enum GeoShapeType {
+  kGeoShapeTypeCircular,
+  kGeoShapeTypeRectangle,
+};
+
+// GeoShape is the search area of GEORADIUS and GEOSEARCH, the radius, width and height are
+// in the unit of the query, and the conversion turns them into meters
+struct GeoShape {
+  GeoShapeType type = kGeoShapeTypeCircular;
+  double xy[2] = {0, 0};
+  double conversion = 1;
+  double radius = 0;
+  double width = 0;
+  double height = 0;
+};
+
+namespace GeoHash {
+
+bool EncodeWGS84(double longitude, double latitude, uint8_t step, GeoHashBits *hash);
+bool EncodeStandard(double longitude, double latitude, uint8_t step, GeoHashBits *hash);
+bool DecodeToLongLatWGS84(const GeoHashBits &hash, double *xy);
+void Neighbors(const GeoHashBits &hash, GeoHashNeighbors *neighbors);
+// Align52Bits returns the score of the hash in the sorted set
+uint64_t Align52Bits(const GeoHashBits &hash);
+// CalculateAreasByShapeWGS84 returns the box of the center and its 8 neighbors which cover the
+// shape, the useless neighbors are zero
+GeoHashRadius CalculateAreasByShapeWGS84(const GeoShape &shape);
+double GetDistance(double lon1d, double lat1d, double lon2d, double lat2d);
+// GetDistanceIfInShape returns false if the point is outside the shape, or else the
+// distance(meter) between the point and the center of the shape
+bool GetDistanceIfInShape(const GeoShape &shape, double longitude, double latitude, double *distance);
+
+}  // namespace GeoHash
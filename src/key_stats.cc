@@ -0,0 +1,173 @@
+#include "key_stats.h"
+
+#include <algorithm>
+#include <random>
+
+// the counts of the shard are halved after every kHotKeysDecaySamples samples
+const uint64_t kHotKeysDecaySamples = 1 << 16;
+
+static std::atomic<uint64_t> hot_keys_next_id{1};
+
+void TopKeys::Offer(const std::string &key, uint64_t count, RedisType type) {
+  if (k_ == 0) return;
+  auto iter = entries_.find(key);
+  if (iter != entries_.end()) {
+    iter->second.count = count;
+    iter->second.type = type;
+    return;
+  }
+  if (entries_.size() >= k_) {
+    if (count <= min_count_) return;
+    auto min_iter = std::min_element(entries_.begin(), entries_.end(),
+                                     [](const std::pair<const std::string, KeyCount> &a,
+                                        const std::pair<const std::string, KeyCount> &b) {
+                                       return a.second.count < b.second.count;
+                                     });
+    min_count_ = min_iter->second.count;
+    if (count <= min_count_) return;
+    entries_.erase(min_iter);
+  }
+  entries_.emplace(key, KeyCount{key, count, type});
+  if (entries_.size() >= k_) {
+    min_count_ = UINT64_MAX;
+    for (const auto &entry : entries_) min_count_ = std::min(min_count_, entry.second.count);
+  }
+}
+
+void TopKeys::Merge(const TopKeys &other) {
+  for (const auto &entry : other.entries_) {
+    auto iter = entries_.find(entry.first);
+    if (iter != entries_.end()) {
+      iter->second.count += entry.second.count;
+      continue;
+    }
+    Offer(entry.first, entry.second.count, entry.second.type);
+  }
+}
+
+void TopKeys::Decay() {
+  for (auto &entry : entries_) entry.second.count /= 2;
+  min_count_ /= 2;
+}
+
+void TopKeys::GetTop(size_t n, std::vector<KeyCount> *keys) const {
+  keys->clear();
+  for (const auto &entry : entries_) keys->emplace_back(entry.second);
+  std::sort(keys->begin(), keys->end(), [](const KeyCount &a, const KeyCount &b) {
+    return a.count > b.count || (a.count == b.count && a.key < b.key);
+  });
+  if (keys->size() > n) keys->resize(n);
+}
+
+void TopKeys::Clear() {
+  entries_.clear();
+  min_count_ = 0;
+}
+
+CountMinSketch::CountMinSketch(size_t width, size_t depth)
+    : width_(width), depth_(depth), counters_(width * depth, 0) {}
+
+uint64_t CountMinSketch::hash(const rocksdb::Slice &key) {
+  // FNV-1a, and the rows are indexed by the double hashing of its two halves
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < key.size(); i++) {
+    h ^= static_cast<uint8_t>(key[i]);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+uint32_t CountMinSketch::Add(const rocksdb::Slice &key) {
+  uint64_t h = hash(key), h1 = h & 0xffffffff, h2 = (h >> 32) | 1;
+  uint32_t estimated = UINT32_MAX;
+  for (size_t i = 0; i < depth_; i++) {
+    auto &counter = counters_[i * width_ + (h1 + i * h2) % width_];
+    if (counter < UINT32_MAX) counter++;
+    estimated = std::min(estimated, counter);
+  }
+  return estimated;
+}
+
+uint32_t CountMinSketch::Estimate(const rocksdb::Slice &key) const {
+  uint64_t h = hash(key), h1 = h & 0xffffffff, h2 = (h >> 32) | 1;
+  uint32_t estimated = UINT32_MAX;
+  for (size_t i = 0; i < depth_; i++) {
+    estimated = std::min(estimated, counters_[i * width_ + (h1 + i * h2) % width_]);
+  }
+  return estimated;
+}
+
+void CountMinSketch::Decay() {
+  for (auto &counter : counters_) counter /= 2;
+}
+
+void CountMinSketch::Clear() {
+  std::fill(counters_.begin(), counters_.end(), 0);
+}
+
+HotKeys::HotKeys(size_t top_k) : top_k_(top_k), id_(hot_keys_next_id.fetch_add(1)) {}
+
+bool HotKeys::Sample(int ratio) {
+  if (ratio <= 0) return false;
+  if (ratio >= 100) return true;
+  static thread_local std::minstd_rand engine(std::random_device{}());
+  return static_cast<int>(engine() % 100) < ratio;
+}
+
+HotKeys::Shard *HotKeys::localShard() {
+  // the id rather than the address identifies the instance, since a new one may reuse the address
+  thread_local uint64_t local_id = 0;
+  thread_local Shard *local_shard = nullptr;
+  if (local_id == id_) return local_shard;
+  auto shard = new Shard(top_k_);
+  shards_mu_.lock();
+  shards_.emplace_back(shard);
+  shards_mu_.unlock();
+  local_id = id_;
+  local_shard = shard;
+  return shard;
+}
+
+void HotKeys::Record(const std::string &ns, const rocksdb::Slice &key) {
+  std::string ns_key;
+  ComposeNamespaceKey(ns, key, &ns_key);
+  auto shard = localShard();
+  std::lock_guard<std::mutex> guard(shard->mu);
+  shard->top.Offer(ns_key, shard->sketch.Add(ns_key));
+  if (++shard->samples % kHotKeysDecaySamples == 0) {
+    shard->sketch.Decay();
+    shard->top.Decay();
+  }
+}
+
+void HotKeys::GetHotKeys(const std::string &ns, size_t n, std::vector<KeyCount> *keys) {
+  // the key accessed by multiple workers is counted in their shards, so the counts are summed
+  std::unordered_map<std::string, uint64_t> counts;
+  std::vector<KeyCount> shard_keys;
+  rocksdb::Slice key_ns, user_key;
+  {
+    std::lock_guard<std::mutex> guard(shards_mu_);
+    for (const auto &shard : shards_) {
+      std::lock_guard<std::mutex> shard_guard(shard->mu);
+      shard->top.GetTop(top_k_, &shard_keys);
+      for (const auto &key : shard_keys) {
+        ExtractNamespaceKey(key.key, &key_ns, &user_key);
+        if (key_ns != ns) continue;
+        counts[user_key.ToString()] += key.count;
+      }
+    }
+  }
+  TopKeys top(n);
+  for (const auto &count : counts) top.Offer(count.first, count.second);
+  top.GetTop(n, keys);
+}
+
+void HotKeys::Reset() {
+  std::lock_guard<std::mutex> guard(shards_mu_);
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> shard_guard(shard->mu);
+    shard->sketch.Clear();
+    shard->top.Clear();
+    shard->samples = 0;
+  }
+}
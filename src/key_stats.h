@@ -0,0 +1,98 @@
+#pragma once
+
+#include <rocksdb/slice.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "redis_metadata.h"
+
+struct KeyCount {
+  std::string key;
+  uint64_t count;
+  RedisType type;
+};
+
+// TopKeys keeps the k keys with the largest counts, the key whose count isn't larger
+// than the smallest kept one is dropped once it's full. It isn't thread safe.
+class TopKeys {
+ public:
+  explicit TopKeys(size_t k) : k_(k) {}
+  // Offer sets the count of the key if it is kept, or it replaces the smallest one
+  void Offer(const std::string &key, uint64_t count, RedisType type = kRedisNone);
+  void Merge(const TopKeys &other);
+  // Decay halves the counts, so the keys which are no longer hot can be replaced
+  void Decay();
+  // GetTop returns at most n keys ordered by the count descending
+  void GetTop(size_t n, std::vector<KeyCount> *keys) const;
+  size_t Size() const { return entries_.size(); }
+  size_t Capacity() const { return k_; }
+  void Clear();
+
+ private:
+  size_t k_;
+  // the lower bound of the smallest count once it's full, the offers below it are
+  // dropped without searching the smallest one
+  uint64_t min_count_ = 0;
+  std::unordered_map<std::string, KeyCount> entries_;
+};
+
+// CountMinSketch estimates the counts of the keys in the fixed memory, the estimation
+// is never less than the real count, and the error is bounded by the width.
+class CountMinSketch {
+ public:
+  explicit CountMinSketch(size_t width = 2048, size_t depth = 4);
+  // Add increases the count of the key and returns its estimated count
+  uint32_t Add(const rocksdb::Slice &key);
+  uint32_t Estimate(const rocksdb::Slice &key) const;
+  void Decay();
+  void Clear();
+
+ private:
+  size_t width_;
+  size_t depth_;
+  std::vector<uint32_t> counters_;
+
+  static uint64_t hash(const rocksdb::Slice &key);
+};
+
+// HotKeys counts the sampled accesses of the keys by the count-min sketch of the
+// accessing thread, and each shard keeps the top keys estimated by its sketch, so the
+// workers never contend with each other. The shards are merged while reading, and
+// the counts are halved periodically to follow the recent accesses.
+class HotKeys {
+ public:
+  explicit HotKeys(size_t top_k = 64);
+  HotKeys(const HotKeys &) = delete;
+  HotKeys &operator=(const HotKeys &) = delete;
+
+  // Sample decides whether the access should be sampled by the ratio(0~100)
+  static bool Sample(int ratio);
+  void Record(const std::string &ns, const rocksdb::Slice &key);
+  // GetHotKeys returns at most n hottest keys of the namespace, the counts are the
+  // estimated samples since the last decay
+  void GetHotKeys(const std::string &ns, size_t n, std::vector<KeyCount> *keys);
+  void Reset();
+
+ private:
+  struct Shard {
+    explicit Shard(size_t top_k) : top(top_k) {}
+    // only the owner thread records, the lock is taken by the readers rarely
+    std::mutex mu;
+    CountMinSketch sketch;
+    TopKeys top;
+    uint64_t samples = 0;
+  };
+  Shard *localShard();
+
+  size_t top_k_;
+  uint64_t id_;
+  std::mutex shards_mu_;
+  // the shards are kept after the threads exit, to keep their counts
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
@@ -1,33 +1,138 @@
 #include "lock_manager.h"
 
+#include <algorithm>
 #include <thread>
 #include <string>
 
+// the slots locked by the transaction of the thread, they are kept until the end of it
+struct TransactionLocks {
+  LockManager *owner = nullptr;
+  std::vector<unsigned> slots;
+};
+static thread_local TransactionLocks txn_locks;
+
 LockManager::LockManager(int hash_power): hash_power_(hash_power) {
   hash_mask_ = (1U << hash_power) - 1;
   for (unsigned i = 0; i < Size(); i++) {
-    mutex_pool_.emplace_back(new std::mutex());
+    auto rwlock = new pthread_rwlock_t;
+    pthread_rwlock_init(rwlock, nullptr);
+    mutex_pool_.emplace_back(rwlock);
   }
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+#ifdef __linux__
+  // prefer the transactions, or they may starve under the steady multi-key writes
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  pthread_rwlock_init(&txn_rwlock_, &attr);
+  pthread_rwlockattr_destroy(&attr);
 }
 
 LockManager::~LockManager() {
   for (const auto &mu : mutex_pool_) {
+    pthread_rwlock_destroy(mu);
     delete mu;
   }
+  pthread_rwlock_destroy(&txn_rwlock_);
 }
 
 unsigned LockManager::hash(const rocksdb::Slice &key) {
-  return static_cast<unsigned>(std::hash<std::string>{}(key.ToString()) & hash_mask_);
+  // FNV-1a, hash the slice in place to avoid copying the key for each lock
+  uint32_t h = 2166136261U;
+  for (size_t i = 0; i < key.size(); i++) {
+    h ^= static_cast<uint8_t>(key[i]);
+    h *= 16777619U;
+  }
+  return static_cast<unsigned>(h & hash_mask_);
 }
 
 unsigned LockManager::Size() {
   return (1U << hash_power_);
 }
 
+void LockManager::lockSlot(unsigned slot, bool exclusive) {
+  if (InTransaction()) {
+    auto &slots = txn_locks.slots;
+    if (std::find(slots.begin(), slots.end(), slot) != slots.end()) return;
+    // the shared lock can't be upgraded later, so the transaction always locks exclusively
+    exclusive = true;
+    slots.emplace_back(slot);
+  }
+  auto mu = mutex_pool_[slot];
+  int ret = exclusive ? pthread_rwlock_trywrlock(mu) : pthread_rwlock_tryrdlock(mu);
+  if (ret != 0) {
+    contended_count_.fetch_add(1, std::memory_order_relaxed);
+    exclusive ? pthread_rwlock_wrlock(mu) : pthread_rwlock_rdlock(mu);
+  }
+  acquired_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LockManager::unlockSlot(unsigned slot) {
+  // the slots of the transaction are unlocked after it is committed or discarded
+  if (InTransaction()) return;
+  pthread_rwlock_unlock(mutex_pool_[slot]);
+}
+
 void LockManager::Lock(const rocksdb::Slice &key) {
-  mutex_pool_[hash(key)]->lock();
+  lockSlot(hash(key), true);
 }
 
 void LockManager::UnLock(const rocksdb::Slice &key) {
-  mutex_pool_[hash(key)]->unlock();
+  unlockSlot(hash(key));
+}
+
+void LockManager::RLock(const rocksdb::Slice &key) {
+  lockSlot(hash(key), false);
+}
+
+void LockManager::RUnLock(const rocksdb::Slice &key) {
+  unlockSlot(hash(key));
+}
+
+std::vector<unsigned> LockManager::MultiLock(const std::vector<rocksdb::Slice> &keys) {
+  std::vector<unsigned> slots;
+  slots.reserve(keys.size());
+  for (const auto &key : keys) {
+    slots.emplace_back(hash(key));
+  }
+  // different keys may be hashed into the same slot, lock it only once
+  std::sort(slots.begin(), slots.end());
+  slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+  bool in_txn = InTransaction();
+  if (!in_txn) pthread_rwlock_rdlock(&txn_rwlock_);
+  for (const auto slot : slots) {
+    lockSlot(slot, true);
+  }
+  multi_lock_count_.fetch_add(1, std::memory_order_relaxed);
+  // the slots are kept by the transaction, so there's nothing to unlock
+  if (in_txn) slots.clear();
+  return slots;
+}
+
+void LockManager::MultiUnLock(const std::vector<unsigned> &slots) {
+  if (InTransaction()) return;
+  for (auto iter = slots.rbegin(); iter != slots.rend(); ++iter) {
+    pthread_rwlock_unlock(mutex_pool_[*iter]);
+  }
+  pthread_rwlock_unlock(&txn_rwlock_);
+}
+
+void LockManager::BeginTransaction() {
+  pthread_rwlock_wrlock(&txn_rwlock_);
+  txn_locks.owner = this;
+  txn_locks.slots.clear();
+}
+
+void LockManager::EndTransaction() {
+  if (!InTransaction()) return;
+  txn_locks.owner = nullptr;
+  for (auto iter = txn_locks.slots.rbegin(); iter != txn_locks.slots.rend(); ++iter) {
+    pthread_rwlock_unlock(mutex_pool_[*iter]);
+  }
+  txn_locks.slots.clear();
+  pthread_rwlock_unlock(&txn_rwlock_);
+}
+
+bool LockManager::InTransaction() {
+  return txn_locks.owner == this;
 }
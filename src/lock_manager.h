@@ -1,10 +1,14 @@
 #pragma once
 
+#include <pthread.h>
 #include <rocksdb/db.h>
 
-#include <mutex>
+#include <atomic>
+#include <string>
 #include <vector>
 
+#include "tracing.h"
+
 class LockManager {
  public:
   explicit LockManager(int hash_power);
@@ -13,25 +17,76 @@ class LockManager {
   unsigned Size();
   void Lock(const rocksdb::Slice &key);
   void UnLock(const rocksdb::Slice &key);
+  void RLock(const rocksdb::Slice &key);
+  void RUnLock(const rocksdb::Slice &key);
+  // MultiLock locks the slots of all keys in ascending slot order, so
+  // concurrent multi-key writers can't deadlock with each other, and
+  // returns the locked slots which should be passed to MultiUnLock.
+  std::vector<unsigned> MultiLock(const std::vector<rocksdb::Slice> &keys);
+  void MultiUnLock(const std::vector<unsigned> &slots);
+  // BeginTransaction makes the locks taken by the thread reentrant, and keeps them until
+  // EndTransaction. The transaction excludes the other transactions and multi-key lockers,
+  // the rest lock one slot at a time and never wait with it held, so the transaction can
+  // lock its keys in any order without deadlock.
+  void BeginTransaction();
+  void EndTransaction();
+  bool InTransaction();
+
+  uint64_t GetAcquiredCount() { return acquired_count_; }
+  uint64_t GetContendedCount() { return contended_count_; }
+  uint64_t GetMultiLockCount() { return multi_lock_count_; }
 
  private:
   int hash_power_;
   int hash_mask_;
-  std::vector<std::mutex*> mutex_pool_;
+  std::vector<pthread_rwlock_t *> mutex_pool_;
+  // the transactions take it exclusively and the multi-key lockers take it shared
+  pthread_rwlock_t txn_rwlock_;
+  std::atomic<uint64_t> acquired_count_{0};
+  std::atomic<uint64_t> contended_count_{0};
+  std::atomic<uint64_t> multi_lock_count_{0};
   unsigned hash(const rocksdb::Slice &key);
+  void lockSlot(unsigned slot, bool exclusive);
+  void unlockSlot(unsigned slot);
 };
 
 class LockGuard {
  public:
-  explicit LockGuard(LockManager *lock_mgr, rocksdb::Slice key):
+  explicit LockGuard(LockManager *lock_mgr, rocksdb::Slice key, bool exclusive = true):
       lock_mgr_(lock_mgr),
-      key_(key) {
-    lock_mgr->Lock(key_);
+      key_(key),
+      exclusive_(exclusive) {
+    TraceSpanTimer timer(Trace::kLockWait);
+    if (exclusive_) {
+      lock_mgr->Lock(key_);
+    } else {
+      lock_mgr->RLock(key_);
+    }
   }
   ~LockGuard() {
-    lock_mgr_->UnLock(key_);
+    if (exclusive_) {
+      lock_mgr_->UnLock(key_);
+    } else {
+      lock_mgr_->RUnLock(key_);
+    }
   }
  private:
   LockManager *lock_mgr_ = nullptr;
   rocksdb::Slice key_;
+  bool exclusive_;
+};
+
+class MultiLockGuard {
+ public:
+  explicit MultiLockGuard(LockManager *lock_mgr, const std::vector<rocksdb::Slice> &keys):
+      lock_mgr_(lock_mgr) {
+    TraceSpanTimer timer(Trace::kLockWait);
+    slots_ = lock_mgr_->MultiLock(keys);
+  }
+  ~MultiLockGuard() {
+    lock_mgr_->MultiUnLock(slots_);
+  }
+ private:
+  LockManager *lock_mgr_ = nullptr;
+  std::vector<unsigned> slots_;
 };
@@ -25,74 +25,157 @@ std::string PerfEntry::ToRedisString() {
   return output;
 }
 
+std::string TraceEntry::ToRedisString() {
+  std::string output;
+  output.append(Redis::MultiLen(5));
+  output.append(Redis::Integer(id));
+  output.append(Redis::Integer(time));
+  output.append(Redis::BulkString(cmd_name));
+  output.append(Redis::Integer(duration));
+  output.append(Redis::MultiLen(fields.size() * 2));
+  for (const auto &field : fields) {
+    output.append(Redis::BulkString(field.first));
+    output.append(Redis::Integer(field.second));
+  }
+  return output;
+}
+
+size_t SlowEntry::MemoryUsage() {
+  size_t usage = sizeof(*this);
+  for (const auto &arg : args) usage += sizeof(arg) + arg.capacity();
+  return usage;
+}
+
+size_t PerfEntry::MemoryUsage() {
+  return sizeof(*this) + cmd_name.capacity() + perf_context.capacity() + iostats_context.capacity();
+}
+
+size_t TraceEntry::MemoryUsage() {
+  size_t usage = sizeof(*this) + cmd_name.capacity();
+  for (const auto &field : fields) usage += sizeof(field) + field.first.capacity();
+  return usage;
+}
+
+static std::atomic<uint64_t> collector_next_id = {1};
+
+template <class T>
+LogCollector<T>::LogCollector() : collector_id_(collector_next_id.fetch_add(1)) {}
+
 template <class T>
 LogCollector<T>::~LogCollector() {
   Reset();
 }
 
+template <class T>
+typename LogCollector<T>::Shard *LogCollector<T>::localShard() {
+  // the id rather than the address identifies the collector, since a new one may reuse the address
+  thread_local uint64_t local_collector_id = 0;
+  thread_local Shard *local_shard = nullptr;
+  if (local_collector_id == collector_id_) return local_shard;
+  auto shard = new Shard;
+  shards_mu_.lock();
+  shards_.emplace_back(shard);
+  shards_mu_.unlock();
+  local_collector_id = collector_id_;
+  local_shard = shard;
+  return shard;
+}
+
+template <class T>
+void LogCollector<T>::Shard::PopBack() {
+  memory_usage -= entries.back()->MemoryUsage();
+  delete entries.back();
+  entries.pop_back();
+}
+
 template <class T>
 ssize_t LogCollector<T>::Size() {
-  size_t n;
-  mu_.lock();
-  n = entries_.size();
-  mu_.unlock();
+  size_t n = 0;
+  std::lock_guard<std::mutex> guard(shards_mu_);
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> shard_guard(shard->mu);
+    n += shard->entries.size();
+  }
+  int64_t max_entries = max_entries_;
+  if (max_entries > 0) n = std::min(n, static_cast<size_t>(max_entries));
   return n;
 }
 
+template <class T>
+size_t LogCollector<T>::MemoryUsage() {
+  size_t usage = 0;
+  std::lock_guard<std::mutex> guard(shards_mu_);
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> shard_guard(shard->mu);
+    usage += shard->memory_usage;
+  }
+  return usage;
+}
+
 template <class T>
 void LogCollector<T>::Reset() {
-  mu_.lock();
-  while (!entries_.empty()) {
-    delete entries_.front();
-    entries_.pop_front();
+  std::lock_guard<std::mutex> guard(shards_mu_);
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> shard_guard(shard->mu);
+    while (!shard->entries.empty()) shard->PopBack();
   }
-  mu_.unlock();
 }
 
 template <class T>
 void LogCollector<T>::SetMaxEntries(int64_t max_entries) {
-  mu_.lock();
-  while (max_entries > 0 && static_cast<int64_t>(entries_.size()) > max_entries) {
-    delete entries_.back();
-    entries_.pop_back();
-  }
   max_entries_ = max_entries;
-  mu_.unlock();
+  if (max_entries <= 0) return;
+  std::lock_guard<std::mutex> guard(shards_mu_);
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> shard_guard(shard->mu);
+    while (static_cast<int64_t>(shard->entries.size()) > max_entries) shard->PopBack();
+  }
 }
 
 template <class T>
 void LogCollector<T>::PushEntry(T *entry) {
-  mu_.lock();
-  entry->id = ++id_;
+  entry->id = id_.fetch_add(1, std::memory_order_relaxed) + 1;
   entry->time = time(nullptr);
-  if (max_entries_ > 0 && !entries_.empty()
-      && entries_.size() >= static_cast<size_t>(max_entries_)) {
-    delete entries_.back();
-    entries_.pop_back();
+  auto shard = localShard();
+  int64_t max_entries = max_entries_;
+  std::lock_guard<std::mutex> guard(shard->mu);
+  if (max_entries > 0 && !shard->entries.empty()
+      && shard->entries.size() >= static_cast<size_t>(max_entries)) {
+    shard->PopBack();
   }
-  entries_.push_front(entry);
-  mu_.unlock();
+  shard->memory_usage += entry->MemoryUsage();
+  shard->entries.push_front(entry);
 }
 
 template <class T>
 std::string LogCollector<T>::GetLatestEntries(int64_t cnt) {
-  size_t n;
-  std::string output;
+  size_t n = cnt > 0 ? static_cast<size_t>(cnt) : SIZE_MAX;
+  int64_t max_entries = max_entries_;
+  if (max_entries > 0) n = std::min(n, static_cast<size_t>(max_entries));
 
-  mu_.lock();
-  if (cnt > 0) {
-    n = std::min(entries_.size(), static_cast<size_t>(cnt));
-  } else {
-    n = entries_.size();
-  }
-  output.append(Redis::MultiLen(n));
-  for (const auto &entry : entries_) {
-    output.append(entry->ToRedisString());
-    if (--n == 0) break;
+  // take the latest n entries of each shard, and merge them by the id
+  std::vector<std::pair<uint64_t, std::string>> entries;
+  {
+    std::lock_guard<std::mutex> guard(shards_mu_);
+    for (const auto &shard : shards_) {
+      std::lock_guard<std::mutex> shard_guard(shard->mu);
+      size_t i = 0;
+      for (const auto &entry : shard->entries) {
+        if (i++ == n) break;
+        entries.emplace_back(entry->id, entry->ToRedisString());
+      }
+    }
   }
-  mu_.unlock();
+  std::sort(entries.begin(), entries.end(),
+            [](const std::pair<uint64_t, std::string> &a, const std::pair<uint64_t, std::string> &b) {
+              return a.first > b.first;
+            });
+  n = std::min(n, entries.size());
+  std::string output = Redis::MultiLen(n);
+  for (size_t i = 0; i < n; i++) output.append(entries[i].second);
   return output;
 }
 
 template class LogCollector<SlowEntry>;
 template class LogCollector<PerfEntry>;
+template class LogCollector<TraceEntry>;
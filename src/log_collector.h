@@ -2,8 +2,11 @@
 
 #include <time.h>
 
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <string>
-#include <list>
+#include <utility>
 #include <vector>
 #include <mutex>
 #include <cstdint>
@@ -18,6 +21,7 @@ class SlowEntry {
 
  public:
   std::string ToRedisString();
+  size_t MemoryUsage();
 };
 
 class PerfEntry {
@@ -31,21 +35,54 @@ class PerfEntry {
 
  public:
   std::string ToRedisString();
+  size_t MemoryUsage();
 };
 
+class TraceEntry {
+ public:
+  uint64_t id;
+  time_t time;
+  uint64_t duration;
+  std::string cmd_name;
+  // the names and microseconds of the stages and spans, and the bytes of the reply
+  std::vector<std::pair<std::string, uint64_t>> fields;
+
+ public:
+  std::string ToRedisString();
+  size_t MemoryUsage();
+};
+
+// LogCollector keeps the latest entries in the shards of the pushing threads, so the
+// threads never contend with each other while pushing, and the shards are merged
+// by the entry id while reading. Each shard keeps at most max_entries entries.
 template <class T>
 class LogCollector {
  public:
+  LogCollector();
   ~LogCollector();
   ssize_t Size();
+  // MemoryUsage returns the approximate bytes of the entries
+  size_t MemoryUsage();
   void Reset();
   void SetMaxEntries(int64_t max_entries);
   void PushEntry(T *entry);
   std::string GetLatestEntries(int64_t cnt);
 
  private:
-  std::mutex mu_;
-  uint64_t id_ = 0;
-  int64_t max_entries_ = 128;
-  std::list<T*> entries_;
+  struct Shard {
+    // contended only when a reader merges the shards
+    std::mutex mu;
+    std::deque<T*> entries;  // the newest one is in the front
+    size_t memory_usage = 0;
+
+    void PopBack();
+  };
+  Shard *localShard();
+
+  uint64_t collector_id_;
+  std::atomic<uint64_t> id_{0};
+  std::atomic<int64_t> max_entries_{128};
+  std::mutex shards_mu_;
+  // never freed, the entries of the exited threads stay visible
+  std::vector<std::unique_ptr<Shard>> shards_;
 };
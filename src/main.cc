@@ -29,6 +29,10 @@
 
 const char *kDefaultConfPath = "../kvrocks.conf";
 
+// the heap profiling is enabled but inactive, so nothing is sampled until the PROFILE HEAP
+// activates it, the jemalloc reads the options before the main
+extern "C" const char *malloc_conf = "prof:true,prof_active:false";
+
 std::function<void()> hup_handler;
 
 struct Options {
@@ -0,0 +1,76 @@
+#include "merge_operator.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "encoding.h"
+#include "redis_metadata.h"
+
+namespace Engine {
+
+static bool addWithoutOverflow(int64_t increment, int64_t *value) {
+  if ((increment < 0 && *value < 0 && increment < (INT64_MIN - *value))
+      || (increment > 0 && *value > 0 && increment > (INT64_MAX - *value))) {
+    return false;
+  }
+  *value += increment;
+  return true;
+}
+
+std::string CounterMergeOperator::EncodeOperand(int64_t increment) {
+  std::string operand;
+  PutFixed64(&operand, static_cast<uint64_t>(increment));
+  return operand;
+}
+
+bool CounterMergeOperator::ParseValue(const rocksdb::Slice &value, int64_t *n) {
+  std::string str = value.ToString();
+  char *end = nullptr;
+  errno = 0;
+  long long parsed = strtoll(str.c_str(), &end, 10);  // NOLINT
+  if (end == str.c_str() || errno == ERANGE) return false;
+  *n = static_cast<int64_t>(parsed);
+  return true;
+}
+
+bool CounterMergeOperator::FullMergeV2(const MergeOperationInput &merge_in,
+                                       MergeOperationOutput *merge_out) const {
+  std::string header;
+  int64_t value = 0;
+  if (merge_in.existing_value) {
+    const auto &existing = *merge_in.existing_value;
+    // the value is overwritten by a non-integer one, the operands are dropped since
+    // the increments are only merged after the integer is checked under the key lock
+    if (existing.size() < header_size_
+        || !ParseValue(rocksdb::Slice(existing.data() + header_size_, existing.size() - header_size_), &value)) {
+      merge_out->new_value.assign(existing.data(), existing.size());
+      return true;
+    }
+    header.assign(existing.data(), header_size_);
+  } else if (header_size_ > 0) {
+    // the base is dropped by the compaction filter after it is expired, so keep it expired
+    header.push_back(static_cast<char>(kRedisString));
+    PutFixed32(&header, 1);
+    header.resize(header_size_, '\0');
+  }
+  for (const auto &operand : merge_in.operand_list) {
+    if (operand.size() != 8) continue;
+    // the increments are checked against the exact value under the key lock before they are
+    // written, so this is only a guard against the corrupted operands
+    addWithoutOverflow(static_cast<int64_t>(DecodeFixed64(operand.data())), &value);
+  }
+  merge_out->new_value = header + std::to_string(value);
+  return true;
+}
+
+bool CounterMergeOperator::PartialMerge(const rocksdb::Slice &key, const rocksdb::Slice &left_operand,
+                                        const rocksdb::Slice &right_operand, std::string *new_value,
+                                        rocksdb::Logger *logger) const {
+  if (left_operand.size() != 8 || right_operand.size() != 8) return false;
+  auto increment = static_cast<int64_t>(DecodeFixed64(left_operand.data()));
+  if (!addWithoutOverflow(static_cast<int64_t>(DecodeFixed64(right_operand.data())), &increment)) return false;
+  *new_value = EncodeOperand(increment);
+  return true;
+}
+
+}  // namespace Engine
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <rocksdb/merge_operator.h>
+
+#include <string>
+
+namespace Engine {
+
+// CounterMergeOperator folds the increments of the integer values, so the counters are increased
+// by the small merge operands instead of rewriting the values.
+// The operand is the fixed64 of the increment, and the values of the metadata column family
+// are prefixed by the string metadata header, flags(1byte) + expire(4byte), which is kept.
+class CounterMergeOperator : public rocksdb::MergeOperator {
+ public:
+  // @header_size: the size of the header before the integer in the value
+  explicit CounterMergeOperator(size_t header_size) : header_size_(header_size) {}
+  const char *Name() const override { return "Kvrocks.CounterMergeOperator"; }
+  bool FullMergeV2(const MergeOperationInput &merge_in, MergeOperationOutput *merge_out) const override;
+  bool PartialMerge(const rocksdb::Slice &key, const rocksdb::Slice &left_operand,
+                    const rocksdb::Slice &right_operand, std::string *new_value,
+                    rocksdb::Logger *logger) const override;
+
+  static std::string EncodeOperand(int64_t increment);
+  // ParseValue parses the integer like std::stoll, which is used by the increments under the lock
+  static bool ParseValue(const rocksdb::Slice &value, int64_t *n);
+
+ private:
+  size_t header_size_;
+};
+
+}  // namespace Engine
@@ -0,0 +1,128 @@
+#include "metadata_cache.h"
+
+MetadataCache::MetadataCache(size_t capacity, int shard_bits)
+    : capacity_(capacity),
+      shard_bits_(shard_bits),
+      shards_(1U << shard_bits) {
+}
+
+MetadataCache::Shard *MetadataCache::getShard(const rocksdb::Slice &ns_key) {
+  uint32_t h = 2166136261U;
+  for (size_t i = 0; i < ns_key.size(); i++) {
+    h ^= static_cast<uint8_t>(ns_key[i]);
+    h *= 16777619U;
+  }
+  return &shards_[h & ((1U << shard_bits_) - 1)];
+}
+
+size_t MetadataCache::charge(const std::string &key, const std::string &bytes) {
+  // rough overhead of the list node and hash index entry
+  return key.size() * 2 + bytes.size() + 64;
+}
+
+bool MetadataCache::Get(const rocksdb::Slice &ns_key, std::string *bytes) {
+  if (!Enabled()) return false;
+  auto shard = getShard(ns_key);
+  std::lock_guard<std::mutex> guard(shard->mu);
+  auto iter = shard->index.find(ns_key.ToString());
+  if (iter == shard->index.end()) {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  shard->lru.splice(shard->lru.begin(), shard->lru, iter->second);
+  bytes->assign(iter->second->second);
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+uint64_t MetadataCache::Generation(const rocksdb::Slice &ns_key) {
+  auto shard = getShard(ns_key);
+  std::lock_guard<std::mutex> guard(shard->mu);
+  return shard->generation;
+}
+
+void MetadataCache::Insert(const rocksdb::Slice &ns_key, const rocksdb::Slice &bytes, uint64_t generation) {
+  if (!Enabled()) return;
+  auto shard = getShard(ns_key);
+  std::lock_guard<std::mutex> guard(shard->mu);
+  // the shard is invalidated after the metadata is loaded, the bytes may be stale
+  if (shard->generation != generation) return;
+  std::string key = ns_key.ToString();
+  auto iter = shard->index.find(key);
+  if (iter != shard->index.end()) {
+    shard->usage -= charge(iter->second->first, iter->second->second);
+    shard->lru.erase(iter->second);
+    shard->index.erase(iter);
+  }
+  shard->lru.emplace_front(key, bytes.ToString());
+  shard->usage += charge(shard->lru.front().first, shard->lru.front().second);
+  shard->index[std::move(key)] = shard->lru.begin();
+  evictIfNeed(shard);
+}
+
+void MetadataCache::Erase(const rocksdb::Slice &ns_key) {
+  if (!Enabled()) return;
+  auto shard = getShard(ns_key);
+  std::lock_guard<std::mutex> guard(shard->mu);
+  shard->generation++;
+  auto iter = shard->index.find(ns_key.ToString());
+  if (iter == shard->index.end()) return;
+  shard->usage -= charge(iter->second->first, iter->second->second);
+  shard->lru.erase(iter->second);
+  shard->index.erase(iter);
+}
+
+void MetadataCache::Clear() {
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> guard(shard.mu);
+    shard.generation++;
+    shard.lru.clear();
+    shard.index.clear();
+    shard.usage = 0;
+  }
+}
+
+void MetadataCache::SetCapacity(size_t capacity) {
+  capacity_ = capacity;
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> guard(shard.mu);
+    evictIfNeed(&shard);
+  }
+}
+
+size_t MetadataCache::GetUsage() {
+  size_t usage = 0;
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> guard(shard.mu);
+    usage += shard.usage;
+  }
+  return usage;
+}
+
+void MetadataCache::GetHotKeys(size_t n, std::vector<std::string> *keys) {
+  keys->clear();
+  std::vector<std::vector<std::string>> shard_keys(shards_.size());
+  size_t per_shard = (n >> shard_bits_) + 1;
+  for (size_t i = 0; i < shards_.size(); i++) {
+    std::lock_guard<std::mutex> guard(shards_[i].mu);
+    for (const auto &entry : shards_[i].lru) {
+      if (shard_keys[i].size() >= per_shard) break;
+      shard_keys[i].emplace_back(entry.first);
+    }
+  }
+  for (size_t j = 0; j < per_shard && keys->size() < n; j++) {
+    for (size_t i = 0; i < shard_keys.size() && keys->size() < n; i++) {
+      if (j < shard_keys[i].size()) keys->emplace_back(std::move(shard_keys[i][j]));
+    }
+  }
+}
+
+void MetadataCache::evictIfNeed(Shard *shard) {
+  size_t shard_capacity = capacity_ >> shard_bits_;
+  while (shard->usage > shard_capacity && !shard->lru.empty()) {
+    auto &last = shard->lru.back();
+    shard->usage -= charge(last.first, last.second);
+    shard->index.erase(last.first);
+    shard->lru.pop_back();
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <rocksdb/slice.h>
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// MetadataCache is a sharded LRU cache of the encoded metadata keyed by ns_key,
+// the entries are invalidated after the metadata is written into the db.
+// To prevent the reader from filling the stale value into the cache while the
+// writer is invalidating the same key, the reader should take the generation
+// of the shard before loading the metadata from db, and the insert would be
+// dropped if the shard is invalidated after that.
+class MetadataCache {
+ public:
+  explicit MetadataCache(size_t capacity, int shard_bits = 4);
+  ~MetadataCache() = default;
+
+  bool Get(const rocksdb::Slice &ns_key, std::string *bytes);
+  uint64_t Generation(const rocksdb::Slice &ns_key);
+  void Insert(const rocksdb::Slice &ns_key, const rocksdb::Slice &bytes, uint64_t generation);
+  void Erase(const rocksdb::Slice &ns_key);
+  void Clear();
+  void SetCapacity(size_t capacity);
+  bool Enabled() { return capacity_ > 0; }
+
+  size_t GetCapacity() { return capacity_; }
+  size_t GetUsage();
+  // GetHotKeys returns at most n most recently used keys, they are taken from the
+  // heads of the shards in turn, so the hottest keys of all shards come first
+  void GetHotKeys(size_t n, std::vector<std::string> *keys);
+  uint64_t GetHits() { return hits_; }
+  uint64_t GetMisses() { return misses_; }
+
+  MetadataCache(const MetadataCache &) = delete;
+  MetadataCache &operator=(const MetadataCache &) = delete;
+
+ private:
+  typedef std::list<std::pair<std::string, std::string>> LRUList;
+  struct Shard {
+    std::mutex mu;
+    LRUList lru;
+    std::unordered_map<std::string, LRUList::iterator> index;
+    size_t usage = 0;
+    uint64_t generation = 0;
+  };
+
+  std::atomic<size_t> capacity_;
+  int shard_bits_;
+  std::vector<Shard> shards_;
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+
+  Shard *getShard(const rocksdb::Slice &ns_key);
+  void evictIfNeed(Shard *shard);
+  static size_t charge(const std::string &key, const std::string &bytes);
+};
@@ -0,0 +1,62 @@
+#include "metrics_server.h"
+
+#include <event2/buffer.h>
+#include <glog/logging.h>
+#include <cerrno>
+#include <cstring>
+
+#include "util.h"
+
+MetricsServer::MetricsServer(const std::vector<std::string> &binds, int port, Renderer renderer)
+    : binds_(binds), port_(port), renderer_(std::move(renderer)) {}
+
+MetricsServer::~MetricsServer() {
+  if (http_) evhttp_free(http_);
+  if (base_) event_base_free(base_);
+}
+
+Status MetricsServer::Start() {
+  base_ = event_base_new();
+  if (!base_) return Status(Status::NotOK, "failed to create the event base");
+  http_ = evhttp_new(base_);
+  if (!http_) return Status(Status::NotOK, "failed to create the http server");
+  // only the GET and HEAD of the metrics are served
+  evhttp_set_allowed_methods(http_, EVHTTP_REQ_GET | EVHTTP_REQ_HEAD);
+  evhttp_set_gencb(http_, handleRequest, this);
+  for (const auto &bind : binds_) {
+    if (evhttp_bind_socket(http_, bind.c_str(), static_cast<uint16_t>(port_)) != 0) {
+      return Status(Status::NotOK, "failed to bind the metrics port " + bind + ":" + std::to_string(port_)
+                                       + ", err: " + strerror(errno));
+    }
+  }
+  t_ = std::thread([this]() {
+    Util::ThreadSetName("metrics");
+    event_base_dispatch(base_);
+  });
+  LOG(INFO) << "[metrics] Serving the metrics on the port: " << port_;
+  return Status::OK();
+}
+
+void MetricsServer::Stop() {
+  if (base_) event_base_loopbreak(base_);
+}
+
+void MetricsServer::Join() {
+  if (t_.joinable()) t_.join();
+}
+
+void MetricsServer::handleRequest(evhttp_request *req, void *ctx) {
+  auto self = static_cast<MetricsServer *>(ctx);
+  const char *path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
+  if (!path || (strcmp(path, "/metrics") != 0 && strcmp(path, "/") != 0)) {
+    evhttp_send_error(req, HTTP_NOTFOUND, nullptr);
+    return;
+  }
+  std::string metrics;
+  self->renderer_(&metrics);
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", "text/plain; version=0.0.4");
+  auto body = evbuffer_new();
+  evbuffer_add(body, metrics.data(), metrics.size());
+  evhttp_send_reply(req, HTTP_OK, "OK", body);
+  evbuffer_free(body);
+}
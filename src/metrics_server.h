@@ -0,0 +1,37 @@
+#pragma once
+
+#include <event2/event.h>
+#include <event2/http.h>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "status.h"
+
+// MetricsServer serves the metrics in the prometheus text format by the http in its own thread,
+// the metrics are rendered from the snapshots of the counters, so the scrapes never wait for
+// the workers or any lock of them
+class MetricsServer {
+ public:
+  using Renderer = std::function<void(std::string *)>;
+
+  MetricsServer(const std::vector<std::string> &binds, int port, Renderer renderer);
+  ~MetricsServer();
+  MetricsServer(const MetricsServer &) = delete;
+  MetricsServer &operator=(const MetricsServer &) = delete;
+
+  Status Start();
+  void Stop();
+  void Join();
+
+ private:
+  static void handleRequest(evhttp_request *req, void *ctx);
+
+  std::vector<std::string> binds_;
+  int port_;
+  Renderer renderer_;
+  event_base *base_ = nullptr;
+  evhttp *http_ = nullptr;
+  std::thread t_;
+};
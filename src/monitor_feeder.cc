@@ -0,0 +1,95 @@
+#include "monitor_feeder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "redis_reply.h"
+#include "util.h"
+
+bool MonitorFilter::Match(const MonitorRecord &record, const std::string &monitor_ns, bool all_namespaces) const {
+  if (!all_namespaces && record.ns != monitor_ns) return false;
+  if (!ns.empty() && record.ns != ns) return false;
+  if (!commands.empty() && (record.args.empty() || !commands.count(Util::ToLower(record.args[0])))) {
+    return false;
+  }
+  if (sample_ratio < 100) {
+    static thread_local std::minstd_rand engine(std::random_device{}());
+    if (static_cast<int>(engine() % 100) >= sample_ratio) return false;
+  }
+  return true;
+}
+
+MonitorFeeder::~MonitorFeeder() {
+  Stop();
+  Join();
+  takeAll();  // free the records which are never delivered
+}
+
+void MonitorFeeder::Start(DeliverFn deliver) {
+  deliver_ = std::move(deliver);
+  t_ = std::thread([this]() {
+    Util::ThreadSetName("monitor-feeder");
+    this->loop();
+  });
+}
+
+void MonitorFeeder::Stop() {
+  stop_ = true;
+  cond_.notify_all();
+}
+
+void MonitorFeeder::Join() {
+  if (t_.joinable()) t_.join();
+}
+
+bool MonitorFeeder::Feed(std::unique_ptr<MonitorRecord> record) {
+  if (pending_.fetch_add(1, std::memory_order_relaxed) >= max_pending_) {
+    pending_.fetch_sub(1, std::memory_order_relaxed);
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  auto node = new Node{record.release(), head_.load(std::memory_order_relaxed)};
+  while (!head_.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {}
+  // only wake up the feeder when the queue is empty, the lost wake up is covered by the timeout
+  if (!node->next) cond_.notify_one();
+  return true;
+}
+
+std::shared_ptr<MonitorRecords> MonitorFeeder::takeAll() {
+  Node *head = head_.exchange(nullptr, std::memory_order_acquire);
+  auto records = std::make_shared<MonitorRecords>();
+  while (head) {
+    records->emplace_back(std::unique_ptr<MonitorRecord>(head->record));
+    Node *next = head->next;
+    delete head;
+    head = next;
+  }
+  pending_.fetch_sub(records->size(), std::memory_order_relaxed);
+  // the nodes are pushed in reverse order, reverse them to keep the feeding order
+  std::reverse(records->begin(), records->end());
+  return records;
+}
+
+void MonitorFeeder::loop() {
+  while (!stop_) {
+    if (!head_.load(std::memory_order_relaxed)) {
+      std::unique_lock<std::mutex> lock(mu_);
+      cond_.wait_for(lock, std::chrono::milliseconds(100));
+      continue;
+    }
+    auto records = takeAll();
+    for (auto &record : *records) record->line = FormatRecord(*record);
+    if (deliver_) deliver_(records);
+  }
+}
+
+std::string MonitorFeeder::FormatRecord(const MonitorRecord &record) {
+  std::string output;
+  output += std::to_string(record.time.tv_sec) + "." + std::to_string(record.time.tv_usec);
+  output += " [" + record.ns + " " + record.addr + "]";
+  for (const auto &arg : record.args) {
+    output += " \"" + arg + "\"";
+  }
+  return Redis::SimpleString(output);
+}
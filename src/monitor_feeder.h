@@ -0,0 +1,78 @@
+#pragma once
+
+#include <sys/time.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct MonitorRecord {
+  timeval time;
+  uint64_t conn_id;
+  std::string ns;
+  std::string addr;
+  std::vector<std::string> args;
+  // the line replied to the monitor clients, it's formatted by the feeder thread
+  std::string line;
+};
+
+typedef std::vector<std::unique_ptr<MonitorRecord>> MonitorRecords;
+
+// MonitorFilter is the options of the MONITOR command, the client only receives the
+// commands of its namespace, or the namespace in the filter if it's the admin
+struct MonitorFilter {
+  int sample_ratio = 100;
+  std::string ns;
+  std::set<std::string> commands;  // the lowercase names, empty is all commands
+
+  bool Match(const MonitorRecord &record, const std::string &monitor_ns, bool all_namespaces) const;
+};
+
+// MonitorFeeder takes the records of the executed commands off the hot path, the workers
+// push them without lock, and the feeder thread formats them and delivers them in batches.
+// The records are dropped while there are too many of them pending, so the monitor
+// clients never slow the workers down.
+class MonitorFeeder {
+ public:
+  typedef std::function<void(const std::shared_ptr<MonitorRecords> &)> DeliverFn;
+  explicit MonitorFeeder(size_t max_pending = kDefaultMaxPending) : max_pending_(max_pending) {}
+  ~MonitorFeeder();
+  MonitorFeeder(const MonitorFeeder &) = delete;
+  MonitorFeeder &operator=(const MonitorFeeder &) = delete;
+
+  void Start(DeliverFn deliver);
+  void Stop();
+  void Join();
+  // Feed is thread safe, and returns false if the record is dropped
+  bool Feed(std::unique_ptr<MonitorRecord> record);
+  uint64_t GetDropped() { return dropped_.load(std::memory_order_relaxed); }
+  static std::string FormatRecord(const MonitorRecord &record);
+
+  static const size_t kDefaultMaxPending = 100000;
+
+ private:
+  struct Node {
+    MonitorRecord *record;
+    Node *next;
+  };
+
+  void loop();
+  // takeAll returns the pending records in the feeding order
+  std::shared_ptr<MonitorRecords> takeAll();
+
+  size_t max_pending_;
+  std::atomic<Node *> head_{nullptr};
+  std::atomic<size_t> pending_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<bool> stop_{false};
+  std::mutex mu_;
+  std::condition_variable cond_;
+  DeliverFn deliver_;
+  std::thread t_;
+};
@@ -0,0 +1,33 @@
+#include "namespace_quota.h"
+
+bool NamespaceQuota::Acquire(uint64_t max_qps, uint64_t max_out_bytes, time_t now) {
+  auto window = window_.load(std::memory_order_relaxed);
+  // only one of the threads resets the counters in the new second
+  if (window != now && window_.compare_exchange_strong(window, now)) {
+    window_calls_.store(0, std::memory_order_relaxed);
+    window_out_bytes_.store(0, std::memory_order_relaxed);
+  }
+  if ((max_qps > 0 && window_calls_.load(std::memory_order_relaxed) >= max_qps) ||
+      (max_out_bytes > 0 && window_out_bytes_.load(std::memory_order_relaxed) >= max_out_bytes)) {
+    throttled_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  window_calls_.fetch_add(1, std::memory_order_relaxed);
+  calls_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+NamespaceQuota *NamespaceQuotas::Get(const std::string &ns) {
+  std::lock_guard<std::mutex> guard(mu_);
+  auto &quota = quotas_[ns];
+  if (!quota) quota.reset(new NamespaceQuota);
+  return quota.get();
+}
+
+void NamespaceQuotas::GetAll(std::vector<std::pair<std::string, NamespaceQuota *>> *quotas) {
+  quotas->clear();
+  std::lock_guard<std::mutex> guard(mu_);
+  for (const auto &iter : quotas_) {
+    quotas->emplace_back(iter.first, iter.second.get());
+  }
+}
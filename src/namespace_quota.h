@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// NamespaceQuota counts the commands and the output bytes of one namespace in the
+// current second, a namespace which runs out of its budget of the second is held
+// til the next one, so the heavy tenant won't starve the others on the same worker.
+class NamespaceQuota {
+ public:
+  NamespaceQuota() = default;
+  NamespaceQuota(const NamespaceQuota &) = delete;
+  NamespaceQuota &operator=(const NamespaceQuota &) = delete;
+
+  // Acquire counts a command and returns false if the namespace has run out of the
+  // budget of the second @now, the limit of 0 is unlimited
+  bool Acquire(uint64_t max_qps, uint64_t max_out_bytes, time_t now);
+  void IncrOutBytes(uint64_t n) {
+    window_out_bytes_.fetch_add(n, std::memory_order_relaxed);
+    out_bytes_.fetch_add(n, std::memory_order_relaxed);
+  }
+  uint64_t GetCalls() { return calls_.load(std::memory_order_relaxed); }
+  uint64_t GetOutBytes() { return out_bytes_.load(std::memory_order_relaxed); }
+  uint64_t GetThrottled() { return throttled_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<time_t> window_{0};
+  std::atomic<uint64_t> window_calls_{0};
+  std::atomic<uint64_t> window_out_bytes_{0};
+  std::atomic<uint64_t> calls_{0};
+  std::atomic<uint64_t> out_bytes_{0};
+  std::atomic<uint64_t> throttled_{0};
+};
+
+// NamespaceQuotas holds the quotas of the namespaces, they are never freed since the
+// connections cache them, and the number of the namespaces is small.
+class NamespaceQuotas {
+ public:
+  NamespaceQuota *Get(const std::string &ns);
+  void GetAll(std::vector<std::pair<std::string, NamespaceQuota *>> *quotas);
+
+ private:
+  std::mutex mu_;
+  std::map<std::string, std::unique_ptr<NamespaceQuota>> quotas_;
+};
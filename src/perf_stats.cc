@@ -0,0 +1,94 @@
+#include "perf_stats.h"
+
+#include <rocksdb/iostats_context.h>
+#include <rocksdb/perf_context.h>
+#include <random>
+
+static const char *kCounterNames[PerfStats::kNumCounters] = {
+    "block_read_count",
+    "block_read_byte",
+    "block_cache_hit_count",
+    "get_from_memtable_count",
+    "seek_on_memtable_count",
+    "next_on_memtable_count",
+    "seek_child_seek_count",
+    "bloom_memtable_hit_count",
+    "bloom_memtable_miss_count",
+    "bloom_sst_hit_count",
+    "bloom_sst_miss_count",
+    "internal_key_skipped_count",
+    "internal_delete_skipped_count",
+    "bytes_read",
+};
+
+const char *PerfStats::CounterName(int counter) {
+  if (counter < 0 || counter >= kNumCounters) return "";
+  return kCounterNames[counter];
+}
+
+PerfStats::PerfStats(size_t n_commands) {
+  for (size_t i = 0; i < n_commands; i++) {
+    commands_.emplace_back(std::unique_ptr<CommandPerfStats>(new CommandPerfStats));
+  }
+}
+
+bool PerfStats::Begin(int ratio) {
+  if (ratio <= 0) return false;
+  if (ratio < 100) {
+    // std::rand takes the global lock in glibc, use the thread local engine instead
+    static thread_local std::minstd_rand engine(std::random_device{}());
+    if (static_cast<int>(engine() % 100) >= ratio) return false;
+  }
+  // don't lower the perf level if the profiling is enabled already
+  if (rocksdb::GetPerfLevel() < rocksdb::PerfLevel::kEnableCount) {
+    rocksdb::SetPerfLevel(rocksdb::PerfLevel::kEnableCount);
+  }
+  rocksdb::get_perf_context()->Reset();
+  rocksdb::get_iostats_context()->Reset();
+  return true;
+}
+
+void PerfStats::Record(int command_id) {
+  if (command_id < 0 || command_id >= static_cast<int>(commands_.size())) return;
+  auto ctx = rocksdb::get_perf_context();
+  uint64_t values[kNumCounters] = {
+      ctx->block_read_count,
+      ctx->block_read_byte,
+      ctx->block_cache_hit_count,
+      ctx->get_from_memtable_count,
+      ctx->seek_on_memtable_count,
+      ctx->next_on_memtable_count,
+      ctx->seek_child_seek_count,
+      ctx->bloom_memtable_hit_count,
+      ctx->bloom_memtable_miss_count,
+      ctx->bloom_sst_hit_count,
+      ctx->bloom_sst_miss_count,
+      ctx->internal_key_skipped_count,
+      ctx->internal_delete_skipped_count,
+      rocksdb::get_iostats_context()->bytes_read,
+  };
+  auto &stats = commands_[command_id];
+  stats->samples.fetch_add(1, std::memory_order_relaxed);
+  for (int i = 0; i < kNumCounters; i++) {
+    if (values[i] != 0) stats->counters[i].fetch_add(values[i], std::memory_order_relaxed);
+  }
+}
+
+bool PerfStats::GetCommandStats(int command_id, uint64_t *samples, std::vector<uint64_t> *counters) {
+  if (command_id < 0 || command_id >= static_cast<int>(commands_.size())) return false;
+  auto &stats = commands_[command_id];
+  *samples = stats->samples.load(std::memory_order_relaxed);
+  if (*samples == 0) return false;
+  counters->resize(kNumCounters);
+  for (int i = 0; i < kNumCounters; i++) {
+    (*counters)[i] = stats->counters[i].load(std::memory_order_relaxed);
+  }
+  return true;
+}
+
+void PerfStats::Reset() {
+  for (auto &stats : commands_) {
+    stats->samples = 0;
+    for (auto &counter : stats->counters) counter = 0;
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// PerfStats aggregates the rocksdb perf and iostats counters of the sampled commands
+// by the command id, the counters are only enabled by PerfLevel::kEnableCount while
+// sampling so it's cheap enough to be always on, and the sources of the read
+// amplification could be told from the counters per command.
+class PerfStats {
+ public:
+  enum Counter {
+    kBlockReadCount = 0,
+    kBlockReadBytes,
+    kBlockCacheHitCount,
+    kGetFromMemtableCount,
+    kSeekOnMemtableCount,
+    kNextOnMemtableCount,
+    kSeekChildSeekCount,
+    kBloomMemtableHitCount,
+    kBloomMemtableMissCount,
+    kBloomSSTHitCount,
+    kBloomSSTMissCount,
+    kInternalKeySkippedCount,
+    kInternalDeleteSkippedCount,
+    kIOBytesRead,
+    kNumCounters,
+  };
+  static const char *CounterName(int counter);
+
+  // @n_commands: the number of the command ids
+  explicit PerfStats(size_t n_commands);
+  PerfStats(const PerfStats &) = delete;
+  PerfStats &operator=(const PerfStats &) = delete;
+
+  // Begin decides whether the command should be sampled by the ratio(0~100), and
+  // enables the perf counters of the current thread if it is sampled
+  static bool Begin(int ratio);
+  // Record adds the perf counters of the current thread into the command, the perf
+  // level is left to the caller since the profiling may share the perf context
+  void Record(int command_id);
+  // GetCommandStats returns false if the command is never sampled
+  bool GetCommandStats(int command_id, uint64_t *samples, std::vector<uint64_t> *counters);
+  void Reset();
+
+ private:
+  struct CommandPerfStats {
+    std::atomic<uint64_t> samples = {0};
+    std::atomic<uint64_t> counters[kNumCounters] = {};
+  };
+  std::vector<std::unique_ptr<CommandPerfStats>> commands_;
+};
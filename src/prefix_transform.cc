@@ -0,0 +1,33 @@
+#include "prefix_transform.h"
+
+#include "encoding.h"
+
+namespace Engine {
+
+size_t SubKeyPrefixTransform::PrefixSize(const rocksdb::Slice &key) {
+  // the layout is: ns_size(1) | ns | key_size(4) | key | version(8) | subkey
+  if (key.size() < 1) return 0;
+  size_t pos = 1 + static_cast<uint8_t>(key[0]);
+  if (key.size() < pos + 4) return 0;
+  pos += 4 + DecodeFixed32(key.data() + pos);
+  if (key.size() < pos + 8) return 0;
+  return pos + 8;
+}
+
+rocksdb::Slice SubKeyPrefixTransform::Transform(const rocksdb::Slice &key) const {
+  return rocksdb::Slice(key.data(), PrefixSize(key));
+}
+
+bool SubKeyPrefixTransform::InDomain(const rocksdb::Slice &key) const {
+  return PrefixSize(key) > 0;
+}
+
+bool SubKeyPrefixTransform::InRange(const rocksdb::Slice &dst) const {
+  return PrefixSize(dst) == dst.size();
+}
+
+bool SubKeyPrefixTransform::SameResultWhenAppended(const rocksdb::Slice &prefix) const {
+  return InRange(prefix);
+}
+
+}  // namespace Engine
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <rocksdb/slice_transform.h>
+
+namespace Engine {
+
+// SubKeyPrefixTransform extracts the `ns|key|version` part from the subkeys
+// encoded by InternalKey, so the subkeys of the same key version share
+// the prefix bloom filters in both the sst files and memtable
+class SubKeyPrefixTransform : public rocksdb::SliceTransform {
+ public:
+  const char *Name() const override { return "Kvrocks.SubKeyPrefixTransform"; }
+  rocksdb::Slice Transform(const rocksdb::Slice &key) const override;
+  bool InDomain(const rocksdb::Slice &key) const override;
+  bool InRange(const rocksdb::Slice &dst) const override;
+  bool SameResultWhenAppended(const rocksdb::Slice &prefix) const override;
+
+  // PrefixSize returns the size of the `ns|key|version` part,
+  // or zero if the key isn't encoded by InternalKey
+  static size_t PrefixSize(const rocksdb::Slice &key);
+};
+
+}  // namespace Engine
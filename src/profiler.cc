@@ -0,0 +1,200 @@
+#include "profiler.h"
+
+#include <jemalloc/jemalloc.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+std::atomic<bool> CpuProfiler::running_{false};
+int CpuProfiler::frequency_ = 0;
+std::unique_ptr<CpuProfiler::Sample[]> CpuProfiler::samples_;
+std::atomic<size_t> CpuProfiler::n_samples_{0};
+std::atomic<uint64_t> CpuProfiler::dropped_samples_{0};
+std::atomic<int> CpuProfiler::in_flight_handlers_{0};
+
+// the frames deeper than this from the interrupted stack pointer are never walked
+static const uintptr_t kMaxStackBytes = 8 * 1024 * 1024;
+
+// interruptedFrame returns the pc, the stack pointer and the frame pointer of the interrupted code
+static bool interruptedFrame(void *ucontext, uintptr_t *pc, uintptr_t *sp, uintptr_t *fp) {
+  auto uc = static_cast<ucontext_t *>(ucontext);
+#if defined(__linux__) && defined(__x86_64__)
+  *pc = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RIP]);
+  *sp = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RSP]);
+  *fp = static_cast<uintptr_t>(uc->uc_mcontext.gregs[REG_RBP]);
+  return true;
+#elif defined(__linux__) && defined(__aarch64__)
+  *pc = static_cast<uintptr_t>(uc->uc_mcontext.pc);
+  *sp = static_cast<uintptr_t>(uc->uc_mcontext.sp);
+  *fp = static_cast<uintptr_t>(uc->uc_mcontext.regs[29]);
+  return true;
+#else
+  (void)uc;
+  (void)pc;
+  (void)sp;
+  (void)fp;
+  return false;
+#endif
+}
+
+// readFrame copies the frame by process_vm_readv, which fails with EFAULT on the unmapped
+// address instead of crashing. The frame pointer of the code built without it(libc, jemalloc,
+// rocksdb) could be any value, and the stack ranges of the threads started by the libraries
+// can't be queried in the handler since pthread_getattr_np isn't async signal safe.
+static bool readFrame(uintptr_t fp, uintptr_t frame[2]) {
+  struct iovec local = {frame, 2 * sizeof(uintptr_t)};
+  struct iovec remote = {reinterpret_cast<void *>(fp), 2 * sizeof(uintptr_t)};
+  return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == static_cast<ssize_t>(2 * sizeof(uintptr_t));
+}
+
+void CpuProfiler::onProfilingSignal(int, siginfo_t *, void *ucontext) {
+  in_flight_handlers_.fetch_add(1);
+  int saved_errno = errno;
+  recordSample(ucontext);
+  errno = saved_errno;
+  in_flight_handlers_.fetch_sub(1);
+}
+
+void CpuProfiler::recordSample(void *ucontext) {
+  if (!running_.load()) return;
+  size_t index = n_samples_.fetch_add(1, std::memory_order_relaxed);
+  if (index >= kMaxSamples) {
+    dropped_samples_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  auto &sample = samples_[index];
+  sample.depth = 0;
+  uintptr_t pc, sp, fp;
+  if (!interruptedFrame(ucontext, &pc, &sp, &fp)) return;
+  sample.pcs[sample.depth++] = pc;
+  // the frame is [the previous frame pointer, the return address], and the frame pointers
+  // only grow toward the bottom of the stack, so they are bounded by [sp, sp + kMaxStackBytes)
+  uintptr_t stack_end = sp + kMaxStackBytes;
+  while (sample.depth < kMaxDepth && fp >= sp && fp < stack_end && fp % sizeof(uintptr_t) == 0) {
+    uintptr_t frame[2];
+    if (!readFrame(fp, frame)) break;
+    uintptr_t next_fp = frame[0], ret = frame[1];
+    if (ret == 0) break;
+    sample.pcs[sample.depth++] = ret;
+    if (next_fp <= fp) break;
+    fp = next_fp;
+  }
+}
+
+Status CpuProfiler::Start(int frequency) {
+  if (frequency <= 0 || frequency > 1000) return Status(Status::NotOK, "the frequency should be between 1 and 1000");
+  bool expected = false;
+  if (!running_.compare_exchange_strong(expected, true)) {
+    return Status(Status::NotOK, "the cpu profiling was running");
+  }
+  if (!samples_) samples_.reset(new Sample[kMaxSamples]);
+  n_samples_ = 0;
+  dropped_samples_ = 0;
+  frequency_ = frequency;
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = onProfilingSignal;
+  sa.sa_flags = SA_RESTART | SA_SIGINFO;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, nullptr) != 0) {
+    running_ = false;
+    return Status(Status::NotOK, std::string("failed to set the SIGPROF handler, err: ") + strerror(errno));
+  }
+  // the timer counts the cpu time of the process, so the idle threads aren't sampled
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 1000000 / frequency;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    running_ = false;
+    return Status(Status::NotOK, std::string("failed to set the profiling timer, err: ") + strerror(errno));
+  }
+  return Status::OK();
+}
+
+Status CpuProfiler::Stop(std::string *profile) {
+  if (!running_) return Status(Status::NotOK, "the cpu profiling wasn't running");
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  // the pending signals are ignored after the handler is reset, and the handler stops
+  // writing the samples once it sees the running flag is cleared
+  signal(SIGPROF, SIG_IGN);
+  running_ = false;
+  // the handlers check the flag after they are counted, so none of them writes the samples
+  // once the in-flight ones are finished
+  while (in_flight_handlers_.load() != 0) std::this_thread::yield();
+  size_t n_samples = std::min(n_samples_.load(), kMaxSamples);
+  buildProfile(n_samples, profile);
+  return Status::OK();
+}
+
+void CpuProfiler::buildProfile(size_t n_samples, std::string *profile) {
+  std::map<std::vector<uintptr_t>, uintptr_t> stacks;
+  for (size_t i = 0; i < n_samples; i++) {
+    const auto &sample = samples_[i];
+    if (sample.depth == 0) continue;
+    stacks[std::vector<uintptr_t>(sample.pcs, sample.pcs + sample.depth)]++;
+  }
+  std::vector<uintptr_t> words = {0, 3, 0, static_cast<uintptr_t>(1000000 / frequency_), 0};
+  for (const auto &stack : stacks) {
+    words.emplace_back(stack.second);
+    words.emplace_back(stack.first.size());
+    words.insert(words.end(), stack.first.begin(), stack.first.end());
+  }
+  // the trailer is the record of zero count with one pc of zero
+  words.insert(words.end(), {0, 1, 0});
+  profile->assign(reinterpret_cast<const char *>(words.data()), words.size() * sizeof(uintptr_t));
+  // the mapped binaries are used by the pprof to symbolize the pcs
+  std::ifstream maps("/proc/self/maps");
+  std::stringstream buffer;
+  buffer << maps.rdbuf();
+  profile->append(buffer.str());
+}
+
+std::atomic<bool> HeapProfiler::running_{false};
+
+static int setHeapProfilingActive(bool active) {
+  return mallctl("prof.active", nullptr, nullptr, &active, sizeof(active));
+}
+
+Status HeapProfiler::Start() {
+  bool enabled = false;
+  size_t sz = sizeof(enabled);
+  if (mallctl("opt.prof", &enabled, &sz, nullptr, 0) != 0 || !enabled) {
+    return Status(Status::NotOK, "the heap profiling wasn't enabled by the jemalloc");
+  }
+  bool expected = false;
+  if (!running_.compare_exchange_strong(expected, true)) {
+    return Status(Status::NotOK, "the heap profiling was running");
+  }
+  int ret = setHeapProfilingActive(true);
+  if (ret != 0) {
+    running_ = false;
+    return Status(Status::NotOK, std::string("failed to activate the heap profiling, err: ") + strerror(ret));
+  }
+  return Status::OK();
+}
+
+Status HeapProfiler::Stop(const std::string &path) {
+  if (!running_) return Status(Status::NotOK, "the heap profiling wasn't running");
+  const char *filename = path.c_str();
+  int ret = mallctl("prof.dump", nullptr, nullptr, &filename, sizeof(filename));
+  setHeapProfilingActive(false);
+  running_ = false;
+  if (ret != 0) {
+    return Status(Status::NotOK, "failed to dump the heap profile to " + path + ", err: " + strerror(ret));
+  }
+  return Status::OK();
+}
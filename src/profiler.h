@@ -0,0 +1,59 @@
+#pragma once
+
+#include <signal.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "status.h"
+
+// CpuProfiler samples the stacks of the threads running on the cpu by the SIGPROF of the
+// profiling timer, the stacks are walked by the frame pointers in the signal handler, which
+// only reads the frames through the syscall, so the garbage frame pointers of the libraries
+// built without them are never dereferenced. The profile
+// is in the legacy cpu profile format of the gperftools, which could be read by the pprof
+// along with the binary, e.g. pprof --svg kvrocks cpu.prof
+class CpuProfiler {
+ public:
+  static const int kMaxDepth = 64;
+  static const size_t kMaxSamples = 256 * 1024;
+
+  // Start starts the profiling of the process by the frequency(hz), only one profiling could
+  // be running at the same time
+  static Status Start(int frequency);
+  // Stop stops the profiling and returns the profile
+  static Status Stop(std::string *profile);
+  static bool IsRunning() { return running_; }
+
+ private:
+  struct Sample {
+    uint32_t depth;
+    uintptr_t pcs[kMaxDepth];
+  };
+  static void onProfilingSignal(int sig, siginfo_t *info, void *ucontext);
+  static void recordSample(void *ucontext);
+  static void buildProfile(size_t n_samples, std::string *profile);
+
+  static std::atomic<bool> running_;
+  static int frequency_;
+  static std::unique_ptr<Sample[]> samples_;
+  static std::atomic<size_t> n_samples_;
+  static std::atomic<uint64_t> dropped_samples_;
+  static std::atomic<int> in_flight_handlers_;
+};
+
+// HeapProfiler activates the sampling of the allocations by the jemalloc, which must be built with
+// the --enable-prof and started with the prof:true, and dumps the profile of the live allocations
+// sampled while it is active, which could also be read by the jeprof or pprof
+class HeapProfiler {
+ public:
+  static Status Start();
+  // Stop dumps the profile into the file of the path, and deactivates the sampling
+  static Status Stop(const std::string &path);
+  static bool IsRunning() { return running_; }
+
+ private:
+  static std::atomic<bool> running_;
+};
@@ -1,4 +1,9 @@
 #include "redis_bitmap.h"
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
 #include <vector>
 
 namespace Redis {
@@ -6,24 +11,65 @@ namespace Redis {
 const uint32_t kBitmapSegmentBits = 1024 * 8;
 const uint32_t kBitmapSegmentBytes = 1024;
 
-uint32_t kNum2Bits[256] = {
-    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-    4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8
-};
+static uint32_t popcountGeneric(const uint8_t *p, size_t n) {
+  uint32_t count = 0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t word;
+    memcpy(&word, p + i, sizeof(word));
+    count += __builtin_popcountll(word);
+  }
+  for (; i < n; i++) count += __builtin_popcount(p[i]);
+  return count;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// the same loop compiled with the popcnt instruction, it's selected at runtime
+// since the binary may be built without -mpopcnt
+__attribute__((target("popcnt")))
+static uint32_t popcountHW(const uint8_t *p, size_t n) {
+  uint32_t count = 0;
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    uint64_t words[4];
+    memcpy(words, p + i, sizeof(words));
+    count += __builtin_popcountll(words[0]) + __builtin_popcountll(words[1])
+        + __builtin_popcountll(words[2]) + __builtin_popcountll(words[3]);
+  }
+  for (; i + 8 <= n; i += 8) {
+    uint64_t word;
+    memcpy(&word, p + i, sizeof(word));
+    count += __builtin_popcountll(word);
+  }
+  for (; i < n; i++) count += __builtin_popcount(p[i]);
+  return count;
+}
+
+static uint32_t popcount(const char *p, size_t n) {
+  static const bool has_popcnt = __builtin_cpu_supports("popcnt");
+  auto bytes = reinterpret_cast<const uint8_t *>(p);
+  return has_popcnt ? popcountHW(bytes, n) : popcountGeneric(bytes, n);
+}
+#else
+static uint32_t popcount(const char *p, size_t n) {
+  return popcountGeneric(reinterpret_cast<const uint8_t *>(p), n);
+}
+#endif
+
+// skipBytes returns the index of the first byte in [start, n) which isn't equal to the skip byte
+static size_t skipBytes(const char *p, size_t start, size_t n, uint8_t skip) {
+  uint64_t skip_word = 0x0101010101010101ULL * skip;
+  size_t i = start;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t word;
+    memcpy(&word, p + i, sizeof(word));
+    if (word != skip_word) break;
+  }
+  for (; i < n; i++) {
+    if (static_cast<uint8_t>(p[i]) != skip) break;
+  }
+  return i;
+}
 
 rocksdb::Status Bitmap::GetMetadata(const Slice &ns_key, BitmapMetadata *metadata) {
   return Database::GetMetadata(kRedisBitmap, ns_key, metadata);
@@ -34,17 +80,15 @@ rocksdb::Status Bitmap::GetBit(const Slice &user_key, uint32_t offset, bool *bit
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  BitmapMetadata metadata;
+  BitmapMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
-  LatestSnapShot ss(db_);
   rocksdb::ReadOptions read_options;
-  read_options.snapshot = ss.GetSnapShot();
   uint32_t index = (offset / kBitmapSegmentBits) * kBitmapSegmentBytes;
   std::string sub_key, value;
   InternalKey(ns_key, std::to_string(index), metadata.version).Encode(&sub_key);
-  s = db_->Get(read_options, sub_key, &value);
+  s = storage_->Get(read_options, subkey_cf_handle_, sub_key, &value);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
   uint32_t byte_index = (offset / 8) % kBitmapSegmentBytes;
   if ((byte_index < value.size() && (value[byte_index] & (1 << (offset % 8))))) {
@@ -66,7 +110,7 @@ rocksdb::Status Bitmap::SetBit(const Slice &user_key, uint32_t offset, bool new_
   uint32_t index = (offset / kBitmapSegmentBits) * kBitmapSegmentBytes;
   InternalKey(ns_key, std::to_string(index), metadata.version).Encode(&sub_key);
   if (s.ok()) {
-    s = db_->Get(rocksdb::ReadOptions(), sub_key, &value);
+    s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value);
     if (!s.ok() && !s.IsNotFound()) return s;
   }
   uint32_t byte_index = (offset / 8) % kBitmapSegmentBytes;
@@ -93,7 +137,7 @@ rocksdb::Status Bitmap::SetBit(const Slice &user_key, uint32_t offset, bool new_
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisBitmap, {std::to_string(offset)});
   batch.PutLogData(log_data.Encode());
-  batch.Put(sub_key, value);
+  batch.Put(subkey_cf_handle_, sub_key, value);
   if (metadata.size != bitmap_size) {
     metadata.size = bitmap_size;
     std::string bytes;
@@ -108,7 +152,7 @@ rocksdb::Status Bitmap::BitCount(const Slice &user_key, int start, int stop, uin
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  BitmapMetadata metadata;
+  BitmapMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
@@ -122,19 +166,42 @@ rocksdb::Status Bitmap::BitCount(const Slice &user_key, int start, int stop, uin
   read_options.snapshot = ss.GetSnapShot();
   int start_index = start / kBitmapSegmentBytes;
   int stop_index = stop / kBitmapSegmentBytes;
+  auto countSegment = [&](int i, const Slice &value) {
+    size_t begin = 0, end = value.size();
+    if (i == start_index) begin = start % kBitmapSegmentBytes;
+    if (i == stop_index) end = std::min(end, static_cast<size_t>(stop % kBitmapSegmentBytes) + 1);
+    if (begin < end) *cnt += popcount(value.data() + begin, end - begin);
+  };
+
+  int total_segments = static_cast<int>(metadata.size / kBitmapSegmentBytes) + 1;
+  if ((stop_index - start_index + 1) * 2 >= total_segments) {
+    // most segments are in range, iterate the existing segments instead of
+    // seeking each index, so the missing segments are skipped for free
+    std::string prefix_key;
+    InternalKey(ns_key, "", metadata.version).Encode(&prefix_key);
+    read_options.fill_cache = false;
+    read_options.prefix_same_as_start = true;
+    auto iter = storage_->NewIterator(read_options, subkey_cf_handle_);
+    for (iter->Seek(prefix_key); iter->Valid() && iter->key().starts_with(prefix_key); iter->Next()) {
+      InternalKey ikey(iter->key());
+      int i = static_cast<int>(std::stoul(ikey.GetSubKey().ToString()) / kBitmapSegmentBytes);
+      if (i < start_index || i > stop_index) continue;
+      countSegment(i, iter->value());
+    }
+    s = iter->status();
+    delete iter;
+    // the partial count is useless if the iteration failed
+    if (!s.ok()) *cnt = 0;
+    return s;
+  }
   // Don't use multi get to prevent large range query, and take too much memory
   std::string sub_key, value;
   for (int i = start_index; i <= stop_index; i++) {
     InternalKey(ns_key, std::to_string(i * kBitmapSegmentBytes), metadata.version).Encode(&sub_key);
-    s = db_->Get(read_options, sub_key, &value);
+    s = storage_->Get(read_options, subkey_cf_handle_, sub_key, &value);
     if (!s.ok() && !s.IsNotFound()) return s;
     if (s.IsNotFound()) continue;
-    size_t j = 0;
-    if (i == start_index) j = start % kBitmapSegmentBytes;
-    for (; j < value.size(); j++) {
-      if (i == stop_index && j > (stop % kBitmapSegmentBytes)) break;
-      *cnt += kNum2Bits[static_cast<int>(value[j])];
-    }
+    countSegment(i, value);
   }
   return rocksdb::Status::OK();
 }
@@ -143,7 +210,7 @@ rocksdb::Status Bitmap::BitPos(const Slice &user_key, bool bit, int start, int s
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  BitmapMetadata metadata;
+  BitmapMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok() && !s.IsNotFound()) return s;
   if (s.IsNotFound()) {
@@ -164,6 +231,8 @@ rocksdb::Status Bitmap::BitPos(const Slice &user_key, bool bit, int start, int s
     }
     return -1;
   };
+  // the bytes without the target bit would be skipped by word
+  uint8_t skip_byte = bit ? 0x00 : 0xff;
 
   LatestSnapShot ss(db_);
   rocksdb::ReadOptions read_options;
@@ -174,23 +243,23 @@ rocksdb::Status Bitmap::BitPos(const Slice &user_key, bool bit, int start, int s
   std::string sub_key, value;
   for (int i = start_index; i <= stop_index; i++) {
     InternalKey(ns_key, std::to_string(i * kBitmapSegmentBytes), metadata.version).Encode(&sub_key);
-    s = db_->Get(read_options, sub_key, &value);
+    s = storage_->Get(read_options, subkey_cf_handle_, sub_key, &value);
     if (!s.ok() && !s.IsNotFound()) return s;
+    size_t j = 0;
+    if (i == start_index) j = start % kBitmapSegmentBytes;
     if (s.IsNotFound()) {
       if (!bit) {
-        *pos = i * kBitmapSegmentBits;
+        *pos = static_cast<int>(i * kBitmapSegmentBits + j * 8);
         return rocksdb::Status::OK();
       }
       continue;
     }
-    size_t j = 0;
-    if (i == start_index) j = start % kBitmapSegmentBytes;
-    for (; j < value.size(); j++) {
-      if (i == stop_index && j > (stop % kBitmapSegmentBytes)) break;
-      if (bitPosInByte(value[j], bit) != -1) {
-        *pos = static_cast<int>(i * kBitmapSegmentBits + j * 8 + bitPosInByte(value[j], bit));
-        return rocksdb::Status::OK();
-      }
+    size_t end = value.size();
+    if (i == stop_index) end = std::min(end, static_cast<size_t>(stop % kBitmapSegmentBytes) + 1);
+    j = skipBytes(value.data(), j, end, skip_byte);
+    if (j < end) {
+      *pos = static_cast<int>(i * kBitmapSegmentBits + j * 8 + bitPosInByte(value[j], bit));
+      return rocksdb::Status::OK();
     }
     if (!bit && value.size() < kBitmapSegmentBytes) {
       *pos = static_cast<int>(i * kBitmapSegmentBits + value.size() * 8);
@@ -202,6 +271,428 @@ rocksdb::Status Bitmap::BitPos(const Slice &user_key, bool bit, int start, int s
   return rocksdb::Status::OK();
 }
 
+// applyBitOp combines the overlapped n bytes of src into dst by 64-bit words,
+// the fixed op in each loop allows the compiler to vectorize it
+template <typename Op>
+static void applyBitOp(char *dst, const char *src, size_t n, Op op) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t a, b;
+    memcpy(&a, dst + i, sizeof(a));
+    memcpy(&b, src + i, sizeof(b));
+    a = op(a, b);
+    memcpy(dst + i, &a, sizeof(a));
+  }
+  for (; i < n; i++) {
+    dst[i] = static_cast<char>(op(static_cast<uint8_t>(dst[i]), static_cast<uint8_t>(src[i])));
+  }
+}
+
+static void bitOpSegment(BitOpFlags op_flag, std::string *dst, const Slice &src) {
+  switch (op_flag) {
+    case kBitOpAnd:
+      // the missing bytes in the shorter segment are zero
+      if (src.size() < dst->size()) dst->resize(src.size());
+      applyBitOp(&(*dst)[0], src.data(), dst->size(), [](uint64_t a, uint64_t b) { return a & b; });
+      break;
+    case kBitOpOr:
+      if (src.size() > dst->size()) dst->resize(src.size(), 0);
+      applyBitOp(&(*dst)[0], src.data(), src.size(), [](uint64_t a, uint64_t b) { return a | b; });
+      break;
+    case kBitOpXor:
+      if (src.size() > dst->size()) dst->resize(src.size(), 0);
+      applyBitOp(&(*dst)[0], src.data(), src.size(), [](uint64_t a, uint64_t b) { return a ^ b; });
+      break;
+    default:
+      break;
+  }
+}
+
+rocksdb::Status Bitmap::BitOp(BitOpFlags op_flag, const std::string &op_name,
+                              const Slice &user_key, const std::vector<Slice> &op_keys, int64_t *len) {
+  *len = 0;
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.fill_cache = false;
+
+  uint32_t max_size = 0;
+  bool has_empty_source = false;
+  std::vector<std::string> prefix_keys;
+  for (const auto &op_key : op_keys) {
+    std::string ns_op_key;
+    AppendNamespacePrefix(op_key, &ns_op_key);
+    BitmapMetadata metadata(false);
+    auto s = GetMetadata(ns_op_key, &metadata);
+    if (!s.ok() && !s.IsNotFound()) return s;
+    if (s.IsNotFound()) {
+      has_empty_source = true;
+      continue;
+    }
+    if (metadata.size > max_size) max_size = metadata.size;
+    std::string prefix_key;
+    InternalKey(ns_op_key, "", metadata.version).Encode(&prefix_key);
+    prefix_keys.emplace_back(prefix_key);
+  }
+
+  rocksdb::WriteBatch batch;
+  std::vector<std::string> log_args = {std::to_string(kRedisCmdBitOp), op_name, user_key.ToString()};
+  for (const auto &op_key : op_keys) log_args.emplace_back(op_key.ToString());
+  WriteBatchLogData log_data(kRedisBitmap, std::move(log_args));
+  batch.PutLogData(log_data.Encode());
+  if (max_size == 0) {
+    // the result is empty, the dest key would be removed as redis does
+    batch.Delete(metadata_cf_handle_, ns_key);
+    return storage_->Write(rocksdb::WriteOptions(), &batch);
+  }
+
+  BitmapMetadata res_metadata;
+  std::string sub_key;
+  if (op_flag == kBitOpNot) {
+    // the missing segments of the source should be filled with ones,
+    // so walk all segment indexes instead of iterating existing segments
+    std::string value;
+    for (uint32_t index = 0; index < max_size; index += kBitmapSegmentBytes) {
+      sub_key = prefix_keys[0] + std::to_string(index);
+      auto s = storage_->Get(read_options, subkey_cf_handle_, sub_key, &value);
+      if (!s.ok() && !s.IsNotFound()) return s;
+      if (s.IsNotFound()) value.clear();
+      value.resize(std::min(kBitmapSegmentBytes, max_size - index), 0);
+      for (auto &c : value) c = ~c;
+      InternalKey(ns_key, std::to_string(index), res_metadata.version).Encode(&sub_key);
+      batch.Put(subkey_cf_handle_, sub_key, value);
+    }
+  } else if (op_flag != kBitOpAnd || !has_empty_source) {
+    // segment subkeys of all sources are in the same order, so the aligned
+    // segments can be found by merging the iterators of sources
+    read_options.prefix_same_as_start = true;
+    std::vector<std::unique_ptr<rocksdb::Iterator>> iters;
+    for (const auto &prefix_key : prefix_keys) {
+      std::unique_ptr<rocksdb::Iterator> iter(storage_->NewIterator(read_options, subkey_cf_handle_));
+      iter->Seek(prefix_key);
+      iters.emplace_back(std::move(iter));
+    }
+    auto segmentIndex = [&](size_t i) -> Slice {
+      if (!iters[i]->Valid() || !iters[i]->key().starts_with(prefix_keys[i])) return Slice();
+      Slice key = iters[i]->key();
+      return Slice(key.data() + prefix_keys[i].size(), key.size() - prefix_keys[i].size());
+    };
+    std::string min_index, value;
+    while (true) {
+      bool found = false;
+      for (size_t i = 0; i < iters.size(); i++) {
+        Slice index = segmentIndex(i);
+        if (index.empty()) continue;
+        if (!found || index.compare(min_index) < 0) min_index = index.ToString();
+        found = true;
+      }
+      if (!found) break;
+      size_t matched = 0;
+      for (size_t i = 0; i < iters.size(); i++) {
+        if (segmentIndex(i) != min_index) continue;
+        if (matched == 0) {
+          value = iters[i]->value().ToString();
+        } else {
+          bitOpSegment(op_flag, &value, iters[i]->value());
+        }
+        matched++;
+        iters[i]->Next();
+      }
+      // the segment is missing in some sources, the `and` result must be zero
+      if (op_flag == kBitOpAnd && matched < iters.size()) continue;
+      if (IsEmptySegment(value)) continue;
+      InternalKey(ns_key, min_index, res_metadata.version).Encode(&sub_key);
+      batch.Put(subkey_cf_handle_, sub_key, value);
+    }
+  }
+  res_metadata.size = max_size;
+  std::string bytes;
+  res_metadata.Encode(&bytes);
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  *len = max_size;
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+// checkSignedOverflow and checkUnsignedOverflow are the same as redis, they return
+// 1 or -1 when the value + incr is overflowed or underflowed with the limit value
+static int checkUnsignedOverflow(uint64_t value, int64_t incr, uint8_t bits,
+                                 BitfieldOverflow overflow, uint64_t *limit) {
+  uint64_t max = (bits == 64) ? UINT64_MAX : ((static_cast<uint64_t>(1) << bits) - 1);
+  int64_t maxincr = max - value;
+  int64_t minincr = -value;
+  if (value > max || (incr > 0 && incr > maxincr)) {
+    *limit = (overflow == kBitfieldOverflowSat) ? max : ((value + incr) & max);
+    return 1;
+  } else if (incr < 0 && incr < minincr) {
+    *limit = (overflow == kBitfieldOverflowSat) ? 0 : ((value + incr) & max);
+    return -1;
+  }
+  return 0;
+}
+
+static int checkSignedOverflow(int64_t value, int64_t incr, uint8_t bits,
+                               BitfieldOverflow overflow, int64_t *limit) {
+  int64_t max = (bits == 64) ? INT64_MAX : ((static_cast<int64_t>(1) << (bits - 1)) - 1);
+  int64_t min = -max - 1;
+  int64_t maxincr = max - value;
+  int64_t minincr = min - value;
+  int ret = 0;
+  if (value > max || (bits != 64 && incr > maxincr) || (value >= 0 && incr > 0 && incr > maxincr)) {
+    ret = 1;
+  } else if (value < min || (bits != 64 && incr < minincr) || (value < 0 && incr < 0 && incr < minincr)) {
+    ret = -1;
+  }
+  if (ret == 0) return 0;
+  if (overflow == kBitfieldOverflowSat) {
+    *limit = ret > 0 ? max : min;
+    return ret;
+  }
+  uint64_t c = static_cast<uint64_t>(value) + static_cast<uint64_t>(incr);
+  if (bits < 64) {
+    uint64_t mask = static_cast<uint64_t>(-1) << bits;
+    uint64_t msb = static_cast<uint64_t>(1) << (bits - 1);
+    c = (c & msb) ? (c | mask) : (c & ~mask);
+  }
+  *limit = static_cast<int64_t>(c);
+  return ret;
+}
+
+rocksdb::Status Bitmap::BitField(const Slice &user_key, const std::vector<BitfieldOperation> &ops,
+                                 std::vector<BitfieldResult> *rets) {
+  rets->clear();
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  BitmapMetadata metadata;
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  bool exists = s.ok();
+
+  // the touched segments are loaded once and written back in one batch
+  std::map<uint32_t, std::string> segments;
+  std::set<uint32_t> dirty_segments;
+  uint32_t bitmap_size = metadata.size;
+  auto loadSegment = [&](uint32_t index, std::string **segment) -> rocksdb::Status {
+    auto iter = segments.find(index);
+    if (iter == segments.end()) {
+      std::string sub_key, value;
+      if (exists) {
+        InternalKey(ns_key, std::to_string(index), metadata.version).Encode(&sub_key);
+        auto s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value);
+        if (!s.ok() && !s.IsNotFound()) return s;
+      }
+      iter = segments.emplace(index, std::move(value)).first;
+    }
+    *segment = &iter->second;
+    return rocksdb::Status::OK();
+  };
+  auto getField = [&](const BitfieldOperation &op, uint64_t *field) -> rocksdb::Status {
+    *field = 0;
+    std::string *segment;
+    for (uint32_t i = 0; i < op.bits; i++) {
+      uint32_t offset = op.offset + i;
+      auto s = loadSegment((offset / kBitmapSegmentBits) * kBitmapSegmentBytes, &segment);
+      if (!s.ok()) return s;
+      *field = (*field << 1) | (GetBitFromValueAndOffset(*segment, offset) ? 1 : 0);
+    }
+    return rocksdb::Status::OK();
+  };
+  auto setField = [&](const BitfieldOperation &op, uint64_t field) -> rocksdb::Status {
+    std::string *segment;
+    for (uint32_t i = 0; i < op.bits; i++) {
+      uint32_t offset = op.offset + i;
+      uint32_t index = (offset / kBitmapSegmentBits) * kBitmapSegmentBytes;
+      auto s = loadSegment(index, &segment);
+      if (!s.ok()) return s;
+      uint32_t byte_index = (offset / 8) % kBitmapSegmentBytes;
+      if (byte_index >= segment->size()) segment->resize(byte_index + 1, 0);
+      if (segment->size() + index > bitmap_size) bitmap_size = static_cast<uint32_t>(segment->size()) + index;
+      if ((field >> (op.bits - 1 - i)) & 1) {
+        (*segment)[byte_index] |= 1 << (offset % 8);
+      } else {
+        (*segment)[byte_index] &= ~(1 << (offset % 8));
+      }
+      dirty_segments.insert(index);
+    }
+    return rocksdb::Status::OK();
+  };
+
+  std::vector<std::string> log_args = {std::to_string(kRedisCmdBitField)};
+  for (const auto &op : ops) {
+    uint64_t field;
+    s = getField(op, &field);
+    if (!s.ok()) return s;
+    int64_t old_value = static_cast<int64_t>(field);
+    if (op.is_signed && op.bits < 64 && (field & (static_cast<uint64_t>(1) << (op.bits - 1)))) {
+      old_value = static_cast<int64_t>(field | (static_cast<uint64_t>(-1) << op.bits));
+    }
+    if (op.type == BitfieldOperation::kGet) {
+      rets->emplace_back(true, old_value);
+      continue;
+    }
+
+    int64_t new_value;
+    int overflowed;
+    if (op.is_signed) {
+      int64_t value = op.type == BitfieldOperation::kSet ? op.value : old_value;
+      int64_t incr = op.type == BitfieldOperation::kSet ? 0 : op.value;
+      overflowed = checkSignedOverflow(value, incr, op.bits, op.overflow, &new_value);
+      if (!overflowed) new_value = value + incr;
+    } else {
+      uint64_t value = op.type == BitfieldOperation::kSet ? static_cast<uint64_t>(op.value) : field;
+      int64_t incr = op.type == BitfieldOperation::kSet ? 0 : op.value;
+      uint64_t limit = value + incr;
+      overflowed = checkUnsignedOverflow(value, incr, op.bits, op.overflow, &limit);
+      new_value = static_cast<int64_t>(limit);
+    }
+    if (overflowed && op.overflow == kBitfieldOverflowFail) {
+      rets->emplace_back(false, 0);
+      continue;
+    }
+    s = setField(op, static_cast<uint64_t>(new_value));
+    if (!s.ok()) return s;
+    rets->emplace_back(true, op.type == BitfieldOperation::kSet ? old_value : new_value);
+    // log the final value of the field, so the replay doesn't depend on the overflow behavior
+    log_args.emplace_back("SET");
+    log_args.emplace_back((op.is_signed ? "i" : "u") + std::to_string(op.bits));
+    log_args.emplace_back(std::to_string(op.offset));
+    log_args.emplace_back(std::to_string(new_value));
+  }
+  if (dirty_segments.empty()) return rocksdb::Status::OK();
+  return writeSegments(ns_key, exists, bitmap_size, segments, dirty_segments, std::move(log_args), &metadata);
+}
+
+rocksdb::Status Bitmap::MSetBit(const Slice &user_key, const std::vector<std::pair<uint32_t, bool>> &bits,
+                                std::vector<bool> *old_bits) {
+  old_bits->clear();
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  BitmapMetadata metadata;
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  bool exists = s.ok();
+
+  // the bits are grouped by the segments, so each touched segment is read once
+  std::map<uint32_t, std::string> segments;
+  std::set<uint32_t> dirty_segments;
+  uint32_t bitmap_size = metadata.size;
+  std::vector<std::string> log_args = {std::to_string(kRedisCmdBitField)};
+  for (const auto &bit : bits) {
+    uint32_t offset = bit.first;
+    uint32_t index = (offset / kBitmapSegmentBits) * kBitmapSegmentBytes;
+    auto iter = segments.find(index);
+    if (iter == segments.end()) {
+      std::string sub_key, value;
+      if (exists) {
+        InternalKey(ns_key, std::to_string(index), metadata.version).Encode(&sub_key);
+        s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value);
+        if (!s.ok() && !s.IsNotFound()) return s;
+      }
+      iter = segments.emplace(index, std::move(value)).first;
+    }
+    std::string *segment = &iter->second;
+    uint32_t byte_index = (offset / 8) % kBitmapSegmentBytes;
+    if (byte_index >= segment->size()) segment->resize(byte_index + 1, 0);
+    if (segment->size() + index > bitmap_size) bitmap_size = static_cast<uint32_t>(segment->size()) + index;
+    old_bits->emplace_back(((*segment)[byte_index] & (1 << (offset % 8))) != 0);
+    if (bit.second) {
+      (*segment)[byte_index] |= 1 << (offset % 8);
+    } else {
+      (*segment)[byte_index] &= ~(1 << (offset % 8));
+    }
+    dirty_segments.insert(index);
+    // the bits are replayed as the one bit fields of the bitfield
+    log_args.emplace_back("SET");
+    log_args.emplace_back("u1");
+    log_args.emplace_back(std::to_string(offset));
+    log_args.emplace_back(bit.second ? "1" : "0");
+  }
+  if (dirty_segments.empty()) return rocksdb::Status::OK();
+  return writeSegments(ns_key, exists, bitmap_size, segments, dirty_segments, std::move(log_args), &metadata);
+}
+
+rocksdb::Status Bitmap::SetBitRange(const Slice &user_key, uint32_t start, uint32_t stop, bool new_bit,
+                                    uint32_t *changed) {
+  *changed = 0;
+  if (start > stop) return rocksdb::Status::OK();
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  BitmapMetadata metadata;
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  bool exists = s.ok();
+
+  std::map<uint32_t, std::string> segments;
+  std::set<uint32_t> dirty_segments;
+  uint32_t bitmap_size = metadata.size;
+  uint64_t offset = start;
+  while (offset <= stop) {
+    uint32_t index = static_cast<uint32_t>(offset / kBitmapSegmentBits) * kBitmapSegmentBytes;
+    std::string value;
+    if (exists) {
+      std::string sub_key;
+      InternalKey(ns_key, std::to_string(index), metadata.version).Encode(&sub_key);
+      s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value);
+      if (!s.ok() && !s.IsNotFound()) return s;
+    }
+    // the last bit of the range in this segment
+    uint64_t seg_stop = std::min<uint64_t>(stop, (offset / kBitmapSegmentBits + 1) * kBitmapSegmentBits - 1);
+    uint32_t stop_byte = static_cast<uint32_t>(seg_stop / 8) % kBitmapSegmentBytes;
+    if (stop_byte >= value.size()) value.resize(stop_byte + 1, 0);
+    if (value.size() + index > bitmap_size) bitmap_size = static_cast<uint32_t>(value.size()) + index;
+    while (offset <= seg_stop) {
+      uint32_t byte_index = static_cast<uint32_t>(offset / 8) % kBitmapSegmentBytes;
+      uint8_t old_byte = static_cast<uint8_t>(value[byte_index]), new_byte;
+      if (offset % 8 == 0 && offset + 7 <= seg_stop) {
+        // the whole byte is in the range
+        new_byte = new_bit ? 0xFF : 0;
+        offset += 8;
+      } else {
+        uint8_t mask = static_cast<uint8_t>(1 << (offset % 8));
+        new_byte = new_bit ? (old_byte | mask) : (old_byte & ~mask);
+        offset++;
+      }
+      *changed += __builtin_popcount(old_byte ^ new_byte);
+      value[byte_index] = static_cast<char>(new_byte);
+    }
+    segments.emplace(index, std::move(value));
+    dirty_segments.insert(index);
+  }
+  std::vector<std::string> log_args = {std::to_string(kRedisCmdSetBitRange), std::to_string(start),
+                                       std::to_string(stop), new_bit ? "1" : "0"};
+  return writeSegments(ns_key, exists, bitmap_size, segments, dirty_segments, std::move(log_args), &metadata);
+}
+
+rocksdb::Status Bitmap::writeSegments(const std::string &ns_key, bool exists, uint32_t bitmap_size,
+                                      const std::map<uint32_t, std::string> &segments,
+                                      const std::set<uint32_t> &dirty_segments,
+                                      std::vector<std::string> &&log_args, BitmapMetadata *metadata) {
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisBitmap, std::move(log_args));
+  batch.PutLogData(log_data.Encode());
+  std::string sub_key;
+  for (const auto &index : dirty_segments) {
+    InternalKey(ns_key, std::to_string(index), metadata->version).Encode(&sub_key);
+    batch.Put(subkey_cf_handle_, sub_key, segments.at(index));
+  }
+  if (!exists || metadata->size != bitmap_size) {
+    metadata->size = bitmap_size;
+    std::string bytes;
+    metadata->Encode(&bytes);
+    batch.Put(metadata_cf_handle_, ns_key, bytes);
+  }
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
 bool Bitmap::GetBitFromValueAndOffset(const std::string &value, uint32_t offset) {
   bool bit = false;
   uint32_t byte_index = (offset / 8) % kBitmapSegmentBytes;
@@ -3,21 +3,73 @@
 #include "redis_db.h"
 #include "redis_metadata.h"
 
+#include <map>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace Redis {
 
+enum BitOpFlags {
+  kBitOpAnd,
+  kBitOpOr,
+  kBitOpXor,
+  kBitOpNot,
+};
+
+enum BitfieldOverflow {
+  kBitfieldOverflowWrap,
+  kBitfieldOverflowSat,
+  kBitfieldOverflowFail,
+};
+
+struct BitfieldOperation {
+  enum Type {
+    kGet,
+    kSet,
+    kIncrBy,
+  };
+  Type type = kGet;
+  bool is_signed = false;
+  uint8_t bits = 0;
+  uint32_t offset = 0;
+  int64_t value = 0;
+  BitfieldOverflow overflow = kBitfieldOverflowWrap;
+};
+
+// the first field is false if the operation has no value(overflow fail)
+typedef std::pair<bool, int64_t> BitfieldResult;
+
 class Bitmap : public Database {
  public:
-  Bitmap(Engine::Storage *storage, const std::string &ns): Database(storage, ns) {}
+  Bitmap(Engine::Storage *storage, const std::string &ns)
+      : Database(storage, ns),
+        subkey_cf_handle_(storage->GetSubKeyCFHandle(kRedisBitmap)) {}
   rocksdb::Status GetBit(const Slice &user_key, uint32_t offset, bool *bit);
   rocksdb::Status SetBit(const Slice &user_key, uint32_t offset, bool new_bit, bool *old_bit);
   rocksdb::Status BitCount(const Slice &user_key, int start, int stop, uint32_t *cnt);
   rocksdb::Status BitPos(const Slice &user_key, bool bit, int start, int stop, int *pos);
+  rocksdb::Status BitOp(BitOpFlags op_flag, const std::string &op_name,
+                        const Slice &user_key, const std::vector<Slice> &op_keys, int64_t *len);
+  rocksdb::Status BitField(const Slice &user_key, const std::vector<BitfieldOperation> &ops,
+                           std::vector<BitfieldResult> *rets);
+  // MSetBit sets the bits of the offsets in one batch, and returns the old bits in the order of the offsets
+  rocksdb::Status MSetBit(const Slice &user_key, const std::vector<std::pair<uint32_t, bool>> &bits,
+                          std::vector<bool> *old_bits);
+  // SetBitRange sets the bits in [start, stop] in one batch, and returns the number of the changed bits
+  rocksdb::Status SetBitRange(const Slice &user_key, uint32_t start, uint32_t stop, bool new_bit, uint32_t *changed);
   static bool GetBitFromValueAndOffset(const std::string &value, const uint32_t offset);
   static bool IsEmptySegment(const Slice &segment);
  private:
   rocksdb::Status GetMetadata(const Slice &ns_key, BitmapMetadata *metadata);
+  // writeSegments writes the dirty segments and the metadata of the bitmap with the log data in one batch
+  rocksdb::Status writeSegments(const std::string &ns_key, bool exists, uint32_t bitmap_size,
+                                const std::map<uint32_t, std::string> &segments,
+                                const std::set<uint32_t> &dirty_segments,
+                                std::vector<std::string> &&log_args, BitmapMetadata *metadata);
+
+  rocksdb::ColumnFamilyHandle *subkey_cf_handle_;
 };
 
 }  // namespace Redis
@@ -1,36 +1,53 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <glog/logging.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <unistd.h>
 #include <algorithm>
 #include <cctype>
 #include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <map>
 #include <thread>
 #include <utility>
 #include <memory>
+#include <set>
+#include <sstream>
+#include <unordered_map>
 
 #include "redis_db.h"
 #include "redis_cmd.h"
 #include "redis_hash.h"
 #include "redis_bitmap.h"
+#include "redis_hyperloglog.h"
+#include "redis_stream.h"
 #include "redis_list.h"
 #include "redis_request.h"
 #include "redis_connection.h"
 #include "redis_set.h"
 #include "redis_string.h"
 #include "redis_zset.h"
+#include "redis_geo.h"
 #include "redis_pubsub.h"
 #include "redis_sortedint.h"
+#include "redis_slot.h"
 #include "replication.h"
+#include "scripting.h"
+#include "rocksdb_crc32c.h"
 #include "util.h"
 #include "storage.h"
 #include "worker.h"
 #include "server.h"
 #include "log_collector.h"
+#include "profiler.h"
 
 namespace Redis {
 
 const char *kValueNotInterger = "value is not an integer or out of range";
+const int64_t kHotKeysMaxCount = 64;
 
 class CommandAuth : public Commander {
  public:
@@ -108,20 +125,21 @@ class CommandNamespace : public Commander {
 
 class CommandKeys : public Commander {
  public:
-  CommandKeys() : Commander("keys", 2, false) {}
+  CommandKeys() : Commander("keys", 2, false, true) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    std::string prefix = args_[1];
     std::vector<std::string> keys;
-    Redis::Database redis(svr->storage_, conn->GetNamespace());
-    if (prefix == "*") {
-      redis.Keys(std::string(), &keys);
-    } else {
-      if (prefix[prefix.size() - 1] != '*') {
-        *output = Redis::Error("ERR only keys prefix match was supported");
-        return Status::OK();
-      }
-      redis.Keys(prefix.substr(0, prefix.size() - 1), &keys);
+    if (args_[1].empty()) {
+      *output = Redis::MultiBulkString(keys);
+      return Status::OK();
     }
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    // seek to the literal prefix of the glob, and only match the keys against
+    // the whole pattern if it isn't like "prefix*"
+    bool match_all = false;
+    std::string prefix = Util::GlobLiteralPrefix(args_[1], &match_all);
+    Redis::KeyFilter filter;
+    filter.pattern = args_[1];
+    redis.Keys(prefix, &keys, nullptr, match_all ? nullptr : &filter);
     *output = Redis::MultiBulkString(keys);
     return Status::OK();
   }
@@ -129,7 +147,7 @@ class CommandKeys : public Commander {
 
 class CommandFlushDB : public Commander {
  public:
-  CommandFlushDB() : Commander("flushdb", 1, false) {}
+  CommandFlushDB() : Commander("flushdb", 1, false, true) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     Redis::Database redis(svr->storage_, conn->GetNamespace());
     rocksdb::Status s = redis.FlushDB();
@@ -145,7 +163,7 @@ class CommandFlushDB : public Commander {
 
 class CommandFlushAll : public Commander {
  public:
-  CommandFlushAll() : Commander("flushall", 1, false) {}
+  CommandFlushAll() : Commander("flushall", 1, false, true) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     if (!conn->IsAdmin()) {
       *output = Redis::Error("only administrator can use flushall command");
@@ -580,10 +598,9 @@ class CommandDel : public Commander {
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     int cnt = 0;
     Redis::Database redis(svr->storage_, conn->GetNamespace());
-    for (unsigned int i = 1; i < args_.size(); i++) {
-      rocksdb::Status s = redis.Del(args_[i]);
-      if (s.ok()) cnt++;
-    }
+    std::vector<rocksdb::Slice> keys(args_.begin() + 1, args_.end());
+    rocksdb::Status s = redis.MDel(keys, &cnt);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
     *output = Redis::Integer(cnt);
     return Status::OK();
   }
@@ -645,6 +662,73 @@ class CommandSetBit : public Commander {
   bool bit_ = false;
 };
 
+class CommandMSetBit : public Commander {
+ public:
+  CommandMSetBit() : Commander("msetbit", -4, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    if (args.size() % 2 != 0) return Status(Status::RedisParseErr, "wrong number of arguments");
+    for (size_t i = 2; i < args.size(); i += 2) {
+      int64_t offset;
+      auto s = Util::StringToNum(args[i], &offset, 0, UINT32_MAX);
+      if (!s.IsOK()) return Status(Status::RedisParseErr, kValueNotInterger);
+      if (args[i + 1] != "0" && args[i + 1] != "1") return Status(Status::RedisParseErr, "bit should be 0 or 1");
+      bits_.emplace_back(static_cast<uint32_t>(offset), args[i + 1] == "1");
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    std::vector<bool> old_bits;
+    Redis::Bitmap bitmap_db(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s = bitmap_db.MSetBit(args_[1], bits_, &old_bits);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::MultiLen(old_bits.size());
+    for (const auto old_bit : old_bits) {
+      *output += Redis::Integer(old_bit ? 1 : 0);
+    }
+    return Status::OK();
+  }
+
+ private:
+  std::vector<std::pair<uint32_t, bool>> bits_;
+};
+
+class CommandSetBitRange : public Commander {
+ public:
+  CommandSetBitRange() : Commander("setbitrange", 5, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    int64_t start, stop;
+    auto s = Util::StringToNum(args[2], &start, 0, UINT32_MAX);
+    if (s.IsOK()) s = Util::StringToNum(args[3], &stop, 0, UINT32_MAX);
+    if (!s.IsOK()) return Status(Status::RedisParseErr, kValueNotInterger);
+    if (stop >= start && stop - start >= kMaxBitRangeBits) {
+      return Status(Status::RedisParseErr,
+                    "the range should be less than " + std::to_string(kMaxBitRangeBits) + " bits");
+    }
+    if (args[4] != "0" && args[4] != "1") return Status(Status::RedisParseErr, "bit should be 0 or 1");
+    start_ = static_cast<uint32_t>(start);
+    stop_ = static_cast<uint32_t>(stop);
+    bit_ = args[4] == "1";
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    uint32_t changed;
+    Redis::Bitmap bitmap_db(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s = bitmap_db.SetBitRange(args_[1], start_, stop_, bit_, &changed);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::Integer(changed);
+    return Status::OK();
+  }
+
+ private:
+  // the segments of the range are written in one batch, so the range is limited to 8MB
+  static const int64_t kMaxBitRangeBits = 64 * 1024 * 1024;
+  uint32_t start_ = 0;
+  uint32_t stop_ = 0;
+  bool bit_ = false;
+};
+
 class CommandBitCount : public Commander {
  public:
   CommandBitCount() : Commander("bitcount", -2, false) {}
@@ -704,199 +788,1111 @@ class CommandBitPos: public Commander {
   bool bit_ = false;
 };
 
-class CommandType : public Commander {
+class CommandBitOp : public Commander {
  public:
-  CommandType() : Commander("type", 2, false) {}
+  CommandBitOp() : Commander("bitop", -4, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    std::string opname = Util::ToLower(args[1]);
+    if (opname == "and") {
+      op_flag_ = Redis::kBitOpAnd;
+    } else if (opname == "or") {
+      op_flag_ = Redis::kBitOpOr;
+    } else if (opname == "xor") {
+      op_flag_ = Redis::kBitOpXor;
+    } else if (opname == "not") {
+      op_flag_ = Redis::kBitOpNot;
+    } else {
+      return Status(Status::RedisInvalidCmd, "Unknown bit operation");
+    }
+    if (op_flag_ == Redis::kBitOpNot && args.size() != 4) {
+      return Status(Status::RedisInvalidCmd, "BITOP NOT must be called with a single source key.");
+    }
+    return Commander::Parse(args);
+  }
+
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    Redis::Database redis(svr->storage_, conn->GetNamespace());
-    RedisType type;
-    rocksdb::Status s = redis.Type(args_[1], &type);
-    if (s.ok()) {
-      *output = Redis::BulkString(RedisTypeNames[type]);
-      return Status::OK();
+    std::vector<Slice> op_keys;
+    for (size_t i = 3; i < args_.size(); i++) {
+      op_keys.emplace_back(args_[i]);
     }
-    return Status(Status::RedisExecErr, s.ToString());
+    int64_t len;
+    Redis::Bitmap bitmap_db(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s = bitmap_db.BitOp(op_flag_, Util::ToLower(args_[1]), args_[2], op_keys, &len);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::Integer(len);
+    return Status::OK();
   }
+
+ private:
+  Redis::BitOpFlags op_flag_ = Redis::kBitOpAnd;
 };
 
-class CommandObject : public Commander {
+class CommandBitField : public Commander {
  public:
-  CommandObject() : Commander("object", 3, false) {}
-  Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    if (Util::ToLower(args_[1]) == "dump") {
-      Redis::Database redis(svr->storage_, conn->GetNamespace());
-      std::vector<std::string> infos;
-      rocksdb::Status s = redis.Dump(args_[2], &infos);
-      if (!s.ok()) {
-        return Status(Status::RedisExecErr, s.ToString());
+  CommandBitField() : Commander("bitfield", -2, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    Redis::BitfieldOverflow overflow = Redis::kBitfieldOverflowWrap;
+    for (size_t i = 2; i < args.size(); i++) {
+      std::string opt = Util::ToLower(args[i]);
+      if (opt == "overflow" && i + 1 < args.size()) {
+        std::string type = Util::ToLower(args[++i]);
+        if (type == "wrap") {
+          overflow = Redis::kBitfieldOverflowWrap;
+        } else if (type == "sat") {
+          overflow = Redis::kBitfieldOverflowSat;
+        } else if (type == "fail") {
+          overflow = Redis::kBitfieldOverflowFail;
+        } else {
+          return Status(Status::RedisInvalidCmd, "Invalid OVERFLOW type specified");
+        }
+        continue;
       }
-      output->append(Redis::MultiLen(infos.size()));
-      for (const auto info : infos) {
-        output->append(Redis::BulkString(info));
+      Redis::BitfieldOperation op;
+      if (opt == "get" && i + 2 < args.size()) {
+        op.type = Redis::BitfieldOperation::kGet;
+      } else if (opt == "set" && i + 3 < args.size()) {
+        op.type = Redis::BitfieldOperation::kSet;
+      } else if (opt == "incrby" && i + 3 < args.size()) {
+        op.type = Redis::BitfieldOperation::kIncrBy;
+      } else {
+        return Status(Status::RedisParseErr, "syntax error");
       }
-    } else {
-      *output = Redis::Error("object subcommand must be dump");
+      Status s = parseType(args[i + 1], &op);
+      if (!s.IsOK()) return s;
+      s = parseOffset(args[i + 2], &op);
+      if (!s.IsOK()) return s;
+      i += 2;
+      if (op.type != Redis::BitfieldOperation::kGet) {
+        try {
+          op.value = std::stoll(args[++i]);
+        } catch (std::exception &e) {
+          return Status(Status::RedisParseErr, kValueNotInterger);
+        }
+      }
+      op.overflow = overflow;
+      ops_.emplace_back(op);
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    std::vector<Redis::BitfieldResult> rets;
+    Redis::Bitmap bitmap_db(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s = bitmap_db.BitField(args_[1], ops_, &rets);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::MultiLen(rets.size());
+    for (const auto &ret : rets) {
+      *output += ret.first ? Redis::Integer(ret.second) : Redis::NilString();
+    }
+    return Status::OK();
+  }
+
+ private:
+  static Status parseType(const std::string &type, Redis::BitfieldOperation *op) {
+    int bits = 0;
+    if (type.size() >= 2 && (type[0] == 'i' || type[0] == 'u')
+        && type.find_first_not_of("0123456789", 1) == std::string::npos) {
+      try {
+        bits = std::stoi(type.substr(1));
+      } catch (std::exception &e) {
+        bits = 0;
+      }
+    }
+    op->is_signed = type[0] == 'i';
+    if (bits < 1 || (op->is_signed && bits > 64) || (!op->is_signed && bits > 63)) {
+      return Status(Status::RedisParseErr,
+                    "Invalid bitfield type. Use something like i16 u8. Note that u64 is not supported but i64 is.");
+    }
+    op->bits = static_cast<uint8_t>(bits);
+    return Status::OK();
+  }
+
+  // the offset prefixed with '#' is multiplied by the type bits
+  static Status parseOffset(const std::string &offset, Redis::BitfieldOperation *op) {
+    bool multiply = !offset.empty() && offset[0] == '#';
+    uint64_t n;
+    try {
+      if (offset.size() <= (multiply ? 1 : 0) || offset[multiply ? 1 : 0] == '-') throw std::invalid_argument(offset);
+      n = std::stoull(multiply ? offset.substr(1) : offset);
+    } catch (std::exception &e) {
+      return Status(Status::RedisParseErr, "bit offset is not an integer or out of range");
     }
+    if (n > UINT32_MAX) {
+      return Status(Status::RedisParseErr, "bit offset is not an integer or out of range");
+    }
+    if (multiply) n *= op->bits;
+    if (n + op->bits - 1 > UINT32_MAX) {
+      return Status(Status::RedisParseErr, "bit offset is not an integer or out of range");
+    }
+    op->offset = static_cast<uint32_t>(n);
     return Status::OK();
   }
+
+  std::vector<Redis::BitfieldOperation> ops_;
 };
 
-class CommandTTL : public Commander {
+class CommandPfAdd : public Commander {
  public:
-  CommandTTL() : Commander("ttl", 2, false) {}
+  CommandPfAdd() : Commander("pfadd", -2, true) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    Redis::Database redis(svr->storage_, conn->GetNamespace());
-    int ttl;
-    rocksdb::Status s = redis.TTL(args_[1], &ttl);
-    if (s.ok()) {
-      *output = Redis::Integer(ttl);
-      return Status::OK();
-    } else {
-      return Status(Status::RedisExecErr, s.ToString());
+    std::vector<Slice> elements;
+    for (size_t i = 2; i < args_.size(); i++) {
+      elements.emplace_back(args_[i]);
     }
+    int ret = 0;
+    Redis::HyperLogLog hll_db(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s = hll_db.Add(args_[1], elements, &ret);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::Integer(ret);
+    return Status::OK();
   }
 };
 
-class CommandPTTL : public Commander {
+class CommandPfCount : public Commander {
  public:
-  CommandPTTL() : Commander("pttl", 2, false) {}
+  CommandPfCount() : Commander("pfcount", -2, false) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    Redis::Database redis(svr->storage_, conn->GetNamespace());
-    int ttl;
-    rocksdb::Status s = redis.TTL(args_[1], &ttl);
-    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
-    if (ttl > 0) {
-      *output = Redis::Integer(ttl*1000);
-    } else {
-      *output = Redis::Integer(ttl);
+    std::vector<Slice> keys;
+    for (size_t i = 1; i < args_.size(); i++) {
+      keys.emplace_back(args_[i]);
     }
+    uint64_t count = 0;
+    Redis::HyperLogLog hll_db(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s = hll_db.Count(keys, &count);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::Integer(count);
     return Status::OK();
   }
 };
 
-class CommandExists : public Commander {
+class CommandPfMerge : public Commander {
  public:
-  CommandExists() : Commander("exists", -2, false) {}
+  CommandPfMerge() : Commander("pfmerge", -2, true) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    int cnt = 0;
-    Redis::Database redis(svr->storage_, conn->GetNamespace());
-    std::vector<rocksdb::Slice> keys;
-    for (unsigned i = 1; i < args_.size(); i++) {
-      keys.emplace_back(args_[i]);
+    std::vector<Slice> src_keys;
+    for (size_t i = 2; i < args_.size(); i++) {
+      src_keys.emplace_back(args_[i]);
     }
-    redis.Exists(keys, &cnt);
-    *output = Redis::Integer(cnt);
+    Redis::HyperLogLog hll_db(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s = hll_db.Merge(args_[1], src_keys);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::SimpleString("OK");
     return Status::OK();
   }
 };
 
-class CommandExpire : public Commander {
+const char *kInvalidStreamID = "Invalid stream ID specified as stream command argument";
+
+static std::string streamEntriesReply(const std::vector<Redis::StreamEntry> &entries) {
+  std::string output = Redis::MultiLen(entries.size());
+  for (const auto &entry : entries) {
+    output.append(Redis::MultiLen(2));
+    output.append(Redis::BulkString(entry.id.ToString()));
+    if (entry.deleted) {
+      output.append(Redis::NilString());
+      continue;
+    }
+    output.append(Redis::MultiLen(entry.values.size()));
+    for (const auto &value : entry.values) output.append(Redis::BulkString(value));
+  }
+  return output;
+}
+
+// parseStreamRangeID parses the range id of XRANGE and XPENDING, the missing seq of the start
+// is 0 and the end is the max, and the id prefixed by ( is exclusive
+static Status parseStreamRangeID(const std::string &input, bool is_start, Redis::StreamEntryID *id) {
+  if (input == "-") {
+    *id = Redis::StreamEntryID::Min();
+    return Status::OK();
+  }
+  if (input == "+") {
+    *id = Redis::StreamEntryID::Max();
+    return Status::OK();
+  }
+  bool exclusive = !input.empty() && input[0] == '(';
+  if (!Redis::StreamEntryID::Parse(exclusive ? input.substr(1) : input, is_start ? 0 : UINT64_MAX, id)) {
+    return Status(Status::RedisParseErr, kInvalidStreamID);
+  }
+  if (exclusive && !(is_start ? id->Next(id) : id->Prev(id))) {
+    return Status(Status::RedisParseErr, "invalid start or end ID for the interval");
+  }
+  return Status::OK();
+}
+
+static Status parseStreamMaxLen(const std::vector<std::string> &args, size_t *i, uint64_t *max_len) {
+  // the approximate trimming is exact, since the entries aren't packed into the nodes
+  if (*i < args.size() && (args[*i] == "~" || args[*i] == "=")) (*i)++;
+  if (*i >= args.size()) return Status(Status::RedisParseErr, "syntax error");
+  try {
+    if (args[*i].empty() || args[*i][0] == '-') throw std::invalid_argument(args[*i]);
+    *max_len = std::stoull(args[(*i)++]);
+  } catch (std::exception &e) {
+    return Status(Status::RedisParseErr, kValueNotInterger);
+  }
+  return Status::OK();
+}
+
+class CommandXAdd : public Commander {
  public:
-  CommandExpire() : Commander("expire", 3, true) {}
+  CommandXAdd() : Commander("xadd", -5, true) {}
   Status Parse(const std::vector<std::string> &args) override {
-    int64_t now;
-    rocksdb::Env::Default()->GetCurrentTime(&now);
-    try {
-      seconds_ = std::stoi(args[2]);
-      if (seconds_ >= INT32_MAX - now) {
-        return Status(Status::RedisParseErr, "the expire time was overflow");
+    size_t i = 2;
+    if (Util::ToLower(args[i]) == "maxlen") {
+      i++;
+      auto s = parseStreamMaxLen(args, &i, &options_.max_len);
+      if (!s.IsOK()) return s;
+      options_.with_max_len = true;
+    }
+    if (i >= args.size()) return Status(Status::RedisParseErr, "syntax error");
+    if (args[i] != "*") {
+      options_.auto_id = false;
+      if (!Redis::StreamEntryID::Parse(args[i], 0, &options_.id)) {
+        return Status(Status::RedisParseErr, kInvalidStreamID);
       }
-      seconds_ += now;
-    } catch (std::exception &e) {
-      return Status(Status::RedisParseErr, kValueNotInterger);
     }
+    i++;
+    if (i >= args.size() || (args.size() - i) % 2 != 0) {
+      return Status(Status::RedisParseErr, "wrong number of arguments");
+    }
+    values_ = std::vector<std::string>(args.begin() + i, args.end());
     return Commander::Parse(args);
   }
 
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    Redis::Database redis(svr->storage_, conn->GetNamespace());
-    rocksdb::Status s = redis.Expire(args_[1], seconds_);
-    if (s.ok()) {
-      *output = Redis::Integer(1);
-    } else {
-      *output = Redis::Integer(0);
-    }
+    Redis::Stream stream_db(svr->storage_, conn->GetNamespace());
+    Redis::StreamEntryID id;
+    rocksdb::Status s = stream_db.Add(args_[1], options_, values_, &id);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    // all the readers blocking on the stream are woken up, since the entries aren't consumed by XREAD
+    svr->WakeupBlockingConns(conn->GetNamespace(), args_[1], std::numeric_limits<size_t>::max());
+    *output = Redis::BulkString(id.ToString());
     return Status::OK();
   }
 
  private:
-  int seconds_ = 0;
+  Redis::StreamAddOptions options_;
+  std::vector<std::string> values_;
 };
 
-class CommandPExpire : public Commander {
+class CommandXLen : public Commander {
  public:
-  CommandPExpire() : Commander("pexpire", 3, true) {}
+  CommandXLen() : Commander("xlen", 2, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Stream stream_db(svr->storage_, conn->GetNamespace());
+    uint64_t len = 0;
+    rocksdb::Status s = stream_db.Len(args_[1], &len);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::Integer(len);
+    return Status::OK();
+  }
+};
+
+class CommandXRangeBase : public Commander {
+ public:
+  explicit CommandXRangeBase(bool reverse) : Commander("xrange", -4, false), reverse_(reverse) {}
   Status Parse(const std::vector<std::string> &args) override {
-    int64_t now;
-    rocksdb::Env::Default()->GetCurrentTime(&now);
-    try {
-      seconds_ = std::stol(args[2])/1000;
-      if (seconds_ >= INT32_MAX - now) {
-        return Status(Status::RedisParseErr, "the expire time was overflow");
+    auto s = parseStreamRangeID(args[reverse_ ? 3 : 2], true, &start_);
+    if (!s.IsOK()) return s;
+    s = parseStreamRangeID(args[reverse_ ? 2 : 3], false, &end_);
+    if (!s.IsOK()) return s;
+    if (args.size() == 6 && Util::ToLower(args[4]) == "count") {
+      try {
+        int64_t count = std::stoll(args[5]);
+        count_ = count > 0 ? static_cast<uint64_t>(count) : 0;
+        if (count <= 0) empty_ = true;
+      } catch (std::exception &e) {
+        return Status(Status::RedisParseErr, kValueNotInterger);
       }
-      seconds_ += now;
-    } catch (std::exception &e) {
-      return Status(Status::RedisParseErr, kValueNotInterger);
+    } else if (args.size() != 4) {
+      return Status(Status::RedisParseErr, "syntax error");
     }
     return Commander::Parse(args);
   }
 
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    Redis::Database redis(svr->storage_, conn->GetNamespace());
-    rocksdb::Status s = redis.Expire(args_[1], seconds_);
-    if (s.ok()) {
-      *output = Redis::Integer(1);
-    } else {
-      *output = Redis::Integer(0);
+    std::vector<Redis::StreamEntry> entries;
+    if (!empty_) {
+      Redis::Stream stream_db(svr->storage_, conn->GetNamespace());
+      rocksdb::Status s = stream_db.Range(args_[1], start_, end_, count_, reverse_, &entries);
+      if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
     }
+    *output = streamEntriesReply(entries);
     return Status::OK();
   }
 
  private:
-  int seconds_ = 0;
+  bool reverse_;
+  bool empty_ = false;
+  uint64_t count_ = 0;
+  Redis::StreamEntryID start_, end_;
 };
 
-class CommandExpireAt : public Commander {
+class CommandXRange : public CommandXRangeBase {
  public:
-  CommandExpireAt() : Commander("expireat", 3, true) {}
+  CommandXRange() : CommandXRangeBase(false) { name_ = "xrange"; }
+};
+
+class CommandXRevRange : public CommandXRangeBase {
+ public:
+  CommandXRevRange() : CommandXRangeBase(true) { name_ = "xrevrange"; }
+};
+
+class CommandXDel : public Commander {
+ public:
+  CommandXDel() : Commander("xdel", -3, true) {}
   Status Parse(const std::vector<std::string> &args) override {
-    try {
-      timestamp_ = std::stoi(args[2]);
-      if (timestamp_ >= INT32_MAX) {
-        return Status(Status::RedisParseErr, "the expire time was overflow");
-      }
-    } catch (std::exception &e) {
-      return Status(Status::RedisParseErr, kValueNotInterger);
+    for (size_t i = 2; i < args.size(); i++) {
+      Redis::StreamEntryID id;
+      if (!Redis::StreamEntryID::Parse(args[i], 0, &id)) return Status(Status::RedisParseErr, kInvalidStreamID);
+      ids_.emplace_back(id);
     }
     return Commander::Parse(args);
   }
+
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    Redis::Database redis(svr->storage_, conn->GetNamespace());
-    rocksdb::Status s = redis.Expire(args_[1], timestamp_);
-    if (s.ok()) {
-      *output = Redis::Integer(1);
-    } else {
-      *output = Redis::Integer(0);
-    }
+    Redis::Stream stream_db(svr->storage_, conn->GetNamespace());
+    uint64_t ret = 0;
+    rocksdb::Status s = stream_db.DeleteEntries(args_[1], ids_, &ret);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::Integer(ret);
     return Status::OK();
   }
 
  private:
-  int timestamp_ = 0;
+  std::vector<Redis::StreamEntryID> ids_;
 };
 
-class CommandPExpireAt : public Commander {
+class CommandXTrim : public Commander {
  public:
-  CommandPExpireAt() : Commander("pexpireat", 3, true) {}
+  CommandXTrim() : Commander("xtrim", -4, true) {}
   Status Parse(const std::vector<std::string> &args) override {
-    try {
-      timestamp_ = static_cast<int>(std::stol(args[2])/1000);
-      if (timestamp_ >= INT32_MAX) {
-        return Status(Status::RedisParseErr, "the expire time was overflow");
-      }
-    } catch (std::exception &e) {
-      return Status(Status::RedisParseErr, kValueNotInterger);
-    }
+    if (Util::ToLower(args[2]) != "maxlen") return Status(Status::RedisParseErr, "syntax error");
+    size_t i = 3;
+    auto s = parseStreamMaxLen(args, &i, &max_len_);
+    if (!s.IsOK()) return s;
+    if (i != args.size()) return Status(Status::RedisParseErr, "syntax error");
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Stream stream_db(svr->storage_, conn->GetNamespace());
+    uint64_t ret = 0;
+    rocksdb::Status s = stream_db.Trim(args_[1], max_len_, &ret);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::Integer(ret);
+    return Status::OK();
+  }
+
+ private:
+  uint64_t max_len_ = 0;
+};
+
+// CommandXReadBase parses the options and the streams of XREAD and XREADGROUP, and blocks
+// on the streams like BLPOP until any of them is added or the BLOCK timeout. The BLOCK is
+// ignored in the transaction or script like the redis.
+class CommandXReadBase : public Commander {
+ public:
+  explicit CommandXReadBase(bool group) : Commander("xread", -4, group), group_(group) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    size_t i = 1;
+    if (group_) {
+      if (args.size() < 4 || Util::ToLower(args[1]) != "group") return Status(Status::RedisParseErr, "syntax error");
+      group_name_ = args[2];
+      consumer_ = args[3];
+      i = 4;
+    }
+    for (; i < args.size(); i++) {
+      std::string opt = Util::ToLower(args[i]);
+      if (opt == "streams") break;
+      if (opt == "count" && i + 1 < args.size()) {
+        try {
+          int64_t count = std::stoll(args[++i]);
+          count_ = count > 0 ? static_cast<uint64_t>(count) : 0;
+        } catch (std::exception &e) {
+          return Status(Status::RedisParseErr, kValueNotInterger);
+        }
+      } else if (opt == "block" && i + 1 < args.size()) {
+        try {
+          block_ms_ = std::stoll(args[++i]);
+          if (block_ms_ < 0) return Status(Status::RedisParseErr, "timeout is negative");
+        } catch (std::exception &e) {
+          return Status(Status::RedisParseErr, "timeout is not an integer or out of range");
+        }
+        block_ = true;
+      } else if (opt == "noack" && group_) {
+        noack_ = true;
+      } else {
+        return Status(Status::RedisParseErr, "syntax error");
+      }
+    }
+    size_t n = args.size() - i - 1;
+    if (i >= args.size() || n == 0 || n % 2 != 0) {
+      return Status(Status::RedisParseErr, "Unbalanced XREAD list of streams: for each stream key an ID "
+                                           "or '$' must be specified");
+    }
+    keys_ = std::vector<std::string>(args.begin() + i + 1, args.begin() + i + 1 + n / 2);
+    id_args_ = std::vector<std::string>(args.begin() + i + 1 + n / 2, args.end());
+    for (const auto &id_arg : id_args_) {
+      Redis::StreamEntryID id;
+      if (id_arg == ">") {
+        if (!group_) return Status(Status::RedisParseErr, kInvalidStreamID);
+      } else if (id_arg == "$") {
+        if (group_) return Status(Status::RedisParseErr, kInvalidStreamID);
+      } else {
+        if (!Redis::StreamEntryID::Parse(id_arg, 0, &id)) return Status(Status::RedisParseErr, kInvalidStreamID);
+        history_ = group_;
+      }
+      ids_.emplace_back(id);
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Stream stream_db(svr->storage_, conn->GetNamespace());
+    // the $ is resolved only once, so the retries after blocking read the entries added since then
+    for (size_t i = 0; i < keys_.size(); i++) {
+      if (id_args_[i] != "$") continue;
+      rocksdb::Status s = stream_db.LastID(keys_[i], &ids_[i]);
+      if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    }
+    auto s = tryRead(svr, conn, output);
+    if (s.IsNotFound()) {
+      if (!block_ || nested_) {
+        *output = Redis::NilString();
+        return Status::OK();
+      }
+      conn->BlockOnKeys(keys_, block_ms_);
+      // retry after the keys are blocked, since the entries added before that
+      // wouldn't wake up the connection
+      s = tryRead(svr, conn, output);
+      if (!s.IsNotFound()) conn->UnBlockKeys();
+    }
+    if (!s.ok() && !s.IsNotFound()) {
+      return Status(Status::RedisExecErr, s.ToString());
+    }
+    return Status::OK();
+  }
+
+  bool OnBlockingKeyReady(Server *svr, Connection *conn) override {
+    std::string output;
+    auto s = tryRead(svr, conn, &output);
+    // the new entries are delivered to the other consumers of the group, keep blocking
+    if (s.IsNotFound()) return false;
+    if (!s.ok()) {
+      output = Redis::Error("ERR " + s.ToString());
+      LOG(ERROR) << "[XREAD] Failed to execute redis command: " << Name() << ", err: " << s.ToString();
+    }
+    conn->Reply(output);
+    return true;
+  }
+
+ private:
+  bool group_;
+  std::string group_name_;
+  std::string consumer_;
+  uint64_t count_ = 0;
+  bool block_ = false;
+  int64_t block_ms_ = 0;
+  bool noack_ = false;
+  // the history of the consumer is always replied, even if it is empty
+  bool history_ = false;
+  std::vector<std::string> keys_;
+  std::vector<std::string> id_args_;
+  std::vector<Redis::StreamEntryID> ids_;
+
+  // tryRead returns NotFound if no entries are read from the streams
+  rocksdb::Status tryRead(Server *svr, Connection *conn, std::string *output) {
+    Redis::Stream stream_db(svr->storage_, conn->GetNamespace());
+    std::vector<Redis::StreamEntry> entries;
+    std::string streams;
+    size_t n_streams = 0;
+    for (size_t i = 0; i < keys_.size(); i++) {
+      rocksdb::Status s;
+      if (group_) {
+        s = stream_db.ReadGroup(keys_[i], group_name_, consumer_, id_args_[i] == ">", ids_[i],
+                                count_, noack_, &entries);
+      } else {
+        Redis::StreamEntryID start;
+        if (!ids_[i].Next(&start)) continue;
+        s = stream_db.Range(keys_[i], start, Redis::StreamEntryID::Max(), count_, false, &entries);
+      }
+      if (!s.ok()) return s;
+      if (entries.empty() && (!group_ || id_args_[i] == ">")) continue;
+      streams.append(Redis::MultiLen(2));
+      streams.append(Redis::BulkString(keys_[i]));
+      streams.append(streamEntriesReply(entries));
+      n_streams++;
+    }
+    if (n_streams == 0 && !history_) return rocksdb::Status::NotFound();
+    *output = Redis::MultiLen(n_streams) + streams;
+    return rocksdb::Status::OK();
+  }
+};
+
+class CommandXRead : public CommandXReadBase {
+ public:
+  CommandXRead() : CommandXReadBase(false) { name_ = "xread"; }
+};
+
+class CommandXReadGroup : public CommandXReadBase {
+ public:
+  CommandXReadGroup() : CommandXReadBase(true) { name_ = "xreadgroup"; }
+};
+
+class CommandXGroup : public Commander {
+ public:
+  CommandXGroup() : Commander("xgroup", -4, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    subcommand_ = Util::ToLower(args[1]);
+    if (subcommand_ == "create" || subcommand_ == "setid") {
+      if (args.size() < 5) return Status(Status::RedisParseErr, "wrong number of arguments");
+      if (args[4] == "$") {
+        last_id_ = true;
+      } else if (!Redis::StreamEntryID::Parse(args[4], 0, &id_)) {
+        return Status(Status::RedisParseErr, kInvalidStreamID);
+      }
+      if (args.size() == 6 && subcommand_ == "create" && Util::ToLower(args[5]) == "mkstream") {
+        mkstream_ = true;
+      } else if (args.size() != 5) {
+        return Status(Status::RedisParseErr, "syntax error");
+      }
+    } else if (subcommand_ == "destroy") {
+      if (args.size() != 4) return Status(Status::RedisParseErr, "wrong number of arguments");
+    } else {
+      return Status(Status::RedisParseErr, "XGROUP subcommand must be CREATE, SETID or DESTROY");
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Stream stream_db(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s;
+    if (subcommand_ == "create") {
+      s = stream_db.CreateGroup(args_[2], args_[3], last_id_, id_, mkstream_);
+      if (s.ok()) *output = Redis::SimpleString("OK");
+    } else if (subcommand_ == "setid") {
+      s = stream_db.SetGroupID(args_[2], args_[3], last_id_, id_);
+      if (s.ok()) *output = Redis::SimpleString("OK");
+    } else {
+      int ret = 0;
+      s = stream_db.DestroyGroup(args_[2], args_[3], &ret);
+      if (s.IsNotFound()) return Status(Status::RedisExecErr, "The XGROUP subcommand requires the key to exist");
+      if (s.ok()) *output = Redis::Integer(ret);
+    }
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    return Status::OK();
+  }
+
+ private:
+  std::string subcommand_;
+  bool last_id_ = false;
+  bool mkstream_ = false;
+  Redis::StreamEntryID id_;
+};
+
+class CommandXAck : public Commander {
+ public:
+  CommandXAck() : Commander("xack", -4, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    for (size_t i = 3; i < args.size(); i++) {
+      Redis::StreamEntryID id;
+      if (!Redis::StreamEntryID::Parse(args[i], 0, &id)) return Status(Status::RedisParseErr, kInvalidStreamID);
+      ids_.emplace_back(id);
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Stream stream_db(svr->storage_, conn->GetNamespace());
+    uint64_t ret = 0;
+    rocksdb::Status s = stream_db.Ack(args_[1], args_[2], ids_, &ret);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::Integer(ret);
+    return Status::OK();
+  }
+
+ private:
+  std::vector<Redis::StreamEntryID> ids_;
+};
+
+class CommandXPending : public Commander {
+ public:
+  CommandXPending() : Commander("xpending", -3, false) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    if (args.size() == 3) return Commander::Parse(args);
+    if (args.size() != 6 && args.size() != 7) return Status(Status::RedisParseErr, "syntax error");
+    extended_ = true;
+    auto s = parseStreamRangeID(args[3], true, &start_);
+    if (!s.IsOK()) return s;
+    s = parseStreamRangeID(args[4], false, &end_);
+    if (!s.IsOK()) return s;
+    try {
+      int64_t count = std::stoll(args[5]);
+      count_ = count > 0 ? static_cast<uint64_t>(count) : 0;
+      if (count <= 0) empty_ = true;
+    } catch (std::exception &e) {
+      return Status(Status::RedisParseErr, kValueNotInterger);
+    }
+    if (args.size() == 7) consumer_ = args[6];
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Stream stream_db(svr->storage_, conn->GetNamespace());
+    std::vector<Redis::StreamPendingEntry> entries;
+    rocksdb::Status s;
+    if (!extended_) {
+      s = stream_db.Pending(args_[1], args_[2], Redis::StreamEntryID::Min(), Redis::StreamEntryID::Max(),
+                            0, "", &entries);
+    } else if (!empty_) {
+      s = stream_db.Pending(args_[1], args_[2], start_, end_, count_, consumer_, &entries);
+    }
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    if (extended_) {
+      auto now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count());
+      *output = Redis::MultiLen(entries.size());
+      for (const auto &entry : entries) {
+        output->append(Redis::MultiLen(4));
+        output->append(Redis::BulkString(entry.id.ToString()));
+        output->append(Redis::BulkString(entry.consumer));
+        output->append(Redis::Integer(now > entry.delivery_time ? now - entry.delivery_time : 0));
+        output->append(Redis::Integer(entry.delivery_count));
+      }
+      return Status::OK();
+    }
+    *output = Redis::MultiLen(4);
+    output->append(Redis::Integer(entries.size()));
+    if (entries.empty()) {
+      output->append(Redis::NilString() + Redis::NilString() + Redis::NilString());
+      return Status::OK();
+    }
+    std::map<std::string, uint64_t> consumers;
+    for (const auto &entry : entries) consumers[entry.consumer]++;
+    output->append(Redis::BulkString(entries.front().id.ToString()));
+    output->append(Redis::BulkString(entries.back().id.ToString()));
+    output->append(Redis::MultiLen(consumers.size()));
+    for (const auto &iter : consumers) {
+      output->append(Redis::MultiLen(2));
+      output->append(Redis::BulkString(iter.first));
+      output->append(Redis::BulkString(std::to_string(iter.second)));
+    }
+    return Status::OK();
+  }
+
+ private:
+  bool extended_ = false;
+  bool empty_ = false;
+  uint64_t count_ = 0;
+  std::string consumer_;
+  Redis::StreamEntryID start_, end_;
+};
+
+class CommandType : public Commander {
+ public:
+  CommandType() : Commander("type", 2, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    RedisType type;
+    rocksdb::Status s = redis.Type(args_[1], &type);
+    if (s.ok()) {
+      // the hyperloglog is a string in redis, and the clients may check the type before PFADD
+      if (type == kRedisHyperLogLog) type = kRedisString;
+      *output = Redis::BulkString(RedisTypeNames[type]);
+      return Status::OK();
+    }
+    return Status(Status::RedisExecErr, s.ToString());
+  }
+};
+
+class CommandObject : public Commander {
+ public:
+  CommandObject() : Commander("object", 3, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (Util::ToLower(args_[1]) == "dump") {
+      Redis::Database redis(svr->storage_, conn->GetNamespace());
+      std::vector<std::string> infos;
+      rocksdb::Status s = redis.Dump(args_[2], &infos);
+      if (!s.ok()) {
+        return Status(Status::RedisExecErr, s.ToString());
+      }
+      output->append(Redis::MultiLen(infos.size()));
+      for (const auto info : infos) {
+        output->append(Redis::BulkString(info));
+      }
+    } else {
+      *output = Redis::Error("object subcommand must be dump");
+    }
+    return Status::OK();
+  }
+};
+
+class CommandDump : public Commander {
+ public:
+  CommandDump() : Commander("dump", 2, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    std::string payload;
+    rocksdb::Status s = redis.DumpPayload(args_[1], &payload);
+    if (!s.ok() && !s.IsNotFound()) {
+      return Status(Status::RedisExecErr, s.ToString());
+    }
+    *output = s.IsNotFound() ? Redis::NilString() : Redis::BulkString(payload);
+    return Status::OK();
+  }
+};
+
+// RESTORE key ttl payload [REPLACE] [ABSTTL], the ttl is in milliseconds and 0 is persistent
+class CommandRestore : public Commander {
+ public:
+  CommandRestore() : Commander("restore", -4, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    auto s = Util::StringToNum(args[2], &ttl_ms_, 0);
+    if (!s.IsOK()) return Status(Status::RedisParseErr, "Invalid TTL value, must be >= 0");
+    for (size_t i = 4; i < args.size(); i++) {
+      std::string opt = Util::ToLower(args[i]);
+      if (opt == "replace") {
+        replace_ = true;
+      } else if (opt == "absttl") {
+        abs_ttl_ = true;
+      } else {
+        return Status(Status::NotOK, "syntax error");
+      }
+    }
+    return Commander::Parse(args);
+  }
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    int64_t now;
+    rocksdb::Env::Default()->GetCurrentTime(&now);
+    // the expire is in seconds, so the ttl is rounded up to keep the key until it's due
+    int64_t expire = 0;
+    if (ttl_ms_ > 0) expire = abs_ttl_ ? (ttl_ms_ + 999) / 1000 : now + (ttl_ms_ + 999) / 1000;
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    if (expire > 0 && expire <= now) {
+      // the key is restored as expired, which only removes the existing key
+      if (replace_) redis.Del(args_[1]);
+      *output = Redis::SimpleString("OK");
+      return Status::OK();
+    }
+    if (expire > INT32_MAX) return Status(Status::RedisExecErr, "the ttl was out of range");
+    bool busy = false;
+    rocksdb::Status s = redis.RestorePayload(args_[1], args_[3], static_cast<int>(expire), replace_, &busy);
+    if (!s.ok()) {
+      return Status(Status::RedisExecErr, s.IsCorruption() || s.IsNotSupported()
+                                          ? "DUMP payload version or checksum are wrong" : s.ToString());
+    }
+    *output = busy ? Redis::Error("BUSYKEY Target key name already exists.") : Redis::SimpleString("OK");
+    return Status::OK();
+  }
+
+ private:
+  int64_t ttl_ms_ = 0;
+  bool replace_ = false;
+  bool abs_ttl_ = false;
+};
+
+// MIGRATE host port key|"" destination-db timeout [COPY] [REPLACE] [AUTH password] [KEYS key [key ...]]
+// dumps the keys and pipelines their RESTORE to the target in one round trip, the keys are deleted
+// once they are restored unless COPY. The namespace of the target is selected by the password,
+// so the destination-db must be 0. The keys are locked from the dump to the deletion, so the writes
+// in between aren't lost, and the connecting and replies are bounded by the timeout, which is one
+// second if it's 0 like the redis.
+class CommandMigrate : public Commander {
+ public:
+  CommandMigrate() : Commander("migrate", -6, true, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    host_ = args[1];
+    auto s = Util::StringToNum(args[2], &port_, 1, 65535);
+    if (!s.IsOK()) return Status(Status::RedisParseErr, "invalid port");
+    if (args[4] != "0") return Status(Status::RedisParseErr, "the destination-db must be 0");
+    s = Util::StringToNum(args[5], &timeout_ms_, 0, INT_MAX);
+    if (!s.IsOK()) return Status(Status::RedisParseErr, "invalid timeout");
+    if (timeout_ms_ == 0) timeout_ms_ = 1000;
+    for (size_t i = 6; i < args.size(); i++) {
+      std::string opt = Util::ToLower(args[i]);
+      if (opt == "copy") {
+        copy_ = true;
+      } else if (opt == "replace") {
+        replace_ = true;
+      } else if (opt == "auth" && i + 1 < args.size()) {
+        password_ = args[++i];
+      } else if (opt == "keys" && args[3].empty()) {
+        keys_.assign(args.begin() + i + 1, args.end());
+        break;
+      } else {
+        return Status(Status::NotOK, "syntax error");
+      }
+    }
+    if (keys_.empty()) {
+      if (args[3].empty()) return Status(Status::NotOK, "syntax error");
+      keys_.emplace_back(args[3]);
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    // the key locks taken in the transaction are kept until it's committed, so the keys
+    // can't be written by others until they are deleted
+    svr->storage_->BeginTxn();
+    auto s = migrate(svr->storage_->GetLockManager(), &redis, output);
+    auto commit_s = svr->storage_->CommitTxn();
+    if (s.IsOK() && !commit_s.ok()) return Status(Status::RedisExecErr, commit_s.ToString());
+    return s;
+  }
+
+ private:
+  std::string host_;
+  int64_t port_ = 0;
+  int64_t timeout_ms_ = 0;
+  bool copy_ = false;
+  bool replace_ = false;
+  std::string password_;
+  std::vector<std::string> keys_;
+
+  Status migrate(LockManager *lock_mgr, Redis::Database *redis, std::string *output) {
+    std::string ns_key;
+    for (const auto &key : keys_) {
+      redis->AppendNamespacePrefix(key, &ns_key);
+      // the lock is released by the commit of the transaction instead of the guard
+      LockGuard guard(lock_mgr, ns_key);
+    }
+    std::string request;
+    if (!password_.empty()) request.append(Redis::MultiBulkString({"AUTH", password_}));
+    std::vector<std::string> migrated_keys;
+    for (const auto &key : keys_) {
+      std::string payload;
+      int expire = 0;
+      auto s = redis->DumpPayload(key, &payload, &expire);
+      if (s.IsNotFound()) continue;
+      if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+      std::vector<std::string> restore_args = {"RESTORE", key, std::to_string(int64_t(expire) * 1000), payload};
+      if (expire > 0) restore_args.emplace_back("ABSTTL");
+      if (replace_) restore_args.emplace_back("REPLACE");
+      request.append(Redis::MultiBulkString(restore_args));
+      migrated_keys.emplace_back(key);
+    }
+    if (migrated_keys.empty()) {
+      *output = Redis::SimpleString("NOKEY");
+      return Status::OK();
+    }
+
+    int fd;
+    auto s = Util::SockConnect(host_, static_cast<uint32_t>(port_), &fd, static_cast<int>(timeout_ms_));
+    if (!s.IsOK()) return Status(Status::RedisExecErr, "IOERR error connecting to the target: " + s.Msg());
+    timeval tv{timeout_ms_ / 1000, static_cast<suseconds_t>((timeout_ms_ % 1000) * 1000)};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    std::vector<std::string> replies;
+    size_t n_replies = migrated_keys.size() + (password_.empty() ? 0 : 1);
+    s = Util::SockSend(fd, request);
+    if (s.IsOK()) s = readReplyLines(fd, n_replies, static_cast<int>(timeout_ms_), &replies);
+    close(fd);
+    if (!s.IsOK()) return Status(Status::RedisExecErr, "IOERR error or timeout with the target: " + s.Msg());
+
+    if (!password_.empty()) {
+      if (replies[0].empty() || replies[0][0] != '+') {
+        *output = Redis::Error("ERR Target instance replied with error: " + replies[0].substr(1));
+        return Status::OK();
+      }
+      replies.erase(replies.begin());
+    }
+    std::string error;
+    for (size_t i = 0; i < migrated_keys.size(); i++) {
+      if (!replies[i].empty() && replies[i][0] == '+') {
+        if (!copy_) redis->Del(migrated_keys[i]);
+      } else if (error.empty()) {
+        error = replies[i].empty() ? replies[i] : replies[i].substr(1);
+      }
+    }
+    *output = error.empty() ? Redis::SimpleString("OK")
+                            : Redis::Error("ERR Target instance replied with error: " + error);
+    return Status::OK();
+  }
+
+  // readReplyLines reads the n single line replies of the AUTH and RESTORE, it fails if they
+  // aren't all read in the timeout
+  static Status readReplyLines(int fd, size_t n, int timeout_ms, std::vector<std::string> *lines) {
+    std::string buf;
+    char chunk[4096];
+    size_t pos = 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (lines->size() < n) {
+      auto end = buf.find("\r\n", pos);
+      if (end != std::string::npos) {
+        lines->emplace_back(buf.substr(pos, end - pos));
+        pos = end + 2;
+        continue;
+      }
+      auto remain_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now()).count();
+      pollfd pfd{fd, POLLIN, 0};
+      if (remain_ms <= 0 || poll(&pfd, 1, static_cast<int>(remain_ms)) == 0) {
+        return Status(Status::NotOK, "timeout");
+      }
+      ssize_t nread = read(fd, chunk, sizeof(chunk));
+      if (nread <= 0) return Status(Status::NotOK, nread == 0 ? "the connection was closed" : strerror(errno));
+      buf.append(chunk, static_cast<size_t>(nread));
+    }
+    return Status::OK();
+  }
+};
+
+class CommandTTL : public Commander {
+ public:
+  CommandTTL() : Commander("ttl", 2, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    int ttl;
+    rocksdb::Status s = redis.TTL(args_[1], &ttl);
+    if (s.ok()) {
+      *output = Redis::Integer(ttl);
+      return Status::OK();
+    } else {
+      return Status(Status::RedisExecErr, s.ToString());
+    }
+  }
+};
+
+class CommandPTTL : public Commander {
+ public:
+  CommandPTTL() : Commander("pttl", 2, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    int ttl;
+    rocksdb::Status s = redis.TTL(args_[1], &ttl);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    if (ttl > 0) {
+      *output = Redis::Integer(ttl*1000);
+    } else {
+      *output = Redis::Integer(ttl);
+    }
+    return Status::OK();
+  }
+};
+
+class CommandExists : public Commander {
+ public:
+  CommandExists() : Commander("exists", -2, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    int cnt = 0;
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    std::vector<rocksdb::Slice> keys;
+    for (unsigned i = 1; i < args_.size(); i++) {
+      keys.emplace_back(args_[i]);
+    }
+    redis.Exists(keys, &cnt);
+    *output = Redis::Integer(cnt);
+    return Status::OK();
+  }
+};
+
+class CommandExpire : public Commander {
+ public:
+  CommandExpire() : Commander("expire", 3, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    int64_t now;
+    rocksdb::Env::Default()->GetCurrentTime(&now);
+    try {
+      seconds_ = std::stoi(args[2]);
+      if (seconds_ >= INT32_MAX - now) {
+        return Status(Status::RedisParseErr, "the expire time was overflow");
+      }
+      seconds_ += now;
+    } catch (std::exception &e) {
+      return Status(Status::RedisParseErr, kValueNotInterger);
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s = redis.Expire(args_[1], seconds_);
+    if (s.ok()) {
+      *output = Redis::Integer(1);
+    } else {
+      *output = Redis::Integer(0);
+    }
+    return Status::OK();
+  }
+
+ private:
+  int seconds_ = 0;
+};
+
+class CommandPExpire : public Commander {
+ public:
+  CommandPExpire() : Commander("pexpire", 3, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    int64_t now;
+    rocksdb::Env::Default()->GetCurrentTime(&now);
+    try {
+      seconds_ = std::stol(args[2])/1000;
+      if (seconds_ >= INT32_MAX - now) {
+        return Status(Status::RedisParseErr, "the expire time was overflow");
+      }
+      seconds_ += now;
+    } catch (std::exception &e) {
+      return Status(Status::RedisParseErr, kValueNotInterger);
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s = redis.Expire(args_[1], seconds_);
+    if (s.ok()) {
+      *output = Redis::Integer(1);
+    } else {
+      *output = Redis::Integer(0);
+    }
+    return Status::OK();
+  }
+
+ private:
+  int seconds_ = 0;
+};
+
+class CommandExpireAt : public Commander {
+ public:
+  CommandExpireAt() : Commander("expireat", 3, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    try {
+      timestamp_ = std::stoi(args[2]);
+      if (timestamp_ >= INT32_MAX) {
+        return Status(Status::RedisParseErr, "the expire time was overflow");
+      }
+    } catch (std::exception &e) {
+      return Status(Status::RedisParseErr, kValueNotInterger);
+    }
+    return Commander::Parse(args);
+  }
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s = redis.Expire(args_[1], timestamp_);
+    if (s.ok()) {
+      *output = Redis::Integer(1);
+    } else {
+      *output = Redis::Integer(0);
+    }
+    return Status::OK();
+  }
+
+ private:
+  int timestamp_ = 0;
+};
+
+class CommandPExpireAt : public Commander {
+ public:
+  CommandPExpireAt() : Commander("pexpireat", 3, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    try {
+      timestamp_ = static_cast<int>(std::stol(args[2])/1000);
+      if (timestamp_ >= INT32_MAX) {
+        return Status(Status::RedisParseErr, "the expire time was overflow");
+      }
+    } catch (std::exception &e) {
+      return Status(Status::RedisParseErr, kValueNotInterger);
+    }
     return Commander::Parse(args);
   }
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
@@ -1141,10 +2137,66 @@ class CommandHMSet : public Commander {
   }
 };
 
-class CommandHKeys : public Commander {
+// the parts of the streaming reply are cut at about this size
+const size_t kStreamingReplyPartSize = 64 * 1024;
+
+// CommandStreamingReply replies the huge collections in parts while the connection drains
+// its output, instead of reading all the elements and building the whole reply in memory.
+// The array length is replied first, and the elements are read from the snapshot of it.
+class CommandStreamingReply : public Commander {
  public:
-  CommandHKeys() : Commander("hkeys", 2, false) {}
+  CommandStreamingReply(std::string name, int arity, int n_fields)
+      : Commander(std::move(name), arity, false, true), n_fields_(n_fields) {}
+
+  bool ContinueReply(std::string *output) override {
+    auto iter = stream_->Get();
+    for (; remaining_ > 0 && output->size() < kStreamingReplyPartSize; remaining_--) {
+      if (!iter->Valid()) {
+        // the array length is replied, fill it up though the snapshot shouldn't miss elements
+        LOG(ERROR) << "[request] The streaming reply of " << name_ << " ended before the size of "
+                   << args_[1] << ", err: " << iter->status().ToString();
+        for (int i = 0; i < n_fields_; i++) *output += Redis::NilString();
+        continue;
+      }
+      appendElement(iter, output);
+      iter->Next();
+    }
+    if (remaining_ > 0) return true;
+    stream_.reset();
+    streaming_reply_ = false;
+    return false;
+  }
+
+ protected:
+  // tryStreaming returns false if the key should be replied at once, otherwise the
+  // array length is appended into the output and the elements would be streamed
+  bool tryStreaming(Server *svr, Connection *conn, RedisType type, std::string *output) {
+    int min_size = svr->GetConfig()->streaming_reply_min_elements;
+    // the stream reads the db without the writes of the transaction, and the reply
+    // is a part of the reply of EXEC
+    if (min_size <= 0 || svr->storage_->InTxn()) return false;
+    Redis::SubKeyScanner scanner(svr->storage_, conn->GetNamespace());
+    uint64_t size = 0;
+    auto s = scanner.OpenStream(type, args_[1], static_cast<uint64_t>(min_size), &stream_, &size);
+    if (!s.ok()) return false;
+    remaining_ = size;
+    *output = Redis::MultiLen(static_cast<int64_t>(size * n_fields_));
+    streaming_reply_ = true;
+    return true;
+  }
+  virtual void appendElement(rocksdb::Iterator *iter, std::string *output) = 0;
+
+ private:
+  int n_fields_;
+  std::unique_ptr<Engine::ScanIterator> stream_;
+  uint64_t remaining_ = 0;
+};
+
+class CommandHKeys : public CommandStreamingReply {
+ public:
+  CommandHKeys() : CommandStreamingReply("hkeys", 2, 1) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (tryStreaming(svr, conn, kRedisHash, output)) return Status::OK();
     Redis::Hash hash_db(svr->storage_, conn->GetNamespace());
     std::vector<FieldValue> field_values;
     rocksdb::Status s = hash_db.GetAll(args_[1], &field_values, HashFetchType::kOnlyKey);
@@ -1158,12 +2210,18 @@ class CommandHKeys : public Commander {
     *output = Redis::MultiBulkString(keys);
     return Status::OK();
   }
+
+ protected:
+  void appendElement(rocksdb::Iterator *iter, std::string *output) override {
+    *output += Redis::BulkString(InternalKey(iter->key()).GetSubKey().ToString());
+  }
 };
 
-class CommandHVals : public Commander {
+class CommandHVals : public CommandStreamingReply {
  public:
-  CommandHVals() : Commander("hvals", 2, false) {}
+  CommandHVals() : CommandStreamingReply("hvals", 2, 1) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (tryStreaming(svr, conn, kRedisHash, output)) return Status::OK();
     Redis::Hash hash_db(svr->storage_, conn->GetNamespace());
     std::vector<FieldValue> field_values;
     rocksdb::Status s = hash_db.GetAll(args_[1], &field_values, HashFetchType::kOnlyValue);
@@ -1177,12 +2235,18 @@ class CommandHVals : public Commander {
     *output = Redis::MultiBulkString(values);
     return Status::OK();
   }
+
+ protected:
+  void appendElement(rocksdb::Iterator *iter, std::string *output) override {
+    *output += Redis::BulkString(iter->value().ToString());
+  }
 };
 
-class CommandHGetAll : public Commander {
+class CommandHGetAll : public CommandStreamingReply {
  public:
-  CommandHGetAll() : Commander("hgetall", 2, false) {}
+  CommandHGetAll() : CommandStreamingReply("hgetall", 2, 2) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (tryStreaming(svr, conn, kRedisHash, output)) return Status::OK();
     Redis::Hash hash_db(svr->storage_, conn->GetNamespace());
     std::vector<FieldValue> field_values;
     rocksdb::Status s = hash_db.GetAll(args_[1], &field_values);
@@ -1196,6 +2260,12 @@ class CommandHGetAll : public Commander {
     }
     return Status::OK();
   }
+
+ protected:
+  void appendElement(rocksdb::Iterator *iter, std::string *output) override {
+    *output += Redis::BulkString(InternalKey(iter->key()).GetSubKey().ToString());
+    *output += Redis::BulkString(iter->value().ToString());
+  }
 };
 
 class CommandPush : public Commander {
@@ -1222,7 +2292,7 @@ class CommandPush : public Commander {
       return Status(Status::RedisExecErr, s.ToString());
     }
 
-    svr->WakeupBlockingConns(args_[1], elems.size());
+    svr->WakeupBlockingConns(conn->GetNamespace(), args_[1], elems.size());
 
     *output = Redis::Integer(ret);
     return Status::OK();
@@ -1288,12 +2358,6 @@ class CommandRPop : public CommandPop {
 class CommandBPop : public Commander {
  public:
   explicit CommandBPop(bool left) : Commander("bpop", -3, true) { left_ = left; }
-  ~CommandBPop() {
-    if (timer_ != nullptr) {
-      event_free(timer_);
-      timer_ = nullptr;
-    }
-  }
 
   Status Parse(const std::vector<std::string> &args) override {
     try {
@@ -1309,102 +2373,48 @@ class CommandBPop : public Commander {
   }
 
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    svr_ = svr;
-    conn_ = conn;
-
-    auto bev = conn->GetBufferEvent();
-    auto s = TryPopFromList();
-    if (s.ok() || !s.IsNotFound()) {
-      return Status::OK();  // error has already output in TryPopFromList
-    }
-    for (const auto &key : keys_) {
-      svr_->AddBlockingKey(key, conn_);
-    }
-    bufferevent_setcb(bev, nullptr, WriteCB, EventCB, this);
-    if (timeout_) {
-      timer_ = evtimer_new(bufferevent_get_base(bev), TimerCB, this);
-      timeval tm = {timeout_, 0};
-      evtimer_add(timer_, &tm);
-    }
-    return Status::OK();
-  }
-
-  rocksdb::Status TryPopFromList() {
-    Redis::List list_db(svr_->storage_, conn_->GetNamespace());
-    std::string elem;
-    rocksdb::Status s;
-    for (const auto &key : keys_) {
-      s = list_db.Pop(key, &elem, left_);
-      if (s.ok() || !s.IsNotFound()) {
-        break;
-      }
-    }
-    if (s.ok()) {
-      conn_->Reply(Redis::BulkString(elem));
-    } else if (!s.IsNotFound()) {
-      conn_->Reply(Redis::Error("ERR " + s.ToString()));
-      LOG(ERROR) << "Failed to execute redis command: " << conn_->current_cmd_->Name()
-                 << ", err: " << s.ToString();
-    }
-    return s;
-  }
-
-  static void WriteCB(bufferevent *bev, void *ctx) {
-    auto self = reinterpret_cast<CommandBPop *>(ctx);
-    auto s = self->TryPopFromList();
-    // if pop fail ,currently we compromised to close bpop request
+    auto s = tryPopFromList(svr, conn, output);
     if (s.IsNotFound()) {
-      self->conn_->Reply(Redis::NilString());
-      LOG(ERROR) << "[BPOP] Failed to execute redis command: " << self->conn_->current_cmd_->Name()
-                 << ", err: another concurrent pop request must have stole the data before this bpop request"
-                 << " or bpop is in a pipeline cmd list(cmd before bpop replyed trigger this writecb)";
+      conn->BlockOnKeys(keys_, static_cast<int64_t>(timeout_) * 1000);
+      // retry after the keys are blocked, since the elements pushed before that
+      // wouldn't wake up the connection
+      s = tryPopFromList(svr, conn, output);
+      if (!s.IsNotFound()) conn->UnBlockKeys();
     }
-    if (self->timer_ != nullptr) {
-      event_free(self->timer_);
-      self->timer_ = nullptr;
+    if (!s.ok() && !s.IsNotFound()) {
+      return Status(Status::RedisExecErr, s.ToString());
     }
-    self->unBlockingAll();
-    bufferevent_setcb(bev, Redis::Connection::OnRead, Redis::Connection::OnWrite,
-                      Redis::Connection::OnEvent, self->conn_);
-    bufferevent_enable(bev, EV_READ);
+    return Status::OK();
   }
 
-  static void EventCB(bufferevent *bev, int16_t events, void *ctx) {
-    auto self = static_cast<CommandBPop *>(ctx);
-    if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
-      if (self->timer_ != nullptr) {
-        event_free(self->timer_);
-        self->timer_ = nullptr;
-      }
-      self->unBlockingAll();
+  bool OnBlockingKeyReady(Server *svr, Connection *conn) override {
+    std::string output;
+    auto s = tryPopFromList(svr, conn, &output);
+    // the elements are taken by others, keep blocking instead of replying the nil
+    if (s.IsNotFound()) return false;
+    if (!s.ok()) {
+      output = Redis::Error("ERR " + s.ToString());
+      LOG(ERROR) << "[BPOP] Failed to execute redis command: " << Name() << ", err: " << s.ToString();
     }
-    Redis::Connection::OnEvent(bev, events, self->conn_);
-  }
-
-  static void TimerCB(int, int16_t events, void *ctx) {
-    auto self = reinterpret_cast<CommandBPop *>(ctx);
-    self->conn_->Reply(Redis::NilString());
-    event_free(self->timer_);
-    self->timer_ = nullptr;
-    self->unBlockingAll();
-    auto bev = self->conn_->GetBufferEvent();
-    bufferevent_setcb(bev, Redis::Connection::OnRead, Redis::Connection::OnWrite,
-                      Redis::Connection::OnEvent, self->conn_);
-    bufferevent_enable(bev, EV_READ);
+    conn->Reply(output);
+    return true;
   }
 
  private:
   bool left_ = false;
   int timeout_ = 0;  // second
   std::vector<std::string> keys_;
-  Server *svr_ = nullptr;
-  Connection *conn_ = nullptr;
-  event *timer_ = nullptr;
 
-  void unBlockingAll() {
+  rocksdb::Status tryPopFromList(Server *svr, Connection *conn, std::string *output) {
+    Redis::List list_db(svr->storage_, conn->GetNamespace());
+    std::string elem;
+    rocksdb::Status s;
     for (const auto &key : keys_) {
-      svr_->UnBlockingKey(key, conn_);
+      s = list_db.Pop(key, &elem, left_);
+      if (!s.IsNotFound()) break;
     }
+    if (s.ok()) *output = Redis::BulkString(elem);
+    return s;
   }
 };
 
@@ -1602,6 +2612,7 @@ class CommandRPopLPUSH : public Commander {
     if (!s.ok() && !s.IsNotFound()) {
       return Status(Status::RedisExecErr, s.ToString());
     }
+    if (s.ok()) svr->WakeupBlockingConns(conn->GetNamespace(), args_[2], 1);
     *output = s.IsNotFound() ? Redis::NilString() : Redis::BulkString(elem);
     return Status::OK();
   }
@@ -1660,10 +2671,11 @@ class CommandSCard : public Commander {
   }
 };
 
-class CommandSMembers : public Commander {
+class CommandSMembers : public CommandStreamingReply {
  public:
-  CommandSMembers() : Commander("smembers", 2, false) {}
+  CommandSMembers() : CommandStreamingReply("smembers", 2, 1) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (tryStreaming(svr, conn, kRedisSet, output)) return Status::OK();
     Redis::Set set_db(svr->storage_, conn->GetNamespace());
     std::vector<std::string> members;
     rocksdb::Status s = set_db.Members(args_[1], &members);
@@ -1673,6 +2685,11 @@ class CommandSMembers : public Commander {
     *output = Redis::MultiBulkString(members);
     return Status::OK();
   }
+
+ protected:
+  void appendElement(rocksdb::Iterator *iter, std::string *output) override {
+    *output += Redis::BulkString(InternalKey(iter->key()).GetSubKey().ToString());
+  }
 };
 
 class CommandSIsMember : public Commander {
@@ -1690,6 +2707,28 @@ class CommandSIsMember : public Commander {
   }
 };
 
+class CommandSMIsMember : public Commander {
+ public:
+  CommandSMIsMember() : Commander("smismember", -3, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Set set_db(svr->storage_, conn->GetNamespace());
+    std::vector<Slice> members;
+    for (size_t i = 2; i < args_.size(); i++) {
+      members.emplace_back(args_[i]);
+    }
+    std::vector<int> exists;
+    rocksdb::Status s = set_db.MIsMember(args_[1], members, &exists);
+    if (!s.ok()) {
+      return Status(Status::RedisExecErr, s.ToString());
+    }
+    output->append(Redis::MultiLen(exists.size()));
+    for (const auto &e : exists) {
+      output->append(Redis::Integer(e));
+    }
+    return Status::OK();
+  }
+};
+
 class CommandSPop : public Commander {
  public:
   CommandSPop() : Commander("spop", -2, true) {}
@@ -1763,7 +2802,7 @@ class CommandSMove : public Commander {
 
 class CommandSDiff : public Commander {
  public:
-  CommandSDiff() : Commander("sdiff", -2, false) {}
+  CommandSDiff() : Commander("sdiff", -2, false, true) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     std::vector<Slice> keys;
     for (size_t i = 1; i < args_.size(); i++) {
@@ -1782,7 +2821,7 @@ class CommandSDiff : public Commander {
 
 class CommandSUnion : public Commander {
  public:
-  CommandSUnion() : Commander("sunion", -2, false) {}
+  CommandSUnion() : Commander("sunion", -2, false, true) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     std::vector<Slice> keys;
     for (size_t i = 1; i < args_.size(); i++) {
@@ -1801,7 +2840,7 @@ class CommandSUnion : public Commander {
 
 class CommandSInter : public Commander {
  public:
-  CommandSInter() : Commander("sinter", -2, false) {}
+  CommandSInter() : Commander("sinter", -2, false, true) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     std::vector<Slice> keys;
     for (size_t i = 1; i < args_.size(); i++) {
@@ -1820,7 +2859,7 @@ class CommandSInter : public Commander {
 
 class CommandSDiffStore: public Commander {
  public:
-  CommandSDiffStore() : Commander("sdiffstore", -3, false) {}
+  CommandSDiffStore() : Commander("sdiffstore", -3, false, true) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     int ret = 0;
     std::vector<Slice> keys;
@@ -1839,7 +2878,7 @@ class CommandSDiffStore: public Commander {
 
 class CommandSUnionStore: public Commander {
  public:
-  CommandSUnionStore() : Commander("sunionstore", -3, false) {}
+  CommandSUnionStore() : Commander("sunionstore", -3, false, true) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     int ret = 0;
     std::vector<Slice> keys;
@@ -1858,7 +2897,7 @@ class CommandSUnionStore: public Commander {
 
 class CommandSInterStore: public Commander {
  public:
-  CommandSInterStore() : Commander("sinterstore", -3, false) {}
+  CommandSInterStore() : Commander("sinterstore", -3, false, true) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     int ret = 0;
     std::vector<Slice> keys;
@@ -2355,7 +3394,7 @@ class CommandZScore : public Commander {
 
 class CommandZUnionStore : public Commander {
  public:
-  CommandZUnionStore() : Commander("zunionstore", -4, true) {}
+  CommandZUnionStore() : Commander("zunionstore", -4, true, true) {}
   Status Parse(const std::vector<std::string> &args) override {
     try {
       numkeys_ = std::stoi(args[2]);
@@ -2549,15 +3588,49 @@ class CommandSortedintRange : public Commander {
   }
 
  private:
-  uint64_t cursor_id_ = 0;
-  uint64_t offset_ = 0;
-  uint64_t limit_ = 20;
-  bool reversed_ = false;
-};
-
-class CommandSortedintRevRange : public CommandSortedintRange {
- public:
-  CommandSortedintRevRange() : CommandSortedintRange(true) { name_ = "sirevrange"; }
+  uint64_t cursor_id_ = 0;
+  uint64_t offset_ = 0;
+  uint64_t limit_ = 20;
+  bool reversed_ = false;
+};
+
+class CommandSortedintRevRange : public CommandSortedintRange {
+ public:
+  CommandSortedintRevRange() : CommandSortedintRange(true) { name_ = "sirevrange"; }
+};
+
+class CommandSortedintExists : public Commander {
+ public:
+  CommandSortedintExists() : Commander("siexists", -3, false) {}
+
+  Status Parse(const std::vector<std::string> &args) override {
+    try {
+      for (unsigned i = 2; i < args.size(); i++) {
+        auto id = std::stoull(args[i]);
+        ids_.emplace_back(id);
+      }
+    } catch (const std::exception &e) {
+      return Status(Status::RedisParseErr, kValueNotInterger);
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Sortedint sortedint_db(svr->storage_, conn->GetNamespace());
+    std::vector<int> exists;
+    rocksdb::Status s = sortedint_db.MExist(args_[1], ids_, &exists);
+    if (!s.ok()) {
+      return Status(Status::RedisExecErr, s.ToString());
+    }
+    output->append(Redis::MultiLen(exists.size()));
+    for (const auto exist : exists) {
+      output->append(Redis::Integer(exist));
+    }
+    return Status::OK();
+  }
+
+ private:
+  std::vector<uint64_t> ids_;
 };
 
 class CommandInfo : public Commander {
@@ -2575,6 +3648,51 @@ class CommandInfo : public Commander {
   }
 };
 
+// CommandCluster only offers the slot lookups, the slots aren't encoded into the keys yet,
+// so COUNTKEYSINSLOT and GETKEYSINSLOT scan the whole namespace for the keys of the slot
+class CommandCluster : public Commander {
+ public:
+  CommandCluster() : Commander("cluster", -2, false, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    subcommand_ = Util::ToLower(args[1]);
+    if (subcommand_ == "keyslot" && args.size() == 3) return Status::OK();
+    if ((subcommand_ == "countkeysinslot" && args.size() == 3)
+        || (subcommand_ == "getkeysinslot" && args.size() == 4)) {
+      auto s = Util::StringToNum(args[2], &slot_, 0, kClusterSlots - 1);
+      if (!s.IsOK()) return Status(Status::RedisParseErr, "Invalid slot");
+      if (args.size() == 4) {
+        s = Util::StringToNum(args[3], &count_, 0);
+        if (!s.IsOK()) return Status(Status::RedisParseErr, "Invalid number of keys");
+      }
+      return Status::OK();
+    }
+    return Status(Status::RedisParseErr, "CLUSTER subcommand must be one of KEYSLOT, COUNTKEYSINSLOT, GETKEYSINSLOT");
+  }
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (subcommand_ == "keyslot") {
+      *output = Redis::Integer(GetSlotNumFromKey(args_[2]));
+      return Status::OK();
+    }
+    std::vector<std::string> keys;
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    Redis::KeyFilter filter;
+    filter.slot = static_cast<int>(slot_);
+    redis.Keys("", &keys, nullptr, &filter);
+    if (subcommand_ == "countkeysinslot") {
+      *output = Redis::Integer(keys.size());
+      return Status::OK();
+    }
+    if (keys.size() > static_cast<size_t>(count_)) keys.resize(static_cast<size_t>(count_));
+    *output = Redis::MultiBulkString(keys);
+    return Status::OK();
+  }
+
+ private:
+  std::string subcommand_;
+  int64_t slot_ = 0;
+  int64_t count_ = 0;
+};
+
 class CommandCompact : public Commander {
  public:
   CommandCompact() : Commander("compact", 1, false) {}
@@ -2607,6 +3725,32 @@ class CommandBGSave: public Commander {
   }
 };
 
+// INGEST column_family file [file ...] ingests the sst files built by the kvrocks_sst_builder,
+// the subkeys should be ingested before the metadata, so the keys are never seen half loaded.
+// It's slow, so the ingestion runs off the worker when the slow command executor is enabled.
+class CommandIngest : public Commander {
+ public:
+  CommandIngest() : Commander("ingest", -3, true, true) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (!conn->IsAdmin()) {
+      *output = Redis::Error("only administrator can ingest the sst files");
+      return Status::OK();
+    }
+    if (svr->IsSlave()) {
+      *output = Redis::Error("the sst files can't be ingested into the slave");
+      return Status::OK();
+    }
+    std::vector<std::string> files(args_.begin() + 2, args_.end());
+    Status s = svr->storage_->IngestSSTFiles(args_[1], files);
+    // the slaves are resynced by the full sync, since the ingested data isn't in the WAL
+    svr->DisconnectSlaves();
+    if (!s.IsOK()) return s;
+    *output = Redis::SimpleString("OK");
+    LOG(INFO) << "Ingested " << files.size() << " sst files into the column family: " << args_[1];
+    return Status::OK();
+  }
+};
+
 class CommandDBSize : public Commander {
  public:
   CommandDBSize() : Commander("dbsize", -1, false) {}
@@ -2614,7 +3758,14 @@ class CommandDBSize : public Commander {
     std::string ns = conn->GetNamespace();
     if (args_.size() == 1) {
       KeyNumStats stats;
-      svr->GetLastestKeyNumStats(ns, &stats);
+      if (svr->GetLastScanTime(ns) == 0) {
+        // answer the estimated number instantly, and refine it by scanning in background
+        Redis::Database db(svr->storage_, ns);
+        db.EstimateKeyNum(&stats.n_key);
+        svr->AsyncScanDBSize(ns);
+      } else {
+        svr->GetLastestKeyNumStats(ns, &stats);
+      }
       *output = Redis::Integer(stats.n_key);
     } else if (args_.size() == 2 && args_[1] == "scan") {
       Status s = svr->AsyncScanDBSize(ns);
@@ -2809,6 +3960,116 @@ class CommandSlaveOf : public Commander {
   uint32_t port_ = 0;
 };
 
+static int replWaitTimeout(Server *svr, int64_t timeout_ms) {
+  int64_t max_wait_ms = svr->GetConfig()->repl_wait_max_ms;
+  return static_cast<int>(timeout_ms == 0 || timeout_ms > max_wait_ms ? max_wait_ms : timeout_ms);
+}
+
+// WAIT blocks until the last write of the connection is acked by at least numreplicas
+// slaves or timeout, and returns the number of the slaves which have reached it. The
+// timeout is capped by the repl-wait-max-ms, and 0 is to wait for the max. The connection
+// is parked while waiting, so neither the worker nor a slow thread is held.
+class CommandWait : public Commander {
+ public:
+  CommandWait() : Commander("wait", 3, false) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    try {
+      num_replicas_ = std::stoi(args[1]);
+      timeout_ms_ = std::stoll(args[2]);
+    } catch (const std::exception &e) {
+      return Status(Status::RedisParseErr, "value is not an integer or out of range");
+    }
+    if (timeout_ms_ < 0) return Status(Status::RedisParseErr, "timeout is negative");
+    return Commander::Parse(args);
+  }
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (svr->IsSlave()) {
+      *output = Redis::Error("ERR WAIT cannot be used with slave instances");
+      return Status::OK();
+    }
+    seq_ = conn->GetLastWriteSeq();
+    int reached = svr->SlavesReachedSeq(seq_);
+    // the nested command can't park the connection, it replies at once like under EXEC of redis
+    if (reached >= num_replicas_ || nested_) {
+      *output = Redis::Integer(reached);
+      return Status::OK();
+    }
+    deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(replWaitTimeout(svr, timeout_ms_));
+    svr->IncrAckWaiters();
+    // the feeders send the new batches and receive the acks in a few milliseconds,
+    // so it's cheaper to poll than to notify the waiters for every batch
+    conn->Park(1);
+    return Status::OK();
+  }
+
+  bool OnParkTick(Server *svr, Connection *conn, std::string *output) override {
+    int reached = svr->SlavesReachedSeq(seq_);
+    if (reached < num_replicas_ && !svr->IsStopped() && std::chrono::steady_clock::now() < deadline_) return false;
+    svr->DecrAckWaiters();
+    *output = Redis::Integer(reached);
+    return true;
+  }
+
+  void OnParkCancel(Server *svr) override { svr->DecrAckWaiters(); }
+
+ private:
+  int num_replicas_ = 0;
+  int64_t timeout_ms_ = 0;
+  rocksdb::SequenceNumber seq_ = 0;
+  std::chrono::steady_clock::time_point deadline_;
+};
+
+// LASTSEQ returns the seq of the last write of the connection, 0 if nothing is written
+class CommandLastSeq : public Commander {
+ public:
+  CommandLastSeq() : Commander("lastseq", 1, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    *output = Redis::Integer(conn->GetLastWriteSeq());
+    return Status::OK();
+  }
+};
+
+// WAITSEQ blocks until the local seq has reached the seq or timeout, and returns the local
+// seq. The client reads its own writes from the slave with the LASTSEQ of the master:
+//   WAITSEQ <seq> <timeout>, and the reads after it are fresh if the returned seq >= seq,
+// or else the slave is lagging and the client should read from the master instead.
+class CommandWaitSeq : public Commander {
+ public:
+  CommandWaitSeq() : Commander("waitseq", 3, false) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    try {
+      seq_ = std::stoull(args[1]);
+      timeout_ms_ = std::stoll(args[2]);
+    } catch (const std::exception &e) {
+      return Status(Status::RedisParseErr, "value is not an integer or out of range");
+    }
+    if (timeout_ms_ < 0) return Status(Status::RedisParseErr, "timeout is negative");
+    return Commander::Parse(args);
+  }
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (svr->storage_->WALHasNewData(seq_) || nested_) {
+      *output = Redis::Integer(svr->storage_->LatestSeq());
+      return Status::OK();
+    }
+    // the connection is parked like WAIT
+    deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(replWaitTimeout(svr, timeout_ms_));
+    conn->Park(1);
+    return Status::OK();
+  }
+
+  bool OnParkTick(Server *svr, Connection *conn, std::string *output) override {
+    if (!svr->storage_->WALHasNewData(seq_) && !svr->IsStopped()
+        && std::chrono::steady_clock::now() < deadline_) return false;
+    *output = Redis::Integer(svr->storage_->LatestSeq());
+    return true;
+  }
+
+ private:
+  rocksdb::SequenceNumber seq_ = 0;
+  int64_t timeout_ms_ = 0;
+  std::chrono::steady_clock::time_point deadline_;
+};
+
 class CommandStats: public Commander {
  public:
   CommandStats() : Commander("stats", 1, false) {}
@@ -2821,15 +4082,18 @@ class CommandStats: public Commander {
 
 class CommandPSync : public Commander {
  public:
-  CommandPSync() : Commander("psync", 2, false) {}
+  CommandPSync() : Commander("psync", -2, false) {}
 
+  // PSYNC <next seq> [replication id], the id is "?" if the slave doesn't know its master yet
   Status Parse(const std::vector<std::string> &args) override {
+    if (args.size() > 3) return Status(Status::RedisParseErr, "wrong number of arguments");
     try {
       auto s = std::stoull(args[1]);
       next_repl_seq = static_cast<rocksdb::SequenceNumber>(s);
     } catch (const std::exception &e) {
       return Status(Status::RedisParseErr, "value is not an unsigned long long or out of range");
     }
+    if (args.size() == 3 && args[2] != "?") replid_ = args[2];
     return Commander::Parse(args);
   }
 
@@ -2837,29 +4101,47 @@ class CommandPSync : public Commander {
     LOG(INFO) << "Slave " << conn->GetAddr() << " asks for synchronization"
               << " with next sequence: " << next_repl_seq
               << ", and local sequence: " << svr->storage_->LatestSeq();
+    auto s = svr->storage_->CheckReplicationID(replid_, next_repl_seq);
+    if (!s.IsOK()) {
+      svr->stats_.IncrPSyncErrCounter();
+      LOG(INFO) << "Slave " << conn->GetAddr() << " was denied to psync with the replication id: " << replid_
+                << ", err: " << s.Msg();
+      *output = s.Msg() + ", please use fullsync";
+      return Status(Status::RedisExecErr, *output);
+    }
     if (!checkWALBoundary(svr->storage_, next_repl_seq).IsOK()) {
       svr->stats_.IncrPSyncErrCounter();
       *output = "sequence out of range, please use fullsync";
       return Status(Status::RedisExecErr, *output);
     }
+    // the slave adopts the replication id in the reply, the slave without its master yet
+    // never creates the id, or the sub slaves would take the id which is replaced later
+    std::string replid = svr->IsSlave() ? svr->storage_->GetReplicationID().id
+                                        : svr->storage_->EnsureReplicationID();
     svr->stats_.IncrPSyncOKCounter();
-    Status s = svr->AddSlave(conn, next_repl_seq);
+    s = svr->AddSlave(conn, next_repl_seq);
     if (!s.IsOK()) return s;
     LOG(INFO) << "New slave: "  << conn->GetAddr() << " was added, start increment syncing";
     conn->EnableFlag(Redis::Connection::kSlave);
     // server would spawn a new thread to sync the batch,
     // and connection would be took over, so should never trigger any event in worker thread
     conn->Detach();
-    write(conn->GetFD(), "+OK\r\n", 5);
+    std::string reply = replid.empty() ? "+OK\r\n" : "+OK " + replid + "\r\n";
+    write(conn->GetFD(), reply.data(), reply.size());
     return Status::OK();
   }
 
  private:
   rocksdb::SequenceNumber next_repl_seq = 0;
+  std::string replid_;
 
   // Return OK if the seq is in the range of the current WAL
   Status checkWALBoundary(Engine::Storage *storage,
                           rocksdb::SequenceNumber seq) {
+    // the data ingested from the sst files isn't in the WAL
+    if (seq <= storage->GetIngestedSeq()) {
+      return Status(Status::NotOK);
+    }
     if (seq == storage->LatestSeq() + 1) {
       return Status::OK();
     }
@@ -2919,6 +4201,259 @@ class CommandPerfLog : public Commander {
   int64_t cnt_ = 10;
 };
 
+// TRACE GET [count|*] | LEN | RESET fetches the traces of the sampled commands, the stages are the
+// microseconds since the pipeline of the command is read, and the spans are the time spent in them
+class CommandTrace : public Commander {
+ public:
+  CommandTrace() : Commander("trace", -2, false) {}
+
+  Status Parse(const std::vector<std::string> &args) override {
+    subcommand_ = Util::ToLower(args[1]);
+    if (subcommand_ != "reset" && subcommand_ != "get" && subcommand_ != "len") {
+      return Status(Status::NotOK, "TRACE subcommand must be one of RESET, LEN, GET");
+    }
+    if (subcommand_ == "get" && args.size() >= 3) {
+      if (args[2] == "*") {
+        cnt_ = 0;
+      } else {
+        return Util::StringToNum(args[2], &cnt_);
+      }
+    }
+    return Status::OK();
+  }
+
+  Status Execute(Server *srv, Connection *conn, std::string *output) override {
+    auto trace_log = srv->GetTraceLog();
+    if (subcommand_ == "len") {
+      *output = Redis::Integer(static_cast<int64_t>(trace_log->Size()));
+    } else if (subcommand_ == "reset") {
+      trace_log->Reset();
+      *output = Redis::SimpleString("OK");
+    } else if (subcommand_ == "get") {
+      *output = trace_log->GetLatestEntries(cnt_);
+    }
+    return Status::OK();
+  }
+
+ private:
+  std::string subcommand_;
+  int64_t cnt_ = 10;
+};
+
+class CommandProfile : public Commander {
+ public:
+  // the connection is parked for the duration, so neither the worker nor the slow
+  // commands executor is held by the profiling
+  CommandProfile() : Commander("profile", -3, false) {}
+
+  Status Parse(const std::vector<std::string> &args) override {
+    type_ = Util::ToLower(args[1]);
+    if (type_ != "cpu" && type_ != "heap") {
+      return Status(Status::RedisParseErr, "PROFILE type must be one of CPU, HEAP");
+    }
+    auto s = Util::StringToNum(args[2], &seconds_, 1, kMaxProfilingSeconds);
+    if (!s.IsOK()) return Status(Status::RedisParseErr, "seconds should be between 1 and 3600");
+    for (size_t i = 3; i < args.size(); i++) {
+      auto option = Util::ToLower(args[i]);
+      if (option == "file" && i + 1 < args.size()) {
+        path_ = args[++i];
+      } else if (option == "frequency" && type_ == "cpu" && i + 1 < args.size()) {
+        s = Util::StringToNum(args[++i], &frequency_, 1, 1000);
+        if (!s.IsOK()) return Status(Status::RedisParseErr, "frequency should be between 1 and 1000");
+      } else {
+        return Status(Status::RedisParseErr, "syntax error");
+      }
+    }
+    return Status::OK();
+  }
+
+  // PROFILE CPU|HEAP <seconds> [FILE path] [FREQUENCY hz] replies the profile, or the path of the
+  // file if it is written into the file
+  Status Execute(Server *srv, Connection *conn, std::string *output) override {
+    if (!conn->IsAdmin()) {
+      *output = Redis::Error("only administrator can use profile command");
+      return Status::OK();
+    }
+    auto s = type_ == "cpu" ? CpuProfiler::Start(static_cast<int>(frequency_)) : HeapProfiler::Start();
+    if (!s.IsOK()) {
+      *output = Redis::Error(s.Msg());
+      return Status::OK();
+    }
+    LOG(INFO) << "Start the " << type_ << " profiling for " << seconds_ << " seconds, addr: " << conn->GetAddr();
+    deadline_ = std::chrono::steady_clock::now() + std::chrono::seconds(seconds_);
+    conn->Park(100);
+    return Status::OK();
+  }
+
+  bool OnParkTick(Server *srv, Connection *conn, std::string *output) override {
+    if (!srv->IsStopped() && std::chrono::steady_clock::now() < deadline_) return false;
+    // the heap profile is always dumped into the file by the jemalloc
+    std::string path = path_;
+    if (path.empty() && type_ == "heap") path = srv->GetConfig()->dir + "/heap.prof." + std::to_string(getpid());
+    std::string profile;
+    Status s;
+    if (type_ == "cpu") {
+      s = CpuProfiler::Stop(&profile);
+      if (s.IsOK() && !path.empty()) s = writeFile(path, profile);
+    } else {
+      s = HeapProfiler::Stop(path);
+      if (s.IsOK() && path_.empty()) {
+        s = readFile(path, &profile);
+        remove(path.c_str());
+      }
+    }
+    if (!s.IsOK()) {
+      *output = Redis::Error(s.Msg());
+      return true;
+    }
+    *output = Redis::BulkString(path_.empty() ? profile : path_);
+    return true;
+  }
+
+  // the profiling of the freed connection is dropped
+  void OnParkCancel(Server *srv) override {
+    if (type_ == "cpu") {
+      std::string profile;
+      CpuProfiler::Stop(&profile);
+      return;
+    }
+    std::string path = srv->GetConfig()->dir + "/heap.prof." + std::to_string(getpid());
+    HeapProfiler::Stop(path);
+    remove(path.c_str());
+  }
+
+ private:
+  static const int64_t kMaxProfilingSeconds = 3600;
+  std::chrono::steady_clock::time_point deadline_;
+  std::string type_;
+  int64_t seconds_ = 0;
+  int64_t frequency_ = 100;
+  std::string path_;
+
+  static Status writeFile(const std::string &path, const std::string &data) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) return Status(Status::NotOK, "failed to open " + path + ", err: " + strerror(errno));
+    file.write(data.data(), data.size());
+    file.close();
+    if (!file) return Status(Status::NotOK, "failed to write " + path);
+    return Status::OK();
+  }
+
+  static Status readFile(const std::string &path, std::string *data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return Status(Status::NotOK, "failed to open " + path + ", err: " + strerror(errno));
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    *data = buffer.str();
+    return Status::OK();
+  }
+};
+
+class CommandHotKeys : public Commander {
+ public:
+  CommandHotKeys() : Commander("hotkeys", -2, false) {}
+
+  Status Parse(const std::vector<std::string> &args) override {
+    subcommand_ = Util::ToLower(args[1]);
+    if (subcommand_ != "reset" && subcommand_ != "get" && subcommand_ != "big") {
+      return Status(Status::NotOK, "HOTKEYS subcommand must be one of RESET, GET, BIG");
+    }
+    if (args.size() > 3 || (subcommand_ == "reset" && args.size() == 3)) {
+      return Status(Status::RedisParseErr, "wrong number of arguments");
+    }
+    if (args.size() == 3) {
+      int64_t count;
+      auto s = Util::StringToNum(args[2], &count, 1, kHotKeysMaxCount);
+      if (!s.IsOK()) return Status(Status::RedisParseErr, "count should be between 1 and 64");
+      count_ = static_cast<size_t>(count);
+    }
+    return Status::OK();
+  }
+
+  // GET replies the sampled hottest keys of the namespace with their sample counts, and BIG replies
+  // the largest keys collected by the last DBSIZE SCAN with their types and sizes
+  Status Execute(Server *srv, Connection *conn, std::string *output) override {
+    if (subcommand_ == "reset") {
+      srv->GetHotKeys()->Reset();
+      *output = Redis::SimpleString("OK");
+      return Status::OK();
+    }
+    std::vector<KeyCount> keys;
+    if (subcommand_ == "get") {
+      srv->GetHotKeys()->GetHotKeys(conn->GetNamespace(), count_, &keys);
+    } else {
+      srv->GetLatestBigKeys(conn->GetNamespace(), count_, &keys);
+    }
+    *output = Redis::MultiLen(keys.size());
+    for (const auto &key : keys) {
+      if (subcommand_ == "get") {
+        *output += Redis::MultiLen(2) + Redis::BulkString(key.key) + Redis::Integer(static_cast<int64_t>(key.count));
+      } else {
+        *output += Redis::MultiLen(3) + Redis::BulkString(key.key) + Redis::BulkString(RedisTypeNames[key.type])
+                   + Redis::Integer(static_cast<int64_t>(key.count));
+      }
+    }
+    return Status::OK();
+  }
+
+ private:
+  std::string subcommand_;
+  size_t count_ = 10;
+};
+
+class CommandPerfStats : public Commander {
+ public:
+  CommandPerfStats() : Commander("perfstats", -2, false) {}
+
+  Status Parse(const std::vector<std::string> &args) override {
+    subcommand_ = Util::ToLower(args[1]);
+    if (subcommand_ != "reset" && subcommand_ != "get") {
+      return Status(Status::NotOK, "PERFSTATS subcommand must be one of RESET, GET");
+    }
+    if (subcommand_ == "get") {
+      for (size_t i = 2; i < args.size(); i++) {
+        int id = GetCommandID(Util::ToLower(args[i]));
+        if (id >= 0) command_ids_.emplace_back(id);
+      }
+      if (args.size() == 2) {
+        for (size_t i = 0; i < GetCommandNum(); i++) command_ids_.emplace_back(static_cast<int>(i));
+      }
+    }
+    return Status::OK();
+  }
+
+  // reply the samples and the sum of each perf counter of the sampled commands
+  Status Execute(Server *srv, Connection *conn, std::string *output) override {
+    auto perf_stats = srv->GetPerfStats();
+    if (subcommand_ == "reset") {
+      perf_stats->Reset();
+      *output = Redis::SimpleString("OK");
+      return Status::OK();
+    }
+    uint64_t samples;
+    std::vector<uint64_t> counters;
+    std::string commands_stats;
+    int n = 0;
+    for (const auto id : command_ids_) {
+      if (!perf_stats->GetCommandStats(id, &samples, &counters)) continue;
+      commands_stats += Redis::BulkString(GetCommandName(id));
+      commands_stats += Redis::MultiLen((PerfStats::kNumCounters + 1) * 2);
+      commands_stats += Redis::BulkString("samples") + Redis::Integer(static_cast<int64_t>(samples));
+      for (int i = 0; i < PerfStats::kNumCounters; i++) {
+        commands_stats += Redis::BulkString(PerfStats::CounterName(i));
+        commands_stats += Redis::Integer(static_cast<int64_t>(counters[i]));
+      }
+      n++;
+    }
+    *output = Redis::MultiLen(n * 2) + commands_stats;
+    return Status::OK();
+  }
+
+ private:
+  std::string subcommand_;
+  std::vector<int> command_ids_;
+};
+
 class CommandSlowlog : public Commander {
  public:
   CommandSlowlog() : Commander("slowlog", -2, false) {}
@@ -2960,13 +4495,64 @@ class CommandSlowlog : public Commander {
   int64_t cnt_ = 10;
 };
 
+class CommandLatency : public Commander {
+ public:
+  CommandLatency() : Commander("latency", -2, false) {}
+
+  Status Parse(const std::vector<std::string> &args) override {
+    if (Util::ToLower(args[1]) != "histogram") {
+      return Status(Status::RedisParseErr, "LATENCY subcommand must be HISTOGRAM");
+    }
+    for (size_t i = 2; i < args.size(); i++) {
+      int id = GetCommandID(Util::ToLower(args[i]));
+      if (id >= 0) command_ids_.emplace_back(id);
+    }
+    if (args.size() == 2) {
+      for (size_t i = 0; i < GetCommandNum(); i++) command_ids_.emplace_back(static_cast<int>(i));
+    }
+    return Status::OK();
+  }
+
+  // reply the calls and the cumulative count of each non-empty bucket, which the
+  // bucket is represented by its max latency like redis
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    std::vector<uint64_t> buckets;
+    uint64_t max;
+    std::string histograms;
+    int n = 0;
+    for (const auto id : command_ids_) {
+      if (!svr->stats_.GetLatencyHistogram(id, &buckets, &max)) continue;
+      std::string histogram;
+      uint64_t calls = 0;
+      int n_buckets = 0;
+      for (size_t i = 0; i < buckets.size(); i++) {
+        if (buckets[i] == 0) continue;
+        calls += buckets[i];
+        histogram += Redis::Integer(static_cast<int64_t>(LatencyHistogram::BucketUpperBound(static_cast<int>(i))));
+        histogram += Redis::Integer(static_cast<int64_t>(calls));
+        n_buckets++;
+      }
+      histograms += Redis::BulkString(GetCommandName(id));
+      histograms += Redis::MultiLen(4);
+      histograms += Redis::BulkString("calls") + Redis::Integer(static_cast<int64_t>(calls));
+      histograms += Redis::BulkString("histogram_usec") + Redis::MultiLen(n_buckets * 2) + histogram;
+      n++;
+    }
+    *output = Redis::MultiLen(n * 2) + histograms;
+    return Status::OK();
+  }
+
+ private:
+  std::vector<int> command_ids_;
+};
+
 class CommandClient : public Commander {
  public:
   CommandClient() : Commander("client", -2, false) {}
 
   Status Parse(const std::vector<std::string> &args) override {
     subcommand_ = Util::ToLower(args[1]);
-    // subcommand: getname id kill list setname
+    // subcommand: getname id kill list setname tracking
     if ((subcommand_ == "id" || subcommand_ == "getname" ||  subcommand_ == "list") && args.size() == 2) {
       return Status::OK();
     }
@@ -3010,8 +4596,39 @@ class CommandClient : public Commander {
       }
       return Status::OK();
     }
+    // TRACKING ON|OFF [REDIRECT id] [BCAST] [PREFIX prefix...]
+    if (subcommand_ == "tracking" && args.size() >= 3) {
+      std::string mode = Util::ToLower(args[2]);
+      if (mode != "on" && mode != "off") return Status(Status::RedisParseErr, "syntax error");
+      tracking_on_ = mode == "on";
+      for (size_t i = 3; i < args.size(); i++) {
+        std::string opt = Util::ToLower(args[i]);
+        if (opt == "redirect" && i + 1 < args.size()) {
+          try {
+            id_ = std::stoull(args[++i]);
+          } catch (std::exception &e) {
+            return Status(Status::RedisParseErr, kValueNotInterger);
+          }
+        } else if (opt == "bcast") {
+          bcast_ = true;
+        } else if (opt == "prefix" && i + 1 < args.size()) {
+          prefixes_.emplace_back(args[++i]);
+        } else {
+          return Status(Status::RedisParseErr, "syntax error");
+        }
+      }
+      if (!prefixes_.empty() && !bcast_) {
+        return Status(Status::RedisParseErr, "PREFIX option requires BCAST mode to be enabled");
+      }
+      // the invalidation messages are only pushed to the other connection in the RESP2
+      if (tracking_on_ && id_ == 0) {
+        return Status(Status::RedisParseErr, "the REDIRECT option is required, and the redirect client"
+                                             " should subscribe the " + std::string(kTrackingChannel));
+      }
+      return Status::OK();
+    }
     return Status(Status::RedisInvalidCmd,
-                  "Syntax error, try CLIENT LIST|KILL ip:port|GETNAME|SETNAME");
+                  "Syntax error, try CLIENT LIST|KILL ip:port|GETNAME|SETNAME|TRACKING");
   }
 
   Status Execute(Server *srv, Connection *conn, std::string *output) override {
@@ -3041,10 +4658,24 @@ class CommandClient : public Commander {
           *output = Redis::SimpleString("OK");
       }
       return Status::OK();
+    } else if (subcommand_ == "tracking") {
+      if (!tracking_on_) {
+        conn->DisableTracking();
+        *output = Redis::SimpleString("OK");
+        return Status::OK();
+      }
+      TrackingRedirect redirect;
+      if (!srv->FindTrackingRedirect(id_, &redirect)) {
+        *output = Redis::Error("The client ID you want redirect to does not exist");
+        return Status::OK();
+      }
+      conn->EnableTracking(redirect, bcast_, prefixes_);
+      *output = Redis::SimpleString("OK");
+      return Status::OK();
     }
 
     return Status(Status::RedisInvalidCmd,
-                  "Syntax error, try CLIENT LIST|KILL ip:port|GETNAME|SETNAME");
+                  "Syntax error, try CLIENT LIST|KILL ip:port|GETNAME|SETNAME|TRACKING");
   }
 
  private:
@@ -3054,16 +4685,50 @@ class CommandClient : public Commander {
   bool skipme_ = false;
   uint64_t id_ = 0;
   bool new_format_ = true;
+  bool tracking_on_ = false;
+  bool bcast_ = false;
+  std::vector<std::string> prefixes_;
 };
 
+// MONITOR [SAMPLE ratio] [COMMANDS cmd1,cmd2...] [NAMESPACE ns]
 class CommandMonitor : public Commander {
  public:
-  CommandMonitor() : Commander("monitor", 1, false) {}
+  CommandMonitor() : Commander("monitor", -1, false) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    if (args.size() % 2 != 1) return Status(Status::RedisParseErr, "wrong number of arguments");
+    for (size_t i = 1; i < args.size(); i += 2) {
+      std::string opt = Util::ToLower(args[i]);
+      if (opt == "sample") {
+        int64_t ratio;
+        auto s = Util::StringToNum(args[i+1], &ratio, 1, 100);
+        if (!s.IsOK()) return Status(Status::RedisParseErr, "the sample ratio should between 1 and 100");
+        filter_.sample_ratio = static_cast<int>(ratio);
+      } else if (opt == "commands") {
+        std::vector<std::string> commands;
+        Util::Split(Util::ToLower(args[i+1]), ",", &commands);
+        filter_.commands.insert(commands.begin(), commands.end());
+      } else if (opt == "namespace") {
+        filter_.ns = args[i+1];
+      } else {
+        return Status(Status::RedisParseErr, "syntax error");
+      }
+    }
+    return Commander::Parse(args);
+  }
+
   Status Execute(Server *srv, Connection *conn, std::string *output) override {
+    if (!filter_.ns.empty() && !conn->IsAdmin()) {
+      *output = Redis::Error("only administrator can monitor the other namespaces");
+      return Status::OK();
+    }
+    conn->SetMonitorFilter(filter_);
     conn->Owner()->BecomeMonitorConn(conn);
     *output = Redis::SimpleString("OK");
     return Status::OK();
   }
+
+ private:
+  MonitorFilter filter_;
 };
 
 class CommandShutdown : public Commander {
@@ -3092,18 +4757,184 @@ class CommandQuit : public Commander {
   }
 };
 
+class CommandMulti : public Commander {
+ public:
+  CommandMulti() : Commander("multi", 1, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (conn->IsFlagEnabled(Redis::Connection::kMulti)) {
+      *output = Redis::Error("ERR MULTI calls can not be nested");
+      return Status::OK();
+    }
+    conn->StartMulti();
+    *output = Redis::SimpleString("OK");
+    return Status::OK();
+  }
+};
+
+class CommandDiscard : public Commander {
+ public:
+  CommandDiscard() : Commander("discard", 1, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (!conn->IsFlagEnabled(Redis::Connection::kMulti)) {
+      *output = Redis::Error("ERR DISCARD without MULTI");
+      return Status::OK();
+    }
+    conn->ResetMulti();
+    *output = Redis::SimpleString("OK");
+    return Status::OK();
+  }
+};
+
+class CommandWatch : public Commander {
+ public:
+  CommandWatch() : Commander("watch", -2, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (conn->IsFlagEnabled(Redis::Connection::kMulti)) {
+      *output = Redis::Error("ERR WATCH inside MULTI is not allowed");
+      return Status::OK();
+    }
+    Redis::Database redis(svr->storage_, conn->GetNamespace());
+    std::string ns_key;
+    for (size_t i = 1; i < args_.size(); i++) {
+      redis.AppendNamespacePrefix(args_[i], &ns_key);
+      conn->WatchKey(ns_key);
+    }
+    *output = Redis::SimpleString("OK");
+    return Status::OK();
+  }
+};
+
+class CommandUnWatch : public Commander {
+ public:
+  CommandUnWatch() : Commander("unwatch", 1, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    conn->UnWatchKeys();
+    *output = Redis::SimpleString("OK");
+    return Status::OK();
+  }
+};
+
+// EXEC executes the queued commands in a storage transaction, their writes are collected
+// into one batch and written at once, so the others see all or none of them. The commands
+// are executed one by one as redis does, the failed one wouldn't roll back the others.
+class CommandExec : public Commander {
+ public:
+  CommandExec() : Commander("exec", 1, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (!conn->IsFlagEnabled(Redis::Connection::kMulti)) {
+      *output = Redis::Error("ERR EXEC without MULTI");
+      return Status::OK();
+    }
+    auto commands = conn->TakeMultiCommands();
+    if (conn->IsMultiError()) {
+      conn->ResetMulti();
+      *output = Redis::Error("EXECABORT Transaction discarded because of previous errors.");
+      return Status::OK();
+    }
+    auto storage = svr->storage_;
+    storage->BeginTxn();
+    // the watched keys are locked before checking, so they can't be changed until committed
+    for (const auto &watched_key : conn->GetWatchedKeys()) {
+      storage->GetLockManager()->Lock(watched_key.first);
+    }
+    bool watched_keys_changed = conn->IsWatchedKeysChanged();
+    conn->ResetMulti();
+    if (watched_keys_changed) {
+      storage->DiscardTxn();
+      *output = Redis::MultiLen(-1);
+      return Status::OK();
+    }
+    std::string replies;
+    for (auto &args : commands) {
+      ExecuteNestedCommand(svr, conn, std::move(args), &replies);
+    }
+    auto s = storage->CommitTxn();
+    if (!s.ok()) {
+      *output = Redis::Error("EXECABORT Transaction wasn't committed: " + s.ToString());
+      return Status::OK();
+    }
+    conn->SetLastWriteSeq(storage->LatestSeq());
+    *output = Redis::MultiLen(static_cast<int64_t>(commands.size()));
+    output->append(replies);
+    return Status::OK();
+  }
+};
+
+// the script is executed in the lua state of the worker, the commands called by it
+// are written into one batch, so the script is atomic like the transaction
+class CommandEval : public Commander {
+ public:
+  CommandEval() : Commander("eval", -3, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    return Lua::EvalGenericCommand(svr, conn, args_, false, output);
+  }
+};
+
+class CommandEvalSHA : public Commander {
+ public:
+  CommandEvalSHA() : Commander("evalsha", -3, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (args_[1].size() != 40) {
+      *output = Redis::Error("NOSCRIPT No matching script. Please use EVAL.");
+      return Status::OK();
+    }
+    return Lua::EvalGenericCommand(svr, conn, args_, true, output);
+  }
+};
+
+class CommandScript : public Commander {
+ public:
+  CommandScript() : Commander("script", -2, false) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    subcommand_ = Util::ToLower(args[1]);
+    if ((subcommand_ == "load" && args.size() == 3)
+        || (subcommand_ == "flush" && args.size() == 2)
+        || (subcommand_ == "exists" && args.size() >= 3)) {
+      return Status::OK();
+    }
+    return Status(Status::RedisParseErr, "ERR Unknown SCRIPT subcommand or wrong # of args");
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (subcommand_ == "load") {
+      auto sha = Lua::Sha1Hex(args_[2]);
+      auto s = Lua::CreateFunction(conn->Owner()->Lua(), sha, args_[2]);
+      if (!s.IsOK()) {
+        *output = Redis::Error("ERR " + s.Msg());
+        return Status::OK();
+      }
+      svr->ScriptSet(sha, args_[2]);
+      *output = Redis::BulkString(sha);
+    } else if (subcommand_ == "exists") {
+      *output = Redis::MultiLen(args_.size() - 2);
+      for (size_t i = 2; i < args_.size(); i++) {
+        *output += Redis::Integer(svr->ScriptGet(Util::ToLower(args_[i]), nullptr) ? 1 : 0);
+      }
+    } else {
+      // the functions compiled in the lua states of the workers are kept, but
+      // they can't be called by EVALSHA since it looks up the cache first
+      svr->ScriptFlush();
+      *output = Redis::SimpleString("OK");
+    }
+    return Status::OK();
+  }
+
+ private:
+  std::string subcommand_;
+};
+
 class CommandScanBase : public Commander {
  public:
   explicit CommandScanBase(const std::string &name, int arity, bool is_write = false)
       : Commander(name, arity, is_write) {}
   Status ParseMatchAndCountParam(const std::string &type, const std::string &value) {
     if (type == "match") {
-      prefix = std::move(value);
-      if (!prefix.empty() && prefix[prefix.size() - 1] == '*') {
-        prefix = prefix.substr(0, prefix.size() - 1);
-        return Status::OK();
-      }
-      return Status(Status::RedisParseErr, "only keys prefix match was supported");
+      // the literal prefix of the glob is used to seek, and the whole pattern is
+      // only matched if it isn't like "prefix*"
+      bool match_all = false;
+      prefix = Util::GlobLiteralPrefix(value, &match_all);
+      pattern = match_all ? std::string() : value;
+      return Status::OK();
     } else if (type == "count") {
       try {
         limit = std::stoi(value);
@@ -3121,6 +4952,12 @@ class CommandScanBase : public Commander {
     }
   }
 
+  // IteratorToken identifies the scan of the connection, so its next page
+  // could reuse the live iterator left by the last page
+  std::string IteratorToken(Connection *conn) {
+    return std::to_string(conn->GetID()) + "|" + Name();
+  }
+
   std::string GenerateOutput(const std::vector<std::string> &keys) {
     std::vector<std::string> list;
     if (!keys.empty()) {
@@ -3137,6 +4974,7 @@ class CommandScanBase : public Commander {
  protected:
   std::string cursor;
   std::string prefix;
+  std::string pattern;
   int limit = 20;
 };
 
@@ -3162,6 +5000,9 @@ class CommandSubkeyScanBase : public CommandScanBase {
         return s;
       }
     }
+    if (!pattern.empty()) {
+      return Status(Status::RedisParseErr, "only keys prefix match was supported");
+    }
     return Commander::Parse(args);
   }
 
@@ -3178,14 +5019,18 @@ class CommandScan : public CommandScanBase {
     }
 
     ParseCursor(args[1]);
-    if (args.size() >= 4) {
-      Status s = ParseMatchAndCountParam(Util::ToLower(args[2]), args_[3]);
-      if (!s.IsOK()) {
-        return s;
+    for (size_t i = 2; i + 1 < args.size(); i += 2) {
+      auto opt = Util::ToLower(args[i]);
+      if (opt == "type") {
+        auto type_name = Util::ToLower(args[i + 1]);
+        auto iter = std::find(RedisTypeNames.begin(), RedisTypeNames.end(), type_name);
+        if (iter == RedisTypeNames.end() || iter == RedisTypeNames.begin()) {
+          return Status(Status::RedisParseErr, "unknown type name");
+        }
+        type_ = static_cast<RedisType>(iter - RedisTypeNames.begin());
+        continue;
       }
-    }
-    if (args.size() >= 6) {
-      Status s = ParseMatchAndCountParam(Util::ToLower(args[4]), args_[5]);
+      Status s = ParseMatchAndCountParam(opt, args_[i + 1]);
       if (!s.IsOK()) {
         return s;
       }
@@ -3195,61 +5040,461 @@ class CommandScan : public CommandScanBase {
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     Redis::Database redis_db(svr->storage_, conn->GetNamespace());
     std::vector<std::string> keys;
-    auto s = redis_db.Scan(cursor, limit, prefix, &keys);
+    std::string end_cursor;
+    Redis::KeyFilter filter;
+    filter.pattern = pattern;
+    filter.type = type_;
+    bool has_filter = !pattern.empty() || type_ != kRedisNone;
+    auto s = redis_db.Scan(cursor, limit, prefix, &keys, IteratorToken(conn),
+                           has_filter ? &filter : nullptr, &end_cursor);
+    if (!s.ok()) {
+      return Status(Status::RedisExecErr, s.ToString());
+    }
+
+    // the cursor is the last scanned key, since the filtered page may be short or empty
+    std::vector<std::string> list;
+    list.emplace_back(Redis::BulkString(end_cursor.empty() ? "0" : end_cursor));
+    list.emplace_back(Redis::MultiBulkString(keys));
+    *output = Redis::Array(list);
+    return Status::OK();
+  }
+
+ private:
+  RedisType type_ = kRedisNone;
+};
+
+class CommandHScan : public CommandSubkeyScanBase {
+ public:
+  CommandHScan() : CommandSubkeyScanBase("hscan", -3, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Hash hash_db(svr->storage_, conn->GetNamespace());
+    std::vector<std::string> fields;
+    auto s = hash_db.Scan(key, cursor, limit, prefix, &fields, IteratorToken(conn));
+    if (!s.ok() && !s.IsNotFound()) {
+      return Status(Status::RedisExecErr, s.ToString());
+    }
+    *output = GenerateOutput(fields);
+    return Status::OK();
+  }
+};
+
+class CommandSScan : public CommandSubkeyScanBase {
+ public:
+  CommandSScan() : CommandSubkeyScanBase("sscan", -3, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::Set set_db(svr->storage_, conn->GetNamespace());
+    std::vector<std::string> members;
+    auto s = set_db.Scan(key, cursor, limit, prefix, &members, IteratorToken(conn));
+    if (!s.ok()) {
+      return Status(Status::RedisExecErr, s.ToString());
+    }
+
+    *output = GenerateOutput(members);
+    return Status::OK();
+  }
+};
+
+class CommandZScan : public CommandSubkeyScanBase {
+ public:
+  CommandZScan() : CommandSubkeyScanBase("zscan", -3, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::ZSet zset_db(svr->storage_, conn->GetNamespace());
+    std::vector<std::string> members;
+    auto s = zset_db.Scan(key, cursor, limit, prefix, &members, IteratorToken(conn));
     if (!s.ok()) {
       return Status(Status::RedisExecErr, s.ToString());
     }
-
-    *output = GenerateOutput(keys);
+
+    *output = GenerateOutput(members);
+    return Status::OK();
+  }
+};
+
+static std::string geoDoubleString(double value, const char *format = "%.17g") {
+  char buf[64];
+  snprintf(buf, sizeof(buf), format, value);
+  return buf;
+}
+
+// CommandGeoBase parses the units, coordinates and search options shared by the geo commands,
+// and searches the points for GEORADIUS, GEORADIUSBYMEMBER, GEOSEARCH and GEOSEARCHSTORE
+class CommandGeoBase : public Commander {
+ public:
+  CommandGeoBase(std::string name, int arity, bool is_write) : Commander(std::move(name), arity, is_write) {}
+
+ protected:
+  std::string key_;
+  std::string from_member_;
+  GeoShape shape_;
+  bool with_coord_ = false;
+  bool with_dist_ = false;
+  bool with_hash_ = false;
+  uint64_t count_ = 0;
+  bool any_ = false;
+  DistanceSort sort_ = kSortNone;
+  std::string store_key_;
+  bool store_distance_ = false;
+
+  static Status parseDistanceUnit(const std::string &input, double *conversion) {
+    std::string unit = Util::ToLower(input);
+    if (unit == "m") {
+      *conversion = Redis::Geo::GetUnitConversion(kDistanceMeter);
+    } else if (unit == "km") {
+      *conversion = Redis::Geo::GetUnitConversion(kDistanceKilometers);
+    } else if (unit == "mi") {
+      *conversion = Redis::Geo::GetUnitConversion(kDistanceMiles);
+    } else if (unit == "ft") {
+      *conversion = Redis::Geo::GetUnitConversion(kDistanceFeet);
+    } else {
+      return Status(Status::RedisParseErr, "unsupported unit provided. please use m, km, ft, mi");
+    }
+    return Status::OK();
+  }
+
+  static Status parseDouble(const std::string &input, double *value) {
+    try {
+      size_t idx = 0;
+      *value = std::stod(input, &idx);
+      if (idx != input.size() || std::isnan(*value)) throw std::invalid_argument(input);
+    } catch (std::exception &e) {
+      return Status(Status::RedisParseErr, "value is not a valid float");
+    }
+    return Status::OK();
+  }
+
+  static Status parseLongLat(const std::string &lon_input, const std::string &lat_input,
+                             double *longitude, double *latitude) {
+    auto s = parseDouble(lon_input, longitude);
+    if (!s.IsOK()) return s;
+    s = parseDouble(lat_input, latitude);
+    if (!s.IsOK()) return s;
+    if (*longitude < GEO_LONG_MIN || *longitude > GEO_LONG_MAX ||
+        *latitude < GEO_LAT_MIN || *latitude > GEO_LAT_MAX) {
+      return Status(Status::RedisParseErr, "invalid longitude,latitude pair " + lon_input + "," + lat_input);
+    }
+    return Status::OK();
+  }
+
+  static Status parseRadius(const std::string &input, double *radius) {
+    auto s = parseDouble(input, radius);
+    if (!s.IsOK()) return s;
+    if (*radius < 0) return Status(Status::RedisParseErr, "radius cannot be negative");
+    return Status::OK();
+  }
+
+  // parseOptions parses the options from the index, the STORE and STOREDIST are only allowed
+  // by GEORADIUS and GEORADIUSBYMEMBER
+  Status parseOptions(const std::vector<std::string> &args, size_t i, bool allow_store) {
+    for (; i < args.size(); i++) {
+      std::string opt = Util::ToLower(args[i]);
+      if (opt == "withcoord") {
+        with_coord_ = true;
+      } else if (opt == "withdist") {
+        with_dist_ = true;
+      } else if (opt == "withhash") {
+        with_hash_ = true;
+      } else if (opt == "asc") {
+        sort_ = kSortASC;
+      } else if (opt == "desc") {
+        sort_ = kSortDESC;
+      } else if (opt == "count" && i + 1 < args.size()) {
+        try {
+          int64_t count = std::stoll(args[++i]);
+          if (count <= 0) return Status(Status::RedisParseErr, "COUNT must be > 0");
+          count_ = static_cast<uint64_t>(count);
+        } catch (std::exception &e) {
+          return Status(Status::RedisParseErr, kValueNotInterger);
+        }
+        if (i + 1 < args.size() && Util::ToLower(args[i + 1]) == "any") {
+          any_ = true;
+          i++;
+        }
+      } else if (allow_store && (opt == "store" || opt == "storedist") && i + 1 < args.size()) {
+        store_key_ = args[++i];
+        store_distance_ = opt == "storedist";
+      } else {
+        return Status(Status::RedisParseErr, "syntax error");
+      }
+    }
+    if (any_ && count_ == 0) return Status(Status::RedisParseErr, "the ANY argument requires COUNT argument");
+    if (!store_key_.empty() && (with_coord_ || with_dist_ || with_hash_)) {
+      return Status(Status::RedisParseErr, "STORE option in GEORADIUS is not compatible with WITHDIST, "
+                                           "WITHHASH and WITHCOORDS options");
+    }
+    return Status::OK();
+  }
+
+  Status search(Server *svr, Connection *conn, std::string *output) {
+    Redis::Geo geo_db(svr->storage_, conn->GetNamespace());
+    if (!from_member_.empty()) {
+      GeoPoint center;
+      auto s = geo_db.Get(key_, from_member_, &center);
+      if (s.IsNotFound()) return Status(Status::RedisExecErr, "could not decode requested zset member");
+      if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+      shape_.xy[0] = center.longitude;
+      shape_.xy[1] = center.latitude;
+    }
+    std::vector<GeoPoint> geo_points;
+    auto s = geo_db.Search(key_, shape_, count_, any_, sort_, store_key_, store_distance_, &geo_points);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    if (!store_key_.empty()) {
+      *output = Redis::Integer(geo_points.size());
+      return Status::OK();
+    }
+    *output = Redis::MultiLen(geo_points.size());
+    bool with_options = with_coord_ || with_dist_ || with_hash_;
+    for (const auto &geo_point : geo_points) {
+      if (!with_options) {
+        output->append(Redis::BulkString(geo_point.member));
+        continue;
+      }
+      output->append(Redis::MultiLen(1 + with_dist_ + with_hash_ + with_coord_));
+      output->append(Redis::BulkString(geo_point.member));
+      if (with_dist_) output->append(Redis::BulkString(geoDoubleString(geo_point.dist / shape_.conversion, "%.4f")));
+      if (with_hash_) output->append(Redis::Integer(static_cast<int64_t>(geo_point.score)));
+      if (with_coord_) {
+        output->append(Redis::MultiLen(2));
+        output->append(Redis::BulkString(geoDoubleString(geo_point.longitude)));
+        output->append(Redis::BulkString(geoDoubleString(geo_point.latitude)));
+      }
+    }
+    return Status::OK();
+  }
+};
+
+class CommandGeoAdd : public CommandGeoBase {
+ public:
+  CommandGeoAdd() : CommandGeoBase("geoadd", -5, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    size_t i = 2;
+    for (; i < args.size(); i++) {
+      std::string opt = Util::ToLower(args[i]);
+      if (opt == "nx") {
+        flags_ |= ZSET_NX;
+      } else if (opt == "xx") {
+        flags_ |= ZSET_XX;
+      } else {
+        break;
+      }
+    }
+    if ((flags_ & ZSET_NX) && (flags_ & ZSET_XX)) {
+      return Status(Status::RedisParseErr, "XX and NX options at the same time are not compatible");
+    }
+    if (i >= args.size() || (args.size() - i) % 3 != 0) {
+      return Status(Status::RedisParseErr, "syntax error");
+    }
+    for (; i < args.size(); i += 3) {
+      GeoPoint geo_point;
+      auto s = parseLongLat(args[i], args[i + 1], &geo_point.longitude, &geo_point.latitude);
+      if (!s.IsOK()) return s;
+      geo_point.member = args[i + 2];
+      geo_points_.emplace_back(std::move(geo_point));
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    int ret = 0;
+    Redis::Geo geo_db(svr->storage_, conn->GetNamespace());
+    auto s = geo_db.Add(args_[1], &geo_points_, flags_, &ret);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::Integer(ret);
+    return Status::OK();
+  }
+
+ private:
+  uint8_t flags_ = 0;
+  std::vector<GeoPoint> geo_points_;
+};
+
+class CommandGeoDist : public CommandGeoBase {
+ public:
+  CommandGeoDist() : CommandGeoBase("geodist", -4, false) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    if (args.size() > 5) return Status(Status::RedisParseErr, "syntax error");
+    if (args.size() == 5) {
+      auto s = parseDistanceUnit(args[4], &conversion_);
+      if (!s.IsOK()) return s;
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    double distance = 0;
+    Redis::Geo geo_db(svr->storage_, conn->GetNamespace());
+    auto s = geo_db.Dist(args_[1], args_[2], args_[3], &distance);
+    if (!s.ok() && !s.IsNotFound()) return Status(Status::RedisExecErr, s.ToString());
+    if (s.IsNotFound()) {
+      *output = Redis::NilString();
+    } else {
+      *output = Redis::BulkString(geoDoubleString(distance / conversion_, "%.4f"));
+    }
     return Status::OK();
   }
+
+ private:
+  double conversion_ = 1;
 };
 
-class CommandHScan : public CommandSubkeyScanBase {
+class CommandGeoHash : public Commander {
  public:
-  CommandHScan() : CommandSubkeyScanBase("hscan", -3, false) {}
+  CommandGeoHash() : Commander("geohash", -2, false) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    Redis::Hash hash_db(svr->storage_, conn->GetNamespace());
-    std::vector<std::string> fields;
-    auto s = hash_db.Scan(key, cursor, limit, prefix, &fields);
-    if (!s.ok() && !s.IsNotFound()) {
-      return Status(Status::RedisExecErr, s.ToString());
-    }
-    *output = GenerateOutput(fields);
+    std::vector<Slice> members;
+    for (size_t i = 2; i < args_.size(); i++) members.emplace_back(args_[i]);
+    std::vector<std::string> geo_hashes;
+    Redis::Geo geo_db(svr->storage_, conn->GetNamespace());
+    auto s = geo_db.Hash(args_[1], members, &geo_hashes);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::MultiBulkString(geo_hashes);
     return Status::OK();
   }
 };
 
-class CommandSScan : public CommandSubkeyScanBase {
+class CommandGeoPos : public Commander {
  public:
-  CommandSScan() : CommandSubkeyScanBase("sscan", -3, false) {}
+  CommandGeoPos() : Commander("geopos", -2, false) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    Redis::Set set_db(svr->storage_, conn->GetNamespace());
-    std::vector<std::string> members;
-    auto s = set_db.Scan(key, cursor, limit, prefix, &members);
-    if (!s.ok()) {
-      return Status(Status::RedisExecErr, s.ToString());
+    std::vector<Slice> members;
+    for (size_t i = 2; i < args_.size(); i++) members.emplace_back(args_[i]);
+    std::map<std::string, GeoPoint> geo_points;
+    Redis::Geo geo_db(svr->storage_, conn->GetNamespace());
+    auto s = geo_db.Pos(args_[1], members, &geo_points);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::MultiLen(members.size());
+    for (const auto &member : members) {
+      auto iter = geo_points.find(member.ToString());
+      if (iter == geo_points.end()) {
+        output->append(Redis::MultiLen(-1));
+        continue;
+      }
+      output->append(Redis::MultiLen(2));
+      output->append(Redis::BulkString(geoDoubleString(iter->second.longitude)));
+      output->append(Redis::BulkString(geoDoubleString(iter->second.latitude)));
     }
-
-    *output = GenerateOutput(members);
     return Status::OK();
   }
 };
 
-class CommandZScan : public CommandSubkeyScanBase {
+class CommandGeoRadius : public CommandGeoBase {
  public:
-  CommandZScan() : CommandSubkeyScanBase("zscan", -3, false) {}
+  explicit CommandGeoRadius(bool read_only = false)
+      : CommandGeoBase("georadius", -6, !read_only), read_only_(read_only) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    key_ = args[1];
+    auto s = parseLongLat(args[2], args[3], &shape_.xy[0], &shape_.xy[1]);
+    if (!s.IsOK()) return s;
+    s = parseRadius(args[4], &shape_.radius);
+    if (!s.IsOK()) return s;
+    s = parseDistanceUnit(args[5], &shape_.conversion);
+    if (!s.IsOK()) return s;
+    s = parseOptions(args, 6, !read_only_);
+    if (!s.IsOK()) return s;
+    return Commander::Parse(args);
+  }
+
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
-    Redis::ZSet zset_db(svr->storage_, conn->GetNamespace());
-    std::vector<std::string> members;
-    auto s = zset_db.Scan(key, cursor, limit, prefix, &members);
-    if (!s.ok()) {
-      return Status(Status::RedisExecErr, s.ToString());
+    return search(svr, conn, output);
+  }
+
+ private:
+  bool read_only_;
+};
+
+class CommandGeoRadiusReadOnly : public CommandGeoRadius {
+ public:
+  CommandGeoRadiusReadOnly() : CommandGeoRadius(true) { name_ = "georadius_ro"; }
+};
+
+class CommandGeoRadiusByMember : public CommandGeoBase {
+ public:
+  explicit CommandGeoRadiusByMember(bool read_only = false)
+      : CommandGeoBase("georadiusbymember", -5, !read_only), read_only_(read_only) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    key_ = args[1];
+    from_member_ = args[2];
+    auto s = parseRadius(args[3], &shape_.radius);
+    if (!s.IsOK()) return s;
+    s = parseDistanceUnit(args[4], &shape_.conversion);
+    if (!s.IsOK()) return s;
+    s = parseOptions(args, 5, !read_only_);
+    if (!s.IsOK()) return s;
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    return search(svr, conn, output);
+  }
+
+ private:
+  bool read_only_;
+};
+
+class CommandGeoRadiusByMemberReadOnly : public CommandGeoRadiusByMember {
+ public:
+  CommandGeoRadiusByMemberReadOnly() : CommandGeoRadiusByMember(true) { name_ = "georadiusbymember_ro"; }
+};
+
+class CommandGeoSearch : public CommandGeoBase {
+ public:
+  explicit CommandGeoSearch(bool store = false)
+      : CommandGeoBase("geosearch", store ? -8 : -7, store), store_(store) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    size_t i = 1;
+    if (store_) store_key_ = args[i++];
+    key_ = args[i++];
+    bool has_from = false, has_by = false;
+    std::vector<std::string> options;
+    for (; i < args.size(); i++) {
+      std::string opt = Util::ToLower(args[i]);
+      Status s;
+      if (opt == "frommember" && i + 1 < args.size() && !has_from) {
+        from_member_ = args[++i];
+        has_from = true;
+      } else if (opt == "fromlonlat" && i + 2 < args.size() && !has_from) {
+        s = parseLongLat(args[i + 1], args[i + 2], &shape_.xy[0], &shape_.xy[1]);
+        i += 2;
+        has_from = true;
+      } else if (opt == "byradius" && i + 2 < args.size() && !has_by) {
+        shape_.type = kGeoShapeTypeCircular;
+        s = parseRadius(args[i + 1], &shape_.radius);
+        if (s.IsOK()) s = parseDistanceUnit(args[i + 2], &shape_.conversion);
+        i += 2;
+        has_by = true;
+      } else if (opt == "bybox" && i + 3 < args.size() && !has_by) {
+        shape_.type = kGeoShapeTypeRectangle;
+        s = parseRadius(args[i + 1], &shape_.width);
+        if (s.IsOK()) s = parseRadius(args[i + 2], &shape_.height);
+        if (s.IsOK()) s = parseDistanceUnit(args[i + 3], &shape_.conversion);
+        i += 3;
+        has_by = true;
+      } else if (store_ && opt == "storedist") {
+        store_distance_ = true;
+      } else {
+        options.emplace_back(args[i]);
+        if (opt == "count" && i + 1 < args.size()) options.emplace_back(args[++i]);
+      }
+      if (!s.IsOK()) return s;
     }
+    if (!has_from) return Status(Status::RedisParseErr, "exactly one of FROMMEMBER or FROMLONLAT can be specified");
+    if (!has_by) return Status(Status::RedisParseErr, "exactly one of BYRADIUS and BYBOX can be specified");
+    // the store key is taken from the arguments already, so it isn't allowed in the options
+    auto s = parseOptions(options, 0, false);
+    if (!s.IsOK()) return s;
+    return Commander::Parse(args);
+  }
 
-    *output = GenerateOutput(members);
-    return Status::OK();
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    return search(svr, conn, output);
   }
+
+ private:
+  bool store_;
+};
+
+class CommandGeoSearchStore : public CommandGeoSearch {
+ public:
+  CommandGeoSearchStore() : CommandGeoSearch(true) { name_ = "geosearchstore"; }
 };
 
 class CommandRandomKey : public Commander {
@@ -3257,10 +5502,11 @@ class CommandRandomKey : public Commander {
   CommandRandomKey() : Commander("randomkey", 1, false) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     std::string key;
-    auto cursor = svr->GetLastRandomKeyCursor();
     Redis::Database redis(svr->storage_, conn->GetNamespace());
-    redis.RandomKey(cursor, &key);
-    svr->SetLastRandomKeyCursor(key);
+    auto s = redis.RandomKey(&key);
+    if (!s.ok()) {
+      return Status(Status::RedisExecErr, s.ToString());
+    }
     *output = Redis::BulkString(key);
     return Status::OK();
   }
@@ -3300,6 +5546,9 @@ class CommandReplConf : public Commander {
       } catch (const std::exception &e) {
         return Status(Status::RedisParseErr, "listening-port should be number");
       }
+    } else if (option == "capa") {
+      // the slave with the capa ack reports its applied seq by REPLCONF ACK
+      if (Util::ToLower(value) == "ack") ack_ = true;
     } else {
       return Status(Status::RedisParseErr, "unknown option");
     }
@@ -3310,12 +5559,14 @@ class CommandReplConf : public Commander {
     if (port_ != 0) {
       conn->SetListeningPort(port_);
     }
+    if (ack_) conn->EnableFlag(Connection::kReplAck);
     *output = Redis::SimpleString("OK");
     return Status::OK();
   }
 
  private:
   uint32_t port_ = 0;
+  bool ack_ = false;
 };
 
 class CommandFetchMeta : public Commander {
@@ -3347,6 +5598,36 @@ class CommandFetchMeta : public Commander {
   }
 };
 
+class CommandFetchCheckpoint : public Commander {
+ public:
+  CommandFetchCheckpoint() : Commander("_fetch_checkpoint", 1, false) {}
+
+  Status Parse(const std::vector<std::string> &args) override {
+    return Status::OK();
+  }
+
+  // the reply is the same as the _fetch_meta, the checkpoint id and the meta size,
+  // followed by the meta content in the format of `<filename> <crc32c>\n` per file
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    std::string checkpoint_id;
+    std::vector<std::pair<std::string, uint32_t>> files;
+    auto s = svr->storage_->CreateCheckpoint(&checkpoint_id, &files);
+    if (!s.IsOK()) {
+      LOG(ERROR) << "Failed to create checkpoint, err: " << s.Msg();
+      return Status(Status::DBBackupFileErr, "can't create db checkpoint");
+    }
+    std::string meta;
+    for (const auto &f : files) {
+      meta.append(f.first + " " + std::to_string(f.second) + "\n");
+    }
+    conn->Reply(checkpoint_id + CRLF);
+    conn->Reply(std::to_string(meta.size()) + CRLF);
+    conn->Reply(meta);
+    svr->stats_.IncrFullSyncCounter();
+    return Status::OK();
+  }
+};
+
 class CommandFetchFile : public Commander {
  public:
   CommandFetchFile() : Commander("_fetch_file", 2, false) {}
@@ -3370,6 +5651,43 @@ class CommandFetchFile : public Commander {
   std::string path_;
 };
 
+class CommandFetchFileChunk : public Commander {
+ public:
+  CommandFetchFileChunk() : Commander("_fetch_file_chunk", 4, false) {}
+
+  Status Parse(const std::vector<std::string> &args) override {
+    path_ = args[1];
+    try {
+      offset_ = std::stoull(args[2]);
+      len_ = std::stoull(args[3]);
+    } catch (std::exception &e) {
+      return Status(Status::RedisParseErr, kValueNotInterger);
+    }
+    if (len_ == 0 || len_ > kMaxChunkSize) {
+      return Status(Status::RedisParseErr, "chunk size should be in range (0, 64MiB]");
+    }
+    return Status::OK();
+  }
+
+  // the reply is `<size> <crc32c>\r\n` followed by the raw data of the chunk,
+  // the size less than the wanted length means the end of the file
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    std::string data;
+    auto s = Engine::Storage::BackupManager::ReadDataFileChunk(svr->storage_, path_, offset_, len_, &data);
+    if (!s.IsOK()) return Status(Status::DBBackupFileErr, s.Msg());
+    uint32_t crc = rocksdb::crc32c::Value(data.data(), data.size());
+    conn->Reply(std::to_string(data.size()) + " " + std::to_string(crc) + CRLF);
+    conn->Reply(data);
+    return Status::OK();
+  }
+
+ private:
+  static const uint64_t kMaxChunkSize = 64 * 1024 * 1024;
+  std::string path_;
+  uint64_t offset_ = 0;
+  uint64_t len_ = 0;
+};
+
 class CommandDBName : public Commander {
  public:
   CommandDBName() : Commander("_db_name", 1, false) {}
@@ -3385,7 +5703,9 @@ class CommandDBName : public Commander {
 };
 
 using CommanderFactory = std::function<std::unique_ptr<Commander>()>;
-std::map<std::string, CommanderFactory> command_table = {
+// The command tables are resolved once at startup and never modified,
+// so it's safe to lookup concurrently from the workers.
+std::unordered_map<std::string, CommanderFactory> command_table = {
     {"auth",
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandAuth);
@@ -3402,6 +5722,10 @@ std::map<std::string, CommanderFactory> command_table = {
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandInfo);
      }},
+    {"cluster",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandCluster);
+     }},
     {"config",
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandConfig);
@@ -3434,6 +5758,26 @@ std::map<std::string, CommanderFactory> command_table = {
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandPerfLog);
      }},
+    {"trace",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandTrace);
+     }},
+    {"profile",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandProfile);
+     }},
+    {"hotkeys",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandHotKeys);
+     }},
+    {"perfstats",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandPerfStats);
+     }},
+    {"latency",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandLatency);
+     }},
     {"client",
      []()->std::unique_ptr<Commander> {
         return std::unique_ptr<Commander>(new CommandClient);
@@ -3450,6 +5794,38 @@ std::map<std::string, CommanderFactory> command_table = {
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandQuit);
      }},
+    {"multi",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandMulti);
+     }},
+    {"exec",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandExec);
+     }},
+    {"discard",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandDiscard);
+     }},
+    {"watch",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandWatch);
+     }},
+    {"unwatch",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandUnWatch);
+     }},
+    {"eval",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandEval);
+     }},
+    {"evalsha",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandEvalSHA);
+     }},
+    {"script",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandScript);
+     }},
     {"scan",
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandScan);
@@ -3475,6 +5851,18 @@ std::map<std::string, CommanderFactory> command_table = {
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandObject);
      }},
+    {"dump",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandDump);
+     }},
+    {"restore",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandRestore);
+     }},
+    {"migrate",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandMigrate);
+     }},
     {"exists",
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandExists);
@@ -3577,6 +5965,14 @@ std::map<std::string, CommanderFactory> command_table = {
       []() -> std::unique_ptr<Commander> {
         return std::unique_ptr<Commander>(new CommandSetBit);
      }},
+    {"msetbit",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandMSetBit);
+     }},
+    {"setbitrange",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandSetBitRange);
+     }},
     {"bitcount",
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandBitCount);
@@ -3585,6 +5981,72 @@ std::map<std::string, CommanderFactory> command_table = {
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandBitPos);
      }},
+    {"bitop",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandBitOp);
+     }},
+    {"bitfield",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandBitField);
+     }},
+    // hyperloglog command
+    {"pfadd",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandPfAdd);
+     }},
+    {"pfcount",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandPfCount);
+     }},
+    {"pfmerge",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandPfMerge);
+     }},
+    // stream command
+    {"xadd",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandXAdd);
+     }},
+    {"xlen",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandXLen);
+     }},
+    {"xrange",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandXRange);
+     }},
+    {"xrevrange",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandXRevRange);
+     }},
+    {"xdel",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandXDel);
+     }},
+    {"xtrim",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandXTrim);
+     }},
+    {"xread",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandXRead);
+     }},
+    {"xreadgroup",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandXReadGroup);
+     }},
+    {"xgroup",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandXGroup);
+     }},
+    {"xack",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandXAck);
+     }},
+    {"xpending",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandXPending);
+     }},
     // hash command
     {"hget",
      []() -> std::unique_ptr<Commander> {
@@ -3732,6 +6194,10 @@ std::map<std::string, CommanderFactory> command_table = {
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandSIsMember);
      }},
+    {"smismember",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandSMIsMember);
+     }},
     {"spop",
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandSPop);
@@ -3772,6 +6238,47 @@ std::map<std::string, CommanderFactory> command_table = {
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandSScan);
      }},
+    // geo command
+    {"geoadd",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandGeoAdd);
+     }},
+    {"geodist",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandGeoDist);
+     }},
+    {"geohash",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandGeoHash);
+     }},
+    {"geopos",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandGeoPos);
+     }},
+    {"georadius",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandGeoRadius);
+     }},
+    {"georadius_ro",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandGeoRadiusReadOnly);
+     }},
+    {"georadiusbymember",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandGeoRadiusByMember);
+     }},
+    {"georadiusbymember_ro",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandGeoRadiusByMemberReadOnly);
+     }},
+    {"geosearch",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandGeoSearch);
+     }},
+    {"geosearchstore",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandGeoSearchStore);
+     }},
     // zset command
     {"zadd",
      []() -> std::unique_ptr<Commander> {
@@ -3907,6 +6414,10 @@ std::map<std::string, CommanderFactory> command_table = {
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandSortedintRevRange);
      }},
+    {"siexists",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandSortedintExists);
+     }},
 
     // internal management cmd
     {"compact",
@@ -3917,6 +6428,10 @@ std::map<std::string, CommanderFactory> command_table = {
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandBGSave);
      }},
+    {"ingest",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandIngest);
+     }},
     {"slaveof",
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandSlaveOf);
@@ -3925,11 +6440,23 @@ std::map<std::string, CommanderFactory> command_table = {
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandStats);
      }},
+    {"wait",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandWait);
+     }},
+    {"lastseq",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandLastSeq);
+     }},
+    {"waitseq",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandWaitSeq);
+     }},
 };
 
 // Replication related commands, which are received by workers listening on
 // `repl-port`
-std::map<std::string, CommanderFactory> repl_command_table = {
+std::unordered_map<std::string, CommanderFactory> repl_command_table = {
     {"auth",
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandAuth);
@@ -3946,32 +6473,233 @@ std::map<std::string, CommanderFactory> repl_command_table = {
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandFetchMeta);
      }},
+    {"_fetch_checkpoint",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandFetchCheckpoint);
+     }},
     {"_fetch_file",
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandFetchFile);
      }},
+    {"_fetch_file_chunk",
+     []() -> std::unique_ptr<Commander> {
+       return std::unique_ptr<Commander>(new CommandFetchFileChunk);
+     }},
     {"_db_name",
      []() -> std::unique_ptr<Commander> {
        return std::unique_ptr<Commander>(new CommandDBName);
      }},
 };
 
+struct CommandEntry {
+  const CommanderFactory *factory;
+  int id;
+};
+
+static std::vector<std::string> buildCommandNames() {
+  std::set<std::string> names;
+  for (const auto &cmd : command_table) names.insert(cmd.first);
+  for (const auto &cmd : repl_command_table) names.insert(cmd.first);
+  return std::vector<std::string>(names.begin(), names.end());
+}
+
+static std::unordered_map<std::string, CommandEntry> buildCommandEntries(
+    const std::unordered_map<std::string, CommanderFactory> &table, const std::vector<std::string> &names) {
+  std::unordered_map<std::string, CommandEntry> entries;
+  for (const auto &cmd : table) {
+    auto id = std::lower_bound(names.begin(), names.end(), cmd.first) - names.begin();
+    entries[cmd.first] = CommandEntry{&cmd.second, static_cast<int>(id)};
+  }
+  return entries;
+}
+
+// the names are sorted, and the id of the command is its index
+static std::vector<std::string> command_names = buildCommandNames();
+static std::unordered_map<std::string, CommandEntry> command_entries =
+    buildCommandEntries(command_table, command_names);
+static std::unordered_map<std::string, CommandEntry> repl_command_entries =
+    buildCommandEntries(repl_command_table, command_names);
+
+bool IsNestedCommandAllowed(const std::string &name) {
+  // the range deletions can't be read back in the transaction as well
+  static const std::vector<std::string> disallowed = {
+      "blpop", "brpop", "subscribe", "unsubscribe", "psubscribe", "punsubscribe", "monitor",
+      "flushdb", "flushall", "slaveof", "shutdown", "replconf", "psync", "wait", "waitseq", "ingest",
+      "migrate", "profile"};
+  return std::find(disallowed.begin(), disallowed.end(), name) == disallowed.end();
+}
+
+int GetFirstKeyIndex(int id) {
+  // the keyless commands and the ones whose keys are found by the options, like XREAD, aren't listed
+  static const std::vector<std::pair<std::string, int>> first_keys = {
+      {"ttl", 1}, {"pttl", 1}, {"type", 1}, {"object", 2}, {"dump", 1}, {"restore", 1}, {"exists", 1},
+      {"persist", 1}, {"expire", 1}, {"pexpire", 1}, {"expireat", 1}, {"pexpireat", 1}, {"del", 1}, {"get", 1},
+      {"strlen", 1}, {"getset", 1}, {"getrange", 1}, {"setrange", 1}, {"mget", 1}, {"append", 1}, {"set", 1},
+      {"setex", 1}, {"setnx", 1}, {"mset", 1}, {"incrby", 1}, {"incrbyfloat", 1}, {"incr", 1}, {"decrby", 1},
+      {"decr", 1}, {"getbit", 1}, {"msetbit", 1}, {"setbitrange", 1}, {"bitcount", 1}, {"bitpos", 1},
+      {"bitop", 2}, {"bitfield", 1}, {"pfadd", 1}, {"pfcount", 1}, {"pfmerge", 1}, {"xadd", 1}, {"xlen", 1},
+      {"xrange", 1}, {"xrevrange", 1}, {"xdel", 1}, {"xtrim", 1}, {"xgroup", 2}, {"xack", 1}, {"xpending", 1},
+      {"hget", 1}, {"hincrby", 1}, {"hincrbyfloat", 1}, {"hset", 1}, {"hsetnx", 1}, {"hdel", 1}, {"hstrlen", 1},
+      {"hexists", 1}, {"hlen", 1}, {"hmget", 1}, {"hmset", 1}, {"hkeys", 1}, {"hvals", 1}, {"hgetall", 1},
+      {"hscan", 1}, {"lpush", 1}, {"rpush", 1}, {"lpushx", 1}, {"rpushx", 1}, {"lpop", 1}, {"rpop", 1},
+      {"blpop", 1}, {"brpop", 1}, {"lrem", 1}, {"linsert", 1}, {"lrange", 1}, {"lindex", 1}, {"ltrim", 1},
+      {"llen", 1}, {"lset", 1}, {"rpoplpush", 1}, {"sadd", 1}, {"srem", 1}, {"scard", 1}, {"smembers", 1},
+      {"sismember", 1}, {"smismember", 1}, {"spop", 1}, {"srandmember", 1}, {"smove", 1}, {"sdiff", 1},
+      {"sunion", 1}, {"sinter", 1}, {"sdiffstore", 1}, {"sunionstore", 1}, {"sinterstore", 1}, {"sscan", 1},
+      {"geoadd", 1}, {"geodist", 1}, {"geohash", 1}, {"geopos", 1}, {"georadius", 1}, {"georadius_ro", 1},
+      {"georadiusbymember", 1}, {"georadiusbymember_ro", 1}, {"geosearch", 1}, {"geosearchstore", 1},
+      {"zadd", 1}, {"zcard", 1}, {"zcount", 1}, {"zincrby", 1}, {"zinterstore", 1}, {"zlexcount", 1},
+      {"zpopmax", 1}, {"zpopmin", 1}, {"zrange", 1}, {"zrevrange", 1}, {"zrangebylex", 1}, {"zrangebyscore", 1},
+      {"zrank", 1}, {"zrem", 1}, {"zremrangebyrank", 1}, {"zremrangebyscore", 1}, {"zremrangebylex", 1},
+      {"zrevrangebyscore", 1}, {"zrevrank", 1}, {"zscore", 1}, {"zscan", 1}, {"zunionstore", 1}, {"siadd", 1},
+      {"sirem", 1}, {"sicard", 1}, {"sirange", 1}, {"sirevrange", 1}, {"siexists", 1}};
+  static const std::vector<int> first_key_indexes = []() {
+    std::vector<int> first_key_indexes(GetCommandNum(), 0);
+    for (const auto &first_key : first_keys) {
+      int key_id = GetCommandID(first_key.first);
+      if (key_id >= 0) first_key_indexes[key_id] = first_key.second;
+    }
+    return first_key_indexes;
+  }();
+  return id >= 0 && id < static_cast<int>(first_key_indexes.size()) ? first_key_indexes[id] : 0;
+}
+
+bool IsPureReadCommand(int id) {
+  static const std::vector<std::string> pure_reads = {
+      "get", "mget", "strlen", "getrange", "getbit", "bitcount", "bitpos", "hget", "hmget", "hlen", "hexists",
+      "hstrlen", "sismember", "smismember", "scard", "lindex", "llen", "lrange", "zscore", "zcard", "zcount",
+      "zrank", "zrevrank", "zrange", "zrevrange", "zrangebyscore", "zrevrangebyscore", "zrangebylex", "zlexcount",
+      "exists", "type", "ttl", "pttl", "geopos", "geodist", "geohash", "pfcount", "sirange", "sicard", "siexists",
+      "xlen", "xrange"};
+  static const std::vector<bool> pure_read_commands = []() {
+    std::vector<bool> pure_read_commands(GetCommandNum(), false);
+    for (const auto &name : pure_reads) {
+      int pure_read_id = GetCommandID(name);
+      if (pure_read_id >= 0) pure_read_commands[pure_read_id] = true;
+    }
+    return pure_read_commands;
+  }();
+  return id >= 0 && id < static_cast<int>(pure_read_commands.size()) && pure_read_commands[id];
+}
+
+// ReadKeySpec is the positions of the keys in the arguments of the read-only command,
+// the last is counted from the end if it's negative, like the key specs of the redis
+struct ReadKeySpec {
+  int first;
+  int last;
+  int step;
+};
+
+bool GetReadKeys(int id, const std::vector<std::string> &args, std::vector<std::string> *keys) {
+  static const std::vector<std::pair<std::string, ReadKeySpec>> read_key_specs = {
+      {"get", {1, 1, 1}}, {"strlen", {1, 1, 1}}, {"getrange", {1, 1, 1}}, {"getbit", {1, 1, 1}},
+      {"bitcount", {1, 1, 1}}, {"bitpos", {1, 1, 1}}, {"mget", {1, -1, 1}}, {"exists", {1, -1, 1}},
+      {"type", {1, 1, 1}}, {"ttl", {1, 1, 1}}, {"pttl", {1, 1, 1}}, {"dump", {1, 1, 1}}, {"object", {2, 2, 1}},
+      {"hget", {1, 1, 1}}, {"hmget", {1, 1, 1}}, {"hlen", {1, 1, 1}}, {"hexists", {1, 1, 1}},
+      {"hstrlen", {1, 1, 1}}, {"hkeys", {1, 1, 1}}, {"hvals", {1, 1, 1}}, {"hgetall", {1, 1, 1}},
+      {"hscan", {1, 1, 1}}, {"lindex", {1, 1, 1}}, {"llen", {1, 1, 1}}, {"lrange", {1, 1, 1}},
+      {"sismember", {1, 1, 1}}, {"smismember", {1, 1, 1}}, {"scard", {1, 1, 1}}, {"smembers", {1, 1, 1}},
+      {"srandmember", {1, 1, 1}}, {"sscan", {1, 1, 1}}, {"sdiff", {1, -1, 1}}, {"sunion", {1, -1, 1}},
+      {"sinter", {1, -1, 1}}, {"zscore", {1, 1, 1}}, {"zcard", {1, 1, 1}}, {"zcount", {1, 1, 1}},
+      {"zrank", {1, 1, 1}}, {"zrevrank", {1, 1, 1}}, {"zrange", {1, 1, 1}}, {"zrevrange", {1, 1, 1}},
+      {"zrangebyscore", {1, 1, 1}}, {"zrevrangebyscore", {1, 1, 1}}, {"zrangebylex", {1, 1, 1}},
+      {"zlexcount", {1, 1, 1}}, {"zscan", {1, 1, 1}}, {"geopos", {1, 1, 1}}, {"geodist", {1, 1, 1}},
+      {"geohash", {1, 1, 1}}, {"georadius_ro", {1, 1, 1}}, {"georadiusbymember_ro", {1, 1, 1}},
+      {"geosearch", {1, 1, 1}}, {"pfcount", {1, -1, 1}}, {"sirange", {1, 1, 1}}, {"sirevrange", {1, 1, 1}},
+      {"sicard", {1, 1, 1}}, {"siexists", {1, 1, 1}}, {"xlen", {1, 1, 1}}, {"xrange", {1, 1, 1}},
+      {"xrevrange", {1, 1, 1}}};
+  static const std::vector<ReadKeySpec> specs = []() {
+    std::vector<ReadKeySpec> specs(GetCommandNum(), ReadKeySpec{0, 0, 0});
+    for (const auto &spec : read_key_specs) {
+      int read_id = GetCommandID(spec.first);
+      if (read_id >= 0) specs[read_id] = spec.second;
+    }
+    return specs;
+  }();
+  static const int xread_id = GetCommandID("xread");
+  int n_args = static_cast<int>(args.size());
+  if (id == xread_id) {
+    // the half of the arguments after the STREAMS are the keys
+    for (int i = 1; i < n_args; i++) {
+      if (Util::ToLower(args[i]) != "streams") continue;
+      int n_keys = (n_args - i - 1) / 2;
+      if (n_keys == 0) return false;
+      keys->assign(args.begin() + i + 1, args.begin() + i + 1 + n_keys);
+      return true;
+    }
+    return false;
+  }
+  if (id < 0 || id >= static_cast<int>(specs.size()) || specs[id].step == 0) return false;
+  const auto &spec = specs[id];
+  int last = spec.last < 0 ? n_args + spec.last : spec.last;
+  if (spec.first >= n_args || last >= n_args || last < spec.first) return false;
+  keys->clear();
+  for (int i = spec.first; i <= last; i += spec.step) keys->emplace_back(args[i]);
+  return true;
+}
+
+void ExecuteNestedCommand(Server *svr, Connection *conn, std::vector<std::string> &&args, std::string *output) {
+  std::unique_ptr<Commander> cmd;
+  auto s = LookupCommand(args.front(), &cmd, conn->IsRepl());
+  if (!s.IsOK()) {
+    output->append(Redis::Error("ERR unknown command"));
+    return;
+  }
+  int arity = cmd->GetArity();
+  int n_args = static_cast<int>(args.size());
+  if ((arity > 0 && n_args != arity) || (arity < 0 && n_args < -arity)) {
+    output->append(Redis::Error("ERR wrong number of arguments"));
+    return;
+  }
+  if (!IsNestedCommandAllowed(cmd->Name())) {
+    output->append(Redis::Error("ERR command " + cmd->Name() + " is not allowed here"));
+    return;
+  }
+  if (cmd->IsWrite() && svr->storage_->IsWriteStopped()) {
+    output->append(Redis::Error("BUSY the writes were stopped by the storage engine, retry later"));
+    return;
+  }
+  if (svr->GetConfig()->slave_readonly && svr->IsSlave() && cmd->IsWrite()) {
+    output->append(Redis::Error("READONLY You can't write against a read only slave."));
+    return;
+  }
+  cmd->SetArgs(std::move(args));
+  s = cmd->Parse(*cmd->Args());
+  if (!s.IsOK()) {
+    output->append(Redis::Error(s.Msg()));
+    return;
+  }
+  svr->stats_.IncrCalls(cmd->GetID());
+  std::vector<std::string> read_keys;
+  if (conn->IsTracking() && GetReadKeys(cmd->GetID(), *cmd->Args(), &read_keys)) conn->TrackReadKeys(read_keys);
+  cmd->SetNested();
+  std::string reply;
+  s = cmd->Execute(svr, conn, &reply);
+  if (!s.IsOK()) {
+    output->append(Redis::Error("ERR " + s.Msg()));
+    return;
+  }
+  output->append(reply);
+}
+
 Status LookupCommand(const std::string &cmd_name,
                      std::unique_ptr<Commander> *cmd, bool is_repl) {
   if (cmd_name.empty()) return Status(Status::RedisUnknownCmd);
-  if (is_repl) {
-    auto cmd_factory = repl_command_table.find(Util::ToLower(cmd_name));
-    if (cmd_factory == repl_command_table.end()) {
-      return Status(Status::RedisUnknownCmd);
-    }
-    *cmd = cmd_factory->second();
-  } else {
-    auto cmd_factory = command_table.find(Util::ToLower(cmd_name));
-    if (cmd_factory == command_table.end()) {
-      return Status(Status::RedisUnknownCmd);
-    }
-    *cmd = cmd_factory->second();
-  }
+  // lowercase the name only if necessary, most clients send the command
+  // name in lowercase, and the lookup can use the token itself.
+  bool need_lower = std::any_of(cmd_name.begin(), cmd_name.end(),
+                                [](char c) { return c >= 'A' && c <= 'Z'; });
+  std::string lower_name;
+  if (need_lower) lower_name = Util::ToLower(cmd_name);
+  const std::string &name = need_lower ? lower_name : cmd_name;
+
+  auto &entries = is_repl ? repl_command_entries : command_entries;
+  auto entry = entries.find(name);
+  if (entry == entries.end()) {
+    return Status(Status::RedisUnknownCmd);
+  }
+  *cmd = (*entry->second.factory)();
+  (*cmd)->SetID(entry->second.id);
   return Status::OK();
 }
 
@@ -3979,6 +6707,20 @@ bool IsCommandExists(const std::string &cmd) {
   return command_table.find(cmd) != command_table.end();
 }
 
+size_t GetCommandNum() {
+  return command_names.size();
+}
+
+const std::string &GetCommandName(int id) {
+  return command_names[id];
+}
+
+int GetCommandID(const std::string &name) {
+  auto iter = std::lower_bound(command_names.begin(), command_names.end(), name);
+  if (iter == command_names.end() || *iter != name) return -1;
+  return static_cast<int>(iter - command_names.begin());
+}
+
 void GetCommandList(std::vector<std::string> *cmds) {
   cmds->clear();
   for (const auto &cmd : command_table) {
@@ -27,13 +27,22 @@ class Commander {
  public:
   // @name: cmd name
   // @sidecar: whether cmd will be executed in sidecar thread, eg. psync.
-  explicit Commander(std::string name, int arity, bool is_write = false)
-      : name_(std::move(name)), arity_(arity), is_write_(is_write) {}
-  std::string Name() { return name_; }
+  // @is_slow: whether cmd may take long on the big keys or the whole db, the slow
+  // commands are executed in the command executors instead of the worker
+  explicit Commander(std::string name, int arity, bool is_write = false, bool is_slow = false)
+      : name_(std::move(name)), arity_(arity), is_write_(is_write), is_slow_(is_slow) {}
+  const std::string &Name() { return name_; }
   int GetArity() { return arity_; }
   bool IsWrite() { return is_write_; }
+  bool IsSlow() { return is_slow_; }
+  // the nested command is executed in place by the transaction or script, so it never blocks
+  void SetNested() { nested_ = true; }
+  // the id is assigned by the command table, and used to index the command stats
+  int GetID() { return id_; }
+  void SetID(int id) { id_ = id; }
 
   void SetArgs(const std::vector<std::string> &args) { args_ = args; }
+  void SetArgs(std::vector<std::string> &&args) { args_ = std::move(args); }
   const std::vector<std::string>* Args() {
     return &args_;
   }
@@ -43,6 +52,24 @@ class Commander {
   virtual Status Execute(Server *svr, Connection *conn, std::string *output) {
     return Status(Status::RedisExecErr, "not implemented");
   }
+  // OnBlockingKeyReady is called after the connection blocked by the command is woken up,
+  // and returns false if the command should keep blocking
+  virtual bool OnBlockingKeyReady(Server *svr, Connection *conn) {
+    return true;
+  }
+  // OnParkTick is called in the worker thread every interval after the command parks the
+  // connection by Connection::Park, and returns false until the reply is set into the output
+  virtual bool OnParkTick(Server *svr, Connection *conn, std::string *output) {
+    return true;
+  }
+  // OnParkCancel is called if the parked connection is freed before the command replies
+  virtual void OnParkCancel(Server *svr) {}
+  // the streaming reply is written in parts by ContinueReply in the worker thread after
+  // the command is executed, ContinueReply returns false after the last part is appended
+  bool IsStreamingReply() { return streaming_reply_; }
+  virtual bool ContinueReply(std::string *output) {
+    return false;
+  }
 
   virtual ~Commander() = default;
 
@@ -51,10 +78,35 @@ class Commander {
   std::string name_;
   int arity_;
   bool is_write_;
+  bool is_slow_;
+  int id_ = -1;
+  bool streaming_reply_ = false;
+  bool nested_ = false;
 };
 
 bool IsCommandExists(const std::string &cmd);
 void GetCommandList(std::vector<std::string> *cmds);
+// the command ids are in [0, GetCommandNum()), the commands with the same name
+// in the normal and replication tables share the same id
+size_t GetCommandNum();
+const std::string &GetCommandName(int id);
+// GetCommandID returns -1 if the command doesn't exist
+int GetCommandID(const std::string &name);
 Status LookupCommand(const std::string &cmd_name,
                      std::unique_ptr<Commander> *cmd, bool is_repl);
+// The commands which block the connection or reply by themselves can't be nested in
+// the transaction or script, since their replies are collected by the caller
+bool IsNestedCommandAllowed(const std::string &name);
+// GetFirstKeyIndex returns the index of the first key in the arguments of the command, or 0
+// if the command has no key at a fixed position, it's used to sample the accessed keys
+int GetFirstKeyIndex(int id);
+// IsPureReadCommand returns true if the command only reads the keys and replies by the output,
+// so it could be executed again after it is tried in the cache only reads of the storage
+bool IsPureReadCommand(int id);
+// GetReadKeys returns the keys read by the read-only key command, which are tracked by the client
+// tracking, or else returns false
+bool GetReadKeys(int id, const std::vector<std::string> &args, std::vector<std::string> *keys);
+// ExecuteNestedCommand executes the command of the transaction or script in place,
+// and appends its reply or error into the output
+void ExecuteNestedCommand(Server *svr, Connection *conn, std::vector<std::string> &&args, std::string *output);
 }  // namespace Redis
@@ -1,11 +1,25 @@
 #include "redis_connection.h"
 
 #include <glog/logging.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
 #include "worker.h"
 #include "server.h"
+#include "redis_metadata.h"
+#include "namespace_quota.h"
 
 namespace Redis {
 
+// the replies larger than this are added to the output by reference instead of copying
+const size_t kReplyByReferenceMinSize = 16 * 1024;
+// release the reply buffer after a huge batch instead of keeping the memory
+const size_t kReplyBufferMaxCapacity = 1024 * 1024;
+// the streaming reply stops writing above the high watermark of the output, and
+// continues after the client has read it below the low watermark
+const size_t kStreamingReplyHighWatermark = 4 * 1024 * 1024;
+const size_t kStreamingReplyLowWatermark = 1024 * 1024;
+
 Connection::Connection(bufferevent *bev, Worker *owner)
     : bev_(bev), req_(owner->svr_), owner_(owner) {
   time_t now;
@@ -15,10 +29,20 @@ Connection::Connection(bufferevent *bev, Worker *owner)
 }
 
 Connection::~Connection() {
+  if (defer_timer_) event_free(defer_timer_);
+  UnBlockKeys();
+  if (blocking_timer_) event_free(blocking_timer_);
+  if (parked_) current_cmd_->OnParkCancel(owner_->svr_);
+  if (park_timer_) event_free(park_timer_);
+  DisableTracking();
   if (bev_) { bufferevent_free(bev_); }
   // unscribe all channels and patterns if exists
   UnSubscribeAll();
   PUnSubscribeAll();
+  UnWatchKeys();
+  stopWaitingAcks();
+  // drop the scan iterators left by the connection
+  owner_->svr_->storage_->GetScanIteratorCache()->ErasePrefix(std::to_string(id_) + "|");
 }
 
 std::string Connection::ToString() {
@@ -43,6 +67,7 @@ void Connection::Close() {
 }
 
 void Connection::Detach() {
+  flushReplies();
   owner_->DetachConnection(this);
 }
 
@@ -57,11 +82,84 @@ void Connection::OnRead(struct bufferevent *bev, void *ctx) {
     conn->Reply(Redis::Error(s.Msg()));
     return;
   }
-  conn->req_.ExecuteCommands(conn);
+  conn->executeCommands();
+}
+
+void Connection::executeCommands() {
+  // the pending commands would be executed after the blocking command is served,
+  // the parked one replies or the streaming reply is finished
+  if (IsBlocked() || IsParked() || IsStreamingReply()) return;
+  if (IsWaitingAcks() && !checkAcks()) return;
+  batching_replies_ = true;
+  req_.ExecuteCommands(this);
+  batching_replies_ = false;
+  // the replies are kept in the buffer til the writes are acked
+  if (IsWaitingAcks() && !checkAcks()) return;
+  flushReplies();
+}
+
+void Connection::flushReplies() {
+  if (reply_buf_.empty()) {
+    if (!traces_.empty()) finishTraces(0, 0);
+    return;
+  }
+  size_t written = 0;
+  if (!IsFlagEnabled(kCloseAsap)) {
+    written = writeRepliesEagerly();
+    if (written < reply_buf_.size()) {
+      evbuffer_add(bufferevent_get_output(bev_), reply_buf_.data() + written, reply_buf_.size() - written);
+    }
+  }
+  if (!traces_.empty()) finishTraces(reply_buf_.size(), written);
+  if (reply_buf_.capacity() > kReplyBufferMaxCapacity) {
+    std::string().swap(reply_buf_);
+  } else {
+    reply_buf_.clear();
+  }
+}
+
+// the replies are written to the socket at once if nothing is pending in the output, which
+// saves the syscalls to watch the socket writable and the round of the event loop to wait for
+// it, the rest of them is left to the bufferevent if the socket buffer is full. The replies
+// which need the write callback or the rate limit are always written by the bufferevent.
+size_t Connection::writeRepliesEagerly() {
+  if (IsFlagEnabled(kCloseAfterReply) || IsStreamingReply() || owner_->IsRateLimited()) return 0;
+  if (evbuffer_get_length(Output()) > 0) return 0;
+  ssize_t n = write(GetFD(), reply_buf_.data(), reply_buf_.size());
+  // the error is left to the bufferevent, which reports it by the event callback
+  return n > 0 ? static_cast<size_t>(n) : 0;
+}
+
+void Connection::finishTraces(size_t flushed, size_t eager_written) {
+  // the replies by reference were added to the output directly, and flushed as well
+  flushed += referenced_reply_bytes_;
+  referenced_reply_bytes_ = 0;
+  auto trace_log = owner_->svr_->GetTraceLog();
+  for (const auto &trace : traces_) {
+    trace->Mark(Trace::kFlushed);
+    auto entry = new TraceEntry();
+    entry->cmd_name = trace->cmd_name;
+    entry->duration = trace->stages[Trace::kFlushed];
+    for (int i = 0; i < Trace::kNumStages; i++) {
+      entry->fields.emplace_back(Trace::StageName(i), trace->stages[i]);
+    }
+    for (int i = 0; i < Trace::kNumSpans; i++) {
+      entry->fields.emplace_back(Trace::SpanName(i), trace->spans[i]);
+    }
+    entry->fields.emplace_back("reply_bytes", trace->reply_bytes);
+    entry->fields.emplace_back("flushed_bytes", flushed);
+    entry->fields.emplace_back("eager_written_bytes", eager_written);
+    trace_log->PushEntry(entry);
+  }
+  traces_.clear();
 }
 
 void Connection::OnWrite(struct bufferevent *bev, void *ctx) {
   auto conn = static_cast<Connection *>(ctx);
+  if (conn->IsStreamingReply()) {
+    if (conn->writeStreamingReply()) conn->executeCommands();
+    return;
+  }
   if (conn->IsFlagEnabled(kCloseAfterReply)) {
     conn->Close();
   }
@@ -89,16 +187,262 @@ void Connection::OnEvent(bufferevent *bev, int16_t events, void *ctx) {
 }
 
 void Connection::Reply(const std::string &msg) {
+  if (IsFlagEnabled(kCloseAsap)) return;
+  owner_->svr_->stats_.IncrOutbondBytes(msg.size());
+  if (quota_) quota_->IncrOutBytes(msg.size());
+  // the monitor connections are fed out of the command execution, so never buffer their replies
+  if (batching_replies_ && !IsFlagEnabled(kMonitor)) {
+    reply_buf_.append(msg);
+  } else {
+    Redis::Reply(bufferevent_get_output(bev_), msg);
+  }
+  checkOutputBufferLimit();
+}
+
+void Connection::Reply(std::string &&msg) {
+  if (msg.size() < kReplyByReferenceMinSize) {
+    Reply(static_cast<const std::string &>(msg));
+    return;
+  }
+  if (IsFlagEnabled(kCloseAsap)) return;
   owner_->svr_->stats_.IncrOutbondBytes(msg.size());
-  Redis::Reply(bufferevent_get_output(bev_), msg);
+  if (quota_) quota_->IncrOutBytes(msg.size());
+  // keep the order of the buffered replies
+  flushReplies();
+  auto data = new std::string(std::move(msg));
+  evbuffer_add_reference(bufferevent_get_output(bev_), data->data(), data->size(),
+                         [](const void *, size_t, void *arg) { delete static_cast<std::string *>(arg); },
+                         data);
+  referenced_reply_bytes_ += data->size();
+  checkOutputBufferLimit();
+}
+
+int Connection::clientClass() {
+  if (IsFlagEnabled(kMonitor)) return kClientClassMonitor;
+  if (!subscribe_channels_.empty() || !subcribe_patterns_.empty()) return kClientClassPubSub;
+  return kClientClassNormal;
+}
+
+void Connection::checkOutputBufferLimit() {
+  if (IsFlagEnabled(kSlave) || IsFlagEnabled(kCloseAsap)) return;
+  const auto &limit = owner_->svr_->GetConfig()->client_output_buffer_limits[clientClass()];
+  if (limit.hard_limit_mb == 0 && limit.soft_limit_mb == 0) return;
+
+  uint64_t size = evbuffer_get_length(Output()) + reply_buf_.size();
+  bool reached = false;
+  if (limit.hard_limit_mb > 0 && size >= limit.hard_limit_mb * MiB) {
+    reached = true;
+  } else if (limit.soft_limit_mb > 0 && size >= limit.soft_limit_mb * MiB) {
+    time_t now = time(nullptr);
+    if (soft_limit_reached_time_ == 0) soft_limit_reached_time_ = now;
+    reached = now - soft_limit_reached_time_ >= limit.soft_limit_seconds;
+  } else {
+    soft_limit_reached_time_ = 0;
+  }
+  if (!reached) return;
+
+  LOG(WARNING) << "[connection] Going to close the client: " << addr_ << ", id: " << id_
+               << ", while its output buffer: " << size << " bytes reached the limit";
+  // the connection is still used by the caller, so it's freed in the next round of the event loop
+  EnableFlag(kCloseAsap);
+  owner_->FreeConnectionAsync(GetFD(), id_);
+}
+
+void Connection::StreamReply() {
+  streaming_reply_ = true;
+  // the buffered replies go out before the first part
+  flushReplies();
+  writeStreamingReply();
+}
+
+bool Connection::writeStreamingReply() {
+  if (IsFlagEnabled(kCloseAsap)) return false;
+  auto output = Output();
+  std::string part;
+  while (evbuffer_get_length(output) < kStreamingReplyHighWatermark) {
+    part.clear();
+    bool more = current_cmd_->ContinueReply(&part);
+    owner_->svr_->stats_.IncrOutbondBytes(part.size());
+    if (quota_) quota_->IncrOutBytes(part.size());
+    Redis::Reply(output, part);
+    // the parts are limited like the other replies, so the huge key can't pin the slow reader
+    checkOutputBufferLimit();
+    if (IsFlagEnabled(kCloseAsap)) return false;
+    if (!more) {
+      streaming_reply_ = false;
+      bufferevent_setwatermark(bev_, EV_WRITE, 0, 0);
+      return true;
+    }
+  }
+  // the write callback is called after the output is drained below the low watermark
+  bufferevent_setwatermark(bev_, EV_WRITE, kStreamingReplyLowWatermark, 0);
+  return false;
 }
 
 void Connection::SendFile(int fd) {
+  flushReplies();
   // NOTE: we don't need to close the fd, the libevent will do that
   auto output = bufferevent_get_output(bev_);
   evbuffer_add_file(output, fd, 0, -1);
 }
 
+bool Connection::HoldWrites() {
+  auto now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+  if (hold_writes_since_ == 0) {
+    hold_writes_since_ = now;
+    owner_->svr_->stats_.IncrWriteStallHeldCounter();
+  }
+  if (now - hold_writes_since_ >= static_cast<uint64_t>(owner_->svr_->GetConfig()->write_stall_max_wait_ms)) {
+    hold_writes_since_ = 0;
+    owner_->svr_->stats_.IncrWriteStallRejectedCounter();
+    return false;
+  }
+  deferCommands(10000);
+  return true;
+}
+
+void Connection::SetLastWriteSeq(rocksdb::SequenceNumber seq) {
+  last_write_seq_ = seq;
+  auto svr = owner_->svr_;
+  if (svr->GetConfig()->repl_min_ack_slaves <= 0 || svr->IsSlave()) return;
+  if (ack_wait_seq_ == 0) {
+    ack_wait_since_ = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    svr->IncrAckWaiters();
+  }
+  ack_wait_seq_ = seq;
+}
+
+bool Connection::checkAcks() {
+  auto svr = owner_->svr_;
+  auto config = svr->GetConfig();
+  if (!svr->IsSeqAcked(ack_wait_seq_, config->repl_min_ack_slaves)) {
+    auto now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    if (now - ack_wait_since_ < static_cast<uint64_t>(config->repl_ack_timeout_ms)) {
+      deferCommands(1000);
+      return false;
+    }
+    // the replies are released on timeout as the asynchronous replication
+    svr->stats_.IncrReplAckTimeoutCounter();
+  }
+  stopWaitingAcks();
+  return true;
+}
+
+void Connection::stopWaitingAcks() {
+  if (ack_wait_seq_ == 0) return;
+  ack_wait_seq_ = 0;
+  owner_->svr_->DecrAckWaiters();
+}
+
+bool Connection::AcquireQuota() {
+  auto config = owner_->svr_->GetConfig();
+  if (!quota_) quota_ = owner_->svr_->GetNamespaceQuotas()->Get(ns_);
+  // the admin is never limited, but still counted
+  uint64_t max_qps = is_admin_ ? 0 : static_cast<uint64_t>(config->namespace_max_qps);
+  uint64_t max_out_bytes = is_admin_ ? 0 : static_cast<uint64_t>(config->namespace_max_net_out_mb) * MiB;
+  if (quota_->Acquire(max_qps, max_out_bytes, time(nullptr))) return true;
+  deferCommands(10000);
+  return false;
+}
+
+void Connection::deferCommands(int delay_us) {
+  if (!defer_timer_) {
+    defer_timer_ = evtimer_new(bufferevent_get_base(bev_), OnDeferTimeout, this);
+  }
+  // the commands are kept in the request, and the new ones would be read after the retry
+  bufferevent_disable(bev_, EV_READ);
+  timeval tm = {0, delay_us};
+  evtimer_add(defer_timer_, &tm);
+}
+
+void Connection::OnDeferTimeout(int, int16_t events, void *ctx) {
+  auto conn = static_cast<Connection *>(ctx);
+  bufferevent_enable(conn->bev_, EV_READ);
+  conn->executeCommands();
+}
+
+void Connection::Pause() {
+  executing_in_background_ = true;
+  bufferevent_disable(bev_, EV_READ);
+}
+
+void Connection::Resume() {
+  executing_in_background_ = false;
+  // the connection is closed while executing the command
+  if (IsFlagEnabled(kFreeAfterExecution)) {
+    Close();
+    return;
+  }
+  batching_replies_ = true;
+  req_.FinishBackgroundCommand(this);
+  batching_replies_ = false;
+  bufferevent_enable(bev_, EV_READ);
+  executeCommands();
+}
+
+void Connection::BlockOnKeys(const std::vector<std::string> &keys, int64_t timeout_ms) {
+  for (const auto &key : keys) {
+    std::string ns_key;
+    ComposeNamespaceKey(ns_, key, &ns_key);
+    if (std::find(blocking_keys_.begin(), blocking_keys_.end(), ns_key) != blocking_keys_.end()) continue;
+    owner_->svr_->AddBlockingKey(ns_key, this);
+    blocking_keys_.emplace_back(std::move(ns_key));
+  }
+  if (timeout_ms <= 0) return;
+  auto base = bufferevent_get_base(bev_);
+  if (!blocking_timer_) blocking_timer_ = evtimer_new(base, OnBlockingTimeout, this);
+  // the blocked connections mostly share a few timeouts, and the timers of the common
+  // timeout are queued in O(1) instead of the heap. it returns null after libevent
+  // runs out of the common timeouts, then the timer falls back to the heap.
+  timeval tm = {static_cast<time_t>(timeout_ms / 1000), static_cast<suseconds_t>(timeout_ms % 1000 * 1000)};
+  const timeval *common_tm = event_base_init_common_timeout(base, &tm);
+  evtimer_add(blocking_timer_, common_tm ? common_tm : &tm);
+}
+
+void Connection::UnBlockKeys() {
+  if (blocking_timer_) evtimer_del(blocking_timer_);
+  for (const auto &ns_key : blocking_keys_) {
+    owner_->svr_->UnBlockingKey(ns_key, this);
+  }
+  blocking_keys_.clear();
+}
+
+bool Connection::OnBlockingKeyReady() {
+  if (!current_cmd_->OnBlockingKeyReady(owner_->svr_, this)) return false;
+  UnBlockKeys();
+  executeCommands();
+  return true;
+}
+
+void Connection::OnBlockingTimeout(int, int16_t events, void *ctx) {
+  auto conn = static_cast<Connection *>(ctx);
+  conn->Reply(Redis::NilString());
+  conn->UnBlockKeys();
+  conn->executeCommands();
+}
+
+void Connection::Park(int interval_ms) {
+  if (!park_timer_) park_timer_ = evtimer_new(bufferevent_get_base(bev_), OnParkTimeout, this);
+  parked_ = true;
+  park_interval_ = {static_cast<time_t>(interval_ms / 1000), static_cast<suseconds_t>(interval_ms % 1000 * 1000)};
+  evtimer_add(park_timer_, &park_interval_);
+}
+
+void Connection::OnParkTimeout(int, int16_t events, void *ctx) {
+  auto conn = static_cast<Connection *>(ctx);
+  std::string reply;
+  if (!conn->current_cmd_->OnParkTick(conn->owner_->svr_, conn, &reply)) {
+    evtimer_add(conn->park_timer_, &conn->park_interval_);
+    return;
+  }
+  conn->parked_ = false;
+  conn->Reply(std::move(reply));
+  conn->executeCommands();
+}
+
 void Connection::SetAddr(std::string ip, int port) {
   ip_ = std::move(ip);
   port_ = port;
@@ -126,7 +470,10 @@ std::string Connection::GetFlags() {
   if (owner_->IsRepl()) flags.append("R");
   if (IsFlagEnabled(kSlave)) flags.append("S");
   if (IsFlagEnabled(kCloseAfterReply)) flags.append("c");
+  if (IsFlagEnabled(kCloseAsap)) flags.append("A");
   if (IsFlagEnabled(kMonitor)) flags.append("M");
+  if (IsFlagEnabled(kMulti)) flags.append("x");
+  if (IsFlagEnabled(kReplAck)) flags.append("a");
   if (!subscribe_channels_.empty()) flags.append("P");
   if (flags.empty()) flags = "N";
   return flags;
@@ -136,10 +483,57 @@ void Connection::EnableFlag(Flag flag) {
   flags_ |= flag;
 }
 
+void Connection::DisableFlag(Flag flag) {
+  flags_ &= ~flag;
+}
+
 bool Connection::IsFlagEnabled(Flag flag) {
   return (flags_ & flag) > 0;
 }
 
+void Connection::StartMulti() {
+  EnableFlag(kMulti);
+  multi_cmds_.clear();
+  multi_error_ = false;
+}
+
+void Connection::ResetMulti() {
+  DisableFlag(kMulti);
+  multi_cmds_.clear();
+  multi_error_ = false;
+  UnWatchKeys();
+}
+
+std::vector<std::vector<std::string>> Connection::TakeMultiCommands() {
+  std::vector<std::vector<std::string>> cmds;
+  cmds.swap(multi_cmds_);
+  return cmds;
+}
+
+void Connection::WatchKey(const std::string &ns_key) {
+  for (const auto &watched_key : watched_keys_) {
+    if (watched_key.first == ns_key) return;
+  }
+  auto storage = owner_->svr_->storage_;
+  // the watcher must be counted before taking the stamp, or the write in between may not stamp the key
+  if (watched_keys_.empty()) storage->IncrWatchers();
+  watched_keys_.emplace_back(ns_key, storage->GetKeyStamp(ns_key));
+}
+
+void Connection::UnWatchKeys() {
+  if (watched_keys_.empty()) return;
+  owner_->svr_->storage_->DecrWatchers();
+  watched_keys_.clear();
+}
+
+bool Connection::IsWatchedKeysChanged() {
+  auto storage = owner_->svr_->storage_;
+  for (const auto &watched_key : watched_keys_) {
+    if (storage->GetKeyStamp(watched_key.first) != watched_key.second) return true;
+  }
+  return false;
+}
+
 bool Connection::IsRepl() {
   return owner_->IsRepl();
 }
@@ -175,6 +569,52 @@ int Connection::SubscriptionsCount() {
   return static_cast<int>(subscribe_channels_.size());
 }
 
+bool Connection::IsSubscribed(const std::string &channel) {
+  for (const auto &chan : subscribe_channels_) {
+    if (chan == channel) return true;
+  }
+  return false;
+}
+
+void Connection::EnableTracking(const TrackingRedirect &redirect, bool bcast,
+                                const std::vector<std::string> &prefixes) {
+  DisableTracking();
+  tracking_ = true;
+  tracking_bcast_ = bcast;
+  tracking_redirect_ = redirect;
+  if (bcast) {
+    // all keys of the namespace are tracked without the prefixes
+    std::string ns_prefix;
+    for (const auto &prefix : prefixes.empty() ? std::vector<std::string>{""} : prefixes) {
+      ComposeNamespaceKey(ns_, prefix, &ns_prefix);
+      tracking_prefixes_.emplace_back(ns_prefix);
+    }
+    for (const auto &ns_prefix : tracking_prefixes_) owner_->TrackPrefix(ns_prefix, this);
+  }
+  owner_->IncrTrackingConns();
+  owner_->svr_->storage_->IncrKeyTrackers();
+}
+
+void Connection::DisableTracking() {
+  if (!tracking_) return;
+  for (const auto &ns_prefix : tracking_prefixes_) owner_->UntrackPrefix(ns_prefix, this);
+  tracking_prefixes_.clear();
+  tracking_ = false;
+  tracking_bcast_ = false;
+  tracking_redirect_ = TrackingRedirect();
+  owner_->DecrTrackingConns();
+  owner_->svr_->storage_->DecrKeyTrackers();
+}
+
+void Connection::TrackReadKeys(const std::vector<std::string> &keys) {
+  if (!tracking_ || tracking_bcast_) return;
+  std::string ns_key;
+  for (const auto &key : keys) {
+    ComposeNamespaceKey(ns_, key, &ns_key);
+    owner_->TrackKey(ns_key, this);
+  }
+}
+
 void Connection::PSubscribeChannel(const std::string &pattern) {
   for (const auto &p : subcribe_patterns_) {
     if (pattern == p) return;
@@ -184,10 +624,10 @@ void Connection::PSubscribeChannel(const std::string &pattern) {
 }
 
 void Connection::PUnSubscribeChannel(const std::string &pattern) {
-  auto iter = subscribe_channels_.begin();
-  for (; iter != subscribe_channels_.end(); iter++) {
+  auto iter = subcribe_patterns_.begin();
+  for (; iter != subcribe_patterns_.end(); iter++) {
     if (*iter == pattern) {
-      subscribe_channels_.erase(iter);
+      subcribe_patterns_.erase(iter);
       owner_->svr_->PUnSubscribeChannel(pattern, this);
       return;
     }
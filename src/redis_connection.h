@@ -1,23 +1,41 @@
 #pragma once
 
 #include <event2/buffer.h>
+#include <event2/event.h>
 #include <vector>
 #include <string>
 #include <utility>
 #include <memory>
 
+#include "monitor_feeder.h"
 #include "redis_cmd.h"
 #include "redis_request.h"
+#include "tracing.h"
 
 class Worker;
+class NamespaceQuota;
 
 namespace Redis {
+// the invalidation messages of the client tracking are published to the channel
+const char kTrackingChannel[] = "__redis__:invalidate";
+
+// TrackingRedirect is the connection which receives the invalidation messages
+struct TrackingRedirect {
+  Worker *worker = nullptr;
+  int fd = -1;
+  uint64_t id = 0;
+};
+
 class Connection {
  public:
   enum Flag {
     kSlave           = 1 << 4,
     kMonitor         = 1 << 5,
     kCloseAfterReply = 1 << 6,
+    kFreeAfterExecution = 1 << 7,
+    kCloseAsap       = 1 << 8,
+    kMulti           = 1 << 9,
+    kReplAck         = 1 << 10,
   };
 
   explicit Connection(bufferevent *bev, Worker *owner);
@@ -28,9 +46,52 @@ class Connection {
   static void OnRead(struct bufferevent *bev, void *ctx);
   static void OnWrite(struct bufferevent *bev, void *ctx);
   static void OnEvent(bufferevent *bev, int16_t events, void *ctx);
+  // the replies of the commands in the same read event are buffered and
+  // added to the output once, and the large ones are added by reference
   void Reply(const std::string &msg);
+  void Reply(std::string &&msg);
   void SendFile(int fd);
+  // HoldWrites stops reading from the connection and retries its pending commands
+  // a while later as the writes are stopped by the storage engine, so the worker
+  // keeps serving the others. It returns false if the connection has been held for
+  // longer than the write-stall-max-wait-ms, and the write should be rejected.
+  bool HoldWrites();
+  void ReleaseWrites() { hold_writes_since_ = 0; }
+  // AcquireQuota returns false if the namespace of the connection runs out of its budget
+  // of the second, and its pending commands are retried a while later
+  bool AcquireQuota();
+  // Yield gives the worker to the other connections, and executes the pending commands
+  // in the next round of the event loop
+  void Yield() { deferCommands(0); }
+  static void OnDeferTimeout(int, int16_t events, void *ctx);
+  // Pause stops reading from the connection while its command is executing
+  // in the command executor, and Resume replies the command and continues
+  // with the pending commands in the worker thread after it is finished
+  void Pause();
+  void Resume();
+  bool IsExecutingInBackground() { return executing_in_background_; }
+  // BlockOnKeys stops executing the pending commands until the current command is
+  // served by the pushed keys or timed out, and the timeout(millisecond) of 0 blocks forever
+  void BlockOnKeys(const std::vector<std::string> &keys, int64_t timeout_ms);
+  void UnBlockKeys();
+  bool IsBlocked() { return !blocking_keys_.empty(); }
+  // OnBlockingKeyReady retries the blocking command in the worker thread after its key is
+  // pushed, and returns false if the command keeps blocking
+  bool OnBlockingKeyReady();
+  static void OnBlockingTimeout(int, int16_t events, void *ctx);
+  // Park stops executing the pending commands while the current command waits without holding
+  // the worker, and its OnParkTick is polled every interval_ms until it replies
+  void Park(int interval_ms);
+  bool IsParked() { return parked_; }
+  static void OnParkTimeout(int, int16_t events, void *ctx);
+  // StreamReply writes the streaming reply of the current command until the output goes
+  // over the high watermark, and continues after the output is drained below the low
+  // watermark. The pending commands would be executed after the whole reply is written.
+  void StreamReply();
+  bool IsStreamingReply() { return streaming_reply_; }
   std::string ToString();
+  // AddTrace keeps the trace of the replied command til its reply is flushed
+  void AddTrace(std::unique_ptr<Trace> trace) { traces_.emplace_back(std::move(trace)); }
 
   void SubscribeChannel(const std::string &channel);
   void UnSubscribeChannel(const std::string &channel);
@@ -40,14 +101,52 @@ class Connection {
   void PUnSubscribeChannel(const std::string &pattern);
   void PUnSubscribeAll();
   int PSubscriptionsCount();
+  bool IsSubscribed(const std::string &channel);
+
+  // EnableTracking tracks the keys read by the connection, or the keys with the prefixes in the
+  // BCAST mode, and the invalidation messages of them are sent to the redirect connection after
+  // they are written. The tracked keys are forgotten once invalidated.
+  void EnableTracking(const TrackingRedirect &redirect, bool bcast, const std::vector<std::string> &prefixes);
+  void DisableTracking();
+  bool IsTracking() { return tracking_; }
+  const TrackingRedirect &GetTrackingRedirect() { return tracking_redirect_; }
+  // TrackReadKeys is called before the keys are read, so the writes in the meantime are
+  // never missed by the invalidation
+  void TrackReadKeys(const std::vector<std::string> &keys);
 
   uint64_t GetAge();
   uint64_t GetIdleTime();
   void SetLastInteraction();
   std::string GetFlags();
   void EnableFlag(Flag flag);
+  void DisableFlag(Flag flag);
   bool IsFlagEnabled(Flag flag);
   bool IsRepl();
+  void SetMonitorFilter(MonitorFilter filter) { monitor_filter_ = std::move(filter); }
+  const MonitorFilter &GetMonitorFilter() { return monitor_filter_; }
+  // The commands after MULTI are queued until EXEC or DISCARD, and the EXEC is
+  // aborted if any of them is rejected while queuing
+  void StartMulti();
+  void ResetMulti();
+  void QueueMultiCommand(const std::vector<std::string> &args) { multi_cmds_.emplace_back(args); }
+  std::vector<std::vector<std::string>> TakeMultiCommands();
+  void FlagMultiError() { if (IsFlagEnabled(kMulti)) multi_error_ = true; }
+  bool IsMultiError() { return multi_error_; }
+  // WatchKey takes the stamp of the key, the EXEC is aborted if any watched key
+  // is changed after that, and the keys are unwatched after EXEC or DISCARD
+  void WatchKey(const std::string &ns_key);
+  void UnWatchKeys();
+  bool IsWatchedKeysChanged();
+  const std::vector<std::pair<std::string, uint64_t>> &GetWatchedKeys() { return watched_keys_; }
+
+  // the seq of the last write is returned by LASTSEQ, and waited by WAIT, so the client
+  // could read its own writes from the slaves after they have reached the seq
+  rocksdb::SequenceNumber GetLastWriteSeq() { return last_write_seq_; }
+  // SetLastWriteSeq holds the replies til the write is acked by the repl-min-ack-slaves
+  // slaves or timeout, only the following writes are executed in the meantime, so the
+  // replies of the pipelined writes are held and released together
+  void SetLastWriteSeq(rocksdb::SequenceNumber seq);
+  bool IsWaitingAcks() { return ack_wait_seq_ != 0; }
 
   uint64_t GetID() { return id_; }
   void SetID(uint64_t id) { id_ = id; }
@@ -65,7 +164,10 @@ class Connection {
   void BecomeAdmin() { is_admin_ = true; }
   void BecomeUser() { is_admin_ = false; }
   std::string GetNamespace() { return ns_; }
-  void SetNamespace(std::string ns) { ns_ = std::move(ns); }
+  void SetNamespace(std::string ns) {
+    ns_ = std::move(ns);
+    quota_ = nullptr;
+  }
 
   Worker *Owner() { return owner_; }
   int GetFD() { return bufferevent_getfd(bev_); }
@@ -76,6 +178,22 @@ class Connection {
   std::unique_ptr<Commander> current_cmd_;
 
  private:
+  void executeCommands();
+  void flushReplies();
+  // writeRepliesEagerly returns the size of the replies written to the socket directly
+  size_t writeRepliesEagerly();
+  // finishTraces pushes the traces of the flushed replies into the trace log
+  void finishTraces(size_t flushed, size_t eager_written);
+  void deferCommands(int delay_us);
+  // checkOutputBufferLimit closes the connection asynchronously if its output buffer goes
+  // over the limits of its client class, the replies after that are dropped
+  void checkOutputBufferLimit();
+  int clientClass();
+  bool writeStreamingReply();
+  // checkAcks returns true if the held replies could be released, or else retries later
+  bool checkAcks();
+  void stopWaitingAcks();
+
   uint64_t id_ = 0;
   int flags_ = 0;
   std::string ns_;
@@ -88,10 +206,37 @@ class Connection {
   std::string last_cmd_;
   time_t create_time_;
   time_t last_interaction_;
+  uint64_t hold_writes_since_ = 0;  // unit is ms
+  event *defer_timer_ = nullptr;
+  NamespaceQuota *quota_ = nullptr;
+  bool executing_in_background_ = false;
+  std::vector<std::string> blocking_keys_;
+  event *blocking_timer_ = nullptr;
+  bool parked_ = false;
+  event *park_timer_ = nullptr;
+  timeval park_interval_ = {0, 0};
+  bool streaming_reply_ = false;
+  time_t soft_limit_reached_time_ = 0;
+  MonitorFilter monitor_filter_;
+  std::vector<std::vector<std::string>> multi_cmds_;
+  bool multi_error_ = false;
+  std::vector<std::pair<std::string, uint64_t>> watched_keys_;
+  rocksdb::SequenceNumber last_write_seq_ = 0;
+  rocksdb::SequenceNumber ack_wait_seq_ = 0;
+  uint64_t ack_wait_since_ = 0;  // unit is ms
+  bool tracking_ = false;
+  bool tracking_bcast_ = false;
+  TrackingRedirect tracking_redirect_;
+  std::vector<std::string> tracking_prefixes_;  // the prefixes with the namespace
 
   bufferevent *bev_;
   Request req_;
   Worker *owner_;
+  bool batching_replies_ = false;
+  std::string reply_buf_;
+  std::vector<std::unique_ptr<Trace>> traces_;
+  // the bytes of the replies added by reference since the traces were finished last time
+  size_t referenced_reply_bytes_ = 0;
   std::vector<std::string> subscribe_channels_;
   std::vector<std::string> subcribe_patterns_;
 };
@@ -1,13 +1,43 @@
 
 #include <ctime>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <thread>
 
 #include "redis_db.h"
 
+#include "key_stats.h"
+#include "redis_slot.h"
+#include "rocksdb_crc32c.h"
 #include "server.h"
 #include "util.h"
+#include "table_properties_collector.h"
 
 namespace Redis {
 
+const uint64_t kLazyReclaimMinSubKeys = 10000;
+const uint32_t kBitmapSegmentBytes = 1024;
+const uint64_t kScanFilterFactor = 10;
+// the random point is located by bisecting the key range with the approximate sizes, until
+// the range is smaller than kRandomSeekMinBytes, whose first kRandomSeekMaxKeys are sampled
+const int kRandomSeekSteps = 24;
+const uint64_t kRandomSeekMinBytes = 4096;
+const uint64_t kRandomSeekMaxKeys = 128;
+const uint64_t kRandomKeyMaxScanned = 128;
+
+bool KeyFilter::Match(const Slice &user_key, const Slice &metadata) const {
+  if (type != kRedisNone && (metadata.empty() || (static_cast<uint8_t>(metadata[0]) & 0x0f) != type)) {
+    return false;
+  }
+  if (slot >= 0 && GetSlotNumFromKey(user_key) != slot) return false;
+  if (pattern.empty()) return true;
+  return Util::StringMatchLen(pattern.data(), static_cast<int>(pattern.size()),
+                              user_key.data(), static_cast<int>(user_key.size()), 0) == 1;
+}
+
 Database::Database(Engine::Storage *storage, const std::string &ns) {
   storage_ = storage;
   metadata_cf_handle_ = storage->GetCFHandle("metadata");
@@ -18,15 +48,25 @@ Database::Database(Engine::Storage *storage, const std::string &ns) {
 rocksdb::Status Database::GetMetadata(RedisType type, const Slice &ns_key, Metadata *metadata) {
   std::string old_metadata;
   metadata->Encode(&old_metadata);
-  LatestSnapShot ss(db_);
-  rocksdb::ReadOptions read_options;
-  read_options.snapshot = ss.GetSnapShot();
   std::string bytes;
-  rocksdb::Status s = db_->Get(read_options, metadata_cf_handle_, ns_key, &bytes);
-  if (!s.ok()) {
-    return rocksdb::Status::NotFound();
+  rocksdb::Status s;
+  // the metadata written by the transaction is only visible to itself, so it
+  // shouldn't be read from or filled into the cache
+  bool in_txn = storage_->InTxn();
+  auto metadata_cache = storage_->GetMetadataCache();
+  if (!in_txn && metadata_cache->Get(ns_key, &bytes)) {
+    metadata->Decode(bytes);
+  } else {
+    auto generation = metadata_cache->Generation(ns_key);
+    rocksdb::ReadOptions read_options;
+    s = storage_->Get(read_options, metadata_cf_handle_, ns_key, &bytes);
+    if (!s.ok()) {
+      return rocksdb::Status::NotFound();
+    }
+    metadata->Decode(bytes);
+    // the string metadata is stored with its value, so don't cache it
+    if (!in_txn && metadata->Type() != kRedisString) metadata_cache->Insert(ns_key, bytes, generation);
   }
-  metadata->Decode(bytes);
 
   if (metadata->Expired()) {
     metadata->Decode(old_metadata);
@@ -48,9 +88,9 @@ rocksdb::Status Database::Expire(const Slice &user_key, int timestamp) {
   AppendNamespacePrefix(user_key, &ns_key);
 
   std::string value;
-  Metadata metadata(kRedisNone);
+  Metadata metadata(kRedisNone, false);
   LockGuard guard(storage_->GetLockManager(), ns_key);
-  rocksdb::Status s = db_->Get(rocksdb::ReadOptions(), metadata_cf_handle_, ns_key, &value);
+  rocksdb::Status s = storage_->Get(rocksdb::ReadOptions(), metadata_cf_handle_, ns_key, &value);
   if (!s.ok()) return s;
   metadata.Decode(value);
   if (metadata.Expired()) {
@@ -80,14 +120,126 @@ rocksdb::Status Database::Del(const Slice &user_key) {
 
   std::string value;
   LockGuard guard(storage_->GetLockManager(), ns_key);
-  rocksdb::Status s = db_->Get(rocksdb::ReadOptions(), metadata_cf_handle_, ns_key, &value);
+  rocksdb::Status s = storage_->Get(rocksdb::ReadOptions(), metadata_cf_handle_, ns_key, &value);
   if (!s.ok()) return s;
-  Metadata metadata(kRedisNone);
+  Metadata metadata(kRedisNone, false);
   metadata.Decode(value);
   if (metadata.Expired()) {
     return rocksdb::Status::NotFound("the key was expired");
   }
-  return db_->Delete(rocksdb::WriteOptions(), metadata_cf_handle_, ns_key);
+  s = storage_->Delete(rocksdb::WriteOptions(), metadata_cf_handle_, ns_key);
+  if (!s.ok()) return s;
+  reclaimSubKeys(ns_key, metadata);
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status Database::MDel(const std::vector<Slice> &keys, int *ret) {
+  *ret = 0;
+  std::set<std::string> unique_keys;
+  std::string ns_key;
+  for (const auto &key : keys) {
+    AppendNamespacePrefix(key, &ns_key);
+    unique_keys.emplace(ns_key);
+  }
+  std::vector<Slice> ns_keys(unique_keys.begin(), unique_keys.end());
+  MultiLockGuard guard(storage_->GetLockManager(), ns_keys);
+  std::vector<rocksdb::ColumnFamilyHandle *> cf_handles(ns_keys.size(), metadata_cf_handle_);
+  std::vector<std::string> values;
+  auto statuses = storage_->MultiGet(rocksdb::ReadOptions(), cf_handles, ns_keys, &values);
+
+  rocksdb::WriteBatch batch;
+  std::vector<std::pair<Slice, Metadata>> deleted;
+  for (size_t i = 0; i < ns_keys.size(); i++) {
+    if (!statuses[i].ok()) {
+      if (statuses[i].IsNotFound()) continue;
+      return statuses[i];
+    }
+    Metadata metadata(kRedisNone, false);
+    metadata.Decode(values[i]);
+    if (metadata.Expired()) continue;
+    batch.Delete(metadata_cf_handle_, ns_keys[i]);
+    deleted.emplace_back(ns_keys[i], metadata);
+  }
+  if (deleted.empty()) return rocksdb::Status::OK();
+  auto s = storage_->WriteDeletes(rocksdb::WriteOptions(), &batch);
+  if (!s.ok()) return s;
+  for (const auto &iter : deleted) reclaimSubKeys(iter.first, iter.second);
+  *ret = static_cast<int>(deleted.size());
+  return rocksdb::Status::OK();
+}
+
+void Database::reclaimSubKeys(const Slice &ns_key, const Metadata &metadata) {
+  // the subkeys of the huge key are reclaimed by the range deletion, as the range
+  // scans have to skip them until compacted, the version makes sure that the new
+  // subkeys of the same key wouldn't be covered
+  uint64_t n_subkeys = metadata.Type() == kRedisBitmap ? metadata.size / kBitmapSegmentBytes : metadata.size;
+  // the hyperloglog has a few segments at most, its size is the number of the registers
+  if (metadata.Type() == kRedisString || metadata.Type() == kRedisHyperLogLog
+      || n_subkeys < kLazyReclaimMinSubKeys) return;
+  std::string begin, end;
+  InternalKey(ns_key, "", metadata.version).Encode(&begin);
+  InternalKey(ns_key, "", metadata.version + 1).Encode(&end);
+  storage_->AddReclaimRange(begin, end, metadata.Type());
+}
+
+rocksdb::Status Database::ExpireKeys(std::string *cursor, uint64_t max_scanned, uint64_t max_deleted,
+                                     uint64_t *n_deleted) {
+  // the keys are locked and deleted in small batches, so the writers of
+  // the same slots wouldn't be blocked for long
+  const size_t batch_size = 128;
+  *n_deleted = 0;
+  int64_t now;
+  rocksdb::Env::Default()->GetCurrentTime(&now);
+
+  std::vector<std::string> expired_keys;
+  {
+    LatestSnapShot ss(db_);
+    auto read_options = storage_->ScanReadOptions(ss.GetSnapShot());
+    std::unique_ptr<rocksdb::Iterator> iter(storage_->NewIterator(read_options, metadata_cf_handle_));
+    if (cursor->empty()) {
+      iter->SeekToFirst();
+    } else {
+      iter->Seek(*cursor);
+    }
+    bool expired = false;
+    uint64_t n_scanned = 0;
+    for (; iter->Valid() && n_scanned < max_scanned && expired_keys.size() < max_deleted; iter->Next()) {
+      n_scanned++;
+      if (Metadata::DecodeExpired(iter->value(), now, &expired) && expired) {
+        expired_keys.emplace_back(iter->key().ToString());
+      }
+    }
+    if (!iter->status().ok()) return iter->status();
+    *cursor = iter->Valid() ? iter->key().ToString() : "";
+  }
+
+  std::string value;
+  for (size_t i = 0; i < expired_keys.size(); i += batch_size) {
+    std::vector<Slice> lock_keys;
+    for (size_t j = i; j < expired_keys.size() && j < i + batch_size; j++) {
+      lock_keys.emplace_back(expired_keys[j]);
+    }
+    MultiLockGuard guard(storage_->GetLockManager(), lock_keys);
+    rocksdb::WriteBatch batch;
+    std::vector<std::pair<Slice, Metadata>> deleted;
+    for (const auto &ns_key : lock_keys) {
+      // the key may be rewritten after the scan, so check it again with the lock held
+      auto s = storage_->Get(rocksdb::ReadOptions(), metadata_cf_handle_, ns_key, &value);
+      if (!s.ok()) continue;
+      bool expired = false;
+      if (!Metadata::DecodeExpired(value, now, &expired) || !expired) continue;
+      batch.Delete(metadata_cf_handle_, ns_key);
+      Metadata metadata(kRedisNone, false);
+      metadata.Decode(value);
+      deleted.emplace_back(ns_key, metadata);
+    }
+    if (deleted.empty()) continue;
+    auto s = storage_->WriteDeletes(rocksdb::WriteOptions(), &batch);
+    if (!s.ok()) return s;
+    for (const auto &iter : deleted) reclaimSubKeys(iter.first, iter.second);
+    *n_deleted += deleted.size();
+  }
+  return rocksdb::Status::OK();
 }
 
 rocksdb::Status Database::Exists(const std::vector<Slice> &keys, int *ret) {
@@ -96,16 +248,22 @@ rocksdb::Status Database::Exists(const std::vector<Slice> &keys, int *ret) {
   rocksdb::ReadOptions read_options;
   read_options.snapshot = ss.GetSnapShot();
 
-  rocksdb::Status s;
-  std::string ns_key, value;
-  for (const auto &key : keys) {
-    AppendNamespacePrefix(key, &ns_key);
-    s = db_->Get(read_options, metadata_cf_handle_, ns_key, &value);
-    if (s.ok()) {
-      Metadata metadata(kRedisNone);
-      metadata.Decode(value);
-      if (!metadata.Expired()) *ret += 1;
-    }
+  // the duplicated keys are counted repeatedly like the redis
+  std::vector<std::string> ns_keys(keys.size());
+  std::vector<Slice> slice_keys;
+  slice_keys.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    AppendNamespacePrefix(keys[i], &ns_keys[i]);
+    slice_keys.emplace_back(ns_keys[i]);
+  }
+  std::vector<rocksdb::ColumnFamilyHandle *> cf_handles(keys.size(), metadata_cf_handle_);
+  std::vector<std::string> values;
+  auto statuses = storage_->MultiGet(read_options, cf_handles, slice_keys, &values);
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (!statuses[i].ok()) continue;
+    Metadata metadata(kRedisNone, false);
+    metadata.Decode(values[i]);
+    if (!metadata.Expired()) *ret += 1;
   }
   return rocksdb::Status::OK();
 }
@@ -115,40 +273,199 @@ rocksdb::Status Database::TTL(const Slice &user_key, int *ttl) {
   AppendNamespacePrefix(user_key, &ns_key);
 
   *ttl = -2;  // ttl is -2 when the key does not exist or expired
-  LatestSnapShot ss(db_);
   rocksdb::ReadOptions read_options;
-  read_options.snapshot = ss.GetSnapShot();
   std::string value;
-  rocksdb::Status s = db_->Get(read_options, metadata_cf_handle_, ns_key, &value);
+  rocksdb::Status s = storage_->Get(read_options, metadata_cf_handle_, ns_key, &value);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
-  Metadata metadata(kRedisNone);
+  Metadata metadata(kRedisNone, false);
   metadata.Decode(value);
   *ttl = metadata.TTL();
   return rocksdb::Status::OK();
 }
 
-void Database::GetKeyNumStats(const std::string &prefix, KeyNumStats *stats) {
-  Keys(prefix, nullptr, stats);
+// prefixUpperBound returns the smallest key greater than all keys with the prefix,
+// the empty string means there's no upper bound
+static std::string prefixUpperBound(std::string prefix) {
+  while (!prefix.empty() && static_cast<uint8_t>(prefix.back()) == 0xff) prefix.pop_back();
+  if (!prefix.empty()) prefix.back()++;
+  return prefix;
 }
 
-void Database::Keys(std::string prefix, std::vector<std::string> *keys, KeyNumStats *stats) {
-  std::string ns_prefix, ns, user_key, value;
+void Database::scanKeyNumStats(const rocksdb::Snapshot *snapshot, const std::string &begin,
+                               const std::string &end, KeyNumStats *stats, uint64_t *ttl_sum,
+                               TopKeys *big_keys) {
+  Slice ns, user_key;
+  auto read_options = storage_->ScanReadOptions(snapshot);
+  rocksdb::Slice upper_bound(end);
+  if (!end.empty()) read_options.iterate_upper_bound = &upper_bound;
+  auto iter = storage_->NewIterator(read_options, metadata_cf_handle_);
+  begin.empty() ? iter->SeekToFirst() : iter->Seek(begin);
+  for (; iter->Valid(); iter->Next()) {
+    Metadata metadata(kRedisNone, false);
+    metadata.Decode(iter->value().ToString());
+    if (metadata.Expired()) {
+      stats->n_expired++;
+      continue;
+    }
+    int32_t ttl = metadata.TTL();
+    stats->n_key++;
+    if (ttl != -1) {
+      stats->n_expires++;
+      if (ttl > 0) *ttl_sum += ttl;
+    }
+    // the size of the string is its value bytes, and the others are the number of elements
+    uint64_t size = metadata.Type() == kRedisString ? iter->value().size() : metadata.size;
+    uint64_t blob_version;
+    uint32_t blob_size;
+    if (DecodeStringBlob(iter->value(), &blob_version, &blob_size)) size = blob_size;
+    if (big_keys && size > 0) {
+      ExtractNamespaceKey(iter->key(), &ns, &user_key);
+      big_keys->Offer(user_key.ToString(), size, metadata.Type());
+    }
+  }
+  delete iter;
+}
+
+void Database::GetKeyNumStats(const std::string &prefix, KeyNumStats *stats, TopKeys *big_keys) {
+  std::string ns_prefix;
+  AppendNamespacePrefix(prefix, &ns_prefix);
+  std::string ns_upper_bound = prefixUpperBound(ns_prefix);
+
+  // Split the key range by the boundaries of the sst files, and scan them in parallel
+  const size_t max_scan_threads = std::max(1U, std::min(8U, std::thread::hardware_concurrency()));
+  std::vector<std::string> boundaries;
+  std::vector<rocksdb::LiveFileMetaData> files;
+  db_->GetLiveFilesMetaData(&files);
+  for (const auto &f : files) {
+    if (f.column_family_name != metadata_cf_handle_->GetName()) continue;
+    if (f.smallestkey <= ns_prefix) continue;
+    if (!ns_upper_bound.empty() && f.smallestkey >= ns_upper_bound) continue;
+    boundaries.emplace_back(f.smallestkey);
+  }
+  std::sort(boundaries.begin(), boundaries.end());
+  boundaries.erase(std::unique(boundaries.begin(), boundaries.end()), boundaries.end());
+  std::vector<std::string> split_keys = {ns_prefix};
+  size_t n_ranges = std::min(max_scan_threads, boundaries.size() + 1);
+  for (size_t i = 1; i < n_ranges; i++) {
+    split_keys.emplace_back(boundaries[i * boundaries.size() / n_ranges]);
+  }
+  split_keys.emplace_back(ns_upper_bound);
+
+  LatestSnapShot ss(db_);
+  std::vector<KeyNumStats> range_stats(n_ranges);
+  std::vector<uint64_t> range_ttl_sums(n_ranges, 0);
+  std::vector<TopKeys> range_big_keys(n_ranges, TopKeys(big_keys ? big_keys->Capacity() : 0));
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < n_ranges; i++) {
+    threads.emplace_back([this, &ss, &split_keys, &range_stats, &range_ttl_sums, &range_big_keys, i]() {
+      scanKeyNumStats(ss.GetSnapShot(), split_keys[i], split_keys[i+1], &range_stats[i], &range_ttl_sums[i],
+                      &range_big_keys[i]);
+    });
+  }
+  scanKeyNumStats(ss.GetSnapShot(), split_keys[0], split_keys[1], &range_stats[0], &range_ttl_sums[0],
+                  &range_big_keys[0]);
+  for (auto &t : threads) t.join();
+  if (big_keys) {
+    for (const auto &range_top : range_big_keys) big_keys->Merge(range_top);
+  }
+
+  uint64_t ttl_sum = 0;
+  for (size_t i = 0; i < n_ranges; i++) {
+    stats->n_key += range_stats[i].n_key;
+    stats->n_expires += range_stats[i].n_expires;
+    stats->n_expired += range_stats[i].n_expired;
+    ttl_sum += range_ttl_sums[i];
+  }
+  if (stats->n_expires > 0) {
+    stats->avg_ttl = ttl_sum / stats->n_expires;
+  }
+}
+
+bool Database::EstimateKeyNumStats(KeyNumStats *stats) {
+  rocksdb::TablePropertiesCollection props;
+  auto s = db_->GetPropertiesOfAllTables(metadata_cf_handle_, &props);
+  if (!s.ok()) return false;
+  bool complete = true;
+  std::map<std::string, Engine::NamespaceKeyStats> ns_stats;
+  for (const auto &iter : props) {
+    const auto &user_props = iter.second->user_collected_properties;
+    auto found = user_props.find(Engine::kNamespaceStatsPropertyName);
+    if (found == user_props.end() || !Engine::DecodeNamespaceKeyStats(found->second, &ns_stats)) {
+      complete = false;
+    }
+  }
+  auto iter = ns_stats.find(namespace_);
+  if (iter == ns_stats.end()) return complete;
+  const auto &stat = iter->second;
+  stats->n_key = stat.n_put > stat.n_delete ? stat.n_put - stat.n_delete : 0;
+  stats->n_expires = std::min(stat.n_expires, stats->n_key);
+  if (stat.n_expires > 0) {
+    int64_t now;
+    rocksdb::Env::Default()->GetCurrentTime(&now);
+    uint64_t avg_expire = stat.expire_sum / stat.n_expires;
+    stats->avg_ttl = avg_expire > static_cast<uint64_t>(now) ? avg_expire - now : 0;
+  }
+  return complete;
+}
+
+void Database::EstimateKeyNum(uint64_t *n_key) {
+  KeyNumStats stats;
+  if (EstimateKeyNumStats(&stats)) {
+    *n_key = stats.n_key;
+    return;
+  }
+  // the sst files created before the stats collector is added, fallback to
+  // estimate the keys by the size of the namespace
+  *n_key = 0;
+  uint64_t total_keys = 0;
+  if (!db_->GetIntProperty(metadata_cf_handle_, "rocksdb.estimate-num-keys", &total_keys)) return;
+  std::string ns_prefix;
+  AppendNamespacePrefix("", &ns_prefix);
+  std::string ns_upper_bound = prefixUpperBound(ns_prefix);
+  // the keys of all namespaces are in the metadata column family,
+  // so estimate the keys of the namespace in proportion to its size
+  const std::string max_key(1, '\xff');
+  rocksdb::Range ranges[2] = {
+      rocksdb::Range(ns_prefix, ns_upper_bound.empty() ? max_key : ns_upper_bound),
+      rocksdb::Range("", max_key),
+  };
+  uint64_t sizes[2] = {0, 0};
+  uint8_t include_flags = rocksdb::DB::INCLUDE_FILES | rocksdb::DB::INCLUDE_MEMTABLES;
+  db_->GetApproximateSizes(metadata_cf_handle_, ranges, 2, sizes, include_flags);
+  if (sizes[1] == 0) return;
+  *n_key = static_cast<uint64_t>(static_cast<double>(total_keys) * sizes[0] / sizes[1]);
+}
+
+void Database::Keys(std::string prefix, std::vector<std::string> *keys, KeyNumStats *stats,
+                    const KeyFilter *filter) {
+  std::string ns_prefix, value;
+  Slice ns, user_key;
   AppendNamespacePrefix(prefix, &ns_prefix);
   prefix = ns_prefix;
 
   uint64_t ttl_sum = 0;
+  int64_t now;
+  rocksdb::Env::Default()->GetCurrentTime(&now);
   LatestSnapShot ss(db_);
-  rocksdb::ReadOptions read_options;
-  read_options.snapshot = ss.GetSnapShot();
-  read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options, metadata_cf_handle_);
+  auto read_options = storage_->ScanReadOptions(ss.GetSnapShot());
+  auto iter = storage_->NewIterator(read_options, metadata_cf_handle_);
   prefix.empty() ? iter->SeekToFirst() : iter->Seek(prefix);
   for (; iter->Valid(); iter->Next()) {
     if (!prefix.empty() && !iter->key().starts_with(prefix)) {
       break;
     }
-    Metadata metadata(kRedisNone);
+    ExtractNamespaceKey(iter->key(), &ns, &user_key);
+    if (filter && !filter->Match(user_key, iter->value())) continue;
+    if (!stats) {
+      // only the expiration is needed to list the keys, which is read in place
+      bool expired = false;
+      if (Metadata::DecodeExpired(iter->value(), now, &expired)) {
+        if (!expired && keys) keys->emplace_back(user_key.ToString());
+        continue;
+      }
+    }
+    Metadata metadata(kRedisNone, false);
     value = iter->value().ToString();
     metadata.Decode(value);
     if (metadata.Expired()) {
@@ -164,8 +481,7 @@ void Database::Keys(std::string prefix, std::vector<std::string> *keys, KeyNumSt
       }
     }
     if (keys) {
-      ExtractNamespaceKey(iter->key(), &ns, &user_key);
-      keys->emplace_back(user_key);
+      keys->emplace_back(user_key.ToString());
     }
   }
   if (stats && stats->n_expires > 0) {
@@ -177,63 +493,288 @@ void Database::Keys(std::string prefix, std::vector<std::string> *keys, KeyNumSt
 rocksdb::Status Database::Scan(const std::string &cursor,
                          uint64_t limit,
                          const std::string &prefix,
-                         std::vector<std::string> *keys) {
-  uint64_t cnt = 0;
-  std::string ns_prefix, ns_cursor, ns, user_key, value;
+                         std::vector<std::string> *keys,
+                         const std::string &iter_token,
+                         const KeyFilter *filter,
+                         std::string *end_cursor) {
+  uint64_t cnt = 0, scanned = 0;
+  uint64_t max_scanned = filter ? limit * kScanFilterFactor : UINT64_MAX;
+  std::string ns_prefix, ns_cursor, last_key, token;
+  Slice ns, user_key;
   AppendNamespacePrefix(prefix, &ns_prefix);
   AppendNamespacePrefix(cursor, &ns_cursor);
+  if (end_cursor) end_cursor->clear();
 
-  LatestSnapShot ss(db_);
-  rocksdb::ReadOptions read_options;
-  read_options.snapshot = ss.GetSnapShot();
-  read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options, metadata_cf_handle_);
-  if (!cursor.empty()) {
+  auto iter_cache = storage_->GetScanIteratorCache();
+  std::unique_ptr<Engine::ScanIterator> scan_iter;
+  if (!iter_token.empty()) {
+    token = iter_token + "|" + ns_prefix;
+    if (!cursor.empty()) scan_iter = iter_cache->Take(token, cursor);
+  }
+  bool resumed = scan_iter != nullptr;
+  if (!resumed) {
+    scan_iter = Engine::ScanIterator::New(storage_, metadata_cf_handle_, prefixUpperBound(ns_prefix));
+    if (!scan_iter) return rocksdb::Status::Aborted("the db was closing");
+  }
+  auto iter = scan_iter->Get();
+  if (resumed) {
+    // the iterator is left at the first key after the cursor
+  } else if (!cursor.empty()) {
     iter->Seek(ns_cursor);
     if (iter->Valid()) {
       iter->Next();
     }
-  } else if (ns_prefix.empty()) {
-    iter->SeekToFirst();
   } else {
     iter->Seek(ns_prefix);
   }
 
-  for (; iter->Valid() && cnt < limit; iter->Next()) {
-    if (!ns_prefix.empty() && !iter->key().starts_with(ns_prefix)) {
+  int64_t now;
+  rocksdb::Env::Default()->GetCurrentTime(&now);
+  for (; iter->Valid() && cnt < limit && scanned < max_scanned; iter->Next()) {
+    if (!iter->key().starts_with(ns_prefix)) {
       break;
     }
-    Metadata metadata(kRedisNone);
-    value = iter->value().ToString();
-    metadata.Decode(value);
-    if (metadata.Expired()) continue;
+    scanned++;
     ExtractNamespaceKey(iter->key(), &ns, &user_key);
-    keys->emplace_back(user_key);
+    last_key.assign(user_key.data(), user_key.size());
+    if (filter && !filter->Match(user_key, iter->value())) continue;
+    bool expired = false;
+    if (!Metadata::DecodeExpired(iter->value(), now, &expired)) {
+      Metadata metadata(kRedisNone, false);
+      metadata.Decode(iter->value().ToString());
+      expired = metadata.Expired();
+    }
+    if (expired) continue;
+    keys->emplace_back(last_key);
     cnt++;
   }
-  delete iter;
+  if (end_cursor) *end_cursor = last_key;
+  if (!token.empty() && !last_key.empty() && iter->Valid() && iter->key().starts_with(ns_prefix)) {
+    scan_iter->cursor = last_key;
+    iter_cache->Put(token, std::move(scan_iter));
+  }
   return rocksdb::Status::OK();
 }
 
-rocksdb::Status Database::RandomKey(const std::string &cursor, std::string *key) {
+rocksdb::Status Database::RandomKey(std::string *key) {
   key->clear();
 
-  std::vector<std::string> keys;
-  auto s = Scan(cursor, 60, "", &keys);
-  if (!s.ok()) {
-    return s;
+  std::string ns_prefix;
+  Slice ns, user_key;
+  AppendNamespacePrefix("", &ns_prefix);
+  std::string ns_upper_bound = prefixUpperBound(ns_prefix);
+  LatestSnapShot ss(db_);
+  auto read_options = storage_->ScanReadOptions(ss.GetSnapShot());
+  std::unique_ptr<rocksdb::Iterator> iter(storage_->NewIterator(read_options, metadata_cf_handle_));
+  seekRandom(iter.get(), metadata_cf_handle_, ns_prefix, ns_upper_bound);
+
+  int64_t now;
+  rocksdb::Env::Default()->GetCurrentTime(&now);
+  // the expired keys after the random point are skipped, and it wraps to the first key once
+  bool wrapped = false;
+  for (uint64_t scanned = 0; scanned < kRandomKeyMaxScanned; scanned++) {
+    if (!iter->Valid() || !iter->key().starts_with(ns_prefix)) {
+      if (wrapped) break;
+      wrapped = true;
+      iter->Seek(ns_prefix);
+      continue;
+    }
+    bool expired = false;
+    if (!Metadata::DecodeExpired(iter->value(), now, &expired)) {
+      Metadata metadata(kRedisNone, false);
+      metadata.Decode(iter->value().ToString());
+      expired = metadata.Expired();
+    }
+    if (!expired) {
+      ExtractNamespaceKey(iter->key(), &ns, &user_key);
+      *key = user_key.ToString();
+      break;
+    }
+    iter->Next();
   }
-  if (keys.empty() && !cursor.empty()) {
-    // if reach the end, restart from begining
-    auto s = Scan("", 60, "", &keys);
-    if (!s.ok()) {
-      return s;
+  return rocksdb::Status::OK();
+}
+
+// keyMidpoint returns the midpoint of the keys which are the big-endian numbers of the same width
+static std::string keyMidpoint(const std::string &lo, const std::string &hi) {
+  std::string mid(lo.size(), '\0');
+  unsigned carry = 0;
+  for (size_t i = lo.size(); i-- > 0;) {
+    unsigned sum = static_cast<uint8_t>(lo[i]) + static_cast<uint8_t>(hi[i]) + carry;
+    mid[i] = static_cast<char>(sum & 0xff);
+    carry = sum >> 8;
+  }
+  for (size_t i = 0; i < mid.size(); i++) {
+    unsigned byte = static_cast<uint8_t>(mid[i]);
+    mid[i] = static_cast<char>((byte >> 1) | (carry << 7));
+    carry = byte & 1;
+  }
+  return mid;
+}
+
+void Database::seekRandom(rocksdb::Iterator *iter, rocksdb::ColumnFamilyHandle *cf_handle,
+                          const std::string &begin, const std::string &end) {
+  static thread_local std::minstd_rand engine(std::random_device{}());
+  size_t width = std::max(begin.size(), end.size()) + 4;
+  std::string lo = begin, hi = end.empty() ? std::string(width, '\xff') : end;
+  lo.resize(width, '\0');
+  hi.resize(width, '\0');
+  // r is the position of the random point in [lo, hi) weighted by the data size
+  double r = std::uniform_real_distribution<double>(0, 1)(engine);
+  std::string from = begin;
+  uint8_t include_flags = rocksdb::DB::INCLUDE_FILES | rocksdb::DB::INCLUDE_MEMTABLES;
+  for (int i = 0; i < kRandomSeekSteps; i++) {
+    std::string mid = keyMidpoint(lo, hi);
+    rocksdb::Range ranges[2] = {rocksdb::Range(lo, hi), rocksdb::Range(lo, mid)};
+    uint64_t sizes[2] = {0, 0};
+    db_->GetApproximateSizes(cf_handle, ranges, 2, sizes, include_flags);
+    if (sizes[0] < kRandomSeekMinBytes) break;
+    double left = std::min(1.0, static_cast<double>(sizes[1]) / sizes[0]);
+    if (r < left) {
+      hi = std::move(mid);
+      r = r / left;
+    } else {
+      lo = std::move(mid);
+      from = lo;
+      r = left < 1 ? (r - left) / (1 - left) : 0;
     }
   }
-  if (!keys.empty()) {
-    unsigned int seed = time(NULL);
-    *key = keys.at(rand_r(&seed) % keys.size());
+
+  // the range is too small to be estimated, so its first keys are sampled uniformly
+  std::string picked;
+  uint64_t n = 0;
+  for (iter->Seek(from); iter->Valid() && n < kRandomSeekMaxKeys; iter->Next(), n++) {
+    if (iter->key().compare(hi) >= 0 || (!end.empty() && iter->key().compare(end) >= 0)) break;
+    if (std::uniform_int_distribution<uint64_t>(0, n)(engine) == 0) picked = iter->key().ToString();
   }
+  if (!picked.empty()) {
+    iter->Seek(picked);
+  } else if (!iter->Valid() || (!end.empty() && iter->key().compare(end) >= 0)) {
+    iter->Seek(begin);
+  }
+}
+
+// the payload is version(1byte) + metadata + subkeys + crc32c(4byte) of the bytes before it,
+// the metadata and each subkey and its value are prefixed by their varint sizes
+const uint8_t kDumpPayloadVersion = 1;
+
+rocksdb::Status Database::DumpPayload(const Slice &user_key, std::string *payload, int *expire) {
+  payload->clear();
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LatestSnapShot ss(db_);
+  auto read_options = storage_->ScanReadOptions(ss.GetSnapShot());
+  std::string bytes;
+  auto s = storage_->Get(read_options, metadata_cf_handle_, ns_key, &bytes);
+  if (!s.ok()) return s;
+  Metadata metadata(kRedisNone, false);
+  metadata.Decode(bytes);
+  if (metadata.Expired()) return rocksdb::Status::NotFound("the key was expired");
+  if (expire) *expire = metadata.expire > 0 ? metadata.expire : 0;
+  uint64_t blob_version;
+  uint32_t blob_size;
+  if (DecodeStringBlob(bytes, &blob_version, &blob_size)) {
+    // the separated value is inlined into the payload, so it's restored without the blob
+    std::string blob_key, blob;
+    InternalKey(ns_key, "", blob_version).Encode(&blob_key);
+    s = storage_->Get(read_options, storage_->GetCFHandle("blob"), blob_key, &blob);
+    if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::Corruption("the blob of the string was missing") : s;
+    bytes.resize(5);
+    bytes[0] = static_cast<char>(bytes[0] & ~kStringBlobFlag);
+    bytes.append(blob);
+  }
+  PutFixed8(payload, kDumpPayloadVersion);
+  PutVarint64(payload, bytes.size());
+  payload->append(bytes);
+
+  if (metadata.Type() != kRedisString) {
+    std::string prefix;
+    InternalKey(ns_key, "", metadata.version).Encode(&prefix);
+    std::unique_ptr<rocksdb::Iterator> iter(
+        storage_->NewIterator(read_options, storage_->GetSubKeyCFHandle(metadata.Type())));
+    for (iter->Seek(prefix); iter->Valid() && iter->key().starts_with(prefix); iter->Next()) {
+      PutVarint64(payload, iter->key().size() - prefix.size());
+      payload->append(iter->key().data() + prefix.size(), iter->key().size() - prefix.size());
+      PutVarint64(payload, iter->value().size());
+      payload->append(iter->value().data(), iter->value().size());
+    }
+    if (!iter->status().ok()) return iter->status();
+  }
+  PutFixed32(payload, rocksdb::crc32c::Value(payload->data(), payload->size()));
+  return rocksdb::Status::OK();
+}
+
+static bool getSizedSlice(Slice *input, Slice *value) {
+  uint64_t size;
+  if (!GetVarint64(input, &size) || input->size() < size) return false;
+  *value = Slice(input->data(), size);
+  input->remove_prefix(size);
+  return true;
+}
+
+rocksdb::Status Database::RestorePayload(const Slice &user_key, const std::string &payload, int expire,
+                                         bool replace, bool *busy) {
+  *busy = false;
+  if (payload.size() < 5 || DecodeFixed32(payload.data() + payload.size() - 4)
+      != rocksdb::crc32c::Value(payload.data(), payload.size() - 4)) {
+    return rocksdb::Status::Corruption("the checksum of the payload was mismatched");
+  }
+  Slice input(payload.data(), payload.size() - 4);
+  uint8_t payload_version;
+  GetFixed8(&input, &payload_version);
+  if (payload_version != kDumpPayloadVersion) return rocksdb::Status::NotSupported("unknown payload version");
+  Slice metadata_bytes;
+  if (!getSizedSlice(&input, &metadata_bytes)) return rocksdb::Status::Corruption("the metadata was truncated");
+  std::string bytes = metadata_bytes.ToString();
+  Metadata metadata(kRedisNone, false);
+  if (!metadata.Decode(bytes).ok() || metadata.Type() == kRedisNone || metadata.Type() > kRedisStream
+      || (metadata.Type() != kRedisString && bytes.size() < 17)) {
+    return rocksdb::Status::Corruption("invalid metadata of the payload");
+  }
+  RedisType type = metadata.Type();
+  // the subkeys are written with a new version, so they never mix with the old ones of the key
+  uint64_t version = Metadata(type).version;
+  EncodeFixed32(&bytes[1], static_cast<uint32_t>(expire));
+  if (type != kRedisString) EncodeFixed64(&bytes[5], version);
+  // the rank index isn't dumped, the restored zset is read without it
+  if (type == kRedisZSet) bytes[0] = static_cast<char>(bytes[0] & ~kZSetRankIndexFlag);
+
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(type);
+  batch.PutLogData(log_data.Encode());
+  auto subkey_cf_handle = storage_->GetSubKeyCFHandle(type);
+  auto score_cf_handle = storage_->GetCFHandle("zset_score");
+  std::string sub_key_bytes, score_key_bytes;
+  Slice sub_key, value;
+  while (!input.empty()) {
+    if (type == kRedisString || !getSizedSlice(&input, &sub_key) || !getSizedSlice(&input, &value)) {
+      return rocksdb::Status::Corruption("the subkeys were truncated");
+    }
+    InternalKey(ns_key, sub_key, version).Encode(&sub_key_bytes);
+    batch.Put(subkey_cf_handle, sub_key_bytes, value);
+    if (type == kRedisZSet) {
+      InternalKey(ns_key, value.ToString() + sub_key.ToString(), version).Encode(&score_key_bytes);
+      batch.Put(score_cf_handle, score_key_bytes, Slice());
+    }
+  }
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  std::string old_bytes;
+  Metadata old_metadata(kRedisNone, false);
+  auto s = storage_->Get(rocksdb::ReadOptions(), metadata_cf_handle_, ns_key, &old_bytes);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  bool existed = s.ok() && old_metadata.Decode(old_bytes).ok() && !old_metadata.Expired();
+  if (existed && !replace) {
+    *busy = true;
+    return rocksdb::Status::OK();
+  }
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  s = storage_->Write(rocksdb::WriteOptions(), &batch);
+  if (!s.ok()) return s;
+  if (existed) reclaimSubKeys(ns_key, old_metadata);
   return rocksdb::Status::OK();
 }
 
@@ -244,15 +785,18 @@ rocksdb::Status Database::FlushDB() {
   if (!s.ok()) {
     return rocksdb::Status::OK();
   }
-  s = db_->DeleteRange(rocksdb::WriteOptions(), metadata_cf_handle_, begin_key, end_key);
-  if (!s.ok()) {
-    return s;
-  }
-  s = db_->Delete(rocksdb::WriteOptions(), metadata_cf_handle_, end_key);
-  if (!s.ok()) {
-    return s;
+  // the metadata and the subkeys are removed in one batch, so the namespace is never half flushed
+  rocksdb::WriteBatch batch;
+  batch.DeleteRange(metadata_cf_handle_, begin_key, end_key);
+  batch.Delete(metadata_cf_handle_, end_key);
+  // remove the subkeys of the namespace at once, it can't be deferred like the
+  // versioned range as the new keys in the namespace would be covered
+  std::string prefix_end = prefixUpperBound(prefix);
+  for (const auto &cf_handle : storage_->GetCFHandles()) {
+    if (cf_handle->GetID() == kColumnFamilyIDMetadata || cf_handle->GetID() == kColumnFamilyIDPubSub) continue;
+    batch.DeleteRange(cf_handle, prefix, prefix_end);
   }
-  return rocksdb::Status::OK();
+  return storage_->WriteDeletes(rocksdb::WriteOptions(), &batch);
 }
 
 rocksdb::Status Database::FlushAll() {
@@ -260,7 +804,7 @@ rocksdb::Status Database::FlushAll() {
   rocksdb::ReadOptions read_options;
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options, metadata_cf_handle_);
+  auto iter = storage_->NewIterator(read_options, metadata_cf_handle_);
   iter->SeekToFirst();
   if (!iter->Valid()) {
     delete iter;
@@ -273,12 +817,12 @@ rocksdb::Status Database::FlushAll() {
     return rocksdb::Status::OK();
   }
   auto last_key = iter->key().ToString();
-  auto s = db_->DeleteRange(rocksdb::WriteOptions(), metadata_cf_handle_, first_key, last_key);
+  auto s = storage_->DeleteRange(rocksdb::WriteOptions(), metadata_cf_handle_, first_key, last_key);
   if (!s.ok()) {
     delete iter;
     return s;
   }
-  s = db_->Delete(rocksdb::WriteOptions(), metadata_cf_handle_, last_key);
+  s = storage_->Delete(rocksdb::WriteOptions(), metadata_cf_handle_, last_key);
   if (!s.ok()) {
     delete iter;
     return s;
@@ -293,14 +837,12 @@ rocksdb::Status Database::Dump(const Slice &user_key, std::vector<std::string> *
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  LatestSnapShot ss(db_);
   rocksdb::ReadOptions read_options;
-  read_options.snapshot = ss.GetSnapShot();
   std::string value;
-  rocksdb::Status s = db_->Get(read_options, metadata_cf_handle_, ns_key, &value);
+  rocksdb::Status s = storage_->Get(read_options, metadata_cf_handle_, ns_key, &value);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
-  Metadata metadata(kRedisNone);
+  Metadata metadata(kRedisNone, false);
   metadata.Decode(value);
 
   infos->emplace_back("namespace");
@@ -325,13 +867,17 @@ rocksdb::Status Database::Dump(const Slice &user_key, std::vector<std::string> *
   infos->emplace_back(created_at_str + "." + std::to_string(created_at.tv_usec));
 
   if (metadata.Type() == kRedisList) {
-    ListMetadata metadata;
+    ListMetadata metadata(false);
     GetMetadata(kRedisList, ns_key, &metadata);
     if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
     infos->emplace_back("head");
     infos->emplace_back(std::to_string(metadata.head));
     infos->emplace_back("tail");
     infos->emplace_back(std::to_string(metadata.tail));
+    if (metadata.IsChunked()) {
+      infos->emplace_back("next_chunk_id");
+      infos->emplace_back(std::to_string(metadata.next_chunk_id));
+    }
   }
 
   return rocksdb::Status::OK();
@@ -342,14 +888,12 @@ rocksdb::Status Database::Type(const Slice &user_key, RedisType *type) {
   AppendNamespacePrefix(user_key, &ns_key);
 
   *type = kRedisNone;
-  LatestSnapShot ss(db_);
   rocksdb::ReadOptions read_options;
-  read_options.snapshot = ss.GetSnapShot();
   std::string value;
-  rocksdb::Status s = db_->Get(read_options, metadata_cf_handle_, ns_key, &value);
+  rocksdb::Status s = storage_->Get(read_options, metadata_cf_handle_, ns_key, &value);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
-  Metadata metadata(kRedisNone);
+  Metadata metadata(kRedisNone, false);
   metadata.Decode(value);
   *type = metadata.Type();
   return rocksdb::Status::OK();
@@ -367,7 +911,7 @@ rocksdb::Status Database::FindKeyRangeWithPrefix(const std::string &prefix, std:
   rocksdb::ReadOptions read_options;
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options, metadata_cf_handle_);
+  auto iter = storage_->NewIterator(read_options, metadata_cf_handle_);
   iter->Seek(prefix);
   if (!iter->Valid()) {
     delete iter;
@@ -401,7 +945,8 @@ rocksdb::Status SubKeyScanner::Scan(RedisType type,
                                     const std::string &cursor,
                                     uint64_t limit,
                                     const std::string &subkey_prefix,
-                                    std::vector<std::string> *keys) {
+                                    std::vector<std::string> *keys,
+                                    const std::string &iter_token) {
   uint64_t cnt = 0;
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
@@ -409,11 +954,6 @@ rocksdb::Status SubKeyScanner::Scan(RedisType type,
   rocksdb::Status s = GetMetadata(type, ns_key, &metadata);
   if (!s.ok()) return s;
 
-  LatestSnapShot ss(db_);
-  rocksdb::ReadOptions read_options;
-  read_options.snapshot = ss.GetSnapShot();
-  read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options);
   std::string match_prefix_key;
   if (!subkey_prefix.empty()) {
     InternalKey(ns_key, subkey_prefix, metadata.version).Encode(&match_prefix_key);
@@ -421,13 +961,31 @@ rocksdb::Status SubKeyScanner::Scan(RedisType type,
     InternalKey(ns_key, "", metadata.version).Encode(&match_prefix_key);
   }
 
+  // the token is bound to the version, the recreated key wouldn't reuse the iterator
+  auto iter_cache = storage_->GetScanIteratorCache();
+  std::string token;
+  std::unique_ptr<Engine::ScanIterator> scan_iter;
+  if (!iter_token.empty()) {
+    token = iter_token + "|" + match_prefix_key;
+    if (!cursor.empty()) scan_iter = iter_cache->Take(token, cursor);
+  }
+  bool resumed = scan_iter != nullptr;
+  if (!resumed) {
+    scan_iter = Engine::ScanIterator::New(storage_, storage_->GetSubKeyCFHandle(type),
+                                          prefixUpperBound(match_prefix_key));
+    if (!scan_iter) return rocksdb::Status::Aborted("the db was closing");
+  }
+  auto iter = scan_iter->Get();
+
   std::string start_key;
   if (!cursor.empty()) {
     InternalKey(ns_key, cursor, metadata.version).Encode(&start_key);
   } else {
     start_key = match_prefix_key;
   }
-  for (iter->Seek(start_key); iter->Valid() && cnt < limit; iter->Next()) {
+  // the resumed iterator is left at the first key after the cursor
+  if (!resumed) iter->Seek(start_key);
+  for (; iter->Valid() && cnt < limit; iter->Next()) {
     if (!cursor.empty() && iter->key() == start_key) {
       // if cursor is not empty, then we need to skip start_key
       // because we already return that key in the last scan
@@ -440,7 +998,44 @@ rocksdb::Status SubKeyScanner::Scan(RedisType type,
     keys->emplace_back(ikey.GetSubKey().ToString());
     cnt++;
   }
-  delete iter;
+  if (!token.empty() && cnt > 0 && cnt == limit && iter->Valid()) {
+    scan_iter->cursor = keys->back();
+    iter_cache->Put(token, std::move(scan_iter));
+  }
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status SubKeyScanner::OpenStream(RedisType type, const Slice &user_key, uint64_t min_size,
+                                          std::unique_ptr<Engine::ScanIterator> *stream, uint64_t *size) {
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+  // check the cached metadata first, most keys are too small to be streamed
+  Metadata metadata(type);
+  rocksdb::Status s = GetMetadata(type, ns_key, &metadata);
+  if (!s.ok()) return s;
+  if (metadata.size < min_size) return rocksdb::Status::NotFound();
+  if (type == kRedisHash && (metadata.flags & kHashInlineFlag)) return rocksdb::Status::NotFound();
+
+  std::string prefix_key;
+  InternalKey(ns_key, "", metadata.version).Encode(&prefix_key);
+  auto scan_iter = Engine::ScanIterator::New(storage_, storage_->GetSubKeyCFHandle(type),
+                                             prefixUpperBound(prefix_key));
+  if (!scan_iter) return rocksdb::Status::Aborted("the db was closing");
+  // the key may be changed before the snapshot, read the size again in the snapshot
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = scan_iter->GetSnapshot();
+  std::string bytes;
+  s = storage_->Get(read_options, metadata_cf_handle_, ns_key, &bytes);
+  if (!s.ok()) return rocksdb::Status::NotFound();
+  Metadata snapshot_metadata(type);
+  snapshot_metadata.Decode(bytes);
+  if (snapshot_metadata.Expired() || snapshot_metadata.version != metadata.version
+      || snapshot_metadata.Type() != type || snapshot_metadata.size < min_size) {
+    return rocksdb::Status::NotFound();
+  }
+  scan_iter->Get()->Seek(prefix_key);
+  *size = snapshot_metadata.size;
+  *stream = std::move(scan_iter);
   return rocksdb::Status::OK();
 }
 
@@ -1,6 +1,7 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <utility>
@@ -8,30 +9,92 @@
 #include "redis_metadata.h"
 #include "storage.h"
 
+class TopKeys;
+
 namespace Redis {
+
+// KeyFilter is matched against the raw metadata entry of the key, so the keys which
+// don't match the pattern or the type are skipped without decoding the metadata
+struct KeyFilter {
+  std::string pattern;
+  RedisType type = kRedisNone;
+  // the cluster slot of the key, -1 matches any slot
+  int slot = -1;
+
+  bool Match(const Slice &user_key, const Slice &metadata) const;
+};
+
 class Database {
  public:
   explicit Database(Engine::Storage *storage, const std::string &ns = "");
   rocksdb::Status GetMetadata(RedisType type, const Slice &ns_key, Metadata *metadata);
   rocksdb::Status Expire(const Slice &user_key, int timestamp);
   rocksdb::Status Del(const Slice &user_key);
+  // MDel deletes the keys with one MultiGet of their metadata and one write batch, and
+  // returns the number of the deleted keys, the duplicated keys are deleted once
+  rocksdb::Status MDel(const std::vector<Slice> &keys, int *ret);
   rocksdb::Status Exists(const std::vector<Slice> &keys, int *ret);
   rocksdb::Status TTL(const Slice &user_key, int *ttl);
   rocksdb::Status Type(const Slice &user_key, RedisType *type);
   rocksdb::Status Dump(const Slice &user_key, std::vector<std::string> *infos);
+  // DumpPayload serializes the metadata and all subkeys of the key read at one snapshot into the
+  // payload, which is restored by RestorePayload on the other nodes as one write batch. The expire
+  // timestamp of the key is set if it's not null, and 0 is persistent
+  rocksdb::Status DumpPayload(const Slice &user_key, std::string *payload, int *expire = nullptr);
+  // RestorePayload writes the key from the payload with a new version and the expire timestamp(0
+  // is persistent), busy is set and nothing is written if the key exists and not replace
+  rocksdb::Status RestorePayload(const Slice &user_key, const std::string &payload, int expire, bool replace,
+                                 bool *busy);
   rocksdb::Status FlushDB();
   rocksdb::Status FlushAll();
-  void GetKeyNumStats(const std::string &prefix, KeyNumStats *stats);
-  void Keys(std::string prefix, std::vector<std::string> *keys = nullptr, KeyNumStats *stats = nullptr);
+  // GetKeyNumStats scans the metadata of the namespace, and offers the live keys into the
+  // big_keys by their sizes if it's not null
+  void GetKeyNumStats(const std::string &prefix, KeyNumStats *stats, TopKeys *big_keys = nullptr);
+  // EstimateKeyNumStats sums the key stats of the namespace collected into the
+  // table properties of the metadata sst files, the keys in memtable are excluded,
+  // returns false if there're sst files without the stats
+  bool EstimateKeyNumStats(KeyNumStats *stats);
+  // EstimateKeyNum estimates the number of keys in the namespace instantly by
+  // the table properties and the approximate size of the namespace
+  void EstimateKeyNum(uint64_t *n_key);
+  void Keys(std::string prefix, std::vector<std::string> *keys = nullptr, KeyNumStats *stats = nullptr,
+            const KeyFilter *filter = nullptr);
+  // Scan continues from the cached iterator of the iter_token if the cursor
+  // is returned by its last page, and leaves the iterator in the cache if
+  // there're more keys. The empty iter_token disables the iterator reuse.
+  // With the filter, at most limit*kScanFilterFactor keys are scanned for a page, so the
+  // page may be short or empty. The end_cursor is set to the last scanned key which the
+  // next page should continue from, and it is empty if nothing is scanned.
   rocksdb::Status Scan(const std::string &cursor,
                        uint64_t limit,
                        const std::string &prefix,
-                       std::vector<std::string> *keys);
-  rocksdb::Status RandomKey(const std::string &cursor, std::string *key);
+                       std::vector<std::string> *keys,
+                       const std::string &iter_token = "",
+                       const KeyFilter *filter = nullptr,
+                       std::string *end_cursor = nullptr);
+  // ExpireKeys deletes the expired keys of all namespaces by scanning at most max_scanned
+  // metadata from the cursor, the cursor is moved to the next key to be scanned, or
+  // cleared if the scan reaches the end. At most max_deleted keys would be deleted.
+  rocksdb::Status ExpireKeys(std::string *cursor, uint64_t max_scanned, uint64_t max_deleted,
+                             uint64_t *n_deleted);
+  // RandomKey seeks to a random point of the namespace weighted by the data size, and
+  // returns the first live key after it, so it takes O(log N) seeks instead of a scan
+  rocksdb::Status RandomKey(std::string *key);
   void AppendNamespacePrefix(const Slice &user_key, std::string *output);
   rocksdb::Status FindKeyRangeWithPrefix(const std::string &prefix, std::string *begin, std::string *end);
 
  protected:
+  void scanKeyNumStats(const rocksdb::Snapshot *snapshot, const std::string &begin,
+                       const std::string &end, KeyNumStats *stats, uint64_t *ttl_sum, TopKeys *big_keys);
+  // reclaimSubKeys queues the subkey range of the deleted huge key to the storage
+  void reclaimSubKeys(const Slice &ns_key, const Metadata &metadata);
+  // seekRandom positions the iterator at a random key of [begin, end), the range is bisected
+  // by the approximate sizes in O(log N) steps, and the keys of the small range are sampled.
+  // It is positioned at the begin if there's no key after the random point, and the empty
+  // end is unbounded.
+  void seekRandom(rocksdb::Iterator *iter, rocksdb::ColumnFamilyHandle *cf_handle,
+                  const std::string &begin, const std::string &end);
+
   Engine::Storage *storage_;
   rocksdb::DB *db_;
   rocksdb::ColumnFamilyHandle *metadata_cf_handle_;
@@ -61,7 +124,14 @@ class SubKeyScanner : public Redis::Database {
                        const std::string &cursor,
                        uint64_t limit,
                        const std::string &subkey_prefix,
-                       std::vector<std::string> *keys);
+                       std::vector<std::string> *keys,
+                       const std::string &iter_token = "");
+  // OpenStream pins the subkeys of the key if it has at least min_size subkeys, the iterator
+  // is positioned at the first subkey and the size is read in the same snapshot, so the
+  // reply length is known before iterating. It returns NotFound if the key isn't large
+  // enough or its subkeys aren't stored one per element, and the caller reads it at once.
+  rocksdb::Status OpenStream(RedisType type, const Slice &user_key, uint64_t min_size,
+                             std::unique_ptr<Engine::ScanIterator> *stream, uint64_t *size);
 };
 
 class WriteBatchLogData {
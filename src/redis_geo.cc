@@ -0,0 +1,183 @@
+#include "redis_geo.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace Redis {
+
+rocksdb::Status Geo::Add(const Slice &user_key, std::vector<GeoPoint> *geo_points, uint8_t flags, int *ret) {
+  std::vector<MemberScore> member_scores;
+  for (auto &geo_point : *geo_points) {
+    GeoHashBits hash;
+    GeoHash::EncodeWGS84(geo_point.longitude, geo_point.latitude, GEO_STEP_MAX, &hash);
+    geo_point.score = static_cast<double>(GeoHash::Align52Bits(hash));
+    member_scores.emplace_back(MemberScore{geo_point.member, geo_point.score});
+  }
+  return ZSet::Add(user_key, flags, &member_scores, ret);
+}
+
+rocksdb::Status Geo::Dist(const Slice &user_key, const Slice &member_1, const Slice &member_2, double *dist) {
+  GeoPoint geo_point_1, geo_point_2;
+  auto s = Get(user_key, member_1, &geo_point_1);
+  if (!s.ok()) return s;
+  s = Get(user_key, member_2, &geo_point_2);
+  if (!s.ok()) return s;
+  *dist = GeoHash::GetDistance(geo_point_1.longitude, geo_point_1.latitude,
+                               geo_point_2.longitude, geo_point_2.latitude);
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status Geo::Hash(const Slice &user_key, const std::vector<Slice> &members,
+                          std::vector<std::string> *geo_hashes) {
+  geo_hashes->clear();
+  std::map<std::string, GeoPoint> geo_points;
+  auto s = Pos(user_key, members, &geo_points);
+  if (!s.ok()) return s;
+  for (const auto &member : members) {
+    auto iter = geo_points.find(member.ToString());
+    if (iter == geo_points.end()) {
+      geo_hashes->emplace_back("");
+      continue;
+    }
+    geo_hashes->emplace_back(EncodeGeoHash(iter->second.longitude, iter->second.latitude));
+  }
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status Geo::Pos(const Slice &user_key, const std::vector<Slice> &members,
+                         std::map<std::string, GeoPoint> *geo_points) {
+  geo_points->clear();
+  for (const auto &member : members) {
+    GeoPoint geo_point;
+    auto s = Get(user_key, member, &geo_point);
+    if (s.IsNotFound()) continue;
+    if (!s.ok()) return s;
+    geo_points->emplace(member.ToString(), std::move(geo_point));
+  }
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status Geo::Get(const Slice &user_key, const Slice &member, GeoPoint *geo_point) {
+  double score;
+  auto s = ZSet::Score(user_key, member, &score);
+  if (!s.ok()) return s;
+  if (!DecodeGeoHash(score, &geo_point->longitude, &geo_point->latitude)) {
+    return rocksdb::Status::NotFound("the score wasn't a valid geohash");
+  }
+  geo_point->member = member.ToString();
+  geo_point->score = score;
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status Geo::Search(const Slice &user_key, const GeoShape &shape, uint64_t count, bool any,
+                            DistanceSort sort, const std::string &store_key, bool store_distance,
+                            std::vector<GeoPoint> *geo_points) {
+  geo_points->clear();
+  GeoHashRadius n = GeoHash::CalculateAreasByShapeWGS84(shape);
+  // the scan stops early with ANY, or else all points in the shape are sorted before truncated
+  auto s = membersOfAllNeighbors(user_key, shape, n, any ? count : 0, geo_points);
+  if (!s.ok()) return s;
+
+  // COUNT without ANY returns the nearest points
+  if (count > 0 && sort == kSortNone && !any) sort = kSortASC;
+  if (sort == kSortASC) {
+    std::sort(geo_points->begin(), geo_points->end(),
+              [](const GeoPoint &a, const GeoPoint &b) { return a.dist < b.dist; });
+  } else if (sort == kSortDESC) {
+    std::sort(geo_points->begin(), geo_points->end(),
+              [](const GeoPoint &a, const GeoPoint &b) { return a.dist > b.dist; });
+  }
+  if (count > 0 && geo_points->size() > count) geo_points->resize(count);
+
+  if (store_key.empty()) return rocksdb::Status::OK();
+  if (geo_points->empty()) return Del(store_key);
+  std::vector<MemberScore> member_scores;
+  for (const auto &geo_point : *geo_points) {
+    double score = store_distance ? geo_point.dist / shape.conversion : geo_point.score;
+    member_scores.emplace_back(MemberScore{geo_point.member, score});
+  }
+  return Overwrite(store_key, member_scores);
+}
+
+rocksdb::Status Geo::membersOfAllNeighbors(const Slice &user_key, const GeoShape &shape, const GeoHashRadius &n,
+                                           uint64_t limit, std::vector<GeoPoint> *geo_points) {
+  const GeoHashBits neighbors[] = {n.hash, n.neighbors.north, n.neighbors.south, n.neighbors.east,
+                                   n.neighbors.west, n.neighbors.north_east, n.neighbors.north_west,
+                                   n.neighbors.south_east, n.neighbors.south_west};
+  // the score range of each box is [min, max), the duplicated boxes of the large radius and the
+  // adjacent boxes are merged, so fewer and longer ranges are scanned from the score column family
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  for (const auto &neighbor : neighbors) {
+    if (neighbor.IsZero()) continue;
+    GeoHashBits next = neighbor;
+    next.bits++;
+    ranges.emplace_back(GeoHash::Align52Bits(neighbor), GeoHash::Align52Bits(next));
+  }
+  std::sort(ranges.begin(), ranges.end());
+  std::vector<std::pair<uint64_t, uint64_t>> merged_ranges;
+  for (const auto &range : ranges) {
+    if (!merged_ranges.empty() && range.first <= merged_ranges.back().second) {
+      merged_ranges.back().second = std::max(merged_ranges.back().second, range.second);
+      continue;
+    }
+    merged_ranges.emplace_back(range);
+  }
+
+  std::vector<MemberScore> member_scores;
+  for (const auto &range : merged_ranges) {
+    ZRangeSpec spec;
+    spec.min = static_cast<double>(range.first);
+    spec.max = static_cast<double>(range.second);
+    spec.maxex = true;
+    auto s = RangeByScore(user_key, spec, &member_scores, nullptr);
+    if (!s.ok()) return s;
+    for (const auto &member_score : member_scores) {
+      GeoPoint geo_point;
+      if (!DecodeGeoHash(member_score.score, &geo_point.longitude, &geo_point.latitude)) continue;
+      // the boxes cover more than the shape, so the points are filtered by the exact distance
+      if (!GeoHash::GetDistanceIfInShape(shape, geo_point.longitude, geo_point.latitude, &geo_point.dist)) continue;
+      geo_point.member = member_score.member;
+      geo_point.score = member_score.score;
+      geo_points->emplace_back(std::move(geo_point));
+      if (limit > 0 && geo_points->size() >= limit) return rocksdb::Status::OK();
+    }
+  }
+  return rocksdb::Status::OK();
+}
+
+std::string Geo::EncodeGeoHash(double longitude, double latitude) {
+  // the geohash of the score uses the latitude range of EPSG:900913, so it is
+  // decoded and encoded again with the standard ranges to be a valid geohash string
+  static const char *geo_alphabet = "0123456789bcdefghjkmnpqrstuvwxyz";
+  GeoHashBits hash;
+  GeoHash::EncodeStandard(longitude, latitude, GEO_STEP_MAX, &hash);
+  std::string geo_hash;
+  for (int i = 0; i < 11; i++) {
+    // the 52 bits only cover 10 characters, the last one is always 0
+    int idx = i == 10 ? 0 : static_cast<int>((hash.bits >> (52 - ((i + 1) * 5))) & 0x1f);
+    geo_hash.push_back(geo_alphabet[idx]);
+  }
+  return geo_hash;
+}
+
+bool Geo::DecodeGeoHash(double score, double *longitude, double *latitude) {
+  GeoHashBits hash;
+  hash.bits = static_cast<uint64_t>(score);
+  hash.step = GEO_STEP_MAX;
+  double xy[2];
+  if (!GeoHash::DecodeToLongLatWGS84(hash, xy)) return false;
+  *longitude = xy[0];
+  *latitude = xy[1];
+  return true;
+}
+
+double Geo::GetUnitConversion(DistanceUnit unit) {
+  switch (unit) {
+    case kDistanceKilometers: return 1000;
+    case kDistanceMiles: return 1609.34;
+    case kDistanceFeet: return 0.3048;
+    default: return 1;
+  }
+}
+
+}  // namespace Redis
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "geohash.h"
+#include "redis_zset.h"
+
+enum DistanceUnit {
+  kDistanceMeter,
+  kDistanceKilometers,
+  kDistanceMiles,
+  kDistanceFeet,
+};
+
+enum DistanceSort {
+  kSortNone,
+  kSortASC,
+  kSortDESC,
+};
+
+struct GeoPoint {
+  double longitude = 0;
+  double latitude = 0;
+  std::string member;
+  double dist = 0;
+  double score = 0;
+};
+
+namespace Redis {
+
+// Geo stores the points as the members of the sorted set, whose scores are the 52 bits
+// geohash of the points, so the search is done by the score ranges of the boxes
+class Geo : public ZSet {
+ public:
+  explicit Geo(Engine::Storage *storage, const std::string &ns) : ZSet(storage, ns) {}
+  rocksdb::Status Add(const Slice &user_key, std::vector<GeoPoint> *geo_points, uint8_t flags, int *ret);
+  rocksdb::Status Dist(const Slice &user_key, const Slice &member_1, const Slice &member_2, double *dist);
+  // Hash returns the standard geohash strings of the members, it is empty for the missing member
+  rocksdb::Status Hash(const Slice &user_key, const std::vector<Slice> &members, std::vector<std::string> *geo_hashes);
+  rocksdb::Status Pos(const Slice &user_key, const std::vector<Slice> &members,
+                      std::map<std::string, GeoPoint> *geo_points);
+  rocksdb::Status Get(const Slice &user_key, const Slice &member, GeoPoint *geo_point);
+  // Search returns at most count(0 is unlimited) points in the shape, and stores them into the
+  // store key with the geohash or distance scores if the store key isn't empty
+  rocksdb::Status Search(const Slice &user_key, const GeoShape &shape, uint64_t count, bool any,
+                         DistanceSort sort, const std::string &store_key, bool store_distance,
+                         std::vector<GeoPoint> *geo_points);
+
+  static std::string EncodeGeoHash(double longitude, double latitude);
+  static bool DecodeGeoHash(double score, double *longitude, double *latitude);
+  static double GetUnitConversion(DistanceUnit unit);
+
+ private:
+  rocksdb::Status membersOfAllNeighbors(const Slice &user_key, const GeoShape &shape, const GeoHashRadius &n,
+                                        uint64_t limit, std::vector<GeoPoint> *geo_points);
+};
+
+}  // namespace Redis
@@ -3,17 +3,61 @@
 #include <limits>
 #include <iostream>
 
+#include "merge_operator.h"
+
 namespace Redis {
 rocksdb::Status Hash::GetMetadata(const Slice &ns_key, HashMetadata *metadata) {
   return Database::GetMetadata(kRedisHash, ns_key, metadata);
 }
 
+rocksdb::Status Hash::getField(const Slice &ns_key, const HashMetadata &metadata, const Slice &field,
+                               const rocksdb::ReadOptions &read_options, std::string *value) {
+  if (metadata.IsInline()) {
+    auto iter = metadata.inline_fields.find(field.ToString());
+    if (iter == metadata.inline_fields.end()) return rocksdb::Status::NotFound();
+    *value = iter->second;
+    return rocksdb::Status::OK();
+  }
+  std::string sub_key;
+  InternalKey(ns_key, field, metadata.version).Encode(&sub_key);
+  return storage_->Get(read_options, subkey_cf_handle_, sub_key, value);
+}
+
+bool Hash::fitsInline(const HashMetadata &metadata) {
+  auto config = storage_->GetConfig();
+  if (metadata.inline_fields.size() > static_cast<size_t>(config->hash_inline_max_entries)) return false;
+  auto max_value = static_cast<size_t>(config->hash_inline_max_value);
+  for (const auto &iter : metadata.inline_fields) {
+    if (iter.first.size() > max_value || iter.second.size() > max_value) return false;
+  }
+  return true;
+}
+
+// putMetadata writes the metadata of the hash, and the inlined fields would be
+// moved out to the sub keys once the hash grows past the inline thresholds
+void Hash::putMetadata(const Slice &ns_key, HashMetadata *metadata, rocksdb::WriteBatch *batch) {
+  if (metadata->IsInline()) {
+    metadata->size = static_cast<uint32_t>(metadata->inline_fields.size());
+    if (!fitsInline(*metadata)) {
+      std::string sub_key;
+      for (const auto &iter : metadata->inline_fields) {
+        InternalKey(ns_key, iter.first, metadata->version).Encode(&sub_key);
+        batch->Put(subkey_cf_handle_, sub_key, iter.second);
+      }
+      metadata->DisableInline();
+    }
+  }
+  std::string bytes;
+  metadata->Encode(&bytes);
+  batch->Put(metadata_cf_handle_, ns_key, bytes);
+}
+
 rocksdb::Status Hash::Size(const Slice &user_key, uint32_t *ret) {
   *ret = 0;
 
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
-  HashMetadata metadata;
+  HashMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s;
   *ret = metadata.size;
@@ -23,15 +67,40 @@ rocksdb::Status Hash::Size(const Slice &user_key, uint32_t *ret) {
 rocksdb::Status Hash::Get(const Slice &user_key, const Slice &field, std::string *value) {
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
-  HashMetadata metadata;
+  HashMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s;
-  LatestSnapShot ss(db_);
-  rocksdb::ReadOptions read_options;
-  read_options.snapshot = ss.GetSnapShot();
-  std::string sub_key;
+  return getField(ns_key, metadata, field, rocksdb::ReadOptions(), value);
+}
+
+// mergeIncrBy merges the increment into the existing integer field under the key lock, like
+// String::mergeIncrBy, but the field is always read since only the metadata is cached. It returns
+// NotSupported for the field which can't be merged.
+rocksdb::Status Hash::mergeIncrBy(const Slice &ns_key, const Slice &field, int64_t increment, int64_t *ret) {
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  HashMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok() || metadata.IsInline()) return rocksdb::Status::NotSupported();
+
+  std::string sub_key, value_bytes;
   InternalKey(ns_key, field, metadata.version).Encode(&sub_key);
-  return db_->Get(read_options, sub_key, value);
+  s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value_bytes);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  int64_t old_value = 0;
+  if (s.IsNotFound() || !Engine::CounterMergeOperator::ParseValue(value_bytes, &old_value)) {
+    return rocksdb::Status::NotSupported();
+  }
+  if ((increment < 0 && old_value < 0 && increment < (LLONG_MIN-old_value))
+      || (increment > 0 && old_value > 0 && increment > (LLONG_MAX-old_value))) {
+    return rocksdb::Status::InvalidArgument("increment or decrement would overflow");
+  }
+
+  *ret = old_value + increment;
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisHash);
+  batch.PutLogData(log_data.Encode());
+  batch.Merge(subkey_cf_handle_, sub_key, Engine::CounterMergeOperator::EncodeOperand(increment));
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
 }
 
 rocksdb::Status Hash::IncrBy(const Slice &user_key, const Slice &field, int64_t increment, int64_t *ret) {
@@ -41,16 +110,22 @@ rocksdb::Status Hash::IncrBy(const Slice &user_key, const Slice &field, int64_t
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
+  if (storage_->GetConfig()->counter_merge_mode && !storage_->InTxn()) {
+    rocksdb::Status s = mergeIncrBy(ns_key, field, increment, ret);
+    if (!s.IsNotSupported()) return s;
+  }
+
   LockGuard guard(storage_->GetLockManager(), ns_key);
   HashMetadata metadata;
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.IsNotFound() && storage_->GetConfig()->hash_inline_max_entries > 0) metadata.EnableInline();
 
   std::string sub_key;
   InternalKey(ns_key, field, metadata.version).Encode(&sub_key);
   if (s.ok()) {
     std::string value_bytes;
-    s = db_->Get(rocksdb::ReadOptions(), sub_key, &value_bytes);
+    s = getField(ns_key, metadata, field, rocksdb::ReadOptions(), &value_bytes);
     if (!s.ok() && !s.IsNotFound()) return s;
     if (s.ok()) {
       try {
@@ -70,7 +145,12 @@ rocksdb::Status Hash::IncrBy(const Slice &user_key, const Slice &field, int64_t
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisHash);
   batch.PutLogData(log_data.Encode());
-  batch.Put(sub_key, std::to_string(*ret));
+  if (metadata.IsInline()) {
+    metadata.inline_fields[field.ToString()] = std::to_string(*ret);
+    putMetadata(ns_key, &metadata, &batch);
+    return storage_->Write(rocksdb::WriteOptions(), &batch);
+  }
+  batch.Put(subkey_cf_handle_, sub_key, std::to_string(*ret));
   if (!exists) {
     metadata.size += 1;
     std::string bytes;
@@ -91,12 +171,13 @@ rocksdb::Status Hash::IncrByFloat(const Slice &user_key, const Slice &field, flo
   HashMetadata metadata;
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.IsNotFound() && storage_->GetConfig()->hash_inline_max_entries > 0) metadata.EnableInline();
 
   std::string sub_key;
   InternalKey(ns_key, field, metadata.version).Encode(&sub_key);
   if (s.ok()) {
     std::string value_bytes;
-    s = db_->Get(rocksdb::ReadOptions(), sub_key, &value_bytes);
+    s = getField(ns_key, metadata, field, rocksdb::ReadOptions(), &value_bytes);
     if (!s.ok() && !s.IsNotFound()) return s;
     if (s.ok()) {
       try {
@@ -116,7 +197,12 @@ rocksdb::Status Hash::IncrByFloat(const Slice &user_key, const Slice &field, flo
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisHash);
   batch.PutLogData(log_data.Encode());
-  batch.Put(sub_key, std::to_string(*ret));
+  if (metadata.IsInline()) {
+    metadata.inline_fields[field.ToString()] = std::to_string(*ret);
+    putMetadata(ns_key, &metadata, &batch);
+    return storage_->Write(rocksdb::WriteOptions(), &batch);
+  }
+  batch.Put(subkey_cf_handle_, sub_key, std::to_string(*ret));
   if (!exists) {
     metadata.size += 1;
     std::string bytes;
@@ -133,22 +219,38 @@ rocksdb::Status Hash::MGet(const Slice &user_key,
 
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
-  HashMetadata metadata;
+  HashMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) {
     return s;
   }
+  if (metadata.IsInline()) {
+    for (const auto &field : fields) {
+      auto iter = metadata.inline_fields.find(field.ToString());
+      values->emplace_back(iter != metadata.inline_fields.end() ? iter->second : std::string());
+    }
+    return rocksdb::Status::OK();
+  }
 
-  LatestSnapShot ss(db_);
+  std::vector<std::string> sub_keys(fields.size());
+  std::vector<Slice> slice_keys;
+  slice_keys.reserve(fields.size());
+  for (size_t i = 0; i < fields.size(); i++) {
+    InternalKey(ns_key, fields[i], metadata.version).Encode(&sub_keys[i]);
+    slice_keys.emplace_back(sub_keys[i]);
+  }
+
+  // the MultiGet reads all fields at the same implicit snapshot
   rocksdb::ReadOptions read_options;
-  read_options.snapshot = ss.GetSnapShot();
-  std::string sub_key, value;
-  for (const auto &field : fields) {
-    InternalKey(ns_key, field, metadata.version).Encode(&sub_key);
-    value.clear();
-    auto s = db_->Get(read_options, sub_key, &value);
-    if (!s.ok() && !s.IsNotFound()) return s;
-    values->emplace_back(value);
+  std::vector<std::string> field_values;
+  std::vector<rocksdb::ColumnFamilyHandle *> cf_handles(slice_keys.size(), subkey_cf_handle_);
+  auto statuses = storage_->MultiGet(read_options, cf_handles, slice_keys, &field_values);
+  for (size_t i = 0; i < fields.size(); i++) {
+    if (!statuses[i].ok() && !statuses[i].IsNotFound()) {
+      values->clear();
+      return statuses[i];
+    }
+    values->emplace_back(statuses[i].ok() ? std::move(field_values[i]) : std::string());
   }
   return rocksdb::Status::OK();
 }
@@ -172,7 +274,7 @@ rocksdb::Status Hash::Delete(const Slice &user_key, const std::vector<Slice> &fi
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  HashMetadata metadata;
+  HashMetadata metadata(false);
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisHash);
   batch.PutLogData(log_data.Encode());
@@ -180,22 +282,31 @@ rocksdb::Status Hash::Delete(const Slice &user_key, const std::vector<Slice> &fi
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
-  std::string sub_key, value;
+  if (metadata.IsInline()) {
+    for (const auto &field : fields) {
+      *ret += static_cast<int>(metadata.inline_fields.erase(field.ToString()));
+    }
+    if (*ret == 0) return rocksdb::Status::OK();
+    putMetadata(ns_key, &metadata, &batch);
+    return storage_->Write(rocksdb::WriteOptions(), &batch);
+  }
+
+  std::string value;
+  InternalKeyBuilder sub_keys(ns_key, metadata.version);
   for (const auto &field : fields) {
-    InternalKey(ns_key, field, metadata.version).Encode(&sub_key);
-    s = db_->Get(rocksdb::ReadOptions(), sub_key, &value);
+    Slice sub_key = sub_keys.Build(field);
+    s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value);
     if (s.ok()) {
       *ret += 1;
-      batch.Delete(sub_key);
+      batch.Delete(subkey_cf_handle_, sub_key);
     }
   }
+  if (*ret == 0) return rocksdb::Status::OK();
   // size was updated
-  if (*ret > 0) {
-    metadata.size -= *ret;
-    std::string bytes;
-    metadata.Encode(&bytes);
-    batch.Put(metadata_cf_handle_, ns_key, bytes);
-  }
+  metadata.size -= *ret;
+  std::string bytes;
+  metadata.Encode(&bytes);
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
   return storage_->Write(rocksdb::WriteOptions(), &batch);
 }
 
@@ -208,18 +319,37 @@ rocksdb::Status Hash::MSet(const Slice &user_key, const std::vector<FieldValue>
   HashMetadata metadata;
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.IsNotFound() && storage_->GetConfig()->hash_inline_max_entries > 0) metadata.EnableInline();
 
   int added = 0;
   bool exists = false;
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisHash);
   batch.PutLogData(log_data.Encode());
+  if (metadata.IsInline()) {
+    bool changed = false;
+    for (const auto &fv : field_values) {
+      auto iter = metadata.inline_fields.find(fv.field);
+      if (iter != metadata.inline_fields.end()) {
+        if (iter->second == fv.value || nx) continue;
+        iter->second = fv.value;
+      } else {
+        metadata.inline_fields.emplace(fv.field, fv.value);
+        added++;
+      }
+      changed = true;
+    }
+    if (!changed) return rocksdb::Status::OK();
+    *ret = added;
+    putMetadata(ns_key, &metadata, &batch);
+    return storage_->Write(rocksdb::WriteOptions(), &batch);
+  }
+  InternalKeyBuilder sub_keys(ns_key, metadata.version);
   for (const auto &fv : field_values) {
-    std::string sub_key;
-    InternalKey(ns_key, fv.field, metadata.version).Encode(&sub_key);
+    Slice sub_key = sub_keys.Build(fv.field);
     if (metadata.size > 0) {
       std::string fieldValue;
-      s = db_->Get(rocksdb::ReadOptions(), sub_key, &fieldValue);
+      s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &fieldValue);
       if (!s.ok() && !s.IsNotFound()) return s;
       if (s.ok()) {
         if (((fieldValue == fv.value) || nx)) continue;
@@ -227,7 +357,7 @@ rocksdb::Status Hash::MSet(const Slice &user_key, const std::vector<FieldValue>
       }
     }
     if (!exists) added++;
-    batch.Put(sub_key, fv.value);
+    batch.Put(subkey_cf_handle_, sub_key, fv.value);
   }
   if (added > 0) {
     *ret = added;
@@ -244,15 +374,26 @@ rocksdb::Status Hash::GetAll(const Slice &user_key, std::vector<FieldValue> *fie
 
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
-  HashMetadata metadata;
+  HashMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
+  if (metadata.IsInline()) {
+    for (const auto &iter : metadata.inline_fields) {
+      FieldValue fv;
+      if (type != HashFetchType::kOnlyValue) fv.field = iter.first;
+      if (type != HashFetchType::kOnlyKey) fv.value = iter.second;
+      field_values->emplace_back(fv);
+    }
+    return rocksdb::Status::OK();
+  }
+
   LatestSnapShot ss(db_);
   rocksdb::ReadOptions read_options;
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options);
+  read_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(read_options, subkey_cf_handle_);
   std::string prefix_key;
   InternalKey(ns_key, "", metadata.version).Encode(&prefix_key);
   for (iter->Seek(prefix_key);
@@ -279,8 +420,25 @@ rocksdb::Status Hash::Scan(const Slice &user_key,
                                 const std::string &cursor,
                                 uint64_t limit,
                                 const std::string &field_prefix,
-                                std::vector<std::string> *fields) {
-  return SubKeyScanner::Scan(kRedisHash, user_key, cursor, limit, field_prefix, fields);
+                                std::vector<std::string> *fields,
+                                const std::string &iter_token) {
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+  HashMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok()) return s;
+  if (!metadata.IsInline()) {
+    return SubKeyScanner::Scan(kRedisHash, user_key, cursor, limit, field_prefix, fields, iter_token);
+  }
+
+  // the inlined fields are sorted like the sub keys, so the cursor works the same
+  auto iter = cursor.empty() ? metadata.inline_fields.lower_bound(field_prefix)
+                             : metadata.inline_fields.upper_bound(cursor);
+  for (; iter != metadata.inline_fields.end() && fields->size() < limit; ++iter) {
+    if (!Slice(iter->first).starts_with(field_prefix)) break;
+    fields->emplace_back(iter->first);
+  }
+  return rocksdb::Status::OK();
 }
 
 }  // namespace Redis
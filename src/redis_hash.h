@@ -22,7 +22,9 @@ enum class HashFetchType {
 namespace Redis {
 class Hash : public SubKeyScanner {
  public:
-  Hash(Engine::Storage *storage, const std::string &ns) : SubKeyScanner(storage, ns) {}
+  Hash(Engine::Storage *storage, const std::string &ns)
+      : SubKeyScanner(storage, ns),
+        subkey_cf_handle_(storage->GetSubKeyCFHandle(kRedisHash)) {}
   rocksdb::Status Size(const Slice &user_key, uint32_t *ret);
   rocksdb::Status Get(const Slice &user_key, const Slice &field, std::string *value);
   rocksdb::Status Set(const Slice &user_key, const Slice &field, const Slice &value, int *ret);
@@ -39,8 +41,16 @@ class Hash : public SubKeyScanner {
                        const std::string &cursor,
                        uint64_t limit,
                        const std::string &field_prefix,
-                       std::vector<std::string> *fields);
+                       std::vector<std::string> *fields,
+                       const std::string &iter_token = "");
  private:
   rocksdb::Status GetMetadata(const Slice &ns_key, HashMetadata *metadata);
+  rocksdb::Status getField(const Slice &ns_key, const HashMetadata &metadata, const Slice &field,
+                           const rocksdb::ReadOptions &read_options, std::string *value);
+  bool fitsInline(const HashMetadata &metadata);
+  void putMetadata(const Slice &ns_key, HashMetadata *metadata, rocksdb::WriteBatch *batch);
+  rocksdb::Status mergeIncrBy(const Slice &ns_key, const Slice &field, int64_t increment, int64_t *ret);
+
+  rocksdb::ColumnFamilyHandle *subkey_cf_handle_;
 };
 }  // namespace Redis
@@ -0,0 +1,304 @@
+#include "redis_hyperloglog.h"
+
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace Redis {
+
+// the bits of the hash after the register index, the position of the first set bit is at most q + 1
+static const int kHyperLogLogQ = 64 - kHyperLogLogRegisterBits;
+static const double kHyperLogLogAlphaInf = 0.721347520444481703680;
+
+// murmurHash64A is the same hash used by redis, so the estimates are comparable
+static uint64_t murmurHash64A(const char *key, size_t len, uint64_t seed) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (len * m);
+  auto data = reinterpret_cast<const uint8_t *>(key);
+  const uint8_t *end = data + (len - (len & 7));
+  for (; data != end; data += 8) {
+    uint64_t k = 0;
+    for (int i = 7; i >= 0; i--) k = (k << 8) | data[i];
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+  switch (len & 7) {
+    case 7: h ^= static_cast<uint64_t>(data[6]) << 48;  // fall through
+    case 6: h ^= static_cast<uint64_t>(data[5]) << 40;  // fall through
+    case 5: h ^= static_cast<uint64_t>(data[4]) << 32;  // fall through
+    case 4: h ^= static_cast<uint64_t>(data[3]) << 24;  // fall through
+    case 3: h ^= static_cast<uint64_t>(data[2]) << 16;  // fall through
+    case 2: h ^= static_cast<uint64_t>(data[1]) << 8;   // fall through
+    case 1:
+      h ^= static_cast<uint64_t>(data[0]);
+      h *= m;
+  }
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+void HyperLogLog::HashElement(const Slice &element, uint32_t *index, uint8_t *count) {
+  uint64_t hash = murmurHash64A(element.data(), element.size(), 0xadc83b19ULL);
+  *index = static_cast<uint32_t>(hash & (kHyperLogLogRegisters - 1));
+  // the sentinel bit makes sure that the count is at most q + 1
+  hash >>= kHyperLogLogRegisterBits;
+  hash |= 1ULL << kHyperLogLogQ;
+  *count = static_cast<uint8_t>(__builtin_ctzll(hash) + 1);
+}
+
+void HyperLogLog::MergeRegisters(uint8_t *dst, const uint8_t *src, size_t n) {
+  // the registers are less than 0x80, so the max of eight registers is taken at once
+  // in a word: the high bit of each byte of (a|0x80) - b is set if a >= b, and no
+  // byte borrows from the next one
+  const uint64_t high_bits = 0x8080808080808080ULL;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t a, b;
+    memcpy(&a, dst + i, sizeof(a));
+    memcpy(&b, src + i, sizeof(b));
+    uint64_t ge = ((a | high_bits) - b) & high_bits;
+    uint64_t mask = (ge >> 7) * 0xff;
+    uint64_t max = (a & mask) | (b & ~mask);
+    memcpy(dst + i, &max, sizeof(max));
+  }
+  for (; i < n; i++) {
+    if (src[i] > dst[i]) dst[i] = src[i];
+  }
+}
+
+static double hllSigma(double x) {
+  if (x == 1.) return INFINITY;
+  double z_prime, y = 1, z = x;
+  do {
+    x *= x;
+    z_prime = z;
+    z += x * y;
+    y += y;
+  } while (z_prime != z);
+  return z;
+}
+
+static double hllTau(double x) {
+  if (x == 0. || x == 1.) return 0.;
+  double z_prime, y = 1.0, z = 1 - x;
+  do {
+    x = sqrt(x);
+    z_prime = z;
+    y *= 0.5;
+    z -= pow(1 - x, 2) * y;
+  } while (z_prime != z);
+  return z / 3;
+}
+
+uint64_t HyperLogLog::Estimate(const uint8_t *registers) {
+  // the estimator of Otmar Ertl which redis uses, it needs no bias correction for the small
+  // or large cardinalities, and only the histogram of the registers is used
+  uint32_t histogram[64] = {0};
+  for (uint32_t i = 0; i < kHyperLogLogRegisters; i++) histogram[registers[i] & 63]++;
+  double m = kHyperLogLogRegisters;
+  double z = m * hllTau((m - histogram[kHyperLogLogQ + 1]) / m);
+  for (int j = kHyperLogLogQ; j >= 1; --j) {
+    z += histogram[j];
+    z *= 0.5;
+  }
+  z += m * hllSigma(histogram[0] / m);
+  return static_cast<uint64_t>(llroundl(kHyperLogLogAlphaInf * m * m / z));
+}
+
+rocksdb::Status HyperLogLog::GetMetadata(const Slice &ns_key, HyperLogLogMetadata *metadata) {
+  return Database::GetMetadata(kRedisHyperLogLog, ns_key, metadata);
+}
+
+rocksdb::Status HyperLogLog::mergeInto(const Slice &ns_key, const HyperLogLogMetadata &metadata,
+                                       const rocksdb::ReadOptions &read_options, std::string *registers) {
+  auto dst = reinterpret_cast<uint8_t *>(&(*registers)[0]);
+  if (metadata.IsSparse()) {
+    for (const auto &iter : metadata.sparse_registers) {
+      if (iter.first < kHyperLogLogRegisters && iter.second > dst[iter.first]) dst[iter.first] = iter.second;
+    }
+    return rocksdb::Status::OK();
+  }
+  std::string prefix_key;
+  InternalKey(ns_key, "", metadata.version).Encode(&prefix_key);
+  rocksdb::ReadOptions iter_options(read_options);
+  iter_options.prefix_same_as_start = true;
+  std::unique_ptr<rocksdb::Iterator> iter(storage_->NewIterator(iter_options, subkey_cf_handle_));
+  for (iter->Seek(prefix_key); iter->Valid() && iter->key().starts_with(prefix_key); iter->Next()) {
+    InternalKey ikey(iter->key());
+    uint32_t offset = static_cast<uint32_t>(std::stoul(ikey.GetSubKey().ToString()));
+    auto value = iter->value();
+    if (offset >= kHyperLogLogRegisters) continue;
+    size_t n = std::min(value.size(), static_cast<size_t>(kHyperLogLogRegisters - offset));
+    MergeRegisters(dst + offset, reinterpret_cast<const uint8_t *>(value.data()), n);
+  }
+  return iter->status();
+}
+
+void HyperLogLog::writeDense(const Slice &ns_key, const HyperLogLogMetadata &metadata,
+                             const std::string &registers, rocksdb::WriteBatch *batch) {
+  static const std::string empty_segment(kHyperLogLogSegmentBytes, 0);
+  std::string sub_key;
+  for (uint32_t offset = 0; offset < kHyperLogLogRegisters; offset += kHyperLogLogSegmentBytes) {
+    Slice segment(registers.data() + offset, kHyperLogLogSegmentBytes);
+    if (segment == empty_segment) continue;
+    InternalKey(ns_key, std::to_string(offset), metadata.version).Encode(&sub_key);
+    batch->Put(subkey_cf_handle_, sub_key, segment);
+  }
+}
+
+rocksdb::Status HyperLogLog::Add(const Slice &user_key, const std::vector<Slice> &elements, int *ret) {
+  *ret = 0;
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  HyperLogLogMetadata metadata;
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.IsNotFound()) {
+    // the empty hyperloglog can't be stored since the key without elements is missing
+    *ret = 1;
+    metadata.EnableSparse();
+  }
+
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisHyperLogLog);
+  batch.PutLogData(log_data.Encode());
+  uint32_t index;
+  uint8_t count;
+  bool changed = false;
+  if (metadata.IsSparse()) {
+    for (const auto &element : elements) {
+      HashElement(element, &index, &count);
+      auto &reg = metadata.sparse_registers[index];
+      if (count > reg) {
+        reg = count;
+        changed = true;
+      }
+    }
+    metadata.size = static_cast<uint32_t>(metadata.sparse_registers.size());
+    if (metadata.size > kHyperLogLogSparseMaxRegisters) {
+      std::string registers(kHyperLogLogRegisters, 0);
+      for (const auto &iter : metadata.sparse_registers) registers[iter.first] = static_cast<char>(iter.second);
+      metadata.DisableSparse();
+      writeDense(ns_key, metadata, registers, &batch);
+    }
+  } else {
+    // the updates are grouped by the segment, so each segment is read and written once
+    std::map<uint32_t, std::vector<std::pair<uint32_t, uint8_t>>> segment_updates;
+    for (const auto &element : elements) {
+      HashElement(element, &index, &count);
+      segment_updates[index / kHyperLogLogSegmentBytes].emplace_back(index % kHyperLogLogSegmentBytes, count);
+    }
+    std::string sub_key, value;
+    for (const auto &iter : segment_updates) {
+      InternalKey(ns_key, std::to_string(iter.first * kHyperLogLogSegmentBytes), metadata.version).Encode(&sub_key);
+      s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value);
+      if (!s.ok() && !s.IsNotFound()) return s;
+      if (s.IsNotFound()) value.clear();
+      value.resize(kHyperLogLogSegmentBytes, 0);
+      bool segment_changed = false;
+      for (const auto &update : iter.second) {
+        auto reg = static_cast<uint8_t>(value[update.first]);
+        if (update.second <= reg) continue;
+        if (reg == 0) metadata.size++;
+        value[update.first] = static_cast<char>(update.second);
+        segment_changed = true;
+      }
+      if (segment_changed) batch.Put(subkey_cf_handle_, sub_key, value);
+      changed |= segment_changed;
+    }
+  }
+  if (!changed) return rocksdb::Status::OK();
+  *ret = 1;
+  std::string bytes;
+  metadata.Encode(&bytes);
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+rocksdb::Status HyperLogLog::Count(const std::vector<Slice> &user_keys, uint64_t *ret) {
+  *ret = 0;
+  LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = ss.GetSnapShot();
+  // the registers of all keys are merged before estimating, as the union of them
+  std::string registers(kHyperLogLogRegisters, 0);
+  std::string ns_key;
+  for (const auto &user_key : user_keys) {
+    AppendNamespacePrefix(user_key, &ns_key);
+    HyperLogLogMetadata metadata(false);
+    auto s = GetMetadata(ns_key, &metadata);
+    if (s.IsNotFound()) continue;
+    if (!s.ok()) return s;
+    s = mergeInto(ns_key, metadata, read_options, &registers);
+    if (!s.ok()) return s;
+  }
+  *ret = Estimate(reinterpret_cast<const uint8_t *>(registers.data()));
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status HyperLogLog::Merge(const Slice &dest_user_key, const std::vector<Slice> &src_user_keys) {
+  std::string ns_key;
+  AppendNamespacePrefix(dest_user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = ss.GetSnapShot();
+  std::string registers(kHyperLogLogRegisters, 0);
+  HyperLogLogMetadata dest_metadata(false);
+  auto s = GetMetadata(ns_key, &dest_metadata);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.ok()) {
+    s = mergeInto(ns_key, dest_metadata, read_options, &registers);
+    if (!s.ok()) return s;
+  }
+  std::string src_ns_key;
+  for (const auto &src_user_key : src_user_keys) {
+    AppendNamespacePrefix(src_user_key, &src_ns_key);
+    HyperLogLogMetadata metadata(false);
+    s = GetMetadata(src_ns_key, &metadata);
+    if (s.IsNotFound()) continue;
+    if (!s.ok()) return s;
+    s = mergeInto(src_ns_key, metadata, read_options, &registers);
+    if (!s.ok()) return s;
+  }
+  uint32_t size = 0;
+  for (const auto &reg : registers) {
+    if (reg != 0) size++;
+  }
+  if (size == 0) return rocksdb::Status::OK();
+
+  // the dest is rewritten in the new version, and the old segments are dropped by the compaction
+  HyperLogLogMetadata metadata;
+  metadata.expire = dest_metadata.expire;
+  metadata.size = size;
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisHyperLogLog);
+  batch.PutLogData(log_data.Encode());
+  if (size <= kHyperLogLogSparseMaxRegisters) {
+    metadata.EnableSparse();
+    for (uint32_t i = 0; i < kHyperLogLogRegisters; i++) {
+      if (registers[i] != 0) metadata.sparse_registers[i] = static_cast<uint8_t>(registers[i]);
+    }
+  } else {
+    writeDense(ns_key, metadata, registers, &batch);
+  }
+  std::string bytes;
+  metadata.Encode(&bytes);
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+}  // namespace Redis
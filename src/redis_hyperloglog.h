@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "redis_db.h"
+#include "redis_metadata.h"
+
+namespace Redis {
+
+// the same precision as redis, 2^14 registers and the standard error is 0.81%
+const uint32_t kHyperLogLogRegisterBits = 14;
+const uint32_t kHyperLogLogRegisters = 1 << kHyperLogLogRegisterBits;
+// each register takes one byte, so the dense registers are split into 16 segments
+const uint32_t kHyperLogLogSegmentBytes = 1024;
+// the hyperloglog is kept sparse in the metadata til it has more non-zero registers
+const uint32_t kHyperLogLogSparseMaxRegisters = 512;
+
+class HyperLogLog : public Database {
+ public:
+  explicit HyperLogLog(Engine::Storage *storage, const std::string &ns)
+      : Database(storage, ns),
+        subkey_cf_handle_(storage->GetSubKeyCFHandle(kRedisHyperLogLog)) {}
+  // Add sets ret to 1 if any register is changed by the elements, or the key is created
+  rocksdb::Status Add(const Slice &user_key, const std::vector<Slice> &elements, int *ret);
+  // Count estimates the cardinality of the union of the keys, the missing keys are empty
+  rocksdb::Status Count(const std::vector<Slice> &user_keys, uint64_t *ret);
+  // Merge writes the union of the dest and the source keys into the dest
+  rocksdb::Status Merge(const Slice &dest_user_key, const std::vector<Slice> &src_user_keys);
+
+  // HashElement returns the register index of the element and the position of the first set bit
+  static void HashElement(const Slice &element, uint32_t *index, uint8_t *count);
+  // MergeRegisters takes the max of each of the n registers into dst
+  static void MergeRegisters(uint8_t *dst, const uint8_t *src, size_t n);
+  // Estimate returns the cardinality of the dense registers
+  static uint64_t Estimate(const uint8_t *registers);
+
+ private:
+  rocksdb::Status GetMetadata(const Slice &ns_key, HyperLogLogMetadata *metadata);
+  // mergeInto merges the registers of the key into the dense registers
+  rocksdb::Status mergeInto(const Slice &ns_key, const HyperLogLogMetadata &metadata,
+                            const rocksdb::ReadOptions &read_options, std::string *registers);
+  // writeDense writes the non-empty segments of the dense registers in the version of the metadata
+  void writeDense(const Slice &ns_key, const HyperLogLogMetadata &metadata,
+                  const std::string &registers, rocksdb::WriteBatch *batch);
+
+  rocksdb::ColumnFamilyHandle *subkey_cf_handle_;
+};
+
+}  // namespace Redis
@@ -1,8 +1,28 @@
 #include "redis_list.h"
 
+#include <algorithm>
+
 #include "stdlib.h"
 namespace Redis {
 
+const char kListChunkIndexTag = 'i';
+const char kListChunkDataTag = 'd';
+// used by the chunked list after list-chunk-size is set to 0
+const uint32_t kDefaultListChunkSize = 128;
+
+static void encodeChunkIndexKey(const Slice &ns_key, uint64_t version, uint64_t start, std::string *key) {
+  std::string sub_key;
+  sub_key.push_back(kListChunkIndexTag);
+  PutFixed64(&sub_key, start);
+  InternalKey(ns_key, sub_key, version).Encode(key);
+}
+
+static void encodeChunkDataKey(const Slice &ns_key, uint64_t version, uint64_t id, std::string *key) {
+  std::string sub_key;
+  List::EncodeChunkDataSubKey(id, &sub_key);
+  InternalKey(ns_key, sub_key, version).Encode(key);
+}
+
 rocksdb::Status List::GetMetadata(const Slice &ns_key, ListMetadata *metadata) {
   return Database::GetMetadata(kRedisList, ns_key, metadata);
 }
@@ -12,7 +32,7 @@ rocksdb::Status List::Size(const Slice &user_key, uint32_t *ret) {
 
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
-  ListMetadata metadata;
+  ListMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
   *ret = metadata.size;
@@ -39,25 +59,37 @@ rocksdb::Status List::push(const Slice &user_key,
   ListMetadata metadata;
   rocksdb::WriteBatch batch;
   RedisCommand cmd = left ? kRedisCmdLPush : kRedisCmdRPush;
-  WriteBatchLogData log_data(kRedisList, {std::to_string(cmd)});
-  batch.PutLogData(log_data.Encode());
   LockGuard guard(storage_->GetLockManager(), ns_key);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok() && !create_if_missing && s.IsNotFound()) {
     return s.IsNotFound() ? rocksdb::Status::OK() : s;
   }
-  uint64_t index = left ? metadata.head - 1 : metadata.tail;
-  for (const auto &elem : elems) {
-    std::string index_buf, sub_key;
-    PutFixed64(&index_buf, index);
-    InternalKey(ns_key, index_buf, metadata.version).Encode(&sub_key);
-    batch.Put(sub_key, elem);
-    left ? --index : ++index;
+  if (s.IsNotFound() && storage_->GetConfig()->list_chunk_size > 0) metadata.EnableChunks();
+
+  std::vector<std::string> log_args{std::to_string(cmd)};
+  if (metadata.IsChunked()) {
+    // the chunks are rewritten as a whole, so the pushed elements must be logged
+    for (const auto &elem : elems) log_args.emplace_back(elem.ToString());
   }
-  if (left) {
-    metadata.head -= elems.size();
+  WriteBatchLogData log_data(kRedisList, log_args);
+  batch.PutLogData(log_data.Encode());
+  if (metadata.IsChunked()) {
+    s = pushChunked(ns_key, &metadata, elems, left, &batch);
+    if (!s.ok()) return s;
   } else {
-    metadata.tail += elems.size();
+    uint64_t index = left ? metadata.head - 1 : metadata.tail;
+    for (const auto &elem : elems) {
+      std::string index_buf, sub_key;
+      PutFixed64(&index_buf, index);
+      InternalKey(ns_key, index_buf, metadata.version).Encode(&sub_key);
+      batch.Put(subkey_cf_handle_, sub_key, elem);
+      left ? --index : ++index;
+    }
+    if (left) {
+      metadata.head -= elems.size();
+    } else {
+      metadata.tail += elems.size();
+    }
   }
   std::string bytes;
   metadata.size += elems.size();
@@ -74,25 +106,30 @@ rocksdb::Status List::Pop(const Slice &user_key, std::string *elem, bool left) {
   AppendNamespacePrefix(user_key, &ns_key);
 
   LockGuard guard(storage_->GetLockManager(), ns_key);
-  ListMetadata metadata;
+  ListMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s;
 
-  uint64_t index = left ? metadata.head : metadata.tail - 1;
-  std::string buf;
-  PutFixed64(&buf, index);
-  std::string sub_key;
-  InternalKey(ns_key, buf, metadata.version).Encode(&sub_key);
-  s = db_->Get(rocksdb::ReadOptions(), sub_key, elem);
-  if (!s.ok()) {
-    // FIXME: should be always exists??
-    return s;
-  }
   rocksdb::WriteBatch batch;
   RedisCommand cmd = left ? kRedisCmdLPop : kRedisCmdRPop;
   WriteBatchLogData log_data(kRedisList, {std::to_string(cmd)});
   batch.PutLogData(log_data.Encode());
-  batch.Delete(sub_key);
+  if (metadata.IsChunked()) {
+    s = popChunked(ns_key, &metadata, left, elem, &batch);
+    if (!s.ok()) return s;
+  } else {
+    uint64_t index = left ? metadata.head : metadata.tail - 1;
+    std::string buf;
+    PutFixed64(&buf, index);
+    std::string sub_key;
+    InternalKey(ns_key, buf, metadata.version).Encode(&sub_key);
+    s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, elem);
+    if (!s.ok()) {
+      // FIXME: should be always exists??
+      return s;
+    }
+    batch.Delete(subkey_cf_handle_, sub_key);
+  }
   if (metadata.size == 1) {
     batch.Delete(metadata_cf_handle_, ns_key);
   } else {
@@ -131,10 +168,26 @@ rocksdb::Status List::Rem(const Slice &user_key, int count, const Slice &elem, i
   AppendNamespacePrefix(user_key, &ns_key);
 
   LockGuard guard(storage_->GetLockManager(), ns_key);
-  ListMetadata metadata;
+  ListMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s;
 
+  if (metadata.IsChunked()) {
+    rocksdb::WriteBatch batch;
+    WriteBatchLogData log_data(kRedisList, {std::to_string(kRedisCmdLRem), std::to_string(count), elem.ToString()});
+    batch.PutLogData(log_data.Encode());
+    s = remChunked(ns_key, &metadata, count, elem, ret, &batch);
+    if (!s.ok()) return s;
+    if (metadata.size == 0) {
+      batch.Delete(metadata_cf_handle_, ns_key);
+    } else {
+      std::string bytes;
+      metadata.Encode(&bytes);
+      batch.Put(metadata_cf_handle_, ns_key, bytes);
+    }
+    return storage_->Write(rocksdb::WriteOptions(), &batch);
+  }
+
   uint64_t index = count >= 0 ? metadata.head : metadata.tail - 1;
   std::string buf, start_key, prefix;
   PutFixed64(&buf, index);
@@ -146,7 +199,8 @@ rocksdb::Status List::Rem(const Slice &user_key, int count, const Slice &elem, i
   LatestSnapShot ss(db_);
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options);
+  read_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(read_options, subkey_cf_handle_);
   for (iter->Seek(start_key);
        iter->Valid() && iter->key().starts_with(prefix);
        !reversed ? iter->Next() : iter->Prev()) {
@@ -186,7 +240,7 @@ rocksdb::Status List::Rem(const Slice &user_key, int count, const Slice &elem, i
         buf.clear();
         PutFixed64(&buf, reversed ? max_to_delete_index-- : min_to_delete_index++);
         InternalKey(ns_key, buf, metadata.version).Encode(&to_update_key);
-        batch.Put(to_update_key, iter->value());
+        batch.Put(subkey_cf_handle_, to_update_key, iter->value());
       }
     }
 
@@ -194,7 +248,7 @@ rocksdb::Status List::Rem(const Slice &user_key, int count, const Slice &elem, i
       buf.clear();
       PutFixed64(&buf, reversed ? (metadata.head + idx) : (metadata.tail - 1 - idx));
       InternalKey(ns_key, buf, metadata.version).Encode(&to_delete_key);
-      batch.Delete(to_delete_key);
+      batch.Delete(subkey_cf_handle_, to_delete_key);
     }
     if (reversed) {
       metadata.head += to_delete_indexes.size();
@@ -218,10 +272,27 @@ rocksdb::Status List::Insert(const Slice &user_key, const Slice &pivot, const Sl
   AppendNamespacePrefix(user_key, &ns_key);
 
   LockGuard guard(storage_->GetLockManager(), ns_key);
-  ListMetadata metadata;
+  ListMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s;
 
+  if (metadata.IsChunked()) {
+    rocksdb::WriteBatch batch;
+    WriteBatchLogData log_data(kRedisList,
+                               {std::to_string(kRedisCmdLInsert),
+                                before ? "1" : "0",
+                                pivot.ToString(),
+                                elem.ToString()});
+    batch.PutLogData(log_data.Encode());
+    s = insertChunked(ns_key, &metadata, pivot, elem, before, &batch);
+    if (!s.ok()) return s;
+    std::string bytes;
+    metadata.Encode(&bytes);
+    batch.Put(metadata_cf_handle_, ns_key, bytes);
+    *ret = metadata.size;
+    return storage_->Write(rocksdb::WriteOptions(), &batch);
+  }
+
   std::string buf, start_key, prefix;
   uint64_t pivot_index = metadata.head - 1, new_elem_index;
   PutFixed64(&buf, metadata.head);
@@ -231,7 +302,8 @@ rocksdb::Status List::Insert(const Slice &user_key, const Slice &pivot, const Sl
   LatestSnapShot ss(db_);
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options);
+  read_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(read_options, subkey_cf_handle_);
   for (iter->Seek(start_key);
        iter->Valid() && iter->key().starts_with(prefix);
        iter->Next()) {
@@ -271,12 +343,12 @@ rocksdb::Status List::Insert(const Slice &user_key, const Slice &pivot, const Sl
     buf.clear();
     PutFixed64(&buf, reversed ? --pivot_index : ++pivot_index);
     InternalKey(ns_key, buf, metadata.version).Encode(&to_update_key);
-    batch.Put(to_update_key, iter->value());
+    batch.Put(subkey_cf_handle_, to_update_key, iter->value());
   }
   buf.clear();
   PutFixed64(&buf, new_elem_index);
   InternalKey(ns_key, buf, metadata.version).Encode(&to_update_key);
-  batch.Put(to_update_key, elem);
+  batch.Put(subkey_cf_handle_, to_update_key, elem);
 
   if (reversed) {
     metadata.head--;
@@ -298,7 +370,7 @@ rocksdb::Status List::Index(const Slice &user_key, int index, std::string *elem)
 
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
-  ListMetadata metadata;
+  ListMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s;
 
@@ -308,11 +380,23 @@ rocksdb::Status List::Index(const Slice &user_key, int index, std::string *elem)
   rocksdb::ReadOptions read_options;
   LatestSnapShot ss(db_);
   read_options.snapshot = ss.GetSnapShot();
+  if (metadata.IsChunked()) {
+    Chunk chunk;
+    std::vector<std::string> elems;
+    s = seekChunk(ns_key, metadata, read_options, metadata.head + index, &chunk);
+    if (!s.ok()) return s;
+    s = readChunk(ns_key, metadata, read_options, chunk.id, &elems);
+    if (!s.ok()) return s;
+    uint64_t offset = metadata.head + index - chunk.start;
+    if (offset >= elems.size()) return rocksdb::Status::Corruption("the chunk of the list was truncated");
+    *elem = std::move(elems[offset]);
+    return rocksdb::Status::OK();
+  }
   std::string buf;
   PutFixed64(&buf, metadata.head + index);
   std::string sub_key;
   InternalKey(ns_key, buf, metadata.version).Encode(&sub_key);
-  return db_->Get(read_options, sub_key, elem);
+  return storage_->Get(read_options, subkey_cf_handle_, sub_key, elem);
 }
 
 // The offset can also be negative, -1 is the last element, -2 the penultimate
@@ -325,7 +409,7 @@ rocksdb::Status List::Range(const Slice &user_key, int start, int stop, std::vec
 
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
-  ListMetadata metadata;
+  ListMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
@@ -334,6 +418,42 @@ rocksdb::Status List::Range(const Slice &user_key, int start, int stop, std::vec
   if (start > static_cast<int>(metadata.size) || stop < 0 || start > stop) return rocksdb::Status::OK();
   if (start < 0) start = 0;
 
+  if (metadata.IsChunked()) {
+    if (start >= static_cast<int>(metadata.size)) return rocksdb::Status::OK();
+    rocksdb::ReadOptions read_options;
+    LatestSnapShot ss(db_);
+    read_options.snapshot = ss.GetSnapShot();
+    read_options.fill_cache = false;
+    uint64_t first = metadata.head + start;
+    uint64_t last = std::min(metadata.head + stop, metadata.tail - 1);
+    Chunk chunk;
+    s = seekChunk(ns_key, metadata, read_options, first, &chunk);
+    if (!s.ok()) return s;
+
+    std::string start_key, prefix;
+    encodeChunkIndexKey(ns_key, metadata.version, chunk.start, &start_key);
+    InternalKey(ns_key, std::string(1, kListChunkIndexTag), metadata.version).Encode(&prefix);
+    read_options.prefix_same_as_start = true;
+    auto iter = storage_->NewIterator(read_options, subkey_cf_handle_);
+    for (iter->Seek(start_key);
+         iter->Valid() && iter->key().starts_with(prefix);
+         iter->Next()) {
+      decodeChunkIndexEntry(iter->key(), iter->value(), &chunk);
+      if (chunk.start > last) break;
+      std::vector<std::string> chunk_elems;
+      s = readChunk(ns_key, metadata, read_options, chunk.id, &chunk_elems);
+      if (!s.ok()) break;
+      for (size_t i = 0; i < chunk_elems.size(); i++) {
+        uint64_t pos = chunk.start + i;
+        if (pos < first) continue;
+        if (pos > last) break;
+        elems->emplace_back(std::move(chunk_elems[i]));
+      }
+    }
+    delete iter;
+    return s;
+  }
+
   std::string buf;
   PutFixed64(&buf, metadata.head + start);
   std::string start_key, prefix;
@@ -344,7 +464,8 @@ rocksdb::Status List::Range(const Slice &user_key, int start, int stop, std::vec
   LatestSnapShot ss(db_);
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options);
+  read_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(read_options, subkey_cf_handle_);
   for (iter->Seek(start_key);
        iter->Valid() && iter->key().starts_with(prefix);
        iter->Next()) {
@@ -365,7 +486,7 @@ rocksdb::Status List::Set(const Slice &user_key, int index, Slice elem) {
   AppendNamespacePrefix(user_key, &ns_key);
 
   LockGuard guard(storage_->GetLockManager(), ns_key);
-  ListMetadata metadata;
+  ListMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s;
   if (index < 0) index = metadata.size + index;
@@ -373,10 +494,31 @@ rocksdb::Status List::Set(const Slice &user_key, int index, Slice elem) {
     return rocksdb::Status::InvalidArgument("index out of range");
   }
 
+  if (metadata.IsChunked()) {
+    rocksdb::ReadOptions read_options;
+    Chunk chunk;
+    std::vector<std::string> elems;
+    s = seekChunk(ns_key, metadata, read_options, metadata.head + index, &chunk);
+    if (!s.ok()) return s;
+    s = readChunk(ns_key, metadata, read_options, chunk.id, &elems);
+    if (!s.ok()) return s;
+    uint64_t offset = metadata.head + index - chunk.start;
+    if (offset >= elems.size()) return rocksdb::Status::Corruption("the chunk of the list was truncated");
+    if (elems[offset] == elem) return rocksdb::Status::OK();
+    elems[offset] = elem.ToString();
+
+    rocksdb::WriteBatch batch;
+    WriteBatchLogData
+        log_data(kRedisList, {std::to_string(kRedisCmdLSet), std::to_string(index), elem.ToString()});
+    batch.PutLogData(log_data.Encode());
+    writeChunkData(ns_key, metadata, chunk.id, elems, &batch);
+    return storage_->Write(rocksdb::WriteOptions(), &batch);
+  }
+
   std::string buf, value, sub_key;
   PutFixed64(&buf, metadata.head + index);
   InternalKey(ns_key, buf, metadata.version).Encode(&sub_key);
-  s = db_->Get(rocksdb::ReadOptions(), sub_key, &value);
+  s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value);
   if (!s.ok()) {
     return s;
   }
@@ -386,7 +528,7 @@ rocksdb::Status List::Set(const Slice &user_key, int index, Slice elem) {
   WriteBatchLogData
       log_data(kRedisList, {std::to_string(kRedisCmdLSet), std::to_string(index)});
   batch.PutLogData(log_data.Encode());
-  batch.Put(sub_key, elem);
+  batch.Put(subkey_cf_handle_, sub_key, elem);
   return storage_->Write(rocksdb::WriteOptions(), &batch);
 }
 
@@ -408,7 +550,7 @@ rocksdb::Status List::Trim(const Slice &user_key, int start, int stop) {
   AppendNamespacePrefix(user_key, &ns_key);
 
   LockGuard guard(storage_->GetLockManager(), ns_key);
-  ListMetadata metadata;
+  ListMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
@@ -417,7 +559,7 @@ rocksdb::Status List::Trim(const Slice &user_key, int start, int stop) {
   // the result will be empty list when start > stop,
   // or start is larger than the end of list
   if (start > stop) {
-    return db_->Delete(rocksdb::WriteOptions(), metadata_cf_handle_, ns_key);
+    return storage_->Delete(rocksdb::WriteOptions(), metadata_cf_handle_, ns_key);
   }
   if (start < 0) start = 0;
 
@@ -427,12 +569,24 @@ rocksdb::Status List::Trim(const Slice &user_key, int start, int stop) {
                              std::vector<std::string>{std::to_string(kRedisCmdLTrim), std::to_string(start),
                                                       std::to_string(stop)});
   batch.PutLogData(log_data.Encode());
+  if (metadata.IsChunked()) {
+    s = trimChunked(ns_key, &metadata, start, stop, &batch);
+    if (!s.ok()) return s;
+    if (metadata.size == 0) {
+      batch.Delete(metadata_cf_handle_, ns_key);
+    } else {
+      std::string bytes;
+      metadata.Encode(&bytes);
+      batch.Put(metadata_cf_handle_, ns_key, bytes);
+    }
+    return storage_->Write(rocksdb::WriteOptions(), &batch);
+  }
   uint64_t left_index = metadata.head + start;
   for (uint64_t i = metadata.head; i < left_index; i++) {
     PutFixed64(&buf, i);
     std::string sub_key;
     InternalKey(ns_key, buf, metadata.version).Encode(&sub_key);
-    batch.Delete(sub_key);
+    batch.Delete(subkey_cf_handle_, sub_key);
     metadata.head++;
     trim_cnt++;
   }
@@ -440,7 +594,7 @@ rocksdb::Status List::Trim(const Slice &user_key, int start, int stop) {
   for (uint64_t i = right_index; i < metadata.tail; i++) {
     std::string sub_key;
     InternalKey(ns_key, buf, metadata.version).Encode(&sub_key);
-    batch.Delete(sub_key);
+    batch.Delete(subkey_cf_handle_, sub_key);
     metadata.tail--;
     trim_cnt++;
   }
@@ -454,4 +608,393 @@ rocksdb::Status List::Trim(const Slice &user_key, int start, int stop) {
   batch.Put(metadata_cf_handle_, ns_key, bytes);
   return storage_->Write(rocksdb::WriteOptions(), &batch);
 }
+
+bool List::IsChunkSubKey(const Slice &sub_key) {
+  return sub_key.size() == 9 && (sub_key[0] == kListChunkIndexTag || sub_key[0] == kListChunkDataTag);
+}
+
+bool List::IsChunkIndexSubKey(const Slice &sub_key) {
+  return sub_key.size() == 9 && sub_key[0] == kListChunkIndexTag;
+}
+
+void List::DecodeChunkIndex(Slice value, uint64_t *id, uint32_t *count) {
+  GetFixed64(&value, id);
+  GetFixed32(&value, count);
+}
+
+void List::EncodeChunkDataSubKey(uint64_t id, std::string *sub_key) {
+  sub_key->clear();
+  sub_key->push_back(kListChunkDataTag);
+  PutFixed64(sub_key, id);
+}
+
+void List::DecodeChunk(Slice value, std::vector<std::string> *elems) {
+  uint32_t len;
+  while (GetFixed32(&value, &len) && value.size() >= len) {
+    elems->emplace_back(value.data(), len);
+    value.remove_prefix(len);
+  }
+}
+
+void List::decodeChunkIndexEntry(const Slice &key, const Slice &value, Chunk *chunk) {
+  InternalKey ikey(key);
+  Slice sub_key = ikey.GetSubKey();
+  sub_key.remove_prefix(1);
+  GetFixed64(&sub_key, &chunk->start);
+  DecodeChunkIndex(value, &chunk->id, &chunk->count);
+}
+
+uint32_t List::chunkCapacity() {
+  int size = storage_->GetConfig()->list_chunk_size;
+  return size > 0 ? static_cast<uint32_t>(size) : kDefaultListChunkSize;
+}
+
+// seekChunk finds the chunk which contains the element at the position,
+// the index entries are keyed by the position of their first element.
+rocksdb::Status List::seekChunk(const Slice &ns_key, const ListMetadata &metadata,
+                                const rocksdb::ReadOptions &read_options, uint64_t pos, Chunk *chunk) {
+  std::string key, prefix;
+  encodeChunkIndexKey(ns_key, metadata.version, pos, &key);
+  InternalKey(ns_key, std::string(1, kListChunkIndexTag), metadata.version).Encode(&prefix);
+  rocksdb::ReadOptions iter_options(read_options);
+  iter_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(iter_options, subkey_cf_handle_);
+  iter->SeekForPrev(key);
+  if (!iter->Valid() || !iter->key().starts_with(prefix)) {
+    delete iter;
+    return rocksdb::Status::Corruption("the chunk of the list was missing");
+  }
+  decodeChunkIndexEntry(iter->key(), iter->value(), chunk);
+  delete iter;
+  if (pos >= chunk->start + chunk->count) {
+    return rocksdb::Status::Corruption("the chunk of the list was missing");
+  }
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status List::loadChunks(const Slice &ns_key, const ListMetadata &metadata,
+                                 const rocksdb::ReadOptions &read_options, std::vector<Chunk> *chunks) {
+  std::string prefix;
+  InternalKey(ns_key, std::string(1, kListChunkIndexTag), metadata.version).Encode(&prefix);
+  rocksdb::ReadOptions iter_options(read_options);
+  iter_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(iter_options, subkey_cf_handle_);
+  for (iter->Seek(prefix);
+       iter->Valid() && iter->key().starts_with(prefix);
+       iter->Next()) {
+    Chunk chunk;
+    decodeChunkIndexEntry(iter->key(), iter->value(), &chunk);
+    chunks->emplace_back(chunk);
+  }
+  auto s = iter->status();
+  delete iter;
+  return s;
+}
+
+rocksdb::Status List::readChunk(const Slice &ns_key, const ListMetadata &metadata,
+                                const rocksdb::ReadOptions &read_options, uint64_t id,
+                                std::vector<std::string> *elems) {
+  std::string key, value;
+  encodeChunkDataKey(ns_key, metadata.version, id, &key);
+  auto s = storage_->Get(read_options, subkey_cf_handle_, key, &value);
+  if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::Corruption("the chunk of the list was missing") : s;
+  DecodeChunk(value, elems);
+  return rocksdb::Status::OK();
+}
+
+void List::writeChunkIndex(const Slice &ns_key, const ListMetadata &metadata,
+                           const Chunk &chunk, rocksdb::WriteBatch *batch) {
+  std::string key, value;
+  encodeChunkIndexKey(ns_key, metadata.version, chunk.start, &key);
+  PutFixed64(&value, chunk.id);
+  PutFixed32(&value, chunk.count);
+  batch->Put(subkey_cf_handle_, key, value);
+}
+
+void List::writeChunkData(const Slice &ns_key, const ListMetadata &metadata,
+                          uint64_t id, const std::vector<std::string> &elems, rocksdb::WriteBatch *batch) {
+  std::string key, value;
+  encodeChunkDataKey(ns_key, metadata.version, id, &key);
+  for (const auto &elem : elems) {
+    PutFixed32(&value, static_cast<uint32_t>(elem.size()));
+    value.append(elem);
+  }
+  batch->Put(subkey_cf_handle_, key, value);
+}
+
+/*
+ * relayoutChunks writes the new chunk sequence of the list. The chunks were laid out
+ * either from the head anchor or backwards from the tail anchor, whichever moves fewer
+ * index entries, so that the middle insert or remove only shifts the positions of
+ * the chunks on the shorter side, and the chunk data was rewritten only if dirty.
+ */
+void List::relayoutChunks(const Slice &ns_key, ListMetadata *metadata,
+                          const std::vector<Chunk> &old_chunks, std::vector<Chunk> *new_chunks,
+                          const std::map<uint64_t, std::vector<std::string>> &dirty,
+                          uint64_t head_anchor, uint64_t tail_anchor, rocksdb::WriteBatch *batch) {
+  std::map<uint64_t, const Chunk *> olds;
+  for (const auto &chunk : old_chunks) olds[chunk.id] = &chunk;
+  uint64_t size = 0;
+  for (const auto &chunk : *new_chunks) size += chunk.count;
+
+  auto count_moved = [&](uint64_t base) {
+    size_t moved = 0;
+    for (const auto &chunk : *new_chunks) {
+      auto iter = olds.find(chunk.id);
+      if (iter == olds.end() || iter->second->start != base || iter->second->count != chunk.count) moved++;
+      base += chunk.count;
+    }
+    return moved;
+  };
+  uint64_t base = count_moved(head_anchor) <= count_moved(tail_anchor - size) ? head_anchor : tail_anchor - size;
+  metadata->head = base;
+  metadata->tail = base + size;
+  metadata->size = static_cast<uint32_t>(size);
+
+  std::map<uint64_t, const Chunk *> news;
+  for (auto &chunk : *new_chunks) {
+    chunk.start = base;
+    base += chunk.count;
+    news[chunk.id] = &chunk;
+  }
+  // delete the stale index entries before putting the moved ones,
+  // since a chunk may be moved to the old position of another chunk
+  std::string key;
+  for (const auto &chunk : old_chunks) {
+    auto iter = news.find(chunk.id);
+    if (iter != news.end() && iter->second->start == chunk.start && iter->second->count == chunk.count) continue;
+    encodeChunkIndexKey(ns_key, metadata->version, chunk.start, &key);
+    batch->Delete(subkey_cf_handle_, key);
+    if (iter == news.end()) {
+      encodeChunkDataKey(ns_key, metadata->version, chunk.id, &key);
+      batch->Delete(subkey_cf_handle_, key);
+    }
+  }
+  for (const auto &chunk : *new_chunks) {
+    auto iter = olds.find(chunk.id);
+    if (iter != olds.end() && iter->second->start == chunk.start && iter->second->count == chunk.count) continue;
+    writeChunkIndex(ns_key, *metadata, chunk, batch);
+  }
+  for (const auto &iter : dirty) {
+    if (news.count(iter.first) > 0) writeChunkData(ns_key, *metadata, iter.first, iter.second, batch);
+  }
+}
+
+// pushChunked fills up the chunk at the pushed side before appending new chunks,
+// and updates the head or tail of the metadata, but not the size.
+rocksdb::Status List::pushChunked(const Slice &ns_key, ListMetadata *metadata,
+                                  const std::vector<Slice> &elems, bool left, rocksdb::WriteBatch *batch) {
+  uint32_t capacity = chunkCapacity();
+  Chunk chunk;
+  std::vector<std::string> chunk_elems;
+  bool has_chunk = false;
+  if (metadata->size > 0) {
+    rocksdb::ReadOptions read_options;
+    auto s = seekChunk(ns_key, *metadata, read_options, left ? metadata->head : metadata->tail - 1, &chunk);
+    if (!s.ok()) return s;
+    if (chunk.count < capacity) {
+      s = readChunk(ns_key, *metadata, read_options, chunk.id, &chunk_elems);
+      if (!s.ok()) return s;
+      if (left) {
+        // the head chunk would be keyed by the new head
+        std::string key;
+        encodeChunkIndexKey(ns_key, metadata->version, chunk.start, &key);
+        batch->Delete(subkey_cf_handle_, key);
+      }
+      has_chunk = true;
+    }
+  }
+
+  auto flush_chunk = [&]() {
+    chunk.count = static_cast<uint32_t>(chunk_elems.size());
+    chunk.start = left ? metadata->head : metadata->tail - chunk.count;
+    writeChunkIndex(ns_key, *metadata, chunk, batch);
+    writeChunkData(ns_key, *metadata, chunk.id, chunk_elems, batch);
+  };
+  for (const auto &elem : elems) {
+    if (has_chunk && chunk_elems.size() >= capacity) {
+      flush_chunk();
+      has_chunk = false;
+    }
+    if (!has_chunk) {
+      chunk.id = metadata->next_chunk_id++;
+      chunk_elems.clear();
+      has_chunk = true;
+    }
+    if (left) {
+      chunk_elems.insert(chunk_elems.begin(), elem.ToString());
+      metadata->head--;
+    } else {
+      chunk_elems.emplace_back(elem.ToString());
+      metadata->tail++;
+    }
+  }
+  if (has_chunk) flush_chunk();
+  return rocksdb::Status::OK();
+}
+
+// popChunked leaves the head, tail and size of the metadata to the caller
+rocksdb::Status List::popChunked(const Slice &ns_key, ListMetadata *metadata,
+                                 bool left, std::string *elem, rocksdb::WriteBatch *batch) {
+  rocksdb::ReadOptions read_options;
+  Chunk chunk;
+  std::vector<std::string> elems;
+  auto s = seekChunk(ns_key, *metadata, read_options, left ? metadata->head : metadata->tail - 1, &chunk);
+  if (!s.ok()) return s;
+  s = readChunk(ns_key, *metadata, read_options, chunk.id, &elems);
+  if (!s.ok()) return s;
+  if (elems.empty()) return rocksdb::Status::Corruption("the chunk of the list was truncated");
+  if (left) {
+    *elem = std::move(elems.front());
+    elems.erase(elems.begin());
+  } else {
+    *elem = std::move(elems.back());
+    elems.pop_back();
+  }
+
+  std::string key;
+  if (left || elems.empty()) {
+    encodeChunkIndexKey(ns_key, metadata->version, chunk.start, &key);
+    batch->Delete(subkey_cf_handle_, key);
+  }
+  if (elems.empty()) {
+    encodeChunkDataKey(ns_key, metadata->version, chunk.id, &key);
+    batch->Delete(subkey_cf_handle_, key);
+    return rocksdb::Status::OK();
+  }
+  if (left) chunk.start++;
+  chunk.count--;
+  writeChunkIndex(ns_key, *metadata, chunk, batch);
+  writeChunkData(ns_key, *metadata, chunk.id, elems, batch);
+  return rocksdb::Status::OK();
+}
+
+// remChunked sets the size of metadata to 0 if all elements are removed
+rocksdb::Status List::remChunked(const Slice &ns_key, ListMetadata *metadata,
+                                 int count, const Slice &elem, int *ret, rocksdb::WriteBatch *batch) {
+  rocksdb::ReadOptions read_options;
+  LatestSnapShot ss(db_);
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.fill_cache = false;
+  std::vector<Chunk> chunks;
+  auto s = loadChunks(ns_key, *metadata, read_options, &chunks);
+  if (!s.ok()) return s;
+
+  bool reversed = count < 0;
+  uint32_t limit = static_cast<uint32_t>(abs(count)), removed = 0;
+  std::vector<Chunk> new_chunks = chunks;
+  std::map<uint64_t, std::vector<std::string>> dirty;
+  for (size_t n = 0; n < new_chunks.size() && (limit == 0 || removed < limit); n++) {
+    Chunk &chunk = new_chunks[reversed ? new_chunks.size() - 1 - n : n];
+    std::vector<std::string> elems, kept;
+    s = readChunk(ns_key, *metadata, read_options, chunk.id, &elems);
+    if (!s.ok()) return s;
+    kept.reserve(elems.size());
+    for (size_t i = 0; i < elems.size(); i++) {
+      auto &e = elems[reversed ? elems.size() - 1 - i : i];
+      if (e == elem && (limit == 0 || removed < limit)) {
+        removed++;
+        continue;
+      }
+      kept.emplace_back(std::move(e));
+    }
+    if (kept.size() == elems.size()) continue;
+    if (reversed) std::reverse(kept.begin(), kept.end());
+    chunk.count = static_cast<uint32_t>(kept.size());
+    dirty[chunk.id] = std::move(kept);
+  }
+  if (removed == 0) return rocksdb::Status::NotFound();
+  *ret = static_cast<int>(removed);
+  if (removed == metadata->size) {
+    // the sub keys would be recycled by the compaction filter after the metadata is deleted
+    metadata->size = 0;
+    return rocksdb::Status::OK();
+  }
+
+  new_chunks.erase(std::remove_if(new_chunks.begin(), new_chunks.end(),
+                                  [](const Chunk &chunk) { return chunk.count == 0; }),
+                   new_chunks.end());
+  relayoutChunks(ns_key, metadata, chunks, &new_chunks, dirty, metadata->head, metadata->tail, batch);
+  return rocksdb::Status::OK();
+}
+
+// insertChunked splits the chunk in halves once it overflows after the insert
+rocksdb::Status List::insertChunked(const Slice &ns_key, ListMetadata *metadata, const Slice &pivot,
+                                    const Slice &elem, bool before, rocksdb::WriteBatch *batch) {
+  rocksdb::ReadOptions read_options;
+  LatestSnapShot ss(db_);
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.fill_cache = false;
+  std::vector<Chunk> chunks;
+  auto s = loadChunks(ns_key, *metadata, read_options, &chunks);
+  if (!s.ok()) return s;
+
+  bool found = false;
+  std::vector<Chunk> new_chunks;
+  std::map<uint64_t, std::vector<std::string>> dirty;
+  for (const auto &chunk : chunks) {
+    new_chunks.emplace_back(chunk);
+    if (found) continue;
+    std::vector<std::string> elems;
+    s = readChunk(ns_key, *metadata, read_options, chunk.id, &elems);
+    if (!s.ok()) return s;
+    auto iter = std::find(elems.begin(), elems.end(), pivot.ToString());
+    if (iter == elems.end()) continue;
+
+    found = true;
+    elems.insert(before ? iter : iter + 1, elem.ToString());
+    if (elems.size() <= chunkCapacity()) {
+      new_chunks.back().count = static_cast<uint32_t>(elems.size());
+      dirty[chunk.id] = std::move(elems);
+      continue;
+    }
+    Chunk next;
+    size_t half = elems.size() / 2;
+    next.id = metadata->next_chunk_id++;
+    next.count = static_cast<uint32_t>(elems.size() - half);
+    new_chunks.back().count = static_cast<uint32_t>(half);
+    dirty[next.id].assign(elems.begin() + half, elems.end());
+    elems.resize(half);
+    dirty[chunk.id] = std::move(elems);
+    new_chunks.emplace_back(next);
+  }
+  if (!found) return rocksdb::Status::NotFound();
+  relayoutChunks(ns_key, metadata, chunks, &new_chunks, dirty, metadata->head, metadata->tail, batch);
+  return rocksdb::Status::OK();
+}
+
+// trimChunked only reads the chunks across the boundaries, the start should be
+// in [0, stop] and the metadata size would be 0 if nothing is left
+rocksdb::Status List::trimChunked(const Slice &ns_key, ListMetadata *metadata,
+                                  int start, int stop, rocksdb::WriteBatch *batch) {
+  rocksdb::ReadOptions read_options;
+  LatestSnapShot ss(db_);
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.fill_cache = false;
+  std::vector<Chunk> chunks;
+  auto s = loadChunks(ns_key, *metadata, read_options, &chunks);
+  if (!s.ok()) return s;
+
+  uint64_t first = metadata->head + start;
+  uint64_t end = std::min(metadata->head + stop + 1, metadata->tail);
+  std::vector<Chunk> new_chunks;
+  std::map<uint64_t, std::vector<std::string>> dirty;
+  for (const auto &chunk : chunks) {
+    uint64_t chunk_end = chunk.start + chunk.count;
+    if (chunk_end <= first || chunk.start >= end) continue;
+    new_chunks.emplace_back(chunk);
+    if (chunk.start >= first && chunk_end <= end) continue;
+
+    std::vector<std::string> elems;
+    s = readChunk(ns_key, *metadata, read_options, chunk.id, &elems);
+    if (!s.ok()) return s;
+    size_t from = std::max(chunk.start, first) - chunk.start;
+    size_t to = std::min<size_t>(std::min(chunk_end, end) - chunk.start, elems.size());
+    if (from > to) from = to;
+    new_chunks.back().count = static_cast<uint32_t>(to - from);
+    dirty[chunk.id].assign(elems.begin() + from, elems.begin() + to);
+  }
+  relayoutChunks(ns_key, metadata, chunks, &new_chunks, dirty, first, std::max(first, end), batch);
+  return rocksdb::Status::OK();
+}
 }  // namespace Redis
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <map>
 #include <vector>
 #include <string>
 
@@ -11,7 +12,9 @@
 namespace Redis {
 class List : public Database {
  public:
-  explicit List(Engine::Storage *storage, const std::string &ns) : Database(storage, ns) {}
+  explicit List(Engine::Storage *storage, const std::string &ns)
+      : Database(storage, ns),
+        subkey_cf_handle_(storage->GetSubKeyCFHandle(kRedisList)) {}
   rocksdb::Status Size(const Slice &user_key, uint32_t *ret);
   rocksdb::Status Trim(const Slice &user_key, int start, int stop);
   rocksdb::Status Set(const Slice &user_key, int index, Slice elem);
@@ -24,8 +27,52 @@ class List : public Database {
   rocksdb::Status PushX(const Slice &user_key, const std::vector<Slice> &elems, bool left, int *ret);
   rocksdb::Status Range(const Slice &user_key, int start, int stop, std::vector<std::string> *elems);
 
+  // The chunked list stores two kinds of sub keys: the index entry keyed by the
+  // position of the chunk's first element, whose value is the chunk id and the
+  // element count, and the chunk data keyed by the chunk id.
+  static bool IsChunkSubKey(const Slice &sub_key);
+  static bool IsChunkIndexSubKey(const Slice &sub_key);
+  static void DecodeChunkIndex(Slice value, uint64_t *id, uint32_t *count);
+  static void EncodeChunkDataSubKey(uint64_t id, std::string *sub_key);
+  static void DecodeChunk(Slice value, std::vector<std::string> *elems);
+
  private:
+  struct Chunk {
+    uint64_t start = 0;
+    uint64_t id = 0;
+    uint32_t count = 0;
+  };
+
   rocksdb::Status GetMetadata(const Slice &ns_key, ListMetadata *metadata);
   rocksdb::Status push(const Slice &user_key, std::vector<Slice> elems, bool create_if_missing, bool left, int *ret);
+
+  static void decodeChunkIndexEntry(const Slice &key, const Slice &value, Chunk *chunk);
+  uint32_t chunkCapacity();
+  rocksdb::Status seekChunk(const Slice &ns_key, const ListMetadata &metadata,
+                            const rocksdb::ReadOptions &read_options, uint64_t pos, Chunk *chunk);
+  rocksdb::Status loadChunks(const Slice &ns_key, const ListMetadata &metadata,
+                             const rocksdb::ReadOptions &read_options, std::vector<Chunk> *chunks);
+  rocksdb::Status readChunk(const Slice &ns_key, const ListMetadata &metadata,
+                            const rocksdb::ReadOptions &read_options, uint64_t id, std::vector<std::string> *elems);
+  void writeChunkIndex(const Slice &ns_key, const ListMetadata &metadata,
+                       const Chunk &chunk, rocksdb::WriteBatch *batch);
+  void writeChunkData(const Slice &ns_key, const ListMetadata &metadata,
+                      uint64_t id, const std::vector<std::string> &elems, rocksdb::WriteBatch *batch);
+  void relayoutChunks(const Slice &ns_key, ListMetadata *metadata,
+                      const std::vector<Chunk> &old_chunks, std::vector<Chunk> *new_chunks,
+                      const std::map<uint64_t, std::vector<std::string>> &dirty,
+                      uint64_t head_anchor, uint64_t tail_anchor, rocksdb::WriteBatch *batch);
+  rocksdb::Status pushChunked(const Slice &ns_key, ListMetadata *metadata,
+                              const std::vector<Slice> &elems, bool left, rocksdb::WriteBatch *batch);
+  rocksdb::Status popChunked(const Slice &ns_key, ListMetadata *metadata,
+                             bool left, std::string *elem, rocksdb::WriteBatch *batch);
+  rocksdb::Status remChunked(const Slice &ns_key, ListMetadata *metadata,
+                             int count, const Slice &elem, int *ret, rocksdb::WriteBatch *batch);
+  rocksdb::Status insertChunked(const Slice &ns_key, ListMetadata *metadata, const Slice &pivot,
+                                const Slice &elem, bool before, rocksdb::WriteBatch *batch);
+  rocksdb::Status trimChunked(const Slice &ns_key, ListMetadata *metadata,
+                              int start, int stop, rocksdb::WriteBatch *batch);
+
+  rocksdb::ColumnFamilyHandle *subkey_cf_handle_;
 };
 }  // namespace Redis
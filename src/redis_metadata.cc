@@ -4,9 +4,11 @@
 #include <sys/time.h>
 #include <rocksdb/env.h>
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
 #include <cstdlib>
-#include <atomic>
+#include <random>
 
 #include "util.h"
 
@@ -21,8 +23,6 @@ InternalKey::InternalKey(Slice input) {
   input.remove_prefix(key_size);
   GetFixed64(&input, &version_);
   sub_key_ = Slice(input.data(), input.size());
-  buf_ = nullptr;
-  memset(prealloc_, '\0', sizeof(prealloc_));
 }
 
 InternalKey::InternalKey(Slice ns_key, Slice sub_key, uint64_t version) {
@@ -33,12 +33,6 @@ InternalKey::InternalKey(Slice ns_key, Slice sub_key, uint64_t version) {
   key_ = ns_key;
   sub_key_ = sub_key;
   version_ = version;
-  buf_ = nullptr;
-  memset(prealloc_, '\0', sizeof(prealloc_));
-}
-
-InternalKey::~InternalKey() {
-  if (buf_ != nullptr && buf_ != prealloc_) delete []buf_;
 }
 
 Slice InternalKey::GetNamespace() const {
@@ -59,26 +53,13 @@ uint64_t InternalKey::GetVersion() const {
 
 void InternalKey::Encode(std::string *out) {
   out->clear();
-  size_t pos = 0;
-  size_t total = 1+namespace_.size()+4+key_.size()+8+sub_key_.size();
-  if (total < sizeof(prealloc_)) {
-    buf_ = prealloc_;
-  } else {
-    buf_ = new char[total];
-  }
-  EncodeFixed8(buf_+pos, static_cast<uint8_t>(namespace_.size()));
-  pos += 1;
-  memcpy(buf_+pos, namespace_.data(), namespace_.size());
-  pos += namespace_.size();
-  EncodeFixed32(buf_+pos, static_cast<uint32_t>(key_.size()));
-  pos += 4;
-  memcpy(buf_+pos, key_.data(), key_.size());
-  pos += key_.size();
-  EncodeFixed64(buf_+pos, version_);
-  pos += 8;
-  memcpy(buf_+pos, sub_key_.data(), sub_key_.size());
-  pos += sub_key_.size();
-  out->assign(buf_, pos);
+  out->reserve(1+namespace_.size()+4+key_.size()+8+sub_key_.size());
+  PutFixed8(out, static_cast<uint8_t>(namespace_.size()));
+  out->append(namespace_.data(), namespace_.size());
+  PutFixed32(out, static_cast<uint32_t>(key_.size()));
+  out->append(key_.data(), key_.size());
+  PutFixed64(out, version_);
+  out->append(sub_key_.data(), sub_key_.size());
 }
 
 bool InternalKey::operator==(const InternalKey &that) const {
@@ -87,6 +68,33 @@ bool InternalKey::operator==(const InternalKey &that) const {
   return version_ == that.version_;
 }
 
+InternalKeyBuilder::InternalKeyBuilder(Slice ns_key, uint64_t version) {
+  uint8_t namespace_size;
+  GetFixed8(&ns_key, &namespace_size);
+  // reserve for the common sub keys, so the most of the builds won't grow the buffer
+  buf_.reserve(1+namespace_size+4+ns_key.size()+8+64);
+  PutFixed8(&buf_, namespace_size);
+  buf_.append(ns_key.data(), namespace_size);
+  ns_key.remove_prefix(namespace_size);
+  PutFixed32(&buf_, static_cast<uint32_t>(ns_key.size()));
+  buf_.append(ns_key.data(), ns_key.size());
+  PutFixed64(&buf_, version);
+  prefix_size_ = buf_.size();
+}
+
+Slice InternalKeyBuilder::Build(const Slice &sub_key) {
+  buf_.resize(prefix_size_);
+  buf_.append(sub_key.data(), sub_key.size());
+  return buf_;
+}
+
+Slice InternalKeyBuilder::Build(const Slice &sub_key_prefix, const Slice &sub_key) {
+  buf_.resize(prefix_size_);
+  buf_.append(sub_key_prefix.data(), sub_key_prefix.size());
+  buf_.append(sub_key.data(), sub_key.size());
+  return buf_;
+}
+
 void ExtractNamespaceKey(Slice ns_key, std::string *ns, std::string *key) {
   uint8_t namespace_size;
   GetFixed8(&ns_key, &namespace_size);
@@ -95,22 +103,30 @@ void ExtractNamespaceKey(Slice ns_key, std::string *ns, std::string *key) {
   *key = ns_key.ToString();
 }
 
+void ExtractNamespaceKey(Slice ns_key, Slice *ns, Slice *key) {
+  uint8_t namespace_size = 0;
+  GetFixed8(&ns_key, &namespace_size);
+  if (namespace_size > ns_key.size()) namespace_size = static_cast<uint8_t>(ns_key.size());
+  *ns = Slice(ns_key.data(), namespace_size);
+  ns_key.remove_prefix(namespace_size);
+  *key = ns_key;
+}
+
 void ComposeNamespaceKey(const Slice& ns, const Slice& key, std::string *ns_key) {
   ns_key->clear();
   PutFixed8(ns_key, static_cast<uint8_t>(ns.size()));
-  ns_key->append(ns.ToString());
-  ns_key->append(key.ToString());
+  ns_key->append(ns.data(), ns.size());
+  ns_key->append(key.data(), key.size());
 }
 
-Metadata::Metadata(RedisType type) {
+Metadata::Metadata(RedisType type, bool generate_version) {
   flags = (uint8_t)0x0f & type;
   expire = -1;
-  version = 0;
+  version = generate_version ? generateVersion() : 0;
   size = 0;
-  version = generateVersion();
 }
 
-rocksdb::Status Metadata::Decode(const std::string &bytes) {
+rocksdb::Status Metadata::Decode(const Slice &bytes) {
   // flags(1byte) + expire (4byte)
   if (bytes.size() < 5) {
     return rocksdb::Status::InvalidArgument("the metadata was too short");
@@ -136,16 +152,28 @@ void Metadata::Encode(std::string *dst) {
 }
 
 uint64_t Metadata::generateVersion() {
-  struct timeval now;
-  gettimeofday(&now, nullptr);
-  uint64_t version = static_cast<uint64_t >(now.tv_sec)*1000000;
-  version += static_cast<uint64_t>(now.tv_usec);
-  // use random position for initial counter to avoid conflicts,
-  // when the slave was promoted as master and the system clock may backoff
-  srand(static_cast<unsigned>(now.tv_sec));
-  static std::atomic<uint64_t> version_counter_ {static_cast<uint64_t>(std::rand())};
-  uint64_t counter = version_counter_.fetch_add(1);
-  return (version << VersionCounterBits) + (counter%(1 << VersionCounterBits));
+  // the process counts from a random position in the tick of the coarse clock, so the versions
+  // won't conflict with the ones of the old master when the slave is promoted and the system
+  // clock may back off. The last version is shared by all threads, so no two keys get the same
+  // version, which would bring the stale subkeys of the deleted key back.
+  static const uint64_t counter_offset = std::random_device()() % (1 << VersionCounterBits);
+  static std::atomic<uint64_t> last_version{0};
+  struct timespec now;
+#ifdef CLOCK_REALTIME_COARSE
+  clock_gettime(CLOCK_REALTIME_COARSE, &now);
+#else
+  clock_gettime(CLOCK_REALTIME, &now);
+#endif
+  uint64_t us = static_cast<uint64_t>(now.tv_sec) * 1000000 + static_cast<uint64_t>(now.tv_nsec) / 1000;
+  uint64_t version = (us << VersionCounterBits) + counter_offset;
+  // the coarse clock ticks every few milliseconds, the versions in the same tick are
+  // counted up from the last one
+  uint64_t last = last_version.load(std::memory_order_relaxed);
+  uint64_t next;
+  do {
+    next = std::max(version, last + 1);
+  } while (!last_version.compare_exchange_weak(last, next, std::memory_order_relaxed));
+  return next;
 }
 
 bool Metadata::operator==(const Metadata &that) const {
@@ -177,6 +205,33 @@ timeval Metadata::Time() const {
   return created_at;
 }
 
+bool Metadata::DecodeExpired(const Slice &bytes, int64_t now, bool *expired) {
+  // flags(1byte) + expire(4byte) + version(8byte) + size(4byte), the string has no version and size
+  if (bytes.size() < 5) return false;
+  auto flags = static_cast<uint8_t>(bytes[0]);
+  auto expire = static_cast<int32_t>(DecodeFixed32(bytes.data() + 1));
+  if (expire > 0 && expire < now) {
+    *expired = true;
+    return true;
+  }
+  if ((flags & 0x0f) == kRedisString) {
+    *expired = false;
+    return true;
+  }
+  if (bytes.size() < 17) return false;
+  *expired = DecodeFixed32(bytes.data() + 13) == 0;
+  return true;
+}
+
+bool DecodeStringBlob(const Slice &bytes, uint64_t *version, uint32_t *size) {
+  if (bytes.size() < 17) return false;
+  auto flags = static_cast<uint8_t>(bytes[0]);
+  if ((flags & 0x0f) != kRedisString || (flags & kStringBlobFlag) == 0) return false;
+  *version = DecodeFixed64(bytes.data() + 5);
+  *size = DecodeFixed32(bytes.data() + 13);
+  return true;
+}
+
 bool Metadata::Expired() const {
   int64_t now;
   rocksdb::Env::Default()->GetCurrentTime(&now);
@@ -186,18 +241,100 @@ bool Metadata::Expired() const {
   return Type() != kRedisString && size == 0;
 }
 
-ListMetadata::ListMetadata() : Metadata(kRedisList) {
+void HashMetadata::Encode(std::string *dst) {
+  Metadata::Encode(dst);
+  if (!IsInline()) return;
+  for (const auto &iter : inline_fields) {
+    PutFixed32(dst, static_cast<uint32_t>(iter.first.size()));
+    dst->append(iter.first);
+    PutFixed32(dst, static_cast<uint32_t>(iter.second.size()));
+    dst->append(iter.second);
+  }
+}
+
+rocksdb::Status HashMetadata::Decode(const Slice &bytes) {
+  auto s = Metadata::Decode(bytes);
+  inline_fields.clear();
+  if (!s.ok() || !IsInline()) return s;
+  // flags(1byte) + expire(4byte) + version(8byte) + size(4byte)
+  if (bytes.size() < 17) return rocksdb::Status::InvalidArgument("the metadata was too short");
+  Slice input(bytes.data() + 17, bytes.size() - 17);
+  uint32_t field_len, value_len;
+  while (GetFixed32(&input, &field_len)) {
+    if (input.size() < field_len) return rocksdb::Status::Corruption("the inline field was truncated");
+    std::string field(input.data(), field_len);
+    input.remove_prefix(field_len);
+    if (!GetFixed32(&input, &value_len) || input.size() < value_len) {
+      return rocksdb::Status::Corruption("the inline value was truncated");
+    }
+    inline_fields[field].assign(input.data(), value_len);
+    input.remove_prefix(value_len);
+  }
+  return rocksdb::Status::OK();
+}
+
+void HyperLogLogMetadata::Encode(std::string *dst) {
+  Metadata::Encode(dst);
+  if (!IsSparse()) return;
+  // the sorted indexes are encoded as the varint deltas
+  uint32_t last_index = 0;
+  for (const auto &iter : sparse_registers) {
+    PutVarint64(dst, iter.first - last_index);
+    PutFixed8(dst, iter.second);
+    last_index = iter.first;
+  }
+}
+
+rocksdb::Status HyperLogLogMetadata::Decode(const Slice &bytes) {
+  auto s = Metadata::Decode(bytes);
+  sparse_registers.clear();
+  if (!s.ok() || !IsSparse()) return s;
+  // flags(1byte) + expire(4byte) + version(8byte) + size(4byte)
+  if (bytes.size() < 17) return rocksdb::Status::InvalidArgument("the metadata was too short");
+  Slice input(bytes.data() + 17, bytes.size() - 17);
+  uint64_t index = 0, delta;
+  uint8_t count;
+  while (GetVarint64(&input, &delta)) {
+    if (!GetFixed8(&input, &count)) return rocksdb::Status::Corruption("the sparse register was truncated");
+    index += delta;
+    sparse_registers[static_cast<uint32_t>(index)] = count;
+  }
+  return rocksdb::Status::OK();
+}
+
+void StreamMetadata::Encode(std::string *dst) {
+  Metadata::Encode(dst);
+  PutFixed64(dst, last_ms);
+  PutFixed64(dst, last_seq);
+  PutFixed64(dst, length);
+}
+
+rocksdb::Status StreamMetadata::Decode(const Slice &bytes) {
+  auto s = Metadata::Decode(bytes);
+  if (!s.ok()) return s;
+  // flags(1byte) + expire(4byte) + version(8byte) + size(4byte)
+  if (bytes.size() < 17 + 24) return rocksdb::Status::InvalidArgument("the metadata was too short");
+  Slice input(bytes.data() + 17, bytes.size() - 17);
+  GetFixed64(&input, &last_ms);
+  GetFixed64(&input, &last_seq);
+  GetFixed64(&input, &length);
+  return rocksdb::Status::OK();
+}
+
+ListMetadata::ListMetadata(bool generate_version) : Metadata(kRedisList, generate_version) {
   head = UINT64_MAX/2;
   tail = head;
+  next_chunk_id = 0;
 }
 
 void ListMetadata::Encode(std::string *dst) {
   Metadata::Encode(dst);
   PutFixed64(dst, head);
   PutFixed64(dst, tail);
+  if (IsChunked()) PutFixed64(dst, next_chunk_id);
 }
 
-rocksdb::Status ListMetadata::Decode(const std::string &bytes) {
+rocksdb::Status ListMetadata::Decode(const Slice &bytes) {
   Slice input(bytes);
   GetFixed8(&input, &flags);
   GetFixed32(&input, reinterpret_cast<uint32_t *>(&expire));
@@ -211,5 +348,9 @@ rocksdb::Status ListMetadata::Decode(const std::string &bytes) {
     GetFixed64(&input, &head);
     GetFixed64(&input, &tail);
   }
+  if (IsChunked()) {
+    if (input.size() < 8) return rocksdb::Status::InvalidArgument("the metadata was too short");
+    GetFixed64(&input, &next_chunk_id);
+  }
   return rocksdb::Status();
 }
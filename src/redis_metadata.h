@@ -2,6 +2,7 @@
 
 #include <rocksdb/status.h>
 
+#include <map>
 #include <string>
 #include <vector>
 
@@ -16,6 +17,8 @@ enum RedisType {
   kRedisZSet,
   kRedisBitmap,
   kRedisSortedint,
+  kRedisHyperLogLog,
+  kRedisStream,
 };
 
 enum RedisCommand {
@@ -28,11 +31,16 @@ enum RedisCommand {
   kRedisCmdLPush,
   kRedisCmdRPush,
   kRedisCmdExpire,
+  kRedisCmdBitOp,
+  kRedisCmdBitField,
+  kRedisCmdSetBitRange,
 };
 
 const std::vector<std::string> RedisTypeNames = {
     "none", "string", "hash",
-    "list", "set", "zset"
+    "list", "set", "zset",
+    "bitmap", "sortedint", "hyperloglog",
+    "stream"
 };
 
 using rocksdb::Slice;
@@ -48,13 +56,15 @@ struct KeyNumStats {
 const int VersionCounterBits = 11;
 
 void ExtractNamespaceKey(Slice ns_key, std::string *ns, std::string *key);
+void ExtractNamespaceKey(Slice ns_key, Slice *ns, Slice *key);
 void ComposeNamespaceKey(const Slice &ns, const Slice &key, std::string *ns_key);
 
+// InternalKey only slices the input while decoding, and encodes into the output directly
 class InternalKey {
  public:
   explicit InternalKey(Slice ns_key, Slice sub_key, uint64_t version);
   explicit InternalKey(Slice input);
-  ~InternalKey();
+  ~InternalKey() = default;
 
   Slice GetNamespace() const;
   Slice GetKey() const;
@@ -68,8 +78,22 @@ class InternalKey {
   Slice key_;
   Slice sub_key_;
   uint64_t version_;
-  char *buf_;
-  char prealloc_[256];
+};
+
+// InternalKeyBuilder encodes the namespace, key and version prefix once, and appends
+// the sub keys into the reused buffer, so encoding the sub keys of the same key in
+// the loop won't allocate. The returned slice is valid until the next Build.
+class InternalKeyBuilder {
+ public:
+  explicit InternalKeyBuilder(Slice ns_key, uint64_t version);
+  Slice Build(const Slice &sub_key);
+  // Build the sub key which is concatenated by the two parts, like the score and member
+  Slice Build(const Slice &sub_key_prefix, const Slice &sub_key);
+  Slice Prefix() const { return Slice(buf_.data(), prefix_size_); }
+
+ private:
+  std::string buf_;
+  size_t prefix_size_;
 };
 
 class Metadata {
@@ -80,51 +104,125 @@ class Metadata {
   uint32_t size;
 
  public:
-  explicit Metadata(RedisType type);
+  // the version is only generated for the new key, the metadata which would be
+  // decoded from the db at once shouldn't pay for it
+  explicit Metadata(RedisType type, bool generate_version = true);
 
   RedisType Type() const;
   virtual int32_t TTL() const;
   virtual timeval Time() const;
   virtual bool Expired() const;
   virtual void Encode(std::string *dst);
-  virtual rocksdb::Status Decode(const std::string &bytes);
+  virtual rocksdb::Status Decode(const Slice &bytes);
   bool operator==(const Metadata &that) const;
+  // DecodeExpired checks whether the encoded metadata is expired at the time in place, only
+  // the flags, expire and size are read. It returns false if the bytes are too short.
+  static bool DecodeExpired(const Slice &bytes, int64_t now, bool *expired);
 
  private:
-  uint64_t generateVersion();
+  static uint64_t generateVersion();
 };
 
+// the value of the large string is separated into the blob column family, and the metadata
+// value kept the reference of the blob, version(8byte) + size(4byte) after the header. The blob
+// is keyed by InternalKey(ns_key, "", version), so it is dropped by the compaction filter of
+// the subkeys once the string is overwritten, deleted or expired.
+const uint8_t kStringBlobFlag = 0x20;
+
+// DecodeStringBlob decodes the blob reference of the encoded string, returns false if its
+// value isn't separated
+bool DecodeStringBlob(const Slice &bytes, uint64_t *version, uint32_t *size);
+
+const uint8_t kHashInlineFlag = 0x20;
+
 class HashMetadata : public Metadata {
  public:
-  HashMetadata():Metadata(kRedisHash){}
+  // fields of the small hash are kept in the metadata value while inlined
+  std::map<std::string, std::string> inline_fields;
+  explicit HashMetadata(bool generate_version = true) : Metadata(kRedisHash, generate_version) {}
+  bool IsInline() const { return (flags & kHashInlineFlag) != 0; }
+  void EnableInline() { flags |= kHashInlineFlag; }
+  void DisableInline() {
+    flags &= static_cast<uint8_t>(~kHashInlineFlag);
+    inline_fields.clear();
+  }
+  void Encode(std::string *dst) override;
+  rocksdb::Status Decode(const Slice &bytes) override;
 };
 
 class SetMetadata : public Metadata {
  public:
-  SetMetadata(): Metadata(kRedisSet) {}
+  explicit SetMetadata(bool generate_version = true) : Metadata(kRedisSet, generate_version) {}
 };
 
+// the high 4 bits of the flags are unused by the type
+const uint8_t kZSetRankIndexFlag = 0x10;
+
 class ZSetMetadata : public Metadata {
  public:
-  ZSetMetadata(): Metadata(kRedisZSet){}
+  explicit ZSetMetadata(bool generate_version = true) : Metadata(kRedisZSet, generate_version) {}
+  bool HasRankIndex() const { return (flags & kZSetRankIndexFlag) != 0; }
+  void EnableRankIndex() { flags |= kZSetRankIndexFlag; }
 };
 
 class BitmapMetadata : public Metadata {
  public:
-  BitmapMetadata(): Metadata(kRedisBitmap){}
+  explicit BitmapMetadata(bool generate_version = true) : Metadata(kRedisBitmap, generate_version) {}
 };
 
+const uint8_t kSortedintBlockFlag = 0x20;
+
 class SortedintMetadata : public Metadata {
  public:
-  SortedintMetadata() : Metadata(kRedisSortedint) {}
+  explicit SortedintMetadata(bool generate_version = true) : Metadata(kRedisSortedint, generate_version) {}
+  bool IsBlocked() const { return (flags & kSortedintBlockFlag) != 0; }
+  void EnableBlocks() { flags |= kSortedintBlockFlag; }
 };
 
+const uint8_t kHyperLogLogSparseFlag = 0x20;
+
+// the registers of the small hyperloglog are kept in the metadata value while sparse,
+// or else they are split into the segment subkeys like the bitmap, the size is the
+// number of the non-zero registers
+class HyperLogLogMetadata : public Metadata {
+ public:
+  // register index => the position of the first set bit of the hash, only the non-zero ones
+  std::map<uint32_t, uint8_t> sparse_registers;
+  explicit HyperLogLogMetadata(bool generate_version = true) : Metadata(kRedisHyperLogLog, generate_version) {}
+  bool IsSparse() const { return (flags & kHyperLogLogSparseFlag) != 0; }
+  void EnableSparse() { flags |= kHyperLogLogSparseFlag; }
+  void DisableSparse() {
+    flags &= static_cast<uint8_t>(~kHyperLogLogSparseFlag);
+    sparse_registers.clear();
+  }
+  void Encode(std::string *dst) override;
+  rocksdb::Status Decode(const Slice &bytes) override;
+};
+
+// the size of the stream is the number of the entries and the consumer groups, so the
+// stream with only the groups left is kept, and the length is the number of the entries
+class StreamMetadata : public Metadata {
+ public:
+  uint64_t last_ms = 0;
+  uint64_t last_seq = 0;
+  uint64_t length = 0;
+  explicit StreamMetadata(bool generate_version = true) : Metadata(kRedisStream, generate_version) {}
+  void Encode(std::string *dst) override;
+  rocksdb::Status Decode(const Slice &bytes) override;
+};
+
+const uint8_t kListChunkedFlag = 0x20;
+
 class ListMetadata : public Metadata {
  public:
   uint64_t head;
   uint64_t tail;
-  ListMetadata();
+  // only encoded while the list is chunked
+  uint64_t next_chunk_id;
+  explicit ListMetadata(bool generate_version = true);
  public:
+  bool IsChunked() const { return (flags & kListChunkedFlag) != 0; }
+  void EnableChunks() { flags |= kListChunkedFlag; }
   void Encode(std::string *dst) override;
-  rocksdb::Status Decode(const std::string &bytes) override;
+  rocksdb::Status Decode(const Slice &bytes) override;
 };
@@ -3,6 +3,7 @@
 #include <rocksdb/iostats_context.h>
 
 #include <chrono>
+#include <cstdint>
 #include <utility>
 
 #include "util.h"
@@ -16,65 +17,137 @@ namespace Redis {
 const size_t PROTO_INLINE_MAX_SIZE = 16 * 1024L;
 const size_t PROTO_BULK_MAX_SIZE = 128 * 1024L * 1024L;
 const size_t PROTO_MAX_MULTI_BULKS = 8 * 1024L;
+// the connection yields the worker after its pipelined commands run longer than the time slice
+const uint64_t kExecutionTimeSliceUs = 10000;
+
+// Parse the decimal length of the '*' or '$' header in place, std::stoull
+// would require a temporary std::string and an exception on bad input.
+static bool parseLength(const char *p, size_t len, size_t *out) {
+  if (len == 0) return false;
+  size_t n = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] < '0' || p[i] > '9') return false;
+    auto d = static_cast<size_t>(p[i] - '0');
+    if (n > (SIZE_MAX - d) / 10) return false;
+    n = n * 10 + d;
+  }
+  *out = n;
+  return true;
+}
+
+// searchEOL returns the offset of the first CRLF in the input or -1, the chains are
+// scanned in place by the vectorized Util::FindCRLF and only fall back to the
+// evbuffer_search_eol if the line is split into too many chains. The line longer
+// than the inline max size is a protocol error, so the rest needn't be peeked.
+static ssize_t searchEOL(evbuffer *input) {
+  const int kMaxChains = 16;
+  evbuffer_iovec chains[kMaxChains];
+  int n = evbuffer_peek(input, static_cast<ev_ssize_t>(PROTO_INLINE_MAX_SIZE + 2), nullptr, chains, kMaxChains);
+  if (n > kMaxChains) {
+    size_t eol_len;
+    return evbuffer_search_eol(input, nullptr, &eol_len, EVBUFFER_EOL_CRLF_STRICT).pos;
+  }
+  size_t offset = 0;
+  bool prev_cr = false;
+  for (int i = 0; i < n; i++) {
+    auto p = static_cast<const char *>(chains[i].iov_base);
+    size_t len = chains[i].iov_len;
+    if (len == 0) continue;
+    // the CRLF may be split by the chains
+    if (prev_cr && p[0] == '\n') return static_cast<ssize_t>(offset - 1);
+    size_t pos = Util::FindCRLF(p, len);
+    if (pos < len) return static_cast<ssize_t>(offset + pos);
+    prev_cr = p[len - 1] == '\r';
+    offset += len;
+  }
+  return -1;
+}
 
 Status Request::Tokenize(evbuffer *input) {
-  char *line;
+  // the header line is '*' or '$' with at most 20 digits, copy it out
+  // to the stack instead of malloc a new line like evbuffer_readln
+  char header[32];
+  const size_t eol_len = 2;
   size_t len;
+  ssize_t eol;
+  if (commands_.empty() && svr_->GetConfig()->trace_sample_ratio > 0) read_us_ = Trace::NowUS();
   while (true) {
     switch (state_) {
       case ArrayLen:
-        line = evbuffer_readln(input, &len, EVBUFFER_EOL_CRLF_STRICT);
-        if (!line || len <= 0) return Status::OK();
+        eol = searchEOL(input);
+        if (eol < 0) {
+          if (evbuffer_get_length(input) > PROTO_INLINE_MAX_SIZE) {
+            return Status(Status::NotOK, "Protocol error: too big inline request");
+          }
+          return Status::OK();
+        }
+        len = static_cast<size_t>(eol);
         svr_->stats_.IncrInbondBytes(len);
-        if (line[0] == '*') {
-          try {
-            multi_bulk_len_ = std::stoull(std::string(line + 1, len-1));
-          } catch (std::exception &e) {
-            free(line);
+        if (len == 0) {
+          evbuffer_drain(input, eol_len);
+          break;
+        }
+        evbuffer_copyout(input, header, 1);
+        if (header[0] == '*') {
+          if (len > sizeof(header)) {
+            return Status(Status::NotOK, "Protocol error: expect integer");
+          }
+          evbuffer_remove(input, header, len);
+          evbuffer_drain(input, eol_len);
+          if (!parseLength(header + 1, len - 1, &multi_bulk_len_)) {
             return Status(Status::NotOK, "Protocol error: expect integer");
           }
           if (multi_bulk_len_ > PROTO_MAX_MULTI_BULKS) {
-            free(line);
             return Status(Status::NotOK, "Protocol error: too many bulk strings");
           }
+          if (multi_bulk_len_ == 0) break;
+          tokens_.reserve(multi_bulk_len_);
           state_ = BulkLen;
         } else {
           if (len > PROTO_INLINE_MAX_SIZE) {
-            free(line);
             return Status(Status::NotOK, "Protocol error: too big inline request");
           }
-          Util::Split(std::string(line, len), " \t", &tokens_);
+          std::string line(len, '\0');
+          evbuffer_remove(input, &line[0], len);
+          evbuffer_drain(input, eol_len);
+          Util::Split(line, " \t", &tokens_);
           commands_.push_back(std::move(tokens_));
+          tokens_.clear();
           state_ = ArrayLen;
         }
-        free(line);
         break;
       case BulkLen:
-        line = evbuffer_readln(input, &len, EVBUFFER_EOL_CRLF_STRICT);
-        if (!line || len <= 0) return Status::OK();
+        eol = searchEOL(input);
+        if (eol < 0) {
+          if (evbuffer_get_length(input) > sizeof(header)) {
+            return Status(Status::NotOK, "Protocol error: expect integer");
+          }
+          return Status::OK();
+        }
+        len = static_cast<size_t>(eol);
+        if (len == 0) return Status(Status::NotOK, "Protocol error: expect '$'");
+        if (len > sizeof(header)) return Status(Status::NotOK, "Protocol error: expect integer");
         svr_->stats_.IncrInbondBytes(len);
-        if (line[0] != '$') {
-          free(line);
+        evbuffer_remove(input, header, len);
+        evbuffer_drain(input, eol_len);
+        if (header[0] != '$') {
           return Status(Status::NotOK, "Protocol error: expect '$'");
         }
-        try {
-          bulk_len_ = std::stoull(std::string(line + 1, len-1));
-        } catch (std::exception &e) {
-          free(line);
+        if (!parseLength(header + 1, len - 1, &bulk_len_)) {
           return Status(Status::NotOK, "Protocol error: expect integer");
         }
         if (bulk_len_ > PROTO_BULK_MAX_SIZE) {
-          free(line);
           return Status(Status::NotOK, "Protocol error: too big bulk string");
         }
-        free(line);
         state_ = BulkData;
         break;
       case BulkData:
         if (evbuffer_get_length(input) < bulk_len_ + 2) return Status::OK();
-        char *data = reinterpret_cast<char *>(evbuffer_pullup(input, bulk_len_ + 2));
-        tokens_.emplace_back(data, bulk_len_);
-        evbuffer_drain(input, bulk_len_ + 2);
+        // copy the bulk across the evbuffer chains directly, evbuffer_pullup
+        // would linearize (and may reallocate) the chains before the copy
+        tokens_.emplace_back(bulk_len_, '\0');
+        if (bulk_len_ > 0) evbuffer_remove(input, &tokens_.back()[0], bulk_len_);
+        evbuffer_drain(input, 2);
         svr_->stats_.IncrInbondBytes(bulk_len_ + 2);
         --multi_bulk_len_;
         if (multi_bulk_len_ == 0) {
@@ -97,6 +170,33 @@ bool Request::inCommandWhitelist(const std::string &command) {
   return false;
 }
 
+// the control commands of the transaction are executed at once in MULTI
+bool Request::isMultiControlCommand(const std::string &command) {
+  std::vector<std::string> commands = {"exec", "discard", "multi", "watch", "quit"};
+  for (const auto &control_command : commands) {
+    if (control_command == command) return true;
+  }
+  return false;
+}
+
+void Request::queueMultiCommand(Connection *conn, std::vector<std::string> &&cmd_tokens) {
+  const auto &name = conn->current_cmd_->Name();
+  if (!IsNestedCommandAllowed(name)) {
+    conn->FlagMultiError();
+    conn->Reply(Redis::Error("ERR command " + name + " is not allowed in MULTI"));
+    return;
+  }
+  conn->current_cmd_->SetArgs(std::move(cmd_tokens));
+  auto s = conn->current_cmd_->Parse(*conn->current_cmd_->Args());
+  if (!s.IsOK()) {
+    conn->FlagMultiError();
+    conn->Reply(Redis::Error(s.Msg()));
+    return;
+  }
+  conn->QueueMultiCommand(*conn->current_cmd_->Args());
+  conn->Reply(Redis::SimpleString("QUEUED"));
+}
+
 bool Request::turnOnProfilingIfNeed(const std::string &cmd) {
   auto config = svr_->GetConfig();
   if (config->profiling_sample_ratio == 0) return false;
@@ -133,12 +233,26 @@ void Request::recordProfilingSampleIfNeed(const std::string &cmd, uint64_t durat
   svr_->GetPerfLog()->PushEntry(entry);
 }
 
+void Request::recordSamples(Commander *cmd, bool is_perf_sampled, bool is_profiling, uint64_t duration) {
+  // the perf stats must be recorded before the profiling, which resets the perf level
+  if (is_perf_sampled) svr_->GetPerfStats()->Record(cmd->GetID());
+  if (is_profiling) {
+    recordProfilingSampleIfNeed(cmd->Name(), duration);
+  } else if (is_perf_sampled) {
+    rocksdb::SetPerfLevel(rocksdb::PerfLevel::kDisable);
+  }
+}
+
 void Request::ExecuteCommands(Connection *conn) {
   if (commands_.empty()) return;
 
   Config *config = svr_->GetConfig();
   std::string reply;
-  for (auto &cmd_tokens : commands_) {
+  size_t executed = 0;
+  uint64_t batch_duration = 0;
+  for (; executed < commands_.size(); executed++) {
+    auto &cmd_tokens = commands_[executed];
+    trace_.reset();
     if (conn->IsFlagEnabled(Redis::Connection::kCloseAfterReply)) break;
     if (conn->GetNamespace().empty()) {
       if (!config->requirepass.empty() && Util::ToLower(cmd_tokens.front()) != "auth") {
@@ -150,6 +264,7 @@ void Request::ExecuteCommands(Connection *conn) {
     }
     auto s = LookupCommand(cmd_tokens.front(), &conn->current_cmd_, conn->IsRepl());
     if (!s.IsOK()) {
+      conn->FlagMultiError();
       conn->Reply(Redis::Error("ERR unknown command"));
       continue;
     }
@@ -161,41 +276,180 @@ void Request::ExecuteCommands(Connection *conn) {
     int tokens = static_cast<int>(cmd_tokens.size());
     if ((arity > 0 && tokens != arity)
         || (arity < 0 && tokens < -arity)) {
+      conn->FlagMultiError();
       conn->Reply(Redis::Error("ERR wrong number of arguments"));
       continue;
     }
-    conn->current_cmd_->SetArgs(cmd_tokens);
-    s = conn->current_cmd_->Parse(cmd_tokens);
+    if (conn->IsFlagEnabled(Redis::Connection::kMulti) && !isMultiControlCommand(conn->current_cmd_->Name())) {
+      queueMultiCommand(conn, std::move(cmd_tokens));
+      continue;
+    }
+    if (conn->IsWaitingAcks() && !conn->current_cmd_->IsWrite()) {
+      // the following writes are executed while waiting for the acks, but the others
+      // are deferred til the held replies are released
+      commands_.erase(commands_.begin(), commands_.begin() + executed);
+      return;
+    }
+    if (conn->current_cmd_->IsWrite() && svr_->storage_->IsWriteStopped()) {
+      // keep the rest of commands to retry later, the commands of the
+      // connection must be executed in order
+      if (conn->HoldWrites()) {
+        commands_.erase(commands_.begin(), commands_.begin() + executed);
+        return;
+      }
+      conn->Reply(Redis::Error("BUSY the writes were stopped by the storage engine, retry later"));
+      continue;
+    }
+    conn->ReleaseWrites();
+    if (!conn->AcquireQuota()) {
+      // keep the rest of commands til the namespace has the budget again
+      commands_.erase(commands_.begin(), commands_.begin() + executed);
+      return;
+    }
+    // move the tokens into the command instead of copying all of them
+    conn->current_cmd_->SetArgs(std::move(cmd_tokens));
+    const auto &args = *conn->current_cmd_->Args();
+    if (Trace::Sample(config->trace_sample_ratio)) {
+      trace_.reset(new Trace(conn->current_cmd_->Name(), read_us_));
+      trace_->Mark(Trace::kQueued);
+    }
+    s = conn->current_cmd_->Parse(args);
     if (!s.IsOK()) {
       conn->Reply(Redis::Error(s.Msg()));
       continue;
     }
+    if (trace_) trace_->Mark(Trace::kParsed);
     if (config->slave_readonly && svr_->IsSlave() && conn->current_cmd_->IsWrite()) {
       conn->Reply(Redis::Error("READONLY You can't write against a read only slave."));
       continue;
     }
     conn->SetLastCmd(conn->current_cmd_->Name());
-    svr_->stats_.IncrCalls(conn->current_cmd_->Name());
+    svr_->stats_.IncrCalls(conn->current_cmd_->GetID());
+    int first_key = GetFirstKeyIndex(conn->current_cmd_->GetID());
+    if (first_key > 0 && args.size() > static_cast<size_t>(first_key)
+        && HotKeys::Sample(config->hotkeys_sample_ratio)) {
+      svr_->GetHotKeys()->Record(conn->GetNamespace(), args[first_key]);
+    }
+    std::vector<std::string> read_keys;
+    if (conn->IsTracking() && GetReadKeys(conn->current_cmd_->GetID(), args, &read_keys)) {
+      conn->TrackReadKeys(read_keys);
+    }
+    if (conn->current_cmd_->IsSlow() && svr_->IsSlowCommandExecutorEnabled()
+        && executeInBackground(conn)) {
+      // the rest of commands would be executed after the slow one is finished
+      commands_.erase(commands_.begin(), commands_.begin() + executed + 1);
+      return;
+    }
     auto start = std::chrono::high_resolution_clock::now();
+    bool is_perf_sampled = PerfStats::Begin(config->perf_stats_sample_ratio);
     bool is_profiling = turnOnProfilingIfNeed(conn->current_cmd_->Name());
+    // the pure read is tried on the memory first, and the one missing the block cache is
+    // executed again by the io read threads, so the worker won't be blocked on the disk
+    bool cache_only = !conn->current_cmd_->IsSlow() && svr_->IsIOReadExecutorEnabled()
+        && IsPureReadCommand(conn->current_cmd_->GetID());
     svr_->IncrExecutingCommandNum();
+    if (cache_only) svr_->storage_->BeginCacheOnlyReads();
+    Trace::Attach(trace_.get());
     s = conn->current_cmd_->Execute(svr_, conn, &reply);
+    Trace::Attach(nullptr);
+    if (cache_only && !svr_->storage_->EndCacheOnlyReads()) {
+      reply.clear();
+      if (executeInBackground(conn, true)) {
+        // the samples are taken by the io read thread instead
+        svr_->DecrExecutingCommandNum();
+        if (is_perf_sampled || is_profiling) rocksdb::SetPerfLevel(rocksdb::PerfLevel::kDisable);
+        commands_.erase(commands_.begin(), commands_.begin() + executed + 1);
+        return;
+      }
+      Trace::Attach(trace_.get());
+      s = conn->current_cmd_->Execute(svr_, conn, &reply);
+      Trace::Attach(nullptr);
+    }
+    if (trace_) trace_->Mark(Trace::kExecuted);
     svr_->DecrExecutingCommandNum();
     auto end = std::chrono::high_resolution_clock::now();
     uint64_t duration = std::chrono::duration_cast<std::chrono::microseconds>(end-start).count();
-    if (is_profiling) recordProfilingSampleIfNeed(conn->current_cmd_->Name(), duration);
-    svr_->SlowlogPushEntryIfNeeded(conn->current_cmd_->Args(), duration);
-    svr_->stats_.IncrLatency(static_cast<uint64_t>(duration), conn->current_cmd_->Name());
-    svr_->FeedMonitorConns(conn, cmd_tokens);
-    if (!s.IsOK()) {
-      conn->Reply(Redis::Error("ERR " + s.Msg()));
-      LOG(ERROR) << "[request] Failed to execute command: " << conn->current_cmd_->Name()
-                 << ", encounter err: " << s.Msg();
-      continue;
+    recordSamples(conn->current_cmd_.get(), is_perf_sampled, is_profiling, duration);
+    finishCommand(conn, s, &reply, duration);
+    if (conn->IsBlocked() || conn->IsParked() || conn->IsStreamingReply()) {
+      // the rest of commands would be executed after the blocking one is served,
+      // the parked one replies or the streaming reply is finished
+      commands_.erase(commands_.begin(), commands_.begin() + executed + 1);
+      return;
+    }
+    batch_duration += duration;
+    if (batch_duration >= kExecutionTimeSliceUs && executed + 1 < commands_.size()) {
+      // the pipeline of the heavy commands shouldn't hold the worker from the others
+      commands_.erase(commands_.begin(), commands_.begin() + executed + 1);
+      conn->Yield();
+      return;
     }
-    if (!reply.empty()) conn->Reply(reply);
   }
   commands_.clear();
 }
 
+bool Request::executeInBackground(Connection *conn, bool io_read) {
+  Task task;
+  task.arg = conn;
+  task.high_priority = true;
+  task.callback = [this](void *arg) {
+    auto conn = static_cast<Connection *>(arg);
+    auto start = std::chrono::high_resolution_clock::now();
+    bool is_perf_sampled = PerfStats::Begin(svr_->GetConfig()->perf_stats_sample_ratio);
+    bool is_profiling = turnOnProfilingIfNeed(conn->current_cmd_->Name());
+    bg_reply_.clear();
+    Trace::Attach(trace_.get());
+    bg_status_ = conn->current_cmd_->Execute(svr_, conn, &bg_reply_);
+    Trace::Attach(nullptr);
+    if (trace_) trace_->Mark(Trace::kExecuted);
+    svr_->DecrExecutingCommandNum();
+    auto end = std::chrono::high_resolution_clock::now();
+    bg_duration_ = std::chrono::duration_cast<std::chrono::microseconds>(end-start).count();
+    recordSamples(conn->current_cmd_.get(), is_perf_sampled, is_profiling, bg_duration_);
+    conn->Owner()->ResumeConnection(conn);
+  };
+  // count the command before it is queued, so the db won't be reclaimed before it is executed
+  svr_->IncrExecutingCommandNum();
+  auto s = io_read ? svr_->PublishIOReadCommand(task) : svr_->PublishSlowCommand(task);
+  if (!s.IsOK()) {
+    // execute in the worker while the executors are too busy or stopped
+    svr_->DecrExecutingCommandNum();
+    return false;
+  }
+  // the command can't be resumed before pausing, since it's resumed in this thread as well
+  conn->Pause();
+  return true;
+}
+
+void Request::FinishBackgroundCommand(Connection *conn) {
+  finishCommand(conn, bg_status_, &bg_reply_, bg_duration_);
+}
+
+void Request::finishCommand(Connection *conn, const Status &s, std::string *reply, uint64_t duration) {
+  svr_->SlowlogPushEntryIfNeeded(conn->current_cmd_->Args(), duration);
+  svr_->stats_.IncrLatency(static_cast<uint64_t>(duration), conn->current_cmd_->GetID());
+  svr_->FeedMonitorConns(conn, *conn->current_cmd_->Args());
+  if (!s.IsOK()) {
+    conn->Reply(Redis::Error("ERR " + s.Msg()));
+    LOG(ERROR) << "[request] Failed to execute command: " << conn->current_cmd_->Name()
+               << ", encounter err: " << s.Msg();
+    if (trace_) finishTrace(conn, 0);
+    return;
+  }
+  // the seq might be a bit larger than the write's, which is still fine for waiting
+  if (conn->current_cmd_->IsWrite()) conn->SetLastWriteSeq(svr_->storage_->LatestSeq());
+  size_t reply_bytes = reply->size();
+  // move the reply, so the large one could be added to the output without copying
+  if (!reply->empty()) conn->Reply(std::move(*reply));
+  reply->clear();
+  if (trace_) finishTrace(conn, reply_bytes);
+  if (conn->current_cmd_->IsStreamingReply()) conn->StreamReply();
+}
+
+void Request::finishTrace(Connection *conn, size_t reply_bytes) {
+  trace_->Mark(Trace::kReplied);
+  trace_->reply_bytes = reply_bytes;
+  conn->AddTrace(std::move(trace_));
+}
+
 }  // namespace Redis
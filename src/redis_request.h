@@ -1,16 +1,19 @@
 #pragma once
 
 #include <event2/buffer.h>
+#include <memory>
 #include <vector>
 #include <string>
 
 #include "status.h"
+#include "tracing.h"
 
 class Server;
 
 namespace Redis {
 
 class Connection;
+class Commander;
 
 class Request {
  public:
@@ -23,6 +26,8 @@ class Request {
   Status Tokenize(evbuffer *input);
   // Exec return true when command finished
   void ExecuteCommands(Connection *conn);
+  // FinishBackgroundCommand replies the slow command executed by the command executor
+  void FinishBackgroundCommand(Connection *conn);
 
  private:
   // internal states related to parsing
@@ -34,11 +39,28 @@ class Request {
   using CommandTokens = std::vector<std::string>;
   CommandTokens tokens_;
   std::vector<CommandTokens> commands_;
+  // the time(us) the oldest pending commands are read, and the trace of the current command
+  uint64_t read_us_ = 0;
+  std::unique_ptr<Trace> trace_;
+
+  // the result of the command executed in background
+  Status bg_status_;
+  std::string bg_reply_;
+  uint64_t bg_duration_ = 0;
 
   Server *svr_;
+  // executeInBackground executes the slow command by the command executors, or the read
+  // command which misses the block cache by the io read threads
+  bool executeInBackground(Connection *conn, bool io_read = false);
+  void finishCommand(Connection *conn, const Status &s, std::string *reply, uint64_t duration);
+  void finishTrace(Connection *conn, size_t reply_bytes);
   bool inCommandWhitelist(const std::string &command);
+  bool isMultiControlCommand(const std::string &command);
+  // queueMultiCommand parses and queues the command until EXEC
+  void queueMultiCommand(Connection *conn, std::vector<std::string> &&cmd_tokens);
   bool turnOnProfilingIfNeed(const std::string &cmd);
   void recordProfilingSampleIfNeed(const std::string &cmd, uint64_t duration);
+  void recordSamples(Commander *cmd, bool is_perf_sampled, bool is_profiling, uint64_t duration);
 };
 
 }  // namespace Redis
@@ -1,10 +1,14 @@
 #include "redis_set.h"
 
-#include <map>
+#include <algorithm>
 #include <iostream>
+#include <set>
 
 namespace Redis {
 
+// at most kSetRandomSeekMaxCount members are picked by their own random seeks
+const int kSetRandomSeekMaxCount = 16;
+
 rocksdb::Status Set::GetMetadata(const Slice &ns_key, SetMetadata *metadata) {
   return Database::GetMetadata(kRedisSet, ns_key, metadata);
 }
@@ -19,10 +23,9 @@ rocksdb::Status Set::Overwrite(Slice user_key, const std::vector<std::string> &m
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisSet);
   batch.PutLogData(log_data.Encode());
-  std::string sub_key;
+  InternalKeyBuilder sub_keys(ns_key, metadata.version);
   for (const auto &member : members) {
-    InternalKey(ns_key, member, metadata.version).Encode(&sub_key);
-    batch.Put(sub_key, Slice());
+    batch.Put(subkey_cf_handle_, sub_keys.Build(member), Slice());
   }
   metadata.size = static_cast<uint32_t>(members.size());
   std::string bytes;
@@ -46,12 +49,12 @@ rocksdb::Status Set::Add(const Slice &user_key, const std::vector<Slice> &member
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisSet);
   batch.PutLogData(log_data.Encode());
-  std::string sub_key;
+  InternalKeyBuilder sub_keys(ns_key, metadata.version);
   for (const auto &member : members) {
-    InternalKey(ns_key, member, metadata.version).Encode(&sub_key);
-    s = db_->Get(rocksdb::ReadOptions(), sub_key, &value);
+    Slice sub_key = sub_keys.Build(member);
+    s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value);
     if (s.ok()) continue;
-    batch.Put(sub_key, Slice());
+    batch.Put(subkey_cf_handle_, sub_key, Slice());
     *ret += 1;
   }
   if (*ret > 0) {
@@ -70,19 +73,20 @@ rocksdb::Status Set::Remove(const Slice &user_key, const std::vector<Slice> &mem
   AppendNamespacePrefix(user_key, &ns_key);
 
   LockGuard guard(storage_->GetLockManager(), ns_key);
-  SetMetadata metadata;
+  SetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
-  std::string value, sub_key;
+  std::string value;
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisSet);
   batch.PutLogData(log_data.Encode());
+  InternalKeyBuilder sub_keys(ns_key, metadata.version);
   for (const auto &member : members) {
-    InternalKey(ns_key, member, metadata.version).Encode(&sub_key);
-    s = db_->Get(rocksdb::ReadOptions(), sub_key, &value);
+    Slice sub_key = sub_keys.Build(member);
+    s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value);
     if (!s.ok()) continue;
-    batch.Delete(sub_key);
+    batch.Delete(subkey_cf_handle_, sub_key);
     *ret += 1;
   }
   if (*ret > 0) {
@@ -99,7 +103,7 @@ rocksdb::Status Set::Card(const Slice &user_key, int *ret) {
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  SetMetadata metadata;
+  SetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
   *ret = metadata.size;
@@ -112,7 +116,7 @@ rocksdb::Status Set::Members(const Slice &user_key, std::vector<std::string> *me
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  SetMetadata metadata;
+  SetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
@@ -122,7 +126,8 @@ rocksdb::Status Set::Members(const Slice &user_key, std::vector<std::string> *me
   LatestSnapShot ss(db_);
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options);
+  read_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(read_options, subkey_cf_handle_);
   for (iter->Seek(prefix);
        iter->Valid() && iter->key().starts_with(prefix);
        iter->Next()) {
@@ -139,33 +144,67 @@ rocksdb::Status Set::IsMember(const Slice &user_key, const Slice &member, int *r
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  SetMetadata metadata;
+  SetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
   rocksdb::ReadOptions read_options;
-  LatestSnapShot ss(db_);
-  read_options.snapshot = ss.GetSnapShot();
   std::string sub_key;
   InternalKey(ns_key, member, metadata.version).Encode(&sub_key);
   std::string value;
-  s = db_->Get(read_options, sub_key, &value);
+  s = storage_->Get(read_options, subkey_cf_handle_, sub_key, &value);
   if (s.ok()) {
     *ret = 1;
   }
   return rocksdb::Status::OK();
 }
 
+rocksdb::Status Set::MIsMember(const Slice &user_key, const std::vector<Slice> &members, std::vector<int> *exists) {
+  exists->clear();
+
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  SetMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.IsNotFound()) {
+    exists->resize(members.size(), 0);
+    return rocksdb::Status::OK();
+  }
+
+  std::vector<std::string> sub_keys(members.size());
+  std::vector<Slice> slice_keys;
+  slice_keys.reserve(members.size());
+  for (size_t i = 0; i < members.size(); i++) {
+    InternalKey(ns_key, members[i], metadata.version).Encode(&sub_keys[i]);
+    slice_keys.emplace_back(sub_keys[i]);
+  }
+  // the MultiGet reads all members at the same implicit snapshot
+  rocksdb::ReadOptions read_options;
+  std::vector<std::string> values;
+  std::vector<rocksdb::ColumnFamilyHandle *> cf_handles(slice_keys.size(), subkey_cf_handle_);
+  auto statuses = storage_->MultiGet(read_options, cf_handles, slice_keys, &values);
+  for (const auto &status : statuses) {
+    if (!status.ok() && !status.IsNotFound()) {
+      exists->clear();
+      return status;
+    }
+    exists->emplace_back(status.ok() ? 1 : 0);
+  }
+  return rocksdb::Status::OK();
+}
+
 rocksdb::Status Set::Take(const Slice &user_key, std::vector<std::string> *members, int count, bool pop) {
-  int n = 0;
   members->clear();
   if (count <= 0) return rocksdb::Status::OK();
 
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  if (pop) LockGuard guard(storage_->GetLockManager(), ns_key);
-  SetMetadata metadata;
+  std::unique_ptr<LockGuard> lock_guard;
+  if (pop) lock_guard = std::unique_ptr<LockGuard>(new LockGuard(storage_->GetLockManager(), ns_key));
+  SetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
@@ -176,20 +215,53 @@ rocksdb::Status Set::Take(const Slice &user_key, std::vector<std::string> *membe
   LatestSnapShot ss(db_);
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options);
-  std::string prefix;
+  read_options.prefix_same_as_start = true;
+  std::unique_ptr<rocksdb::Iterator> iter(storage_->NewIterator(read_options, subkey_cf_handle_));
+  std::string prefix, next_version_prefix;
   InternalKey(ns_key, "", metadata.version).Encode(&prefix);
-  for (iter->Seek(prefix);
-       iter->Valid() && iter->key().starts_with(prefix);
-       iter->Next()) {
-    InternalKey ikey(iter->key());
+  InternalKey(ns_key, "", metadata.version + 1).Encode(&next_version_prefix);
+  auto take = [&](const Slice &key) {
+    InternalKey ikey(key);
     members->emplace_back(ikey.GetSubKey().ToString());
-    if (pop) batch.Delete(iter->key());
-    if (++n >= count) break;
+    if (pop) batch.Delete(subkey_cf_handle_, key);
+  };
+
+  if (static_cast<uint64_t>(count) >= metadata.size) {
+    for (iter->Seek(prefix);
+         iter->Valid() && iter->key().starts_with(prefix);
+         iter->Next()) {
+      take(iter->key());
+    }
+  } else {
+    // the few members are picked by their own random seeks, and the rest are taken
+    // in order from a random point, the duplicated picks are dropped
+    std::set<std::string> picked;
+    size_t n = static_cast<size_t>(count);
+    if (count <= kSetRandomSeekMaxCount) {
+      for (int i = 0; i < count * 2 && picked.size() < n; i++) {
+        seekRandom(iter.get(), subkey_cf_handle_, prefix, next_version_prefix);
+        if (!iter->Valid() || !iter->key().starts_with(prefix)) break;
+        if (picked.insert(iter->key().ToString()).second) take(iter->key());
+      }
+    }
+    if (picked.size() < n) {
+      seekRandom(iter.get(), subkey_cf_handle_, prefix, next_version_prefix);
+      bool wrapped = false;
+      for (uint64_t visited = 0; picked.size() < n && visited < metadata.size;) {
+        if (!iter->Valid() || !iter->key().starts_with(prefix)) {
+          if (wrapped) break;
+          wrapped = true;
+          iter->Seek(prefix);
+          continue;
+        }
+        if (picked.insert(iter->key().ToString()).second) take(iter->key());
+        visited++;
+        iter->Next();
+      }
+    }
   }
-  delete iter;
-  if (pop && n > 0) {
-    metadata.size -= n;
+  if (pop && !members->empty()) {
+    metadata.size -= members->size();
     std::string bytes;
     metadata.Encode(&bytes);
     batch.Put(metadata_cf_handle_, ns_key, bytes);
@@ -198,20 +270,87 @@ rocksdb::Status Set::Take(const Slice &user_key, std::vector<std::string> *membe
 }
 
 rocksdb::Status Set::Move(const Slice &src, const Slice &dst, const Slice &member, int *ret) {
-  std::vector<Slice> members{member};
-  rocksdb::Status s = Remove(src, members, ret);
-  if (!s.ok() || *ret == 0) {
-    return s;
+  *ret = 0;
+
+  std::string src_ns_key, dst_ns_key;
+  AppendNamespacePrefix(src, &src_ns_key);
+  AppendNamespacePrefix(dst, &dst_ns_key);
+  if (src_ns_key == dst_ns_key) {
+    return IsMember(src, member, ret);
+  }
+
+  MultiLockGuard guard(storage_->GetLockManager(), {src_ns_key, dst_ns_key});
+  SetMetadata src_metadata, dst_metadata;
+  rocksdb::Status s = GetMetadata(src_ns_key, &src_metadata);
+  if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
+  s = GetMetadata(dst_ns_key, &dst_metadata);
+  if (!s.ok() && !s.IsNotFound()) return s;
+
+  std::string value, src_sub_key, dst_sub_key;
+  InternalKey(src_ns_key, member, src_metadata.version).Encode(&src_sub_key);
+  s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, src_sub_key, &value);
+  if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
+
+  // remove the member from src and add it into dst in the same batch,
+  // so the member would never be seen in both or neither of the sets
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisSet);
+  batch.PutLogData(log_data.Encode());
+  std::string bytes;
+  batch.Delete(subkey_cf_handle_, src_sub_key);
+  src_metadata.size -= 1;
+  src_metadata.Encode(&bytes);
+  batch.Put(metadata_cf_handle_, src_ns_key, bytes);
+
+  InternalKey(dst_ns_key, member, dst_metadata.version).Encode(&dst_sub_key);
+  s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, dst_sub_key, &value);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.IsNotFound()) {
+    batch.Put(subkey_cf_handle_, dst_sub_key, Slice());
+    dst_metadata.size += 1;
+    bytes.clear();
+    dst_metadata.Encode(&bytes);
+    batch.Put(metadata_cf_handle_, dst_ns_key, bytes);
   }
-  return Add(dst, members, ret);
+  *ret = 1;
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
 }
 
 rocksdb::Status Set::Scan(const Slice &user_key,
                           const std::string &cursor,
                           uint64_t limit,
                           const std::string &member_prefix,
-                          std::vector<std::string> *members) {
-  return SubKeyScanner::Scan(kRedisSet, user_key, cursor, limit, member_prefix, members);
+                          std::vector<std::string> *members,
+                          const std::string &iter_token) {
+  return SubKeyScanner::Scan(kRedisSet, user_key, cursor, limit, member_prefix, members, iter_token);
+}
+
+void Set::MemberIterator::Seek(const Slice &member) {
+  if (Valid() && Member().compare(member) >= 0) return;
+  std::string key = prefix;
+  key.append(member.data(), member.size());
+  iter->Seek(key);
+}
+
+// newMemberIterator returns an empty iterator if the set is not found
+rocksdb::Status Set::newMemberIterator(const Slice &user_key, const rocksdb::ReadOptions &read_options,
+                                       std::unique_ptr<MemberIterator> *iter) {
+  iter->reset();
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+  SetMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
+
+  std::unique_ptr<MemberIterator> member_iter(new MemberIterator);
+  InternalKey(ns_key, "", metadata.version).Encode(&member_iter->prefix);
+  member_iter->size = metadata.size;
+  rocksdb::ReadOptions iter_options(read_options);
+  iter_options.prefix_same_as_start = true;
+  member_iter->iter.reset(storage_->NewIterator(iter_options, subkey_cf_handle_));
+  member_iter->iter->Seek(member_iter->prefix);
+  *iter = std::move(member_iter);
+  return rocksdb::Status::OK();
 }
 
 /*
@@ -224,23 +363,33 @@ rocksdb::Status Set::Scan(const Slice &user_key,
  */
 rocksdb::Status Set::Diff(const std::vector<Slice> &keys, std::vector<std::string> *members) {
   members->clear();
-  std::vector<std::string> source_members;
-  auto s = Members(keys[0], &source_members);
-  if (!s.ok()) return s;
 
-  std::map<std::string, bool> exclude_members;
-  std::vector<std::string> target_members;
+  rocksdb::ReadOptions read_options;
+  LatestSnapShot ss(db_);
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.fill_cache = false;
+  std::unique_ptr<MemberIterator> source;
+  auto s = newMemberIterator(keys[0], read_options, &source);
+  if (!s.ok() || !source) return s;
+  std::vector<std::unique_ptr<MemberIterator>> excludes;
   for (size_t i = 1; i < keys.size(); i++) {
-    s = Members(keys[i], &target_members);
+    std::unique_ptr<MemberIterator> exclude;
+    s = newMemberIterator(keys[i], read_options, &exclude);
     if (!s.ok()) return s;
-    for (const auto &member : target_members) {
-      exclude_members[member] = true;
-    }
+    if (exclude) excludes.emplace_back(std::move(exclude));
   }
-  for (const auto &member : source_members) {
-    if (exclude_members.find(member) == exclude_members.end()) {
-      members->push_back(member);
+  // all the members are sorted, so the exclude iterators only move forward
+  for (; source->Valid(); source->Next()) {
+    Slice member = source->Member();
+    bool excluded = false;
+    for (const auto &exclude : excludes) {
+      exclude->Seek(member);
+      if (exclude->Valid() && exclude->Member() == member) {
+        excluded = true;
+        break;
+      }
     }
+    if (!excluded) members->emplace_back(member.ToString());
   }
   return rocksdb::Status::OK();
 }
@@ -256,17 +405,28 @@ rocksdb::Status Set::Diff(const std::vector<Slice> &keys, std::vector<std::strin
 rocksdb::Status Set::Union(const std::vector<Slice> &keys, std::vector<std::string> *members) {
   members->clear();
 
-  std::map<std::string, bool> union_members;
-  std::vector<std::string> target_members;
-  for (size_t i = 0; i < keys.size(); i++) {
-    auto s = Members(keys[i], &target_members);
+  rocksdb::ReadOptions read_options;
+  LatestSnapShot ss(db_);
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.fill_cache = false;
+  std::vector<std::unique_ptr<MemberIterator>> iters;
+  for (const auto &key : keys) {
+    std::unique_ptr<MemberIterator> iter;
+    auto s = newMemberIterator(key, read_options, &iter);
     if (!s.ok()) return s;
-    for (const auto &member : target_members) {
-      union_members[member] = true;
-    }
+    if (iter) iters.emplace_back(std::move(iter));
   }
-  for (const auto &iter : union_members) {
-    members->emplace_back(iter.first);
+  // merge the sorted members of all sets, and skip the duplicate members
+  while (true) {
+    MemberIterator *min_iter = nullptr;
+    for (const auto &iter : iters) {
+      if (!iter->Valid()) continue;
+      if (!min_iter || iter->Member().compare(min_iter->Member()) < 0) min_iter = iter.get();
+    }
+    if (!min_iter) break;
+    Slice member = min_iter->Member();
+    if (members->empty() || members->back() != member) members->emplace_back(member.ToString());
+    min_iter->Next();
   }
   return rocksdb::Status::OK();
 }
@@ -282,25 +442,34 @@ rocksdb::Status Set::Union(const std::vector<Slice> &keys, std::vector<std::stri
 rocksdb::Status Set::Inter(const std::vector<Slice> &keys, std::vector<std::string> *members) {
   members->clear();
 
-  std::map<std::string, size_t> member_counters;
-  std::vector<std::string> target_members;
-  auto s = Members(keys[0], &target_members);
-  if (!s.ok() || target_members.empty()) return s;
-  for (const auto &member : target_members) {
-    member_counters[member] = 1;
-  }
-  for (size_t i = 1; i < keys.size(); i++) {
-    auto s = Members(keys[i], &target_members);
-    if (!s.ok() || target_members.empty()) return s;
-    for (const auto &member : target_members) {
-      if (member_counters.find(member) == member_counters.end()) continue;
-      member_counters[member]++;
-    }
+  rocksdb::ReadOptions read_options;
+  LatestSnapShot ss(db_);
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.fill_cache = false;
+  std::vector<std::unique_ptr<MemberIterator>> iters;
+  for (const auto &key : keys) {
+    std::unique_ptr<MemberIterator> iter;
+    auto s = newMemberIterator(key, read_options, &iter);
+    if (!s.ok() || !iter) return s;
+    iters.emplace_back(std::move(iter));
   }
-  for (const auto iter : member_counters) {
-    if (iter.second == keys.size()) {  // all the sets contain this member
-      members->emplace_back(iter.first);
+  // walk the smallest set, and seek the others to check whether the member exists
+  std::sort(iters.begin(), iters.end(),
+            [](const std::unique_ptr<MemberIterator> &a, const std::unique_ptr<MemberIterator> &b) {
+              return a->size < b->size;
+            });
+  for (auto &smallest = iters[0]; smallest->Valid(); smallest->Next()) {
+    Slice member = smallest->Member();
+    bool all_contain = true;
+    for (size_t i = 1; i < iters.size(); i++) {
+      iters[i]->Seek(member);
+      if (!iters[i]->Valid()) return rocksdb::Status::OK();  // no more members in this set
+      if (iters[i]->Member() != member) {
+        all_contain = false;
+        break;
+      }
     }
+    if (all_contain) members->emplace_back(member.ToString());
   }
   return rocksdb::Status::OK();
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -11,10 +12,12 @@ namespace Redis {
 class Set : public SubKeyScanner {
  public:
   explicit Set(Engine::Storage *storage, const std::string &ns)
-      : SubKeyScanner(storage, ns) {}
+      : SubKeyScanner(storage, ns),
+        subkey_cf_handle_(storage->GetSubKeyCFHandle(kRedisSet)) {}
 
   rocksdb::Status Card(const Slice &user_key, int *ret);
   rocksdb::Status IsMember(const Slice &user_key, const Slice &member, int *ret);
+  rocksdb::Status MIsMember(const Slice &user_key, const std::vector<Slice> &members, std::vector<int> *exists);
   rocksdb::Status Add(const Slice &user_key, const std::vector<Slice> &members, int *ret);
   rocksdb::Status Remove(const Slice &user_key, const std::vector<Slice> &members, int *ret);
   rocksdb::Status Members(const Slice &user_key, std::vector<std::string> *members);
@@ -31,10 +34,27 @@ class Set : public SubKeyScanner {
                        const std::string &cursor,
                        uint64_t limit,
                        const std::string &member_prefix,
-                       std::vector<std::string> *members);
+                       std::vector<std::string> *members,
+                       const std::string &iter_token = "");
 
  private:
+  // MemberIterator walks the members of a set in lexicographical order
+  struct MemberIterator {
+    std::string prefix;
+    uint32_t size;
+    std::unique_ptr<rocksdb::Iterator> iter;
+    bool Valid() const { return iter->Valid() && iter->key().starts_with(prefix); }
+    Slice Member() const { return Slice(iter->key().data() + prefix.size(), iter->key().size() - prefix.size()); }
+    void Next() { iter->Next(); }
+    // Seek to the first member which is not less than the target
+    void Seek(const Slice &member);
+  };
+
   rocksdb::Status GetMetadata(const Slice &ns_key, SetMetadata *metadata);
+  rocksdb::Status newMemberIterator(const Slice &user_key, const rocksdb::ReadOptions &read_options,
+                                    std::unique_ptr<MemberIterator> *iter);
+
+  rocksdb::ColumnFamilyHandle *subkey_cf_handle_;
 };
 
 }  // namespace Redis
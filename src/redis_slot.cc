@@ -0,0 +1,33 @@
+#include "redis_slot.h"
+
+// CRC16 of the CCITT(XMODEM) variant which the redis cluster uses, the poly is 0x1021
+uint16_t Crc16(const char *buf, size_t len) {
+  uint16_t crc = 0;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= static_cast<uint16_t>(static_cast<uint8_t>(buf[i])) << 8;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+    }
+  }
+  return crc;
+}
+
+int GetSlotNumFromKey(const rocksdb::Slice &key) {
+  const char *data = key.data();
+  size_t size = key.size();
+  // only the part between the first '{' and the next '}' is hashed if it's not empty
+  size_t start = 0;
+  for (; start < size; start++) {
+    if (data[start] == '{') break;
+  }
+  if (start < size) {
+    size_t stop = start + 1;
+    for (; stop < size; stop++) {
+      if (data[stop] == '}') break;
+    }
+    if (stop < size && stop != start + 1) {
+      return Crc16(data + start + 1, stop - start - 1) & (kClusterSlots - 1);
+    }
+  }
+  return Crc16(data, size) & (kClusterSlots - 1);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <rocksdb/slice.h>
+#include <cstdint>
+
+// the slots are the same as the redis cluster, so the clients could route the keys
+// in the same way, and the keys with the same hash tag({...}) fall into the same slot
+const int kClusterSlots = 16384;
+
+uint16_t Crc16(const char *buf, size_t len);
+int GetSlotNumFromKey(const rocksdb::Slice &key);
@@ -1,17 +1,140 @@
 #include "redis_sortedint.h"
 
+#include <algorithm>
+#include <iterator>
 #include <map>
 #include <iostream>
 #include <limits>
+#include <memory>
 
 namespace Redis {
 
+// used by the blocked sortedint after sortedint-block-size is set to 0
+const uint32_t kDefaultSortedintBlockSize = 1024;
+
+// the id is the subkey of the plain sortedint, and the min id of the block is the subkey of the block
+static void encodeIdKey(const Slice &ns_key, uint64_t version, uint64_t id, std::string *key) {
+  std::string sub_key;
+  PutFixed64(&sub_key, id);
+  InternalKey(ns_key, sub_key, version).Encode(key);
+}
+
+void Sortedint::EncodeBlock(std::vector<uint64_t>::const_iterator begin,
+                            std::vector<uint64_t>::const_iterator end, std::string *value) {
+  value->clear();
+  if (begin == end) return;
+  PutFixed32(value, static_cast<uint32_t>(end - begin));
+  PutFixed64(value, *begin);
+  PutFixed64(value, *(end - 1));
+  for (auto iter = begin + 1; iter != end; iter++) {
+    PutVarint64(value, *iter - *(iter - 1));
+  }
+}
+
+bool Sortedint::DecodeBlock(Slice value, std::vector<uint64_t> *ids) {
+  ids->clear();
+  uint32_t count;
+  uint64_t min_id, max_id, delta;
+  if (!GetFixed32(&value, &count) || count == 0) return false;
+  if (!GetFixed64(&value, &min_id) || !GetFixed64(&value, &max_id)) return false;
+  ids->reserve(count);
+  ids->emplace_back(min_id);
+  for (uint32_t i = 1; i < count; i++) {
+    if (!GetVarint64(&value, &delta)) return false;
+    ids->emplace_back(ids->back() + delta);
+  }
+  return ids->back() == max_id;
+}
+
+uint32_t Sortedint::blockCapacity() {
+  int size = storage_->GetConfig()->sortedint_block_size;
+  return size > 0 ? static_cast<uint32_t>(size) : kDefaultSortedintBlockSize;
+}
+
+void Sortedint::writeBlocks(const Slice &ns_key, const SortedintMetadata &metadata,
+                            const std::vector<uint64_t> &ids, bool appended, rocksdb::WriteBatch *batch) {
+  // the ids appended after the last block are packed into the full blocks, or the
+  // overflowed block is split evenly, so the random inserts won't split off tiny blocks
+  size_t capacity = blockCapacity();
+  if (!appended && ids.size() > capacity) {
+    size_t n_blocks = (ids.size() + capacity - 1) / capacity;
+    capacity = (ids.size() + n_blocks - 1) / n_blocks;
+  }
+  std::string key, value;
+  for (size_t pos = 0; pos < ids.size(); pos += capacity) {
+    auto end = ids.begin() + std::min(pos + capacity, ids.size());
+    encodeIdKey(ns_key, metadata.version, ids[pos], &key);
+    EncodeBlock(ids.begin() + pos, end, &value);
+    batch->Put(subkey_cf_handle_, key, value);
+  }
+}
+
+rocksdb::Status Sortedint::updateBlocks(const Slice &ns_key, const SortedintMetadata &metadata,
+                                        const std::vector<uint64_t> &ids, bool remove,
+                                        rocksdb::WriteBatch *batch, int *ret) {
+  std::string prefix, seek_key, block_key;
+  InternalKey(ns_key, "", metadata.version).Encode(&prefix);
+  // the caller is holding the key lock, so the blocks can't be changed by others
+  rocksdb::ReadOptions read_options;
+  read_options.prefix_same_as_start = true;
+  std::unique_ptr<rocksdb::Iterator> iter(storage_->NewIterator(read_options, subkey_cf_handle_));
+  std::vector<uint64_t> block, updated;
+  size_t i = 0;
+  while (i < ids.size()) {
+    // the ids before the first block are added into the first block
+    encodeIdKey(ns_key, metadata.version, ids[i], &seek_key);
+    iter->SeekForPrev(seek_key);
+    if (!iter->Valid() || !iter->key().starts_with(prefix)) iter->Seek(prefix);
+    bool found = iter->Valid() && iter->key().starts_with(prefix);
+    if (!found && remove) break;
+    block.clear();
+    bool has_next = false;
+    uint64_t next_min_id = 0;
+    if (found) {
+      block_key = iter->key().ToString();
+      if (!DecodeBlock(iter->value(), &block)) {
+        return rocksdb::Status::Corruption("the sortedint block was corrupted");
+      }
+      iter->Next();
+      if (iter->Valid() && iter->key().starts_with(prefix)) {
+        InternalKey ikey(iter->key());
+        Slice sub_key = ikey.GetSubKey();
+        has_next = GetFixed64(&sub_key, &next_min_id);
+      }
+    }
+    if (!iter->status().ok()) return iter->status();
+
+    // the ids before the next block fall into the current block
+    size_t j = i;
+    while (j < ids.size() && (!has_next || ids[j] < next_min_id)) j++;
+    updated.clear();
+    if (remove) {
+      std::set_difference(block.begin(), block.end(), ids.begin() + i, ids.begin() + j,
+                          std::back_inserter(updated));
+    } else {
+      std::set_union(block.begin(), block.end(), ids.begin() + i, ids.begin() + j,
+                     std::back_inserter(updated));
+    }
+    bool appended = !remove && !has_next && (block.empty() || ids[i] > block.back());
+    i = j;
+    if (updated.size() == block.size()) continue;
+    *ret += static_cast<int>(remove ? block.size() - updated.size() : updated.size() - block.size());
+    // the key of the block is changed if its min id is changed, and the put would
+    // override the delete in the same batch otherwise
+    if (found) batch->Delete(subkey_cf_handle_, block_key);
+    writeBlocks(ns_key, metadata, updated, appended, batch);
+  }
+  return rocksdb::Status::OK();
+}
+
 rocksdb::Status Sortedint::GetMetadata(const Slice &ns_key, SortedintMetadata *metadata) {
   return Database::GetMetadata(kRedisSortedint, ns_key, metadata);
 }
 
 rocksdb::Status Sortedint::Add(const Slice &user_key, std::vector<uint64_t> ids, int *ret) {
   *ret = 0;
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
 
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
@@ -20,19 +143,25 @@ rocksdb::Status Sortedint::Add(const Slice &user_key, std::vector<uint64_t> ids,
   SortedintMetadata metadata;
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.IsNotFound() && storage_->GetConfig()->sortedint_block_size > 0) metadata.EnableBlocks();
 
   std::string value;
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisSortedint);
   batch.PutLogData(log_data.Encode());
   std::string sub_key;
+  if (metadata.IsBlocked()) {
+    s = updateBlocks(ns_key, metadata, ids, false, &batch, ret);
+    if (!s.ok()) return s;
+    ids.clear();
+  }
   for (const auto id : ids) {
     std::string id_buf;
     PutFixed64(&id_buf, id);
     InternalKey(ns_key, id_buf, metadata.version).Encode(&sub_key);
-    s = db_->Get(rocksdb::ReadOptions(), sub_key, &value);
+    s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value);
     if (s.ok()) continue;
-    batch.Put(sub_key, Slice());
+    batch.Put(subkey_cf_handle_, sub_key, Slice());
     *ret += 1;
   }
   if (*ret > 0) {
@@ -46,12 +175,14 @@ rocksdb::Status Sortedint::Add(const Slice &user_key, std::vector<uint64_t> ids,
 
 rocksdb::Status Sortedint::Remove(const Slice &user_key, std::vector<uint64_t> ids, int *ret) {
   *ret = 0;
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
 
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
   LockGuard guard(storage_->GetLockManager(), ns_key);
-  SortedintMetadata metadata;
+  SortedintMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
@@ -59,13 +190,18 @@ rocksdb::Status Sortedint::Remove(const Slice &user_key, std::vector<uint64_t> i
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisSortedint);
   batch.PutLogData(log_data.Encode());
+  if (metadata.IsBlocked()) {
+    s = updateBlocks(ns_key, metadata, ids, true, &batch, ret);
+    if (!s.ok()) return s;
+    ids.clear();
+  }
   for (const auto id : ids) {
     std::string id_buf;
     PutFixed64(&id_buf, id);
     InternalKey(ns_key, id_buf, metadata.version).Encode(&sub_key);
-    s = db_->Get(rocksdb::ReadOptions(), sub_key, &value);
+    s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value);
     if (!s.ok()) continue;
-    batch.Delete(sub_key);
+    batch.Delete(subkey_cf_handle_, sub_key);
     *ret += 1;
   }
   if (*ret == 0) return rocksdb::Status::OK();
@@ -81,7 +217,7 @@ rocksdb::Status Sortedint::Card(const Slice &user_key, int *ret) {
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  SortedintMetadata metadata;
+  SortedintMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
   *ret = metadata.size;
@@ -99,9 +235,10 @@ rocksdb::Status Sortedint::Range(const Slice &user_key,
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  SortedintMetadata metadata;
+  SortedintMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
+  if (metadata.IsBlocked()) return rangeBlocks(ns_key, metadata, cursor_id, offset, limit, reversed, ids);
 
   std::string prefix, start_key, start_buf;
   uint64_t start_id = cursor_id;
@@ -116,7 +253,8 @@ rocksdb::Status Sortedint::Range(const Slice &user_key,
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
   uint64_t id, pos = 0;
-  auto iter = db_->NewIterator(read_options);
+  read_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(read_options, subkey_cf_handle_);
   for (!reversed ? iter->Seek(start_key) : iter->SeekForPrev(start_key);
        iter->Valid() && iter->key().starts_with(prefix);
        !reversed ? iter->Next() : iter->Prev()) {
@@ -130,4 +268,94 @@ rocksdb::Status Sortedint::Range(const Slice &user_key,
   delete iter;
   return rocksdb::Status::OK();
 }
+
+rocksdb::Status Sortedint::rangeBlocks(const Slice &ns_key, const SortedintMetadata &metadata, uint64_t cursor_id,
+                                       uint64_t offset, uint64_t limit, bool reversed, std::vector<uint64_t> *ids) {
+  uint64_t start_id = cursor_id;
+  if (reversed && cursor_id == 0) {
+    start_id = std::numeric_limits<uint64_t>::max();
+  }
+  std::string prefix, start_key;
+  InternalKey(ns_key, "", metadata.version).Encode(&prefix);
+  encodeIdKey(ns_key, metadata.version, start_id, &start_key);
+  rocksdb::ReadOptions read_options;
+  LatestSnapShot ss(db_);
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.fill_cache = false;
+  read_options.prefix_same_as_start = true;
+  std::unique_ptr<rocksdb::Iterator> iter(storage_->NewIterator(read_options, subkey_cf_handle_));
+  // the start id is in the last block whose min id isn't greater than it
+  iter->SeekForPrev(start_key);
+  if (!reversed && (!iter->Valid() || !iter->key().starts_with(prefix))) iter->Seek(prefix);
+  uint64_t pos = 0;
+  std::vector<uint64_t> block;
+  for (; iter->Valid() && iter->key().starts_with(prefix); !reversed ? iter->Next() : iter->Prev()) {
+    if (!DecodeBlock(iter->value(), &block)) {
+      return rocksdb::Status::Corruption("the sortedint block was corrupted");
+    }
+    if (!reversed) {
+      for (auto it = std::lower_bound(block.begin(), block.end(), start_id); it != block.end(); it++) {
+        if (*it == cursor_id || pos++ < offset) continue;
+        ids->emplace_back(*it);
+        if (limit > 0 && ids->size() >= limit) return rocksdb::Status::OK();
+      }
+    } else {
+      for (auto it = std::upper_bound(block.begin(), block.end(), start_id); it != block.begin();) {
+        it--;
+        if (*it == cursor_id || pos++ < offset) continue;
+        ids->emplace_back(*it);
+        if (limit > 0 && ids->size() >= limit) return rocksdb::Status::OK();
+      }
+    }
+  }
+  return iter->status();
+}
+
+rocksdb::Status Sortedint::MExist(const Slice &user_key, const std::vector<uint64_t> &ids, std::vector<int> *exists) {
+  exists->clear();
+
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  SortedintMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.IsNotFound()) {
+    exists->resize(ids.size(), 0);
+    return rocksdb::Status::OK();
+  }
+
+  rocksdb::ReadOptions read_options;
+  LatestSnapShot ss(db_);
+  read_options.snapshot = ss.GetSnapShot();
+  std::string prefix, sub_key, value;
+  if (!metadata.IsBlocked()) {
+    for (const auto id : ids) {
+      encodeIdKey(ns_key, metadata.version, id, &sub_key);
+      s = storage_->Get(read_options, subkey_cf_handle_, sub_key, &value);
+      if (!s.ok() && !s.IsNotFound()) return s;
+      exists->emplace_back(s.ok() ? 1 : 0);
+    }
+    return rocksdb::Status::OK();
+  }
+
+  InternalKey(ns_key, "", metadata.version).Encode(&prefix);
+  read_options.prefix_same_as_start = true;
+  std::unique_ptr<rocksdb::Iterator> iter(storage_->NewIterator(read_options, subkey_cf_handle_));
+  // the adjacent ids are likely in the same block, so the last decoded block is reused
+  std::vector<uint64_t> block;
+  for (const auto id : ids) {
+    if (block.empty() || id < block.front() || id > block.back()) {
+      block.clear();
+      encodeIdKey(ns_key, metadata.version, id, &sub_key);
+      iter->SeekForPrev(sub_key);
+      if (iter->Valid() && iter->key().starts_with(prefix) && !DecodeBlock(iter->value(), &block)) {
+        return rocksdb::Status::Corruption("the sortedint block was corrupted");
+      }
+      if (!iter->status().ok()) return iter->status();
+    }
+    exists->emplace_back(std::binary_search(block.begin(), block.end(), id) ? 1 : 0);
+  }
+  return rocksdb::Status::OK();
+}
 }  // namespace Redis
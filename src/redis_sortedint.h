@@ -10,7 +10,9 @@ namespace Redis {
 
 class Sortedint : public Database {
  public:
-  explicit Sortedint(Engine::Storage *storage, const std::string &ns) : Database(storage, ns) {}
+  explicit Sortedint(Engine::Storage *storage, const std::string &ns)
+      : Database(storage, ns),
+        subkey_cf_handle_(storage->GetSubKeyCFHandle(kRedisSortedint)) {}
   rocksdb::Status Card(const Slice &user_key, int *ret);
   rocksdb::Status Add(const Slice &user_key, std::vector<uint64_t> ids, int *ret);
   rocksdb::Status Remove(const Slice &user_key, std::vector<uint64_t> ids, int *ret);
@@ -20,9 +22,29 @@ class Sortedint : public Database {
                         uint64_t limit,
                         bool reversed,
                         std::vector<uint64_t> *ids);
+  // MExist checks the ids in the order of the input, exists[i] is 1 if the ids[i] is in the key
+  rocksdb::Status MExist(const Slice &user_key, const std::vector<uint64_t> &ids, std::vector<int> *exists);
+
+  // The blocked sortedint packs the sorted ids into blocks keyed by the min id of the block, the
+  // value is `count(4byte)|min(8byte)|max(8byte)|varint deltas` and the block of the id is the
+  // last block whose min id isn't greater than it.
+  static void EncodeBlock(std::vector<uint64_t>::const_iterator begin,
+                          std::vector<uint64_t>::const_iterator end, std::string *value);
+  static bool DecodeBlock(Slice value, std::vector<uint64_t> *ids);
 
  private:
   rocksdb::Status GetMetadata(const Slice &ns_key, SortedintMetadata *metadata);
+  uint32_t blockCapacity();
+  // updateBlocks adds or removes the sorted unique ids, only the blocks which the ids fall into are rewritten
+  rocksdb::Status updateBlocks(const Slice &ns_key, const SortedintMetadata &metadata,
+                               const std::vector<uint64_t> &ids, bool remove,
+                               rocksdb::WriteBatch *batch, int *ret);
+  void writeBlocks(const Slice &ns_key, const SortedintMetadata &metadata,
+                   const std::vector<uint64_t> &ids, bool appended, rocksdb::WriteBatch *batch);
+  rocksdb::Status rangeBlocks(const Slice &ns_key, const SortedintMetadata &metadata, uint64_t cursor_id,
+                              uint64_t offset, uint64_t limit, bool reversed, std::vector<uint64_t> *ids);
+
+  rocksdb::ColumnFamilyHandle *subkey_cf_handle_;
 };
 
 }  // namespace Redis
@@ -0,0 +1,605 @@
+#include "redis_stream.h"
+
+#include <ctype.h>
+#include <chrono>
+#include <memory>
+#include <set>
+#include <utility>
+
+namespace Redis {
+
+const char kStreamEntryTag = 'e';
+const char kStreamGroupTag = 'g';
+const char kStreamPendingTag = 'p';
+// the trimmed entries are removed by one range deletion instead of the point deletions if
+// there are many of them, the range deletion can't be used in the transaction
+const uint64_t kStreamTrimRangeDeletionMinEntries = 128;
+
+static uint64_t nowMs() {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+}
+
+static bool parseUInt64(const std::string &input, uint64_t *value) {
+  // stoull accepts the leading spaces and the minus sign, which aren't valid in the id
+  if (input.empty() || !isdigit(input[0])) return false;
+  try {
+    size_t idx = 0;
+    *value = std::stoull(input, &idx);
+    return idx == input.size();
+  } catch (std::exception &e) {
+    return false;
+  }
+}
+
+static bool decodeEntryID(Slice sub_key, StreamEntryID *id) {
+  if (sub_key.size() != 17 || sub_key[0] != kStreamEntryTag) return false;
+  sub_key.remove_prefix(1);
+  GetFixed64(&sub_key, &id->ms);
+  GetFixed64(&sub_key, &id->seq);
+  return true;
+}
+
+bool StreamEntryID::Next(StreamEntryID *next) const {
+  if (seq < UINT64_MAX) {
+    *next = StreamEntryID(ms, seq + 1);
+  } else if (ms < UINT64_MAX) {
+    *next = StreamEntryID(ms + 1, 0);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool StreamEntryID::Prev(StreamEntryID *prev) const {
+  if (seq > 0) {
+    *prev = StreamEntryID(ms, seq - 1);
+  } else if (ms > 0) {
+    *prev = StreamEntryID(ms - 1, UINT64_MAX);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool StreamEntryID::Parse(const std::string &input, uint64_t missing_seq, StreamEntryID *id) {
+  auto pos = input.find('-');
+  if (!parseUInt64(input.substr(0, pos), &id->ms)) return false;
+  if (pos == std::string::npos) {
+    id->seq = missing_seq;
+    return true;
+  }
+  return parseUInt64(input.substr(pos + 1), &id->seq);
+}
+
+void Stream::EncodeEntrySubKey(const StreamEntryID &id, std::string *sub_key) {
+  sub_key->clear();
+  sub_key->push_back(kStreamEntryTag);
+  PutFixed64(sub_key, id.ms);
+  PutFixed64(sub_key, id.seq);
+}
+
+void Stream::EncodeEntryValue(const std::vector<std::string> &values, std::string *value) {
+  value->clear();
+  for (const auto &v : values) {
+    PutVarint64(value, v.size());
+    value->append(v);
+  }
+}
+
+bool Stream::DecodeEntryValue(Slice value, std::vector<std::string> *values) {
+  values->clear();
+  uint64_t len;
+  while (GetVarint64(&value, &len)) {
+    if (value.size() < len) return false;
+    values->emplace_back(value.data(), len);
+    value.remove_prefix(len);
+  }
+  return value.empty();
+}
+
+void Stream::encodePendingSubKey(const std::string &group, const StreamEntryID &id, std::string *sub_key) {
+  sub_key->clear();
+  sub_key->push_back(kStreamPendingTag);
+  PutFixed32(sub_key, static_cast<uint32_t>(group.size()));
+  sub_key->append(group);
+  PutFixed64(sub_key, id.ms);
+  PutFixed64(sub_key, id.seq);
+}
+
+void Stream::decodePendingValue(Slice value, StreamPendingEntry *entry) {
+  GetFixed64(&value, &entry->delivery_time);
+  GetFixed64(&value, &entry->delivery_count);
+  entry->consumer = value.ToString();
+}
+
+rocksdb::Status Stream::GetMetadata(const Slice &ns_key, StreamMetadata *metadata) {
+  return Database::GetMetadata(kRedisStream, ns_key, metadata);
+}
+
+rocksdb::Status Stream::getGroup(const Slice &ns_key, const StreamMetadata &metadata,
+                                 const std::string &group, StreamEntryID *last_delivered) {
+  std::string sub_key, value;
+  InternalKey(ns_key, std::string(1, kStreamGroupTag) + group, metadata.version).Encode(&sub_key);
+  auto s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, sub_key, &value);
+  if (!s.ok()) return s;
+  Slice input(value);
+  GetFixed64(&input, &last_delivered->ms);
+  GetFixed64(&input, &last_delivered->seq);
+  return rocksdb::Status::OK();
+}
+
+void Stream::putGroup(const Slice &ns_key, const StreamMetadata &metadata, const std::string &group,
+                      const StreamEntryID &last_delivered, rocksdb::WriteBatch *batch) {
+  std::string sub_key, value;
+  InternalKey(ns_key, std::string(1, kStreamGroupTag) + group, metadata.version).Encode(&sub_key);
+  PutFixed64(&value, last_delivered.ms);
+  PutFixed64(&value, last_delivered.seq);
+  batch->Put(subkey_cf_handle_, sub_key, value);
+}
+
+void Stream::putPending(const Slice &ns_key, const StreamMetadata &metadata, const std::string &group,
+                        const StreamPendingEntry &entry, rocksdb::WriteBatch *batch) {
+  std::string sub_key, key, value;
+  encodePendingSubKey(group, entry.id, &sub_key);
+  InternalKey(ns_key, sub_key, metadata.version).Encode(&key);
+  PutFixed64(&value, entry.delivery_time);
+  PutFixed64(&value, entry.delivery_count);
+  value.append(entry.consumer);
+  batch->Put(subkey_cf_handle_, key, value);
+}
+
+static rocksdb::Status noGroupError(const Slice &user_key, const std::string &group) {
+  return rocksdb::Status::InvalidArgument("NOGROUP No such key '" + user_key.ToString()
+                                          + "' or consumer group '" + group + "'");
+}
+
+rocksdb::Status Stream::Add(const Slice &user_key, const StreamAddOptions &options,
+                            const std::vector<std::string> &values, StreamEntryID *id) {
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  StreamMetadata metadata;
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok() && !s.IsNotFound()) return s;
+
+  // the stream itself is counted in the size, so it's kept after all entries are removed
+  if (s.IsNotFound()) metadata.size = 1;
+  StreamEntryID last_id(metadata.last_ms, metadata.last_seq);
+  if (options.auto_id) {
+    uint64_t now = nowMs();
+    if (now > last_id.ms) {
+      *id = StreamEntryID(now, 0);
+    } else if (!last_id.Next(id)) {
+      return rocksdb::Status::InvalidArgument("The stream has exhausted the last possible ID");
+    }
+  } else {
+    *id = options.id;
+    if (*id == StreamEntryID::Min()) {
+      return rocksdb::Status::InvalidArgument("The ID specified in XADD must be greater than 0-0");
+    }
+    if (*id <= last_id) {
+      return rocksdb::Status::InvalidArgument(
+          "The ID specified in XADD is equal or smaller than the target stream top item");
+    }
+  }
+
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisStream);
+  batch.PutLogData(log_data.Encode());
+  // trim before adding, since the iterator of the trimming can't see the new entry in the batch
+  if (options.with_max_len) {
+    uint64_t trimmed = 0;
+    s = trim(ns_key, &metadata, options.max_len > 0 ? options.max_len - 1 : 0, &batch, &trimmed);
+    if (!s.ok()) return s;
+  }
+  if (!options.with_max_len || options.max_len > 0) {
+    std::string sub_key, key, value;
+    EncodeEntrySubKey(*id, &sub_key);
+    InternalKey(ns_key, sub_key, metadata.version).Encode(&key);
+    EncodeEntryValue(values, &value);
+    batch.Put(subkey_cf_handle_, key, value);
+    metadata.length++;
+    metadata.size++;
+  }
+  metadata.last_ms = id->ms;
+  metadata.last_seq = id->seq;
+  std::string bytes;
+  metadata.Encode(&bytes);
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+rocksdb::Status Stream::Len(const Slice &user_key, uint64_t *ret) {
+  *ret = 0;
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+  StreamMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
+  *ret = metadata.length;
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status Stream::LastID(const Slice &user_key, StreamEntryID *id) {
+  *id = StreamEntryID::Min();
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+  StreamMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
+  *id = StreamEntryID(metadata.last_ms, metadata.last_seq);
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status Stream::Range(const Slice &user_key, const StreamEntryID &start, const StreamEntryID &end,
+                              uint64_t count, bool reverse, std::vector<StreamEntry> *entries) {
+  entries->clear();
+  if (end < start) return rocksdb::Status::OK();
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+  StreamMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
+
+  std::string prefix, start_key, end_key, sub_key;
+  InternalKey(ns_key, std::string(1, kStreamEntryTag), metadata.version).Encode(&prefix);
+  EncodeEntrySubKey(start, &sub_key);
+  InternalKey(ns_key, sub_key, metadata.version).Encode(&start_key);
+  EncodeEntrySubKey(end, &sub_key);
+  InternalKey(ns_key, sub_key, metadata.version).Encode(&end_key);
+
+  LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.prefix_same_as_start = true;
+  std::unique_ptr<rocksdb::Iterator> iter(storage_->NewIterator(read_options, subkey_cf_handle_));
+  // the entries are ordered by their ids, so the range is one sequential scan
+  for (!reverse ? iter->Seek(start_key) : iter->SeekForPrev(end_key);
+       iter->Valid() && iter->key().starts_with(prefix);
+       !reverse ? iter->Next() : iter->Prev()) {
+    if (!reverse ? iter->key().compare(end_key) > 0 : iter->key().compare(start_key) < 0) break;
+    StreamEntry entry;
+    if (!decodeEntryID(InternalKey(iter->key()).GetSubKey(), &entry.id)) continue;
+    if (!DecodeEntryValue(iter->value(), &entry.values)) {
+      return rocksdb::Status::Corruption("the stream entry was truncated");
+    }
+    entries->emplace_back(std::move(entry));
+    if (count > 0 && entries->size() >= count) break;
+  }
+  return iter->status();
+}
+
+rocksdb::Status Stream::DeleteEntries(const Slice &user_key, const std::vector<StreamEntryID> &ids, uint64_t *ret) {
+  *ret = 0;
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  StreamMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
+
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisStream);
+  batch.PutLogData(log_data.Encode());
+  std::set<StreamEntryID> unique_ids(ids.begin(), ids.end());
+  std::string sub_key, key, value;
+  for (const auto &id : unique_ids) {
+    EncodeEntrySubKey(id, &sub_key);
+    InternalKey(ns_key, sub_key, metadata.version).Encode(&key);
+    s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, key, &value);
+    if (s.IsNotFound()) continue;
+    if (!s.ok()) return s;
+    batch.Delete(subkey_cf_handle_, key);
+    *ret += 1;
+  }
+  if (*ret == 0) return rocksdb::Status::OK();
+  metadata.length -= *ret;
+  metadata.size -= static_cast<uint32_t>(*ret);
+  std::string bytes;
+  metadata.Encode(&bytes);
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+rocksdb::Status Stream::trim(const Slice &ns_key, StreamMetadata *metadata, uint64_t max_len,
+                             rocksdb::WriteBatch *batch, uint64_t *ret) {
+  *ret = 0;
+  if (metadata->length <= max_len) return rocksdb::Status::OK();
+  uint64_t n = metadata->length - max_len;
+  bool range_deletion = n >= kStreamTrimRangeDeletionMinEntries && !storage_->InTxn();
+
+  std::string prefix, end_key;
+  InternalKey(ns_key, std::string(1, kStreamEntryTag), metadata->version).Encode(&prefix);
+  LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.prefix_same_as_start = true;
+  read_options.fill_cache = false;
+  std::unique_ptr<rocksdb::Iterator> iter(storage_->NewIterator(read_options, subkey_cf_handle_));
+  for (iter->Seek(prefix); iter->Valid() && iter->key().starts_with(prefix); iter->Next()) {
+    // the first kept entry is the exclusive end of the range deletion
+    if (*ret == n) {
+      end_key = iter->key().ToString();
+      break;
+    }
+    if (!range_deletion) batch->Delete(subkey_cf_handle_, iter->key());
+    *ret += 1;
+  }
+  if (!iter->status().ok()) return iter->status();
+  if (range_deletion && *ret > 0) {
+    if (end_key.empty()) {
+      InternalKey(ns_key, std::string(1, static_cast<char>(kStreamEntryTag + 1)), metadata->version).Encode(&end_key);
+    }
+    batch->DeleteRange(subkey_cf_handle_, prefix, end_key);
+  }
+  metadata->length -= *ret;
+  metadata->size -= static_cast<uint32_t>(*ret);
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status Stream::Trim(const Slice &user_key, uint64_t max_len, uint64_t *ret) {
+  *ret = 0;
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  StreamMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
+
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisStream);
+  batch.PutLogData(log_data.Encode());
+  s = trim(ns_key, &metadata, max_len, &batch, ret);
+  if (!s.ok() || *ret == 0) return s;
+  std::string bytes;
+  metadata.Encode(&bytes);
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+rocksdb::Status Stream::CreateGroup(const Slice &user_key, const std::string &group, bool last_id,
+                                    const StreamEntryID &id, bool mkstream) {
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  StreamMetadata metadata;
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.IsNotFound() && !mkstream) {
+    return rocksdb::Status::InvalidArgument("The XGROUP subcommand requires the key to exist. "
+                                            "Note that for CREATE you may want to use the MKSTREAM option");
+  }
+  if (s.IsNotFound()) metadata.size = 1;
+  StreamEntryID last_delivered;
+  s = getGroup(ns_key, metadata, group, &last_delivered);
+  if (s.ok()) return rocksdb::Status::InvalidArgument("BUSYGROUP Consumer Group name already exists");
+  if (!s.IsNotFound()) return s;
+
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisStream);
+  batch.PutLogData(log_data.Encode());
+  putGroup(ns_key, metadata, group, last_id ? StreamEntryID(metadata.last_ms, metadata.last_seq) : id, &batch);
+  metadata.size++;
+  std::string bytes;
+  metadata.Encode(&bytes);
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+rocksdb::Status Stream::DestroyGroup(const Slice &user_key, const std::string &group, int *ret) {
+  *ret = 0;
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  StreamMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok()) return s;
+  StreamEntryID last_delivered;
+  s = getGroup(ns_key, metadata, group, &last_delivered);
+  if (s.IsNotFound()) return rocksdb::Status::OK();
+  if (!s.ok()) return s;
+
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisStream);
+  batch.PutLogData(log_data.Encode());
+  std::string sub_key, prefix;
+  InternalKey(ns_key, std::string(1, kStreamGroupTag) + group, metadata.version).Encode(&sub_key);
+  batch.Delete(subkey_cf_handle_, sub_key);
+  // the pending entries of the group are dropped along with it
+  encodePendingSubKey(group, StreamEntryID::Min(), &sub_key);
+  sub_key.resize(sub_key.size() - 16);
+  InternalKey(ns_key, sub_key, metadata.version).Encode(&prefix);
+  LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.prefix_same_as_start = true;
+  read_options.fill_cache = false;
+  std::unique_ptr<rocksdb::Iterator> iter(storage_->NewIterator(read_options, subkey_cf_handle_));
+  for (iter->Seek(prefix); iter->Valid() && iter->key().starts_with(prefix); iter->Next()) {
+    batch.Delete(subkey_cf_handle_, iter->key());
+  }
+  if (!iter->status().ok()) return iter->status();
+  metadata.size--;
+  std::string bytes;
+  metadata.Encode(&bytes);
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  *ret = 1;
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+rocksdb::Status Stream::SetGroupID(const Slice &user_key, const std::string &group, bool last_id,
+                                   const StreamEntryID &id) {
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  StreamMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (s.IsNotFound()) return noGroupError(user_key, group);
+  if (!s.ok()) return s;
+  StreamEntryID last_delivered;
+  s = getGroup(ns_key, metadata, group, &last_delivered);
+  if (s.IsNotFound()) return noGroupError(user_key, group);
+  if (!s.ok()) return s;
+
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisStream);
+  batch.PutLogData(log_data.Encode());
+  putGroup(ns_key, metadata, group, last_id ? StreamEntryID(metadata.last_ms, metadata.last_seq) : id, &batch);
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+rocksdb::Status Stream::ReadGroup(const Slice &user_key, const std::string &group, const std::string &consumer,
+                                  bool new_entries, const StreamEntryID &id, uint64_t count, bool noack,
+                                  std::vector<StreamEntry> *entries) {
+  entries->clear();
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  StreamMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (s.IsNotFound()) return noGroupError(user_key, group);
+  if (!s.ok()) return s;
+  StreamEntryID last_delivered;
+  s = getGroup(ns_key, metadata, group, &last_delivered);
+  if (s.IsNotFound()) return noGroupError(user_key, group);
+  if (!s.ok()) return s;
+
+  if (!new_entries) {
+    // the history of the consumer is read from the pending entries, and the deleted
+    // entries are returned without the fields. The delivery of the rest is counted like the redis.
+    std::vector<StreamPendingEntry> pending_entries;
+    StreamEntryID start;
+    if (!id.Next(&start)) return rocksdb::Status::OK();
+    s = Pending(user_key, group, start, StreamEntryID::Max(), count, consumer, &pending_entries);
+    if (!s.ok()) return s;
+    rocksdb::WriteBatch batch;
+    WriteBatchLogData log_data(kRedisStream);
+    batch.PutLogData(log_data.Encode());
+    uint64_t now = nowMs();
+    bool redelivered = false;
+    std::string sub_key, key, value;
+    for (auto &pending_entry : pending_entries) {
+      StreamEntry entry;
+      entry.id = pending_entry.id;
+      EncodeEntrySubKey(entry.id, &sub_key);
+      InternalKey(ns_key, sub_key, metadata.version).Encode(&key);
+      s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, key, &value);
+      if (!s.ok() && !s.IsNotFound()) return s;
+      entry.deleted = s.IsNotFound();
+      if (!entry.deleted) {
+        DecodeEntryValue(value, &entry.values);
+        pending_entry.delivery_time = now;
+        pending_entry.delivery_count++;
+        putPending(ns_key, metadata, group, pending_entry, &batch);
+        redelivered = true;
+      }
+      entries->emplace_back(std::move(entry));
+    }
+    if (!redelivered) return rocksdb::Status::OK();
+    return storage_->Write(rocksdb::WriteOptions(), &batch);
+  }
+
+  StreamEntryID start;
+  if (!last_delivered.Next(&start)) return rocksdb::Status::OK();
+  s = Range(user_key, start, StreamEntryID::Max(), count, false, entries);
+  if (!s.ok() || entries->empty()) return s;
+
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisStream);
+  batch.PutLogData(log_data.Encode());
+  putGroup(ns_key, metadata, group, entries->back().id, &batch);
+  if (!noack) {
+    StreamPendingEntry pending_entry;
+    pending_entry.consumer = consumer;
+    pending_entry.delivery_time = nowMs();
+    pending_entry.delivery_count = 1;
+    for (const auto &entry : *entries) {
+      pending_entry.id = entry.id;
+      putPending(ns_key, metadata, group, pending_entry, &batch);
+    }
+  }
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+rocksdb::Status Stream::Ack(const Slice &user_key, const std::string &group,
+                            const std::vector<StreamEntryID> &ids, uint64_t *ret) {
+  *ret = 0;
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  StreamMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
+
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisStream);
+  batch.PutLogData(log_data.Encode());
+  std::set<StreamEntryID> unique_ids(ids.begin(), ids.end());
+  std::string sub_key, key, value;
+  for (const auto &id : unique_ids) {
+    encodePendingSubKey(group, id, &sub_key);
+    InternalKey(ns_key, sub_key, metadata.version).Encode(&key);
+    s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, key, &value);
+    if (s.IsNotFound()) continue;
+    if (!s.ok()) return s;
+    batch.Delete(subkey_cf_handle_, key);
+    *ret += 1;
+  }
+  if (*ret == 0) return rocksdb::Status::OK();
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+rocksdb::Status Stream::Pending(const Slice &user_key, const std::string &group, const StreamEntryID &start,
+                                const StreamEntryID &end, uint64_t count, const std::string &consumer,
+                                std::vector<StreamPendingEntry> *entries) {
+  entries->clear();
+  std::string ns_key;
+  AppendNamespacePrefix(user_key, &ns_key);
+  StreamMetadata metadata(false);
+  rocksdb::Status s = GetMetadata(ns_key, &metadata);
+  if (s.IsNotFound()) return noGroupError(user_key, group);
+  if (!s.ok()) return s;
+  StreamEntryID last_delivered;
+  s = getGroup(ns_key, metadata, group, &last_delivered);
+  if (s.IsNotFound()) return noGroupError(user_key, group);
+  if (!s.ok()) return s;
+  if (end < start) return rocksdb::Status::OK();
+
+  std::string sub_key, prefix, start_key, end_key;
+  encodePendingSubKey(group, start, &sub_key);
+  InternalKey(ns_key, sub_key, metadata.version).Encode(&start_key);
+  sub_key.resize(sub_key.size() - 16);
+  InternalKey(ns_key, sub_key, metadata.version).Encode(&prefix);
+  encodePendingSubKey(group, end, &sub_key);
+  InternalKey(ns_key, sub_key, metadata.version).Encode(&end_key);
+
+  LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.prefix_same_as_start = true;
+  std::unique_ptr<rocksdb::Iterator> iter(storage_->NewIterator(read_options, subkey_cf_handle_));
+  for (iter->Seek(start_key); iter->Valid() && iter->key().starts_with(prefix); iter->Next()) {
+    if (iter->key().compare(end_key) > 0) break;
+    StreamPendingEntry entry;
+    decodePendingValue(iter->value(), &entry);
+    if (!consumer.empty() && entry.consumer != consumer) continue;
+    Slice id_bytes = InternalKey(iter->key()).GetSubKey();
+    id_bytes.remove_prefix(id_bytes.size() - 16);
+    GetFixed64(&id_bytes, &entry.id.ms);
+    GetFixed64(&id_bytes, &entry.id.seq);
+    entries->emplace_back(std::move(entry));
+    if (count > 0 && entries->size() >= count) break;
+  }
+  return iter->status();
+}
+
+}  // namespace Redis
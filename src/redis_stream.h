@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "redis_db.h"
+#include "redis_metadata.h"
+
+namespace Redis {
+
+struct StreamEntryID {
+  uint64_t ms = 0;
+  uint64_t seq = 0;
+
+  StreamEntryID() = default;
+  StreamEntryID(uint64_t ms, uint64_t seq) : ms(ms), seq(seq) {}
+  std::string ToString() const { return std::to_string(ms) + "-" + std::to_string(seq); }
+  bool operator<(const StreamEntryID &that) const { return ms < that.ms || (ms == that.ms && seq < that.seq); }
+  bool operator==(const StreamEntryID &that) const { return ms == that.ms && seq == that.seq; }
+  bool operator<=(const StreamEntryID &that) const { return !(that < *this); }
+  // Next returns false if the id is the max one
+  bool Next(StreamEntryID *next) const;
+  // Prev returns false if the id is the min one
+  bool Prev(StreamEntryID *prev) const;
+  static StreamEntryID Min() { return StreamEntryID(0, 0); }
+  static StreamEntryID Max() { return StreamEntryID(UINT64_MAX, UINT64_MAX); }
+  // Parse parses the <ms>-<seq> or <ms>, the missing seq is filled by missing_seq
+  static bool Parse(const std::string &input, uint64_t missing_seq, StreamEntryID *id);
+};
+
+struct StreamEntry {
+  StreamEntryID id;
+  // the fields and values, it is empty for the deleted entry which is still pending
+  std::vector<std::string> values;
+  bool deleted = false;
+};
+
+struct StreamPendingEntry {
+  StreamEntryID id;
+  std::string consumer;
+  uint64_t delivery_time = 0;  // millisecond
+  uint64_t delivery_count = 0;
+};
+
+struct StreamAddOptions {
+  bool auto_id = true;
+  StreamEntryID id;
+  bool with_max_len = false;
+  uint64_t max_len = 0;
+};
+
+// The entries are stored as the subkeys ordered by their ids, and the consumer groups and
+// their pending entries are stored as the subkeys of their own prefixes in the same key:
+//   entry:   'e' | ms(8byte) | seq(8byte)                         => fields and values
+//   group:   'g' | group name                                      => last delivered id
+//   pending: 'p' | group name size(4byte) | group name | entry id => consumer, time and count
+// The size of the metadata counts the entries, the groups and the stream itself, so the empty
+// stream is kept with its last id and groups like the redis.
+class Stream : public Database {
+ public:
+  explicit Stream(Engine::Storage *storage, const std::string &ns)
+      : Database(storage, ns),
+        subkey_cf_handle_(storage->GetSubKeyCFHandle(kRedisStream)) {}
+  rocksdb::Status Add(const Slice &user_key, const StreamAddOptions &options,
+                      const std::vector<std::string> &values, StreamEntryID *id);
+  rocksdb::Status Len(const Slice &user_key, uint64_t *ret);
+  // Range returns at most count(0 is unlimited) entries between start and end inclusively
+  rocksdb::Status Range(const Slice &user_key, const StreamEntryID &start, const StreamEntryID &end,
+                        uint64_t count, bool reverse, std::vector<StreamEntry> *entries);
+  rocksdb::Status DeleteEntries(const Slice &user_key, const std::vector<StreamEntryID> &ids, uint64_t *ret);
+  rocksdb::Status Trim(const Slice &user_key, uint64_t max_len, uint64_t *ret);
+  // LastID returns 0-0 if the stream is missing, it resolves the $ of XREAD and XGROUP
+  rocksdb::Status LastID(const Slice &user_key, StreamEntryID *id);
+
+  rocksdb::Status CreateGroup(const Slice &user_key, const std::string &group, bool last_id,
+                              const StreamEntryID &id, bool mkstream);
+  rocksdb::Status DestroyGroup(const Slice &user_key, const std::string &group, int *ret);
+  rocksdb::Status SetGroupID(const Slice &user_key, const std::string &group, bool last_id,
+                             const StreamEntryID &id);
+  // ReadGroup delivers the new entries after the last delivered id of the group if new_entries,
+  // or else the pending entries of the consumer after the id
+  rocksdb::Status ReadGroup(const Slice &user_key, const std::string &group, const std::string &consumer,
+                            bool new_entries, const StreamEntryID &id, uint64_t count, bool noack,
+                            std::vector<StreamEntry> *entries);
+  rocksdb::Status Ack(const Slice &user_key, const std::string &group,
+                      const std::vector<StreamEntryID> &ids, uint64_t *ret);
+  // Pending returns at most count pending entries of the group between start and end, only the
+  // entries of the consumer are returned if it isn't empty
+  rocksdb::Status Pending(const Slice &user_key, const std::string &group, const StreamEntryID &start,
+                          const StreamEntryID &end, uint64_t count, const std::string &consumer,
+                          std::vector<StreamPendingEntry> *entries);
+
+  static void EncodeEntrySubKey(const StreamEntryID &id, std::string *sub_key);
+  static void EncodeEntryValue(const std::vector<std::string> &values, std::string *value);
+  static bool DecodeEntryValue(Slice value, std::vector<std::string> *values);
+
+ private:
+  rocksdb::Status GetMetadata(const Slice &ns_key, StreamMetadata *metadata);
+  rocksdb::Status getGroup(const Slice &ns_key, const StreamMetadata &metadata,
+                           const std::string &group, StreamEntryID *last_delivered);
+  void putGroup(const Slice &ns_key, const StreamMetadata &metadata, const std::string &group,
+                const StreamEntryID &last_delivered, rocksdb::WriteBatch *batch);
+  void putPending(const Slice &ns_key, const StreamMetadata &metadata, const std::string &group,
+                  const StreamPendingEntry &entry, rocksdb::WriteBatch *batch);
+  rocksdb::Status trim(const Slice &ns_key, StreamMetadata *metadata, uint64_t max_len,
+                       rocksdb::WriteBatch *batch, uint64_t *ret);
+
+  static void encodePendingSubKey(const std::string &group, const StreamEntryID &id, std::string *sub_key);
+  static void decodePendingValue(Slice value, StreamPendingEntry *entry);
+
+  rocksdb::ColumnFamilyHandle *subkey_cf_handle_;
+};
+
+}  // namespace Redis
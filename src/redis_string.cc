@@ -2,6 +2,8 @@
 #include <string>
 #include <limits>
 
+#include "merge_operator.h"
+
 namespace Redis {
 
 rocksdb::Status String::getValue(const Slice &ns_key, std::string *raw_value, std::string *value) {
@@ -13,14 +15,43 @@ rocksdb::Status String::getValue(const Slice &ns_key, std::string *raw_value, st
     raw_value->append(md_bytes);
   }
 
+  // the point Get reads at the implicit snapshot, which doesn't take the db mutex
   rocksdb::ReadOptions read_options;
+  std::string raw_bytes;
+  rocksdb::Status s = storage_->Get(read_options, metadata_cf_handle_, ns_key, &raw_bytes);
+  if (!s.ok()) return s;
+  s = extractValue(raw_bytes, value);
+  if (!s.ok()) return s;
+  if (value && (raw_bytes[0] & kStringBlobFlag)) {
+    s = getBlobValue(ns_key, &raw_bytes, value);
+    if (!s.ok()) return s;
+  }
+  if (raw_value) raw_value->assign(raw_bytes.data(), raw_bytes.size());
+  return rocksdb::Status::OK();
+}
+
+// getBlobValue reads the separated value of the string, the metadata is read again along with
+// the blob at the same snapshot, since the blob of the old value is dropped once it's overwritten
+rocksdb::Status String::getBlobValue(const Slice &ns_key, std::string *raw_bytes, std::string *value) {
   LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
   read_options.snapshot = ss.GetSnapShot();
-  std::string raw_bytes;
-  rocksdb::Status s = db_->Get(read_options, metadata_cf_handle_, ns_key, &raw_bytes);
+  rocksdb::Status s = storage_->Get(read_options, metadata_cf_handle_, ns_key, raw_bytes);
+  if (!s.ok()) return s;
+  s = extractValue(*raw_bytes, value);
   if (!s.ok()) return s;
+  uint64_t version;
+  uint32_t size;
+  if (!DecodeStringBlob(*raw_bytes, &version, &size)) return rocksdb::Status::OK();
+  std::string blob_key;
+  InternalKey(ns_key, "", version).Encode(&blob_key);
+  s = storage_->Get(read_options, blob_cf_handle_, blob_key, value);
+  if (s.IsNotFound()) return rocksdb::Status::Corruption("the blob of the string was missing");
+  return s;
+}
 
-  Metadata metadata(kRedisNone);
+rocksdb::Status String::extractValue(const std::string &raw_bytes, std::string *value) {
+  Metadata metadata(kRedisNone, false);
   metadata.Decode(raw_bytes);
   if (metadata.Expired()) {
     return rocksdb::Status::NotFound("the key was expired");
@@ -28,27 +59,47 @@ rocksdb::Status String::getValue(const Slice &ns_key, std::string *raw_value, st
   if (metadata.Type() != kRedisString && metadata.size > 0) {
     return rocksdb::Status::InvalidArgument("WRONGTYPE Operation against a key holding the wrong kind of value");
   }
-  if (value) value->assign(raw_bytes.substr(5, raw_bytes.size()-5));
-  if (raw_value) raw_value->assign(raw_bytes.data(), raw_bytes.size());
+  if (value) value->assign(raw_bytes.data() + 5, raw_bytes.size() - 5);
   return rocksdb::Status::OK();
 }
 
 rocksdb::Status String::updateValue(const Slice &ns_key, const Slice &raw_value, const Slice &new_value) {
-  std::string metadata_bytes;
-  if (raw_value.empty()) {
-    Metadata(kRedisString).Encode(&metadata_bytes);
-  } else {
-    metadata_bytes = raw_value.ToString().substr(0, 5);
+  Metadata metadata(kRedisString);
+  if (!raw_value.empty()) {
+    Metadata old_metadata(kRedisNone, false);
+    old_metadata.Decode(raw_value);
+    metadata.flags = old_metadata.flags;
+    metadata.expire = old_metadata.expire;
   }
-  metadata_bytes.append(new_value.ToString());
 
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisString);
   batch.PutLogData(log_data.Encode());
-  batch.Put(metadata_cf_handle_, ns_key, metadata_bytes);
+  putValue(ns_key, &metadata, new_value, &batch);
   return storage_->Write(rocksdb::WriteOptions(), &batch);
 }
 
+void String::putValue(const Slice &ns_key, Metadata *metadata, const Slice &value, rocksdb::WriteBatch *batch) {
+  std::string bytes;
+  auto blob_min_size = storage_->GetConfig()->string_blob_min_size;
+  if (blob_min_size <= 0 || value.size() < static_cast<size_t>(blob_min_size)) {
+    metadata->flags &= static_cast<uint8_t>(~kStringBlobFlag);
+    metadata->Encode(&bytes);
+    bytes.append(value.data(), value.size());
+    batch->Put(metadata_cf_handle_, ns_key, bytes);
+    return;
+  }
+  // the blob is keyed by the new version, so the blob of the old value is left to the compaction
+  metadata->flags |= kStringBlobFlag;
+  metadata->Encode(&bytes);
+  PutFixed64(&bytes, metadata->version);
+  PutFixed32(&bytes, static_cast<uint32_t>(value.size()));
+  std::string blob_key;
+  InternalKey(ns_key, "", metadata->version).Encode(&blob_key);
+  batch->Put(blob_cf_handle_, blob_key, value);
+  batch->Put(metadata_cf_handle_, ns_key, bytes);
+}
+
 rocksdb::Status String::Append(const Slice &user_key, const Slice &value, int *ret) {
   *ret = 0;
   std::string ns_key;
@@ -64,12 +115,27 @@ rocksdb::Status String::Append(const Slice &user_key, const Slice &value, int *r
 }
 
 std::vector<rocksdb::Status> String::MGet(const std::vector<Slice> &keys, std::vector<std::string> *values) {
-  std::string ns_key;
+  std::vector<std::string> ns_keys(keys.size());
+  std::vector<Slice> slice_keys;
+  slice_keys.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    AppendNamespacePrefix(keys[i], &ns_keys[i]);
+    slice_keys.emplace_back(ns_keys[i]);
+  }
+
+  // fetch all keys with one MultiGet, which reads them at the same implicit
+  // snapshot, instead of issuing a point Get for each key
+  rocksdb::ReadOptions read_options;
+  std::vector<rocksdb::ColumnFamilyHandle *> cf_handles(keys.size(), metadata_cf_handle_);
+  std::vector<std::string> raw_values;
+  std::vector<rocksdb::Status> statuses = storage_->MultiGet(read_options, cf_handles, slice_keys, &raw_values);
   std::string value;
-  std::vector<rocksdb::Status> statuses;
   for (size_t i = 0; i < keys.size(); i++) {
-    AppendNamespacePrefix(keys[i], &ns_key);
-    statuses.emplace_back(getValue(ns_key, nullptr, &value));
+    value.clear();
+    if (statuses[i].ok()) statuses[i] = extractValue(raw_values[i], &value);
+    if (statuses[i].ok() && (raw_values[i][0] & kStringBlobFlag)) {
+      statuses[i] = getBlobValue(ns_keys[i], &raw_values[i], &value);
+    }
     values->emplace_back(value);
   }
   return statuses;
@@ -130,12 +196,9 @@ rocksdb::Status String::SetXX(const Slice &user_key, const Slice &value, int ttl
   if (exists != 1) return rocksdb::Status::OK();
 
   *ret = 1;
-  std::string bytes;
   Metadata metadata(kRedisString);
   metadata.expire = expire;
-  metadata.Encode(&bytes);
-  bytes.append(value.ToString());
-  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  putValue(ns_key, &metadata, value, &batch);
   return storage_->Write(rocksdb::WriteOptions(), &batch);
 }
 
@@ -164,10 +227,53 @@ rocksdb::Status String::SetRange(const Slice &user_key, int offset, Slice value,
   return updateValue(ns_key, raw_value_bytes, value_bytes);
 }
 
+// mergeIncrBy merges the increment into the existing integer under the key lock, so the reply is
+// the value after this increment, and the overflow is rejected before the increment is written.
+// The merged value is kept in the metadata cache, so the increments of a hot counter don't read
+// the db. It returns NotSupported if the value can't be merged, and the caller increments it as usual.
+rocksdb::Status String::mergeIncrBy(const Slice &ns_key, int64_t increment, int64_t *ret) {
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  auto metadata_cache = storage_->GetMetadataCache();
+  auto generation = metadata_cache->Generation(ns_key);
+  std::string raw_value_bytes, value_bytes;
+  if (!metadata_cache->Get(ns_key, &raw_value_bytes)) {
+    rocksdb::Status s = storage_->Get(rocksdb::ReadOptions(), metadata_cf_handle_, ns_key, &raw_value_bytes);
+    if (!s.ok()) return rocksdb::Status::NotSupported();
+  }
+  int64_t value = 0;
+  // the separated value is never merged, since the merge operator only folds the inlined one
+  if (!extractValue(raw_value_bytes, &value_bytes).ok() || (raw_value_bytes[0] & 0x0f) != kRedisString
+      || (raw_value_bytes[0] & kStringBlobFlag) || !Engine::CounterMergeOperator::ParseValue(value_bytes, &value)) {
+    return rocksdb::Status::NotSupported();
+  }
+  if ((increment < 0 && value < 0 && increment < (LLONG_MIN-value))
+      || (increment > 0 && value > 0 && increment > (LLONG_MAX-value))) {
+    return rocksdb::Status::InvalidArgument("increment or decrement would overflow");
+  }
+  *ret = value + increment;
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisString);
+  batch.PutLogData(log_data.Encode());
+  batch.Merge(metadata_cf_handle_, ns_key, Engine::CounterMergeOperator::EncodeOperand(increment));
+  rocksdb::Status s = storage_->Write(rocksdb::WriteOptions(), &batch);
+  if (!s.ok()) return s;
+  // the write invalidates the key once, any other invalidation in between, like the FLUSHDB,
+  // means the merged value may be stale
+  if (metadata_cache->Generation(ns_key) == generation + 1) {
+    metadata_cache->Insert(ns_key, raw_value_bytes.substr(0, 5) + std::to_string(*ret), generation + 1);
+  }
+  return rocksdb::Status::OK();
+}
+
 rocksdb::Status String::IncrBy(const Slice &user_key, int64_t increment, int64_t *ret) {
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
+  if (storage_->GetConfig()->counter_merge_mode && !storage_->InTxn()) {
+    rocksdb::Status s = mergeIncrBy(ns_key, increment, ret);
+    if (!s.IsNotSupported()) return s;
+  }
+
   LockGuard guard(storage_->GetLockManager(), ns_key);
   std::string raw_value_bytes, value_bytes;
   rocksdb::Status s = getValue(ns_key, &raw_value_bytes, &value_bytes);
@@ -223,25 +329,24 @@ rocksdb::Status String::MSet(const std::vector<StringPair> &pairs, int ttl) {
     expire = uint32_t(now) + ttl;
   }
 
-  // Data race, key string maybe overwrite by other key while didn't lock the key here,
-  // to improve the set performance
-  std::string ns_key;
-  for (const auto &pair : pairs) {
-    std::string bytes;
+  std::vector<std::string> ns_keys(pairs.size());
+  std::vector<Slice> lock_keys;
+  lock_keys.reserve(pairs.size());
+  for (size_t i = 0; i < pairs.size(); i++) {
+    AppendNamespacePrefix(pairs[i].key, &ns_keys[i]);
+    lock_keys.emplace_back(ns_keys[i]);
+  }
+
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisString);
+  batch.PutLogData(log_data.Encode());
+  for (size_t i = 0; i < pairs.size(); i++) {
     Metadata metadata(kRedisString);
     metadata.expire = expire;
-    metadata.Encode(&bytes);
-    bytes.append(pair.value.ToString());
-    rocksdb::WriteBatch batch;
-    WriteBatchLogData log_data(kRedisString);
-    batch.PutLogData(log_data.Encode());
-    AppendNamespacePrefix(pair.key, &ns_key);
-    batch.Put(metadata_cf_handle_, ns_key, bytes);
-    LockGuard guard(storage_->GetLockManager(), ns_key);
-    auto s = storage_->Write(rocksdb::WriteOptions(), &batch);
-    if (!s.ok()) return s;
+    putValue(ns_keys[i], &metadata, pairs[i].value, &batch);
   }
-  return rocksdb::Status::OK();
+  MultiLockGuard guard(storage_->GetLockManager(), lock_keys);
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
 }
 
 rocksdb::Status String::MSetNX(const std::vector<StringPair> &pairs, int ttl, int *ret) {
@@ -254,26 +359,32 @@ rocksdb::Status String::MSetNX(const std::vector<StringPair> &pairs, int ttl, in
     expire = uint32_t(now) + ttl;
   }
 
-  int exists;
-  std::string ns_key;
-  for (StringPair pair : pairs) {
-    AppendNamespacePrefix(pair.key, &ns_key);
-    LockGuard guard(storage_->GetLockManager(), ns_key);
-    if (Exists({pair.key}, &exists).ok() && exists == 1) {
-      return rocksdb::Status::OK();
-    }
-    std::string bytes;
+  std::vector<std::string> ns_keys(pairs.size());
+  std::vector<Slice> lock_keys, user_keys;
+  lock_keys.reserve(pairs.size());
+  user_keys.reserve(pairs.size());
+  for (size_t i = 0; i < pairs.size(); i++) {
+    AppendNamespacePrefix(pairs[i].key, &ns_keys[i]);
+    lock_keys.emplace_back(ns_keys[i]);
+    user_keys.emplace_back(pairs[i].key);
+  }
+
+  MultiLockGuard guard(storage_->GetLockManager(), lock_keys);
+  int exists = 0;
+  auto s = Exists(user_keys, &exists);
+  if (!s.ok()) return s;
+  if (exists > 0) return rocksdb::Status::OK();
+
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisString);
+  batch.PutLogData(log_data.Encode());
+  for (size_t i = 0; i < pairs.size(); i++) {
     Metadata metadata(kRedisString);
     metadata.expire = expire;
-    metadata.Encode(&bytes);
-    bytes.append(pair.value.ToString());
-    rocksdb::WriteBatch batch;
-    WriteBatchLogData log_data(kRedisString);
-    batch.PutLogData(log_data.Encode());
-    batch.Put(metadata_cf_handle_, ns_key, bytes);
-    auto s = storage_->Write(rocksdb::WriteOptions(), &batch);
-    if (!s.ok()) return s;
+    putValue(ns_keys[i], &metadata, pairs[i].value, &batch);
   }
+  s = storage_->Write(rocksdb::WriteOptions(), &batch);
+  if (!s.ok()) return s;
   *ret = 1;
   return rocksdb::Status::OK();
 }
@@ -15,7 +15,8 @@ namespace Redis {
 
 class String : public Database {
  public:
-  explicit String(Engine::Storage *storage, const std::string &ns) : Database(storage, ns) {}
+  explicit String(Engine::Storage *storage, const std::string &ns)
+      : Database(storage, ns), blob_cf_handle_(storage->GetCFHandle("blob")) {}
   rocksdb::Status Append(const Slice &user_key, const Slice &value, int *ret);
   rocksdb::Status Get(const Slice &user_key, std::string *value);
   rocksdb::Status GetSet(const Slice &user_key, const Slice &new_value, std::string *old_value);
@@ -32,7 +33,15 @@ class String : public Database {
 
  private:
   rocksdb::Status getValue(const Slice &ns_key, std::string *raw_value, std::string *value = nullptr);
+  rocksdb::Status extractValue(const std::string &raw_bytes, std::string *value);
+  rocksdb::Status getBlobValue(const Slice &ns_key, std::string *raw_bytes, std::string *value);
   rocksdb::Status updateValue(const Slice &ns_key, const Slice &raw_value, const Slice &new_value);
+  // putValue writes the value with the header of the metadata into the batch, the value of at
+  // least string-blob-min-size bytes is written into the blob column family instead
+  void putValue(const Slice &ns_key, Metadata *metadata, const Slice &value, rocksdb::WriteBatch *batch);
+  rocksdb::Status mergeIncrBy(const Slice &ns_key, int64_t increment, int64_t *ret);
+
+  rocksdb::ColumnFamilyHandle *blob_cf_handle_;
 };
 
 }  // namespace Redis
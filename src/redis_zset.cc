@@ -1,11 +1,34 @@
 #include "redis_zset.h"
 
 #include <math.h>
+#include <algorithm>
 #include <map>
 #include <limits>
+#include <memory>
 
 namespace Redis {
 
+// the readahead is enabled for the unlimited ranges of the large zset, which
+// are likely to read many blocks in sequence
+const uint32_t kRangeReadaheadMinMembers = 4096;
+const size_t kRangeReadaheadSize = 2 * 1024 * 1024;
+
+// encodeScoreBound encodes the bound of the score keys `NS|key|version|score|member`, it is
+// placed after all keys of the score if the after is true, or before them otherwise
+static void encodeScoreBound(const Slice &ns_key, uint64_t version, double score, bool after, std::string *bound) {
+  // the -0 is encoded before the +0 though they are equal
+  if (score == 0) score = after ? 0.0 : -0.0;
+  std::string score_bytes;
+  PutDouble(&score_bytes, score);
+  if (after) {
+    // the encoded score never reaches the max of uint64, since the NaN isn't allowed
+    uint64_t encoded = DecodeFixed64(score_bytes.data());
+    score_bytes.clear();
+    PutFixed64(&score_bytes, encoded + 1);
+  }
+  InternalKey(ns_key, score_bytes, version).Encode(bound);
+}
+
 rocksdb::Status ZSet::GetMetadata(const Slice &ns_key, ZSetMetadata *metadata) {
   return Database::GetMetadata(kRedisZSet, ns_key, metadata);
 }
@@ -20,17 +43,19 @@ rocksdb::Status ZSet::Add(const Slice &user_key, uint8_t flags, std::vector<Memb
   ZSetMetadata metadata;
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.IsNotFound() && storage_->GetConfig()->zset_rank_index) metadata.EnableRankIndex();
 
   int added = 0;
+  RankIndexDeltas rank_deltas;
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisZSet);
   batch.PutLogData(log_data.Encode());
-  std::string member_key;
+  InternalKeyBuilder member_keys(ns_key, metadata.version), score_keys(ns_key, metadata.version);
   for (size_t i = 0; i < mscores->size(); i++) {
-    InternalKey(ns_key, (*mscores)[i].member, metadata.version).Encode(&member_key);
+    Slice member_key = member_keys.Build((*mscores)[i].member);
     if (metadata.size > 0) {
       std::string old_score_bytes;
-      s = db_->Get(rocksdb::ReadOptions(), member_key, &old_score_bytes);
+      s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, member_key, &old_score_bytes);
       if (!s.ok() && !s.IsNotFound()) return s;
       if (s.ok()) {
         double old_score = DecodeDouble(old_score_bytes.data());
@@ -38,28 +63,30 @@ rocksdb::Status ZSet::Add(const Slice &user_key, uint8_t flags, std::vector<Memb
           (*mscores)[i].score += old_score;
         }
         if ((*mscores)[i].score != old_score) {
-          old_score_bytes.append((*mscores)[i].member);
-          std::string old_score_key;
-          InternalKey(ns_key, old_score_bytes, metadata.version).Encode(&old_score_key);
-          batch.Delete(score_cf_handle_, old_score_key);
-          std::string new_score_bytes, new_score_key;
+          if (metadata.HasRankIndex()) {
+            std::string new_score_bytes;
+            PutDouble(&new_score_bytes, (*mscores)[i].score);
+            rankIndexUpdate(ns_key, metadata, old_score_bytes, -1, &rank_deltas);
+            rankIndexUpdate(ns_key, metadata, new_score_bytes, 1, &rank_deltas);
+          }
+          batch.Delete(score_cf_handle_, score_keys.Build(old_score_bytes, (*mscores)[i].member));
+          std::string new_score_bytes;
           PutDouble(&new_score_bytes, (*mscores)[i].score);
-          batch.Put(member_key, new_score_bytes);
-          new_score_bytes.append((*mscores)[i].member);
-          InternalKey(ns_key, new_score_bytes, metadata.version).Encode(&new_score_key);
-          batch.Put(score_cf_handle_, new_score_key, Slice());
+          batch.Put(subkey_cf_handle_, member_key, new_score_bytes);
+          batch.Put(score_cf_handle_, score_keys.Build(new_score_bytes, (*mscores)[i].member), Slice());
         }
         continue;
       }
     }
-    std::string score_bytes, score_key;
+    std::string score_bytes;
     PutDouble(&score_bytes, (*mscores)[i].score);
-    batch.Put(member_key, score_bytes);
-    score_bytes.append((*mscores)[i].member);
-    InternalKey(ns_key, score_bytes, metadata.version).Encode(&score_key);
-    batch.Put(score_cf_handle_, score_key, Slice());
+    batch.Put(subkey_cf_handle_, member_key, score_bytes);
+    if (metadata.HasRankIndex()) rankIndexUpdate(ns_key, metadata, score_bytes, 1, &rank_deltas);
+    batch.Put(score_cf_handle_, score_keys.Build(score_bytes, (*mscores)[i].member), Slice());
     added++;
   }
+  s = rankIndexWrite(rank_deltas, &batch);
+  if (!s.ok()) return s;
   if (added > 0) {
     *ret = added;
     metadata.size += added;
@@ -76,7 +103,7 @@ rocksdb::Status ZSet::Card(const Slice &user_key, int *ret) {
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  ZSetMetadata metadata;
+  ZSetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound()? rocksdb::Status::OK():s;
   *ret = metadata.size;
@@ -105,7 +132,7 @@ rocksdb::Status ZSet::Pop(const Slice &user_key, int count, bool min, std::vecto
   AppendNamespacePrefix(user_key, &ns_key);
 
   LockGuard guard(storage_->GetLockManager(), ns_key);
-  ZSetMetadata metadata;
+  ZSetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound()? rocksdb::Status::OK():s;
   if (count <=0) return rocksdb::Status::OK();
@@ -118,6 +145,7 @@ rocksdb::Status ZSet::Pop(const Slice &user_key, int count, bool min, std::vecto
   InternalKey(ns_key, score_bytes, metadata.version).Encode(&start_key);
   InternalKey(ns_key, "", metadata.version).Encode(&prefix_key);
 
+  RankIndexDeltas rank_deltas;
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisZSet);
   batch.PutLogData(log_data.Encode());
@@ -125,7 +153,8 @@ rocksdb::Status ZSet::Pop(const Slice &user_key, int count, bool min, std::vecto
   LatestSnapShot ss(db_);
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options, score_cf_handle_);
+  read_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(read_options, score_cf_handle_);
   iter->Seek(start_key);
   // see comment in rangebyscore()
   if (!min && (!iter->Valid() || !iter->key().starts_with(prefix_key))) {
@@ -136,16 +165,21 @@ rocksdb::Status ZSet::Pop(const Slice &user_key, int count, bool min, std::vecto
       min ? iter->Next() : iter->Prev()) {
     InternalKey ikey(iter->key());
     Slice score_key = ikey.GetSubKey();
+    if (metadata.HasRankIndex()) {
+      rankIndexUpdate(ns_key, metadata, Slice(score_key.data(), sizeof(double)), -1, &rank_deltas);
+    }
     GetDouble(&score_key, &score);
     mscores->emplace_back(MemberScore{score_key.ToString(), score});
     std::string default_cf_key;
     InternalKey(ns_key, score_key, metadata.version).Encode(&default_cf_key);
-    batch.Delete(default_cf_key);
+    batch.Delete(subkey_cf_handle_, default_cf_key);
     batch.Delete(score_cf_handle_, iter->key());
     if (mscores->size() >= static_cast<unsigned>(count)) break;
   }
   delete iter;
 
+  s = rankIndexWrite(rank_deltas, &batch);
+  if (!s.ok()) return s;
   if (!mscores->empty()) {
     metadata.size -= mscores->size();
     std::string bytes;
@@ -164,8 +198,9 @@ rocksdb::Status ZSet::Range(const Slice &user_key, int start, int stop, uint8_t
 
   bool removed = (flags & (uint8_t)ZSET_REMOVED) != 0;
   bool reversed = (flags & (uint8_t)ZSET_REVERSED) != 0;
-  if (removed) LockGuard guard(storage_->GetLockManager(), ns_key);
-  ZSetMetadata metadata;
+  std::unique_ptr<LockGuard> lock_guard;
+  if (removed) lock_guard = std::unique_ptr<LockGuard>(new LockGuard(storage_->GetLockManager(), ns_key));
+  ZSetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound()? rocksdb::Status::OK():s;
   if (start < 0) start += metadata.size;
@@ -186,24 +221,48 @@ rocksdb::Status ZSet::Range(const Slice &user_key, int start, int stop, uint8_t
   LatestSnapShot ss(db_);
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
+  RankIndexDeltas rank_deltas;
   rocksdb::WriteBatch batch;
-  auto iter = db_->NewIterator(read_options, score_cf_handle_);
-  iter->Seek(start_key);
-  // see comment in rangebyscore()
-  if (reversed && (!iter->Valid() || !iter->key().starts_with(prefix_key))) {
-    iter->SeekForPrev(start_key);
+  WriteBatchLogData log_data(kRedisZSet);
+  batch.PutLogData(log_data.Encode());
+  read_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(read_options, score_cf_handle_);
+  if (metadata.HasRankIndex() && start > 0 && start < static_cast<int>(metadata.size)) {
+    // jump to the score of the start member, and skip the members with the same score before it
+    uint64_t rank = reversed ? metadata.size - 1 - start : start, offset;
+    std::string start_score_bytes;
+    s = rankIndexSelect(read_options, ns_key, metadata, rank, &start_score_bytes, &offset);
+    if (!s.ok()) {
+      delete iter;
+      return s;
+    }
+    InternalKey(ns_key, start_score_bytes, metadata.version).Encode(&start_key);
+    iter->Seek(start_key);
+    for (; offset > 0 && iter->Valid() && iter->key().starts_with(prefix_key); offset--) {
+      iter->Next();
+    }
+    count = start;
+  } else {
+    iter->Seek(start_key);
+    // see comment in rangebyscore()
+    if (reversed && (!iter->Valid() || !iter->key().starts_with(prefix_key))) {
+      iter->SeekForPrev(start_key);
+    }
   }
   for (;
       iter->Valid() && iter->key().starts_with(prefix_key);
       !reversed ? iter->Next() : iter->Prev()) {
     InternalKey ikey(iter->key());
     Slice score_key = ikey.GetSubKey();
+    if (count >= start && removed && metadata.HasRankIndex()) {
+      rankIndexUpdate(ns_key, metadata, Slice(score_key.data(), sizeof(double)), -1, &rank_deltas);
+    }
     GetDouble(&score_key, &score);
     if (count >= start) {
       if (removed) {
         std::string sub_key;
         InternalKey(ns_key, score_key, metadata.version).Encode(&sub_key);
-        batch.Delete(sub_key);
+        batch.Delete(subkey_cf_handle_, sub_key);
         batch.Delete(score_cf_handle_, iter->key());
       }
       mscores->emplace_back(MemberScore{score_key.ToString(), score});
@@ -212,8 +271,10 @@ rocksdb::Status ZSet::Range(const Slice &user_key, int start, int stop, uint8_t
   }
   delete iter;
 
-  if (removed &&count > 0) {
-    metadata.size -= count;
+  if (removed && !mscores->empty()) {
+    s = rankIndexWrite(rank_deltas, &batch);
+    if (!s.ok()) return s;
+    metadata.size -= mscores->size();
     std::string bytes;
     metadata.Encode(&bytes);
     batch.Put(metadata_cf_handle_, ns_key, bytes);
@@ -232,57 +293,54 @@ rocksdb::Status ZSet::RangeByScore(const Slice &user_key,
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  if (spec.removed) LockGuard guard(storage_->GetLockManager(), ns_key);
-  ZSetMetadata metadata;
+  std::unique_ptr<LockGuard> lock_guard;
+  if (spec.removed) lock_guard = std::unique_ptr<LockGuard>(new LockGuard(storage_->GetLockManager(), ns_key));
+  ZSetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound()? rocksdb::Status::OK():s;
 
-  std::string start_score_bytes;
-  PutDouble(&start_score_bytes, spec.reversed ? spec.max : spec.min);
-  std::string start_key, prefix_key;
-  InternalKey(ns_key, start_score_bytes, metadata.version).Encode(&start_key);
-  InternalKey(ns_key, "", metadata.version).Encode(&prefix_key);
+  // the bounds are tight to the score range, so the iteration never walks over the
+  // tombstones or the members out of the range, and the upper bound is exclusive
+  std::string lower_key, upper_key;
+  encodeScoreBound(ns_key, metadata.version, spec.min, spec.minex, &lower_key);
+  encodeScoreBound(ns_key, metadata.version, spec.max, !spec.maxex, &upper_key);
+  rocksdb::Slice lower_bound(lower_key), upper_bound(upper_key);
 
   rocksdb::ReadOptions read_options;
   LatestSnapShot ss(db_);
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
+  read_options.iterate_lower_bound = &lower_bound;
+  read_options.iterate_upper_bound = &upper_bound;
+  if (spec.count <= 0 && metadata.size >= kRangeReadaheadMinMembers) read_options.readahead_size = kRangeReadaheadSize;
 
   int pos = 0;
-  auto iter = db_->NewIterator(read_options, score_cf_handle_);
+  RankIndexDeltas rank_deltas;
+  read_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(read_options, score_cf_handle_);
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisZSet);
   batch.PutLogData(log_data.Encode());
-  iter->Seek(start_key);
-  // when using reverse range, we should use the `SeekForPrev` to put the iter to the right position in those cases:
-  //    a. the key with the max score was the maximum key in DB and the iter would be invalid, try to seek the prev key
-  //    b. there's some key after the key with max score and the iter would be valid, but the current key may be:
-  //        b1. the prefix was the same with start key, don't skip it (the zset key has existed)
-  //        b2. the prefix was not the same with start key, try to seek the prev key
-  // Note: the DB key was composed by `NS|key|version|score|member`, so SeekForPrev(`NS|key|version|score`)
-  // may skip the current score if exists, so do SeekForPrev if prefix was not the same with start key
-  if (spec.reversed && (!iter->Valid() || !iter->key().starts_with(prefix_key))) {
-    iter->SeekForPrev(start_key);
+  if (!spec.reversed) {
+    iter->Seek(lower_key);
+  } else {
+    iter->SeekForPrev(upper_key);
+    // the member may be empty, so the score key could be equal to the exclusive upper bound
+    if (iter->Valid() && iter->key() == upper_bound) iter->Prev();
   }
-  for (;
-      iter->Valid() && iter->key().starts_with(prefix_key);
-      !spec.reversed ? iter->Next() : iter->Prev()) {
+  for (; iter->Valid(); !spec.reversed ? iter->Next() : iter->Prev()) {
     InternalKey ikey(iter->key());
     Slice score_key = ikey.GetSubKey();
     double score;
     GetDouble(&score_key, &score);
-    if (spec.reversed) {
-      if ((spec.minex && score == spec.min) || score < spec.min) break;
-      if ((spec.maxex && score == spec.max) || score > spec.max) continue;
-    } else {
-      if ((spec.minex && score == spec.min) || score < spec.min) continue;
-      if ((spec.maxex && score == spec.max) || score > spec.max) break;
-    }
     if (spec.offset >= 0 && pos++ < spec.offset) continue;
     if (spec.removed) {
+      if (metadata.HasRankIndex()) {
+        rankIndexUpdate(ns_key, metadata, Slice(ikey.GetSubKey().data(), sizeof(double)), -1, &rank_deltas);
+      }
       std::string sub_key;
       InternalKey(ns_key, score_key, metadata.version).Encode(&sub_key);
-      batch.Delete(sub_key);
+      batch.Delete(subkey_cf_handle_, sub_key);
       batch.Delete(score_cf_handle_, iter->key());
     } else {
       if (mscores) mscores->emplace_back(MemberScore{score_key.ToString(), score});
@@ -293,6 +351,8 @@ rocksdb::Status ZSet::RangeByScore(const Slice &user_key,
   delete iter;
 
   if (spec.removed && *size > 0) {
+    s = rankIndexWrite(rank_deltas, &batch);
+    if (!s.ok()) return s;
     metadata.size -= *size;
     std::string bytes;
     metadata.Encode(&bytes);
@@ -312,39 +372,52 @@ rocksdb::Status ZSet::RangeByLex(const Slice &user_key,
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
 
-  ZSetMetadata metadata;
+  std::unique_ptr<LockGuard> lock_guard;
+  if (spec.removed) lock_guard = std::unique_ptr<LockGuard>(new LockGuard(storage_->GetLockManager(), ns_key));
+  ZSetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
 
-  std::string start_key, prefix_key;
-  InternalKey(ns_key, spec.min, metadata.version).Encode(&start_key);
-  InternalKey(ns_key, "", metadata.version).Encode(&prefix_key);
+  // the member keys are ordered by the member bytes, and the smallest key after
+  // the member is the member with the trailing zero byte
+  std::string lower_key, upper_key;
+  InternalKey(ns_key, spec.min, metadata.version).Encode(&lower_key);
+  if (spec.minex) lower_key.push_back('\0');
+  if (spec.max_infinite) {
+    InternalKey(ns_key, "", metadata.version + 1).Encode(&upper_key);
+  } else {
+    InternalKey(ns_key, spec.max, metadata.version).Encode(&upper_key);
+    if (!spec.maxex) upper_key.push_back('\0');
+  }
+  rocksdb::Slice lower_bound(lower_key), upper_bound(upper_key);
 
   rocksdb::ReadOptions read_options;
   LatestSnapShot ss(db_);
   read_options.snapshot = ss.GetSnapShot();
   read_options.fill_cache = false;
+  read_options.iterate_lower_bound = &lower_bound;
+  read_options.iterate_upper_bound = &upper_bound;
+  if (spec.count <= 0 && metadata.size >= kRangeReadaheadMinMembers) read_options.readahead_size = kRangeReadaheadSize;
 
   int pos = 0;
-  auto iter = db_->NewIterator(read_options);
+  RankIndexDeltas rank_deltas;
+  read_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(read_options, subkey_cf_handle_);
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisZSet);
   batch.PutLogData(log_data.Encode());
-  for (iter->Seek(start_key);
-       iter->Valid() && iter->key().starts_with(prefix_key);
-       iter->Next()) {
+  for (iter->Seek(lower_key); iter->Valid(); iter->Next()) {
     InternalKey ikey(iter->key());
     Slice member = ikey.GetSubKey();
-    if (spec.minex && member == spec.min) continue;  // the min score was exclusive
-    if ((spec.maxex && member == spec.max) || (!spec.max_infinite && member.ToString() > spec.max)) break;
     if (spec.offset >= 0 && pos++ < spec.offset) continue;
     if (spec.removed) {
+      if (metadata.HasRankIndex()) rankIndexUpdate(ns_key, metadata, iter->value(), -1, &rank_deltas);
       std::string score_bytes = iter->value().ToString();
       score_bytes.append(member.ToString());
       std::string score_key;
       InternalKey(ns_key, score_bytes, metadata.version).Encode(&score_key);
       batch.Delete(score_cf_handle_, score_key);
-      batch.Delete(iter->key());
+      batch.Delete(subkey_cf_handle_, iter->key());
     } else {
       if (members) members->emplace_back(member.ToString());
     }
@@ -354,6 +427,8 @@ rocksdb::Status ZSet::RangeByLex(const Slice &user_key,
   delete iter;
 
   if (spec.removed && *size > 0) {
+    s = rankIndexWrite(rank_deltas, &batch);
+    if (!s.ok()) return s;
     metadata.size -= *size;
     std::string bytes;
     metadata.Encode(&bytes);
@@ -366,17 +441,14 @@ rocksdb::Status ZSet::RangeByLex(const Slice &user_key,
 rocksdb::Status ZSet::Score(const Slice &user_key, const Slice &member, double *score) {
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
-  ZSetMetadata metadata;
+  ZSetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s;
 
   rocksdb::ReadOptions read_options;
-  LatestSnapShot ss(db_);
-  read_options.snapshot = ss.GetSnapShot();
-
   std::string member_key, score_bytes;
   InternalKey(ns_key, member, metadata.version).Encode(&member_key);
-  s = db_->Get(read_options, member_key, &score_bytes);
+  s = storage_->Get(read_options, subkey_cf_handle_, member_key, &score_bytes);
   if (!s.ok()) return s;
   *score = DecodeDouble(score_bytes.data());
   return rocksdb::Status::OK();
@@ -388,7 +460,7 @@ rocksdb::Status ZSet::Remove(const Slice &user_key, const std::vector<Slice> &me
   AppendNamespacePrefix(user_key, &ns_key);
 
   LockGuard guard(storage_->GetLockManager(), ns_key);
-  ZSetMetadata metadata;
+  ZSetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound()? rocksdb::Status::OK():s;
 
@@ -396,19 +468,21 @@ rocksdb::Status ZSet::Remove(const Slice &user_key, const std::vector<Slice> &me
   WriteBatchLogData log_data(kRedisZSet);
   batch.PutLogData(log_data.Encode());
   int removed = 0;
-  std::string member_key, score_key;
+  RankIndexDeltas rank_deltas;
+  InternalKeyBuilder member_keys(ns_key, metadata.version), score_keys(ns_key, metadata.version);
+  std::string score_bytes;
   for (const auto &member : members) {
-    InternalKey(ns_key, member, metadata.version).Encode(&member_key);
-    std::string score_bytes;
-    s = db_->Get(rocksdb::ReadOptions(), member_key, &score_bytes);
+    Slice member_key = member_keys.Build(member);
+    s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, member_key, &score_bytes);
     if (s.ok()) {
-      score_bytes.append(member.ToString());
-      InternalKey(ns_key, score_bytes, metadata.version).Encode(&score_key);
-      batch.Delete(member_key);
-      batch.Delete(score_cf_handle_, score_key);
+      if (metadata.HasRankIndex()) rankIndexUpdate(ns_key, metadata, score_bytes, -1, &rank_deltas);
+      batch.Delete(subkey_cf_handle_, member_key);
+      batch.Delete(score_cf_handle_, score_keys.Build(score_bytes, member));
       removed++;
     }
   }
+  s = rankIndexWrite(rank_deltas, &batch);
+  if (!s.ok()) return s;
   if (removed > 0) {
     *ret = removed;
     metadata.size -= removed;
@@ -442,7 +516,7 @@ rocksdb::Status ZSet::Rank(const Slice &user_key, const Slice &member, bool reve
 
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
-  ZSetMetadata metadata;
+  ZSetMetadata metadata(false);
   rocksdb::Status s = GetMetadata(ns_key, &metadata);
   if (!s.ok()) return s.IsNotFound()? rocksdb::Status::OK():s;
 
@@ -451,9 +525,31 @@ rocksdb::Status ZSet::Rank(const Slice &user_key, const Slice &member, bool reve
   read_options.snapshot = ss.GetSnapShot();
   std::string score_bytes, member_key;
   InternalKey(ns_key, member, metadata.version).Encode(&member_key);
-  s = db_->Get(rocksdb::ReadOptions(), member_key, &score_bytes);
+  s = storage_->Get(rocksdb::ReadOptions(), subkey_cf_handle_, member_key, &score_bytes);
   if (!s.ok()) return s.IsNotFound()? rocksdb::Status::OK():s;
 
+  if (metadata.HasRankIndex()) {
+    uint64_t count = 0;
+    s = rankIndexCountLess(read_options, ns_key, metadata, score_bytes, &count);
+    if (!s.ok()) return s;
+    // count the members with the same score but ordered before the target member
+    std::string target_key, prefix_key;
+    InternalKey(ns_key, score_bytes, metadata.version).Encode(&prefix_key);
+    score_bytes.append(member.ToString());
+    InternalKey(ns_key, score_bytes, metadata.version).Encode(&target_key);
+    read_options.fill_cache = false;
+    read_options.prefix_same_as_start = true;
+    auto iter = storage_->NewIterator(read_options, score_cf_handle_);
+    for (iter->Seek(prefix_key);
+         iter->Valid() && iter->key().starts_with(prefix_key) && iter->key().compare(target_key) < 0;
+         iter->Next()) {
+      count++;
+    }
+    delete iter;
+    *ret = static_cast<int>(reversed ? metadata.size - 1 - count : count);
+    return rocksdb::Status::OK();
+  }
+
   double target_score = DecodeDouble(score_bytes.data());
   std::string start_score_bytes, start_key, prefix_key;
   double start_score = !reversed ? std::numeric_limits<double>::lowest():std::numeric_limits<double>::max();
@@ -463,7 +559,8 @@ rocksdb::Status ZSet::Rank(const Slice &user_key, const Slice &member, bool reve
 
   int rank = 0;
   read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options, score_cf_handle_);
+  read_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(read_options, score_cf_handle_);
   iter->Seek(start_key);
   // see comment in rangebyscore()
   if (reversed && (!iter->Valid() || !iter->key().starts_with(prefix_key))) {
@@ -491,17 +588,25 @@ rocksdb::Status ZSet::Overwrite(const Slice &user_key, const std::vector<MemberS
 
   LockGuard guard(storage_->GetLockManager(), ns_key);
   ZSetMetadata metadata;
+  if (storage_->GetConfig()->zset_rank_index) metadata.EnableRankIndex();
+  RankIndexDeltas rank_deltas;
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisZSet);
   batch.PutLogData(log_data.Encode());
+  InternalKeyBuilder member_keys(ns_key, metadata.version), score_keys(ns_key, metadata.version);
+  std::string score_bytes;
   for (const auto &ms : mscores) {
-    std::string member_key, score_bytes, score_key;
-    InternalKey(ns_key, ms.member, metadata.version).Encode(&member_key);
+    score_bytes.clear();
     PutDouble(&score_bytes, ms.score);
-    batch.Put(member_key, score_bytes);
-    score_bytes.append(ms.member);
-    InternalKey(ns_key, score_bytes, metadata.version).Encode(&score_key);
-    batch.Put(score_cf_handle_, score_key, Slice());
+    batch.Put(subkey_cf_handle_, member_keys.Build(ms.member), score_bytes);
+    if (metadata.HasRankIndex()) rankIndexUpdate(ns_key, metadata, score_bytes, 1, &rank_deltas);
+    batch.Put(score_cf_handle_, score_keys.Build(score_bytes, ms.member), Slice());
+  }
+  // the version is new, so there's nothing to read back in the rank index
+  for (const auto &delta : rank_deltas) {
+    std::string count_bytes;
+    PutFixed64(&count_bytes, static_cast<uint64_t>(delta.second));
+    batch.Put(rank_cf_handle_, delta.first, count_bytes);
   }
   metadata.size = static_cast<uint32_t>(mscores.size());
   std::string bytes;
@@ -514,101 +619,140 @@ rocksdb::Status ZSet::InterStore(const Slice &dst,
                                  const std::vector<KeyWeight> &keys_weights,
                                  AggregateMethod aggregate_method,
                                  int *size) {
-  if (size) *size = 0;
-
-  std::map<std::string, double> dst_zset;
-  std::map<std::string, size_t> member_counters;
-  std::vector<MemberScore> target_mscores;
-  int target_size;
-  ZRangeSpec spec;
-  auto s = RangeByScore(keys_weights[0].key, spec, &target_mscores, &target_size);
-  if (!s.ok() || target_mscores.empty()) return s;
-  for (const auto &ms : target_mscores) {
-    double score = ms.score * keys_weights[0].weight;
-    dst_zset[ms.member] = score;
-    member_counters[ms.member] = 1;
-  }
-  for (size_t i = 1; i < keys_weights.size(); i++) {
-    auto s = RangeByScore(keys_weights[i].key, spec, &target_mscores, &target_size);
-    if (!s.ok() || target_mscores.empty()) return s;
-    for (const auto &ms : target_mscores) {
-      if (dst_zset.find(ms.member) == dst_zset.end()) continue;
-      member_counters[ms.member]++;
-      double score = ms.score * keys_weights[i].weight;
-      switch (aggregate_method) {
-        case kAggregateSum:dst_zset[ms.member] += score;
-          break;
-        case kAggregateMin:
-          if (dst_zset[ms.member] > score) {
-            dst_zset[ms.member] = score;
-          }
-          break;
-        case kAggregateMax:
-          if (dst_zset[ms.member] < score) {
-            dst_zset[ms.member] = score;
-          }
-          break;
-      }
-    }
-  }
-  if (!dst_zset.empty()) {
-    std::vector<MemberScore> mscores;
-    for (const auto &iter : dst_zset) {
-      if (member_counters[iter.first] != keys_weights.size()) continue;
-      mscores.emplace_back(MemberScore{iter.first, iter.second});
-    }
-    if (size) *size = mscores.size();
-    Overwrite(dst, mscores);
-  }
-
-  return rocksdb::Status::OK();
+  return mergeStore(dst, keys_weights, aggregate_method, true, size);
 }
 
 rocksdb::Status ZSet::UnionStore(const Slice &dst,
                                  const std::vector<KeyWeight> &keys_weights,
                                  AggregateMethod aggregate_method,
                                  int *size) {
+  return mergeStore(dst, keys_weights, aggregate_method, false, size);
+}
+
+rocksdb::Status ZSet::mergeStore(const Slice &dst,
+                                 const std::vector<KeyWeight> &keys_weights,
+                                 AggregateMethod aggregate_method,
+                                 bool intersect,
+                                 int *size) {
   if (size) *size = 0;
 
-  std::map<std::string, double> dst_zset;
-  std::vector<MemberScore> target_mscores;
-  int target_size;
-  ZRangeSpec spec;
+  LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.fill_cache = false;
+  read_options.prefix_same_as_start = true;
+  std::vector<MergeSource> sources;
   for (const auto &key_weight : keys_weights) {
-    // get all member
-    auto s = RangeByScore(key_weight.key, spec, &target_mscores, &target_size);
+    std::string ns_key;
+    AppendNamespacePrefix(key_weight.key, &ns_key);
+    ZSetMetadata metadata(false);
+    auto s = GetMetadata(ns_key, &metadata);
     if (!s.ok() && !s.IsNotFound()) return s;
-    for (const auto &ms : target_mscores) {
-      double score = ms.score * key_weight.weight;
-      if (dst_zset.find(ms.member) == dst_zset.end()) {
-        dst_zset[ms.member] = score;
+    if (s.IsNotFound()) {
+      // the intersection of the missing key is empty
+      if (intersect) return rocksdb::Status::OK();
+      continue;
+    }
+    MergeSource source;
+    InternalKey(ns_key, "", metadata.version).Encode(&source.prefix_key);
+    source.weight = key_weight.weight;
+    source.iter.reset(storage_->NewIterator(read_options, subkey_cf_handle_));
+    source.iter->Seek(source.prefix_key);
+    sources.emplace_back(std::move(source));
+  }
+
+  std::string ns_key;
+  AppendNamespacePrefix(dst, &ns_key);
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  ZSetMetadata metadata;
+  if (storage_->GetConfig()->zset_rank_index) metadata.EnableRankIndex();
+  auto s = mergeSources(&sources, ns_key, aggregate_method, intersect, &metadata);
+  if (!s.ok()) return s;
+  if (size) *size = static_cast<int>(metadata.size);
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status ZSet::mergeSources(std::vector<MergeSource> *sources, const Slice &ns_key,
+                                   AggregateMethod aggregate_method, bool intersect, ZSetMetadata *metadata) {
+  auto heap_greater = [sources](size_t a, size_t b) -> bool {
+    return (*sources)[a].Member().compare((*sources)[b].Member()) > 0;
+  };
+  std::vector<size_t> heap;
+  for (size_t i = 0; i < sources->size(); i++) {
+    if ((*sources)[i].Valid()) heap.emplace_back(i);
+  }
+  std::make_heap(heap.begin(), heap.end(), heap_greater);
+
+  RankIndexDeltas rank_deltas;
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisZSet);
+  batch.PutLogData(log_data.Encode());
+  InternalKeyBuilder member_keys(ns_key, metadata->version), score_keys(ns_key, metadata->version);
+  std::string member, score_bytes;
+  uint32_t n_members = 0;
+  rocksdb::Status s;
+  while (!heap.empty()) {
+    // the rest members can't be in all sources once any source is exhausted
+    if (intersect && heap.size() != sources->size()) break;
+    member = (*sources)[heap.front()].Member().ToString();
+    double score = 0;
+    size_t n_sources = 0;
+    while (!heap.empty() && (*sources)[heap.front()].Member() == member) {
+      std::pop_heap(heap.begin(), heap.end(), heap_greater);
+      auto &source = (*sources)[heap.back()];
+      double weighted = DecodeDouble(source.iter->value().data()) * source.weight;
+      if (n_sources == 0) {
+        score = weighted;
       } else {
         switch (aggregate_method) {
-          case kAggregateSum:dst_zset[ms.member] += score;
+          case kAggregateSum:score += weighted;
             break;
           case kAggregateMin:
-            if (dst_zset[ms.member] > score) {
-              dst_zset[ms.member] = score;
-            }
+            if (score > weighted) score = weighted;
             break;
           case kAggregateMax:
-            if (dst_zset[ms.member] < score) {
-              dst_zset[ms.member] = score;
-            }
+            if (score < weighted) score = weighted;
             break;
         }
       }
+      n_sources++;
+      source.iter->Next();
+      if (source.Valid()) {
+        std::push_heap(heap.begin(), heap.end(), heap_greater);
+      } else {
+        if (!source.iter->status().ok()) return source.iter->status();
+        heap.pop_back();
+      }
     }
+    if (intersect && n_sources != sources->size()) continue;
+
+    score_bytes.clear();
+    PutDouble(&score_bytes, score);
+    batch.Put(subkey_cf_handle_, member_keys.Build(member), score_bytes);
+    if (metadata->HasRankIndex()) rankIndexUpdate(ns_key, *metadata, score_bytes, 1, &rank_deltas);
+    batch.Put(score_cf_handle_, score_keys.Build(score_bytes, member), Slice());
+    n_members++;
   }
-  if (!dst_zset.empty()) {
-    std::vector<MemberScore> mscores;
-    for (const auto &iter : dst_zset) {
-      mscores.emplace_back(MemberScore{iter.first, iter.second});
-    }
-    if (size) *size = mscores.size();
-    Overwrite(dst, mscores);
-  }
+  // nothing is written into the destination if the result is empty
+  if (n_members == 0) return rocksdb::Status::OK();
 
+  std::string old_metadata_bytes;
+  s = storage_->Get(rocksdb::ReadOptions(), metadata_cf_handle_, ns_key, &old_metadata_bytes);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  bool has_old_metadata = s.ok();
+  s = rankIndexWrite(rank_deltas, &batch);
+  if (!s.ok()) return s;
+  metadata->size = n_members;
+  std::string bytes;
+  metadata->Encode(&bytes);
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  s = storage_->Write(rocksdb::WriteOptions(), &batch);
+  if (!s.ok()) return s;
+  if (has_old_metadata) {
+    Metadata old_metadata(kRedisNone, false);
+    old_metadata.Decode(old_metadata_bytes);
+    reclaimSubKeys(ns_key, old_metadata);
+  }
   return rocksdb::Status::OK();
 }
 
@@ -683,12 +827,106 @@ Status ZSet::ParseRangeLexSpec(const std::string &min, const std::string &max, Z
   return Status::OK();
 }
 
+void ZSet::rankIndexUpdate(const Slice &ns_key, const ZSetMetadata &metadata,
+                           const Slice &score_bytes, int64_t delta, RankIndexDeltas *deltas) {
+  std::string node, node_key;
+  for (size_t level = 1; level <= sizeof(double); level++) {
+    node.clear();
+    PutFixed8(&node, static_cast<uint8_t>(level));
+    node.append(score_bytes.data(), level);
+    InternalKey(ns_key, node, metadata.version).Encode(&node_key);
+    (*deltas)[node_key] += delta;
+  }
+}
+
+rocksdb::Status ZSet::rankIndexWrite(const RankIndexDeltas &deltas, rocksdb::WriteBatch *batch) {
+  std::string count_bytes;
+  for (const auto &delta : deltas) {
+    if (delta.second == 0) continue;
+    // the caller is holding the key lock, so it's safe to read the count without snapshot
+    int64_t count = 0;
+    auto s = storage_->Get(rocksdb::ReadOptions(), rank_cf_handle_, delta.first, &count_bytes);
+    if (!s.ok() && !s.IsNotFound()) return s;
+    if (s.ok()) count = static_cast<int64_t>(DecodeFixed64(count_bytes.data()));
+    count += delta.second;
+    if (count <= 0) {
+      batch->Delete(rank_cf_handle_, delta.first);
+    } else {
+      count_bytes.clear();
+      PutFixed64(&count_bytes, static_cast<uint64_t>(count));
+      batch->Put(rank_cf_handle_, delta.first, count_bytes);
+    }
+  }
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status ZSet::rankIndexCountLess(const rocksdb::ReadOptions &read_options, const Slice &ns_key,
+                                         const ZSetMetadata &metadata, const Slice &score_bytes, uint64_t *count) {
+  *count = 0;
+  std::string node, prefix_key, target_key;
+  rocksdb::ReadOptions iter_options(read_options);
+  iter_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(iter_options, rank_cf_handle_);
+  // sum the counts of the siblings which are less than the score prefix at each level
+  for (size_t level = 1; level <= sizeof(double); level++) {
+    node.clear();
+    PutFixed8(&node, static_cast<uint8_t>(level));
+    node.append(score_bytes.data(), level - 1);
+    InternalKey(ns_key, node, metadata.version).Encode(&prefix_key);
+    node.push_back(score_bytes[level - 1]);
+    InternalKey(ns_key, node, metadata.version).Encode(&target_key);
+    for (iter->Seek(prefix_key);
+         iter->Valid() && iter->key().starts_with(prefix_key) && iter->key().compare(target_key) < 0;
+         iter->Next()) {
+      *count += DecodeFixed64(iter->value().data());
+    }
+  }
+  auto s = iter->status();
+  delete iter;
+  return s;
+}
+
+rocksdb::Status ZSet::rankIndexSelect(const rocksdb::ReadOptions &read_options, const Slice &ns_key,
+                                      const ZSetMetadata &metadata, uint64_t rank,
+                                      std::string *score_bytes, uint64_t *offset) {
+  score_bytes->clear();
+  std::string node, prefix_key;
+  rocksdb::ReadOptions iter_options(read_options);
+  iter_options.prefix_same_as_start = true;
+  auto iter = storage_->NewIterator(iter_options, rank_cf_handle_);
+  // walk down from the root to the child which contains the rank at each level
+  for (size_t level = 1; level <= sizeof(double); level++) {
+    node.clear();
+    PutFixed8(&node, static_cast<uint8_t>(level));
+    node.append(*score_bytes);
+    InternalKey(ns_key, node, metadata.version).Encode(&prefix_key);
+    bool found = false;
+    for (iter->Seek(prefix_key); iter->Valid() && iter->key().starts_with(prefix_key); iter->Next()) {
+      uint64_t count = DecodeFixed64(iter->value().data());
+      if (rank < count) {
+        score_bytes->push_back(iter->key()[iter->key().size() - 1]);
+        found = true;
+        break;
+      }
+      rank -= count;
+    }
+    if (!found) {
+      delete iter;
+      return rocksdb::Status::Corruption("the rank index was mismatched with the zset");
+    }
+  }
+  delete iter;
+  *offset = rank;
+  return rocksdb::Status::OK();
+}
+
 rocksdb::Status ZSet::Scan(const Slice &user_key,
                                 const std::string &cursor,
                                 uint64_t limit,
                                 const std::string &member_prefix,
-                                std::vector<std::string> *members) {
-  return SubKeyScanner::Scan(kRedisZSet, user_key, cursor, limit, member_prefix, members);
+                                std::vector<std::string> *members,
+                                const std::string &iter_token) {
+  return SubKeyScanner::Scan(kRedisZSet, user_key, cursor, limit, member_prefix, members, iter_token);
 }
 
 }  // namespace Redis
@@ -3,6 +3,8 @@
 #include <string>
 #include <vector>
 #include <limits>
+#include <map>
+#include <memory>
 
 #include "redis_db.h"
 #include "redis_metadata.h"
@@ -64,7 +66,9 @@ class ZSet : public SubKeyScanner {
  public:
   explicit ZSet(Engine::Storage *storage, const std::string &ns) :
       SubKeyScanner(storage, ns),
-      score_cf_handle_(storage->GetCFHandle("zset_score")) {}
+      subkey_cf_handle_(storage->GetSubKeyCFHandle(kRedisZSet)),
+      score_cf_handle_(storage->GetCFHandle("zset_score")),
+      rank_cf_handle_(storage->GetCFHandle("zset_rank")) {}
   rocksdb::Status Add(const Slice &user_key, uint8_t flags, std::vector<MemberScore> *mscores, int *ret);
   rocksdb::Status Card(const Slice &user_key, int *ret);
   rocksdb::Status Count(const Slice &user_key, const ZRangeSpec &spec, int *ret);
@@ -85,7 +89,8 @@ class ZSet : public SubKeyScanner {
                        const std::string &cursor,
                        uint64_t limit,
                        const std::string &member_prefix,
-                       std::vector<std::string> *members);
+                       std::vector<std::string> *members,
+                       const std::string &iter_token = "");
   rocksdb::Status Overwrite(const Slice &user_key, const std::vector<MemberScore> &mscores);
   rocksdb::Status InterStore(const Slice &dst,
                              const std::vector<KeyWeight> &keys_weights,
@@ -97,8 +102,44 @@ class ZSet : public SubKeyScanner {
                              int *size);
 
  private:
+  rocksdb::ColumnFamilyHandle *subkey_cf_handle_;
   rocksdb::ColumnFamilyHandle *score_cf_handle_;
+  rocksdb::ColumnFamilyHandle *rank_cf_handle_;
   rocksdb::Status GetMetadata(const Slice &ns_key, ZSetMetadata *metadata);
+
+  // MergeSource iterates the members of the source key in order, the members of
+  // the same key are sorted by the bytes since they share the same prefix
+  struct MergeSource {
+    std::string prefix_key;
+    double weight;
+    std::unique_ptr<rocksdb::Iterator> iter;
+    Slice Member() const {
+      Slice key = iter->key();
+      return Slice(key.data() + prefix_key.size(), key.size() - prefix_key.size());
+    }
+    bool Valid() const { return iter->Valid() && iter->key().starts_with(prefix_key); }
+  };
+  // mergeStore merges the sources as a k-way merge over their member iterators, so only the
+  // write batch of the destination is held in the memory. The members and the metadata are
+  // written in one batch, or the members written before the metadata would be taken as the
+  // orphans by the compactions of the slaves or after the restart.
+  rocksdb::Status mergeStore(const Slice &dst, const std::vector<KeyWeight> &keys_weights,
+                             AggregateMethod aggregate_method, bool intersect, int *size);
+  rocksdb::Status mergeSources(std::vector<MergeSource> *sources, const Slice &ns_key,
+                               AggregateMethod aggregate_method, bool intersect, ZSetMetadata *metadata);
+
+  // The rank index is a 256-ary radix tree over the encoded score, which is stored
+  // in the rank column family with key `NS|key|version|level|score[0:level]` and the
+  // value is the number of members whose score starts with the prefix.
+  typedef std::map<std::string, int64_t> RankIndexDeltas;
+  void rankIndexUpdate(const Slice &ns_key, const ZSetMetadata &metadata,
+                       const Slice &score_bytes, int64_t delta, RankIndexDeltas *deltas);
+  rocksdb::Status rankIndexWrite(const RankIndexDeltas &deltas, rocksdb::WriteBatch *batch);
+  rocksdb::Status rankIndexCountLess(const rocksdb::ReadOptions &read_options, const Slice &ns_key,
+                                     const ZSetMetadata &metadata, const Slice &score_bytes, uint64_t *count);
+  rocksdb::Status rankIndexSelect(const rocksdb::ReadOptions &read_options, const Slice &ns_key,
+                                  const ZSetMetadata &metadata, uint64_t rank,
+                                  std::string *score_bytes, uint64_t *offset);
 };
 
 }  // namespace Redis
@@ -7,6 +7,8 @@
 #include <event2/event.h>
 #include <glog/logging.h>
 #include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <algorithm>
 #include <future>
 #include <string>
 #include <thread>
@@ -16,6 +18,124 @@
 #include "util.h"
 #include "status.h"
 #include "server.h"
+#include "encoding.h"
+
+// the header of the raw write batch is the sequence(8byte) and the count(4byte)
+const size_t kWriteBatchHeaderSize = 12;
+// the coalesced batches of the master are written once they are larger than this
+const size_t kIncrBatchMaxBytes = 4 * 1024 * 1024;
+
+WALTailer::~WALTailer() {
+  Stop();
+}
+
+Status WALTailer::Start(rocksdb::SequenceNumber seq) {
+  if (running_) return Status::OK();
+  reset(seq);
+  stop_ = false;
+  try {
+    t_ = std::thread([this]() {
+      Util::ThreadSetName("wal-tailer");
+      this->loop();
+    });
+  } catch (const std::system_error &e) {
+    return Status(Status::NotOK, e.what());
+  }
+  running_ = true;
+  return Status::OK();
+}
+
+void WALTailer::Stop() {
+  stop_ = true;
+  cv_.notify_all();
+  if (t_.joinable()) t_.join();
+  running_ = false;
+  iter_ = nullptr;
+  reset(0);
+}
+
+void WALTailer::reset(rocksdb::SequenceNumber seq) {
+  std::lock_guard<std::mutex> guard(mu_);
+  ring_.clear();
+  ring_bytes_ = 0;
+  next_seq_ = seq;
+}
+
+void WALTailer::append(const rocksdb::BatchResult &batch) {
+  auto ring_batch = std::make_shared<Batch>();
+  ring_batch->sequence = batch.sequence;
+  ring_batch->next_sequence = batch.sequence + batch.writeBatchPtr->Count();
+  ring_batch->data = batch.writeBatchPtr->Data();
+  {
+    std::lock_guard<std::mutex> guard(mu_);
+    ring_bytes_ += ring_batch->data.size();
+    next_seq_ = ring_batch->next_sequence;
+    ring_.emplace_back(std::move(ring_batch));
+    // the feeders may still hold the evicted batches, they are freed once sent
+    while (ring_.size() > 1 && ring_bytes_ > max_bytes_) {
+      ring_bytes_ -= ring_.front()->data.size();
+      ring_.pop_front();
+    }
+  }
+  cv_.notify_all();
+}
+
+bool WALTailer::Read(rocksdb::SequenceNumber seq, size_t max_bytes,
+                     std::vector<std::shared_ptr<const Batch>> *batches) {
+  std::lock_guard<std::mutex> guard(mu_);
+  if (!running_ || next_seq_ == 0) return false;
+  if (seq == next_seq_) return true;
+  if (ring_.empty() || seq < ring_.front()->sequence || seq > next_seq_) return false;
+  auto iter = std::lower_bound(ring_.begin(), ring_.end(), seq,
+                               [](const std::shared_ptr<const Batch> &batch, rocksdb::SequenceNumber seq) {
+                                 return batch->sequence < seq;
+                               });
+  if (iter == ring_.end() || (*iter)->sequence != seq) return false;
+  size_t bytes = 0;
+  for (; iter != ring_.end() && bytes < max_bytes; iter++) {
+    bytes += (*iter)->data.size();
+    batches->emplace_back(*iter);
+  }
+  return true;
+}
+
+bool WALTailer::WaitFor(rocksdb::SequenceNumber seq, int timeout_ms) {
+  std::unique_lock<std::mutex> lock(mu_);
+  return cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                      [this, seq] { return stop_ || next_seq_ > seq; }) && !stop_;
+}
+
+void WALTailer::loop() {
+  const int wait_milliseconds = 200;
+  while (!stop_) {
+    if (!iter_ || !iter_->Valid()) {
+      if (!storage_->WALHasNewData(next_seq_)) {
+        iter_ = nullptr;
+        storage_->WaitForNewData(next_seq_, wait_milliseconds);
+        continue;
+      }
+      if (!storage_->GetWALIter(next_seq_, &iter_).IsOK()) {
+        // the WAL of next seq might be purged, restart from the latest seq,
+        // and the slaves behind it would use their own iterators
+        LOG(WARNING) << "[replication] WAL tailer failed to seek seq: " << next_seq_
+                     << ", would restart from the latest seq";
+        iter_ = nullptr;
+        reset(storage_->LatestSeq() + 1);
+        continue;
+      }
+    }
+    auto batch = iter_->GetBatch();
+    if (batch.sequence != next_seq_) {
+      LOG(WARNING) << "[replication] WAL tailer got discrete seq: " << batch.sequence
+                   << ", expected: " << next_seq_ << ", would drop the ring";
+      reset(batch.sequence);
+    }
+    append(batch);
+    while (!stop_ && !storage_->WaitForNewData(next_seq_, wait_milliseconds)) {
+    }
+    iter_->Next();
+  }
+}
 
 FeedSlaveThread::~FeedSlaveThread() {
   delete conn_;
@@ -54,7 +174,11 @@ void FeedSlaveThread::Join() {
 }
 
 void FeedSlaveThread::checkLivenessIfNeed() {
-  if (++interval % 1000) return;
+  // the feeder waits shorter while the acks are waited, so the ping is sent by time
+  auto now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+  if (now - last_ping_ms_ < 2000) return;
+  last_ping_ms_ = now;
   const auto ping_command = Redis::BulkString("ping");
   auto s = Util::SockSend(conn_->GetFD(), ping_command);
   if (!s.IsOK()) {
@@ -64,48 +188,139 @@ void FeedSlaveThread::checkLivenessIfNeed() {
   }
 }
 
+void FeedSlaveThread::recvAcks() {
+  char buf[1024];
+  while (true) {
+    // the closed connection is detected by the sends, so only the data is taken here
+    ssize_t n = recv(conn_->GetFD(), buf, sizeof(buf), MSG_DONTWAIT);
+    if (n <= 0) break;
+    ack_buf_.append(buf, static_cast<size_t>(n));
+  }
+  // each ack is "*3 $8 replconf $3 ack $<n> <seq>" of 7 lines, and the seq only grows
+  // so the acks are parsed to the last complete one
+  size_t pos = 0;
+  while (true) {
+    std::vector<std::string> lines;
+    size_t end = pos;
+    while (lines.size() < 7) {
+      auto crlf = ack_buf_.find("\r\n", end);
+      if (crlf == std::string::npos) break;
+      lines.emplace_back(ack_buf_.substr(end, crlf - end));
+      end = crlf + 2;
+    }
+    if (lines.size() < 7) break;
+    pos = end;
+    if (lines[0] != "*3" || Util::ToLower(lines[2]) != "replconf" || Util::ToLower(lines[4]) != "ack") {
+      LOG(WARNING) << "Unexpected data from slave[" << conn_->GetAddr() << "], drop the acks";
+      ack_buf_.clear();
+      return;
+    }
+    auto seq = std::strtoull(lines[6].c_str(), nullptr, 10);
+    if (seq > acked_repl_seq_.load()) acked_repl_seq_ = seq;
+  }
+  ack_buf_.erase(0, pos);
+}
+
+Status FeedSlaveThread::sendBatches(const std::vector<rocksdb::Slice> &batches) {
+  // send the batches as bulk strings with one writev, the batch data isn't copied
+  static const char kCRLF[] = "\r\n";
+  std::vector<std::string> headers(batches.size());
+  std::vector<iovec> iov;
+  iov.reserve(batches.size() * 3);
+  for (size_t i = 0; i < batches.size(); i++) {
+    headers[i] = "$" + std::to_string(batches[i].size()) + kCRLF;
+    iov.push_back({const_cast<char *>(headers[i].data()), headers[i].size()});
+    iov.push_back({const_cast<char *>(batches[i].data()), batches[i].size()});
+    iov.push_back({const_cast<char *>(kCRLF), 2});
+  }
+  return Util::SockSendv(conn_->GetFD(), &iov);
+}
+
 void FeedSlaveThread::loop() {
-  uint32_t yield_milliseconds = 2000;
-  std::vector<std::string> batch_list;
+  // the feeder is woken up by new writes, the timeout is only used to check the liveness
+  const int wait_milliseconds = 200;
+  // stop collecting the batches once the limits are reached while the slave is lagging
+  const size_t max_pending_bytes = 1024 * 1024;
+  const size_t max_pending_batches = 1024;
+  std::vector<rocksdb::BatchResult> pending_batches;
+  size_t pending_bytes = 0;
+  auto flushPendingBatches = [&]() -> bool {
+    if (pending_batches.empty()) return true;
+    std::vector<rocksdb::Slice> datas;
+    for (const auto &batch : pending_batches) datas.emplace_back(batch.writeBatchPtr->Data());
+    auto s = sendBatches(datas);
+    if (!s.IsOK()) {
+      LOG(ERROR) << "Write error while sending batch to slave: " << s.Msg();
+      Stop();
+      return false;
+    }
+    pending_batches.clear();
+    pending_bytes = 0;
+    return true;
+  };
+  auto tailer = srv_->GetWALTailer();
+  std::vector<std::shared_ptr<const WALTailer::Batch>> shared_batches;
+  bool ack_enabled = IsAckEnabled();
   while (!IsStopped()) {
+    // the acks are received between the batches, and the feeder waits shorter for the
+    // new writes while someone is waiting for the acks, to receive them in time
+    int wait_ms = wait_milliseconds;
+    if (ack_enabled) {
+      recvAcks();
+      if (srv_->HasAckWaiters()) wait_ms = 1;
+    }
+    // the slave is in the window of the shared tailer, consume the batches from it
+    shared_batches.clear();
+    if (tailer->Read(next_repl_seq_, max_pending_bytes, &shared_batches)) {
+      if (!flushPendingBatches()) return;
+      iter_ = nullptr;
+      if (shared_batches.empty()) {
+        if (!tailer->WaitFor(next_repl_seq_, wait_ms)) checkLivenessIfNeed();
+        continue;
+      }
+      std::vector<rocksdb::Slice> datas;
+      for (const auto &batch : shared_batches) datas.emplace_back(batch->data);
+      auto s = sendBatches(datas);
+      if (!s.IsOK()) {
+        LOG(ERROR) << "Write error while sending batch to slave: " << s.Msg();
+        Stop();
+        return;
+      }
+      next_repl_seq_ = shared_batches.back()->next_sequence;
+      continue;
+    }
+
+    // the slave is behind the tailer, read the WAL with its own iterator
     if (!iter_ || !iter_->Valid()) {
       if (iter_) LOG(INFO) << "WAL was rotated, would reopen again";
       if (!srv_->storage_->WALHasNewData(next_repl_seq_)
           || !srv_->storage_->GetWALIter(next_repl_seq_, &iter_).IsOK()) {
         iter_ = nullptr;
-        usleep(yield_milliseconds);
-        checkLivenessIfNeed();
+        if (!flushPendingBatches()) return;
+        if (!srv_->storage_->WaitForNewData(next_repl_seq_, wait_ms)) checkLivenessIfNeed();
         continue;
       }
     }
     // iter_ would be always valid here
     auto batch = iter_->GetBatch();
-    auto data = batch.writeBatchPtr->Data();
-    batch_list.emplace_back(Redis::BulkString(data));
-    // feed the bulks data to slave in batch mode iff the lag was far from the master
-    auto latest_seq = srv_->storage_->LatestSeq();
-    if (latest_seq - batch.sequence <= 20 || batch_list.size() >= 20) {
-      for (const auto &bulk_str : batch_list) {
-        auto s = Util::SockSend(conn_->GetFD(), bulk_str);
-        if (!s.IsOK()) {
-          LOG(ERROR) << "Write error while sending batch to slave: " << s.Msg();
-          Stop();
-          return;
-        }
-      }
-      batch_list.clear();
-    }
     if (batch.sequence != next_repl_seq_) {
       LOG(ERROR) << "Fatal error encountered, WAL iterator is discrete, some seq might be lost";
       Stop();
       return;
     }
     next_repl_seq_ = batch.sequence + batch.writeBatchPtr->Count();
-    while (!IsStopped() && !srv_->storage_->WALHasNewData(next_repl_seq_)) {
-      usleep(yield_milliseconds);
-      checkLivenessIfNeed();
-    }
+    pending_bytes += batch.writeBatchPtr->GetDataSize();
+    pending_batches.emplace_back(std::move(batch));
+    // the iterator always points to the next unsent batch, so the feeder
+    // could switch to the tailer once it caught up
     iter_->Next();
+    // flush the pending batches as soon as the feeder caught up with the latest write,
+    // otherwise the slave is lagging and more batches could be sent with one syscall
+    if (!srv_->storage_->WALHasNewData(next_repl_seq_)
+        || pending_bytes >= max_pending_bytes
+        || pending_batches.size() >= max_pending_batches) {
+      if (!flushPendingBatches()) return;
+    }
   }
 }
 
@@ -245,6 +460,12 @@ ReplicationThread::ReplicationThread(std::string host, uint32_t port,
                        CallbacksStateMachine::CallbackType{
                            CallbacksStateMachine::READ, "replconf read", replConfReadCB
                        },
+                       CallbacksStateMachine::CallbackType{
+                           CallbacksStateMachine::WRITE, "replconf capa write", replConfCapaWriteCB
+                       },
+                       CallbacksStateMachine::CallbackType{
+                           CallbacksStateMachine::READ, "replconf capa read", replConfCapaReadCB
+                       },
                        CallbacksStateMachine::CallbackType{
                            CallbacksStateMachine::WRITE, "psync write", tryPSyncWriteCB
                        },
@@ -390,8 +611,8 @@ ReplicationThread::CBState ReplicationThread::checkDBNameReadCB(
 ReplicationThread::CBState ReplicationThread::replConfWriteCB(
     bufferevent *bev, void *ctx) {
   auto self = static_cast<ReplicationThread *>(ctx);
-  send_string(bev,
-              Redis::MultiBulkString({"replconf", "listening-port", std::to_string(self->srv_->GetConfig()->port)}));
+  send_string(bev, Redis::MultiBulkString({"replconf", "listening-port",
+                                           std::to_string(self->srv_->GetConfig()->port)}));
   self->repl_state_ = kReplReplConf;
   LOG(INFO) << "[replication] replconf request was sent, waiting for response";
   return CBState::NEXT;
@@ -417,18 +638,52 @@ ReplicationThread::CBState ReplicationThread::replConfReadCB(
     return CBState::NEXT;
   } else {
     free(line);
-    LOG(INFO) << "[replication] replconf is ok, start psync";
+    LOG(INFO) << "[replication] replconf is ok";
     return CBState::NEXT;
   }
 }
 
+// the capa ack is sent by its own replconf, so the master of the old versions which refuses
+// it still gets the listening port
+ReplicationThread::CBState ReplicationThread::replConfCapaWriteCB(
+    bufferevent *bev, void *ctx) {
+  send_string(bev, Redis::MultiBulkString({"replconf", "capa", "ack"}));
+  LOG(INFO) << "[replication] replconf capa ack was sent, waiting for response";
+  return CBState::NEXT;
+}
+
+ReplicationThread::CBState ReplicationThread::replConfCapaReadCB(
+    bufferevent *bev, void *ctx) {
+  char *line;
+  size_t line_len;
+  auto input = bufferevent_get_input(bev);
+  line = evbuffer_readln(input, &line_len, EVBUFFER_EOL_CRLF_STRICT);
+  if (!line) return CBState::AGAIN;
+
+  if (line[0] == '-' && isRestoringError(line)) {
+    free(line);
+    LOG(WARNING) << "The master was restoring the db, retry later";
+    return CBState::RESTART;
+  }
+  auto self = static_cast<ReplicationThread *>(ctx);
+  // the master of the old versions doesn't support the capa ack, the applied seq isn't acked then
+  self->repl_ack_ = strncmp(line, "+OK", 3) == 0;
+  if (!self->repl_ack_) LOG(WARNING) << "[replication] The master doesn't support the capa ack: " << line;
+  free(line);
+  return CBState::NEXT;
+}
+
 ReplicationThread::CBState ReplicationThread::tryPSyncWriteCB(
     bufferevent *bev, void *ctx) {
   auto self = static_cast<ReplicationThread *>(ctx);
   auto next_seq = self->storage_->LatestSeq() + 1;
-  send_string(bev, Redis::MultiBulkString({"PSYNC", std::to_string(next_seq)}));
+  auto replid = self->storage_->GetReplicationID().id;
+  std::vector<std::string> cmd = {"PSYNC", std::to_string(next_seq)};
+  // the master of the old versions doesn't know the replication id
+  if (!self->psync_without_replid_) cmd.emplace_back(replid.empty() ? "?" : replid);
+  send_string(bev, Redis::MultiBulkString(cmd));
   self->repl_state_ = kReplSendPSync;
-  LOG(INFO) << "[replication] Try to use psync, next seq: " << next_seq;
+  LOG(INFO) << "[replication] Try to use psync, next seq: " << next_seq << ", replication id: " << replid;
   return CBState::NEXT;
 }
 
@@ -446,6 +701,12 @@ ReplicationThread::CBState ReplicationThread::tryPSyncReadCB(bufferevent *bev,
     LOG(WARNING) << "The master was restoring the db, retry later";
     return CBState::RESTART;
   }
+  if (line[0] == '-' && !self->psync_without_replid_ && strstr(line, "wrong number of arguments")) {
+    free(line);
+    LOG(WARNING) << "[replication] The master doesn't support the replication id, retry the psync without it";
+    self->psync_without_replid_ = true;
+    return CBState::RESTART;
+  }
   if (strncmp(line, "+OK", 3) != 0) {
     // PSYNC isn't OK, we should use FullSync
     // Switch to fullsync state machine
@@ -454,7 +715,9 @@ ReplicationThread::CBState ReplicationThread::tryPSyncReadCB(bufferevent *bev,
     free(line);
     return CBState::QUIT;
   } else {
-    // PSYNC is OK, use IncrementBatchLoop
+    // PSYNC is OK, use IncrementBatchLoop, and the slave takes the replication id of the master,
+    // which may be changed if the master is the promoted slave
+    if (line_len > 4 && line[3] == ' ') self->storage_->SetReplicationID(std::string(line + 4, line_len - 4));
     free(line);
     LOG(INFO) << "[replication] PSync is ok, start increment batch loop";
     return CBState::NEXT;
@@ -469,17 +732,31 @@ ReplicationThread::CBState ReplicationThread::incrementBatchLoopCB(
   auto self = static_cast<ReplicationThread *>(ctx);
   self->repl_state_ = kReplConnected;
   auto input = bufferevent_get_input(bev);
+  auto on_write_error = [self](const Status &s) {
+    LOG(ERROR) << "[replication] CRITICAL - Failed to write batch to local, err: " << s.Msg();
+    self->stop_flag_ = true;  // This is a very critical error, data might be corrupted
+    self->srv_->ResetMaster();
+    return CBState::QUIT;
+  };
+  // the received batches are written before waiting for more data, so the coalescing
+  // never delays the replication
+  auto flush_and_return = [self, bev, &on_write_error](CBState state) {
+    auto s = self->flushIncrBatch();
+    if (!s.IsOK()) return on_write_error(s);
+    self->sendAckIfNeed(bev);
+    return state;
+  };
   while (true) {
     switch (self->incr_state_) {
       case Incr_batch_size:
         // Read bulk length
         line = evbuffer_readln(input, &line_len, EVBUFFER_EOL_CRLF_STRICT);
-        if (!line) return CBState::AGAIN;
+        if (!line) return flush_and_return(CBState::AGAIN);
         self->incr_bulk_len_ = line_len > 0 ? std::strtoull(line + 1, nullptr, 10) : 0;
         free(line);
         if (self->incr_bulk_len_ == 0) {
           LOG(ERROR) << "[replication] Invalid increment data size";
-          return CBState::RESTART;
+          return flush_and_return(CBState::RESTART);
         }
         self->incr_state_ = Incr_batch_data;
         break;
@@ -487,33 +764,46 @@ ReplicationThread::CBState ReplicationThread::incrementBatchLoopCB(
         // Read bulk data (batch data)
         if (self->incr_bulk_len_+2 <= evbuffer_get_length(input)) {  // We got enough data
           bulk_data = reinterpret_cast<char *>(evbuffer_pullup(input, self->incr_bulk_len_ + 2));
-          std::string bulk_string = std::string(bulk_data, self->incr_bulk_len_);
           // master would send the ping heartbeat packet to check whether the slave was alive or not,
           // don't write ping to db here.
-          if (bulk_string != "ping") {
-            auto s = self->storage_->WriteBatch(std::string(bulk_data, self->incr_bulk_len_));
-            if (!s.IsOK()) {
-              LOG(ERROR) << "[replication] CRITICAL - Failed to write batch to local, err: " << s.Msg();
-              self->stop_flag_ = true;  // This is a very critical error, data might be corrupted
-              self->srv_->ResetMaster();
-              return CBState::QUIT;
-            }
-            self->ParseWriteBatch(bulk_string);
+          if (self->incr_bulk_len_ != 4 || strncmp(bulk_data, "ping", 4) != 0) {
+            auto s = self->appendIncrBatch(bulk_data, self->incr_bulk_len_);
+            if (!s.IsOK()) return on_write_error(s);
           }
           evbuffer_drain(input, self->incr_bulk_len_ + 2);
           self->incr_state_ = Incr_batch_size;
+          if (self->incr_pending_batch_.size() >= kIncrBatchMaxBytes) {
+            auto s = self->flushIncrBatch();
+            if (!s.IsOK()) return on_write_error(s);
+          }
         } else {
-          return CBState::AGAIN;
+          return flush_and_return(CBState::AGAIN);
         }
         break;
     }
   }
 }
 
+void ReplicationThread::sendAckIfNeed(bufferevent *bev) {
+  if (!repl_ack_) return;
+  auto seq = storage_->LatestSeq();
+  auto now = time(nullptr);
+  // the new writes are acked at once, and the idle slave acks once per second at most
+  if (seq == last_ack_seq_ && now == last_ack_time_) return;
+  send_string(bev, Redis::MultiBulkString({"replconf", "ack", std::to_string(seq)}));
+  last_ack_seq_ = seq;
+  last_ack_time_ = now;
+}
+
 ReplicationThread::CBState ReplicationThread::fullSyncWriteCB(
     bufferevent *bev, void *ctx) {
-  send_string(bev, Redis::MultiBulkString({"_fetch_meta"}));
   auto self = static_cast<ReplicationThread *>(ctx);
+  if (self->fullsync_use_checkpoint_) {
+    send_string(bev, Redis::MultiBulkString({"_fetch_checkpoint"}));
+  } else {
+    send_string(bev, Redis::MultiBulkString({"_fetch_meta"}));
+  }
+  self->fullsync_state_ = kFetchMetaID;
   self->repl_state_ = kReplFetchMeta;
   LOG(INFO) << "[replication] Start syncing data with fullsync";
   return CBState::NEXT;
@@ -530,20 +820,33 @@ ReplicationThread::CBState ReplicationThread::fullSyncReadCB(bufferevent *bev,
       line = evbuffer_readln(input, &line_len, EVBUFFER_EOL_CRLF_STRICT);
       if (!line) return CBState::AGAIN;
       if (line[0] == '-') {
-        LOG(ERROR) << "[replication] Failed to fetch meta id: " << line;
+        if (self->fullsync_use_checkpoint_ && strncmp(line, "-ERR unknown command", 20) == 0) {
+          LOG(INFO) << "[replication] The master doesn't support the checkpoint, fallback to the backup";
+          self->fullsync_use_checkpoint_ = false;
+        } else {
+          LOG(ERROR) << "[replication] Failed to fetch meta id: " << line;
+        }
         free(line);
         return CBState::RESTART;
       }
-      self->fullsync_meta_id_ = static_cast<rocksdb::BackupID>(
-          line_len > 0 ? std::strtoul(line, nullptr, 10) : 0);
-      free(line);
-      if (self->fullsync_meta_id_ == 0) {
-        LOG(ERROR) << "[replication] Invalid meta id received";
-        return CBState::RESTART;
+      if (self->fullsync_use_checkpoint_) {
+        self->fullsync_checkpoint_id_ = std::string(line, line_len);
+        free(line);
+        // the partial files of the stale checkpoints are useless, remove them to save disk space
+        Engine::Storage::BackupManager::PurgeCheckpoints(self->storage_, self->fullsync_checkpoint_id_);
+        LOG(INFO) << "[replication] Success to fetch checkpoint id: " << self->fullsync_checkpoint_id_;
+      } else {
+        self->fullsync_meta_id_ = static_cast<rocksdb::BackupID>(
+            line_len > 0 ? std::strtoul(line, nullptr, 10) : 0);
+        free(line);
+        if (self->fullsync_meta_id_ == 0) {
+          LOG(ERROR) << "[replication] Invalid meta id received";
+          return CBState::RESTART;
+        }
+        self->storage_->PurgeBackupIfNeed(self->fullsync_meta_id_);
+        LOG(INFO) << "[replication] Success to fetch meta id: " << self->fullsync_meta_id_;
       }
-      self->storage_->PurgeBackupIfNeed(self->fullsync_meta_id_);
       self->fullsync_state_ = kFetchMetaSize;
-      LOG(INFO) << "[replication] Success to fetch meta id: " << self->fullsync_meta_id_;
     case kFetchMetaSize:
       line = evbuffer_readln(input, &line_len, EVBUFFER_EOL_CRLF_STRICT);
       if (!line) return CBState::AGAIN;
@@ -564,14 +867,20 @@ ReplicationThread::CBState ReplicationThread::fullSyncReadCB(bufferevent *bev,
       if (evbuffer_get_length(input) < self->fullsync_filesize_) {
         return CBState::AGAIN;
       }
-      auto meta = Engine::Storage::BackupManager::ParseMetaAndSave(
-          self->storage_, self->fullsync_meta_id_, input);
+      std::vector<std::pair<std::string, uint32_t>> files;
+      if (self->fullsync_use_checkpoint_) {
+        files = Engine::Storage::BackupManager::ParseCheckpointMeta(input);
+      } else {
+        auto meta = Engine::Storage::BackupManager::ParseMetaAndSave(
+            self->storage_, self->fullsync_meta_id_, input);
+        files = std::move(meta.files);
+      }
       assert(evbuffer_get_length(input) == 0);
       self->fullsync_state_ = kFetchMetaID;
 
       LOG(INFO) << "[replication] Succeeded fetching meta file, fetching files in parallel";
       self->repl_state_ = kReplFetchSST;
-      auto s = self->parallelFetchFile(meta.files);
+      auto s = self->parallelFetchFile(files);
       if (!s.IsOK()) {
         LOG(ERROR) << "[replication] Failed to parallel fetch files while " + s.Msg();
         return CBState::RESTART;
@@ -580,13 +889,24 @@ ReplicationThread::CBState ReplicationThread::fullSyncReadCB(bufferevent *bev,
 
       // Restore DB from backup
       self->pre_fullsync_cb_();
-      s = self->storage_->RestoreFromBackup();
+      if (self->fullsync_use_checkpoint_) {
+        s = self->storage_->RestoreFromCheckpoint(self->fullsync_checkpoint_id_);
+      } else {
+        s = self->storage_->RestoreFromBackupFiles(files);
+        if (!s.IsOK()) {
+          LOG(WARNING) << "[replication] Failed to restore from the backup files, err: " << s.Msg()
+                       << ", fallback to the backup engine";
+          s = self->storage_->RestoreFromBackup();
+        }
+      }
       if (!s.IsOK()) {
         LOG(ERROR) << "[replication] Failed to restore backup while " + s.Msg();
         self->post_fullsync_cb_();
         return CBState::RESTART;
       }
       LOG(INFO) << "[replication] Succeeded restoring the backup, fullsync was finish";
+      // the history of the db is replaced, so the id of the master is taken by the next psync
+      self->storage_->SetReplicationID("");
       self->post_fullsync_cb_();
 
       // Switch to psync state machine again
@@ -600,69 +920,101 @@ ReplicationThread::CBState ReplicationThread::fullSyncReadCB(bufferevent *bev,
 }
 
 Status ReplicationThread::parallelFetchFile(const std::vector<std::pair<std::string, uint32_t>> &files) {
-  size_t concurrency = 1;
-  if (files.size() > 20) {
-    // Use 4 threads to download files in parallel
-    concurrency = 4;
-  }
+  // the workers take files from the shared cursor, and one more worker would be
+  // added per second while it raised the throughput, til the max concurrency
+  const size_t max_concurrency = 8;
+  std::atomic<size_t> next_file = {0};
   std::atomic<uint32_t> fetch_cnt = {0};
   std::atomic<uint32_t> skip_cnt = {0};
+  std::atomic<uint64_t> fetched_bytes = {0};
+  std::atomic<bool> failed = {false};
+  auto fetchFiles = [this, &files, &next_file, &fetch_cnt, &skip_cnt, &fetched_bytes, &failed]() -> Status {
+    if (this->stop_flag_) {
+      return Status(Status::NotOK, "replication thread was stopped");
+    }
+    int sock_fd;
+    Status s = Util::SockConnect(this->host_, this->port_, &sock_fd);
+    if (!s.IsOK()) {
+      failed = true;
+      return Status(Status::NotOK, "connect the server err: " + s.Msg());
+    }
+    s = this->sendAuth(sock_fd);
+    if (!s.IsOK()) {
+      failed = true;
+      close(sock_fd);
+      return Status(Status::NotOK, "sned the auth command err: " + s.Msg());
+    }
+    bool chunk_supported = true;
+    while (!failed) {
+      if (this->stop_flag_) {
+        close(sock_fd);
+        return Status(Status::NotOK, "replication thread was stopped");
+      }
+      size_t f_idx = next_file.fetch_add(1);
+      if (f_idx >= files.size()) break;
+      const auto &f_name = files[f_idx].first;
+      const auto &f_crc = files[f_idx].second;
+      // Don't fetch existing files
+      if (Engine::Storage::BackupManager::FileExists(this->storage_, f_name, f_crc)) {
+        skip_cnt.fetch_add(1);
+        uint32_t cur_skip_cnt = skip_cnt.load();
+        uint32_t cur_fetch_cnt = fetch_cnt.load();
+        LOG(INFO) << "[skip] "<< f_name << " " << f_crc
+                  << ", skip count: " << cur_skip_cnt << ", fetch count: " << cur_fetch_cnt
+                  << ", progress: " << cur_skip_cnt+cur_fetch_cnt<< "/" << files.size();
+        continue;
+      }
+      fetch_cnt.fetch_add(1);
+      uint32_t cur_skip_cnt = skip_cnt.load();
+      uint32_t cur_fetch_cnt = fetch_cnt.load();
+      DLOG(INFO) << "[fetch] " << f_name << " " << f_crc
+                 << ", skip count: " << cur_skip_cnt << ", fetch count: " << cur_fetch_cnt
+                 << ", progress: " << cur_skip_cnt+cur_fetch_cnt<< "/" << files.size();
+      if (chunk_supported) {
+        s = this->fetchFileChunked(sock_fd, f_name, f_crc, &fetched_bytes);
+        if (s.Is(Status::RedisUnknownCmd)) {
+          // the master is too old to fetch file by chunks
+          LOG(INFO) << "[replication] The master doesn't support fetching file by chunks";
+          chunk_supported = false;
+        }
+      }
+      if (!chunk_supported) s = this->fetchFile(sock_fd, f_name, f_crc);
+      if (!s.IsOK()) {
+        failed = true;
+        close(sock_fd);
+        return Status(Status::NotOK, "fetch file err: " + s.Msg());
+      }
+    }
+    close(sock_fd);
+    return Status::OK();
+  };
+
   std::vector<std::future<Status>> results;
-  for (size_t tid = 0; tid < concurrency; ++tid) {
-    results.push_back(std::async(
-        std::launch::async, [this, &files, tid, concurrency, &fetch_cnt, &skip_cnt]() -> Status {
-          if (this->stop_flag_) {
-            return Status(Status::NotOK, "replication thread was stopped");
-          }
-          int sock_fd;
-          Status s = Util::SockConnect(this->host_, this->port_, &sock_fd);
-          if (!s.IsOK()) {
-            return Status(Status::NotOK, "connect the server err: " + s.Msg());
-          }
-          s = this->sendAuth(sock_fd);
-          if (!s.IsOK()) {
-            close(sock_fd);
-            return Status(Status::NotOK, "sned the auth command err: " + s.Msg());
-          }
-          for (auto f_idx = tid; f_idx < files.size(); f_idx += concurrency) {
-            if (this->stop_flag_) {
-              return Status(Status::NotOK, "replication thread was stopped");
-            }
-            const auto &f_name = files[f_idx].first;
-            const auto &f_crc = files[f_idx].second;
-            // Don't fetch existing files
-            if (Engine::Storage::BackupManager::FileExists(this->storage_, f_name)) {
-              skip_cnt.fetch_add(1);
-              uint32_t cur_skip_cnt = skip_cnt.load();
-              uint32_t cur_fetch_cnt = fetch_cnt.load();
-              LOG(INFO) << "[skip] "<< f_name << " " << f_crc
-                        << ", skip count: " << cur_skip_cnt << ", fetch count: " << cur_fetch_cnt
-                        << ", progress: " << cur_skip_cnt+cur_fetch_cnt<< "/" << files.size();
-              continue;
-            }
-            fetch_cnt.fetch_add(1);
-            uint32_t cur_skip_cnt = skip_cnt.load();
-            uint32_t cur_fetch_cnt = fetch_cnt.load();
-            DLOG(INFO) << "[fetch] " << f_name << " " << f_crc
-                       << ", skip count: " << cur_skip_cnt << ", fetch count: " << cur_fetch_cnt
-                       << ", progress: " << cur_skip_cnt+cur_fetch_cnt<< "/" << files.size();
-            s = this->fetchFile(sock_fd, f_name, f_crc);
-            if (!s.IsOK()) {
-              close(sock_fd);
-              return Status(Status::NotOK, "fetch file err: " + s.Msg());
-            }
-          }
-          close(sock_fd);
-          return Status::OK();
-        }));
+  results.push_back(std::async(std::launch::async, fetchFiles));
+  uint64_t last_bytes = 0;
+  uint64_t last_rate = 0;
+  while (results.size() < max_concurrency && next_file < files.size() && !failed && !stop_flag_) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    uint64_t bytes = fetched_bytes.load();
+    uint64_t rate = bytes - last_bytes;
+    last_bytes = bytes;
+    // stop adding workers once the last one doesn't raise the throughput by 10%,
+    // the bandwidth or the disk is saturated
+    if (last_rate > 0 && rate * 10 < last_rate * 11) break;
+    last_rate = rate;
+    if (next_file < files.size()) {
+      results.push_back(std::async(std::launch::async, fetchFiles));
+    }
   }
+  LOG(INFO) << "[replication] Fetching files with " << results.size() << " workers";
 
   // Wait til finish
+  Status result = Status::OK();
   for (auto &f : results) {
     Status s = f.get();
-    if (!s.IsOK()) return s;
+    if (!s.IsOK() && result.IsOK()) result = s;
   }
-  return Status::OK();
+  return result;
 }
 
 Status ReplicationThread::sendAuth(int sock_fd) {
@@ -759,6 +1111,87 @@ Status ReplicationThread::fetchFile(int sock_fd, std::string path,
   return Engine::Storage::BackupManager::SwapTmpFile(storage_, path);
 }
 
+Status ReplicationThread::fetchFileChunked(int sock_fd, const std::string &path, uint32_t crc,
+                                           std::atomic<uint64_t> *fetched_bytes) {
+  const size_t chunk_size = 4 * 1024 * 1024;
+  uint64_t offset;
+  uint32_t tmp_crc;
+  // only the verified chunks are appended into the tmp file, so the fetch
+  // could be resumed from the end of it after reconnecting to the master
+  auto tmp_file = Engine::Storage::BackupManager::ReopenTmpFile(storage_, path, &offset, &tmp_crc);
+  if (!tmp_file) return Status(Status::NotOK, "unable to create tmp file");
+  if (offset > 0) {
+    LOG(INFO) << "[replication] Resume fetching file: " << path << " from offset: " << offset;
+  }
+
+  evbuffer *evbuf = evbuffer_new();
+  std::string chunk;
+  while (true) {
+    if (stop_flag_) {
+      evbuffer_free(evbuf);
+      return Status(Status::NotOK, "replication thread was stopped");
+    }
+    const auto fetch_command = Redis::MultiBulkString({"_fetch_file_chunk", path,
+                                                       std::to_string(offset), std::to_string(chunk_size)});
+    auto s = Util::SockSend(sock_fd, fetch_command);
+    if (!s.IsOK()) {
+      evbuffer_free(evbuf);
+      return Status(Status::NotOK, "send fetch file chunk command err: "+s.Msg());
+    }
+    // Read the chunk size and crc line
+    size_t line_len;
+    char *line;
+    while (!(line = evbuffer_readln(evbuf, &line_len, EVBUFFER_EOL_CRLF_STRICT))) {
+      if (evbuffer_read(evbuf, sock_fd, -1) <= 0) {
+        evbuffer_free(evbuf);
+        return Status(Status::NotOK, std::string("read chunk line err: ")+strerror(errno));
+      }
+    }
+    if (*line == '-') {
+      std::string err(line);
+      free(line);
+      evbuffer_free(evbuf);
+      if (err.compare(0, 20, "-ERR unknown command") == 0) return Status(Status::RedisUnknownCmd, err);
+      return Status(Status::NotOK, "_fetch_file_chunk got err: "+err);
+    }
+    char *end;
+    uint64_t n = std::strtoull(line, &end, 10);
+    uint32_t chunk_crc = static_cast<uint32_t>(std::strtoul(end, nullptr, 10));
+    free(line);
+    while (evbuffer_get_length(evbuf) < n) {
+      if (evbuffer_read(evbuf, sock_fd, -1) <= 0) {
+        evbuffer_free(evbuf);
+        return Status(Status::NotOK, std::string("read chunk data err: ")+strerror(errno));
+      }
+    }
+    chunk.resize(n);
+    if (n > 0) evbuffer_remove(evbuf, &chunk[0], n);
+    if (rocksdb::crc32c::Value(chunk.data(), chunk.size()) != chunk_crc) {
+      evbuffer_free(evbuf);
+      return Status(Status::NotOK, "chunk CRC mismatch");
+    }
+    auto ws = tmp_file->Append(chunk);
+    if (ws.ok()) ws = tmp_file->Flush();
+    if (!ws.ok()) {
+      evbuffer_free(evbuf);
+      return Status(Status::NotOK, "write tmp file err: "+ws.ToString());
+    }
+    tmp_crc = rocksdb::crc32c::Extend(tmp_crc, chunk.data(), chunk.size());
+    offset += n;
+    fetched_bytes->fetch_add(n);
+    if (n < chunk_size) break;
+  }
+  evbuffer_free(evbuf);
+  tmp_file->Close();
+  if (crc != tmp_crc) {
+    // all chunks are right but the file is not, it should be fetched from scratch
+    Engine::Storage::BackupManager::NewTmpFile(storage_, path);
+    return Status(Status::NotOK, "CRC mismatch");
+  }
+  // File is OK, rename to formal name
+  return Engine::Storage::BackupManager::SwapTmpFile(storage_, path);
+}
+
 // Check if stop_flag_ is set, when do, tear down replication
 void ReplicationThread::EventTimerCB(int, int16_t, void *ctx) {
   // DLOG(INFO) << "[replication] timer";
@@ -771,19 +1204,46 @@ void ReplicationThread::EventTimerCB(int, int16_t, void *ctx) {
   }
 }
 
-rocksdb::Status ReplicationThread::ParseWriteBatch(const std::string &batch_string) {
-  rocksdb::WriteBatch write_batch(batch_string);
-  WriteBatchHandler write_batch_handler;
-  rocksdb::Status status;
-
-  status = write_batch.Iterate(&write_batch_handler);
-  if (!status.ok()) return status;
-  if (write_batch_handler.IsPublish()) {
-    srv_->PublishMessage(write_batch_handler.GetPublishChannel().ToString(),
-                         write_batch_handler.GetPublishValue().ToString());
+Status ReplicationThread::appendIncrBatch(const char *data, size_t len) {
+  if (len < kWriteBatchHeaderSize) {
+    return Status(Status::NotOK, "invalid write batch size: " + std::to_string(len));
   }
+  // the batch is `sequence(8byte)|count(4byte)|records`, and each record takes one
+  // sequence, so the continuous batches could be joined by appending the records
+  rocksdb::SequenceNumber seq = DecodeFixed64(data);
+  uint32_t count = DecodeFixed32(data + 8);
+  if (!incr_pending_batch_.empty() && seq != incr_pending_next_seq_) {
+    auto s = flushIncrBatch();
+    if (!s.IsOK()) return s;
+  }
+  if (incr_pending_batch_.empty()) {
+    incr_pending_batch_.assign(data, len);
+  } else {
+    incr_pending_batch_.append(data + kWriteBatchHeaderSize, len - kWriteBatchHeaderSize);
+    EncodeFixed32(&incr_pending_batch_[8], DecodeFixed32(incr_pending_batch_.data() + 8) + count);
+  }
+  incr_pending_next_seq_ = seq + count;
+  return Status::OK();
+}
 
-  return rocksdb::Status::OK();
+Status ReplicationThread::flushIncrBatch() {
+  if (incr_pending_batch_.empty()) return Status::OK();
+  // the publishes may be in the middle of the joined batch, so it's parsed before being moved
+  // into the write, and the messages are published after the write
+  rocksdb::WriteBatch write_batch(incr_pending_batch_);
+  WriteBatchHandler write_batch_handler;
+  auto parsed = write_batch.Iterate(&write_batch_handler);
+  auto s = storage_->WriteBatch(std::move(incr_pending_batch_));
+  incr_pending_batch_.clear();
+  if (!s.IsOK()) return s;
+  if (!parsed.ok()) {
+    LOG(WARNING) << "[replication] Failed to parse the publishes of the batch, err: " << parsed.ToString();
+    return Status::OK();
+  }
+  for (const auto &message : write_batch_handler.GetPublishMessages()) {
+    srv_->PublishMessage(message.first, message.second);
+  }
+  return Status::OK();
 }
 
 bool ReplicationThread::isRestoringError(const char *err) {
@@ -796,7 +1256,6 @@ rocksdb::Status WriteBatchHandler::PutCF(uint32_t column_family_id, const rocksd
     return rocksdb::Status::OK();
   }
 
-  publish_message_ = std::make_pair(key.ToString(), value.ToString());
-  is_publish_ = true;
+  publish_messages_.emplace_back(key.ToString(), value.ToString());
   return rocksdb::Status::OK();
 }
@@ -8,6 +8,9 @@
 #include <tuple>
 #include <string>
 #include <deque>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 
 #include "status.h"
 #include "storage.h"
@@ -27,6 +30,53 @@ enum ReplState {
   kReplError,
 };
 
+// WALTailer reads the WAL once for all slaves and keeps the recent batches
+// in a ring, the feeders which are in the window of the ring share the
+// decoded batches instead of opening their own WAL iterators.
+class WALTailer {
+ public:
+  struct Batch {
+    rocksdb::SequenceNumber sequence;
+    rocksdb::SequenceNumber next_sequence;
+    std::string data;
+  };
+
+  explicit WALTailer(Engine::Storage *storage, size_t max_bytes)
+      : storage_(storage), max_bytes_(max_bytes) {}
+  ~WALTailer();
+  WALTailer(const WALTailer &) = delete;
+  WALTailer &operator=(const WALTailer &) = delete;
+
+  Status Start(rocksdb::SequenceNumber seq);
+  // Stop joins the tailer thread and drops the ring, it must be called before closing the db
+  void Stop();
+  bool IsRunning() { return running_; }
+  // Read returns false if the seq is out of the window of the ring, and the caller
+  // should read the WAL by itself, otherwise appends the batches started from seq
+  // til max_bytes, it may append nothing if there's no new batch.
+  bool Read(rocksdb::SequenceNumber seq, size_t max_bytes,
+            std::vector<std::shared_ptr<const Batch>> *batches);
+  // WaitFor blocks until the batch of the seq is in the ring or timeout
+  bool WaitFor(rocksdb::SequenceNumber seq, int timeout_ms);
+
+ private:
+  Engine::Storage *storage_;
+  size_t max_bytes_;
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> running_{false};
+  std::thread t_;
+  std::unique_ptr<rocksdb::TransactionLogIterator> iter_ = nullptr;
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::shared_ptr<const Batch>> ring_;
+  size_t ring_bytes_ = 0;
+  rocksdb::SequenceNumber next_seq_ = 0;
+
+  void loop();
+  void append(const rocksdb::BatchResult &batch);
+  void reset(rocksdb::SequenceNumber seq);
+};
 
 class FeedSlaveThread {
  public:
@@ -39,19 +89,33 @@ class FeedSlaveThread {
   void Join();
   bool IsStopped() { return stop_; }
   Redis::Connection *GetConn() { return conn_; }
-  rocksdb::SequenceNumber GetCurrentReplSeq() { return next_repl_seq_ == 0 ? 0 : next_repl_seq_-1; }
+  // GetCurrentReplSeq returns the seq of the last batch sent to the slave, it's read by
+  // the INFO and WAIT commands in the other threads
+  rocksdb::SequenceNumber GetCurrentReplSeq() {
+    rocksdb::SequenceNumber next_repl_seq = next_repl_seq_.load();
+    return next_repl_seq == 0 ? 0 : next_repl_seq-1;
+  }
+  // the slave which sent the capa ack in its REPLCONF reports its applied seq by the
+  // REPLCONF ACK, GetAckedReplSeq returns 0 if nothing is acked
+  bool IsAckEnabled() { return conn_->IsFlagEnabled(Redis::Connection::kReplAck); }
+  rocksdb::SequenceNumber GetAckedReplSeq() { return acked_repl_seq_.load(); }
 
  private:
-  uint64_t interval = 0;
+  uint64_t last_ping_ms_ = 0;
   bool stop_ = false;
   Server *srv_ = nullptr;
   Redis::Connection *conn_ = nullptr;
-  rocksdb::SequenceNumber next_repl_seq_ = 0;
+  std::atomic<rocksdb::SequenceNumber> next_repl_seq_{0};
+  std::atomic<rocksdb::SequenceNumber> acked_repl_seq_{0};
+  std::string ack_buf_;
   std::thread t_;
   std::unique_ptr<rocksdb::TransactionLogIterator> iter_ = nullptr;
 
   void loop();
   void checkLivenessIfNeed();
+  // recvAcks reads the acks of the slave without blocking
+  void recvAcks();
+  Status sendBatches(const std::vector<rocksdb::Slice> &batches);
 };
 
 class ReplicationThread {
@@ -133,6 +197,11 @@ class ReplicationThread {
   } fullsync_state_ = kFetchMetaID;
   rocksdb::BackupID fullsync_meta_id_ = 0;
   size_t fullsync_filesize_ = 0;
+  // fetch the checkpoint instead of the backup, unless the master is too old
+  bool fullsync_use_checkpoint_ = true;
+  std::string fullsync_checkpoint_id_;
+  // send the psync without the replication id, if the master is too old
+  bool psync_without_replid_ = false;
 
   // Internal states managed by IncrementBatchLoop procedure
   enum IncrementBatchLoopState {
@@ -141,6 +210,15 @@ class ReplicationThread {
   } incr_state_ = Incr_batch_size;
 
   size_t incr_bulk_len_ = 0;
+  // the consecutive batches of the master are coalesced into one local write, the
+  // next_seq is the sequence of the batch which could be appended to the pending one
+  std::string incr_pending_batch_;
+  rocksdb::SequenceNumber incr_pending_next_seq_ = 0;
+  // the applied seq is acked after the batches are written, or with the heartbeat
+  // of the master, if the master accepted the capa ack
+  bool repl_ack_ = false;
+  rocksdb::SequenceNumber last_ack_seq_ = 0;
+  time_t last_ack_time_ = 0;
 
   using CBState = CallbacksStateMachine::State;
   CallbacksStateMachine psync_steps_;
@@ -154,6 +232,8 @@ class ReplicationThread {
   static CBState checkDBNameReadCB(bufferevent *bev, void *ctx);
   static CBState replConfWriteCB(bufferevent *bev, void *ctx);
   static CBState replConfReadCB(bufferevent *bev, void *ctx);
+  static CBState replConfCapaWriteCB(bufferevent *bev, void *ctx);
+  static CBState replConfCapaReadCB(bufferevent *bev, void *ctx);
   static CBState tryPSyncWriteCB(bufferevent *bev, void *ctx);
   static CBState tryPSyncReadCB(bufferevent *bev, void *ctx);
   static CBState incrementBatchLoopCB(bufferevent *bev, void *ctx);
@@ -163,12 +243,18 @@ class ReplicationThread {
   // Synchronized-Blocking ops
   Status sendAuth(int sock_fd);
   Status fetchFile(int sock_fd, std::string path, uint32_t crc);
+  Status fetchFileChunked(int sock_fd, const std::string &path, uint32_t crc,
+                          std::atomic<uint64_t> *fetched_bytes);
   Status parallelFetchFile(const std::vector<std::pair<std::string, uint32_t>> &files);
   static bool isRestoringError(const char *err);
 
   static void EventTimerCB(int, int16_t, void *ctx);
 
-  rocksdb::Status ParseWriteBatch(const std::string &batch_string);
+  // appendIncrBatch coalesces the batch of the master into the pending one, which is
+  // written first if the sequence isn't continuous
+  Status appendIncrBatch(const char *data, size_t len);
+  Status flushIncrBatch();
+  void sendAckIfNeed(bufferevent *bev);
 };
 
 /*
@@ -179,10 +265,9 @@ class WriteBatchHandler : public rocksdb::WriteBatch::Handler {
   rocksdb::Status PutCF(uint32_t column_family_id, const rocksdb::Slice &key,
                         const rocksdb::Slice &value) override;
 
-  rocksdb::Slice GetPublishChannel() { return publish_message_.first; }
-  rocksdb::Slice GetPublishValue() { return publish_message_.second; }
-  bool IsPublish() { return is_publish_; }
+  // the publishes are found anywhere in the batch, like the ones in the batch of EXEC or EVAL
+  const std::vector<std::pair<std::string, std::string>> &GetPublishMessages() { return publish_messages_; }
+  bool IsPublish() { return !publish_messages_.empty(); }
  private:
-  std::pair<std::string, std::string> publish_message_;
-  bool is_publish_ = false;
+  std::vector<std::pair<std::string, std::string>> publish_messages_;
 };
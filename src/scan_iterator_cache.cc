@@ -0,0 +1,113 @@
+#include "scan_iterator_cache.h"
+
+#include <utility>
+#include <vector>
+
+#include "storage.h"
+
+namespace Engine {
+
+std::unique_ptr<ScanIterator> ScanIterator::New(Storage *storage,
+                                                rocksdb::ColumnFamilyHandle *cf_handle,
+                                                const std::string &upper_bound) {
+  if (!storage->IncrDBRefs().IsOK()) return nullptr;
+  std::unique_ptr<ScanIterator> scan_iter(new ScanIterator(storage));
+  auto db = storage->GetDB();
+  scan_iter->snapshot_ = db->GetSnapshot();
+  scan_iter->upper_bound_ = upper_bound;
+  scan_iter->upper_bound_slice_ = scan_iter->upper_bound_;
+  auto read_options = storage->ScanReadOptions(scan_iter->snapshot_);
+  // the subkey scans stay in the prefix of the key version, and the metadata
+  // scans seek in the total order though its prefix extractor is the whole key
+  read_options.prefix_same_as_start = true;
+  Storage::SetTotalOrderIfMetadata(cf_handle, &read_options);
+  if (!scan_iter->upper_bound_.empty()) read_options.iterate_upper_bound = &scan_iter->upper_bound_slice_;
+  scan_iter->iter_.reset(db->NewIterator(read_options, cf_handle));
+  scan_iter->last_access = std::time(nullptr);
+  return scan_iter;
+}
+
+ScanIterator::~ScanIterator() {
+  iter_.reset();
+  if (snapshot_) storage_->GetDB()->ReleaseSnapshot(snapshot_);
+  storage_->DecrDBRefs();
+}
+
+std::unique_ptr<ScanIterator> ScanIteratorCache::Take(const std::string &token, const std::string &cursor) {
+  std::unique_ptr<ScanIterator> scan_iter;
+  {
+    std::lock_guard<std::mutex> guard(mu_);
+    auto iter = iters_.find(token);
+    if (iter == iters_.end()) return nullptr;
+    scan_iter = std::move(iter->second);
+    iters_.erase(iter);
+  }
+  // the client restarted or jumped to another cursor, drop it outside the lock
+  if (scan_iter->cursor != cursor) return nullptr;
+  return scan_iter;
+}
+
+void ScanIteratorCache::Put(const std::string &token, std::unique_ptr<ScanIterator> scan_iter) {
+  std::unique_ptr<ScanIterator> evicted;
+  std::lock_guard<std::mutex> guard(mu_);
+  if (!enabled_ || capacity_ == 0) return;
+  if (iters_.size() >= capacity_ && iters_.find(token) == iters_.end()) {
+    auto lru = iters_.begin();
+    for (auto iter = iters_.begin(); iter != iters_.end(); iter++) {
+      if (iter->second->last_access < lru->second->last_access) lru = iter;
+    }
+    evicted = std::move(lru->second);
+    iters_.erase(lru);
+  }
+  scan_iter->last_access = std::time(nullptr);
+  iters_[token] = std::move(scan_iter);
+}
+
+void ScanIteratorCache::ErasePrefix(const std::string &token_prefix) {
+  std::vector<std::unique_ptr<ScanIterator>> erased;
+  std::lock_guard<std::mutex> guard(mu_);
+  auto iter = iters_.lower_bound(token_prefix);
+  while (iter != iters_.end() && iter->first.compare(0, token_prefix.size(), token_prefix) == 0) {
+    erased.emplace_back(std::move(iter->second));
+    iter = iters_.erase(iter);
+  }
+}
+
+void ScanIteratorCache::PurgeIdle(int max_idle_seconds) {
+  std::vector<std::unique_ptr<ScanIterator>> purged;
+  auto now = std::time(nullptr);
+  std::lock_guard<std::mutex> guard(mu_);
+  for (auto iter = iters_.begin(); iter != iters_.end();) {
+    if (iter->second->last_access + max_idle_seconds >= now) {
+      iter++;
+      continue;
+    }
+    purged.emplace_back(std::move(iter->second));
+    iter = iters_.erase(iter);
+  }
+}
+
+void ScanIteratorCache::Disable() {
+  std::lock_guard<std::mutex> guard(mu_);
+  enabled_ = false;
+  iters_.clear();
+}
+
+void ScanIteratorCache::Enable() {
+  std::lock_guard<std::mutex> guard(mu_);
+  enabled_ = true;
+}
+
+void ScanIteratorCache::SetCapacity(size_t capacity) {
+  std::map<std::string, std::unique_ptr<ScanIterator>> dropped;
+  std::lock_guard<std::mutex> guard(mu_);
+  capacity_ = capacity;
+  if (iters_.size() > capacity_) dropped.swap(iters_);
+}
+
+size_t ScanIteratorCache::Size() {
+  std::lock_guard<std::mutex> guard(mu_);
+  return iters_.size();
+}
+
+}  // namespace Engine
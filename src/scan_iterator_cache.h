@@ -0,0 +1,76 @@
+#pragma once
+
+#include <rocksdb/db.h>
+
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace Engine {
+class Storage;
+
+// ScanIterator pins the snapshot and the position of the paged scan, so the next
+// page could be continued from where the last one stopped instead of seeking again.
+// It holds a reference of the db, the db wouldn't be closed until it is released.
+class ScanIterator {
+ public:
+  // New returns nullptr if the db is closing, the upper bound is exclusive
+  static std::unique_ptr<ScanIterator> New(Storage *storage,
+                                           rocksdb::ColumnFamilyHandle *cf_handle,
+                                           const std::string &upper_bound);
+  ~ScanIterator();
+
+  rocksdb::Iterator *Get() { return iter_.get(); }
+  const rocksdb::Snapshot *GetSnapshot() { return snapshot_; }
+
+  // the cursor is returned to the client by the last page
+  std::string cursor;
+  time_t last_access = 0;
+
+  ScanIterator(const ScanIterator &) = delete;
+  ScanIterator &operator=(const ScanIterator &) = delete;
+
+ private:
+  explicit ScanIterator(Storage *storage) : storage_(storage) {}
+
+  Storage *storage_;
+  const rocksdb::Snapshot *snapshot_ = nullptr;
+  std::string upper_bound_;
+  rocksdb::Slice upper_bound_slice_;
+  std::unique_ptr<rocksdb::Iterator> iter_;
+};
+
+// ScanIteratorCache keeps the live scan iterators keyed by the token, which is
+// composed of the connection id and the scanned key, at most capacity iterators
+// are cached and the least recently used one would be evicted if full.
+class ScanIteratorCache {
+ public:
+  explicit ScanIteratorCache(size_t capacity) : capacity_(capacity) {}
+  ~ScanIteratorCache() = default;
+
+  // Take removes the iterator from the cache and returns it if its cursor matched,
+  // the caller should put it back after the page is done
+  std::unique_ptr<ScanIterator> Take(const std::string &token, const std::string &cursor);
+  void Put(const std::string &token, std::unique_ptr<ScanIterator> iter);
+  void ErasePrefix(const std::string &token_prefix);
+  void PurgeIdle(int max_idle_seconds);
+  // Disable drops all iterators and rejects the new ones until enabled,
+  // it should be called before closing the db
+  void Disable();
+  void Enable();
+  void SetCapacity(size_t capacity);
+  size_t Size();
+
+  ScanIteratorCache(const ScanIteratorCache &) = delete;
+  ScanIteratorCache &operator=(const ScanIteratorCache &) = delete;
+
+ private:
+  std::mutex mu_;
+  size_t capacity_;
+  bool enabled_ = false;
+  std::map<std::string, std::unique_ptr<ScanIterator>> iters_;
+};
+
+}  // namespace Engine
@@ -0,0 +1,455 @@
+#include "scripting.h"
+
+extern "C" {
+#include <lauxlib.h>
+#include <lua.h>
+#include <lualib.h>
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "redis_cmd.h"
+#include "redis_connection.h"
+#include "redis_reply.h"
+#include "server.h"
+#include "util.h"
+#include "worker.h"
+
+namespace Lua {
+
+// the addresses are the registry keys of the server and connection of the running script
+static const char kServerKey = 0;
+static const char kConnectionKey = 0;
+// the deadline(ms) of the running script in the thread, 0 is no limit
+static thread_local int64_t script_deadline_ms = 0;
+// the count of the instructions between the checks of the deadline
+static const int kTimeLimitCheckCount = 100000;
+
+static int64_t nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the commands can't be nested in the script, besides the ones disallowed in the transaction
+static bool isScriptCommandAllowed(const std::string &name) {
+  static const std::vector<std::string> disallowed = {
+      "eval", "evalsha", "script", "multi", "exec", "discard", "watch", "unwatch", "quit"};
+  return std::find(disallowed.begin(), disallowed.end(), name) == disallowed.end();
+}
+
+// the error message is a part of the reply, so it shouldn't break the protocol
+static std::string errorLine(std::string msg) {
+  std::replace(msg.begin(), msg.end(), '\r', ' ');
+  std::replace(msg.begin(), msg.end(), '\n', ' ');
+  return msg;
+}
+
+// pushErrorTable pushes the error reply {err=msg} as redis does
+static void pushErrorTable(lua_State *lua, const std::string &msg) {
+  lua_newtable(lua);
+  lua_pushstring(lua, "err");
+  lua_pushlstring(lua, msg.data(), msg.size());
+  lua_settable(lua, -3);
+}
+
+// respToLua pushes the lua value of the reply, and returns the position after it. The status
+// and error replies are converted into the tables {ok=status} and {err=error}, the nil into false.
+static const char *respToLua(lua_State *lua, const char *p, const char *end) {
+  const char *crlf = std::search(p, end, CRLF, CRLF + 2);
+  if (p == end || crlf == end) {
+    lua_pushboolean(lua, 0);
+    return end;
+  }
+  std::string line(p + 1, crlf);
+  const char *next = crlf + 2;
+  switch (*p) {
+    case '+':
+    case '-':
+      lua_newtable(lua);
+      lua_pushstring(lua, *p == '+' ? "ok" : "err");
+      lua_pushlstring(lua, line.data(), line.size());
+      lua_settable(lua, -3);
+      return next;
+    case ':':
+      lua_pushnumber(lua, static_cast<lua_Number>(std::strtoll(line.c_str(), nullptr, 10)));
+      return next;
+    case '$': {
+      int64_t len = std::strtoll(line.c_str(), nullptr, 10);
+      if (len < 0 || next + len > end) {
+        lua_pushboolean(lua, 0);
+        return len < 0 ? next : end;
+      }
+      lua_pushlstring(lua, next, static_cast<size_t>(len));
+      return std::min(next + len + 2, end);
+    }
+    case '*': {
+      int64_t n = std::strtoll(line.c_str(), nullptr, 10);
+      if (n < 0) {
+        lua_pushboolean(lua, 0);
+        return next;
+      }
+      lua_checkstack(lua, 3);
+      lua_newtable(lua);
+      for (int64_t i = 0; i < n; i++) {
+        next = respToLua(lua, next, end);
+        lua_rawseti(lua, -2, static_cast<int>(i + 1));
+      }
+      return next;
+    }
+    default:
+      lua_pushboolean(lua, 0);
+      return end;
+  }
+}
+
+// luaToResp pops the value on the top of the stack and appends its reply into the output,
+// the number is truncated to the integer, and the array ends at the first nil like redis
+static void luaToResp(lua_State *lua, std::string *output) {
+  switch (lua_type(lua, -1)) {
+    case LUA_TSTRING: {
+      size_t len;
+      const char *str = lua_tolstring(lua, -1, &len);
+      output->append(Redis::BulkString(std::string(str, len)));
+      break;
+    }
+    case LUA_TBOOLEAN:
+      output->append(lua_toboolean(lua, -1) ? Redis::Integer(1) : Redis::NilString());
+      break;
+    case LUA_TNUMBER:
+      output->append(Redis::Integer(static_cast<int64_t>(lua_tonumber(lua, -1))));
+      break;
+    case LUA_TTABLE: {
+      lua_pushstring(lua, "err");
+      lua_gettable(lua, -2);
+      if (lua_type(lua, -1) == LUA_TSTRING) {
+        output->append(Redis::Error(errorLine(lua_tostring(lua, -1))));
+        lua_pop(lua, 2);
+        return;
+      }
+      lua_pop(lua, 1);
+      lua_pushstring(lua, "ok");
+      lua_gettable(lua, -2);
+      if (lua_type(lua, -1) == LUA_TSTRING) {
+        output->append(Redis::SimpleString(errorLine(lua_tostring(lua, -1))));
+        lua_pop(lua, 2);
+        return;
+      }
+      lua_pop(lua, 1);
+      std::string elems;
+      int n = 0;
+      lua_checkstack(lua, 2);
+      for (int i = 1; ; i++) {
+        lua_rawgeti(lua, -1, i);
+        if (lua_isnil(lua, -1)) {
+          lua_pop(lua, 1);
+          break;
+        }
+        luaToResp(lua, &elems);
+        n++;
+      }
+      output->append(Redis::MultiLen(n));
+      output->append(elems);
+      break;
+    }
+    default:
+      output->append(Redis::NilString());
+  }
+  lua_pop(lua, 1);
+}
+
+// callCommand executes the command of the arguments on the stack, and pushes its reply,
+// it returns false if the reply is an error. All C++ objects are destroyed after it
+// returned, so the caller can raise the lua error which jumps over the C++ frames.
+static bool callCommand(lua_State *lua) {
+  int argc = lua_gettop(lua);
+  if (argc == 0) {
+    pushErrorTable(lua, "ERR Please specify at least one argument for redis.call()");
+    return false;
+  }
+  std::vector<std::string> args;
+  for (int i = 1; i <= argc; i++) {
+    // the numbers are converted into the strings as well
+    if (!lua_isstring(lua, i)) {
+      pushErrorTable(lua, "ERR Lua redis() command arguments must be strings or integers");
+      return false;
+    }
+    size_t len;
+    const char *arg = lua_tolstring(lua, i, &len);
+    args.emplace_back(arg, len);
+  }
+  if (!isScriptCommandAllowed(Util::ToLower(args.front()))) {
+    pushErrorTable(lua, "ERR This command is not allowed from scripts");
+    return false;
+  }
+  lua_pushlightuserdata(lua, const_cast<char *>(&kServerKey));
+  lua_gettable(lua, LUA_REGISTRYINDEX);
+  auto svr = static_cast<Server *>(lua_touserdata(lua, -1));
+  lua_pushlightuserdata(lua, const_cast<char *>(&kConnectionKey));
+  lua_gettable(lua, LUA_REGISTRYINDEX);
+  auto conn = static_cast<Redis::Connection *>(lua_touserdata(lua, -1));
+  lua_pop(lua, 2);
+
+  std::string reply;
+  Redis::ExecuteNestedCommand(svr, conn, std::move(args), &reply);
+  respToLua(lua, reply.data(), reply.data() + reply.size());
+  return reply.empty() || reply[0] != '-';
+}
+
+static int redisCall(lua_State *lua) {
+  if (!callCommand(lua)) return lua_error(lua);
+  return 1;
+}
+
+static int redisPCall(lua_State *lua) {
+  callCommand(lua);
+  return 1;
+}
+
+static int redisReturnSingleFieldTable(lua_State *lua, const char *field) {
+  if (lua_gettop(lua) != 1 || lua_type(lua, -1) != LUA_TSTRING) {
+    return luaL_error(lua, "wrong number or type of arguments");
+  }
+  lua_newtable(lua);
+  lua_pushstring(lua, field);
+  lua_pushvalue(lua, -3);
+  lua_settable(lua, -3);
+  return 1;
+}
+
+static int redisStatusReply(lua_State *lua) {
+  return redisReturnSingleFieldTable(lua, "ok");
+}
+
+static int redisErrorReply(lua_State *lua) {
+  return redisReturnSingleFieldTable(lua, "err");
+}
+
+static void timeLimitHook(lua_State *lua, lua_Debug *ar) {
+  if (script_deadline_ms > 0 && nowMs() > script_deadline_ms) {
+    luaL_error(lua, "the script was aborted as it ran longer than lua-time-limit");
+  }
+}
+
+static void loadLibrary(lua_State *lua, const char *name, lua_CFunction func) {
+  lua_pushcfunction(lua, func);
+  lua_pushstring(lua, name);
+  lua_call(lua, 1, 0);
+}
+
+static void setGlobalArray(lua_State *lua, const char *name, const std::vector<std::string> &elems,
+                           size_t begin, size_t end) {
+  lua_newtable(lua);
+  for (size_t i = begin; i < end; i++) {
+    lua_pushlstring(lua, elems[i].data(), elems[i].size());
+    lua_rawseti(lua, -2, static_cast<int>(i - begin + 1));
+  }
+  lua_setglobal(lua, name);
+}
+
+lua_State *CreateState() {
+  lua_State *lua = luaL_newstate();
+  loadLibrary(lua, "", luaopen_base);
+  loadLibrary(lua, LUA_TABLIBNAME, luaopen_table);
+  loadLibrary(lua, LUA_STRLIBNAME, luaopen_string);
+  loadLibrary(lua, LUA_MATHLIBNAME, luaopen_math);
+  // the scripts shouldn't touch the files
+  lua_pushnil(lua);
+  lua_setglobal(lua, "loadfile");
+  lua_pushnil(lua);
+  lua_setglobal(lua, "dofile");
+
+  lua_newtable(lua);
+  lua_pushstring(lua, "call");
+  lua_pushcfunction(lua, redisCall);
+  lua_settable(lua, -3);
+  lua_pushstring(lua, "pcall");
+  lua_pushcfunction(lua, redisPCall);
+  lua_settable(lua, -3);
+  lua_pushstring(lua, "status_reply");
+  lua_pushcfunction(lua, redisStatusReply);
+  lua_settable(lua, -3);
+  lua_pushstring(lua, "error_reply");
+  lua_pushcfunction(lua, redisErrorReply);
+  lua_settable(lua, -3);
+  lua_setglobal(lua, "redis");
+  return lua;
+}
+
+void DestroyState(lua_State *lua) {
+  if (lua) lua_close(lua);
+}
+
+static uint32_t rotateLeft(uint32_t x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+std::string Sha1Hex(const std::string &input) {
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+  std::string msg = input;
+  uint64_t bits = static_cast<uint64_t>(input.size()) * 8;
+  msg.push_back(static_cast<char>(0x80));
+  while (msg.size() % 64 != 56) msg.push_back(0);
+  for (int i = 7; i >= 0; i--) msg.push_back(static_cast<char>((bits >> (i * 8)) & 0xff));
+
+  uint32_t w[80];
+  for (size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+    for (int i = 0; i < 16; i++) {
+      const auto *p = reinterpret_cast<const uint8_t *>(msg.data() + chunk + i * 4);
+      w[i] = (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16)
+          | (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+    }
+    for (int i = 16; i < 80; i++) w[i] = rotateLeft(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t temp = rotateLeft(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotateLeft(b, 30);
+      b = a;
+      a = temp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+  char hex[41];
+  for (int i = 0; i < 5; i++) snprintf(hex + i * 8, 9, "%08x", h[i]);
+  return std::string(hex, 40);
+}
+
+Status CreateFunction(lua_State *lua, const std::string &sha, const std::string &body) {
+  std::string func = "function f_" + sha + "() " + body + "\nend";
+  if (luaL_loadbuffer(lua, func.data(), func.size(), "@user_script")) {
+    std::string err = lua_tostring(lua, -1);
+    lua_pop(lua, 1);
+    return Status(Status::NotOK, "Error compiling script (new function): " + err);
+  }
+  if (lua_pcall(lua, 0, 0, 0)) {
+    std::string err = lua_tostring(lua, -1);
+    lua_pop(lua, 1);
+    return Status(Status::NotOK, "Error running script (new function): " + err);
+  }
+  return Status::OK();
+}
+
+Status EvalGenericCommand(Server *svr, Redis::Connection *conn, const std::vector<std::string> &args,
+                          bool evalsha, std::string *output) {
+  int64_t numkeys;
+  auto s = Util::StringToNum(args[2], &numkeys);
+  if (!s.IsOK()) {
+    *output = Redis::Error("ERR value is not an integer or out of range");
+    return Status::OK();
+  }
+  if (numkeys < 0) {
+    *output = Redis::Error("ERR Number of keys can't be negative");
+    return Status::OK();
+  }
+  if (numkeys > static_cast<int64_t>(args.size()) - 3) {
+    *output = Redis::Error("ERR Number of keys can't be greater than number of args");
+    return Status::OK();
+  }
+
+  std::string sha, body;
+  if (evalsha) {
+    sha = Util::ToLower(args[1]);
+    if (!svr->ScriptGet(sha, &body)) {
+      *output = Redis::Error("NOSCRIPT No matching script. Please use EVAL.");
+      return Status::OK();
+    }
+  } else {
+    body = args[1];
+    sha = Sha1Hex(body);
+  }
+  lua_State *lua = conn->Owner()->Lua();
+  std::string func = "f_" + sha;
+  lua_getglobal(lua, func.c_str());
+  if (lua_isnil(lua, -1)) {
+    lua_pop(lua, 1);
+    s = CreateFunction(lua, sha, body);
+    if (!s.IsOK()) {
+      *output = Redis::Error("ERR " + errorLine(s.Msg()));
+      return Status::OK();
+    }
+    lua_getglobal(lua, func.c_str());
+  }
+  if (!evalsha) svr->ScriptSet(sha, body);
+  setGlobalArray(lua, "KEYS", args, 3, 3 + numkeys);
+  setGlobalArray(lua, "ARGV", args, 3 + numkeys, args.size());
+  lua_pushlightuserdata(lua, const_cast<char *>(&kServerKey));
+  lua_pushlightuserdata(lua, svr);
+  lua_settable(lua, LUA_REGISTRYINDEX);
+  lua_pushlightuserdata(lua, const_cast<char *>(&kConnectionKey));
+  lua_pushlightuserdata(lua, conn);
+  lua_settable(lua, LUA_REGISTRYINDEX);
+
+  // the writes of the script are collected into one batch, or into the batch
+  // of the transaction if the script is called by EXEC
+  auto storage = svr->storage_;
+  bool own_txn = !storage->InTxn();
+  if (own_txn) {
+    storage->BeginTxn();
+  } else {
+    // the failed script under EXEC drops its own writes, and keeps the writes of the other commands
+    storage->SetTxnSavePoint();
+  }
+  int time_limit = svr->GetConfig()->lua_time_limit;
+  script_deadline_ms = time_limit > 0 ? nowMs() + time_limit : 0;
+  if (time_limit > 0) lua_sethook(lua, timeLimitHook, LUA_MASKCOUNT, kTimeLimitCheckCount);
+  int err = lua_pcall(lua, 0, 1, 0);
+  if (time_limit > 0) lua_sethook(lua, nullptr, 0, 0);
+  script_deadline_ms = 0;
+  if (err) {
+    // none of the writes is applied if the script fails
+    if (own_txn) {
+      storage->DiscardTxn();
+    } else {
+      storage->RollbackTxnToSavePoint();
+    }
+    if (lua_type(lua, -1) == LUA_TTABLE) {
+      // the error raised by redis.call is replied as it is
+      luaToResp(lua, output);
+    } else {
+      const char *msg = lua_tostring(lua, -1);
+      *output = Redis::Error(errorLine("ERR Error running script (call to " + func + "): " + (msg ? msg : "")));
+      lua_pop(lua, 1);
+    }
+    return Status::OK();
+  }
+  std::string reply;
+  luaToResp(lua, &reply);
+  if (own_txn) {
+    auto ws = storage->CommitTxn();
+    if (!ws.ok()) {
+      *output = Redis::Error("ERR the writes of the script weren't committed: " + ws.ToString());
+      return Status::OK();
+    }
+    conn->SetLastWriteSeq(storage->LatestSeq());
+  } else {
+    storage->PopTxnSavePoint();
+  }
+  *output = std::move(reply);
+  return Status::OK();
+}
+
+}  // namespace Lua
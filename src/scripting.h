@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "status.h"
+
+struct lua_State;
+class Server;
+namespace Redis {
+class Connection;
+}
+
+namespace Lua {
+
+// CreateState creates the lua state of the worker, only the base, table, string and math
+// libraries are loaded, and the redis table is registered for the scripts to call the commands
+lua_State *CreateState();
+void DestroyState(lua_State *lua);
+// Sha1Hex returns the sha1 digest of the script in lowercase hex, which keys the script cache
+std::string Sha1Hex(const std::string &input);
+// CreateFunction compiles the script into the global function f_<sha> of the lua state
+Status CreateFunction(lua_State *lua, const std::string &sha, const std::string &body);
+// EvalGenericCommand runs the script of EVAL or EVALSHA in the lua state of the worker, the
+// commands called by the script are executed in place without the protocol, and their writes
+// are collected into one batch which is written after the script is finished
+Status EvalGenericCommand(Server *svr, Redis::Connection *conn, const std::vector<std::string> &args,
+                          bool evalsha, std::string *output);
+
+}  // namespace Lua
@@ -4,8 +4,13 @@
 #include <sys/utsname.h>
 #include <sys/resource.h>
 #include <glog/logging.h>
+#include <rocksdb/statistics.h>
+#include <rocksdb/table_properties.h>
 #include <utility>
 #include <memory>
+#include <set>
+#include <iomanip>
+#include <algorithm>
 
 #include "util.h"
 #include "worker.h"
@@ -13,20 +18,47 @@
 #include "redis_db.h"
 #include "redis_request.h"
 #include "redis_connection.h"
+#include "compaction_checker.h"
+
+// the checkpoint for the full sync would be purged after no slave fetched it for a while
+const int kCheckpointMaxIdleSeconds = 120;
+// limit the range deletions of the reclaimer to avoid too many range tombstones at once
+const size_t kMaxReclaimRangesPerSecond = 100;
+const int kScanIteratorMaxIdleSeconds = 30;
+// the expire cycle scans at most the times of the expire limit metadata per second
+const uint64_t kActiveExpireScanFactor = 100;
+// the compaction checker picks at most the number of files whose deleted keys ratio
+// is at least the threshold every minute, to keep the extra compactions gentle
+const double kCompactionCheckMinDeletedRatio = 0.3;
+const int kCompactionCheckMaxFiles = 4;
+// the DBSIZE SCAN keeps the largest keys, and the INFO shows the top ones of the hot and big keys
+const size_t kBigKeysTopK = 64;
+const size_t kHotKeysInfoCount = 10;
 
 Server::Server(Engine::Storage *storage, Config *config) :
-  storage_(storage), config_(config) {
-  // init commands stats here to prevent concurrent insert, and cause core
-  std::vector<std::string> commands;
-  Redis::GetCommandList(&commands);
-  for (const auto &cmd : commands) {
-    stats_.commands_stats[cmd].calls = 0;
-    stats_.commands_stats[cmd].latency = 0;
+  stats_(Redis::GetCommandNum()), storage_(storage), config_(config),
+  perf_stats_(Redis::GetCommandNum()) {
+  const auto &cpus = config->worker_cpus;
+  if (!config->unixsocket.empty()) {
+    auto s = Util::SockListenUnix(config->unixsocket, config->unixsocketperm, config->backlog, &unixsocket_fd_);
+    if (!s.IsOK()) {
+      LOG(ERROR) << "[server] Failed to listen on the unix socket: " << config->unixsocket
+                 << ", encounter error: " << s.Msg();
+      exit(1);
+    }
   }
-
   for (int i = 0; i < config->workers; i++) {
     auto worker = new Worker(this, config);
-    worker_threads_.emplace_back(new WorkerThread(worker));
+    if (unixsocket_fd_ != -1) {
+      auto s = worker->ListenUnixSocket(unixsocket_fd_);
+      if (!s.IsOK()) {
+        LOG(ERROR) << "[server] Failed to listen on the unix socket: " << config->unixsocket
+                   << ", encounter error: " << s.Msg();
+        exit(1);
+      }
+    }
+    int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+    worker_threads_.emplace_back(new WorkerThread(worker, cpu));
   }
   uint64_t max_replication_bytes =
       config_->max_replication_mb > 0 ? config_->max_replication_mb * 1024 * 1024 / config_->repl_workers : 0;
@@ -37,18 +69,46 @@ Server::Server(Engine::Storage *storage, Config *config) :
   }
   slow_log_.SetMaxEntries(config->slowlog_max_len);
   perf_log_.SetMaxEntries(config->profiling_sample_record_max_len);
+  trace_log_.SetMaxEntries(config->trace_max_len);
   task_runner_ = new TaskRunner(2, 1024);
+  if (config->slow_command_threads > 0) {
+    slow_cmd_runner_ = new TaskRunner(config->slow_command_threads, 10240);
+  }
+  if (config->io_read_threads > 0) {
+    io_read_runner_ = new TaskRunner(config->io_read_threads, 10240);
+  }
+  // keep the recent 64MiB WAL batches for the slaves
+  wal_tailer_ = std::unique_ptr<WALTailer>(new WALTailer(storage, 64 * 1024 * 1024));
+  pthread_rwlock_init(&pubsub_rwlock_, nullptr);
+  pthread_rwlock_init(&blocking_keys_rwlock_, nullptr);
+  // the written keys are invalidated by the workers which have the tracking connections
+  storage_->SetWrittenKeysHandler([this](const std::vector<std::string> &ns_keys) {
+    for (const auto &t : worker_threads_) {
+      auto worker = t->GetWorker();
+      if (worker->HasTrackingConns()) worker->InvalidateKeys(ns_keys);
+    }
+  });
+  storage_->SetDBClosingHandler([this]() {
+    for (const auto &t : worker_threads_) t->GetWorker()->CancelStreamingReplies();
+  });
   time(&start_time_);
 }
 
 Server::~Server() {
+  storage_->SetWrittenKeysHandler(nullptr);
+  storage_->SetDBClosingHandler(nullptr);
   for (const auto &worker_thread : worker_threads_) {
     delete worker_thread;
   }
-  for (const auto &iter : conn_ctxs_) {
-    delete iter.first;
+  if (unixsocket_fd_ != -1) {
+    close(unixsocket_fd_);
+    unlink(config_->unixsocket.c_str());
   }
   delete task_runner_;
+  delete slow_cmd_runner_;
+  delete io_read_runner_;
+  pthread_rwlock_destroy(&pubsub_rwlock_);
+  pthread_rwlock_destroy(&blocking_keys_rwlock_);
 }
 
 Status Server::Start() {
@@ -60,6 +120,19 @@ Status Server::Start() {
     worker->Start();
   }
   task_runner_->Start();
+  if (slow_cmd_runner_) slow_cmd_runner_->Start();
+  if (io_read_runner_) io_read_runner_->Start();
+  monitor_feeder_.Start([this](const std::shared_ptr<MonitorRecords> &records) {
+    for (const auto &worker_thread : worker_threads_) {
+      worker_thread->GetWorker()->FeedMonitorConns(records);
+    }
+  });
+  if (config_->metrics_port > 0) {
+    metrics_server_ = std::unique_ptr<MetricsServer>(new MetricsServer(
+        config_->binds, config_->metrics_port, [this](std::string *metrics) { GetMetrics(metrics); }));
+    Status s = metrics_server_->Start();
+    if (!s.IsOK()) return s;
+  }
   // setup server cron thread
   cron_thread_ = std::thread([this]() {
     Util::ThreadSetName("server-cron");
@@ -74,11 +147,13 @@ void Server::Stop() {
   for (const auto worker : worker_threads_) {
     worker->Stop();
   }
-  slave_threads_mu_.lock();
-  for (const auto slave_thread : slave_threads_) slave_thread->Stop();
-  slave_threads_mu_.unlock();
-  cleanupExitedSlaves();
+  // the feeders are joined before the tailer is stopped, since they read the ring of it
+  DisconnectSlaves();
   task_runner_->Stop();
+  if (slow_cmd_runner_) slow_cmd_runner_->Stop();
+  if (io_read_runner_) io_read_runner_->Stop();
+  if (metrics_server_) metrics_server_->Stop();
+  monitor_feeder_.Stop();
 }
 
 void Server::Join() {
@@ -86,6 +161,10 @@ void Server::Join() {
     worker->Join();
   }
   task_runner_->Join();
+  if (slow_cmd_runner_) slow_cmd_runner_->Join();
+  if (io_read_runner_) io_read_runner_->Join();
+  if (metrics_server_) metrics_server_->Join();
+  monitor_feeder_.Join();
   if (cron_thread_.joinable()) cron_thread_.join();
 }
 
@@ -108,7 +187,8 @@ Status Server::AddMaster(std::string host, uint32_t port) {
         this->is_loading_ = true;
         ReclaimOldDBPtr();
       },
-      [this]() { this->is_loading_ = false; });
+      // the failed restore leaves the db closed, keep rejecting the commands til the next full sync
+      [this]() { this->is_loading_ = storage_->IsClosed(); });
   if (s.IsOK()) {
     master_host_ = host;
     master_port_ = port;
@@ -130,6 +210,8 @@ Status Server::RemoveMaster() {
     config_->master_port = 0;
     if (replication_thread_) replication_thread_->Stop();
     replication_thread_ = nullptr;
+    // the slaves of the former master could continue from the promoted one by the former id
+    storage_->ShiftReplicationID();
   }
   slaveof_mu_.unlock();
   return Status::OK();
@@ -159,7 +241,21 @@ Status Server::AddSlave(Redis::Connection *conn, rocksdb::SequenceNumber next_re
   }
 
   slave_threads_mu_.lock();
+  // the tailer isn't started again after the server is stopped
+  if (stop_) {
+    slave_threads_mu_.unlock();
+    t->Stop();
+    t->Join();
+    delete t;
+    return Status(Status::NotOK, "the server is stopping");
+  }
   slave_threads_.emplace_back(t);
+  // the shared tailer is started by the first slave, and the later slaves
+  // would catch up with it if they are behind
+  if (!wal_tailer_->IsRunning()) {
+    s = wal_tailer_->Start(next_repl_seq);
+    if (!s.IsOK()) LOG(WARNING) << "Failed to start the WAL tailer, err: " << s.Msg();
+  }
   slave_threads_mu_.unlock();
   return Status::OK();
 }
@@ -175,9 +271,35 @@ void Server::DisconnectSlaves() {
     slave_thread->Join();
     delete slave_thread;
   }
+  // the tailer must be stopped before the db is reopened
+  wal_tailer_->Stop();
   slave_threads_mu_.unlock();
 }
 
+int Server::SlavesReachedSeq(rocksdb::SequenceNumber seq) {
+  int reached = 0;
+  countSlavesReachedSeq(seq, &reached, nullptr);
+  return reached;
+}
+
+bool Server::IsSeqAcked(rocksdb::SequenceNumber seq, int n_slaves) {
+  int reached = 0;
+  countSlavesReachedSeq(seq, &reached, nullptr);
+  return reached >= n_slaves;
+}
+
+void Server::countSlavesReachedSeq(rocksdb::SequenceNumber seq, int *reached, int *alive) {
+  std::lock_guard<std::mutex> guard(slave_threads_mu_);
+  for (const auto &slave_thread : slave_threads_) {
+    if (slave_thread->IsStopped()) continue;
+    if (alive) (*alive)++;
+    // the slaves of the old versions never ack, the sent seq is the best known one
+    auto slave_seq = slave_thread->IsAckEnabled() ? slave_thread->GetAckedReplSeq()
+                                                  : slave_thread->GetCurrentReplSeq();
+    if (slave_seq >= seq) (*reached)++;
+  }
+}
+
 void Server::cleanupExitedSlaves() {
   std::list<FeedSlaveThread *> exited_slave_threads;
   slave_threads_mu_.lock();
@@ -197,182 +319,216 @@ void Server::cleanupExitedSlaves() {
 
 void Server::FeedMonitorConns(Redis::Connection *conn, const std::vector<std::string> &tokens) {
   if (monitor_clients_ <= 0) return;
-  for (const auto &worker_thread : worker_threads_) {
-    auto worker = worker_thread->GetWorker();
-    worker->FeedMonitorConns(conn, tokens);
-  }
+  // only the record is built in the worker, it's formatted and delivered by the feeder thread
+  std::unique_ptr<MonitorRecord> record(new MonitorRecord);
+  gettimeofday(&record->time, nullptr);
+  record->conn_id = conn->GetID();
+  record->ns = conn->GetNamespace();
+  record->addr = conn->GetAddr();
+  record->args = tokens;
+  monitor_feeder_.Feed(std::move(record));
+}
+
+// patternPrefix returns the literal prefix of the pattern before the first wildcard
+static std::string patternPrefix(const std::string &pattern) {
+  return pattern.substr(0, pattern.find_first_of("*?[\\"));
 }
 
 int Server::PublishMessage(const std::string &channel, const std::string &msg) {
   int cnt = 0;
-  std::string reply;
-  reply.append(Redis::MultiLen(3));
-  reply.append(Redis::BulkString("message"));
-  reply.append(Redis::BulkString(channel));
-  reply.append(Redis::BulkString(msg));
+  std::set<Worker *> receivers;
+  auto message = std::make_shared<PubSubMessage>();
+  message->channel = channel;
 
-  std::lock_guard<std::mutex> guard(pubsub_channels_mu_);
+  pthread_rwlock_rdlock(&pubsub_rwlock_);
   auto iter = pubsub_channels_.find(channel);
   if (iter != pubsub_channels_.end()) {
-    for (const auto &conn_ctx : iter->second) {
-      auto s = conn_ctx->owner->Reply(conn_ctx->fd, reply);
-      if (s.IsOK()) {
-        cnt++;
-      }
+    for (const auto &worker_iter : iter->second) {
+      cnt += worker_iter.second;
+      receivers.insert(worker_iter.first);
     }
-  }
-  for (const auto &iter : pubsub_patterns_) {
-    if (Util::StringMatch(iter.first, channel, 0)) {
-      for (const auto &conn_ctx : iter.second) {
-        auto s = conn_ctx->owner->Reply(conn_ctx->fd, reply);
-        if (s.IsOK()) {
-          cnt++;
+    message->reply.append(Redis::MultiLen(3));
+    message->reply.append(Redis::BulkString("message"));
+    message->reply.append(Redis::BulkString(channel));
+    message->reply.append(Redis::BulkString(msg));
+  }
+  if (!pubsub_patterns_.empty()) {
+    for (size_t i = 0; i <= channel.size(); i++) {
+      auto prefix_iter = pubsub_patterns_.find(channel.substr(0, i));
+      if (prefix_iter == pubsub_patterns_.end()) continue;
+      for (const auto &pattern_iter : prefix_iter->second) {
+        if (!Util::StringMatch(pattern_iter.first, channel, 0)) continue;
+        for (const auto &worker_iter : pattern_iter.second) {
+          cnt += worker_iter.second;
+          receivers.insert(worker_iter.first);
         }
+        std::string reply;
+        reply.append(Redis::MultiLen(4));
+        reply.append(Redis::BulkString("pmessage"));
+        reply.append(Redis::BulkString(pattern_iter.first));
+        reply.append(Redis::BulkString(channel));
+        reply.append(Redis::BulkString(msg));
+        message->pattern_replies.emplace_back(pattern_iter.first, std::move(reply));
       }
     }
   }
+  pthread_rwlock_unlock(&pubsub_rwlock_);
+
+  // the message would be delivered in the event loop of each worker,
+  // so the publisher never waits for the subscribers
+  for (const auto &worker : receivers) {
+    worker->PublishMessage(message);
+  }
   return cnt;
 }
 
 void Server::SubscribeChannel(const std::string &channel, Redis::Connection *conn) {
-  std::lock_guard<std::mutex> guard(pubsub_channels_mu_);
-  auto conn_ctx = new ConnContext(conn->Owner(), conn->GetFD());
-  conn_ctxs_[conn_ctx] = true;
-  auto iter = pubsub_channels_.find(channel);
-  if (iter == pubsub_channels_.end()) {
-    std::list<ConnContext *> conn_ctxs;
-    conn_ctxs.emplace_back(conn_ctx);
-    pubsub_channels_.insert(std::pair<std::string, std::list<ConnContext *>>(channel, conn_ctxs));
-  } else {
-    iter->second.emplace_back(conn_ctx);
-  }
+  conn->Owner()->SubscribeChannel(channel, conn);
+  pthread_rwlock_wrlock(&pubsub_rwlock_);
+  pubsub_channels_[channel][conn->Owner()]++;
+  pthread_rwlock_unlock(&pubsub_rwlock_);
 }
 
 void Server::UnSubscribeChannel(const std::string &channel, Redis::Connection *conn) {
-  std::lock_guard<std::mutex> guard(pubsub_channels_mu_);
+  if (!conn->Owner()->UnSubscribeChannel(channel, conn)) return;
+  pthread_rwlock_wrlock(&pubsub_rwlock_);
   auto iter = pubsub_channels_.find(channel);
-  if (iter == pubsub_channels_.end()) {
-    return;
-  }
-  for (const auto &conn_ctx : iter->second) {
-    if (conn->GetFD() == conn_ctx->fd && conn->Owner() == conn_ctx->owner) {
-      delConnContext(conn_ctx);
-      iter->second.remove(conn_ctx);
-      if (iter->second.empty()) {
-        pubsub_channels_.erase(iter);
-      }
-      break;
+  if (iter != pubsub_channels_.end()) {
+    auto worker_iter = iter->second.find(conn->Owner());
+    if (worker_iter != iter->second.end() && --worker_iter->second <= 0) {
+      iter->second.erase(worker_iter);
+      if (iter->second.empty()) pubsub_channels_.erase(iter);
     }
   }
+  pthread_rwlock_unlock(&pubsub_rwlock_);
 }
 
 void Server::GetChannelsByPattern(const std::string &pattern, std::vector<std::string> *channels) {
-  std::lock_guard<std::mutex> guard(pubsub_channels_mu_);
+  pthread_rwlock_rdlock(&pubsub_rwlock_);
   for (const auto &iter : pubsub_channels_) {
     if (pattern.empty() || Util::StringMatch(pattern, iter.first, 0)) {
       channels->emplace_back(iter.first);
     }
   }
+  pthread_rwlock_unlock(&pubsub_rwlock_);
 }
 
 void Server::ListChannelSubscribeNum(std::vector<std::string> channels,
                                      std::vector<ChannelSubscribeNum> *channel_subscribe_nums) {
-  std::lock_guard<std::mutex> guard(pubsub_channels_mu_);
+  pthread_rwlock_rdlock(&pubsub_rwlock_);
   for (const auto &chan : channels) {
+    size_t subscribe_num = 0;
     auto iter = pubsub_channels_.find(chan);
     if (iter != pubsub_channels_.end()) {
-      channel_subscribe_nums->emplace_back(ChannelSubscribeNum{iter->first, iter->second.size()});
-    } else {
-      channel_subscribe_nums->emplace_back(ChannelSubscribeNum{chan, 0});
+      for (const auto &worker_iter : iter->second) {
+        subscribe_num += worker_iter.second;
+      }
     }
+    channel_subscribe_nums->emplace_back(ChannelSubscribeNum{chan, subscribe_num});
   }
+  pthread_rwlock_unlock(&pubsub_rwlock_);
 }
 
 void Server::PSubscribeChannel(const std::string &pattern, Redis::Connection *conn) {
-  std::lock_guard<std::mutex> guard(pubsub_channels_mu_);
-  auto conn_ctx = new ConnContext(conn->Owner(), conn->GetFD());
-  conn_ctxs_[conn_ctx] = true;
-  auto iter = pubsub_patterns_.find(pattern);
-  if (iter == pubsub_patterns_.end()) {
-    std::list<ConnContext *> conn_ctxs;
-    conn_ctxs.emplace_back(conn_ctx);
-    pubsub_patterns_.insert(std::pair<std::string, std::list<ConnContext *>>(pattern, conn_ctxs));
-  } else {
-    iter->second.emplace_back(conn_ctx);
-  }
+  conn->Owner()->PSubscribeChannel(pattern, conn);
+  pthread_rwlock_wrlock(&pubsub_rwlock_);
+  pubsub_patterns_[patternPrefix(pattern)][pattern][conn->Owner()]++;
+  pthread_rwlock_unlock(&pubsub_rwlock_);
 }
 
 void Server::PUnSubscribeChannel(const std::string &pattern, Redis::Connection *conn) {
-  std::lock_guard<std::mutex> guard(pubsub_channels_mu_);
-  auto iter = pubsub_patterns_.find(pattern);
-  if (iter == pubsub_patterns_.end()) {
-    return;
-  }
-  for (const auto &conn_ctx : iter->second) {
-    if (conn->GetFD() == conn_ctx->fd && conn->Owner() == conn_ctx->owner) {
-      delConnContext(conn_ctx);
-      iter->second.remove(conn_ctx);
-      if (iter->second.empty()) {
-        pubsub_patterns_.erase(iter);
+  if (!conn->Owner()->PUnSubscribeChannel(pattern, conn)) return;
+  pthread_rwlock_wrlock(&pubsub_rwlock_);
+  auto prefix_iter = pubsub_patterns_.find(patternPrefix(pattern));
+  if (prefix_iter != pubsub_patterns_.end()) {
+    auto iter = prefix_iter->second.find(pattern);
+    if (iter != prefix_iter->second.end()) {
+      auto worker_iter = iter->second.find(conn->Owner());
+      if (worker_iter != iter->second.end() && --worker_iter->second <= 0) {
+        iter->second.erase(worker_iter);
+        if (iter->second.empty()) prefix_iter->second.erase(iter);
+        if (prefix_iter->second.empty()) pubsub_patterns_.erase(prefix_iter);
       }
-      break;
     }
   }
+  pthread_rwlock_unlock(&pubsub_rwlock_);
 }
 
-void Server::AddBlockingKey(const std::string &key, Redis::Connection *conn) {
-  std::lock_guard<std::mutex> guard(blocking_keys_mu_);
-  auto iter = blocking_keys_.find(key);
-  auto conn_ctx = new ConnContext(conn->Owner(), conn->GetFD());
-  conn_ctxs_[conn_ctx] = true;
-  if (iter == blocking_keys_.end()) {
-    std::list<ConnContext *> conn_ctxs;
-    conn_ctxs.emplace_back(conn_ctx);
-    blocking_keys_.insert(std::pair<std::string, std::list<ConnContext *>>(key, conn_ctxs));
-  } else {
-    iter->second.emplace_back(conn_ctx);
+int Server::GetPubSubPatternSize() {
+  int size = 0;
+  pthread_rwlock_rdlock(&pubsub_rwlock_);
+  for (const auto &iter : pubsub_patterns_) {
+    size += static_cast<int>(iter.second.size());
   }
+  pthread_rwlock_unlock(&pubsub_rwlock_);
+  return size;
 }
 
-void Server::UnBlockingKey(const std::string &key, Redis::Connection *conn) {
-  std::lock_guard<std::mutex> guard(blocking_keys_mu_);
-  auto iter = blocking_keys_.find(key);
-  if (iter == blocking_keys_.end()) {
-    return;
-  }
-  for (const auto &conn_ctx : iter->second) {
-    if (conn->GetFD() == conn_ctx->fd && conn->Owner() == conn_ctx->owner) {
-      delConnContext(conn_ctx);
-      iter->second.remove(conn_ctx);
-      if (iter->second.empty()) {
-        blocking_keys_.erase(iter);
-      }
-      break;
+void Server::AddBlockingKey(const std::string &ns_key, Redis::Connection *conn) {
+  conn->Owner()->AddBlockingKey(ns_key, conn);
+  pthread_rwlock_wrlock(&blocking_keys_rwlock_);
+  blocking_keys_[ns_key][conn->Owner()]++;
+  pthread_rwlock_unlock(&blocking_keys_rwlock_);
+  // the pusher checks the number after its write, and the blocked connection retries
+  // after it is counted, so either of them would see the pushed element
+  blocking_keys_num_++;
+}
+
+void Server::UnBlockingKey(const std::string &ns_key, Redis::Connection *conn) {
+  if (!conn->Owner()->UnBlockingKey(ns_key, conn)) return;
+  pthread_rwlock_wrlock(&blocking_keys_rwlock_);
+  auto iter = blocking_keys_.find(ns_key);
+  if (iter != blocking_keys_.end()) {
+    auto worker_iter = iter->second.find(conn->Owner());
+    if (worker_iter != iter->second.end() && --worker_iter->second <= 0) {
+      iter->second.erase(worker_iter);
+      if (iter->second.empty()) blocking_keys_.erase(iter);
     }
   }
+  pthread_rwlock_unlock(&blocking_keys_rwlock_);
+  blocking_keys_num_--;
 }
 
-Status Server::WakeupBlockingConns(const std::string &key, size_t n_conns) {
-  std::lock_guard<std::mutex> guard(blocking_keys_mu_);
-  auto iter = blocking_keys_.find(key);
-  if (iter == blocking_keys_.end() || iter->second.empty()) {
-    return Status(Status::NotOK);
+void Server::WakeupBlockingConns(const std::string &ns, const std::string &key, size_t n_elems) {
+  if (blocking_keys_num_ == 0 || n_elems == 0) return;
+  // the pushed elements aren't visible to the others until the transaction is committed
+  if (storage_->InTxn()) {
+    storage_->RunAfterCommit([this, ns, key, n_elems] { WakeupBlockingConns(ns, key, n_elems); });
+    return;
   }
-  while (n_conns-- && !iter->second.empty()) {
-    auto conn_ctx = iter->second.front();
-    conn_ctx->owner->EnableWriteEvent(conn_ctx->fd);
-    delConnContext(conn_ctx);
-    iter->second.pop_front();
+  std::string ns_key;
+  ComposeNamespaceKey(ns, key, &ns_key);
+  std::vector<std::pair<Worker *, size_t>> workers;
+  pthread_rwlock_rdlock(&blocking_keys_rwlock_);
+  auto iter = blocking_keys_.find(ns_key);
+  if (iter != blocking_keys_.end()) {
+    for (const auto &worker_iter : iter->second) {
+      workers.emplace_back(worker_iter.first, std::min(n_elems, static_cast<size_t>(worker_iter.second)));
+    }
+  }
+  pthread_rwlock_unlock(&blocking_keys_rwlock_);
+  for (const auto &worker : workers) {
+    worker.first->WakeupBlockingConns(ns_key, worker.second);
   }
-  return Status::OK();
 }
 
-void Server::delConnContext(ConnContext *c) {
-  auto conn_ctx_iter = conn_ctxs_.find(c);
-  if (conn_ctx_iter != conn_ctxs_.end()) {
-    delete conn_ctx_iter->first;
-    conn_ctxs_.erase(conn_ctx_iter);
-  }
+void Server::ScriptSet(const std::string &sha, const std::string &body) {
+  std::lock_guard<std::mutex> guard(scripts_mu_);
+  scripts_[sha] = body;
+}
+
+bool Server::ScriptGet(const std::string &sha, std::string *body) {
+  std::lock_guard<std::mutex> guard(scripts_mu_);
+  auto iter = scripts_.find(sha);
+  if (iter == scripts_.end()) return false;
+  if (body) *body = iter->second;
+  return true;
+}
+
+void Server::ScriptFlush() {
+  std::lock_guard<std::mutex> guard(scripts_mu_);
+  scripts_.clear();
+  scripts_generation_.fetch_add(1);
 }
 
 int Server::IncrClientNum() {
@@ -404,6 +560,63 @@ std::atomic<uint64_t> *Server::GetClientID() {
   return &client_id_;
 }
 
+void Server::activeExpireCycle() {
+  uint64_t max_deleted = static_cast<uint64_t>(config_->active_expire_keys_per_sec);
+  // the slaves would receive the deletes of the expired keys from the master
+  if (max_deleted == 0 || IsSlave() || is_loading_ || storage_->IsWriteStopped()) {
+    active_expired_keys_per_sec_ = 0;
+    return;
+  }
+  if (!storage_->IncrDBRefs().IsOK()) return;
+  uint64_t n_deleted = 0;
+  Redis::Database db(storage_);
+  auto s = db.ExpireKeys(&expire_cursor_, max_deleted * kActiveExpireScanFactor, max_deleted, &n_deleted);
+  storage_->DecrDBRefs();
+  if (!s.ok()) {
+    LOG(WARNING) << "[server] Failed to delete the expired keys, err: " << s.ToString();
+  }
+  active_expired_keys_per_sec_ = n_deleted;
+  active_expired_keys_.fetch_add(n_deleted);
+}
+
+void Server::compactionCheckCycle() {
+  if (is_loading_) return;
+  auto t = std::time(nullptr);
+  auto now = std::localtime(&t);
+  if (!config_->IsCompactionCheckerTime(now->tm_hour)) return;
+  // the checker gives way to the requests during the traffic peak
+  if (io_peak_) return;
+  Status s = AsyncPickCompactionFiles();
+  if (!s.IsOK()) {
+    LOG(INFO) << "[server] Skip the compaction checker, reason: " << s.Msg();
+  }
+}
+
+void Server::ioRateLimitCycle() {
+  uint64_t total_calls = stats_.GetTotalCalls();
+  instantaneous_qps_ = total_calls - last_total_calls_;
+  last_total_calls_ = total_calls;
+  bool io_peak = false;
+  auto peak_qps = static_cast<uint64_t>(config_->io_rate_limit_peak_qps);
+  if (peak_qps > 0 && instantaneous_qps_ > peak_qps && !is_loading_ && storage_->IncrDBRefs().IsOK()) {
+    // the compactions shouldn't be slowed down if they fall behind, or the writes would be stalled
+    io_peak = !CompactionChecker(storage_).IsCompactionBehind();
+    storage_->DecrDBRefs();
+  }
+  if (io_peak == io_peak_) return;
+  io_peak_ = io_peak;
+  AdjustIORateLimit();
+  LOG(INFO) << "[server] " << (io_peak ? "Lower" : "Restore") << " the io rate limit, the qps was "
+            << instantaneous_qps_;
+}
+
+void Server::AdjustIORateLimit() {
+  uint64_t max_io_mb = config_->max_io_mb;
+  // 0 is no limit, so it's never lowered
+  if (io_peak_ && max_io_mb > 0) max_io_mb = std::max<uint64_t>(max_io_mb / 2, 1);
+  storage_->SetIORateLimit(max_io_mb);
+}
+
 void Server::cron() {
   uint64_t counter = 0;
   while (!stop_) {
@@ -419,10 +632,19 @@ void Server::cron() {
         Status s = AsyncBgsaveDB();
         LOG(INFO) << "[server] Schedule to bgsave the db, result: " << s.Msg();
       }
+      storage_->PurgeIdleCheckpoints(kCheckpointMaxIdleSeconds);
     }
     // check every minutes
     if (counter != 0 && counter % 600 == 0) {
       storage_->PurgeOldBackups(config_->max_backup_to_keep, config_->max_backup_keep_hours);
+      compactionCheckCycle();
+    }
+    // reclaim the subkeys of the deleted huge keys every second
+    if (counter % 10 == 0) {
+      reclaimed_ranges_per_sec_ = storage_->ReclaimRanges(kMaxReclaimRangesPerSecond);
+      storage_->GetScanIteratorCache()->PurgeIdle(kScanIteratorMaxIdleSeconds);
+      activeExpireCycle();
+      ioRateLimitCycle();
     }
     cleanupExitedSlaves();
     counter++;
@@ -430,6 +652,34 @@ void Server::cron() {
   }
 }
 
+void Server::getTableBlocksSize(rocksdb::ColumnFamilyHandle *cf_handle, TableBlocksSize *size) {
+  // GetPropertiesOfAllTables reads the properties block of every sst file which isn't opened,
+  // so it's only called after the flushes, compactions or ingestions change the sst files
+  rocksdb::DB *db = storage_->GetDB();
+  uint64_t super_version = 0, sst_files_size = 0;
+  db->GetIntProperty(cf_handle, "rocksdb.current-super-version-number", &super_version);
+  db->GetIntProperty(cf_handle, "rocksdb.total-sst-files-size", &sst_files_size);
+  std::lock_guard<std::mutex> guard(table_blocks_sizes_mu_);
+  auto &cached = table_blocks_sizes_[cf_handle->GetName()];
+  if (cached.super_version != super_version || cached.sst_files_size != sst_files_size) {
+    cached = TableBlocksSize();
+    cached.super_version = super_version;
+    cached.sst_files_size = sst_files_size;
+    rocksdb::TablePropertiesCollection props;
+    if (db->GetPropertiesOfAllTables(cf_handle, &props).ok()) {
+      for (const auto &iter : props) {
+        cached.index_size += iter.second->index_size;
+        cached.filter_size += iter.second->filter_size;
+        cached.top_level_index_size += iter.second->top_level_index_size;
+      }
+    } else {
+      // read them again next time
+      cached.super_version = 0;
+    }
+  }
+  *size = cached;
+}
+
 void Server::GetRocksDBInfo(std::string *info) {
   std::ostringstream string_stream;
   rocksdb::DB *db = storage_->GetDB();
@@ -462,6 +712,21 @@ void Server::GetRocksDBInfo(std::string *info) {
     db->GetIntProperty(cf_handle, "rocksdb.estimate-table-readers-mem", &index_and_filter_cache_usage);
     string_stream << "index_and_filter_cache_usage:[" << cf_handle->GetName() << "]:" << index_and_filter_cache_usage
                   << "\r\n";
+    // the sizes of the index and filter blocks of the sst files, which is the memory taken by them
+    // once they are all cached, and only the top level index is loaded for the partitioned index
+    TableBlocksSize size;
+    getTableBlocksSize(cf_handle, &size);
+    string_stream << "index_blocks_size[" << cf_handle->GetName() << "]:" << size.index_size << "\r\n";
+    string_stream << "filter_blocks_size[" << cf_handle->GetName() << "]:" << size.filter_size << "\r\n";
+    string_stream << "top_level_index_size[" << cf_handle->GetName() << "]:" << size.top_level_index_size << "\r\n";
+  }
+  // the usage of the column families above is the usage of their cache, so the
+  // column families sharing the same cache have the same usage
+  for (const auto &cache : storage_->GetBlockCaches()) {
+    string_stream << "block_cache_capacity[" << cache.first << "]:" << cache.second->GetCapacity() << "\r\n";
+    string_stream << "block_cache_total_usage[" << cache.first << "]:" << cache.second->GetUsage() << "\r\n";
+    string_stream << "block_cache_total_pinned_usage[" << cache.first << "]:"
+                  << cache.second->GetPinnedUsage() << "\r\n";
   }
   string_stream << "all_mem_tables:" << memtable_sizes << "\r\n";
   string_stream << "cur_mem_tables:" << cur_memtable_sizes << "\r\n";
@@ -476,6 +741,34 @@ void Server::GetRocksDBInfo(std::string *info) {
   string_stream << "num_background_errors:" << num_backgroud_errors << "\r\n";
   string_stream << "flush_count:" << storage_->GetFlushCount()<< "\r\n";
   string_stream << "compaction_count:" << storage_->GetCompactionCount()<< "\r\n";
+  string_stream << "compaction_checker_files:" << compaction_checker_files_ << "\r\n";
+  string_stream << "io_rate_limit_lowered:" << (io_peak_ ? 1 : 0) << "\r\n";
+  string_stream << "write_stopped_column_families:" << storage_->GetWriteStoppedCFs() << "\r\n";
+  string_stream << "write_delayed_column_families:" << storage_->GetWriteDelayedCFs() << "\r\n";
+  auto stats = db->GetDBOptions().statistics;
+  if (stats) {
+    // writes done by other are the ones merged into a write group led by another writer
+    string_stream << "write_done_by_self:" << stats->getTickerCount(rocksdb::WRITE_DONE_BY_SELF) << "\r\n";
+    string_stream << "write_done_by_other:" << stats->getTickerCount(rocksdb::WRITE_DONE_BY_OTHER) << "\r\n";
+    string_stream << "write_with_wal:" << stats->getTickerCount(rocksdb::WRITE_WITH_WAL) << "\r\n";
+    string_stream << "wal_bytes:" << stats->getTickerCount(rocksdb::WAL_FILE_BYTES) << "\r\n";
+    string_stream << "wal_synced:" << stats->getTickerCount(rocksdb::WAL_FILE_SYNCED) << "\r\n";
+    // the tickers are counted by the db, not by the column family
+    auto hit_ratio = [&stats](rocksdb::Tickers hit, rocksdb::Tickers miss) {
+      uint64_t hits = stats->getTickerCount(hit), total = hits + stats->getTickerCount(miss);
+      return total == 0 ? 0 : static_cast<double>(hits) / total;
+    };
+    string_stream << "block_cache_hit_ratio:"
+                  << hit_ratio(rocksdb::BLOCK_CACHE_HIT, rocksdb::BLOCK_CACHE_MISS) << "\r\n";
+    string_stream << "block_cache_index_hit_ratio:"
+                  << hit_ratio(rocksdb::BLOCK_CACHE_INDEX_HIT, rocksdb::BLOCK_CACHE_INDEX_MISS) << "\r\n";
+    string_stream << "block_cache_filter_hit_ratio:"
+                  << hit_ratio(rocksdb::BLOCK_CACHE_FILTER_HIT, rocksdb::BLOCK_CACHE_FILTER_MISS) << "\r\n";
+    string_stream << "block_cache_data_hit_ratio:"
+                  << hit_ratio(rocksdb::BLOCK_CACHE_DATA_HIT, rocksdb::BLOCK_CACHE_DATA_MISS) << "\r\n";
+    string_stream << "block_cache_compressed_hit_ratio:"
+                  << hit_ratio(rocksdb::BLOCK_CACHE_COMPRESSED_HIT, rocksdb::BLOCK_CACHE_COMPRESSED_MISS) << "\r\n";
+  }
   string_stream << "is_bgsaving:" << (db_bgsave_ ? "yes" : "no") << "\r\n";
   string_stream << "is_compacting:" << (db_compacting_ ? "yes" : "no") << "\r\n";
   *info = string_stream.str();
@@ -514,6 +807,7 @@ void Server::GetClientsInfo(std::string *info) {
   string_stream << "# Clients\r\n";
   string_stream << "connected_clients:" << connected_clients_ << "\r\n";
   string_stream << "monitor_clients:" << monitor_clients_ << "\r\n";
+  string_stream << "monitor_dropped_records:" << monitor_feeder_.GetDropped() << "\r\n";
   *info = string_stream.str();
 }
 
@@ -525,6 +819,40 @@ void Server::GetMemoryInfo(std::string *info) {
   string_stream << "# Memory\r\n";
   string_stream << "used_memory_rss:" << rss <<"\r\n";
   string_stream << "used_memory_human:" << buf <<"\r\n";
+
+  uint64_t allocated, active, resident;
+  Stats::GetAllocatorStats(&allocated, &active, &resident);
+  string_stream << "allocator_allocated:" << allocated << "\r\n";
+  string_stream << "allocator_active:" << active << "\r\n";
+  string_stream << "allocator_resident:" << resident << "\r\n";
+  string_stream << "allocator_frag_ratio:" << std::fixed << std::setprecision(2)
+                << (allocated > 0 ? static_cast<double>(active) / allocated : 0) << "\r\n";
+
+  // the memory of the rocksdb is allocated by itself, and the pinned blocks of the
+  // block caches are held by the iterators and the table readers
+  rocksdb::DB *db = storage_->GetDB();
+  uint64_t memtables = 0, table_readers = 0;
+  db->GetAggregatedIntProperty("rocksdb.cur-size-all-mem-tables", &memtables);
+  db->GetAggregatedIntProperty("rocksdb.estimate-table-readers-mem", &table_readers);
+  string_stream << "used_memory_memtables:" << memtables << "\r\n";
+  string_stream << "used_memory_table_readers:" << table_readers << "\r\n";
+  for (const auto &cache : storage_->GetBlockCaches()) {
+    string_stream << "used_memory_" << cache.first << "_block_cache:" << cache.second->GetUsage() << "\r\n";
+    string_stream << "used_memory_" << cache.first << "_block_cache_pinned:"
+                  << cache.second->GetPinnedUsage() << "\r\n";
+  }
+
+  // the messages of the pubsub and the monitor are counted in the output buffers once delivered
+  size_t clients_input = 0, clients_output = 0, max_output = 0;
+  for (const auto &t : worker_threads_) {
+    t->GetWorker()->GetClientsBufferSize(&clients_input, &clients_output, &max_output);
+  }
+  string_stream << "used_memory_clients_input:" << clients_input << "\r\n";
+  string_stream << "used_memory_clients_output:" << clients_output << "\r\n";
+  string_stream << "client_max_output_buffer:" << max_output << "\r\n";
+  string_stream << "used_memory_slowlog:" << slow_log_.MemoryUsage() << "\r\n";
+  string_stream << "used_memory_perflog:" << perf_log_.MemoryUsage() << "\r\n";
+  string_stream << "used_memory_tracelog:" << trace_log_.MemoryUsage() << "\r\n";
   *info = string_stream.str();
 }
 
@@ -546,6 +874,11 @@ void Server::GetReplicationInfo(std::string *info) {
     string_stream << "slave_priority:" << config_->slave_priority << "\r\n";
   }
 
+  auto replid = storage_->GetReplicationID();
+  string_stream << "master_replid:" << replid.id << "\r\n";
+  string_stream << "master_replid2:" << replid.prev_id << "\r\n";
+  string_stream << "second_repl_offset:" << (replid.prev_id.empty() ? 0 : replid.prev_id_last_seq + 1) << "\r\n";
+
   int idx = 0;
   rocksdb::SequenceNumber latest_seq = storage_->LatestSeq();
   slave_threads_mu_.lock();
@@ -556,7 +889,13 @@ void Server::GetReplicationInfo(std::string *info) {
     string_stream << "ip=" << slave->GetConn()->GetIP()
                   << ",port=" << slave->GetConn()->GetListeningPort()
                   << ",offset=" << slave->GetCurrentReplSeq()
-                  << ",lag=" << latest_seq - slave->GetCurrentReplSeq() << "\r\n";
+                  << ",lag=" << latest_seq - slave->GetCurrentReplSeq();
+    // the acked offset is the seq applied by the slave, so the ack lag is the true lag
+    if (slave->IsAckEnabled()) {
+      string_stream << ",ack_offset=" << slave->GetAckedReplSeq()
+                    << ",ack_lag=" << latest_seq - std::min(latest_seq, slave->GetAckedReplSeq());
+    }
+    string_stream << "\r\n";
     ++idx;
   }
   slave_threads_mu_.unlock();
@@ -568,13 +907,48 @@ void Server::GetStatsInfo(std::string *info) {
   std::ostringstream string_stream;
   string_stream << "# Stats\r\n";
   string_stream << "total_connections_received:" << total_clients_ <<"\r\n";
-  string_stream << "total_commands_processed:" << stats_.total_calls <<"\r\n";
-  string_stream << "total_net_input_bytes:" << stats_.in_bytes <<"\r\n";
-  string_stream << "total_net_output_bytes:" << stats_.out_bytes <<"\r\n";
+  string_stream << "total_commands_processed:" << stats_.GetTotalCalls() <<"\r\n";
+  string_stream << "total_net_input_bytes:" << stats_.GetInbondBytes() <<"\r\n";
+  string_stream << "total_net_output_bytes:" << stats_.GetOutbondBytes() <<"\r\n";
   string_stream << "sync_full:" << stats_.fullsync_counter <<"\r\n";
   string_stream << "sync_partial_ok:" << stats_.psync_ok_counter <<"\r\n";
   string_stream << "sync_partial_err:" << stats_.psync_err_counter <<"\r\n";
+  TaskRunnerStats task_stats;
+  task_runner_->GetStats(&task_stats);
+  string_stream << "background_tasks_queued:" << task_stats.queued_tasks <<"\r\n";
+  string_stream << "background_tasks_executed:" << task_stats.executed_tasks <<"\r\n";
+  string_stream << "background_tasks_avg_wait_us:" << task_stats.avg_wait_us <<"\r\n";
+  string_stream << "background_tasks_max_wait_us:" << task_stats.max_wait_us <<"\r\n";
+  if (slow_cmd_runner_) {
+    slow_cmd_runner_->GetStats(&task_stats);
+    string_stream << "slow_commands_queued:" << task_stats.queued_tasks <<"\r\n";
+    string_stream << "slow_commands_executed:" << task_stats.executed_tasks <<"\r\n";
+    string_stream << "slow_commands_stolen:" << task_stats.stolen_tasks <<"\r\n";
+    string_stream << "slow_commands_rejected:" << task_stats.rejected_tasks <<"\r\n";
+    string_stream << "slow_commands_avg_wait_us:" << task_stats.avg_wait_us <<"\r\n";
+    string_stream << "slow_commands_max_wait_us:" << task_stats.max_wait_us <<"\r\n";
+  }
+  if (io_read_runner_) {
+    io_read_runner_->GetStats(&task_stats);
+    string_stream << "io_read_commands_queued:" << task_stats.queued_tasks <<"\r\n";
+    string_stream << "io_read_commands_executed:" << task_stats.executed_tasks <<"\r\n";
+    string_stream << "io_read_commands_rejected:" << task_stats.rejected_tasks <<"\r\n";
+    string_stream << "io_read_commands_avg_wait_us:" << task_stats.avg_wait_us <<"\r\n";
+    string_stream << "io_read_commands_max_wait_us:" << task_stats.max_wait_us <<"\r\n";
+  }
+  string_stream << "write_stall_held_commands:" << stats_.write_stall_held_counter <<"\r\n";
+  string_stream << "write_stall_rejected_commands:" << stats_.write_stall_rejected_counter <<"\r\n";
+  string_stream << "repl_ack_timeouts:" << stats_.repl_ack_timeout_counter <<"\r\n";
   string_stream << "pubsub_channels:" << pubsub_channels_.size() <<"\r\n";
+  auto lock_mgr = storage_->GetLockManager();
+  string_stream << "key_locks_acquired:" << lock_mgr->GetAcquiredCount() <<"\r\n";
+  string_stream << "key_locks_contended:" << lock_mgr->GetContendedCount() <<"\r\n";
+  string_stream << "key_multi_locks:" << lock_mgr->GetMultiLockCount() <<"\r\n";
+  auto metadata_cache = storage_->GetMetadataCache();
+  string_stream << "metadata_cache_capacity:" << metadata_cache->GetCapacity() <<"\r\n";
+  string_stream << "metadata_cache_usage:" << metadata_cache->GetUsage() <<"\r\n";
+  string_stream << "metadata_cache_hits:" << metadata_cache->GetHits() <<"\r\n";
+  string_stream << "metadata_cache_misses:" << metadata_cache->GetMisses() <<"\r\n";
   *info = string_stream.str();
 }
 
@@ -582,11 +956,13 @@ void Server::GetCommandsStatsInfo(std::string *info) {
   std::ostringstream string_stream;
   string_stream << "# Commandstats\r\n";
 
-  for (const auto &cmd_stat : stats_.commands_stats) {
-    auto calls = cmd_stat.second.calls.load();
-    auto latency = cmd_stat.second.latency.load();
+  std::vector<uint64_t> commands_calls, commands_latency;
+  stats_.GetCommandStats(&commands_calls, &commands_latency);
+  for (size_t i = 0; i < commands_calls.size(); i++) {
+    auto calls = commands_calls[i];
+    auto latency = commands_latency[i];
     if (calls == 0) continue;
-    string_stream << "cmdstat_" << cmd_stat.first << ":calls=" << calls
+    string_stream << "cmdstat_" << Redis::GetCommandName(static_cast<int>(i)) << ":calls=" << calls
                   << ",usec=" << latency << ",usec_per_call="
                   << ((calls == 0) ? 0 : static_cast<float>(latency/calls))
                   << "\r\n";
@@ -594,6 +970,186 @@ void Server::GetCommandsStatsInfo(std::string *info) {
   *info = string_stream.str();
 }
 
+void Server::GetLatencyStatsInfo(std::string *info) {
+  std::ostringstream string_stream;
+  string_stream << "# Latencystats\r\n";
+
+  std::vector<uint64_t> buckets;
+  uint64_t max;
+  for (size_t i = 0; i < Redis::GetCommandNum(); i++) {
+    if (!stats_.GetLatencyHistogram(static_cast<int>(i), &buckets, &max)) continue;
+    string_stream << "latency_percentiles_usec_" << Redis::GetCommandName(static_cast<int>(i))
+                  << ":p50=" << LatencyHistogram::Percentile(buckets, 50, max)
+                  << ",p99=" << LatencyHistogram::Percentile(buckets, 99, max)
+                  << ",p99.9=" << LatencyHistogram::Percentile(buckets, 99.9, max)
+                  << ",max=" << max << "\r\n";
+  }
+  *info = string_stream.str();
+}
+
+// promMetricName replaces the characters which aren't allowed in the prometheus metric name
+static std::string promMetricName(const std::string &name) {
+  std::string metric_name = name;
+  for (auto &c : metric_name) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '_') c = '_';
+  }
+  return metric_name;
+}
+
+// the metrics are rendered from the per-thread counters and the tickers of the rocksdb, they
+// are all read without the locks of the workers, unlike the INFO which formats every section
+void Server::GetMetrics(std::string *metrics) {
+  std::ostringstream out;
+  auto header = [&out](const std::string &name, const char *type, const char *help) {
+    out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+  };
+  auto metric = [&out, &header](const std::string &name, const char *type, const char *help, double value) {
+    header(name, type, help);
+    out << name << " " << value << "\n";
+  };
+  out << std::setprecision(17);
+  metric("kvrocks_uptime_seconds", "gauge", "Seconds since the server was started", time(nullptr) - start_time_);
+  metric("kvrocks_connected_clients", "gauge", "Number of the client connections", connected_clients_);
+  metric("kvrocks_connections_received_total", "counter", "Connections accepted by the server", total_clients_);
+  metric("kvrocks_commands_processed_total", "counter", "Commands processed by the server", stats_.GetTotalCalls());
+  metric("kvrocks_net_input_bytes_total", "counter", "Bytes read from the network", stats_.GetInbondBytes());
+  metric("kvrocks_net_output_bytes_total", "counter", "Bytes written to the network", stats_.GetOutbondBytes());
+  metric("kvrocks_sync_full_total", "counter", "Full resyncs of the slaves", stats_.fullsync_counter);
+  metric("kvrocks_sync_partial_ok_total", "counter", "Accepted partial resyncs", stats_.psync_ok_counter);
+  metric("kvrocks_sync_partial_err_total", "counter", "Denied partial resyncs", stats_.psync_err_counter);
+  metric("kvrocks_write_stall_held_commands_total", "counter", "Writes held by the write stall",
+         stats_.write_stall_held_counter);
+  metric("kvrocks_write_stall_rejected_commands_total", "counter", "Writes rejected by the write stall",
+         stats_.write_stall_rejected_counter);
+  metric("kvrocks_memory_rss_bytes", "gauge", "Resident memory of the process", Stats::GetMemoryRSS());
+  uint64_t allocated, active, resident;
+  Stats::GetAllocatorStats(&allocated, &active, &resident);
+  metric("kvrocks_allocator_allocated_bytes", "gauge", "Bytes allocated by the application", allocated);
+  metric("kvrocks_allocator_resident_bytes", "gauge", "Resident bytes of the allocator", resident);
+
+  std::vector<uint64_t> calls, latency;
+  stats_.GetCommandStats(&calls, &latency);
+  header("kvrocks_command_calls_total", "counter", "Calls of the command");
+  for (size_t i = 0; i < calls.size(); i++) {
+    if (calls[i] == 0) continue;
+    out << "kvrocks_command_calls_total{cmd=\"" << Redis::GetCommandName(static_cast<int>(i)) << "\"} "
+        << calls[i] << "\n";
+  }
+  // the buckets of the histogram are merged into the powers of 4 microseconds, which are
+  // the bounds of the buckets of the latency histogram as well
+  header("kvrocks_command_duration_seconds", "histogram", "Latency of the command");
+  std::vector<uint64_t> buckets;
+  uint64_t max;
+  for (size_t i = 0; i < calls.size(); i++) {
+    if (!stats_.GetLatencyHistogram(static_cast<int>(i), &buckets, &max)) continue;
+    std::string cmd = Redis::GetCommandName(static_cast<int>(i));
+    uint64_t count = 0, le = 16;
+    for (int j = 0; j < LatencyHistogram::kBuckets; j++) {
+      while (LatencyHistogram::BucketUpperBound(j) >= le && le <= 4 * 1000 * 1000) {
+        out << "kvrocks_command_duration_seconds_bucket{cmd=\"" << cmd << "\",le=\"" << le / 1e6 << "\"} "
+            << count << "\n";
+        le *= 4;
+      }
+      count += buckets[j];
+    }
+    out << "kvrocks_command_duration_seconds_bucket{cmd=\"" << cmd << "\",le=\"+Inf\"} " << count << "\n";
+    out << "kvrocks_command_duration_seconds_sum{cmd=\"" << cmd << "\"} " << latency[i] / 1e6 << "\n";
+    out << "kvrocks_command_duration_seconds_count{cmd=\"" << cmd << "\"} " << count << "\n";
+  }
+
+  // the db might be reopened while restoring from the backup
+  if (storage_->IncrDBRefs().IsOK()) {
+    auto db = storage_->GetDB();
+    uint64_t memtables = 0, table_readers = 0;
+    db->GetAggregatedIntProperty("rocksdb.cur-size-all-mem-tables", &memtables);
+    db->GetAggregatedIntProperty("rocksdb.estimate-table-readers-mem", &table_readers);
+    metric("kvrocks_rocksdb_memtables_bytes", "gauge", "Bytes of all memtables", memtables);
+    metric("kvrocks_rocksdb_table_readers_bytes", "gauge", "Bytes of the table readers", table_readers);
+    header("kvrocks_rocksdb_block_cache_usage_bytes", "gauge", "Bytes used by the block cache");
+    for (const auto &cache : storage_->GetBlockCaches()) {
+      out << "kvrocks_rocksdb_block_cache_usage_bytes{cache=\"" << cache.first << "\"} "
+          << cache.second->GetUsage() << "\n";
+    }
+    auto stats = db->GetDBOptions().statistics;
+    if (stats) {
+      for (const auto &iter : rocksdb::TickersNameMap) {
+        auto name = "kvrocks_" + promMetricName(iter.second) + "_total";
+        metric(name, "counter", "The ticker of the rocksdb statistics", stats->getTickerCount(iter.first));
+      }
+      for (const auto &iter : rocksdb::HistogramsNameMap) {
+        rocksdb::HistogramData hist_data;
+        stats->histogramData(iter.first, &hist_data);
+        auto name = "kvrocks_" + promMetricName(iter.second);
+        header(name, "summary", "The histogram of the rocksdb statistics");
+        out << name << "{quantile=\"0.5\"} " << hist_data.median << "\n";
+        out << name << "{quantile=\"0.95\"} " << hist_data.percentile95 << "\n";
+        out << name << "{quantile=\"0.99\"} " << hist_data.percentile99 << "\n";
+        out << name << "_sum " << hist_data.sum << "\n";
+        out << name << "_count " << hist_data.count << "\n";
+      }
+    }
+    storage_->DecrDBRefs();
+  }
+  *metrics = out.str();
+}
+
+// the counters are averaged by the samples, so the read amplification of the commands could be compared
+void Server::GetPerfStatsInfo(std::string *info) {
+  std::ostringstream string_stream;
+  string_stream << "# Perfstats\r\n";
+
+  uint64_t samples;
+  std::vector<uint64_t> counters;
+  for (size_t i = 0; i < Redis::GetCommandNum(); i++) {
+    if (!perf_stats_.GetCommandStats(static_cast<int>(i), &samples, &counters)) continue;
+    string_stream << "perfstats_" << Redis::GetCommandName(static_cast<int>(i)) << ":samples=" << samples;
+    for (int j = 0; j < PerfStats::kNumCounters; j++) {
+      string_stream << "," << PerfStats::CounterName(j) << "=" << std::fixed << std::setprecision(2)
+                    << static_cast<double>(counters[j]) / samples;
+    }
+    string_stream << "\r\n";
+  }
+  *info = string_stream.str();
+}
+
+// the flushes and compactions are reported by the event listener of the rocksdb
+void Server::GetBackgroundStatsInfo(std::string *info) {
+  std::string stats_info;
+  storage_->GetBackgroundJobStats()->GetInfo(BackgroundJobStats::NowUS(), &stats_info);
+  *info = "# Backgroundstats\r\n" + stats_info;
+}
+
+// the hot keys are sampled by the hotkeys-sample-ratio, and the big keys are collected by the last DBSIZE SCAN
+void Server::GetHotKeysInfo(const std::string &ns, std::string *info) {
+  std::ostringstream string_stream;
+  string_stream << "# HotKeys\r\n";
+  std::vector<KeyCount> keys;
+  hot_keys_.GetHotKeys(ns, kHotKeysInfoCount, &keys);
+  for (size_t i = 0; i < keys.size(); i++) {
+    string_stream << "hotkey_" << i << ":key=" << keys[i].key << ",samples=" << keys[i].count << "\r\n";
+  }
+  GetLatestBigKeys(ns, kHotKeysInfoCount, &keys);
+  for (size_t i = 0; i < keys.size(); i++) {
+    string_stream << "bigkey_" << i << ":key=" << keys[i].key << ",type=" << RedisTypeNames[keys[i].type]
+                  << ",size=" << keys[i].count << "\r\n";
+  }
+  *info = string_stream.str();
+}
+
+void Server::GetNamespaceStatsInfo(const std::string &ns, std::string *info) {
+  std::ostringstream string_stream;
+  string_stream << "# NamespaceStats\r\n";
+  std::vector<std::pair<std::string, NamespaceQuota *>> quotas;
+  namespace_quotas_.GetAll(&quotas);
+  for (const auto &iter : quotas) {
+    if (ns != kDefaultNamespace && ns != iter.first) continue;
+    string_stream << "namespace_" << iter.first << ":calls=" << iter.second->GetCalls()
+                  << ",net_output_bytes=" << iter.second->GetOutBytes()
+                  << ",throttled=" << iter.second->GetThrottled() << "\r\n";
+  }
+  *info = string_stream.str();
+}
+
 void Server::GetInfo(const std::string &ns, const std::string &section, std::string *info) {
   info->clear();
   std::ostringstream string_stream;
@@ -644,6 +1200,31 @@ void Server::GetInfo(const std::string &ns, const std::string &section, std::str
     GetCommandsStatsInfo(&commands_stats_info);
     string_stream << commands_stats_info;
   }
+  if (all || section == "latencystats") {
+    std::string latency_stats_info;
+    GetLatencyStatsInfo(&latency_stats_info);
+    string_stream << latency_stats_info;
+  }
+  if (all || section == "perfstats") {
+    std::string perf_stats_info;
+    GetPerfStatsInfo(&perf_stats_info);
+    string_stream << perf_stats_info;
+  }
+  if (all || section == "backgroundstats") {
+    std::string background_stats_info;
+    GetBackgroundStatsInfo(&background_stats_info);
+    string_stream << background_stats_info;
+  }
+  if (all || section == "hotkeys") {
+    std::string hot_keys_info;
+    GetHotKeysInfo(ns, &hot_keys_info);
+    string_stream << hot_keys_info;
+  }
+  if (all || section == "namespacestats") {
+    std::string namespace_stats_info;
+    GetNamespaceStatsInfo(ns, &namespace_stats_info);
+    string_stream << namespace_stats_info;
+  }
   if (all || section == "keyspace") {
     KeyNumStats stats;
     GetLastestKeyNumStats(ns, &stats);
@@ -652,8 +1233,25 @@ void Server::GetInfo(const std::string &ns, const std::string &section, std::str
     string_stream << "# Last scan db time: " << std::asctime(std::localtime(&last_scan_time));
     string_stream << "db0:keys=" << stats.n_key << ",expires=" << stats.n_expires
                   << ",avg_ttl=" << stats.avg_ttl << ",expired=" << stats.n_expired << "\r\n";
+    KeyNumStats estimated_stats;
+    Redis::Database db(storage_, ns);
+    db.EstimateKeyNumStats(&estimated_stats);
+    string_stream << "estimated_keys:" << estimated_stats.n_key << "\r\n";
+    string_stream << "estimated_expires:" << estimated_stats.n_expires << "\r\n";
+    string_stream << "estimated_avg_ttl:" << estimated_stats.avg_ttl << "\r\n";
+    string_stream << "reclaim_pending_ranges:" << storage_->GetReclaimPendingNum() << "\r\n";
+    string_stream << "reclaimed_ranges:" << storage_->GetReclaimedNum() << "\r\n";
+    string_stream << "reclaimed_ranges_per_sec:" << reclaimed_ranges_per_sec_ << "\r\n";
+    string_stream << "active_expired_keys:" << active_expired_keys_ << "\r\n";
+    string_stream << "active_expired_keys_per_sec:" << active_expired_keys_per_sec_ << "\r\n";
     string_stream << "sequence:" << storage_->GetDB()->GetLatestSequenceNumber() << "\r\n";
     string_stream << "used_db_size:" << storage_->GetTotalSize() << "\r\n";
+    std::map<std::string, uint64_t> path_sizes;
+    storage_->GetDBPathSizes(&path_sizes);
+    for (const auto &path : config_->rocksdb_options.db_paths) {
+      string_stream << "used_db_path_size[" << path.first << "]:" << path_sizes[path.first] << "\r\n";
+      string_stream << "target_db_path_size[" << path.first << "]:" << path.second << "\r\n";
+    }
     string_stream << "max_db_size:" << config_->max_db_size * GiB << "\r\n";
     double used_percent = config_->max_db_size ?
                           storage_->GetTotalSize() * 100 / (config_->max_db_size * GiB) : 0;
@@ -731,6 +1329,35 @@ Status Server::AsyncCompactDB() {
   return task_runner_->Publish(task);
 }
 
+Status Server::AsyncPickCompactionFiles() {
+  db_mu_.lock();
+  if (db_compacting_) {
+    db_mu_.unlock();
+    return Status(Status::NotOK, "compact in-progress");
+  }
+  db_compacting_ = true;
+  db_mu_.unlock();
+
+  Task task;
+  task.arg = this;
+  task.callback = [](void *arg) {
+    auto svr = static_cast<Server*>(arg);
+    if (svr->storage_->IncrDBRefs().IsOK()) {
+      CompactionChecker checker(svr->storage_);
+      // the rocksdb's own compactions come first if they fall behind
+      if (!checker.IsCompactionBehind()) {
+        int n = checker.PickCompactionFiles(kCompactionCheckMinDeletedRatio, kCompactionCheckMaxFiles);
+        svr->compaction_checker_files_.fetch_add(n);
+      }
+      svr->storage_->DecrDBRefs();
+    }
+    svr->db_mu_.lock();
+    svr->db_compacting_ = false;
+    svr->db_mu_.unlock();
+  };
+  return task_runner_->Publish(task);
+}
+
 Status Server::AsyncBgsaveDB() {
   db_mu_.lock();
   if (db_bgsave_) {
@@ -771,25 +1398,48 @@ Status Server::AsyncScanDBSize(const std::string &ns) {
     auto svr = static_cast<Server*>(arg);
     Redis::Database db(svr->storage_, ns);
     KeyNumStats stats;
-    db.GetKeyNumStats("", &stats);
+    TopKeys big_keys(kBigKeysTopK);
+    db.GetKeyNumStats("", &stats, &big_keys);
 
     svr->db_mu_.lock();
     svr->db_scan_infos_[ns].key_num_stats = stats;
+    big_keys.GetTop(kBigKeysTopK, &svr->db_scan_infos_[ns].big_keys);
     time(&svr->db_scan_infos_[ns].last_scan_time);
     svr->db_scan_infos_[ns].is_scanning = false;
     svr->db_mu_.unlock();
   };
+  // the scan is requested by the user, and shouldn't wait for the compaction or bgsave
+  task.high_priority = true;
   return task_runner_->Publish(task);
 }
 
+Status Server::PublishSlowCommand(Task task) {
+  return slow_cmd_runner_->Publish(task);
+}
+
+Status Server::PublishIOReadCommand(Task task) {
+  return io_read_runner_->Publish(task);
+}
+
 void Server::GetLastestKeyNumStats(const std::string &ns, KeyNumStats *stats) {
+  std::lock_guard<std::mutex> guard(db_mu_);
   auto iter = db_scan_infos_.find(ns);
   if (iter != db_scan_infos_.end()) {
     *stats = iter->second.key_num_stats;
   }
 }
 
+void Server::GetLatestBigKeys(const std::string &ns, size_t n, std::vector<KeyCount> *keys) {
+  keys->clear();
+  std::lock_guard<std::mutex> guard(db_mu_);
+  auto iter = db_scan_infos_.find(ns);
+  if (iter == db_scan_infos_.end()) return;
+  const auto &big_keys = iter->second.big_keys;
+  keys->assign(big_keys.begin(), big_keys.begin() + std::min(n, big_keys.size()));
+}
+
 time_t Server::GetLastScanTime(const std::string &ns) {
+  std::lock_guard<std::mutex> guard(db_mu_);
   auto iter = db_scan_infos_.find(ns);
   if (iter != db_scan_infos_.end()) {
     return iter->second.last_scan_time;
@@ -800,8 +1450,24 @@ time_t Server::GetLastScanTime(const std::string &ns) {
 void Server::SlowlogPushEntryIfNeeded(const std::vector<std::string>* args, uint64_t duration) {
   int64_t threshold = config_->slowlog_log_slower_than;
   if (threshold < 0 || static_cast<int64_t>(duration) < threshold) return;
+  // the args are truncated like redis, so the slow commands with huge args won't eat up the memory
+  const size_t kSlowlogMaxArgc = 32, kSlowlogMaxString = 128;
   auto entry = new SlowEntry();
-  entry->args = *args;
+  size_t argc = std::min(args->size(), kSlowlogMaxArgc);
+  entry->args.reserve(argc);
+  for (size_t i = 0; i < argc; i++) {
+    if (argc != args->size() && i == argc - 1) {
+      entry->args.emplace_back("... (" + std::to_string(args->size() - argc + 1) + " more arguments)");
+      break;
+    }
+    const auto &arg = (*args)[i];
+    if (arg.size() > kSlowlogMaxString) {
+      entry->args.emplace_back(arg.substr(0, kSlowlogMaxString) + "... ("
+                                   + std::to_string(arg.size() - kSlowlogMaxString) + " more bytes)");
+    } else {
+      entry->args.emplace_back(arg);
+    }
+  }
   entry->duration = duration;
   slow_log_.PushEntry(entry);
 }
@@ -837,6 +1503,19 @@ void Server::KillClient(int64_t *killed, std::string addr, uint64_t id, bool ski
   slave_threads_mu_.unlock();
 }
 
+bool Server::FindTrackingRedirect(uint64_t id, Redis::TrackingRedirect *redirect) {
+  for (const auto &t : worker_threads_) {
+    auto worker = t->GetWorker();
+    int fd = worker->FindConnectionFD(id);
+    if (fd < 0) continue;
+    redirect->worker = worker;
+    redirect->fd = fd;
+    redirect->id = id;
+    return true;
+  }
+  return false;
+}
+
 void Server::SetReplicationRateLimit(uint64_t max_replication_mb) {
   uint64_t max_rate_per_repl_worker = 0;
   if (max_replication_mb > 0) {
@@ -2,33 +2,36 @@
 
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
+#include <pthread.h>
 
 #include <map>
 #include <list>
 #include <string>
 #include <vector>
 #include <memory>
+#include <unordered_map>
 
 #include "stats.h"
+#include "perf_stats.h"
+#include "key_stats.h"
+#include "namespace_quota.h"
 #include "storage.h"
 #include "task_runner.h"
 #include "replication.h"
 #include "redis_metadata.h"
 #include "log_collector.h"
+#include "monitor_feeder.h"
 #include "worker.h"
+#include "metrics_server.h"
 
 struct DBScanInfo {
   time_t last_scan_time = 0;
   KeyNumStats key_num_stats;
+  // the largest keys are collected by the same scan
+  std::vector<KeyCount> big_keys;
   bool is_scanning = false;
 };
 
-struct ConnContext {
-  Worker *owner;
-  int fd;
-  ConnContext(Worker *w, int fd) : owner(w), fd(fd) {}
-};
-
 typedef struct {
   std::string channel;
   size_t subscribe_num;
@@ -53,6 +56,17 @@ class Server {
   void DisconnectSlaves();
   void cleanupExitedSlaves();
   bool IsSlave() { return !master_host_.empty(); }
+  // SlavesReachedSeq returns the number of the slaves which have acked the seq(or are sent the
+  // seq if they never ack), the waiters poll it with the ack waiters counted
+  int SlavesReachedSeq(rocksdb::SequenceNumber seq);
+  // IsSeqAcked returns true if at least n_slaves alive slaves have acked the seq, it's false while
+  // fewer slaves are alive, so the write isn't taken as acked without the slaves
+  bool IsSeqAcked(rocksdb::SequenceNumber seq, int n_slaves);
+  // the feeders receive the acks of the slaves more frequently while someone is waiting
+  void IncrAckWaiters() { ack_waiters_.fetch_add(1); }
+  void DecrAckWaiters() { ack_waiters_.fetch_sub(1); }
+  bool HasAckWaiters() { return ack_waiters_.load() > 0; }
+  WALTailer *GetWALTailer() { return wal_tailer_.get(); }
   void FeedMonitorConns(Redis::Connection *conn, const std::vector<std::string> &tokens);
 
   int PublishMessage(const std::string &channel, const std::string &msg);
@@ -63,14 +77,23 @@ class Server {
                                std::vector<ChannelSubscribeNum> *channel_subscribe_nums);
   void PSubscribeChannel(const std::string &pattern, Redis::Connection *conn);
   void PUnSubscribeChannel(const std::string &pattern, Redis::Connection *conn);
-  int GetPubSubPatternSize() { return pubsub_patterns_.size(); }
+  int GetPubSubPatternSize();
 
-  void AddBlockingKey(const std::string &key, Redis::Connection *conn);
-  void UnBlockingKey(const std::string &key, Redis::Connection *conn);
-  Status WakeupBlockingConns(const std::string &key, size_t n_conns);
+  // the blocking keys are composed with the namespace
+  void AddBlockingKey(const std::string &ns_key, Redis::Connection *conn);
+  void UnBlockingKey(const std::string &ns_key, Redis::Connection *conn);
+  // WakeupBlockingConns is called after n elements are pushed into the key, it returns
+  // without any lock if no connection is blocking
+  void WakeupBlockingConns(const std::string &ns, const std::string &key, size_t n_elems);
+
+  // the scripts are cached by the sha1 of the body, and shared by all workers,
+  // each worker compiles the script into its own lua state at the first call
+  void ScriptSet(const std::string &sha, const std::string &body);
+  bool ScriptGet(const std::string &sha, std::string *body);
+  void ScriptFlush();
+  // the generation is bumped by SCRIPT FLUSH, the workers recreate their lua states once it's changed
+  uint64_t ScriptsGeneration() { return scripts_generation_.load(); }
 
-  std::string GetLastRandomKeyCursor() { return last_random_key_cursor_; }
-  void SetLastRandomKeyCursor(const std::string &cursor) { last_random_key_cursor_ = cursor; }
 
   void GetStatsInfo(std::string *info);
   void GetServerInfo(std::string *info);
@@ -79,14 +102,31 @@ class Server {
   void GetClientsInfo(std::string *info);
   void GetReplicationInfo(std::string *info);
   void GetCommandsStatsInfo(std::string *info);
+  void GetLatencyStatsInfo(std::string *info);
+  void GetPerfStatsInfo(std::string *info);
+  void GetBackgroundStatsInfo(std::string *info);
+  void GetHotKeysInfo(const std::string &ns, std::string *info);
+  // GetNamespaceStatsInfo returns the stats of all namespaces to the admin, or only its own ones
+  void GetNamespaceStatsInfo(const std::string &ns, std::string *info);
   void GetInfo(const std::string &ns, const std::string &section, std::string *info);
   std::string GetRocksDBStatsJson();
+  // GetMetrics renders the metrics in the prometheus text format for the metrics server
+  void GetMetrics(std::string *metrics);
 
   void ReclaimOldDBPtr();
   Status AsyncCompactDB();
+  // AsyncPickCompactionFiles compacts the ranges of the files full of the tombstones in the background
+  Status AsyncPickCompactionFiles();
   Status AsyncBgsaveDB();
   Status AsyncScanDBSize(const std::string &ns);
+  // the slow commands are executed by the command executors if enabled
+  bool IsSlowCommandExecutorEnabled() { return slow_cmd_runner_ != nullptr; }
+  Status PublishSlowCommand(Task task);
+  // the read commands which miss the block cache are executed by the io read threads if enabled
+  bool IsIOReadExecutorEnabled() { return io_read_runner_ != nullptr; }
+  Status PublishIOReadCommand(Task task);
   void GetLastestKeyNumStats(const std::string &ns, KeyNumStats *stats);
+  void GetLatestBigKeys(const std::string &ns, size_t n, std::vector<KeyCount> *keys);
   time_t GetLastScanTime(const std::string &ns);
 
   int DecrClientNum();
@@ -98,9 +138,17 @@ class Server {
   std::string GetClientsStr();
   std::atomic<uint64_t> *GetClientID();
   void KillClient(int64_t *killed, std::string addr, uint64_t id, bool skipme, Redis::Connection *conn);
+  // FindTrackingRedirect returns false if the client of the id isn't found
+  bool FindTrackingRedirect(uint64_t id, Redis::TrackingRedirect *redirect);
   void SetReplicationRateLimit(uint64_t max_replication_mb);
+  // AdjustIORateLimit applies the max-io-mb, which is halved during the traffic peak
+  void AdjustIORateLimit();
 
   LogCollector<PerfEntry> *GetPerfLog() { return &perf_log_; }
+  LogCollector<TraceEntry> *GetTraceLog() { return &trace_log_; }
+  PerfStats *GetPerfStats() { return &perf_stats_; }
+  HotKeys *GetHotKeys() { return &hot_keys_; }
+  NamespaceQuotas *GetNamespaceQuotas() { return &namespace_quotas_; }
   LogCollector<SlowEntry> *GetSlowLog() { return &slow_log_; }
   void SlowlogPushEntryIfNeeded(const std::vector<std::string>* args, uint64_t duration);
 
@@ -109,7 +157,10 @@ class Server {
 
  private:
   void cron();
-  void delConnContext(ConnContext *c);
+  void activeExpireCycle();
+  void compactionCheckCycle();
+  void ioRateLimitCycle();
+  void countSlavesReachedSeq(rocksdb::SequenceNumber seq, int *reached, int *alive);
 
   bool stop_ = false;
   bool is_loading_ = false;
@@ -118,7 +169,6 @@ class Server {
   std::string master_host_;
   uint32_t master_port_ = 0;
   Config *config_ = nullptr;
-  std::string last_random_key_cursor_;
 
   // client counters
   std::atomic<uint64_t> client_id_{1};
@@ -126,10 +176,21 @@ class Server {
   std::atomic<int> monitor_clients_{0};
   std::atomic<uint64_t> total_clients_{0};
   std::atomic<int> excuting_command_num_{0};
+  std::atomic<uint64_t> reclaimed_ranges_per_sec_{0};
+  // the cursor of the expire cycle is only accessed by the cron thread
+  std::string expire_cursor_;
+  std::atomic<uint64_t> active_expired_keys_{0};
+  std::atomic<uint64_t> active_expired_keys_per_sec_{0};
+  // the qps is only computed by the cron thread
+  uint64_t last_total_calls_ = 0;
+  uint64_t instantaneous_qps_ = 0;
+  std::atomic<bool> io_peak_{false};
+  std::atomic<uint64_t> compaction_checker_files_{0};
 
   // slave
   std::mutex slave_threads_mu_;
   std::list<FeedSlaveThread *> slave_threads_;
+  std::atomic<int> ack_waiters_{0};
 
   std::mutex db_mu_;
   bool db_compacting_ = false;
@@ -138,17 +199,52 @@ class Server {
 
   LogCollector<SlowEntry> slow_log_;
   LogCollector<PerfEntry> perf_log_;
-
-  std::map<ConnContext *, bool> conn_ctxs_;
-  std::map<std::string, std::list<ConnContext *>> pubsub_channels_;
-  std::map<std::string, std::list<ConnContext *>> pubsub_patterns_;
-  std::mutex pubsub_channels_mu_;
-  std::map<std::string, std::list<ConnContext *>> blocking_keys_;
-  std::mutex blocking_keys_mu_;
+  LogCollector<TraceEntry> trace_log_;
+  PerfStats perf_stats_;
+  HotKeys hot_keys_;
+  NamespaceQuotas namespace_quotas_;
+  MonitorFeeder monitor_feeder_;
+
+  // the subscribers are registered in the owner worker, the server only
+  // counts them per worker to route the published messages and reply the
+  // number of receivers. patterns are indexed by the literal prefix before
+  // the first wildcard, so the publish only matches patterns which share
+  // a prefix with the channel.
+  std::map<std::string, std::map<Worker *, int>> pubsub_channels_;
+  std::map<std::string, std::map<std::string, std::map<Worker *, int>>> pubsub_patterns_;
+  pthread_rwlock_t pubsub_rwlock_;
+  // the blocked connections are registered in the owner worker as well, and the
+  // server counts them per worker to only wake up the workers blocking on the key
+  std::map<std::string, std::map<Worker *, int>> blocking_keys_;
+  std::atomic<int> blocking_keys_num_{0};
+  pthread_rwlock_t blocking_keys_rwlock_;
+
+  std::mutex scripts_mu_;
+  std::unordered_map<std::string, std::string> scripts_;
+  std::atomic<uint64_t> scripts_generation_{0};
+
+  // the sizes of the index and filter blocks of the sst files of a column family, they're summed
+  // from the table properties only after the super version or the sst files of it are changed
+  struct TableBlocksSize {
+    uint64_t super_version = 0;
+    uint64_t sst_files_size = 0;
+    uint64_t index_size = 0;
+    uint64_t filter_size = 0;
+    uint64_t top_level_index_size = 0;
+  };
+  void getTableBlocksSize(rocksdb::ColumnFamilyHandle *cf_handle, TableBlocksSize *size);
+  std::mutex table_blocks_sizes_mu_;
+  std::map<std::string, TableBlocksSize> table_blocks_sizes_;
 
   // threads
   std::thread cron_thread_;
   TaskRunner *task_runner_ = nullptr;
+  TaskRunner *slow_cmd_runner_ = nullptr;
+  TaskRunner *io_read_runner_ = nullptr;
   std::vector<WorkerThread *> worker_threads_;
+  // the unix socket is listened by all the workers, each of them accepts on the dup of it
+  int unixsocket_fd_ = -1;
   std::unique_ptr<ReplicationThread> replication_thread_;
+  std::unique_ptr<WALTailer> wal_tailer_;
+  std::unique_ptr<MetricsServer> metrics_server_;
 };
@@ -1,5 +1,10 @@
 #include "stats.h"
 
+#include <jemalloc/jemalloc.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
+
 #if defined(__APPLE__)
 #include <mach/task.h>
 #include <mach/mach_init.h>
@@ -45,11 +50,198 @@ int64_t Stats::GetMemoryRSS() {
 }
 #endif
 
-void Stats::IncrCalls(const std::string &command_name) {
-  total_calls.fetch_add(1, std::memory_order_relaxed);
-  commands_stats[command_name].calls.fetch_add(1, std::memory_order_relaxed);
+void Stats::GetAllocatorStats(uint64_t *allocated, uint64_t *active, uint64_t *resident) {
+  *allocated = *active = *resident = 0;
+  // the stats are cached by jemalloc, and refreshed after the epoch is updated
+  uint64_t epoch = 1;
+  size_t sz = sizeof(epoch);
+  if (mallctl("epoch", &epoch, &sz, &epoch, sz) != 0) return;
+  size_t value;
+  sz = sizeof(value);
+  if (mallctl("stats.allocated", &value, &sz, nullptr, 0) == 0) *allocated = value;
+  if (mallctl("stats.active", &value, &sz, nullptr, 0) == 0) *active = value;
+  if (mallctl("stats.resident", &value, &sz, nullptr, 0) == 0) *resident = value;
+}
+
+static std::atomic<uint64_t> stats_next_id = {1};
+// the alive stats by the id, so the exiting threads won't retire the blocks into the destroyed stats
+static std::mutex stats_registry_mu;
+static std::map<uint64_t, Stats *> stats_registry;
+
+Stats::Stats(size_t n_commands) : id_(stats_next_id.fetch_add(1)), n_commands_(n_commands) {
+  blocks_.emplace_back(new StatsBlock(n_commands_));
+  std::lock_guard<std::mutex> guard(stats_registry_mu);
+  stats_registry[id_] = this;
+}
+
+Stats::~Stats() {
+  std::lock_guard<std::mutex> guard(stats_registry_mu);
+  stats_registry.erase(id_);
+}
+
+// LocalBlock retires the block of the thread when the thread exits
+struct LocalBlock {
+  ~LocalBlock() {
+    if (block) Stats::retireBlock(stats_id, block);
+  }
+  uint64_t stats_id = 0;
+  StatsBlock *block = nullptr;
+};
+
+static void mergeCounter(std::atomic<uint64_t> *dst, const std::atomic<uint64_t> &src) {
+  dst->fetch_add(src.load(std::memory_order_relaxed), std::memory_order_relaxed);
 }
 
-void Stats::IncrLatency(uint64_t latency, const std::string &command_name) {
-  commands_stats[command_name].latency.fetch_add(latency, std::memory_order_relaxed);
+void Stats::retireBlock(uint64_t stats_id, StatsBlock *block) {
+  std::lock_guard<std::mutex> registry_guard(stats_registry_mu);
+  auto iter = stats_registry.find(stats_id);
+  // the block was freed with the stats
+  if (iter == stats_registry.end()) return;
+  auto stats = iter->second;
+  std::lock_guard<std::mutex> guard(stats->blocks_mu_);
+  auto retired = stats->blocks_[0].get();
+  mergeCounter(&retired->total_calls, block->total_calls);
+  mergeCounter(&retired->in_bytes, block->in_bytes);
+  mergeCounter(&retired->out_bytes, block->out_bytes);
+  for (size_t i = 0; i < stats->n_commands_; i++) {
+    mergeCounter(&retired->commands_calls[i], block->commands_calls[i]);
+    mergeCounter(&retired->commands_latency[i], block->commands_latency[i]);
+    auto histogram = block->commands_histogram[i].load(std::memory_order_relaxed);
+    if (!histogram) continue;
+    auto retired_histogram = retired->commands_histogram[i].load(std::memory_order_relaxed);
+    if (!retired_histogram) {
+      retired_histogram = new LatencyHistogram();
+      retired->commands_histogram[i].store(retired_histogram, std::memory_order_release);
+    }
+    for (int j = 0; j < LatencyHistogram::kBuckets; j++) {
+      mergeCounter(&retired_histogram->buckets[j], histogram->buckets[j]);
+    }
+    auto max = histogram->max.load(std::memory_order_relaxed);
+    if (max > retired_histogram->max.load(std::memory_order_relaxed)) {
+      retired_histogram->max.store(max, std::memory_order_relaxed);
+    }
+  }
+  auto &blocks = stats->blocks_;
+  blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+                              [block](const std::unique_ptr<StatsBlock> &b) { return b.get() == block; }),
+               blocks.end());
+}
+
+StatsBlock *Stats::localBlock() {
+  // the id rather than the address identifies the stats, since a new one may reuse the address
+  thread_local LocalBlock local;
+  if (local.stats_id == id_) return local.block;
+  if (local.block) retireBlock(local.stats_id, local.block);
+  auto block = new StatsBlock(n_commands_);
+  blocks_mu_.lock();
+  blocks_.emplace_back(block);
+  blocks_mu_.unlock();
+  local.stats_id = id_;
+  local.block = block;
+  return block;
+}
+
+void Stats::IncrCalls(int command_id) {
+  auto block = localBlock();
+  incr(&block->total_calls, 1);
+  if (command_id >= 0 && static_cast<size_t>(command_id) < n_commands_) {
+    incr(&block->commands_calls[command_id], 1);
+  }
+}
+
+void Stats::IncrLatency(uint64_t latency, int command_id) {
+  if (command_id < 0 || static_cast<size_t>(command_id) >= n_commands_) return;
+  auto block = localBlock();
+  incr(&block->commands_latency[command_id], latency);
+  auto histogram = block->commands_histogram[command_id].load(std::memory_order_relaxed);
+  if (!histogram) {
+    histogram = new LatencyHistogram();
+    // release the zeroed buckets to the readers
+    block->commands_histogram[command_id].store(histogram, std::memory_order_release);
+  }
+  incr(&histogram->buckets[LatencyHistogram::BucketIndex(latency)], 1);
+  if (latency > histogram->max.load(std::memory_order_relaxed)) {
+    histogram->max.store(latency, std::memory_order_relaxed);
+  }
+}
+
+bool Stats::GetLatencyHistogram(int command_id, std::vector<uint64_t> *buckets, uint64_t *max) {
+  buckets->assign(LatencyHistogram::kBuckets, 0);
+  *max = 0;
+  if (command_id < 0 || static_cast<size_t>(command_id) >= n_commands_) return false;
+  bool found = false;
+  std::lock_guard<std::mutex> guard(blocks_mu_);
+  for (const auto &block : blocks_) {
+    auto histogram = block->commands_histogram[command_id].load(std::memory_order_acquire);
+    if (!histogram) continue;
+    found = true;
+    for (int i = 0; i < LatencyHistogram::kBuckets; i++) {
+      (*buckets)[i] += histogram->buckets[i].load(std::memory_order_relaxed);
+    }
+    *max = std::max(*max, histogram->max.load(std::memory_order_relaxed));
+  }
+  return found;
+}
+
+int LatencyHistogram::BucketIndex(uint64_t latency) {
+  if (latency < kSubBuckets) return static_cast<int>(latency);
+  int exp = 63 - __builtin_clzll(latency);
+  int sub = static_cast<int>((latency >> (exp - kSubBucketBits)) & (kSubBuckets - 1));
+  int index = kSubBuckets + (exp - kSubBucketBits) * kSubBuckets + sub;
+  return std::min(index, kBuckets - 1);
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(int index) {
+  if (index < kSubBuckets) return static_cast<uint64_t>(index);
+  int exp = (index - kSubBuckets) / kSubBuckets + kSubBucketBits;
+  uint64_t sub = static_cast<uint64_t>((index - kSubBuckets) % kSubBuckets);
+  // the bucket is [(4+sub) << (exp-2), (5+sub) << (exp-2))
+  return ((kSubBuckets + sub + 1) << (exp - kSubBucketBits)) - 1;
+}
+
+uint64_t LatencyHistogram::Percentile(const std::vector<uint64_t> &buckets, double percentile, uint64_t max) {
+  uint64_t total = 0;
+  for (const auto &n : buckets) total += n;
+  if (total == 0) return 0;
+  auto rank = static_cast<uint64_t>(std::ceil(percentile / 100 * static_cast<double>(total)));
+  if (rank == 0) rank = 1;
+  uint64_t count = 0;
+  for (size_t i = 0; i < buckets.size(); i++) {
+    count += buckets[i];
+    if (count >= rank) return std::min(BucketUpperBound(static_cast<int>(i)), max);
+  }
+  return max;
+}
+
+uint64_t Stats::GetTotalCalls() {
+  std::lock_guard<std::mutex> guard(blocks_mu_);
+  uint64_t n = 0;
+  for (const auto &block : blocks_) n += block->total_calls.load(std::memory_order_relaxed);
+  return n;
+}
+
+uint64_t Stats::GetInbondBytes() {
+  std::lock_guard<std::mutex> guard(blocks_mu_);
+  uint64_t n = 0;
+  for (const auto &block : blocks_) n += block->in_bytes.load(std::memory_order_relaxed);
+  return n;
+}
+
+uint64_t Stats::GetOutbondBytes() {
+  std::lock_guard<std::mutex> guard(blocks_mu_);
+  uint64_t n = 0;
+  for (const auto &block : blocks_) n += block->out_bytes.load(std::memory_order_relaxed);
+  return n;
+}
+
+void Stats::GetCommandStats(std::vector<uint64_t> *calls, std::vector<uint64_t> *latency) {
+  calls->assign(n_commands_, 0);
+  latency->assign(n_commands_, 0);
+  std::lock_guard<std::mutex> guard(blocks_mu_);
+  for (const auto &block : blocks_) {
+    for (size_t i = 0; i < n_commands_; i++) {
+      (*calls)[i] += block->commands_calls[i].load(std::memory_order_relaxed);
+      (*latency)[i] += block->commands_latency[i].load(std::memory_order_relaxed);
+    }
+  }
 }
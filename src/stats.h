@@ -1,33 +1,99 @@
 #pragma once
 
 #include <unistd.h>
-#include <map>
 #include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
-struct command_stat {
-  std::atomic<uint64_t> calls;
-  std::atomic<uint64_t> latency;
+// LatencyHistogram buckets the latency(us) by the power of two, and splits each
+// power of two into 4 linear sub-buckets, so the percentiles are within 25% error
+struct LatencyHistogram {
+  static const int kSubBucketBits = 2;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  // the last bucket holds the latency larger than 2^36us(about 19 hours)
+  static const int kBuckets = kSubBuckets + (36 - kSubBucketBits) * kSubBuckets;
+  static int BucketIndex(uint64_t latency);
+  // BucketUpperBound returns the max latency of the bucket
+  static uint64_t BucketUpperBound(int index);
+  // Percentile returns the latency of the percentile(0~100) from the bucket counts
+  static uint64_t Percentile(const std::vector<uint64_t> &buckets, double percentile, uint64_t max);
+
+  std::atomic<uint64_t> buckets[kBuckets] = {};
+  std::atomic<uint64_t> max = {0};
 };
 
-class Stats {
- public:
+// StatsBlock is the counters of one thread, it's only updated by the owner thread
+// and summed up while reading, so the threads won't contend on the same cache line
+struct StatsBlock {
+  explicit StatsBlock(size_t n_commands)
+      : commands_calls(n_commands), commands_latency(n_commands), commands_histogram(n_commands) {}
+  ~StatsBlock() {
+    for (auto &histogram : commands_histogram) delete histogram.load();
+  }
   std::atomic<uint64_t> total_calls = {0};
   std::atomic<uint64_t> in_bytes = {0};
   std::atomic<uint64_t> out_bytes = {0};
+  std::vector<std::atomic<uint64_t>> commands_calls;
+  std::vector<std::atomic<uint64_t>> commands_latency;
+  // the histograms are allocated when the command is called the first time
+  std::vector<std::atomic<LatencyHistogram *>> commands_histogram;
+};
+
+class Stats {
+ public:
+  // @n_commands: the number of the command ids
+  explicit Stats(size_t n_commands);
+  ~Stats();
+  Stats(const Stats &) = delete;
+  Stats &operator=(const Stats &) = delete;
 
   std::atomic<uint64_t> fullsync_counter = {0};
   std::atomic<uint64_t> psync_err_counter = {0};
   std::atomic<uint64_t> psync_ok_counter = {0};
-  std::map<std::string, command_stat> commands_stats;
+  std::atomic<uint64_t> write_stall_held_counter = {0};
+  std::atomic<uint64_t> write_stall_rejected_counter = {0};
+  std::atomic<uint64_t> repl_ack_timeout_counter = {0};
 
  public:
-  void IncrCalls(const std::string &command_name);
-  void IncrLatency(uint64_t latency, const std::string &command_name);
-  void IncrInbondBytes(uint64_t bytes) { in_bytes.fetch_add(bytes, std::memory_order_relaxed); }
-  void IncrOutbondBytes(uint64_t bytes) { out_bytes.fetch_add(bytes, std::memory_order_relaxed); }
+  void IncrCalls(int command_id);
+  void IncrLatency(uint64_t latency, int command_id);
+  void IncrInbondBytes(uint64_t bytes) { incr(&localBlock()->in_bytes, bytes); }
+  void IncrOutbondBytes(uint64_t bytes) { incr(&localBlock()->out_bytes, bytes); }
   void IncrFullSyncCounter() { fullsync_counter.fetch_add(1, std::memory_order_relaxed); }
   void IncrPSyncErrCounter() { psync_err_counter.fetch_add(1, std::memory_order_relaxed); }
   void IncrPSyncOKCounter() { psync_ok_counter.fetch_add(1, std::memory_order_relaxed); }
+  void IncrWriteStallHeldCounter() { write_stall_held_counter.fetch_add(1, std::memory_order_relaxed); }
+  void IncrWriteStallRejectedCounter() { write_stall_rejected_counter.fetch_add(1, std::memory_order_relaxed); }
+  void IncrReplAckTimeoutCounter() { repl_ack_timeout_counter.fetch_add(1, std::memory_order_relaxed); }
+  uint64_t GetTotalCalls();
+  uint64_t GetInbondBytes();
+  uint64_t GetOutbondBytes();
+  // GetCommandStats returns the calls and latency indexed by the command id
+  void GetCommandStats(std::vector<uint64_t> *calls, std::vector<uint64_t> *latency);
+  // GetLatencyHistogram merges the latency histograms of the command in all threads,
+  // and returns false if the command is never called
+  bool GetLatencyHistogram(int command_id, std::vector<uint64_t> *buckets, uint64_t *max);
   static int64_t GetMemoryRSS();
+  // GetAllocatorStats returns the bytes allocated by the application, the bytes of the active
+  // pages and the resident bytes of the allocator, they are all zero if it's not jemalloc
+  static void GetAllocatorStats(uint64_t *allocated, uint64_t *active, uint64_t *resident);
+
+ private:
+  // only the owner thread writes the counter, so it needn't the atomic add
+  static void incr(std::atomic<uint64_t> *counter, uint64_t n) {
+    counter->store(counter->load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+  StatsBlock *localBlock();
+  // retireBlock merges the counters of the block into the first block and frees it,
+  // it's called when the owner thread exits or switches to another stats
+  static void retireBlock(uint64_t stats_id, StatsBlock *block);
+  friend struct LocalBlock;
+
+  uint64_t id_;
+  size_t n_commands_;
+  std::mutex blocks_mu_;
+  // the first block holds the counters of the exited threads
+  std::vector<std::unique_ptr<StatsBlock>> blocks_;
 };
@@ -32,6 +32,7 @@ class Status {
   Status() : Status(cOK, "ok") {}
   explicit Status(Code code, std::string msg = "") : code_(code), msg_(std::move(msg)) {}
   bool IsOK() { return code_ == cOK; }
+  bool Is(Code code) { return code_ == code; }
   std::string Msg() { return msg_; }
   static Status OK() { return Status(cOK, "ok"); }
 
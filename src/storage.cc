@@ -1,6 +1,7 @@
 #include "storage.h"
 
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <event2/buffer.h>
 #include <glog/logging.h>
@@ -9,32 +10,230 @@
 #include <rocksdb/sst_file_manager.h>
 #include <rocksdb/utilities/table_properties_collectors.h>
 #include <rocksdb/rate_limiter.h>
+#include <rocksdb/utilities/checkpoint.h>
+#include <rocksdb/utilities/write_batch_with_index.h>
+#include <rocksdb/convenience.h>
+#include <rocksdb/env.h>
+#include <rocksdb/slice_transform.h>
+#include <rocksdb/version.h>
+#include <algorithm>
 #include <iostream>
 #include <memory>
+#include <random>
+#include <sstream>
 
 #include "config.h"
 #include "redis_metadata.h"
 #include "event_listener.h"
 #include "compact_filter.h"
+#include "table_properties_collector.h"
+#include "prefix_transform.h"
+#include "merge_operator.h"
+#include "rocksdb_crc32c.h"
+#include "encoding.h"
+#include "tracing.h"
+#include "util.h"
 
 namespace Engine {
 
 const char *kPubSubColumnFamilyName = "pubsub";
 const char *kZSetScoreColumnFamilyName = "zset_score";
 const char *kMetadataColumnFamilyName = "metadata";
+const char *kZSetRankColumnFamilyName = "zset_rank";
+const char *kBlobColumnFamilyName = "blob";
+// the column families of the subkeys split by type, in the order of their ids
+static const std::vector<std::pair<RedisType, const char *>> kTypeColumnFamilies = {
+    {kRedisHash, "hash"},
+    {kRedisSet, "set"},
+    {kRedisList, "list"},
+    {kRedisBitmap, "bitmap"},
+    {kRedisSortedint, "sortedint"},
+    {kRedisZSet, "zset"},
+};
 const uint64_t kIORateLimitMaxMb = 1024000;
+// the hottest keys to warm up the caches after a restart
+const char *kWarmupKeysFileName = "warmup_keys";
+// kept in the dir rather than the db dir, which the fullsync replaces
+const char *kReplicationIDFileName = "replication_id";
+// kept in the db dir, so it's dropped along with the data by the restores
+const char *kTypeCFsMigratedFileName = "type_cfs_migrated";
+// the sequence of the last ingestion, kept in the db dir for the same reason
+const char *kIngestedSeqFileName = "ingested_seq";
 using rocksdb::Slice;
 
+// Transaction is the uncommitted writes of the thread, see BeginTxn
+struct Transaction {
+  Storage *storage = nullptr;
+  std::unique_ptr<rocksdb::WriteBatchWithIndex> batch;
+  std::vector<std::function<void()>> after_commit;
+  // the batch has the writes besides the deletes, which are refused once the db reaches the size limit
+  bool has_writes = false;
+  // the sizes of after_commit and has_writes at the save points, see SetTxnSavePoint
+  std::vector<std::pair<size_t, bool>> save_points;
+};
+static thread_local Transaction txn;
+
+static Transaction *currentTxn(Storage *storage) {
+  return txn.storage == storage ? &txn : nullptr;
+}
+
+// CacheOnlyReads is the cache only mode of the thread, see BeginCacheOnlyReads
+struct CacheOnlyReads {
+  Storage *storage = nullptr;
+  bool missed = false;
+};
+static thread_local CacheOnlyReads cache_only_reads;
+
+// CacheOnlyIterator records the miss of the cache only mode, the iterator becomes invalid
+// with the incomplete status once it reaches the block which isn't in the memory
+class CacheOnlyIterator : public rocksdb::Iterator {
+ public:
+  explicit CacheOnlyIterator(rocksdb::Iterator *iter) : iter_(iter) {}
+  bool Valid() const override {
+    if (iter_->Valid()) return true;
+    if (iter_->status().IsIncomplete()) cache_only_reads.missed = true;
+    return false;
+  }
+  void SeekToFirst() override { iter_->SeekToFirst(); }
+  void SeekToLast() override { iter_->SeekToLast(); }
+  void Seek(const rocksdb::Slice &target) override { iter_->Seek(target); }
+  void SeekForPrev(const rocksdb::Slice &target) override { iter_->SeekForPrev(target); }
+  void Next() override { iter_->Next(); }
+  void Prev() override { iter_->Prev(); }
+  rocksdb::Slice key() const override { return iter_->key(); }
+  rocksdb::Slice value() const override { return iter_->value(); }
+  rocksdb::Status status() const override { return iter_->status(); }
+
+ private:
+  std::unique_ptr<rocksdb::Iterator> iter_;
+};
+
+// TxnIterator keeps the iterator over the transaction batch and the db in the bounds and the
+// prefix of the read options, since the batch side of NewIteratorWithBase ignores them
+class TxnIterator : public rocksdb::Iterator {
+ public:
+  TxnIterator(rocksdb::Iterator *iter, const rocksdb::ReadOptions &options, bool has_prefix)
+      : iter_(iter), prefix_same_as_start_(has_prefix && options.prefix_same_as_start) {
+    if (options.iterate_lower_bound) lower_bound_.reset(new std::string(options.iterate_lower_bound->ToString()));
+    if (options.iterate_upper_bound) upper_bound_.reset(new std::string(options.iterate_upper_bound->ToString()));
+  }
+  bool Valid() const override {
+    if (!iter_->Valid()) return false;
+    auto key = iter_->key();
+    if (lower_bound_ && key.compare(*lower_bound_) < 0) return false;
+    if (upper_bound_ && key.compare(*upper_bound_) >= 0) return false;
+    return !prefix_same_as_start_ || key.starts_with(prefix_);
+  }
+  void SeekToFirst() override {
+    if (lower_bound_) {
+      iter_->Seek(*lower_bound_);
+    } else {
+      iter_->SeekToFirst();
+    }
+    setPrefix();
+  }
+  void SeekToLast() override {
+    if (upper_bound_) {
+      iter_->SeekForPrev(*upper_bound_);
+      if (iter_->Valid() && iter_->key() == *upper_bound_) iter_->Prev();
+    } else {
+      iter_->SeekToLast();
+    }
+    setPrefix();
+  }
+  void Seek(const rocksdb::Slice &target) override {
+    if (lower_bound_ && target.compare(*lower_bound_) < 0) {
+      iter_->Seek(*lower_bound_);
+    } else {
+      iter_->Seek(target);
+    }
+    setPrefix();
+  }
+  void SeekForPrev(const rocksdb::Slice &target) override {
+    if (upper_bound_ && target.compare(*upper_bound_) >= 0) {
+      SeekToLast();
+      return;
+    }
+    iter_->SeekForPrev(target);
+    setPrefix();
+  }
+  void Next() override { iter_->Next(); }
+  void Prev() override { iter_->Prev(); }
+  rocksdb::Slice key() const override { return iter_->key(); }
+  rocksdb::Slice value() const override { return iter_->value(); }
+  rocksdb::Status status() const override { return iter_->status(); }
+
+ private:
+  std::unique_ptr<rocksdb::Iterator> iter_;
+  std::unique_ptr<std::string> lower_bound_;
+  std::unique_ptr<std::string> upper_bound_;
+  bool prefix_same_as_start_;
+  std::string prefix_;
+
+  // the iteration stays in the prefix of the key found by the seek, like the db iterator
+  void setPrefix() {
+    if (!prefix_same_as_start_ || !iter_->Valid()) return;
+    auto key = iter_->key();
+    prefix_.assign(key.data(), SubKeyPrefixTransform::PrefixSize(key));
+  }
+};
+
+// TracedIterator adds the time of the seeks and moves to the storage read span of the trace
+class TracedIterator : public rocksdb::Iterator {
+ public:
+  explicit TracedIterator(rocksdb::Iterator *iter) : iter_(iter) {}
+  bool Valid() const override { return iter_->Valid(); }
+  void SeekToFirst() override {
+    TraceSpanTimer timer(Trace::kStorageRead);
+    iter_->SeekToFirst();
+  }
+  void SeekToLast() override {
+    TraceSpanTimer timer(Trace::kStorageRead);
+    iter_->SeekToLast();
+  }
+  void Seek(const rocksdb::Slice &target) override {
+    TraceSpanTimer timer(Trace::kStorageRead);
+    iter_->Seek(target);
+  }
+  void SeekForPrev(const rocksdb::Slice &target) override {
+    TraceSpanTimer timer(Trace::kStorageRead);
+    iter_->SeekForPrev(target);
+  }
+  void Next() override {
+    TraceSpanTimer timer(Trace::kStorageRead);
+    iter_->Next();
+  }
+  void Prev() override {
+    TraceSpanTimer timer(Trace::kStorageRead);
+    iter_->Prev();
+  }
+  rocksdb::Slice key() const override { return iter_->key(); }
+  rocksdb::Slice value() const override { return iter_->value(); }
+  rocksdb::Status status() const override { return iter_->status(); }
+
+ private:
+  std::unique_ptr<rocksdb::Iterator> iter_;
+};
+
 Storage::~Storage() {
   DestroyBackup();
   CloseDB();
 }
 
 void Storage::CloseDB() {
+  // the failed restore leaves the db closed
+  if (!db_) return;
+  stopWarmup();
+  saveWarmupKeys();
   db_->SyncWAL();
   // prevent to destroy the cloumn family while the compact filter was using
   db_mu_.lock();
   db_closing_ = true;
+  db_mu_.unlock();
+  // the cached scan iterators hold the db references
+  scan_iter_cache_.Disable();
+  if (db_closing_handler_) db_closing_handler_();
+  db_mu_.lock();
   while (db_refs_ != 0) {
     db_mu_.unlock();
     usleep(10000);
@@ -42,7 +241,9 @@ void Storage::CloseDB() {
   }
   db_mu_.unlock();
   for (auto handle : cf_handles_) db_->DestroyColumnFamilyHandle(handle);
+  cf_handles_.clear();
   delete db_;
+  db_ = nullptr;
 }
 
 void Storage::InitOptions(rocksdb::Options *options) {
@@ -55,13 +256,25 @@ void Storage::InitOptions(rocksdb::Options *options) {
   options->stats_dump_period_sec = 0;
   options->OptimizeLevelStyleCompaction();
   options->max_open_files = config_->rocksdb_options.max_open_files;
+  options->max_file_opening_threads = config_->rocksdb_options.max_file_opening_threads;
   options->max_subcompactions = config_->rocksdb_options.max_sub_compactions;
   options->max_background_flushes = config_->rocksdb_options.max_background_flushes;
   options->max_background_compactions = config_->rocksdb_options.max_background_compactions;
   options->max_write_buffer_number = config_->rocksdb_options.max_write_buffer_number;
   options->write_buffer_size =  config_->rocksdb_options.write_buffer_size;
   options->compression = config_->rocksdb_options.compression;
+  options->compression_per_level = config_->rocksdb_options.compression_per_level;
+  // the levels are placed into the first path which can hold them with the upper levels,
+  // and the WAL and manifest files are still in the db_dir
+  for (const auto &path : config_->rocksdb_options.db_paths) {
+    options->db_paths.emplace_back(path.first, path.second);
+  }
   options->enable_pipelined_write = config_->rocksdb_options.enable_pipelined_write;
+  // Concurrent writers from all workers are grouped by the rocksdb write thread,
+  // the group leader appends all batches in one WAL write and the followers insert
+  // into the memtable concurrently, works with and without the pipelined write.
+  options->allow_concurrent_memtable_write = true;
+  options->enable_write_thread_adaptive_yield = true;
   options->target_file_size_base = config_->rocksdb_options.target_file_size_base;
   options->max_manifest_file_size = 64 * MiB;
   options->max_log_file_size = 256 * MiB;
@@ -80,8 +293,17 @@ void Storage::InitOptions(rocksdb::Options *options) {
   }
   rate_limiter_ = std::shared_ptr<rocksdb::RateLimiter>(rocksdb::NewGenericRateLimiter(max_io_mb * MiB));
   options->rate_limiter = rate_limiter_;
+  uint64_t max_backup_mb = config_->max_backup_mb > 0 ? config_->max_backup_mb : kIORateLimitMaxMb;
+  backup_rate_limiter_ = std::shared_ptr<rocksdb::RateLimiter>(rocksdb::NewGenericRateLimiter(max_backup_mb * MiB));
   options->delayed_write_rate = config_->rocksdb_options.delayed_write_rate;
   options->compaction_readahead_size = config_->rocksdb_options.compaction_readahead_size;
+  // the direct io bypasses the page cache, so the flush and compaction wouldn't evict
+  // the hot pages, and the block cache is the only cache of the direct reads
+  options->use_direct_reads = config_->rocksdb_options.use_direct_reads;
+  options->use_direct_io_for_flush_and_compaction = config_->rocksdb_options.use_direct_io_for_flush_and_compaction;
+  options->bytes_per_sync = config_->rocksdb_options.bytes_per_sync;
+  options->wal_bytes_per_sync = config_->rocksdb_options.wal_bytes_per_sync;
+  options->use_adaptive_mutex = config_->rocksdb_options.use_adaptive_mutex;
   options->level0_slowdown_writes_trigger = config_->rocksdb_options.level0_slowdown_writes_trigger;
   options->level0_stop_writes_trigger = config_->rocksdb_options.level0_stop_writes_trigger;
 }
@@ -93,7 +315,8 @@ Status Storage::CreateColumnFamiles(const rocksdb::Options &options) {
   if (s.ok()) {
     std::vector<std::string> cf_names = {kMetadataColumnFamilyName,
                                          kZSetScoreColumnFamilyName,
-                                         kPubSubColumnFamilyName};
+                                         kPubSubColumnFamilyName,
+                                         kZSetRankColumnFamilyName};
     std::vector<rocksdb::ColumnFamilyHandle *> cf_handles;
     s = tmp_db->CreateColumnFamilies(cf_options, cf_names, &cf_handles);
     if (!s.ok()) {
@@ -114,32 +337,83 @@ Status Storage::Open(bool read_only) {
   db_closing_ = false;
   db_refs_ = 0;
   db_mu_.unlock();
+  scan_iter_cache_.Enable();
+  // the stall conditions of the new db would be reported by the listener again
+  write_stopped_cfs_ = 0;
+  write_delayed_cfs_ = 0;
 
   rocksdb::Options options;
   InitOptions(&options);
   CreateColumnFamiles(options);
+  if (config_->rocksdb_options.shared_block_cache_size > 0) {
+    metadata_block_cache_ = newBlockCache(config_->rocksdb_options.shared_block_cache_size);
+    subkey_block_cache_ = metadata_block_cache_;
+  } else {
+    metadata_block_cache_ = newBlockCache(config_->rocksdb_options.metadata_block_cache_size);
+    subkey_block_cache_ = newBlockCache(config_->rocksdb_options.subkey_block_cache_size);
+  }
+  compressed_block_cache_.reset();
+  if (config_->rocksdb_options.compressed_block_cache_size > 0) {
+    compressed_block_cache_ = rocksdb::NewLRUCache(config_->rocksdb_options.compressed_block_cache_size);
+  }
   rocksdb::BlockBasedTableOptions metadata_table_opts;
-  metadata_table_opts.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, true));
-  metadata_table_opts.block_cache =
-      rocksdb::NewLRUCache(config_->rocksdb_options.metadata_block_cache_size, -1, false, 0.75);
+  metadata_table_opts.filter_policy.reset(newBloomFilterPolicy(10));
+  metadata_table_opts.block_cache = metadata_block_cache_;
+  metadata_table_opts.block_cache_compressed = compressed_block_cache_;
   metadata_table_opts.cache_index_and_filter_blocks = true;
   metadata_table_opts.cache_index_and_filter_blocks_with_high_priority = true;
+  setPartitionedIndexAndFilters(&metadata_table_opts);
+  if (config_->rocksdb_options.data_block_hash_index) {
+#if ROCKSDB_MAJOR > 5 || (ROCKSDB_MAJOR == 5 && ROCKSDB_MINOR >= 16)
+    // the point lookups search the hash index inside the data block, the seeks still use the binary search
+    metadata_table_opts.data_block_index_type = rocksdb::BlockBasedTableOptions::kDataBlockBinaryAndHash;
+#else
+    LOG(WARNING) << "[storage] The data block hash index isn't supported by the rocksdb " << ROCKSDB_MAJOR
+                 << "." << ROCKSDB_MINOR << ", ignore it";
+#endif
+  }
   rocksdb::ColumnFamilyOptions metadata_opts(options);
   metadata_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(metadata_table_opts));
+  // the metadata is mostly read by the point lookups of the ns_key, so the prefix extractor
+  // is the whole key for the memtable bloom, and the metadata iterators seek in the total
+  // order, see SetTotalOrderIfMetadata. The memtable stays the skiplist, since the hash
+  // skiplist is sorted again for every iterator in the total order.
+  if (config_->rocksdb_options.metadata_memtable_bloom) {
+    metadata_opts.prefix_extractor.reset(rocksdb::NewNoopTransform());
+    metadata_opts.memtable_prefix_bloom_size_ratio = 0.1;
+  }
   metadata_opts.compaction_filter_factory = std::make_shared<MetadataFilterFactory>();
+  // the merge operators are always set even if the counter-merge-mode is disabled, since
+  // the merged counters written before may be still there
+  metadata_opts.merge_operator = std::make_shared<CounterMergeOperator>(5);
+  metadata_opts.table_properties_collector_factories.emplace_back(
+      std::make_shared<NamespaceStatsCollectorFactory>());
 
   rocksdb::BlockBasedTableOptions subkey_table_opts;
-  subkey_table_opts.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, true));
-  subkey_table_opts.block_cache =
-      rocksdb::NewLRUCache(config_->rocksdb_options.subkey_block_cache_size, -1, false, 0.75);
+  subkey_table_opts.filter_policy.reset(newBloomFilterPolicy(10));
+  subkey_table_opts.block_cache = subkey_block_cache_;
+  subkey_table_opts.block_cache_compressed = compressed_block_cache_;
   subkey_table_opts.cache_index_and_filter_blocks = true;
   subkey_table_opts.cache_index_and_filter_blocks_with_high_priority = true;
+  setPartitionedIndexAndFilters(&subkey_table_opts);
   rocksdb::ColumnFamilyOptions subkey_opts(options);
   subkey_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(subkey_table_opts));
   subkey_opts.compaction_filter_factory = std::make_shared<SubKeyFilterFactory>(this);
+  subkey_opts.merge_operator = std::make_shared<CounterMergeOperator>(0);
+  // the subkeys are mostly read by iterating the `ns|key|version` prefix, so the
+  // prefix blooms skip the sst files and memtables which don't contain the key,
+  // and the whole keys are still added into the filters for the point lookups
+  subkey_opts.prefix_extractor = std::make_shared<SubKeyPrefixTransform>();
+  subkey_opts.memtable_prefix_bloom_size_ratio = 0.1;
+  // the subkeys are mostly read after their metadata is found, so the filters of the
+  // bottommost level, which take the most memory, are rarely useful
+  subkey_opts.optimize_filters_for_hits = config_->rocksdb_options.optimize_filters_for_hits;
 
   rocksdb::BlockBasedTableOptions pubsub_table_opts;
   pubsub_table_opts.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, true));
+  // the pubsub messages are rarely read, share the subkey cache instead of the
+  // default cache of rocksdb which is outside the configured capacity
+  pubsub_table_opts.block_cache = subkey_block_cache_;
   rocksdb::ColumnFamilyOptions pubsub_opts(options);
   pubsub_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(pubsub_table_opts));
   pubsub_opts.compaction_filter_factory = std::make_shared<PubSubFilterFactory>();
@@ -150,6 +424,37 @@ Status Storage::Open(bool read_only) {
   column_families.emplace_back(rocksdb::ColumnFamilyDescriptor(kMetadataColumnFamilyName, metadata_opts));
   column_families.emplace_back(rocksdb::ColumnFamilyDescriptor(kZSetScoreColumnFamilyName, subkey_opts));
   column_families.emplace_back(rocksdb::ColumnFamilyDescriptor(kPubSubColumnFamilyName, pubsub_opts));
+  column_families.emplace_back(rocksdb::ColumnFamilyDescriptor(kZSetRankColumnFamilyName, subkey_opts));
+  // the type column families are always opened to keep the ids stable,
+  // they are only written if the type-column-families is enabled
+  for (const auto &type_cf : kTypeColumnFamilies) {
+    const auto &type_cf_options = config_->rocksdb_options.type_cf_options[type_cf.second];
+    rocksdb::BlockBasedTableOptions type_table_opts(subkey_table_opts);
+    type_table_opts.block_size = static_cast<size_t>(type_cf_options.block_size);
+    if (type_cf_options.bloom_bits > 0) {
+      type_table_opts.filter_policy.reset(newBloomFilterPolicy(type_cf_options.bloom_bits));
+    } else {
+      type_table_opts.filter_policy.reset();
+    }
+    setPartitionedIndexAndFilters(&type_table_opts);
+    rocksdb::ColumnFamilyOptions type_opts(subkey_opts);
+    type_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(type_table_opts));
+    if (type_cf_options.compression >= 0) {
+      type_opts.compression = static_cast<rocksdb::CompressionType>(type_cf_options.compression);
+    }
+    if (type_cf_options.universal_compaction) {
+      type_opts.compaction_style = rocksdb::kCompactionStyleUniversal;
+    }
+    column_families.emplace_back(rocksdb::ColumnFamilyDescriptor(type_cf.second, type_opts));
+  }
+  // the blobs are written once and dropped as a whole, so the universal compaction rewrites them
+  // far less than the levels, and the stale blobs are dropped by the subkey filter
+  rocksdb::BlockBasedTableOptions blob_table_opts(subkey_table_opts);
+  blob_table_opts.block_size = 64 * KiB;
+  rocksdb::ColumnFamilyOptions blob_opts(subkey_opts);
+  blob_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(blob_table_opts));
+  blob_opts.compaction_style = rocksdb::kCompactionStyleUniversal;
+  column_families.emplace_back(rocksdb::ColumnFamilyDescriptor(kBlobColumnFamilyName, blob_opts));
 
   auto start = std::chrono::high_resolution_clock::now();
   rocksdb::Status s;
@@ -165,11 +470,22 @@ Status Storage::Open(bool read_only) {
     return Status(Status::DBOpenErr, s.ToString());
   }
   LOG(INFO) << "[storage] Success to load the data from disk: " << duration << " ms";
+  auto type_cfs_status = openTypeCFs(read_only);
+  if (!type_cfs_status.IsOK()) return type_cfs_status;
+  loadIngestedSeq();
+  // the db may be reopened after restoring from the backup
+  metadata_cache_.Clear();
+  {
+    // the ranges are useless for the restored db
+    std::lock_guard<std::mutex> guard(reclaim_mu_);
+    reclaim_ranges_.clear();
+  }
   if (!read_only) {
+    loadReplicationID();
     // open backup engine
-    rocksdb::BackupableDBOptions bk_option(config_->backup_dir);
-    s = rocksdb::BackupEngine::Open(db_->GetEnv(), bk_option, &backup_);
+    s = rocksdb::BackupEngine::Open(db_->GetEnv(), backupOptions(), &backup_);
     if (!s.ok()) return Status(Status::DBBackupErr, s.ToString());
+    startWarmup();
   }
   return Status::OK();
 }
@@ -178,11 +494,148 @@ Status Storage::Open() {
   return Open(false);
 }
 
+void Storage::saveWarmupKeys() {
+  if (config_->warmup_max_keys <= 0) return;
+  std::vector<std::string> keys;
+  metadata_cache_.GetHotKeys(static_cast<size_t>(config_->warmup_max_keys), &keys);
+  if (keys.empty()) return;
+  std::string content;
+  for (const auto &key : keys) {
+    PutFixed32(&content, static_cast<uint32_t>(key.size()));
+    content.append(key);
+  }
+  // the file is written as a whole, so the warmup never reads the partial one
+  std::string path = config_->dir + "/" + kWarmupKeysFileName;
+  std::string tmp_path = path + ".tmp";
+  auto s = rocksdb::WriteStringToFile(db_->GetEnv(), content, tmp_path, true);
+  if (s.ok()) s = db_->GetEnv()->RenameFile(tmp_path, path);
+  if (!s.ok()) {
+    LOG(WARNING) << "[storage] Failed to save the warmup keys, err: " << s.ToString();
+    return;
+  }
+  LOG(INFO) << "[storage] Saved " << keys.size() << " warmup keys";
+}
+
+void Storage::startWarmup() {
+  if (config_->warmup_max_keys <= 0) return;
+  warmup_stop_ = false;
+  warmup_thread_ = std::thread([this]() {
+    Util::ThreadSetName("warmup");
+    warmup();
+  });
+}
+
+void Storage::stopWarmup() {
+  warmup_stop_ = true;
+  if (warmup_thread_.joinable()) warmup_thread_.join();
+}
+
+void Storage::warmup() {
+  std::string content;
+  std::string path = config_->dir + "/" + kWarmupKeysFileName;
+  auto s = rocksdb::ReadFileToString(db_->GetEnv(), path, &content);
+  if (!s.ok()) return;
+  auto start = std::chrono::steady_clock::now();
+  rocksdb::ReadOptions read_options;
+  auto metadata_cf_handle = cf_handles_[kColumnFamilyIDMetadata];
+  // the keys are read in the small rounds, so the rate is limited smoothly
+  const uint64_t keys_per_round = 100;
+  uint64_t n_keys = 0;
+  rocksdb::Slice input(content);
+  uint32_t key_size;
+  std::string bytes;
+  while (!warmup_stop_ && GetFixed32(&input, &key_size) && input.size() >= key_size) {
+    rocksdb::Slice ns_key(input.data(), key_size);
+    input.remove_prefix(key_size);
+    s = db_->Get(read_options, metadata_cf_handle, ns_key, &bytes);
+    Metadata metadata(kRedisNone, false);
+    if (s.ok() && metadata.Decode(bytes).ok() && metadata.Type() != kRedisString) {
+      // the first subkey is read to load the index and the first data block of the key
+      std::string prefix;
+      InternalKey(ns_key, "", metadata.version).Encode(&prefix);
+      std::unique_ptr<rocksdb::Iterator> iter(db_->NewIterator(read_options, GetSubKeyCFHandle(metadata.Type())));
+      iter->Seek(prefix);
+    }
+    if (++n_keys % keys_per_round != 0) continue;
+    auto expected = std::chrono::milliseconds(n_keys * 1000 / config_->warmup_keys_per_sec);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    if (elapsed < expected) std::this_thread::sleep_for(expected - elapsed);
+  }
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  LOG(INFO) << "[storage] Warmed up " << n_keys << " keys in " << duration.count() << " ms";
+}
+
+const rocksdb::FilterPolicy *Storage::newBloomFilterPolicy(int bits_per_key) {
+  // the partitioned filters are built from the full filters instead of the block based ones
+  return rocksdb::NewBloomFilterPolicy(bits_per_key, !config_->rocksdb_options.partitioned_index_and_filters);
+}
+
+void Storage::setPartitionedIndexAndFilters(rocksdb::BlockBasedTableOptions *table_opts) {
+  if (!config_->rocksdb_options.partitioned_index_and_filters) return;
+  // the index and filter of the sst file are split into the partitions of the metadata block
+  // size, which are cached like the data blocks, and only the small top level index is
+  // loaded for each opened file, so the index and filters of the cold files could be evicted
+  table_opts->index_type = rocksdb::BlockBasedTableOptions::kTwoLevelIndexSearch;
+  table_opts->partition_filters = table_opts->filter_policy != nullptr;
+  table_opts->metadata_block_size = 4096;
+  table_opts->pin_top_level_index_and_filter = config_->rocksdb_options.pin_top_level_index_and_filter;
+}
+
+std::shared_ptr<rocksdb::Cache> Storage::newBlockCache(size_t capacity) {
+  const auto &rocksdb_options = config_->rocksdb_options;
+  if (rocksdb_options.block_cache_clock) {
+    auto cache = rocksdb::NewClockCache(capacity, -1, rocksdb_options.block_cache_strict_capacity);
+    // the clock cache is unavailable if rocksdb is built without TBB
+    if (cache) return cache;
+    LOG(WARNING) << "[storage] The clock cache isn't supported, fallback to the lru cache";
+  }
+  return rocksdb::NewLRUCache(capacity, -1, rocksdb_options.block_cache_strict_capacity,
+                              rocksdb_options.block_cache_high_pri_pool_ratio);
+}
+
+Status Storage::SetBlockCacheCapacity(const std::string &name, size_t capacity) {
+  if (!db_) return Status(Status::NotOK, "the db wasn't opened");
+  for (const auto &cache : GetBlockCaches()) {
+    if (cache.first != name) continue;
+    cache.second->SetCapacity(capacity);
+    return Status::OK();
+  }
+  return Status(Status::NotOK, "the " + name + " block cache wasn't in use");
+}
+
+std::vector<std::pair<std::string, std::shared_ptr<rocksdb::Cache>>> Storage::GetBlockCaches() {
+  std::vector<std::pair<std::string, std::shared_ptr<rocksdb::Cache>>> caches;
+  if (metadata_block_cache_ == subkey_block_cache_) {
+    caches.emplace_back("shared", metadata_block_cache_);
+  } else {
+    caches.emplace_back("metadata", metadata_block_cache_);
+    caches.emplace_back("subkey", subkey_block_cache_);
+  }
+  if (compressed_block_cache_) caches.emplace_back("compressed", compressed_block_cache_);
+  return caches;
+}
+
 Status Storage::OpenForReadOnly() {
   return Open(true);
 }
 
+// the table files are shared between the backups, so the backup only copies the new table files,
+// and they are named with the checksums since the file numbers might be reused after the db is
+// restored. The copies are limited by the backup rate limiter, apart from the flush and compaction
+rocksdb::BackupableDBOptions Storage::backupOptions() {
+  rocksdb::BackupableDBOptions bk_option(config_->backup_dir);
+  bk_option.share_table_files = true;
+  bk_option.share_files_with_checksum = true;
+  bk_option.backup_rate_limiter = backup_rate_limiter_;
+  bk_option.max_background_operations = config_->backup_threads;
+  return bk_option;
+}
+
 Status Storage::CreateBackup() {
+  // the backup engine and the checkpoint only copy the sst files from the db_dir
+  if (!config_->rocksdb_options.db_paths.empty()) {
+    return Status(Status::DBBackupErr, "the backup isn't supported with the rocksdb.db_paths");
+  }
   LOG(INFO) << "[storage] Start to create new backup";
   auto tm = std::time(nullptr);
   char time_str[25];
@@ -196,19 +649,24 @@ Status Storage::CreateBackup() {
 }
 
 Status Storage::DestroyBackup() {
+  if (!backup_) return Status();
   backup_->StopBackup();
   delete backup_;
+  backup_ = nullptr;
   return Status();
 }
 
 Status Storage::RestoreFromBackup() {
   // TODO(@ruoshan): assert role to be slave
-  // We must reopen the backup engine every time, as the files is changed
-  rocksdb::BackupableDBOptions bk_option(config_->backup_dir);
-  auto s = rocksdb::BackupEngine::Open(db_->GetEnv(), bk_option, &backup_);
+  // We must reopen the backup engine every time, as the files is changed, and the db may be
+  // closed already by the failed RestoreFromBackupFiles
+  auto s = rocksdb::BackupEngine::Open(backup_env_, backupOptions(), &backup_);
   if (!s.ok()) return Status(Status::DBBackupErr, s.ToString());
   CloseDB();
 
+  // the backup engine only replaces the files of the rocksdb
+  backup_env_->DeleteFile(config_->db_dir + "/" + kTypeCFsMigratedFileName);
+  backup_env_->DeleteFile(config_->db_dir + "/" + kIngestedSeqFileName);
   s = backup_->RestoreDBFromLatestBackup(config_->db_dir, config_->db_dir);
   if (!s.ok()) {
     LOG(ERROR) << "[storage] Failed to restore: " << s.ToString();
@@ -225,6 +683,71 @@ Status Storage::RestoreFromBackup() {
   return Status::OK();
 }
 
+static Status copyFile(rocksdb::Env *env, const std::string &src, const std::string &dst) {
+  std::unique_ptr<rocksdb::SequentialFile> rf;
+  std::unique_ptr<rocksdb::WritableFile> wf;
+  auto s = env->NewSequentialFile(src, &rf, rocksdb::EnvOptions());
+  if (s.ok()) s = env->NewWritableFile(dst, &wf, rocksdb::EnvOptions());
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  const size_t buf_size = 1024 * 1024;
+  std::unique_ptr<char[]> buf(new char[buf_size]);
+  rocksdb::Slice data;
+  do {
+    s = rf->Read(buf_size, &data, buf.get());
+    if (s.ok()) s = wf->Append(data);
+    if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  } while (data.size() > 0);
+  s = wf->Sync();
+  if (s.ok()) s = wf->Close();
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  return Status::OK();
+}
+
+// backupFileDBName returns the name of the backup file in the db dir, the shared files with
+// checksum are named as `<number>_<crc>_<size>.sst` and the others keep their names
+static std::string backupFileDBName(const std::string &rel_path) {
+  auto pos = rel_path.rfind('/');
+  std::string name = pos == std::string::npos ? rel_path : rel_path.substr(pos + 1);
+  if (rel_path.compare(0, 16, "shared_checksum/") != 0) return name;
+  auto underscore = name.find('_');
+  auto dot = name.rfind('.');
+  if (underscore == std::string::npos || dot == std::string::npos || dot < underscore) return name;
+  return name.substr(0, underscore) + name.substr(dot);
+}
+
+Status Storage::RestoreFromBackupFiles(const std::vector<std::pair<std::string, uint32_t>> &files) {
+  CloseDB();
+  std::vector<std::string> old_files;
+  backup_env_->GetChildren(config_->db_dir, &old_files);
+  for (const auto &f : old_files) {
+    if (f == "." || f == "..") continue;
+    backup_env_->DeleteFile(config_->db_dir + "/" + f);
+  }
+  for (const auto &file : files) {
+    const auto &rel_path = file.first;
+    auto src = config_->backup_dir + "/" + rel_path;
+    auto dst = config_->db_dir + "/" + backupFileDBName(rel_path);
+    // the table files are immutable, so they could be shared with the backup. the private
+    // files like the MANIFEST and the WAL might be written after the db is opened, copy them
+    bool is_shared = rel_path.compare(0, 7, "shared/") == 0 || rel_path.compare(0, 16, "shared_checksum/") == 0;
+    if (is_shared && backup_env_->LinkFile(src, dst).ok()) continue;
+    auto s = copyFile(backup_env_, src, dst);
+    if (!s.IsOK()) {
+      LOG(ERROR) << "[storage] Failed to restore the file: " << rel_path << ", err: " << s.Msg();
+      return Status(Status::DBBackupErr, s.Msg());
+    }
+  }
+  LOG(INFO) << "[storage] Restore from the backup files, count: " << files.size();
+
+  // Reopen DB
+  auto s = Open();
+  if (!s.IsOK()) {
+    LOG(ERROR) << "[storage] Failed to reopen db: " << s.Msg();
+    return Status(Status::DBOpenErr);
+  }
+  return Status::OK();
+}
+
 void Storage::PurgeOldBackups(uint32_t num_backups_to_keep, uint32_t backup_max_keep_hours) {
   std::vector<rocksdb::BackupInfo> backup_infos;
   backup_->GetBackupInfo(&backup_infos);
@@ -270,11 +793,680 @@ rocksdb::SequenceNumber Storage::LatestSeq() {
   return db_->GetLatestSequenceNumber();
 }
 
+// MetadataInvalidator drops the written metadata from the metadata cache
+class MetadataInvalidator : public rocksdb::WriteBatch::Handler {
+ public:
+  explicit MetadataInvalidator(MetadataCache *cache) : cache_(cache) {}
+  rocksdb::Status PutCF(uint32_t column_family_id, const Slice &key, const Slice &value) override {
+    if (column_family_id == kColumnFamilyIDMetadata) cache_->Erase(key);
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status DeleteCF(uint32_t column_family_id, const Slice &key) override {
+    if (column_family_id == kColumnFamilyIDMetadata) cache_->Erase(key);
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status SingleDeleteCF(uint32_t column_family_id, const Slice &key) override {
+    return DeleteCF(column_family_id, key);
+  }
+  rocksdb::Status DeleteRangeCF(uint32_t column_family_id, const Slice &begin_key, const Slice &end_key) override {
+    if (column_family_id == kColumnFamilyIDMetadata) cache_->Clear();
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status MergeCF(uint32_t column_family_id, const Slice &key, const Slice &value) override {
+    return DeleteCF(column_family_id, key);
+  }
+
+ private:
+  MetadataCache *cache_;
+};
+
+void Storage::invalidateMetadataCache(rocksdb::WriteBatch *updates) {
+  if (!metadata_cache_.Enabled()) return;
+  MetadataInvalidator invalidator(&metadata_cache_);
+  updates->Iterate(&invalidator);
+}
+
+void Storage::notifyNewWrite() {
+  // most writes have no waiter, don't touch the mutex in that case
+  if (write_waiters_.load() == 0) return;
+  {
+    std::lock_guard<std::mutex> guard(write_notify_mu_);
+  }
+  write_notify_cv_.notify_all();
+}
+
+bool Storage::WaitForNewData(rocksdb::SequenceNumber seq, int timeout_ms) {
+  if (WALHasNewData(seq)) return true;
+  write_waiters_.fetch_add(1);
+  std::unique_lock<std::mutex> lock(write_notify_mu_);
+  bool has_new_data = write_notify_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                                                [this, seq] { return WALHasNewData(seq); });
+  write_waiters_.fetch_sub(1);
+  return has_new_data;
+}
+
 rocksdb::Status Storage::Write(const rocksdb::WriteOptions &options, rocksdb::WriteBatch *updates) {
+  TraceSpanTimer timer(Trace::kStorageWrite);
   if (reach_db_size_limit_) {
     return rocksdb::Status::SpaceLimit();
   }
-  return db_->Write(options, updates);
+  if (InTxn()) {
+    txn.has_writes = true;
+    return appendToTxn(updates);
+  }
+  auto s = db_->Write(options, updates);
+  // the caller is holding the key lock, so the invalidation happens before the next writer
+  invalidateMetadataCache(updates);
+  stampWrittenKeys(updates);
+  reportWrittenKeys(updates);
+  notifyNewWrite();
+  return s;
+}
+
+rocksdb::Status Storage::WriteDeletes(const rocksdb::WriteOptions &options, rocksdb::WriteBatch *deletes) {
+  TraceSpanTimer timer(Trace::kStorageWrite);
+  if (InTxn()) return appendToTxn(deletes);
+  auto s = db_->Write(options, deletes);
+  invalidateMetadataCache(deletes);
+  stampWrittenKeys(deletes);
+  reportWrittenKeys(deletes);
+  notifyNewWrite();
+  return s;
+}
+
+rocksdb::Status Storage::Delete(const rocksdb::WriteOptions &options,
+                                rocksdb::ColumnFamilyHandle *cf_handle,
+                                const rocksdb::Slice &key) {
+  TraceSpanTimer timer(Trace::kStorageWrite);
+  auto t = currentTxn(this);
+  if (t) {
+    t->batch->Delete(cf_handle, key);
+    return rocksdb::Status::OK();
+  }
+  // deletes are allowed even if the space limit is reached, that's the way to reclaim the space
+  auto s = db_->Delete(options, cf_handle, key);
+  if (cf_handle->GetID() == kColumnFamilyIDMetadata) metadata_cache_.Erase(key);
+  if (watchers_ > 0) stampKey(cf_handle->GetID(), key);
+  if (key_trackers_ > 0) {
+    rocksdb::WriteBatch batch;
+    batch.Delete(cf_handle, key);
+    reportWrittenKeys(&batch);
+  }
+  notifyNewWrite();
+  return s;
+}
+
+rocksdb::Status Storage::DeleteRange(const rocksdb::WriteOptions &options,
+                                     rocksdb::ColumnFamilyHandle *cf_handle,
+                                     const rocksdb::Slice &begin_key,
+                                     const rocksdb::Slice &end_key) {
+  // the range deletion can't be read back from the batch with index
+  if (InTxn()) return rocksdb::Status::NotSupported("the range deletion in the transaction");
+  auto s = db_->DeleteRange(options, cf_handle, begin_key, end_key);
+  if (cf_handle->GetID() == kColumnFamilyIDMetadata) {
+    metadata_cache_.Clear();
+    // the subkey ranges are the reclaimed versions, which are invisible already
+    if (key_trackers_ > 0) written_keys_handler_({});
+  }
+  stamp_epoch_.fetch_add(1);
+  notifyNewWrite();
+  return s;
+}
+
+rocksdb::Status Storage::Get(const rocksdb::ReadOptions &options, rocksdb::ColumnFamilyHandle *cf_handle,
+                             const rocksdb::Slice &key, std::string *value) {
+  TraceSpanTimer timer(Trace::kStorageRead);
+  bool cache_only = cache_only_reads.storage == this;
+  rocksdb::ReadOptions read_options(options);
+  if (cache_only) read_options.read_tier = rocksdb::kBlockCacheTier;
+  auto t = currentTxn(this);
+  auto s = t ? t->batch->GetFromBatchAndDB(db_, read_options, cf_handle, key, value)
+             : db_->Get(read_options, cf_handle, key, value);
+  if (cache_only && s.IsIncomplete()) cache_only_reads.missed = true;
+  return s;
+}
+
+std::vector<rocksdb::Status> Storage::MultiGet(const rocksdb::ReadOptions &options,
+                                               const std::vector<rocksdb::ColumnFamilyHandle *> &cf_handles,
+                                               const std::vector<rocksdb::Slice> &keys,
+                                               std::vector<std::string> *values) {
+  TraceSpanTimer timer(Trace::kStorageRead);
+  bool cache_only = cache_only_reads.storage == this;
+  rocksdb::ReadOptions read_options(options);
+  if (cache_only) read_options.read_tier = rocksdb::kBlockCacheTier;
+  std::vector<rocksdb::Status> statuses;
+  auto t = currentTxn(this);
+  if (!t) {
+    statuses = db_->MultiGet(read_options, cf_handles, keys, values);
+  } else {
+    // the keys are read one by one in the transaction, so take a snapshot to keep them consistent
+    // like the implicit one of the MultiGet
+    const rocksdb::Snapshot *snapshot = nullptr;
+    if (!read_options.snapshot) read_options.snapshot = snapshot = db_->GetSnapshot();
+    values->resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      statuses.emplace_back(t->batch->GetFromBatchAndDB(db_, read_options, cf_handles[i], keys[i], &(*values)[i]));
+    }
+    if (snapshot) db_->ReleaseSnapshot(snapshot);
+  }
+  if (cache_only) {
+    for (const auto &s : statuses) {
+      if (s.IsIncomplete()) cache_only_reads.missed = true;
+    }
+  }
+  return statuses;
+}
+
+rocksdb::Iterator *Storage::NewIterator(const rocksdb::ReadOptions &options,
+                                        rocksdb::ColumnFamilyHandle *cf_handle) {
+  bool cache_only = cache_only_reads.storage == this;
+  rocksdb::ReadOptions read_options(options);
+  if (cache_only) read_options.read_tier = rocksdb::kBlockCacheTier;
+  SetTotalOrderIfMetadata(cf_handle, &read_options);
+  auto t = currentTxn(this);
+  rocksdb::Iterator *iter = db_->NewIterator(read_options, cf_handle);
+  if (t) {
+    // the subkey column families have the prefix extractor, the metadata seeks in the total order
+    bool has_prefix = cf_handle->GetID() != kColumnFamilyIDMetadata && cf_handle->GetID() != kColumnFamilyIDPubSub;
+    iter = new TxnIterator(t->batch->NewIteratorWithBase(cf_handle, iter), read_options, has_prefix);
+  }
+  if (cache_only) iter = new CacheOnlyIterator(iter);
+  // the iterators are only traced while they are created by the traced command
+  if (Trace::Current()) iter = new TracedIterator(iter);
+  return iter;
+}
+
+void Storage::SetTotalOrderIfMetadata(rocksdb::ColumnFamilyHandle *cf_handle, rocksdb::ReadOptions *options) {
+  if (cf_handle->GetID() != kColumnFamilyIDMetadata) return;
+  options->total_order_seek = true;
+  options->prefix_same_as_start = false;
+}
+
+void Storage::BeginCacheOnlyReads() {
+  cache_only_reads.storage = this;
+  cache_only_reads.missed = false;
+}
+
+bool Storage::EndCacheOnlyReads() {
+  bool missed = cache_only_reads.missed;
+  cache_only_reads.storage = nullptr;
+  cache_only_reads.missed = false;
+  return !missed;
+}
+
+rocksdb::ReadOptions Storage::ScanReadOptions(const rocksdb::Snapshot *snapshot,
+                                              rocksdb::ColumnFamilyHandle *cf_handle) {
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = snapshot;
+  read_options.fill_cache = false;
+  read_options.readahead_size = config_->rocksdb_options.scan_readahead_size;
+  if (cf_handle) SetTotalOrderIfMetadata(cf_handle, &read_options);
+  return read_options;
+}
+
+void Storage::BeginTxn() {
+  lock_mgr_.BeginTransaction();
+  txn.storage = this;
+  // overwrite the key in the index, or the iterator over the batch can't be used
+  txn.batch.reset(new rocksdb::WriteBatchWithIndex(rocksdb::BytewiseComparator(), 0, true));
+  txn.after_commit.clear();
+  txn.save_points.clear();
+}
+
+rocksdb::Status Storage::CommitTxn() {
+  auto t = currentTxn(this);
+  if (!t) return rocksdb::Status::OK();
+  rocksdb::Status s;
+  auto updates = t->batch->GetWriteBatch();
+  // the db may reach the size limit after the writes are appended
+  if (t->has_writes && reach_db_size_limit_) {
+    DiscardTxn();
+    return rocksdb::Status::SpaceLimit();
+  }
+  if (updates->Count() > 0) {
+    TraceSpanTimer timer(Trace::kStorageWrite);
+    s = db_->Write(rocksdb::WriteOptions(), updates);
+    invalidateMetadataCache(updates);
+    stampWrittenKeys(updates);
+    reportWrittenKeys(updates);
+    notifyNewWrite();
+  }
+  auto after_commit = std::move(t->after_commit);
+  DiscardTxn();
+  if (!s.ok()) return s;
+  for (const auto &fn : after_commit) fn();
+  return s;
+}
+
+void Storage::DiscardTxn() {
+  if (!InTxn()) return;
+  txn.storage = nullptr;
+  txn.batch.reset();
+  txn.after_commit.clear();
+  txn.save_points.clear();
+  txn.has_writes = false;
+  lock_mgr_.EndTransaction();
+}
+
+void Storage::SetTxnSavePoint() {
+  auto t = currentTxn(this);
+  if (!t) return;
+  t->batch->SetSavePoint();
+  t->save_points.emplace_back(t->after_commit.size(), t->has_writes);
+}
+
+rocksdb::Status Storage::RollbackTxnToSavePoint() {
+  auto t = currentTxn(this);
+  if (!t || t->save_points.empty()) return rocksdb::Status::NotFound("no save point");
+  auto s = t->batch->RollbackToSavePoint();
+  if (!s.ok()) return s;
+  t->after_commit.resize(t->save_points.back().first);
+  t->has_writes = t->save_points.back().second;
+  t->save_points.pop_back();
+  return s;
+}
+
+void Storage::PopTxnSavePoint() {
+  auto t = currentTxn(this);
+  if (!t || t->save_points.empty()) return;
+  t->batch->PopSavePoint();
+  t->save_points.pop_back();
+}
+
+bool Storage::InTxn() {
+  return currentTxn(this) != nullptr;
+}
+
+void Storage::RunAfterCommit(std::function<void()> fn) {
+  auto t = currentTxn(this);
+  if (!t) {
+    fn();
+    return;
+  }
+  t->after_commit.emplace_back(std::move(fn));
+}
+
+// TxnBatchAppender copies the writes of the batch into the batch of the transaction
+class TxnBatchAppender : public rocksdb::WriteBatch::Handler {
+ public:
+  explicit TxnBatchAppender(rocksdb::WriteBatchWithIndex *batch,
+                            const std::vector<rocksdb::ColumnFamilyHandle *> &cf_handles)
+      : batch_(batch), cf_handles_(cf_handles) {}
+  rocksdb::Status PutCF(uint32_t column_family_id, const Slice &key, const Slice &value) override {
+    if (column_family_id >= cf_handles_.size()) return rocksdb::Status::InvalidArgument("unknown column family");
+    batch_->Put(cf_handles_[column_family_id], key, value);
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status DeleteCF(uint32_t column_family_id, const Slice &key) override {
+    if (column_family_id >= cf_handles_.size()) return rocksdb::Status::InvalidArgument("unknown column family");
+    batch_->Delete(cf_handles_[column_family_id], key);
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status SingleDeleteCF(uint32_t column_family_id, const Slice &key) override {
+    if (column_family_id >= cf_handles_.size()) return rocksdb::Status::InvalidArgument("unknown column family");
+    batch_->SingleDelete(cf_handles_[column_family_id], key);
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status DeleteRangeCF(uint32_t column_family_id, const Slice &begin_key, const Slice &end_key) override {
+    return rocksdb::Status::NotSupported("the range deletion in the transaction");
+  }
+  rocksdb::Status MergeCF(uint32_t column_family_id, const Slice &key, const Slice &value) override {
+    if (column_family_id >= cf_handles_.size()) return rocksdb::Status::InvalidArgument("unknown column family");
+    batch_->Merge(cf_handles_[column_family_id], key, value);
+    return rocksdb::Status::OK();
+  }
+  void LogData(const Slice &blob) override {
+    batch_->PutLogData(blob);
+  }
+
+ private:
+  rocksdb::WriteBatchWithIndex *batch_;
+  const std::vector<rocksdb::ColumnFamilyHandle *> &cf_handles_;
+};
+
+rocksdb::Status Storage::appendToTxn(rocksdb::WriteBatch *updates) {
+  // the failed write shouldn't be left in the transaction, and the save point is popped
+  // after the success, otherwise it would be taken as the save point of SetTxnSavePoint
+  txn.batch->SetSavePoint();
+  TxnBatchAppender appender(txn.batch.get(), cf_handles_);
+  auto s = updates->Iterate(&appender);
+  if (!s.ok()) {
+    txn.batch->RollbackToSavePoint();
+  } else {
+    txn.batch->PopSavePoint();
+  }
+  return s;
+}
+
+// KeyStamper stamps the keys written by the batch for the watchers
+class KeyStamper : public rocksdb::WriteBatch::Handler {
+ public:
+  explicit KeyStamper(Storage *storage) : storage_(storage) {}
+  rocksdb::Status PutCF(uint32_t column_family_id, const Slice &key, const Slice &value) override {
+    storage_->stampKey(column_family_id, key);
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status DeleteCF(uint32_t column_family_id, const Slice &key) override {
+    storage_->stampKey(column_family_id, key);
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status SingleDeleteCF(uint32_t column_family_id, const Slice &key) override {
+    return DeleteCF(column_family_id, key);
+  }
+  rocksdb::Status DeleteRangeCF(uint32_t column_family_id, const Slice &begin_key, const Slice &end_key) override {
+    // the range of the subkeys inside one key, like the trimming of the stream, only stamps the key
+    if (column_family_id != kColumnFamilyIDMetadata && column_family_id != kColumnFamilyIDPubSub) {
+      InternalKey begin_ikey(begin_key), end_ikey(end_key);
+      if (begin_ikey.GetNamespace() == end_ikey.GetNamespace() && begin_ikey.GetKey() == end_ikey.GetKey()) {
+        storage_->stampKey(column_family_id, begin_key);
+        return rocksdb::Status::OK();
+      }
+    }
+    storage_->stamp_epoch_.fetch_add(1);
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status MergeCF(uint32_t column_family_id, const Slice &key, const Slice &value) override {
+    return DeleteCF(column_family_id, key);
+  }
+
+ private:
+  Storage *storage_;
+};
+
+// TypeCFWriteDetector finds the writes of the type column families in the batch
+class TypeCFWriteDetector : public rocksdb::WriteBatch::Handler {
+ public:
+  rocksdb::Status PutCF(uint32_t column_family_id, const Slice &key, const Slice &value) override {
+    return DeleteCF(column_family_id, key);
+  }
+  rocksdb::Status DeleteCF(uint32_t column_family_id, const Slice &key) override {
+    found = found || (column_family_id >= kColumnFamilyIDHash && column_family_id <= kColumnFamilyIDZSet);
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status SingleDeleteCF(uint32_t column_family_id, const Slice &key) override {
+    return DeleteCF(column_family_id, key);
+  }
+  rocksdb::Status DeleteRangeCF(uint32_t column_family_id, const Slice &begin_key, const Slice &end_key) override {
+    return DeleteCF(column_family_id, begin_key);
+  }
+  rocksdb::Status MergeCF(uint32_t column_family_id, const Slice &key, const Slice &value) override {
+    return DeleteCF(column_family_id, key);
+  }
+  bool Continue() override { return !found; }
+
+  bool found = false;
+};
+
+bool Storage::hasTypeCFWrites(rocksdb::WriteBatch *updates) {
+  TypeCFWriteDetector detector;
+  updates->Iterate(&detector);
+  return detector.found;
+}
+
+// getWrittenNsKey returns false if the entry isn't the data of a key
+static bool getWrittenNsKey(uint32_t cf_id, const Slice &key, std::string *ns_key) {
+  if (cf_id == kColumnFamilyIDPubSub || cf_id == kColumnFamilyIDZSetRank) return false;
+  if (cf_id == kColumnFamilyIDMetadata) {
+    ns_key->assign(key.data(), key.size());
+    return true;
+  }
+  // the subkeys are prefixed by the namespace and key, but encoded in another way
+  InternalKey ikey(key);
+  ComposeNamespaceKey(ikey.GetNamespace(), ikey.GetKey(), ns_key);
+  return true;
+}
+
+// WrittenKeysCollector collects the keys written by the batch for the key trackers
+class WrittenKeysCollector : public rocksdb::WriteBatch::Handler {
+ public:
+  rocksdb::Status PutCF(uint32_t column_family_id, const Slice &key, const Slice &value) override {
+    return DeleteCF(column_family_id, key);
+  }
+  rocksdb::Status DeleteCF(uint32_t column_family_id, const Slice &key) override {
+    std::string ns_key;
+    if (!getWrittenNsKey(column_family_id, key, &ns_key)) return rocksdb::Status::OK();
+    // the subkeys of the same key are mostly adjacent
+    if (ns_keys.empty() || ns_keys.back() != ns_key) ns_keys.emplace_back(std::move(ns_key));
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status SingleDeleteCF(uint32_t column_family_id, const Slice &key) override {
+    return DeleteCF(column_family_id, key);
+  }
+  rocksdb::Status DeleteRangeCF(uint32_t column_family_id, const Slice &begin_key, const Slice &end_key) override {
+    if (column_family_id == kColumnFamilyIDMetadata) all_keys = true;
+    return rocksdb::Status::OK();
+  }
+  rocksdb::Status MergeCF(uint32_t column_family_id, const Slice &key, const Slice &value) override {
+    return DeleteCF(column_family_id, key);
+  }
+
+  std::vector<std::string> ns_keys;
+  bool all_keys = false;
+};
+
+void Storage::reportWrittenKeys(rocksdb::WriteBatch *updates) {
+  if (key_trackers_ == 0) return;
+  WrittenKeysCollector collector;
+  updates->Iterate(&collector);
+  if (collector.all_keys) {
+    written_keys_handler_({});
+    return;
+  }
+  auto &ns_keys = collector.ns_keys;
+  if (ns_keys.empty()) return;
+  std::sort(ns_keys.begin(), ns_keys.end());
+  ns_keys.erase(std::unique(ns_keys.begin(), ns_keys.end()), ns_keys.end());
+  written_keys_handler_(ns_keys);
+}
+
+static size_t keyStampSlot(const Slice &ns_key, size_t slots) {
+  // FNV-1a, the same as the lock manager
+  uint32_t h = 2166136261U;
+  for (size_t i = 0; i < ns_key.size(); i++) {
+    h ^= static_cast<uint8_t>(ns_key[i]);
+    h *= 16777619U;
+  }
+  return h & (slots - 1);
+}
+
+void Storage::stampWrittenKeys(rocksdb::WriteBatch *updates) {
+  if (watchers_ == 0) return;
+  KeyStamper stamper(this);
+  updates->Iterate(&stamper);
+}
+
+void Storage::stampKey(uint32_t cf_id, const rocksdb::Slice &key) {
+  if (cf_id == kColumnFamilyIDPubSub) return;
+  if (cf_id == kColumnFamilyIDMetadata) {
+    key_stamps_[keyStampSlot(key, kKeyStampSlots)].fetch_add(1);
+    return;
+  }
+  // decode the subkey to stamp the slot of its user key
+  InternalKey ikey(key);
+  std::string ns_key;
+  ComposeNamespaceKey(ikey.GetNamespace(), ikey.GetKey(), &ns_key);
+  key_stamps_[keyStampSlot(ns_key, kKeyStampSlots)].fetch_add(1);
+}
+
+uint64_t Storage::GetKeyStamp(const rocksdb::Slice &ns_key) {
+  return key_stamps_[keyStampSlot(ns_key, kKeyStampSlots)].load() + stamp_epoch_.load();
+}
+
+bool Storage::cfHasData(rocksdb::ColumnFamilyHandle *cf_handle) {
+  rocksdb::ReadOptions read_options;
+  read_options.fill_cache = false;
+  read_options.total_order_seek = true;
+  std::unique_ptr<rocksdb::Iterator> iter(db_->NewIterator(read_options, cf_handle));
+  iter->SeekToFirst();
+  return iter->Valid();
+}
+
+// openTypeCFs decides whether the subkeys live in the type column families. The read only
+// open(kvrocks2redis) and the slaves follow the existing layout, since the slaves get it from
+// the writes or the full sync of the master. On the master the config decides it, and the
+// subkeys left in the default column family are migrated once.
+Status Storage::openTypeCFs(bool read_only) {
+  bool has_type_data = false;
+  for (size_t i = 0; i < kTypeColumnFamilies.size() && !has_type_data; i++) {
+    has_type_data = cfHasData(cf_handles_[kColumnFamilyIDHash + i]);
+  }
+  if (read_only || !config_->master_host.empty()) {
+    type_cfs_enabled_ = has_type_data;
+    return Status::OK();
+  }
+  if (!config_->type_column_families) {
+    if (has_type_data) {
+      return Status(Status::DBOpenErr,
+                    "the subkeys are in the type column families, type-column-families can't be disabled");
+    }
+    type_cfs_enabled_ = false;
+    return Status::OK();
+  }
+  type_cfs_enabled_ = true;
+  auto env = db_->GetEnv();
+  std::string marker_path = config_->db_dir + "/" + kTypeCFsMigratedFileName;
+  if (env->FileExists(marker_path).ok()) return Status::OK();
+  if (cfHasData(cf_handles_[kColumnFamilyIDDefault])) {
+    auto status = migrateSubKeysToTypeCFs();
+    if (!status.IsOK()) return status;
+  }
+  auto s = rocksdb::WriteStringToFile(env, "", marker_path, true);
+  if (!s.ok()) return Status(Status::DBOpenErr, s.ToString());
+  return Status::OK();
+}
+
+// migrateSubKeysToTypeCFs moves the subkeys in the default column family into the column
+// family of their type and drops the stale subkeys. The subkeys of the types without their own
+// column family, like the stream, stay in the default column family. It runs before serving,
+// and the moves are written into the WAL so the slaves follow.
+Status Storage::migrateSubKeysToTypeCFs() {
+  LOG(INFO) << "[storage] Start to migrate the subkeys into the type column families";
+  auto start = std::chrono::high_resolution_clock::now();
+  const size_t max_batch_bytes = 16 * MiB;
+  auto default_cf_handle = cf_handles_[kColumnFamilyIDDefault];
+  rocksdb::ReadOptions read_options;
+  read_options.fill_cache = false;
+  read_options.total_order_seek = true;
+  std::unique_ptr<rocksdb::Iterator> iter(db_->NewIterator(read_options, default_cf_handle));
+
+  rocksdb::WriteBatch batch;
+  std::string ns_key, last_ns_key, bytes, first_key, last_key;
+  rocksdb::ColumnFamilyHandle *type_cf_handle = nullptr;
+  uint64_t version = 0, n_moved = 0, n_dropped = 0, n_kept = 0;
+  // the moved and stale subkeys between the kept ones are removed by one range deletion
+  auto deleteRange = [&] {
+    if (first_key.empty()) return;
+    last_key.push_back('\0');
+    batch.DeleteRange(default_cf_handle, first_key, last_key);
+    first_key.clear();
+  };
+  rocksdb::Status s;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    InternalKey ikey(iter->key());
+    ComposeNamespaceKey(ikey.GetNamespace(), ikey.GetKey(), &ns_key);
+    if (ns_key != last_ns_key) {
+      last_ns_key = ns_key;
+      type_cf_handle = nullptr;
+      s = db_->Get(read_options, cf_handles_[kColumnFamilyIDMetadata], ns_key, &bytes);
+      if (!s.ok() && !s.IsNotFound()) break;
+      Metadata metadata(kRedisNone, false);
+      if (s.ok() && metadata.Decode(bytes).ok() && metadata.Type() != kRedisString) {
+        type_cf_handle = GetSubKeyCFHandle(metadata.Type());
+        version = metadata.version;
+      }
+      s = rocksdb::Status::OK();
+    }
+    bool live = type_cf_handle != nullptr && ikey.GetVersion() == version;
+    if (live && type_cf_handle == default_cf_handle) {
+      deleteRange();
+      n_kept++;
+      continue;
+    }
+    if (first_key.empty()) first_key = iter->key().ToString();
+    last_key = iter->key().ToString();
+    if (!live) {
+      n_dropped++;
+      continue;
+    }
+    batch.Put(type_cf_handle, iter->key(), iter->value());
+    n_moved++;
+    if (batch.GetDataSize() >= max_batch_bytes) {
+      s = db_->Write(rocksdb::WriteOptions(), &batch);
+      if (!s.ok()) break;
+      batch.Clear();
+    }
+  }
+  if (s.ok()) s = iter->status();
+  if (s.ok()) {
+    deleteRange();
+    s = db_->Write(rocksdb::WriteOptions(), &batch);
+  }
+  iter.reset();
+  // compact the default column family to drop the tombstones
+  if (s.ok() && n_moved + n_dropped > 0) {
+    s = db_->CompactRange(rocksdb::CompactRangeOptions(), default_cf_handle, nullptr, nullptr);
+  }
+  if (!s.ok()) {
+    LOG(ERROR) << "[storage] Failed to migrate the subkeys, err: " << s.ToString();
+    return Status(Status::DBOpenErr, s.ToString());
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  int64_t duration = std::chrono::duration_cast<std::chrono::milliseconds>(end-start).count();
+  LOG(INFO) << "[storage] Success to migrate the subkeys, moved: " << n_moved << ", dropped: " << n_dropped
+            << ", kept: " << n_kept << ", cost: " << duration << " ms";
+  return Status::OK();
+}
+
+void Storage::AddReclaimRange(const std::string &begin, const std::string &end, RedisType type) {
+  // the range of the key deleted in the transaction can't be reclaimed before it is committed
+  if (InTxn()) {
+    RunAfterCommit([this, begin, end, type] { AddReclaimRange(begin, end, type); });
+    return;
+  }
+  // the subkeys would be still removed by the compaction filter if the queue is full
+  const size_t max_pending_ranges = 100000;
+  std::lock_guard<std::mutex> guard(reclaim_mu_);
+  if (reclaim_ranges_.size() >= max_pending_ranges) return;
+  reclaim_ranges_.emplace_back(ReclaimRange{begin, end, type});
+}
+
+size_t Storage::GetReclaimPendingNum() {
+  std::lock_guard<std::mutex> guard(reclaim_mu_);
+  return reclaim_ranges_.size();
+}
+
+size_t Storage::ReclaimRanges(size_t max_ranges) {
+  if (!IncrDBRefs().IsOK()) return 0;
+  std::vector<ReclaimRange> ranges;
+  {
+    std::lock_guard<std::mutex> guard(reclaim_mu_);
+    while (!reclaim_ranges_.empty() && ranges.size() < max_ranges) {
+      ranges.emplace_back(std::move(reclaim_ranges_.front()));
+      reclaim_ranges_.pop_front();
+    }
+  }
+  for (const auto &range : ranges) {
+    std::vector<rocksdb::ColumnFamilyHandle *> cf_handles = {GetSubKeyCFHandle(range.type)};
+    if (range.type == kRedisZSet) {
+      cf_handles.emplace_back(cf_handles_[kColumnFamilyIDZSetScore]);
+      cf_handles.emplace_back(cf_handles_[kColumnFamilyIDZSetRank]);
+    }
+    rocksdb::WriteBatch batch;
+    for (auto cf_handle : cf_handles) batch.DeleteRange(cf_handle, range.begin, range.end);
+    // never blocked by the space limit
+    auto s = WriteDeletes(rocksdb::WriteOptions(), &batch);
+    if (!s.ok()) {
+      LOG(WARNING) << "[storage] Failed to reclaim the range, err: " << s.ToString();
+      continue;
+    }
+    // drop the sst files which are fully covered by the range, so the space is reclaimed
+    // without compacting them, the end is excluded like the end of the range deletion
+    rocksdb::Slice begin(range.begin), end(range.end);
+    for (auto cf_handle : cf_handles) rocksdb::DeleteFilesInRange(db_, cf_handle, &begin, &end, false);
+    reclaimed_ranges_.fetch_add(1);
+  }
+  DecrDBRefs();
+  return ranges.size();
 }
 
 Status Storage::WriteBatch(std::string &&raw_batch) {
@@ -283,6 +1475,15 @@ Status Storage::WriteBatch(std::string &&raw_batch) {
   }
   auto bat = rocksdb::WriteBatch(std::move(raw_batch));
   auto s = db_->Write(rocksdb::WriteOptions(), &bat);
+  // the slave switches to the type column families once the master writes them
+  if (s.ok() && !type_cfs_enabled_ && hasTypeCFWrites(&bat)) {
+    LOG(INFO) << "[storage] The master writes the type column families, enable them";
+    type_cfs_enabled_ = true;
+  }
+  invalidateMetadataCache(&bat);
+  stampWrittenKeys(&bat);
+  reportWrittenKeys(&bat);
+  notifyNewWrite();
   if (!s.ok()) {
     return Status(Status::NotOK, s.ToString());
   }
@@ -296,10 +1497,28 @@ rocksdb::ColumnFamilyHandle *Storage::GetCFHandle(const std::string &name) {
     return cf_handles_[2];
   } else if (name == kPubSubColumnFamilyName) {
     return cf_handles_[3];
+  } else if (name == kZSetRankColumnFamilyName) {
+    return cf_handles_[4];
+  } else if (name == kBlobColumnFamilyName) {
+    return cf_handles_[kColumnFamilyIDBlob];
+  }
+  for (size_t i = 0; i < kTypeColumnFamilies.size(); i++) {
+    if (name == kTypeColumnFamilies[i].second) return cf_handles_[kColumnFamilyIDHash + i];
   }
   return cf_handles_[0];
 }
 
+rocksdb::ColumnFamilyHandle *Storage::GetSubKeyCFHandle(RedisType type) {
+  // the segments of the hyperloglog are laid out like the bitmap, so they share the column family
+  if (type == kRedisHyperLogLog) type = kRedisBitmap;
+  if (type_cfs_enabled_) {
+    for (size_t i = 0; i < kTypeColumnFamilies.size(); i++) {
+      if (type == kTypeColumnFamilies[i].first) return cf_handles_[kColumnFamilyIDHash + i];
+    }
+  }
+  return cf_handles_[kColumnFamilyIDDefault];
+}
+
 rocksdb::Status Storage::Compact(const Slice *begin, const Slice *end) {
   rocksdb::CompactRangeOptions compact_opts;
   compact_opts.change_level = true;
@@ -311,10 +1530,58 @@ rocksdb::Status Storage::Compact(const Slice *begin, const Slice *end) {
   return rocksdb::Status::OK();
 }
 
+Status Storage::IngestSSTFiles(const std::string &cf_name, const std::vector<std::string> &files) {
+  if (reach_db_size_limit_) return Status(Status::NotOK, "reach the db size limit");
+  rocksdb::ColumnFamilyHandle *cf_handle = nullptr;
+  for (auto handle : cf_handles_) {
+    if (handle->GetName() == cf_name) cf_handle = handle;
+  }
+  if (!cf_handle || cf_name == kPubSubColumnFamilyName) {
+    return Status(Status::NotOK, "unknown column family: " + cf_name);
+  }
+  rocksdb::IngestExternalFileOptions ingest_opts;
+  // the files are linked into the db instead of copied if they are in the same file system
+  ingest_opts.move_files = true;
+  // the files ingested before the failed one are kept, so the ingestion could be resumed from it
+  Status result = Status::OK();
+  for (const auto &file : files) {
+    auto s = db_->IngestExternalFile(cf_handle, {file}, ingest_opts);
+    if (!s.ok()) {
+      result = Status(Status::NotOK, "failed to ingest " + file + ", err: " + s.ToString());
+      break;
+    }
+    LOG(INFO) << "[storage] Success to ingest the sst file: " << file << " into " << cf_name;
+  }
+  // the ingestion takes no sequence unless the files overlap the data in the db, so a marker
+  // is written to tell the slaves synced before the ingestion from the ones synced after it
+  rocksdb::WriteBatch marker;
+  marker.Delete(cf_handles_[kColumnFamilyIDPubSub], Slice());
+  auto s = db_->Write(rocksdb::WriteOptions(), &marker);
+  if (!s.ok() && result.IsOK()) result = Status(Status::NotOK, s.ToString());
+  ingested_seq_ = LatestSeq();
+  // the sequence is persisted, or the slaves synced before the ingestion could resume by the
+  // psync after a restart
+  auto status = saveIngestedSeq(ingested_seq_);
+  if (!status.IsOK() && result.IsOK()) result = status;
+  // the ingested metadata is never seen by the invalidation of the writes
+  if (cf_handle->GetID() == kColumnFamilyIDMetadata) metadata_cache_.Clear();
+  stamp_epoch_.fetch_add(1);
+  return result;
+}
+
 uint64_t Storage::GetTotalSize() {
   return sst_file_manager_->GetTotalSize();
 }
 
+void Storage::GetDBPathSizes(std::map<std::string, uint64_t> *sizes) {
+  sizes->clear();
+  if (config_->rocksdb_options.db_paths.empty()) return;
+  for (const auto &path : config_->rocksdb_options.db_paths) (*sizes)[path.first] = 0;
+  std::vector<rocksdb::LiveFileMetaData> files;
+  db_->GetLiveFilesMetaData(&files);
+  for (const auto &file : files) (*sizes)[file.db_path] += file.size;
+}
+
 Status Storage::CheckDBSizeLimit() {
   bool reach_db_size_limit;
   if (config_->max_db_size == 0) {
@@ -335,6 +1602,13 @@ Status Storage::CheckDBSizeLimit() {
   return Status::OK();
 }
 
+void Storage::SetWriteStallCondition(rocksdb::WriteStallCondition prev, rocksdb::WriteStallCondition cur) {
+  if (prev == rocksdb::WriteStallCondition::kStopped) write_stopped_cfs_.fetch_sub(1);
+  if (prev == rocksdb::WriteStallCondition::kDelayed) write_delayed_cfs_.fetch_sub(1);
+  if (cur == rocksdb::WriteStallCondition::kStopped) write_stopped_cfs_.fetch_add(1);
+  if (cur == rocksdb::WriteStallCondition::kDelayed) write_delayed_cfs_.fetch_add(1);
+}
+
 void Storage::SetIORateLimit(uint64_t max_io_mb) {
   if (max_io_mb == 0) {
     max_io_mb = kIORateLimitMaxMb;
@@ -342,6 +1616,121 @@ void Storage::SetIORateLimit(uint64_t max_io_mb) {
   rate_limiter_->SetBytesPerSecond(max_io_mb * MiB);
 }
 
+void Storage::loadIngestedSeq() {
+  std::string content;
+  ingested_seq_ = 0;
+  auto s = rocksdb::ReadFileToString(backup_env_, config_->db_dir + "/" + kIngestedSeqFileName, &content);
+  if (!s.ok()) return;
+  ingested_seq_ = std::strtoull(content.c_str(), nullptr, 10);
+}
+
+Status Storage::saveIngestedSeq(rocksdb::SequenceNumber seq) {
+  std::string path = config_->db_dir + "/" + kIngestedSeqFileName;
+  std::string tmp_path = path + ".tmp";
+  auto s = rocksdb::WriteStringToFile(backup_env_, std::to_string(seq) + "\n", tmp_path, true);
+  if (s.ok()) s = backup_env_->RenameFile(tmp_path, path);
+  if (!s.ok()) {
+    LOG(WARNING) << "[storage] Failed to save the ingested sequence, err: " << s.ToString();
+    return Status(Status::NotOK, s.ToString());
+  }
+  return Status::OK();
+}
+
+void Storage::loadReplicationID() {
+  std::string content;
+  auto s = rocksdb::ReadFileToString(backup_env_, config_->dir + "/" + kReplicationIDFileName, &content);
+  if (!s.ok()) return;
+  std::istringstream input(content);
+  ReplicationID replid;
+  input >> replid.id >> replid.prev_id >> replid.prev_id_last_seq;
+  // the prev id is written as "?" if there's none
+  if (replid.id == "?") replid.id.clear();
+  if (replid.prev_id == "?") replid.prev_id.clear();
+  std::lock_guard<std::mutex> guard(replid_mu_);
+  replid_ = replid;
+}
+
+Status Storage::saveReplicationID(const ReplicationID &replid) {
+  std::string content = (replid.id.empty() ? "?" : replid.id) + "\n" +
+                        (replid.prev_id.empty() ? "?" : replid.prev_id) + "\n" +
+                        std::to_string(replid.prev_id_last_seq) + "\n";
+  std::string path = config_->dir + "/" + kReplicationIDFileName;
+  std::string tmp_path = path + ".tmp";
+  auto s = rocksdb::WriteStringToFile(backup_env_, content, tmp_path, true);
+  if (s.ok()) s = backup_env_->RenameFile(tmp_path, path);
+  if (!s.ok()) {
+    LOG(WARNING) << "[storage] Failed to save the replication id, err: " << s.ToString();
+    return Status(Status::NotOK, s.ToString());
+  }
+  return Status::OK();
+}
+
+static std::string newReplicationID() {
+  static const char kHexChars[] = "0123456789abcdef";
+  std::random_device rd;
+  std::mt19937_64 engine((static_cast<uint64_t>(rd()) << 32) | rd());
+  std::string id(40, '0');
+  for (auto &c : id) c = kHexChars[engine() % 16];
+  return id;
+}
+
+Storage::ReplicationID Storage::GetReplicationID() {
+  std::lock_guard<std::mutex> guard(replid_mu_);
+  return replid_;
+}
+
+std::string Storage::EnsureReplicationID() {
+  std::lock_guard<std::mutex> guard(replid_mu_);
+  // the id is created once it is asked by the slaves, so the nodes upgraded from the versions
+  // without the id adopt the id of their master instead of making the fullsync
+  if (replid_.id.empty()) {
+    replid_.id = newReplicationID();
+    saveReplicationID(replid_);
+  }
+  return replid_.id;
+}
+
+void Storage::SetReplicationID(const std::string &id) {
+  std::lock_guard<std::mutex> guard(replid_mu_);
+  if (replid_.id == id) return;
+  LOG(INFO) << "[storage] The replication id was changed from " << replid_.id << " to " << id;
+  // the history of the former id is never continued by the slave
+  replid_.id = id;
+  replid_.prev_id.clear();
+  replid_.prev_id_last_seq = 0;
+  saveReplicationID(replid_);
+}
+
+void Storage::ShiftReplicationID() {
+  std::lock_guard<std::mutex> guard(replid_mu_);
+  replid_.prev_id = replid_.id;
+  replid_.prev_id_last_seq = LatestSeq();
+  replid_.id = newReplicationID();
+  LOG(INFO) << "[storage] The replication id was shifted to " << replid_.id << ", the former id "
+            << replid_.prev_id << " was valid til the sequence " << replid_.prev_id_last_seq;
+  saveReplicationID(replid_);
+}
+
+Status Storage::CheckReplicationID(const std::string &id, rocksdb::SequenceNumber next_seq) {
+  if (id.empty()) return Status::OK();
+  auto replid = GetReplicationID();
+  if (id == replid.id) return Status::OK();
+  // the slave of the former master could continue til the sequence where the id is shifted,
+  // the writes after that on the former master are never seen by this one
+  if (!replid.prev_id.empty() && id == replid.prev_id) {
+    if (next_seq <= replid.prev_id_last_seq + 1) return Status::OK();
+    return Status(Status::NotOK, "the sequence was beyond the history of the replication id");
+  }
+  return Status(Status::NotOK, "the replication id was mismatched");
+}
+
+void Storage::SetBackupRateLimit(uint64_t max_backup_mb) {
+  if (max_backup_mb == 0) {
+    max_backup_mb = kIORateLimitMaxMb;
+  }
+  backup_rate_limiter_->SetBytesPerSecond(max_backup_mb * MiB);
+}
+
 rocksdb::DB *Storage::GetDB() { return db_; }
 
 Status Storage::IncrDBRefs() {
@@ -409,6 +1798,32 @@ int Storage::BackupManager::OpenDataFile(Storage *storage, const std::string &re
   return rv;
 }
 
+Status Storage::BackupManager::ReadDataFileChunk(Storage *storage, const std::string &rel_path,
+                                                 uint64_t offset, size_t len, std::string *data) {
+  uint64_t file_size = 0;
+  int fd = OpenDataFile(storage, rel_path, &file_size);
+  if (fd < 0) return Status(Status::NotOK, "failed to open the data file");
+  storage->touchCheckpoint(rel_path);
+  data->clear();
+  if (offset > file_size) {
+    close(fd);
+    return Status(Status::NotOK, "the offset was out of the file range");
+  }
+  data->resize(std::min(static_cast<uint64_t>(len), file_size - offset));
+  size_t n = 0;
+  while (n < data->size()) {
+    ssize_t nread = pread(fd, &(*data)[n], data->size() - n, offset + n);
+    if (nread <= 0) {
+      if (nread < 0 && errno == EINTR) continue;
+      close(fd);
+      return Status(Status::NotOK, nread < 0 ? strerror(errno) : "unexpected end of file");
+    }
+    n += nread;
+  }
+  close(fd);
+  return Status::OK();
+}
+
 Storage::BackupManager::MetaInfo Storage::BackupManager::ParseMetaAndSave(
     Storage *storage, rocksdb::BackupID meta_id, evbuffer *evbuf) {
   char *line;
@@ -463,6 +1878,21 @@ Storage::BackupManager::MetaInfo Storage::BackupManager::ParseMetaAndSave(
   return meta;
 }
 
+std::vector<std::pair<std::string, uint32_t>> Storage::BackupManager::ParseCheckpointMeta(evbuffer *evbuf) {
+  std::vector<std::pair<std::string, uint32_t>> files;
+  char *line;
+  size_t len;
+  while ((line = evbuffer_readln(evbuf, &len, EVBUFFER_EOL_LF))) {
+    DLOG(INFO) << "[checkpoint] file info: " << line;
+    auto space = strchr(line, ' ');
+    if (space) {
+      files.emplace_back(std::string(line, space - line), std::strtoul(space + 1, nullptr, 10));
+    }
+    free(line);
+  }
+  return files;
+}
+
 Status MkdirRecursively(rocksdb::Env *env, const std::string &dir) {
   if (env->CreateDirIfMissing(dir).ok()) return Status::OK();
 
@@ -501,6 +1931,47 @@ std::unique_ptr<rocksdb::WritableFile> Storage::BackupManager::NewTmpFile(
   return wf;
 }
 
+// fileCrc computes the crc32c of the whole file
+static Status fileCrc(rocksdb::Env *env, const std::string &path, uint64_t *size, uint32_t *crc) {
+  std::unique_ptr<rocksdb::SequentialFile> rf;
+  auto s = env->NewSequentialFile(path, &rf, rocksdb::EnvOptions());
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  *size = 0;
+  *crc = 0;
+  const size_t buf_size = 1024 * 1024;
+  std::unique_ptr<char[]> buf(new char[buf_size]);
+  rocksdb::Slice data;
+  do {
+    s = rf->Read(buf_size, &data, buf.get());
+    if (!s.ok()) return Status(Status::NotOK, s.ToString());
+    *crc = rocksdb::crc32c::Extend(*crc, data.data(), data.size());
+    *size += data.size();
+  } while (data.size() > 0);
+  return Status::OK();
+}
+
+std::unique_ptr<rocksdb::WritableFile> Storage::BackupManager::ReopenTmpFile(
+    Storage *storage, const std::string &rel_path, uint64_t *offset, uint32_t *crc) {
+  *offset = 0;
+  *crc = 0;
+  std::string tmp_path = storage->config_->backup_dir + "/" + rel_path + ".tmp";
+  if (!storage->backup_env_->FileExists(tmp_path).ok()) {
+    return NewTmpFile(storage, rel_path);
+  }
+  if (!fileCrc(storage->backup_env_, tmp_path, offset, crc).IsOK()) {
+    return NewTmpFile(storage, rel_path);
+  }
+  std::unique_ptr<rocksdb::WritableFile> wf;
+  auto s = storage->backup_env_->ReopenWritableFile(tmp_path, &wf, rocksdb::EnvOptions());
+  if (!s.ok()) {
+    LOG(WARNING) << "[storage] Failed to reopen the tmp file: " << s.ToString() << ", would fetch it again";
+    *offset = 0;
+    *crc = 0;
+    return NewTmpFile(storage, rel_path);
+  }
+  return wf;
+}
+
 Status Storage::BackupManager::SwapTmpFile(Storage *storage,
                                            const std::string &rel_path) {
   std::string tmp_path = storage->config_->backup_dir + "/" + rel_path + ".tmp";
@@ -511,9 +1982,13 @@ Status Storage::BackupManager::SwapTmpFile(Storage *storage,
   return Status::OK();
 }
 
-bool Storage::BackupManager::FileExists(Storage *storage, const std::string &rel_path) {
-  auto s = storage->backup_env_->FileExists(storage->config_->backup_dir + "/" + rel_path);
-  return s.ok();
+bool Storage::BackupManager::FileExists(Storage *storage, const std::string &rel_path, uint32_t crc) {
+  std::string path = storage->config_->backup_dir + "/" + rel_path;
+  if (!storage->backup_env_->FileExists(path).ok()) return false;
+  // the file with the same name might be broken or from another backup, check the crc to reuse it
+  uint64_t size;
+  uint32_t file_crc;
+  return fileCrc(storage->backup_env_, path, &size, &file_crc).IsOK() && file_crc == crc;
 }
 
 bool isDir(const char* name) {
@@ -579,4 +2054,141 @@ void Storage::PurgeBackupIfNeed(uint32_t next_backup_id) {
     rocksdb::Env::Default()->CreateDirIfMissing(config_->backup_dir);
   }
 }
+static const char *kCheckpointDir = "checkpoint";
+
+Status Storage::CreateCheckpoint(std::string *checkpoint_id,
+                                 std::vector<std::pair<std::string, uint32_t>> *files) {
+  if (!config_->rocksdb_options.db_paths.empty()) {
+    return Status(Status::DBBackupErr, "the checkpoint isn't supported with the rocksdb.db_paths");
+  }
+  std::string rel_dir, dir;
+  {
+    std::lock_guard<std::mutex> guard(checkpoint_mu_);
+    *checkpoint_id = std::to_string(LatestSeq());
+    rel_dir = std::string(kCheckpointDir) + "/" + *checkpoint_id;
+    dir = config_->backup_dir + "/" + rel_dir;
+    // no new writes since the checkpoint is created, the slaves can share it
+    if (!backup_env_->FileExists(dir).ok()) {
+      LOG(INFO) << "[storage] Start to create new checkpoint: " << *checkpoint_id;
+      if (!MkdirRecursively(backup_env_, config_->backup_dir + "/" + kCheckpointDir).IsOK()) {
+        return Status(Status::DBBackupErr, "failed to create the checkpoint dir");
+      }
+      rocksdb::Checkpoint *checkpoint = nullptr;
+      auto s = rocksdb::Checkpoint::Create(db_, &checkpoint);
+      if (!s.ok()) return Status(Status::DBBackupErr, s.ToString());
+      std::unique_ptr<rocksdb::Checkpoint> checkpoint_guard(checkpoint);
+      // the memtable would be flushed before creating the checkpoint, so no WAL is needed
+      s = checkpoint->CreateCheckpoint(dir, 0);
+      if (!s.ok()) return Status(Status::DBBackupErr, s.ToString());
+      LOG(INFO) << "[storage] Success to create new checkpoint: " << *checkpoint_id;
+    }
+    checkpoint_access_[*checkpoint_id] = std::time(nullptr);
+  }
+
+  // the checkpoint files are immutable, so the crcs are computed without blocking the other slaves
+  std::vector<std::string> children;
+  auto s = backup_env_->GetChildren(dir, &children);
+  if (!s.ok()) return Status(Status::DBBackupErr, s.ToString());
+  files->clear();
+  for (const auto &child : children) {
+    if (child == "." || child == "..") continue;
+    uint64_t size;
+    uint32_t crc;
+    auto status = fileCrc(backup_env_, dir + "/" + child, &size, &crc);
+    if (!status.IsOK()) return Status(Status::DBBackupErr, status.Msg());
+    files->emplace_back(rel_dir + "/" + child, crc);
+  }
+  return Status::OK();
+}
+
+void Storage::BackupManager::PurgeCheckpoints(Storage *storage, const std::string &keep_id) {
+  std::string dir = storage->config_->backup_dir + "/" + kCheckpointDir;
+  std::vector<std::string> children;
+  if (!storage->backup_env_->GetChildren(dir, &children).ok()) return;
+  for (const auto &child : children) {
+    if (child == "." || child == ".." || child == keep_id) continue;
+    RmdirRecursively(storage->backup_env_, dir + "/" + child);
+  }
+}
+
+void Storage::touchCheckpoint(const std::string &rel_path) {
+  size_t prefix_len = strlen(kCheckpointDir) + 1;
+  if (rel_path.compare(0, prefix_len, std::string(kCheckpointDir) + "/") != 0) return;
+  auto id = rel_path.substr(prefix_len, rel_path.find('/', prefix_len) - prefix_len);
+  std::lock_guard<std::mutex> guard(checkpoint_mu_);
+  auto iter = checkpoint_access_.find(id);
+  if (iter != checkpoint_access_.end()) iter->second = std::time(nullptr);
+}
+
+void Storage::PurgeIdleCheckpoints(int max_idle_seconds) {
+  std::lock_guard<std::mutex> guard(checkpoint_mu_);
+  auto now = std::time(nullptr);
+  for (auto iter = checkpoint_access_.begin(); iter != checkpoint_access_.end();) {
+    if (iter->second + max_idle_seconds >= now) {
+      iter++;
+      continue;
+    }
+    LOG(INFO) << "[storage] The checkpoint(id: " << iter->first << ") would be purged because idle";
+    RmdirRecursively(backup_env_, config_->backup_dir + "/" + kCheckpointDir + "/" + iter->first);
+    iter = checkpoint_access_.erase(iter);
+  }
+}
+
+// moveFile renames the file, or copies it if they are not in the same filesystem
+static Status moveFile(rocksdb::Env *env, const std::string &src, const std::string &dst) {
+  if (env->RenameFile(src, dst).ok()) return Status::OK();
+  auto s = copyFile(env, src, dst);
+  if (!s.IsOK()) return s;
+  env->DeleteFile(src);
+  return Status::OK();
+}
+
+Status Storage::RestoreFromCheckpoint(const std::string &checkpoint_id) {
+  std::string checkpoint_dir = config_->backup_dir + "/" + kCheckpointDir + "/" + checkpoint_id;
+  std::vector<std::string> files;
+  auto s = backup_env_->GetChildren(checkpoint_dir, &files);
+  if (!s.ok()) return Status(Status::DBBackupErr, s.ToString());
+  DestroyBackup();
+  CloseDB();
+
+  // Move the checkpoint files into a temp dir first, and swap it with the db dir by renaming,
+  // so the old db files are kept until the checkpoint is fully moved in.
+  std::string tmp_dir = config_->db_dir + ".restoring";
+  std::string old_dir = config_->db_dir + ".old";
+  RmdirRecursively(backup_env_, tmp_dir);
+  RmdirRecursively(backup_env_, old_dir);
+  auto status = MkdirRecursively(backup_env_, tmp_dir);
+  for (const auto &f : files) {
+    if (!status.IsOK()) break;
+    if (f == "." || f == "..") continue;
+    status = moveFile(backup_env_, checkpoint_dir + "/" + f, tmp_dir + "/" + f);
+  }
+  if (status.IsOK()) {
+    s = backup_env_->RenameFile(config_->db_dir, old_dir);
+    if (s.ok()) {
+      s = backup_env_->RenameFile(tmp_dir, config_->db_dir);
+      if (!s.ok()) backup_env_->RenameFile(old_dir, config_->db_dir);
+    }
+    if (!s.ok()) status = Status(Status::NotOK, s.ToString());
+  }
+  if (!status.IsOK()) {
+    LOG(ERROR) << "[storage] Failed to restore: " << status.Msg();
+    RmdirRecursively(backup_env_, tmp_dir);
+    // the old db files are untouched, reopen them
+    auto s2 = Open();
+    if (!s2.IsOK()) LOG(ERROR) << "[storage] Failed to reopen db: " << s2.Msg();
+    return Status(Status::DBBackupErr, status.Msg());
+  }
+  RmdirRecursively(backup_env_, old_dir);
+  RmdirRecursively(backup_env_, checkpoint_dir);
+  LOG(INFO) << "[storage] Restore from checkpoint: " << checkpoint_id;
+
+  // Reopen DB
+  auto s2 = Open();
+  if (!s2.IsOK()) {
+    LOG(ERROR) << "[storage] Failed to reopen db: " << s2.Msg();
+    return Status(Status::DBOpenErr);
+  }
+  return Status::OK();
+}
 }  // namespace Engine
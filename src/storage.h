@@ -1,25 +1,47 @@
 #pragma once
 
 #include <inttypes.h>
+#include <rocksdb/cache.h>
 #include <rocksdb/db.h>
+#include <rocksdb/listener.h>
 #include <rocksdb/options.h>
+#include <rocksdb/table.h>
 #include <rocksdb/utilities/backupable_db.h>
 #include <event2/bufferevent.h>
 #include <utility>
 #include <memory>
 #include <string>
 #include <vector>
+#include <deque>
+#include <map>
+#include <set>
 #include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
 
 #include "status.h"
 #include "lock_manager.h"
+#include "redis_metadata.h"
+#include "metadata_cache.h"
+#include "scan_iterator_cache.h"
 #include "config.h"
+#include "background_job_stats.h"
 
 enum ColumnFamilyID{
   kColumnFamilyIDDefault,
   kColumnFamilyIDMetadata,
   kColumnFamilyIDZSetScore,
   kColumnFamilyIDPubSub,
+  kColumnFamilyIDZSetRank,
+  kColumnFamilyIDHash,
+  kColumnFamilyIDSet,
+  kColumnFamilyIDList,
+  kColumnFamilyIDBitmap,
+  kColumnFamilyIDSortedint,
+  kColumnFamilyIDZSet,
+  kColumnFamilyIDBlob,
 };
 
 namespace Engine {
@@ -29,7 +51,10 @@ class Storage {
   explicit Storage(Config *config)
       :backup_env_(rocksdb::Env::Default()),
        config_(config),
-       lock_mgr_(16) {}
+       lock_mgr_(16),
+       metadata_cache_(config->metadata_cache_size),
+       scan_iter_cache_(config->scan_iterator_cache_size),
+       key_stamps_(new std::atomic<uint64_t>[kKeyStampSlots]()) {}
   ~Storage();
 
   Status Open(bool read_only);
@@ -41,32 +66,169 @@ class Storage {
   Status CreateBackup();
   Status DestroyBackup();
   Status RestoreFromBackup();
+  // RestoreFromBackupFiles restores the db from the files of the fetched backup, whose crc are
+  // verified while fetching. The table files are hard linked into the db dir and only the small
+  // private files are copied, instead of verifying and copying all files by the backup engine.
+  // The db is left closed if it fails, and the caller falls back to RestoreFromBackup.
+  Status RestoreFromBackupFiles(const std::vector<std::pair<std::string, uint32_t>> &files);
+  // CreateCheckpoint creates(or reuses) the checkpoint of the latest sequence under
+  // the backup dir, the files are hard linked so it costs nearly no disk space
+  Status CreateCheckpoint(std::string *checkpoint_id,
+                          std::vector<std::pair<std::string, uint32_t>> *files);
+  void PurgeIdleCheckpoints(int max_idle_seconds);
+  Status RestoreFromCheckpoint(const std::string &checkpoint_id);
   Status GetWALIter(rocksdb::SequenceNumber seq,
                     std::unique_ptr<rocksdb::TransactionLogIterator> *iter);
   Status WriteBatch(std::string &&raw_batch);
   rocksdb::SequenceNumber LatestSeq();
   rocksdb::Status Write(const rocksdb::WriteOptions& options, rocksdb::WriteBatch* updates);
+  // WriteDeletes writes the batch which has only the deletes, it's allowed even if
+  // the space limit is reached since that's the way to reclaim the space
+  rocksdb::Status WriteDeletes(const rocksdb::WriteOptions &options, rocksdb::WriteBatch *deletes);
+  rocksdb::Status Delete(const rocksdb::WriteOptions &options,
+                         rocksdb::ColumnFamilyHandle *cf_handle,
+                         const rocksdb::Slice &key);
+  rocksdb::Status DeleteRange(const rocksdb::WriteOptions &options,
+                              rocksdb::ColumnFamilyHandle *cf_handle,
+                              const rocksdb::Slice &begin_key,
+                              const rocksdb::Slice &end_key);
+  // Get, MultiGet and NewIterator read the db along with the uncommitted writes of the
+  // transaction of the thread, so the commands in the transaction see the former ones
+  rocksdb::Status Get(const rocksdb::ReadOptions &options, rocksdb::ColumnFamilyHandle *cf_handle,
+                      const rocksdb::Slice &key, std::string *value);
+  std::vector<rocksdb::Status> MultiGet(const rocksdb::ReadOptions &options,
+                                        const std::vector<rocksdb::ColumnFamilyHandle *> &cf_handles,
+                                        const std::vector<rocksdb::Slice> &keys,
+                                        std::vector<std::string> *values);
+  rocksdb::Iterator *NewIterator(const rocksdb::ReadOptions &options, rocksdb::ColumnFamilyHandle *cf_handle);
+  // BeginCacheOnlyReads serves the reads of the thread by the memtables and the block cache only,
+  // the reads of the blocks out of the memory fail with the incomplete status instead of blocking
+  // on the disk, and EndCacheOnlyReads returns false if there's any of them. The iterators created
+  // in the cache only mode must be destroyed before it ends.
+  void BeginCacheOnlyReads();
+  bool EndCacheOnlyReads();
+  // ScanReadOptions returns the read options of the long scans, they read ahead the sst files
+  // and don't fill the block cache, so the hot blocks of the online reads stay. The metadata
+  // iterators seek in the total order if the cf_handle is given.
+  rocksdb::ReadOptions ScanReadOptions(const rocksdb::Snapshot *snapshot,
+                                       rocksdb::ColumnFamilyHandle *cf_handle = nullptr);
+  // SetTotalOrderIfMetadata disables the prefix seek of the metadata iterators, the prefix
+  // extractor of the metadata is the whole key when its memtable bloom is enabled.
+  // NewIterator applies it, only the iterators created by the db directly need to call it.
+  static void SetTotalOrderIfMetadata(rocksdb::ColumnFamilyHandle *cf_handle, rocksdb::ReadOptions *options);
+  // BeginTxn collects the writes of the thread into one batch, which is written into the db
+  // at once by CommitTxn. The key locks taken in the transaction are kept until it is
+  // committed or discarded, so the keys can't be changed by the others in the middle.
+  void BeginTxn();
+  rocksdb::Status CommitTxn();
+  void DiscardTxn();
+  bool InTxn();
+  // SetTxnSavePoint marks the writes of the transaction so far, RollbackTxnToSavePoint drops
+  // the writes and the deferred fns after the last mark, and PopTxnSavePoint keeps them
+  void SetTxnSavePoint();
+  rocksdb::Status RollbackTxnToSavePoint();
+  void PopTxnSavePoint();
+  // RunAfterCommit defers the fn until the transaction of the thread is committed, and the
+  // fn is dropped if the transaction is discarded. It runs the fn at once out of transactions.
+  void RunAfterCommit(std::function<void()> fn);
+  // The writes stamp the keys while there're watchers, the watcher compares the stamps to
+  // know whether the keys are changed. The keys are hashed into the fixed slots, so the
+  // writes of the other keys in the same slot would change the stamp as well.
+  void IncrWatchers() { watchers_.fetch_add(1); }
+  void DecrWatchers() { watchers_.fetch_sub(1); }
+  uint64_t GetKeyStamp(const rocksdb::Slice &ns_key);
+  // The writes report the written keys to the handler while there're key trackers, so the keys
+  // cached by the clients could be invalidated. The empty keys mean all keys are changed, like
+  // the range deletion of the metadata. The handler is set before the db is written.
+  void IncrKeyTrackers() { key_trackers_.fetch_add(1); }
+  void DecrKeyTrackers() { key_trackers_.fetch_sub(1); }
+  void SetWrittenKeysHandler(std::function<void(const std::vector<std::string> &)> handler) {
+    written_keys_handler_ = std::move(handler);
+  }
+  // The handler is called once the db starts closing, the holders of the long-lived db references
+  // like the streaming replies should release them, otherwise CloseDB waits for them forever.
+  void SetDBClosingHandler(std::function<void()> handler) { db_closing_handler_ = std::move(handler); }
   bool WALHasNewData(rocksdb::SequenceNumber seq) { return seq <= LatestSeq(); }
+  // WaitForNewData blocks until the seq is written or timeout, and returns
+  // whether the WAL has new data, it's used by the slave feeders to avoid polling
+  bool WaitForNewData(rocksdb::SequenceNumber seq, int timeout_ms);
   void PurgeBackupIfNeed(uint32_t next_backup_id);
+  // AddReclaimRange queues the subkey range of a deleted huge key, the range would be
+  // removed by the range deletion in background instead of waiting for the compaction
+  void AddReclaimRange(const std::string &begin, const std::string &end, RedisType type);
+  size_t ReclaimRanges(size_t max_ranges);
+  size_t GetReclaimPendingNum();
+  uint64_t GetReclaimedNum() { return reclaimed_ranges_; }
 
   rocksdb::Status Compact(const rocksdb::Slice *begin, const rocksdb::Slice *end);
+  // IngestSSTFiles ingests the external sst files into the column family of the name, the files
+  // are ingested one by one, so they could overlap each other and the later ones win. The ingested
+  // data isn't in the WAL, so the slaves behind GetIngestedSeq must be resynced by the full sync.
+  // The ingested sequence is kept in the db dir, so it survives the restarts.
+  Status IngestSSTFiles(const std::string &cf_name, const std::vector<std::string> &files);
+  rocksdb::SequenceNumber GetIngestedSeq() { return ingested_seq_; }
   rocksdb::DB *GetDB();
+  // IsClosed returns true if the db is closed by the failed restore
+  bool IsClosed() { return db_ == nullptr; }
   bool IsClosing();
   Status IncrDBRefs();
   Status DecrDBRefs();
   const std::string GetName() {return config_->db_name; }
+  Config *GetConfig() { return config_; }
   rocksdb::ColumnFamilyHandle *GetCFHandle(const std::string &name);
+  // GetSubKeyCFHandle returns the column family of the subkeys of the type, the subkeys
+  // of all types are in the default column family unless the type-column-families is enabled
+  rocksdb::ColumnFamilyHandle *GetSubKeyCFHandle(RedisType type);
+  bool IsTypeCFsEnabled() { return type_cfs_enabled_; }
   std::vector<rocksdb::ColumnFamilyHandle *> GetCFHandles() { return cf_handles_; }
   LockManager *GetLockManager() { return &lock_mgr_; }
+  MetadataCache *GetMetadataCache() { return &metadata_cache_; }
+  ScanIteratorCache *GetScanIteratorCache() { return &scan_iter_cache_; }
   void PurgeOldBackups(uint32_t num_backups_to_keep, uint32_t backup_max_keep_hours);
   uint64_t GetTotalSize();
+  // GetDBPathSizes returns the size of the live sst files in each of the rocksdb.db_paths
+  void GetDBPathSizes(std::map<std::string, uint64_t> *sizes);
   Status CheckDBSizeLimit();
   void SetIORateLimit(uint64_t max_io_mb);
+  // ReplicationID identifies the history of the sequences, the slave takes the id of its master,
+  // and the promoted slave keeps the id of its former master with the last sequence of it, so
+  // the other slaves of the former master could still make the psync from the promoted one
+  struct ReplicationID {
+    std::string id;
+    std::string prev_id;
+    rocksdb::SequenceNumber prev_id_last_seq = 0;
+  };
+  ReplicationID GetReplicationID();
+  // EnsureReplicationID returns the id of the master, it is created if there's none
+  std::string EnsureReplicationID();
+  // SetReplicationID adopts the id of the master, or clears the id by the empty one after
+  // the db is replaced by the fullsync
+  void SetReplicationID(const std::string &id);
+  // ShiftReplicationID is called after the slave is promoted to the master
+  void ShiftReplicationID();
+  // CheckReplicationID returns OK if the history of the id is continued by this db from
+  // the sequence, the empty id is from the slave which doesn't know its master yet
+  Status CheckReplicationID(const std::string &id, rocksdb::SequenceNumber next_seq);
+  // SetBackupRateLimit limits the rate of the backup, 0 is no limit
+  void SetBackupRateLimit(uint64_t max_backup_mb);
+  // SetBlockCacheCapacity resizes the block cache in use by its name in GetBlockCaches
+  Status SetBlockCacheCapacity(const std::string &name, size_t capacity);
+  // GetBlockCaches returns the block caches in use with their names,
+  // the shared cache is returned once though all column families use it
+  std::vector<std::pair<std::string, std::shared_ptr<rocksdb::Cache>>> GetBlockCaches();
 
   uint64_t GetFlushCount() { return flush_count_; }
   void IncrFlushCount(uint64_t n) { flush_count_.fetch_add(n); }
   uint64_t GetCompactionCount() { return compaction_count_; }
   void IncrCompactionCount(uint64_t n) { compaction_count_.fetch_add(n); }
+  BackgroundJobStats *GetBackgroundJobStats() { return &background_job_stats_; }
+  // SetWriteStallCondition is called by the event listener when the write stall condition
+  // of a column family is changed, the writes would be blocked inside the rocksdb while
+  // any column family is stopped, so the workers hold the write commands instead
+  void SetWriteStallCondition(rocksdb::WriteStallCondition prev, rocksdb::WriteStallCondition cur);
+  bool IsWriteStopped() { return write_stopped_cfs_ > 0; }
+  int GetWriteStoppedCFs() { return write_stopped_cfs_; }
+  int GetWriteDelayedCFs() { return write_delayed_cfs_; }
 
   Storage(const Storage &) = delete;
   Storage &operator=(const Storage &) = delete;
@@ -80,6 +242,9 @@ class Storage {
                                  uint64_t *file_size);
     static int OpenDataFile(Storage *storage, const std::string &rel_path,
                             uint64_t *file_size);
+    // ReadDataFileChunk reads at most len bytes of the data file started from the offset
+    static Status ReadDataFileChunk(Storage *storage, const std::string &rel_path,
+                                    uint64_t offset, size_t len, std::string *data);
 
     // Slave side
     struct MetaInfo {
@@ -92,25 +257,107 @@ class Storage {
     static MetaInfo ParseMetaAndSave(Storage *storage,
                                      rocksdb::BackupID meta_id,
                                      evbuffer *evbuf);
+    // [[filename, checksum]...]
+    static std::vector<std::pair<std::string, uint32_t>> ParseCheckpointMeta(evbuffer *evbuf);
     static std::unique_ptr<rocksdb::WritableFile> NewTmpFile(
         Storage *storage, const std::string &rel_path);
+    // ReopenTmpFile reopens the tmp file left by the interrupted fetch for appending,
+    // and returns the size and crc of the fetched content to resume from
+    static std::unique_ptr<rocksdb::WritableFile> ReopenTmpFile(
+        Storage *storage, const std::string &rel_path, uint64_t *offset, uint32_t *crc);
     static Status SwapTmpFile(Storage *storage, const std::string &rel_path);
-    static bool FileExists(Storage *storage, const std::string &rel_path);
+    static bool FileExists(Storage *storage, const std::string &rel_path, uint32_t crc);
     static Status PurgeBackup(Storage *storage);
+    // PurgeCheckpoints removes the fetched checkpoints except the one in use
+    static void PurgeCheckpoints(Storage *storage, const std::string &keep_id);
   };
 
  private:
+  friend class KeyStamper;
+
+  void invalidateMetadataCache(rocksdb::WriteBatch *updates);
+  void notifyNewWrite();
+  rocksdb::Status appendToTxn(rocksdb::WriteBatch *updates);
+  void stampWrittenKeys(rocksdb::WriteBatch *updates);
+  bool hasTypeCFWrites(rocksdb::WriteBatch *updates);
+  void stampKey(uint32_t cf_id, const rocksdb::Slice &key);
+  void reportWrittenKeys(rocksdb::WriteBatch *updates);
+  void touchCheckpoint(const std::string &rel_path);
+  rocksdb::BackupableDBOptions backupOptions();
+  void loadReplicationID();
+  void loadIngestedSeq();
+  Status saveIngestedSeq(rocksdb::SequenceNumber seq);
+  Status saveReplicationID(const ReplicationID &replid);
+  bool cfHasData(rocksdb::ColumnFamilyHandle *cf_handle);
+  Status openTypeCFs(bool read_only);
+  Status migrateSubKeysToTypeCFs();
+  std::shared_ptr<rocksdb::Cache> newBlockCache(size_t capacity);
+  const rocksdb::FilterPolicy *newBloomFilterPolicy(int bits_per_key);
+  // setPartitionedIndexAndFilters switches the table to the two-level index and filters
+  // if the partitioned_index_and_filters is enabled, it must be called after the filter is set
+  void setPartitionedIndexAndFilters(rocksdb::BlockBasedTableOptions *table_opts);
+  // the hottest keys of the metadata cache are saved while closing the db, and read
+  // by the warmup thread after opening it to fill the block caches in the background
+  void saveWarmupKeys();
+  void startWarmup();
+  void stopWarmup();
+  void warmup();
+
   rocksdb::DB *db_ = nullptr;
   rocksdb::BackupEngine *backup_ = nullptr;
   rocksdb::Env *backup_env_;
   std::shared_ptr<rocksdb::SstFileManager> sst_file_manager_;
   std::shared_ptr<rocksdb::RateLimiter> rate_limiter_;
+  std::shared_ptr<rocksdb::RateLimiter> backup_rate_limiter_;
+  std::shared_ptr<rocksdb::Cache> metadata_block_cache_;
+  std::shared_ptr<rocksdb::Cache> subkey_block_cache_;
+  std::shared_ptr<rocksdb::Cache> compressed_block_cache_;
   Config *config_ = nullptr;
   std::vector<rocksdb::ColumnFamilyHandle *> cf_handles_;
   LockManager lock_mgr_;
+  MetadataCache metadata_cache_;
+  ScanIteratorCache scan_iter_cache_;
+  std::atomic<bool> type_cfs_enabled_{false};
   bool reach_db_size_limit_ = false;
   std::atomic<uint64_t> flush_count_{0};
   std::atomic<uint64_t> compaction_count_{0};
+  BackgroundJobStats background_job_stats_;
+  std::atomic<int> write_stopped_cfs_{0};
+  std::atomic<int> write_delayed_cfs_{0};
+  std::atomic<rocksdb::SequenceNumber> ingested_seq_{0};
+  std::thread warmup_thread_;
+  std::atomic<bool> warmup_stop_{false};
+
+  std::mutex write_notify_mu_;
+  std::condition_variable write_notify_cv_;
+  std::atomic<int> write_waiters_{0};
+
+  static const size_t kKeyStampSlots = 1 << 16;
+  std::atomic<int> watchers_{0};
+  std::unique_ptr<std::atomic<uint64_t>[]> key_stamps_;
+  // the range deletions changed the stamps of all keys
+  std::atomic<uint64_t> stamp_epoch_{0};
+  std::atomic<int> key_trackers_{0};
+  std::function<void(const std::vector<std::string> &)> written_keys_handler_;
+  std::function<void()> db_closing_handler_;
+
+  struct ReclaimRange {
+    std::string begin;
+    std::string end;
+    // the zset has the subkeys in the score and rank column families as well
+    RedisType type;
+  };
+  std::mutex reclaim_mu_;
+  std::deque<ReclaimRange> reclaim_ranges_;
+  std::atomic<uint64_t> reclaimed_ranges_{0};
+
+
+  std::mutex checkpoint_mu_;
+  // checkpoint id => last access time
+  std::map<std::string, time_t> checkpoint_access_;
+
+  std::mutex replid_mu_;
+  ReplicationID replid_;
 
   std::mutex db_mu_;
   int db_refs_ = 0;
@@ -0,0 +1,89 @@
+#include "table_properties_collector.h"
+
+#include "encoding.h"
+
+namespace Engine {
+
+const char *kNamespaceStatsPropertyName = "kvrocks.namespace.stats";
+
+void EncodeNamespaceKeyStats(const std::map<std::string, NamespaceKeyStats> &stats, std::string *dst) {
+  dst->clear();
+  for (const auto &iter : stats) {
+    PutFixed8(dst, static_cast<uint8_t>(iter.first.size()));
+    dst->append(iter.first);
+    PutFixed64(dst, iter.second.n_put);
+    PutFixed64(dst, iter.second.n_delete);
+    PutFixed64(dst, iter.second.n_expires);
+    PutFixed64(dst, iter.second.expire_sum);
+  }
+}
+
+bool DecodeNamespaceKeyStats(const std::string &bytes, std::map<std::string, NamespaceKeyStats> *stats) {
+  rocksdb::Slice input(bytes);
+  while (!input.empty()) {
+    uint8_t ns_size;
+    GetFixed8(&input, &ns_size);
+    if (input.size() < ns_size + 32u) return false;
+    auto &ns_stats = (*stats)[std::string(input.data(), ns_size)];
+    input.remove_prefix(ns_size);
+    NamespaceKeyStats file_stats;
+    GetFixed64(&input, &file_stats.n_put);
+    GetFixed64(&input, &file_stats.n_delete);
+    GetFixed64(&input, &file_stats.n_expires);
+    GetFixed64(&input, &file_stats.expire_sum);
+    ns_stats.n_put += file_stats.n_put;
+    ns_stats.n_delete += file_stats.n_delete;
+    ns_stats.n_expires += file_stats.n_expires;
+    ns_stats.expire_sum += file_stats.expire_sum;
+  }
+  return true;
+}
+
+rocksdb::Status NamespaceStatsCollector::AddUserKey(const rocksdb::Slice &key, const rocksdb::Slice &value,
+                                                    rocksdb::EntryType type, rocksdb::SequenceNumber seq,
+                                                    uint64_t file_size) {
+  if (type != rocksdb::kEntryPut && type != rocksdb::kEntryDelete && type != rocksdb::kEntrySingleDelete) {
+    return rocksdb::Status::OK();
+  }
+  // the key is composed of the namespace size(1byte) + namespace + user key
+  if (key.empty() || key.size() < 1u + static_cast<uint8_t>(key[0])) return rocksdb::Status::OK();
+  size_t ns_prefix_size = 1 + static_cast<uint8_t>(key[0]);
+  if (!last_ns_stats_ || rocksdb::Slice(key.data(), ns_prefix_size) != last_ns_prefix_) {
+    last_ns_prefix_.assign(key.data(), ns_prefix_size);
+    last_ns_stats_ = &stats_[last_ns_prefix_.substr(1)];
+  }
+  if (type != rocksdb::kEntryPut) {
+    last_ns_stats_->n_delete++;
+    return rocksdb::Status::OK();
+  }
+  last_ns_stats_->n_put++;
+  // the metadata starts with flags(1byte) + expire(4byte)
+  if (value.size() >= 5) {
+    uint32_t expire = DecodeFixed32(value.data() + 1);
+    if (expire > 0) {
+      last_ns_stats_->n_expires++;
+      last_ns_stats_->expire_sum += expire;
+    }
+  }
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status NamespaceStatsCollector::Finish(rocksdb::UserCollectedProperties *properties) {
+  std::string bytes;
+  EncodeNamespaceKeyStats(stats_, &bytes);
+  properties->insert({kNamespaceStatsPropertyName, bytes});
+  return rocksdb::Status::OK();
+}
+
+rocksdb::UserCollectedProperties NamespaceStatsCollector::GetReadableProperties() const {
+  rocksdb::UserCollectedProperties properties;
+  for (const auto &iter : stats_) {
+    properties.insert({std::string(kNamespaceStatsPropertyName) + "." + iter.first,
+                       "puts=" + std::to_string(iter.second.n_put) +
+                       ",deletes=" + std::to_string(iter.second.n_delete) +
+                       ",expires=" + std::to_string(iter.second.n_expires)});
+  }
+  return properties;
+}
+
+}  // namespace Engine
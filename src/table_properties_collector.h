@@ -0,0 +1,51 @@
+#pragma once
+
+#include <rocksdb/table_properties.h>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace Engine {
+
+// NamespaceKeyStats is collected from the entries of the metadata sst file,
+// the puts and deletes of the same key in different files are both counted,
+// so the number of keys is approximate til they are compacted together
+struct NamespaceKeyStats {
+  uint64_t n_put = 0;
+  uint64_t n_delete = 0;
+  uint64_t n_expires = 0;
+  // the sum of the absolute expire time of the keys with ttl
+  uint64_t expire_sum = 0;
+};
+
+extern const char *kNamespaceStatsPropertyName;
+
+void EncodeNamespaceKeyStats(const std::map<std::string, NamespaceKeyStats> &stats, std::string *dst);
+bool DecodeNamespaceKeyStats(const std::string &bytes, std::map<std::string, NamespaceKeyStats> *stats);
+
+class NamespaceStatsCollector : public rocksdb::TablePropertiesCollector {
+ public:
+  rocksdb::Status AddUserKey(const rocksdb::Slice &key, const rocksdb::Slice &value,
+                             rocksdb::EntryType type, rocksdb::SequenceNumber seq,
+                             uint64_t file_size) override;
+  rocksdb::Status Finish(rocksdb::UserCollectedProperties *properties) override;
+  rocksdb::UserCollectedProperties GetReadableProperties() const override;
+  const char *Name() const override { return "NamespaceStatsCollector"; }
+
+ private:
+  std::map<std::string, NamespaceKeyStats> stats_;
+  // the keys are sorted, so cache the namespace of the last key
+  std::string last_ns_prefix_;
+  NamespaceKeyStats *last_ns_stats_ = nullptr;
+};
+
+class NamespaceStatsCollectorFactory : public rocksdb::TablePropertiesCollectorFactory {
+ public:
+  rocksdb::TablePropertiesCollector *CreateTablePropertiesCollector(
+      rocksdb::TablePropertiesCollectorFactory::Context context) override {
+    return new NamespaceStatsCollector();
+  }
+  const char *Name() const override { return "NamespaceStatsCollectorFactory"; }
+};
+
+}  // namespace Engine
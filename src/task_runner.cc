@@ -1,29 +1,96 @@
 #include "task_runner.h"
 
+#include <chrono>
 #include <thread>
 #include "util.h"
 
+static uint64_t nowMicros() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+TaskRunner::TaskRunner(int n_thread, uint32_t max_queue_size)
+    : max_queue_size_(max_queue_size), n_thread_(n_thread) {
+  if (n_thread_ < 1) n_thread_ = 1;
+  pending_[0] = 0;
+  pending_[1] = 0;
+  // the pending tasks are limited by the max queue size, so the rings
+  // have enough space in total though the tasks aren't evenly distributed
+  size_t ring_size = (max_queue_size_ + n_thread_ - 1) / n_thread_;
+  if (ring_size == 0) ring_size = 1;
+  for (int i = 0; i < n_thread_; i++) {
+    auto queue = std::unique_ptr<TaskQueue>(new TaskQueue);
+    for (auto &ring : queue->rings) {
+      ring.tasks.resize(ring_size);
+      ring.enqueue_us.resize(ring_size);
+    }
+    queues_.emplace_back(std::move(queue));
+  }
+}
+
 Status TaskRunner::Publish(Task task) {
-  mu_.lock();
   if (stop_) {
-    mu_.unlock();
     return Status(Status::NotOK, "the runner was stopped");
   }
-  if (task_queue_.size() >= max_queue_size_) {
-    mu_.unlock();
+  int priority = task.high_priority ? 0 : 1;
+  if (pending_[priority].fetch_add(1) >= max_queue_size_) {
+    pending_[priority].fetch_sub(1);
+    rejected_tasks_.fetch_add(1, std::memory_order_relaxed);
     return Status(Status::NotOK, "the task queue was reached max length");
   }
-  task_queue_.emplace_back(task);
-  cond_.notify_all();
-  mu_.unlock();
+  uint64_t now = nowMicros();
+  size_t start = next_queue_.fetch_add(1, std::memory_order_relaxed);
+  for (size_t i = 0; i < queues_.size(); i++) {
+    auto &queue = queues_[(start + i) % queues_.size()];
+    std::lock_guard<std::mutex> guard(queue->mu);
+    auto &ring = queue->rings[priority];
+    if (ring.size == ring.tasks.size()) continue;
+    size_t pos = (ring.head + ring.size) % ring.tasks.size();
+    ring.tasks[pos] = std::move(task);
+    ring.enqueue_us[pos] = now;
+    ring.size++;
+    break;
+  }
+  if (sleepers_ > 0) {
+    std::lock_guard<std::mutex> guard(sleep_mu_);
+    sleep_cond_.notify_one();
+  }
   return Status::OK();
 }
 
+bool TaskRunner::pop(size_t index, Task *task) {
+  for (int priority = 0; priority < 2; priority++) {
+    if (pending_[priority] == 0) continue;
+    for (size_t i = 0; i < queues_.size(); i++) {
+      auto &queue = queues_[(index + i) % queues_.size()];
+      std::lock_guard<std::mutex> guard(queue->mu);
+      auto &ring = queue->rings[priority];
+      if (ring.size == 0) continue;
+      *task = std::move(ring.tasks[ring.head]);
+      ring.tasks[ring.head] = Task();
+      uint64_t wait_us = nowMicros() - ring.enqueue_us[ring.head];
+      ring.head = (ring.head + 1) % ring.tasks.size();
+      ring.size--;
+      pending_[priority].fetch_sub(1);
+
+      if (i != 0) stolen_tasks_.fetch_add(1, std::memory_order_relaxed);
+      executed_tasks_.fetch_add(1, std::memory_order_relaxed);
+      total_wait_us_.fetch_add(wait_us, std::memory_order_relaxed);
+      uint64_t max_wait_us = max_wait_us_.load(std::memory_order_relaxed);
+      while (wait_us > max_wait_us
+             && !max_wait_us_.compare_exchange_weak(max_wait_us, wait_us, std::memory_order_relaxed)) {
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
 void TaskRunner::Start() {
   for (int i = 0; i < n_thread_; i++) {
-    threads_.emplace_back(std::thread([this]() {
+    threads_.emplace_back(std::thread([this, i]() {
       Util::ThreadSetName("task-runner");
-      this->run();
+      this->run(static_cast<size_t>(i));
     }));
   }
 }
@@ -31,19 +98,16 @@ void TaskRunner::Start() {
 void TaskRunner::Restart() {
   Stop();
   Join();
-  mu_.lock();
   threads_.clear();
-  task_queue_.clear();
+  clear();
   stop_ = false;
-  mu_.unlock();
   Start();
 }
 
 void TaskRunner::Stop() {
-  mu_.lock();
   stop_ = true;
-  cond_.notify_all();
-  mu_.unlock();
+  std::lock_guard<std::mutex> guard(sleep_mu_);
+  sleep_cond_.notify_all();
 }
 
 void TaskRunner::Join() {
@@ -52,20 +116,42 @@ void TaskRunner::Join() {
   }
 }
 
-void TaskRunner::run() {
+void TaskRunner::GetStats(TaskRunnerStats *stats) {
+  stats->queued_tasks = QueueSize();
+  stats->executed_tasks = executed_tasks_;
+  stats->stolen_tasks = stolen_tasks_;
+  stats->rejected_tasks = rejected_tasks_;
+  stats->avg_wait_us = stats->executed_tasks == 0 ? 0 : total_wait_us_ / stats->executed_tasks;
+  stats->max_wait_us = max_wait_us_;
+}
+
+void TaskRunner::clear() {
+  for (auto &queue : queues_) {
+    std::lock_guard<std::mutex> guard(queue->mu);
+    for (auto &ring : queue->rings) {
+      for (auto &task : ring.tasks) task = Task();
+      ring.head = 0;
+      ring.size = 0;
+    }
+  }
+  pending_[0] = 0;
+  pending_[1] = 0;
+}
+
+void TaskRunner::run(size_t index) {
   Task task;
-  std::unique_lock<std::mutex> lock(mu_);
   while (!stop_) {
-    cond_.wait(lock, [this]() -> bool { return stop_ || !task_queue_.empty();});
-    while (!stop_ && !task_queue_.empty()) {
-      task = task_queue_.front();
-      task_queue_.pop_front();
-      lock.unlock();
+    if (pop(index, &task)) {
       if (task.callback) task.callback(task.arg);
-      lock.lock();
+      task = Task();
+      continue;
     }
+    std::unique_lock<std::mutex> lock(sleep_mu_);
+    // the publisher would see the sleeper and wake it up, or the sleeper
+    // would see the pending task before waiting
+    sleepers_++;
+    sleep_cond_.wait(lock, [this]() -> bool { return stop_ || QueueSize() > 0; });
+    sleepers_--;
   }
-  task_queue_.clear();
-  lock.unlock();
   // CAUTION: drop the rest of tasks, don't use task runner if the task can't be drop
 }
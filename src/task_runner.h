@@ -2,9 +2,10 @@
 
 #include <cstdint>
 #include <vector>
-#include <list>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <memory>
 #include <condition_variable>
 #include <functional>
 
@@ -12,27 +13,69 @@
 
 struct Task {
   std::function<void(void*)> callback;
-  void *arg;
+  void *arg = nullptr;
+  // the high priority tasks are the user-facing ones, and executed before
+  // the maintenance tasks like the compaction and bgsave
+  bool high_priority = false;
 };
 
+struct TaskRunnerStats {
+  uint64_t queued_tasks = 0;
+  uint64_t executed_tasks = 0;
+  uint64_t stolen_tasks = 0;
+  uint64_t rejected_tasks = 0;
+  uint64_t avg_wait_us = 0;
+  uint64_t max_wait_us = 0;
+};
+
+// TaskRunner dispatches the published tasks to the queues of the threads in round-robin,
+// the thread executes the tasks in its own queue first and steals from the others when
+// it's empty, so the publishers and threads rarely contend on the same lock.
 class TaskRunner {
  public:
-  explicit TaskRunner(int n_thread = 2, uint32_t max_queue_size = 10240)
-  :max_queue_size_(max_queue_size), n_thread_(n_thread) {}
+  // @max_queue_size: the max number of the pending tasks of each priority
+  explicit TaskRunner(int n_thread = 2, uint32_t max_queue_size = 10240);
   ~TaskRunner() = default;
   Status Publish(Task task);
-  size_t QueueSize() { return task_queue_.size(); }
+  size_t QueueSize() { return pending_[0] + pending_[1]; }
   void Start();
   void Restart();
   void Stop();
   void Join();
+  void GetStats(TaskRunnerStats *stats);
+
  private:
-  void run();
-  bool stop_ = false;
+  // TaskRing is a fixed size ring buffer, publishing a task won't allocate the list node
+  struct TaskRing {
+    std::vector<Task> tasks;
+    std::vector<uint64_t> enqueue_us;
+    size_t head = 0;
+    size_t size = 0;
+  };
+  struct TaskQueue {
+    std::mutex mu;
+    TaskRing rings[2];  // indexed by the priority, 0 is the high priority
+  };
+  void run(size_t index);
+  bool pop(size_t index, Task *task);
+  void clear();
+
+  std::atomic<bool> stop_{false};
   uint32_t max_queue_size_;
-  std::list<Task> task_queue_;
-  std::mutex mu_;
-  std::condition_variable cond_;
   int n_thread_;
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+  std::atomic<size_t> next_queue_{0};
+  std::atomic<size_t> pending_[2];
+  // the idle threads sleep on the condition variable, only the publishers who
+  // see the sleepers need to take the lock to wake them up
+  std::atomic<int> sleepers_{0};
+  std::mutex sleep_mu_;
+  std::condition_variable sleep_cond_;
   std::vector<std::thread> threads_;
+
+  std::atomic<uint64_t> executed_tasks_{0};
+  std::atomic<uint64_t> stolen_tasks_{0};
+  std::atomic<uint64_t> rejected_tasks_{0};
+  std::atomic<uint64_t> total_wait_us_{0};
+  std::atomic<uint64_t> max_wait_us_{0};
 };
@@ -0,0 +1,40 @@
+#include "tracing.h"
+
+#include <chrono>
+#include <random>
+
+static const char *kStageNames[Trace::kNumStages] = {"queued", "parsed", "executed", "replied", "flushed"};
+static const char *kSpanNames[Trace::kNumSpans] = {"lock_wait", "storage_read", "storage_write"};
+
+static thread_local Trace *current_trace = nullptr;
+
+const char *Trace::StageName(int stage) {
+  if (stage < 0 || stage >= kNumStages) return "unknown";
+  return kStageNames[stage];
+}
+
+const char *Trace::SpanName(int span) {
+  if (span < 0 || span >= kNumSpans) return "unknown";
+  return kSpanNames[span];
+}
+
+bool Trace::Sample(int ratio) {
+  if (ratio <= 0) return false;
+  if (ratio >= 100) return true;
+  // the same thread local engine as the perf sampling, std::rand is locked in glibc
+  static thread_local std::minstd_rand engine(std::random_device{}());
+  return static_cast<int>(engine() % 100) < ratio;
+}
+
+uint64_t Trace::NowUS() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+}
+
+Trace *Trace::Current() {
+  return current_trace;
+}
+
+void Trace::Attach(Trace *trace) {
+  current_trace = trace;
+}
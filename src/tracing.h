@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+// Trace timestamps the stages of a sampled command in microseconds since its pipeline is read
+// from the client, and accumulates the time spent in the lock waits and the storage. The trace
+// is attached to the executing thread while the command is running, so the lock manager and
+// the storage add their spans without knowing the command, and pay nothing if it isn't traced.
+class Trace {
+ public:
+  enum Stage {
+    kQueued = 0,  // the command is picked up from the pending commands
+    kParsed,
+    kExecuted,
+    kReplied,  // the reply is added to the connection
+    kFlushed,  // the replies are written to the socket or its output buffer
+    kNumStages,
+  };
+  enum Span {
+    kLockWait = 0,
+    kStorageRead,
+    kStorageWrite,
+    kNumSpans,
+  };
+  static const char *StageName(int stage);
+  static const char *SpanName(int span);
+
+  // Sample decides whether the command should be traced by the ratio(0~100)
+  static bool Sample(int ratio);
+  static uint64_t NowUS();
+  // Current returns the trace attached to the current thread, or nullptr if there's none
+  static Trace *Current();
+  // Attach attaches the trace to the current thread, and nullptr detaches it
+  static void Attach(Trace *trace);
+
+  Trace(std::string cmd, uint64_t start) : cmd_name(std::move(cmd)), start_us(start) {}
+  void Mark(Stage stage) { stages[stage] = NowUS() - start_us; }
+  void AddSpan(Span span, uint64_t duration) { spans[span] += duration; }
+
+  std::string cmd_name;
+  uint64_t start_us;
+  uint64_t stages[kNumStages] = {};
+  uint64_t spans[kNumSpans] = {};
+  uint64_t reply_bytes = 0;
+};
+
+// TraceSpanTimer adds the time of its scope to the span of the current trace if there's one
+class TraceSpanTimer {
+ public:
+  explicit TraceSpanTimer(Trace::Span span)
+      : trace_(Trace::Current()), span_(span), start_us_(trace_ ? Trace::NowUS() : 0) {}
+  ~TraceSpanTimer() {
+    if (trace_) trace_->AddSpan(span_, Trace::NowUS() - start_us_);
+  }
+  TraceSpanTimer(const TraceSpanTimer &) = delete;
+  TraceSpanTimer &operator=(const TraceSpanTimer &) = delete;
+
+ private:
+  Trace *trace_;
+  Trace::Span span_;
+  uint64_t start_us_;
+};
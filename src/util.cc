@@ -7,10 +7,21 @@
 #include <glog/logging.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <poll.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <pthread.h>
+#include <limits.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define KVROCKS_X86_SIMD 1
+#endif
 
+#include <cstring>
 #include <string>
 #include <algorithm>
 
@@ -35,23 +46,62 @@ sockaddr_in NewSockaddrInet(const std::string &host, uint32_t port) {
   return sin;
 }
 
-Status SockConnect(std::string host, uint32_t port, int *fd) {
+Status SockConnect(std::string host, uint32_t port, int *fd, int timeout_ms) {
   sockaddr_in sin{};
   sin.sin_family = AF_INET;
   sin.sin_addr.s_addr = inet_addr(host.c_str());
   sin.sin_port = htons(port);
   *fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (*fd < 0) return Status(Status::NotOK, strerror(errno));
+  // connect in nonblocking and wait for it in the poll, so the connecting is bounded by the timeout
+  if (timeout_ms > 0) evutil_make_socket_nonblocking(*fd);
   auto rv = connect(*fd, reinterpret_cast<sockaddr *>(&sin), sizeof(sin));
+  if (rv < 0 && timeout_ms > 0 && errno == EINPROGRESS) {
+    pollfd pfd{*fd, POLLOUT, 0};
+    rv = poll(&pfd, 1, timeout_ms);
+    if (rv == 0) {
+      errno = ETIMEDOUT;
+      rv = -1;
+    } else if (rv > 0) {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(*fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      errno = err;
+      rv = err == 0 ? 0 : -1;
+    }
+  }
   if (rv < 0) {
+    int err = errno;
     close(*fd);
     *fd = -1;
-    return Status(Status::NotOK, strerror(errno));
+    return Status(Status::NotOK, strerror(err));
   }
+  if (timeout_ms > 0) fcntl(*fd, F_SETFL, fcntl(*fd, F_GETFL) & ~O_NONBLOCK);
   setsockopt(*fd, SOL_SOCKET, SO_KEEPALIVE, nullptr, 0);
   setsockopt(*fd, IPPROTO_TCP, TCP_NODELAY, nullptr, 0);
   return Status::OK();
 }
 
+Status SockListenUnix(const std::string &path, int perm, int backlog, int *fd) {
+  sockaddr_un sun{};
+  if (path.size() >= sizeof(sun.sun_path)) return Status(Status::NotOK, "the unix socket path is too long");
+  sun.sun_family = AF_UNIX;
+  strncpy(sun.sun_path, path.c_str(), sizeof(sun.sun_path) - 1);
+  unlink(path.c_str());
+  *fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (*fd < 0) return Status(Status::NotOK, strerror(errno));
+  if (bind(*fd, reinterpret_cast<sockaddr *>(&sun), sizeof(sun)) < 0
+      || (perm != 0 && chmod(path.c_str(), static_cast<mode_t>(perm)) < 0)
+      || listen(*fd, backlog) < 0) {
+    int err = errno;
+    close(*fd);
+    *fd = -1;
+    return Status(Status::NotOK, strerror(err));
+  }
+  evutil_make_socket_nonblocking(*fd);
+  return Status::OK();
+}
+
 // NOTE: fd should be blocking here
 Status SockSend(int fd, const std::string &data) {
   ssize_t n = 0;
@@ -65,6 +115,28 @@ Status SockSend(int fd, const std::string &data) {
   return Status::OK();
 }
 
+Status SockSendv(int fd, std::vector<iovec> *iov) {
+  size_t i = 0;
+  while (i < iov->size()) {
+    int cnt = static_cast<int>(std::min(iov->size() - i, static_cast<size_t>(IOV_MAX)));
+    ssize_t nwritten = writev(fd, iov->data() + i, cnt);
+    if (nwritten == -1) {
+      if (errno == EINTR) continue;
+      return Status(Status::NotOK, strerror(errno));
+    }
+    // skip the fully written vectors, and move forward the partially written one
+    while (i < iov->size() && nwritten >= static_cast<ssize_t>((*iov)[i].iov_len)) {
+      nwritten -= (*iov)[i].iov_len;
+      i++;
+    }
+    if (nwritten > 0) {
+      (*iov)[i].iov_base = static_cast<char *>((*iov)[i].iov_base) + nwritten;
+      (*iov)[i].iov_len -= nwritten;
+    }
+  }
+  return Status::OK();
+}
+
 int GetPeerAddr(int fd, std::string *addr, uint32_t *port) {
   sockaddr_storage sa{};
   socklen_t sa_len = sizeof(sa);
@@ -109,25 +181,147 @@ void Trim(const std::string &in, const std::string &chars, std::string *out) {
   out->erase(out->find_last_not_of(chars)+1);
 }
 
-void Split(std::string in, std::string delim, std::vector<std::string> *out) {
+// the scalar versions are used by the tails of the vectorized ones, and the cpus without SSE
+static size_t findCRLFScalar(const char *p, size_t len) {
+  const char *end = p + len, *cur = p;
+  while (end - cur > 1) {
+    cur = static_cast<const char *>(memchr(cur, '\r', end - cur - 1));
+    if (!cur) break;
+    if (cur[1] == '\n') return cur - p;
+    cur++;
+  }
+  return len;
+}
+
+static size_t findFirstOfScalar(const char *p, size_t len, const std::string &chars) {
+  for (size_t i = 0; i < len; i++) {
+    if (chars.find(p[i]) != std::string::npos) return i;
+  }
+  return len;
+}
+
+#ifdef KVROCKS_X86_SIMD
+// compare the bytes with CR and the next bytes with LF, so the bits set in
+// both masks are the positions of the CRLF
+static size_t findCRLFSSE2(const char *p, size_t len) {
+  const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 16 < len; i += 16) {
+    __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i + 1));
+    int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(cur, cr), _mm_cmpeq_epi8(next, lf)));
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  return i + findCRLFScalar(p + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t findCRLFAVX2(const char *p, size_t len) {
+  const __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 32 < len; i += 32) {
+    __m256i cur = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i + 1));
+    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(cur, cr), _mm256_cmpeq_epi8(next, lf))));
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  return i + findCRLFSSE2(p + i, len - i);
+}
+
+// the chars are padded to 4 by repeating the first one, the larger sets use the scalar version
+static size_t findFirstOfSSE2(const char *p, size_t len, const std::string &chars) {
+  if (chars.empty() || chars.size() > 4) return findFirstOfScalar(p, len, chars);
+  __m128i c[4];
+  for (size_t j = 0; j < 4; j++) c[j] = _mm_set1_epi8(chars[j < chars.size() ? j : 0]);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    __m128i eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(cur, c[0]), _mm_cmpeq_epi8(cur, c[1])),
+                              _mm_or_si128(_mm_cmpeq_epi8(cur, c[2]), _mm_cmpeq_epi8(cur, c[3])));
+    int mask = _mm_movemask_epi8(eq);
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  return i + findFirstOfScalar(p + i, len - i, chars);
+}
+
+__attribute__((target("avx2")))
+static size_t findFirstOfAVX2(const char *p, size_t len, const std::string &chars) {
+  if (chars.empty() || chars.size() > 4) return findFirstOfScalar(p, len, chars);
+  __m256i c[4];
+  for (size_t j = 0; j < 4; j++) c[j] = _mm256_set1_epi8(chars[j < chars.size() ? j : 0]);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i cur = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    __m256i eq = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(cur, c[0]), _mm256_cmpeq_epi8(cur, c[1])),
+        _mm256_or_si256(_mm256_cmpeq_epi8(cur, c[2]), _mm256_cmpeq_epi8(cur, c[3])));
+    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(eq));
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  return i + findFirstOfSSE2(p + i, len - i, chars);
+}
+#endif
+
+struct StringScanner {
+  size_t (*find_crlf)(const char *p, size_t len);
+  size_t (*find_first_of)(const char *p, size_t len, const std::string &chars);
+};
+
+// pick the implementations by the cpu once at startup, SSE2 is the baseline of x86_64
+static StringScanner pickStringScanner() {
+#ifdef KVROCKS_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return StringScanner{findCRLFAVX2, findFirstOfAVX2};
+  return StringScanner{findCRLFSSE2, findFirstOfSSE2};
+#else
+  return StringScanner{findCRLFScalar, findFirstOfScalar};
+#endif
+}
+
+static const StringScanner string_scanner = pickStringScanner();
+
+size_t FindCRLF(const char *p, size_t len) {
+  return string_scanner.find_crlf(p, len);
+}
+
+size_t FindFirstOf(const char *p, size_t len, const std::string &chars) {
+  return string_scanner.find_first_of(p, len, chars);
+}
+
+void Split(const std::string &in, const std::string &delim, std::vector<std::string> *out) {
   if (in.empty() || !out) return;
   out->clear();
 
-  std::string::size_type pos = 0;
-  std::string elem, trimed_elem;
-  do {
-    pos = in.find_first_of(delim);
-    elem = in.substr(0, pos);
-    Trim(elem, delim, &trimed_elem);
-    if (!trimed_elem.empty()) out->push_back(trimed_elem);
-    in = in.substr(pos+1);
-  } while (pos != std::string::npos);
+  const char *p = in.data();
+  size_t len = in.size(), pos = 0;
+  while (pos < len) {
+    size_t end = pos + FindFirstOf(p + pos, len - pos, delim);
+    if (end > pos) out->emplace_back(p + pos, end - pos);
+    pos = end + 1;
+  }
 }
 
 int StringMatch(const std::string &pattern, const std::string &in, int nocase) {
   return StringMatchLen(pattern.c_str(), pattern.length(), in.c_str(), in.length(), nocase);
 }
 
+std::string GlobLiteralPrefix(const std::string &pattern, bool *match_all) {
+  std::string prefix;
+  size_t i = 0;
+  for (; i < pattern.size(); i++) {
+    char c = pattern[i];
+    if (c == '*' || c == '?' || c == '[') break;
+    if (c == '\\' && i + 1 < pattern.size()) c = pattern[++i];
+    prefix.push_back(c);
+  }
+  // the rest of the pattern is only the stars, or nothing for the pattern without wildcard
+  size_t rest = i;
+  while (rest < pattern.size() && pattern[rest] == '*') rest++;
+  *match_all = rest == pattern.size() && rest > i;
+  return prefix;
+}
+
 // Glob-style pattern matching.
 int StringMatchLen(const char *pattern, int patternLen,
                    const char *string, int stringLen, int nocase) {
@@ -281,6 +475,27 @@ bool IsPortInUse(int port) {
   return s.IsOK();
 }
 
+Status ParseCPUList(const std::string &in, std::vector<int> *cpus) {
+  cpus->clear();
+  std::vector<std::string> ranges;
+  Split(in, ",", &ranges);
+  for (const auto &range : ranges) {
+    int64_t first, last;
+    auto pos = range.find('-');
+    auto s = StringToNum(range.substr(0, pos), &first, 0, 1023);
+    if (!s.IsOK()) return Status(Status::NotOK, "invalid cpu: " + range);
+    last = first;
+    if (pos != std::string::npos) {
+      s = StringToNum(range.substr(pos + 1), &last, first, 1023);
+      if (!s.IsOK()) return Status(Status::NotOK, "invalid cpu range: " + range);
+    }
+    for (int64_t cpu = first; cpu <= last; cpu++) {
+      cpus->emplace_back(static_cast<int>(cpu));
+    }
+  }
+  return Status::OK();
+}
+
 void ThreadSetName(const char *name) {
 #ifdef __APPLE__
   pthread_setname_np(name);
@@ -288,4 +503,17 @@ void ThreadSetName(const char *name) {
   pthread_setname_np(pthread_self(), name);
 #endif
 }
+
+Status ThreadSetCPUAffinity(int cpu) {
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (ret != 0) return Status(Status::NotOK, strerror(ret));
+  return Status::OK();
+#else
+  return Status(Status::NotOK, "the cpu affinity is only supported on linux");
+#endif
+}
 }  // namespace Util
@@ -3,6 +3,7 @@
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 
 #include <cctype>
 #include <string>
@@ -13,9 +14,15 @@
 namespace Util {
 // sock util
 sockaddr_in NewSockaddrInet(const std::string &host, uint32_t port);
-Status SockConnect(std::string host, uint32_t port, int *fd);
+// SockConnect connects the host in blocking, the connecting fails after the timeout if it's positive
+Status SockConnect(std::string host, uint32_t port, int *fd, int timeout_ms = 0);
 Status SockSend(int fd, const std::string &data);
+// SockSendv writes all the vectors, the iov would be modified if it is partially written
+Status SockSendv(int fd, std::vector<iovec> *iov);
 int GetPeerAddr(int fd, std::string *addr, uint32_t *port);
+// SockListenUnix binds the unix socket of the path after the stale file is removed, and changes
+// its permission if perm isn't zero, the socket is nonblocking and listened with the backlog
+Status SockListenUnix(const std::string &path, int perm, int backlog, int *fd);
 bool IsPortInUse(int port);
 
 // string util
@@ -23,9 +30,21 @@ Status StringToNum(const std::string &str, int64_t *n, int64_t min = INT64_MIN,
 std::string ToLower(std::string in);
 void BytesToHuman(char *buf, size_t size, uint64_t n);
 void Trim(const std::string &in, const std::string &chars, std::string *out);
-void Split(std::string in, std::string delim, std::vector<std::string> *out);
+void Split(const std::string &in, const std::string &delim, std::vector<std::string> *out);
+// FindCRLF returns the offset of the first "\r\n", and FindFirstOf returns the offset of
+// the first byte in the chars, or the len if not found. They are vectorized by SSE2/AVX2
+// which is picked by the cpu at startup, and FindFirstOf is only vectorized for <= 4 chars
+size_t FindCRLF(const char *p, size_t len);
+size_t FindFirstOf(const char *p, size_t len, const std::string &chars);
 int StringMatch(const std::string &pattern, const std::string &in, int nocase);
 int StringMatchLen(const char *p, int plen, const char *s, int slen, int nocase);
+// GlobLiteralPrefix returns the literal prefix of the glob pattern before its first wildcard,
+// and sets match_all if all strings with the prefix match the pattern, like "prefix*"
+std::string GlobLiteralPrefix(const std::string &pattern, bool *match_all);
+// ParseCPUList parses the cpu list like "0-3,8,10-11" into the cpu ids
+Status ParseCPUList(const std::string &in, std::vector<int> *cpus);
 
 void ThreadSetName(const char *name);
+// ThreadSetCPUAffinity pins the current thread to the cpu, it's only supported on linux
+Status ThreadSetCPUAffinity(int cpu);
 }  // namespace Util
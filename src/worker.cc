@@ -1,6 +1,8 @@
 #include "worker.h"
 
 #include <glog/logging.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
 #include <list>
 #include <cctype>
 #include <utility>
@@ -8,16 +10,29 @@
 
 #include "redis_request.h"
 #include "redis_connection.h"
+#include "scripting.h"
 #include "server.h"
 #include "util.h"
 
 Worker::Worker(Server *svr, Config *config, bool repl) : svr_(svr), repl_(repl) {
-  base_ = event_base_new();
+  // the changes of the events in a round of the loop are merged into at most one epoll_ctl
+  // per fd, like the reads paused and resumed by the connection in the same round
+  auto event_cfg = event_config_new();
+  event_config_set_flag(event_cfg, EVENT_BASE_FLAG_EPOLL_USE_CHANGELIST);
+  base_ = event_base_new_with_config(event_cfg);
+  event_config_free(event_cfg);
   if (!base_) throw std::exception();
 
   timer_ = event_new(base_, -1, EV_PERSIST, TimerCB, this);
   timeval tm = {10, 0};
   evtimer_add(timer_, &tm);
+  pubsub_event_ = event_new(base_, -1, 0, PubSubCB, this);
+  resume_event_ = event_new(base_, -1, 0, ResumeCB, this);
+  ready_keys_event_ = event_new(base_, -1, 0, ReadyKeysCB, this);
+  monitor_event_ = event_new(base_, -1, 0, MonitorCB, this);
+  invalidation_event_ = event_new(base_, -1, 0, InvalidationCB, this);
+  lua_ = Lua::CreateState();
+  lua_generation_ = svr_->ScriptsGeneration();
 
   int port = repl ? config->repl_port : config->port;
   auto binds = repl ? config->repl_binds : config->binds;
@@ -33,13 +48,24 @@ Worker::Worker(Server *svr, Config *config, bool repl) : svr_(svr), repl_(repl)
 
 Worker::~Worker() {
   std::list<Redis::Connection*> conns;
-  for (const auto &iter : conns_) {
-    conns.emplace_back(iter.second);
+  for (const auto &conn : conns_) {
+    if (conn) conns.emplace_back(conn);
   }
   for (const auto &iter : conns) {
     iter->Close();
   }
   event_free(timer_);
+  event_free(pubsub_event_);
+  event_free(resume_event_);
+  event_free(ready_keys_event_);
+  event_free(monitor_event_);
+  event_free(invalidation_event_);
+  PubSubNode *node = pubsub_queue_.exchange(nullptr);
+  while (node) {
+    PubSubNode *next = node->next;
+    delete node;
+    node = next;
+  }
   if (rate_limit_group_ != nullptr) {
     bufferevent_rate_limit_group_free(rate_limit_group_);
   }
@@ -47,6 +73,17 @@ Worker::~Worker() {
     ev_token_bucket_cfg_free(rate_limit_group_cfg_);
   }
   event_base_free(base_);
+  Lua::DestroyState(lua_);
+}
+
+lua_State *Worker::Lua() {
+  auto generation = svr_->ScriptsGeneration();
+  if (generation != lua_generation_) {
+    Lua::DestroyState(lua_);
+    lua_ = Lua::CreateState();
+    lua_generation_ = generation;
+  }
+  return lua_;
 }
 
 void Worker::TimerCB(int, int16_t events, void *ctx) {
@@ -68,11 +105,14 @@ void Worker::newConnection(evconnlistener *listener, evutil_socket_t fd,
                << " from port: " << worker->svr_->GetConfig()->port << " thread #"
                << worker->tid_;
   }
-  int enable = 1;
-  if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, reinterpret_cast<void*>(&enable), sizeof(enable)) < 0) {
-    LOG(ERROR) << "[worker] Failed to set tcp-keepalive, err:" << evutil_socket_geterror(fd);
-    evutil_closesocket(fd);
-    return;
+  bool is_unix = address->sa_family == AF_UNIX;
+  if (!is_unix) {
+    Status s = setTCPOptions(fd, worker->svr_->GetConfig());
+    if (!s.IsOK()) {
+      LOG(ERROR) << "[worker] Failed to set the tcp options, err: " << s.Msg();
+      evutil_closesocket(fd);
+      return;
+    }
   }
   event_base *base = evconnlistener_get_base(listener);
   bufferevent *bev = bufferevent_socket_new(base, fd, BEV_OPT_CLOSE_ON_FREE);
@@ -83,7 +123,9 @@ void Worker::newConnection(evconnlistener *listener, evutil_socket_t fd,
   Status status = worker->AddConnection(conn);
   std::string ip;
   uint32_t port;
-  if (Util::GetPeerAddr(fd, &ip, &port) == 0) {
+  if (is_unix) {
+    conn->SetAddr(worker->svr_->GetConfig()->unixsocket, 0);
+  } else if (Util::GetPeerAddr(fd, &ip, &port) == 0) {
     conn->SetAddr(ip, port);
   }
   if (!status.IsOK()) {
@@ -114,6 +156,13 @@ Status Worker::listen(const std::string &host, int port, int backlog) {
   if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
     return Status(Status::NotOK, evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR()));
   }
+#ifdef TCP_DEFER_ACCEPT
+  // the connection is accepted after its first request arrives, or the seconds pass
+  int defer_accept = svr_->GetConfig()->tcp_defer_accept;
+  if (defer_accept > 0 && setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_accept, sizeof(defer_accept)) < 0) {
+    return Status(Status::NotOK, evutil_socket_error_to_string(EVUTIL_SOCKET_ERROR()));
+  }
+#endif
   evutil_make_socket_nonblocking(fd);
   auto lev = evconnlistener_new(base_, newConnection, this,
                                 LEV_OPT_CLOSE_ON_FREE, backlog, fd);
@@ -121,6 +170,37 @@ Status Worker::listen(const std::string &host, int port, int backlog) {
   return Status::OK();
 }
 
+Status Worker::ListenUnixSocket(int fd) {
+  int dup_fd = dup(fd);
+  if (dup_fd < 0) return Status(Status::NotOK, strerror(errno));
+  // the socket is already listening
+  auto lev = evconnlistener_new(base_, newConnection, this, LEV_OPT_CLOSE_ON_FREE, -1, dup_fd);
+  if (!lev) {
+    close(dup_fd);
+    return Status(Status::NotOK, "failed to create the listener");
+  }
+  listen_events_.emplace_back(lev);
+  return Status::OK();
+}
+
+Status Worker::setTCPOptions(int fd, Config *config) {
+  int enable = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable)) < 0) {
+    return Status(Status::NotOK, "tcp-keepalive: " + std::string(strerror(errno)));
+  }
+  if (config->tcp_nodelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)) < 0) {
+    return Status(Status::NotOK, "tcp-nodelay: " + std::string(strerror(errno)));
+  }
+  int sndbuf = config->tcp_sndbuf, rcvbuf = config->tcp_rcvbuf;
+  if (sndbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0) {
+    return Status(Status::NotOK, "tcp-sndbuf: " + std::string(strerror(errno)));
+  }
+  if (rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) {
+    return Status(Status::NotOK, "tcp-rcvbuf: " + std::string(strerror(errno)));
+  }
+  return Status::OK();
+}
+
 void Worker::Run(std::thread::id tid) {
   tid_ = tid;
   if (event_base_dispatch(base_) != 0) {
@@ -139,8 +219,8 @@ void Worker::Stop() {
 
 Status Worker::AddConnection(Redis::Connection *c) {
   std::unique_lock<std::mutex> lock(conns_mu_);
-  auto iter = conns_.find(c->GetFD());
-  if (iter != conns_.end()) {
+  auto fd = static_cast<size_t>(c->GetFD());
+  if (fd < conns_.size() && conns_[fd]) {
     return Status(Status::NotOK, "connection was exists");
   }
   int max_clients = svr_->GetConfig()->maxclients;
@@ -148,7 +228,9 @@ Status Worker::AddConnection(Redis::Connection *c) {
     svr_->DecrClientNum();
     return Status(Status::NotOK, "max number of clients reached");
   }
-  conns_.insert(std::pair<int, Redis::Connection*>(c->GetFD(), c));
+  if (fd >= conns_.size()) conns_.resize(fd + 1, nullptr);
+  conns_[fd] = c;
+  num_conns_++;
   uint64_t id = svr_->GetClientID()->fetch_add(1, std::memory_order_relaxed);
   c->SetID(id);
   return Status::OK();
@@ -158,13 +240,13 @@ Status Worker::AddConnection(Redis::Connection *c) {
 Redis::Connection *Worker::removeConnection(int fd) {
   Redis::Connection *conn = nullptr;
   std::unique_lock<std::mutex> lock(conns_mu_);
-  auto iter = conns_.find(fd);
-  if (iter != conns_.end()) {
-    conn = iter->second;
-    conns_.erase(iter);
+  if (static_cast<size_t>(fd) < conns_.size() && conns_[fd]) {
+    conn = conns_[fd];
+    conns_[fd] = nullptr;
+    num_conns_--;
     svr_->DecrClientNum();
   }
-  iter = monitor_conns_.find(fd);
+  auto iter = monitor_conns_.find(fd);
   if (iter != monitor_conns_.end()) {
     conn = iter->second;
     monitor_conns_.erase(iter);
@@ -187,6 +269,11 @@ void Worker::DetachConnection(Redis::Connection *conn) {
 
 void Worker::FreeConnection(Redis::Connection *conn) {
   if (!conn) return;
+  // the command executor still uses the connection, free it after the command is finished
+  if (conn->IsExecutingInBackground()) {
+    conn->EnableFlag(Redis::Connection::kFreeAfterExecution);
+    return;
+  }
   removeConnection(conn->GetFD());
   if (rate_limit_group_ != nullptr) {
     bufferevent_remove_from_rate_limit_group(conn->GetBufferEvent());
@@ -196,13 +283,18 @@ void Worker::FreeConnection(Redis::Connection *conn) {
 
 void Worker::FreeConnectionByID(int fd, uint64_t id) {
   std::unique_lock<std::mutex> lock(conns_mu_);
-  auto conn_iter = conns_.find(fd);
-  if (conn_iter != conns_.end() && conn_iter->second->GetID() == id) {
+  auto conn = static_cast<size_t>(fd) < conns_.size() ? conns_[fd] : nullptr;
+  if (conn && conn->GetID() == id) {
+    if (conn->IsExecutingInBackground()) {
+      conn->EnableFlag(Redis::Connection::kFreeAfterExecution);
+      return;
+    }
     if (rate_limit_group_ != nullptr) {
-      bufferevent_remove_from_rate_limit_group(conn_iter->second->GetBufferEvent());
+      bufferevent_remove_from_rate_limit_group(conn->GetBufferEvent());
     }
-    delete conn_iter->second;
-    conns_.erase(conn_iter);
+    delete conn;
+    conns_[fd] = nullptr;
+    num_conns_--;
     svr_->DecrClientNum();
   }
   auto monitor_conn_iter = monitor_conns_.find(fd);
@@ -214,22 +306,42 @@ void Worker::FreeConnectionByID(int fd, uint64_t id) {
   }
 }
 
-Status Worker::EnableWriteEvent(int fd) {
-  std::unique_lock<std::mutex> lock(conns_mu_);
-  auto iter = conns_.find(fd);
-  if (iter != conns_.end()) {
-    auto bev = iter->second->GetBufferEvent();
-    bufferevent_enable(bev, EV_WRITE);
-    return Status::OK();
-  }
-  return Status(Status::NotOK);
+struct FreeConnectionArgs {
+  Worker *worker;
+  int fd;
+  uint64_t id;
+};
+
+void Worker::FreeConnectionAsync(int fd, uint64_t id) {
+  auto args = new FreeConnectionArgs{this, fd, id};
+  timeval tm = {0, 0};
+  event_base_once(base_, -1, EV_TIMEOUT, [](int, int16_t, void *ctx) {
+    auto args = static_cast<FreeConnectionArgs *>(ctx);
+    args->worker->FreeConnectionByID(args->fd, args->id);
+    delete args;
+  }, args, &tm);
+}
+
+void Worker::CancelStreamingReplies() {
+  timeval tm = {0, 0};
+  event_base_once(base_, -1, EV_TIMEOUT, [](int, int16_t, void *ctx) {
+    auto worker = static_cast<Worker *>(ctx);
+    std::vector<Redis::Connection *> conns;
+    for (const auto conn : worker->conns_) {
+      if (conn && conn->IsStreamingReply()) conns.emplace_back(conn);
+    }
+    for (const auto conn : conns) {
+      LOG(WARNING) << "[worker] Going to close the client: " << conn->GetAddr() << ", id: " << conn->GetID()
+                   << ", while its streaming reply holds the closing db";
+      worker->FreeConnection(conn);
+    }
+  }, this, &tm);
 }
 
 Status Worker::Reply(int fd, const std::string &reply) {
   std::unique_lock<std::mutex> lock(conns_mu_);
-  auto iter = conns_.find(fd);
-  if (iter != conns_.end()) {
-    Redis::Reply(iter->second->Output(), reply);
+  if (static_cast<size_t>(fd) < conns_.size() && conns_[fd]) {
+    conns_[fd]->Reply(reply);
     return Status::OK();
   }
   return Status(Status::NotOK, "connection doesn't exist");
@@ -266,29 +378,176 @@ int Worker::SetReplicationRateLimit(uint64_t max_replication_bytes) {
 }
 
 void Worker::BecomeMonitorConn(Redis::Connection *conn) {
+  // enable the flag before it could be fed by other workers
+  conn->EnableFlag(Redis::Connection::kMonitor);
   conns_mu_.lock();
-  conns_.erase(conn->GetFD());
+  if (conns_[conn->GetFD()]) {
+    conns_[conn->GetFD()] = nullptr;
+    num_conns_--;
+  }
   monitor_conns_[conn->GetFD()] = conn;
   conns_mu_.unlock();
   svr_->IncrMonitorClientNum();
-  conn->EnableFlag(Redis::Connection::kMonitor);
 }
 
-void Worker::FeedMonitorConns(Redis::Connection *conn, const std::vector<std::string> &tokens) {
-  struct timeval tv;
-  gettimeofday(&tv, nullptr);
-  std::string output;
-  output += std::to_string(tv.tv_sec) + "." + std::to_string(tv.tv_usec);
-  output += " [" + conn->GetNamespace() + " " + conn->GetAddr() + "]";
-  for (const auto &token : tokens) {
-    output += " \"" + token + "\"";
+void Worker::FeedMonitorConns(const std::shared_ptr<MonitorRecords> &records) {
+  monitor_records_mu_.lock();
+  monitor_records_.emplace_back(records);
+  bool need_wakeup = monitor_records_.size() == 1;
+  monitor_records_mu_.unlock();
+  if (need_wakeup) event_active(monitor_event_, EV_READ, 0);
+}
+
+void Worker::MonitorCB(int, int16_t events, void *ctx) {
+  auto worker = static_cast<Worker *>(ctx);
+  std::vector<std::shared_ptr<MonitorRecords>> batches;
+  worker->monitor_records_mu_.lock();
+  batches.swap(worker->monitor_records_);
+  worker->monitor_records_mu_.unlock();
+
+  std::unique_lock<std::mutex> lock(worker->conns_mu_);
+  for (const auto &iter : worker->monitor_conns_) {
+    auto conn = iter.second;
+    const auto &filter = conn->GetMonitorFilter();
+    std::string monitor_ns = conn->GetNamespace();
+    bool all_namespaces = monitor_ns == kDefaultNamespace;
+    // the records of the batches are replied to the connection at once
+    std::string output;
+    for (const auto &records : batches) {
+      for (const auto &record : *records) {
+        if (record->conn_id == conn->GetID()) continue;  // skip the monitor command
+        if (filter.Match(*record, monitor_ns, all_namespaces)) output.append(record->line);
+      }
+    }
+    if (!output.empty()) conn->Reply(output);
   }
-  std::unique_lock<std::mutex> lock(conns_mu_);
-  for (const auto &iter : monitor_conns_) {
-    if (conn == iter.second) continue;  // skip the monitor command
-    if (conn->GetNamespace() == iter.second->GetNamespace()
-        || iter.second->GetNamespace() == kDefaultNamespace) {
-      iter.second->Reply(Redis::SimpleString(output));
+}
+
+void Worker::SubscribeChannel(const std::string &channel, Redis::Connection *conn) {
+  pubsub_channels_[channel].emplace_back(conn);
+}
+
+bool Worker::UnSubscribeChannel(const std::string &channel, Redis::Connection *conn) {
+  auto iter = pubsub_channels_.find(channel);
+  if (iter == pubsub_channels_.end()) return false;
+  auto conn_iter = std::find(iter->second.begin(), iter->second.end(), conn);
+  if (conn_iter == iter->second.end()) return false;
+  iter->second.erase(conn_iter);
+  if (iter->second.empty()) pubsub_channels_.erase(iter);
+  return true;
+}
+
+void Worker::PSubscribeChannel(const std::string &pattern, Redis::Connection *conn) {
+  pubsub_patterns_[pattern].emplace_back(conn);
+}
+
+bool Worker::PUnSubscribeChannel(const std::string &pattern, Redis::Connection *conn) {
+  auto iter = pubsub_patterns_.find(pattern);
+  if (iter == pubsub_patterns_.end()) return false;
+  auto conn_iter = std::find(iter->second.begin(), iter->second.end(), conn);
+  if (conn_iter == iter->second.end()) return false;
+  iter->second.erase(conn_iter);
+  if (iter->second.empty()) pubsub_patterns_.erase(iter);
+  return true;
+}
+
+void Worker::PublishMessage(const std::shared_ptr<PubSubMessage> &msg) {
+  auto node = new PubSubNode{msg, pubsub_queue_.load(std::memory_order_relaxed)};
+  while (!pubsub_queue_.compare_exchange_weak(node->next, node,
+                                              std::memory_order_release, std::memory_order_relaxed)) {
+  }
+  // only the publisher who pushed into the empty queue needs to wake up the worker,
+  // others would be delivered in the same round
+  if (node->next == nullptr) event_active(pubsub_event_, EV_READ, 0);
+}
+
+void Worker::PubSubCB(int, int16_t events, void *ctx) {
+  auto worker = static_cast<Worker *>(ctx);
+  worker->deliverPubSubMessages();
+}
+
+void Worker::deliverPubSubMessages() {
+  PubSubNode *head = pubsub_queue_.exchange(nullptr, std::memory_order_acquire);
+  // the nodes are pushed in reverse order, reverse them to keep the publish order
+  PubSubNode *nodes = nullptr;
+  while (head) {
+    PubSubNode *next = head->next;
+    head->next = nodes;
+    nodes = head;
+    head = next;
+  }
+  while (nodes) {
+    const auto &msg = nodes->msg;
+    if (!msg->reply.empty()) {
+      auto iter = pubsub_channels_.find(msg->channel);
+      if (iter != pubsub_channels_.end()) {
+        for (const auto &conn : iter->second) conn->Reply(msg->reply);
+      }
+    }
+    for (const auto &pattern_reply : msg->pattern_replies) {
+      auto iter = pubsub_patterns_.find(pattern_reply.first);
+      if (iter == pubsub_patterns_.end()) continue;
+      for (const auto &conn : iter->second) conn->Reply(pattern_reply.second);
+    }
+    PubSubNode *next = nodes->next;
+    delete nodes;
+    nodes = next;
+  }
+}
+
+void Worker::ResumeConnection(Redis::Connection *conn) {
+  resume_conns_mu_.lock();
+  resume_conns_.emplace_back(conn);
+  bool need_wakeup = resume_conns_.size() == 1;
+  resume_conns_mu_.unlock();
+  if (need_wakeup) event_active(resume_event_, EV_READ, 0);
+}
+
+void Worker::ResumeCB(int, int16_t events, void *ctx) {
+  auto worker = static_cast<Worker *>(ctx);
+  std::vector<Redis::Connection *> conns;
+  worker->resume_conns_mu_.lock();
+  conns.swap(worker->resume_conns_);
+  worker->resume_conns_mu_.unlock();
+  for (const auto &conn : conns) conn->Resume();
+}
+
+void Worker::AddBlockingKey(const std::string &ns_key, Redis::Connection *conn) {
+  blocking_keys_[ns_key].emplace_back(conn);
+}
+
+bool Worker::UnBlockingKey(const std::string &ns_key, Redis::Connection *conn) {
+  auto iter = blocking_keys_.find(ns_key);
+  if (iter == blocking_keys_.end()) return false;
+  auto conn_iter = std::find(iter->second.begin(), iter->second.end(), conn);
+  if (conn_iter == iter->second.end()) return false;
+  iter->second.erase(conn_iter);
+  if (iter->second.empty()) blocking_keys_.erase(iter);
+  return true;
+}
+
+void Worker::WakeupBlockingConns(const std::string &ns_key, size_t n_conns) {
+  ready_keys_mu_.lock();
+  ready_keys_.emplace_back(ns_key, n_conns);
+  bool need_wakeup = ready_keys_.size() == 1;
+  ready_keys_mu_.unlock();
+  if (need_wakeup) event_active(ready_keys_event_, EV_READ, 0);
+}
+
+void Worker::ReadyKeysCB(int, int16_t events, void *ctx) {
+  auto worker = static_cast<Worker *>(ctx);
+  std::vector<std::pair<std::string, size_t>> ready_keys;
+  worker->ready_keys_mu_.lock();
+  ready_keys.swap(worker->ready_keys_);
+  worker->ready_keys_mu_.unlock();
+  for (const auto &ready_key : ready_keys) {
+    // only the earliest blocked connections are woken up, and the served one is removed
+    // from all its blocking keys. stop at the first one which fails to pop since the
+    // elements are taken by others, and the rest keep blocking without retrying.
+    for (size_t i = 0; i < ready_key.second; i++) {
+      auto iter = worker->blocking_keys_.find(ready_key.first);
+      if (iter == worker->blocking_keys_.end()) break;
+      if (!iter->second.front()->OnBlockingKeyReady()) break;
     }
   }
 }
@@ -296,17 +555,27 @@ void Worker::FeedMonitorConns(Redis::Connection *conn, const std::vector<std::st
 std::string Worker::GetClientsStr() {
   std::unique_lock<std::mutex> lock(conns_mu_);
   std::string output;
-  for (const auto iter : conns_) {
-    Redis::Connection *conn = iter.second;
-    output.append(conn->ToString());
+  for (const auto &conn : conns_) {
+    if (conn) output.append(conn->ToString());
   }
   return output;
 }
 
+void Worker::GetClientsBufferSize(size_t *input, size_t *output, size_t *max_output) {
+  std::unique_lock<std::mutex> lock(conns_mu_);
+  for (const auto &conn : conns_) {
+    if (!conn) continue;
+    *input += evbuffer_get_length(conn->Input());
+    size_t output_size = evbuffer_get_length(conn->Output());
+    *output += output_size;
+    *max_output = std::max(*max_output, output_size);
+  }
+}
+
 void Worker::KillClient(Redis::Connection *self, uint64_t id, std::string addr, bool skipme, int64_t *killed) {
   conns_mu_.lock();
-  for (const auto iter : conns_) {
-    Redis::Connection* conn = iter.second;
+  for (const auto conn : conns_) {
+    if (!conn) continue;
     if (skipme && self == conn) continue;
     if ((!addr.empty() && conn->GetAddr() == addr) || (id != 0 && conn->GetID() == id)) {
       conn->EnableFlag(Redis::Connection::kCloseAfterReply);
@@ -324,21 +593,25 @@ void Worker::KillClient(Redis::Connection *self, uint64_t id, std::string addr,
 void Worker::KickoutIdleClients(int timeout) {
   conns_mu_.lock();
   std::list<std::pair<int, uint64_t>> to_be_killed_conns;
-  if (conns_.empty()) {
+  if (num_conns_ == 0) {
     conns_mu_.unlock();
     return;
   }
-  int iterations = std::min(static_cast<int>(conns_.size()), 50);
-  auto iter = conns_.upper_bound(last_iter_conn_fd);
-  while (iterations--) {
-    if (iter == conns_.end()) iter = conns_.begin();
-    if (static_cast<int>(iter->second->GetIdleTime()) >= timeout) {
-      to_be_killed_conns.emplace_back(std::make_pair(iter->first, iter->second->GetID()));
+  // check at most 50 connections each time, continue from the last checked one
+  int iterations = std::min(static_cast<int>(num_conns_), 50);
+  size_t fd = static_cast<size_t>(last_iter_conn_fd);
+  for (size_t i = 0; i < conns_.size() && iterations > 0; i++) {
+    fd = (fd + 1) % conns_.size();
+    auto conn = conns_[fd];
+    if (!conn) continue;
+    iterations--;
+    // the blocked connections are idle while waiting for the keys
+    if (conn->IsBlocked()) continue;
+    if (static_cast<int>(conn->GetIdleTime()) >= timeout) {
+      to_be_killed_conns.emplace_back(std::make_pair(static_cast<int>(fd), conn->GetID()));
     }
-    iter++;
   }
-  iter--;
-  last_iter_conn_fd = iter->first;
+  last_iter_conn_fd = static_cast<int>(fd);
   conns_mu_.unlock();
 
   for (const auto conn : to_be_killed_conns) {
@@ -354,6 +627,12 @@ void WorkerThread::Start() {
       } else {
         Util::ThreadSetName("worker");
       }
+      if (this->cpu_ >= 0) {
+        auto s = Util::ThreadSetCPUAffinity(this->cpu_);
+        if (!s.IsOK()) {
+          LOG(WARNING) << "[worker] Failed to pin the worker to cpu " << this->cpu_ << ", err: " << s.Msg();
+        }
+      }
       this->worker_->Run(t_.get_id());
     });
   } catch (const std::system_error &e) {
@@ -370,3 +649,130 @@ void WorkerThread::Stop() {
 void WorkerThread::Join() {
   if (t_.joinable()) t_.join();
 }
+
+void Worker::TrackKey(const std::string &ns_key, Redis::Connection *conn) {
+  auto &conns = tracking_keys_[ns_key];
+  conns.emplace(conn->GetFD(), conn->GetID());
+  size_t max_keys = svr_->GetConfig()->tracking_table_max_keys;
+  if (max_keys == 0 || tracking_keys_.size() <= max_keys) return;
+  // the evicted keys are invalidated, so the clients won't cache them without the tracking
+  std::vector<std::string> evicted_keys;
+  for (auto iter = tracking_keys_.begin(); iter != tracking_keys_.end(); iter++) {
+    if (iter->first == ns_key) continue;
+    evicted_keys.emplace_back(iter->first);
+    if (tracking_keys_.size() - evicted_keys.size() <= max_keys) break;
+  }
+  invalidateTrackedKeys(evicted_keys, false);
+}
+
+void Worker::TrackPrefix(const std::string &ns_prefix, Redis::Connection *conn) {
+  tracking_prefixes_[ns_prefix].emplace(conn->GetFD(), conn->GetID());
+}
+
+void Worker::UntrackPrefix(const std::string &ns_prefix, Redis::Connection *conn) {
+  auto iter = tracking_prefixes_.find(ns_prefix);
+  if (iter == tracking_prefixes_.end()) return;
+  iter->second.erase({conn->GetFD(), conn->GetID()});
+  if (iter->second.empty()) tracking_prefixes_.erase(iter);
+}
+
+void Worker::InvalidateKeys(const std::vector<std::string> &ns_keys) {
+  invalid_keys_mu_.lock();
+  bool need_wakeup = invalid_keys_.empty() && !invalidate_all_keys_;
+  if (ns_keys.empty()) {
+    invalidate_all_keys_ = true;
+  } else if (!invalidate_all_keys_) {
+    invalid_keys_.insert(invalid_keys_.end(), ns_keys.begin(), ns_keys.end());
+  }
+  invalid_keys_mu_.unlock();
+  if (need_wakeup) event_active(invalidation_event_, EV_READ, 0);
+}
+
+void Worker::InvalidationCB(int, int16_t events, void *ctx) {
+  auto worker = static_cast<Worker *>(ctx);
+  std::vector<std::string> ns_keys;
+  worker->invalid_keys_mu_.lock();
+  ns_keys.swap(worker->invalid_keys_);
+  bool all_keys = worker->invalidate_all_keys_;
+  worker->invalidate_all_keys_ = false;
+  worker->invalid_keys_mu_.unlock();
+  worker->invalidateTrackedKeys(ns_keys, all_keys);
+}
+
+// the invalidation message is the same as the message of __redis__:invalidate in the RESP2,
+// and the null array means all keys are invalidated
+static std::string invalidationMessage(const std::vector<std::string> *keys) {
+  std::string message = Redis::MultiLen(3);
+  message.append(Redis::BulkString("message"));
+  message.append(Redis::BulkString(Redis::kTrackingChannel));
+  message.append(keys ? Redis::MultiBulkString(*keys) : Redis::MultiLen(-1));
+  return message;
+}
+
+void Worker::invalidateTrackedKeys(const std::vector<std::string> &ns_keys, bool all_keys) {
+  // the tracked keys are removed once invalidated, the client would read and track them again
+  std::map<Redis::Connection *, std::vector<std::string>> conn_keys;
+  auto collect = [this, &conn_keys](const std::set<std::pair<int, uint64_t>> &clients, const std::string &ns_key) {
+    std::string ns, user_key;
+    ExtractNamespaceKey(ns_key, &ns, &user_key);
+    for (const auto &client : clients) {
+      auto conn = static_cast<size_t>(client.first) < conns_.size() ? conns_[client.first] : nullptr;
+      if (!conn || conn->GetID() != client.second || !conn->IsTracking()) continue;
+      conn_keys[conn].emplace_back(user_key);
+    }
+  };
+  if (all_keys) {
+    tracking_keys_.clear();
+    for (const auto conn : conns_) {
+      if (!conn || !conn->IsTracking()) continue;
+      const auto &redirect = conn->GetTrackingRedirect();
+      redirect.worker->DeliverInvalidation(redirect.fd, redirect.id, invalidationMessage(nullptr));
+    }
+    return;
+  }
+  for (const auto &ns_key : ns_keys) {
+    auto iter = tracking_keys_.find(ns_key);
+    if (iter != tracking_keys_.end()) {
+      collect(iter->second, ns_key);
+      tracking_keys_.erase(iter);
+    }
+    if (tracking_prefixes_.empty()) continue;
+    for (size_t i = 0; i <= ns_key.size(); i++) {
+      auto prefix_iter = tracking_prefixes_.find(ns_key.substr(0, i));
+      if (prefix_iter != tracking_prefixes_.end()) collect(prefix_iter->second, ns_key);
+    }
+  }
+  for (auto &iter : conn_keys) {
+    const auto &redirect = iter.first->GetTrackingRedirect();
+    redirect.worker->DeliverInvalidation(redirect.fd, redirect.id, invalidationMessage(&iter.second));
+  }
+}
+
+struct InvalidationArgs {
+  Worker *worker;
+  int fd;
+  uint64_t id;
+  std::string message;
+};
+
+void Worker::DeliverInvalidation(int fd, uint64_t id, std::string message) {
+  auto args = new InvalidationArgs{this, fd, id, std::move(message)};
+  timeval tm = {0, 0};
+  event_base_once(base_, -1, EV_TIMEOUT, [](int, int16_t, void *ctx) {
+    auto args = static_cast<InvalidationArgs *>(ctx);
+    auto &conns = args->worker->conns_;
+    auto conn = static_cast<size_t>(args->fd) < conns.size() ? conns[args->fd] : nullptr;
+    if (conn && conn->GetID() == args->id && conn->IsSubscribed(Redis::kTrackingChannel)) {
+      conn->Reply(args->message);
+    }
+    delete args;
+  }, args, &tm);
+}
+
+int Worker::FindConnectionFD(uint64_t id) {
+  std::unique_lock<std::mutex> lock(conns_mu_);
+  for (const auto conn : conns_) {
+    if (conn && conn->GetID() == id) return conn->GetFD();
+  }
+  return -1;
+}
@@ -4,18 +4,32 @@
 #include <event2/bufferevent.h>
 #include <event2/listener.h>
 #include <event2/util.h>
+#include <atomic>
 #include <cstring>
 #include <iostream>
+#include <list>
 #include <map>
 #include <memory>
+#include <set>
 #include <thread>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "storage.h"
+#include "monitor_feeder.h"
 #include "redis_connection.h"
 
 class Server;
+struct lua_State;
+
+struct PubSubMessage {
+  std::string channel;
+  // the reply for the channel subscribers, empty if nobody subscribed the channel
+  std::string reply;
+  // the replies for subscribers of each matched pattern
+  std::vector<std::pair<std::string, std::string>> pattern_replies;
+};
 
 class Worker {
  public:
@@ -29,17 +43,68 @@ class Worker {
   void DetachConnection(Redis::Connection *conn);
   void FreeConnection(Redis::Connection *conn);
   void FreeConnectionByID(int fd, uint64_t id);
+  // FreeConnectionAsync is thread safe, the connection would be freed by id in the worker thread
+  void FreeConnectionAsync(int fd, uint64_t id);
+  // CancelStreamingReplies is thread safe, the streaming connections would be closed in the worker
+  // thread, since the rest of the replies can't be read after the db is closed
+  void CancelStreamingReplies();
   Status AddConnection(Redis::Connection *c);
-  Status EnableWriteEvent(int fd);
+  // ListenUnixSocket accepts the connections of the listening unix socket in the worker,
+  // the fd is duplicated so the workers could share the socket
+  Status ListenUnixSocket(int fd);
   Status Reply(int fd, const std::string &reply);
   bool IsRepl() { return repl_; }
+  bool IsRateLimited() { return rate_limit_group_ != nullptr; }
   int SetReplicationRateLimit(uint64_t max_replication_bytes);
   void BecomeMonitorConn(Redis::Connection *conn);
-  void FeedMonitorConns(Redis::Connection *conn, const std::vector<std::string> &tokens);
+  // FeedMonitorConns is thread safe, the records would be replied to the monitor
+  // connections matched their filters in the worker thread
+  void FeedMonitorConns(const std::shared_ptr<MonitorRecords> &records);
+
+  // the subscriptions are only touched in the worker thread, and return false
+  // when the connection doesn't subscribe it
+  void SubscribeChannel(const std::string &channel, Redis::Connection *conn);
+  bool UnSubscribeChannel(const std::string &channel, Redis::Connection *conn);
+  void PSubscribeChannel(const std::string &pattern, Redis::Connection *conn);
+  bool PUnSubscribeChannel(const std::string &pattern, Redis::Connection *conn);
+  // PublishMessage is thread safe, the message would be delivered in the worker thread
+  void PublishMessage(const std::shared_ptr<PubSubMessage> &msg);
+  // ResumeConnection is thread safe, it's called by the command executor after the
+  // slow command is finished, and the connection would be resumed in the worker thread
+  void ResumeConnection(Redis::Connection *conn);
+  // the blocking keys are only touched in the worker thread, and UnBlockingKey
+  // returns false when the connection doesn't block on the key
+  void AddBlockingKey(const std::string &ns_key, Redis::Connection *conn);
+  bool UnBlockingKey(const std::string &ns_key, Redis::Connection *conn);
+  // WakeupBlockingConns is thread safe, at most n_conns of the connections blocking
+  // on the key would retry their commands in the worker thread by the blocking order
+  void WakeupBlockingConns(const std::string &ns_key, size_t n_conns);
+  // the tracking table is only touched in the worker thread, the keys are read by the
+  // tracking connections of the worker, and the prefixes are tracked by the BCAST ones
+  void TrackKey(const std::string &ns_key, Redis::Connection *conn);
+  void TrackPrefix(const std::string &ns_prefix, Redis::Connection *conn);
+  void UntrackPrefix(const std::string &ns_prefix, Redis::Connection *conn);
+  void IncrTrackingConns() { tracking_conns_.fetch_add(1); }
+  void DecrTrackingConns() { tracking_conns_.fetch_sub(1); }
+  bool HasTrackingConns() { return tracking_conns_ > 0; }
+  // InvalidateKeys is thread safe, the tracked keys are invalidated in the worker thread,
+  // and the empty keys invalidate all of them
+  void InvalidateKeys(const std::vector<std::string> &ns_keys);
+  // DeliverInvalidation is thread safe, the message is replied to the connection in the
+  // worker thread if it has subscribed the invalidation channel
+  void DeliverInvalidation(int fd, uint64_t id, std::string message);
+  // FindConnectionFD returns the fd of the connection, or -1 if it's not in the worker
+  int FindConnectionFD(uint64_t id);
 
   std::string GetClientsStr();
+  // GetClientsBufferSize sums up the input and output buffers of the connections, and returns
+  // the largest output buffer, so a slow reader could be found from the INFO
+  void GetClientsBufferSize(size_t *input, size_t *output, size_t *max_output);
   void KillClient(Redis::Connection *self, uint64_t id, std::string addr, bool skipme, int64_t *killed);
   void KickoutIdleClients(int timeout);
+  // the lua state is only touched in the worker thread, so the scripts of the worker run one by one.
+  // It's recreated after SCRIPT FLUSH to drop the compiled functions of the flushed scripts.
+  lua_State *Lua();
 
   Server *svr_;
 
@@ -47,7 +112,16 @@ class Worker {
   Status listen(const std::string &host, int port, int backlog);
   static void newConnection(evconnlistener *listener, evutil_socket_t fd,
                             sockaddr *address, int socklen, void *ctx);
+  // setTCPOptions applies the keepalive and the tcp options of the config to the accepted socket
+  static Status setTCPOptions(int fd, Config *config);
   static void TimerCB(int, int16_t events, void *ctx);
+  static void PubSubCB(int, int16_t events, void *ctx);
+  static void ResumeCB(int, int16_t events, void *ctx);
+  static void ReadyKeysCB(int, int16_t events, void *ctx);
+  static void MonitorCB(int, int16_t events, void *ctx);
+  static void InvalidationCB(int, int16_t events, void *ctx);
+  void deliverPubSubMessages();
+  void invalidateTrackedKeys(const std::vector<std::string> &ns_keys, bool all_keys);
   Redis::Connection *removeConnection(int fd);
 
 
@@ -56,18 +130,56 @@ class Worker {
   std::thread::id tid_;
   std::vector<evconnlistener*> listen_events_;
   std::mutex conns_mu_;
-  std::map<int, Redis::Connection*> conns_;
+  // the connections are indexed by the fd, the owner thread inserts and removes
+  // with the lock, since other threads iterate them for CLIENT LIST/KILL
+  std::vector<Redis::Connection*> conns_;
+  size_t num_conns_ = 0;
   std::map<int, Redis::Connection*> monitor_conns_;
+  std::mutex monitor_records_mu_;
+  std::vector<std::shared_ptr<MonitorRecords>> monitor_records_;
+  event *monitor_event_;
   int last_iter_conn_fd = 0;   // fd of last processed connection in previous cron
 
+  struct PubSubNode {
+    std::shared_ptr<PubSubMessage> msg;
+    PubSubNode *next;
+  };
+  // the pending messages are pushed by publishers without lock,
+  // and taken all at once by the worker
+  std::atomic<PubSubNode *> pubsub_queue_{nullptr};
+  event *pubsub_event_;
+  std::map<std::string, std::list<Redis::Connection *>> pubsub_channels_;
+  std::map<std::string, std::list<Redis::Connection *>> pubsub_patterns_;
+
+  std::mutex resume_conns_mu_;
+  std::vector<Redis::Connection *> resume_conns_;
+  event *resume_event_;
+
+  std::map<std::string, std::list<Redis::Connection *>> blocking_keys_;
+  std::mutex ready_keys_mu_;
+  std::vector<std::pair<std::string, size_t>> ready_keys_;
+  event *ready_keys_event_;
+
+  // the tracked keys and prefixes => fd and id of the tracking connections
+  std::unordered_map<std::string, std::set<std::pair<int, uint64_t>>> tracking_keys_;
+  std::map<std::string, std::set<std::pair<int, uint64_t>>> tracking_prefixes_;
+  std::atomic<int> tracking_conns_{0};
+  std::mutex invalid_keys_mu_;
+  std::vector<std::string> invalid_keys_;
+  bool invalidate_all_keys_ = false;
+  event *invalidation_event_;
+
   bool repl_;
+  lua_State *lua_;
+  uint64_t lua_generation_ = 0;
   struct bufferevent_rate_limit_group *rate_limit_group_ = nullptr;
   struct ev_token_bucket_cfg *rate_limit_group_cfg_ = nullptr;
 };
 
 class WorkerThread {
  public:
-  explicit WorkerThread(Worker *worker) : worker_(worker) {}
+  // @cpu: pin the thread to the cpu if it's not negative
+  explicit WorkerThread(Worker *worker, int cpu = -1) : worker_(worker), cpu_(cpu) {}
   ~WorkerThread() { delete worker_; }
   WorkerThread(const WorkerThread&) = delete;
   WorkerThread(WorkerThread&&) = delete;
@@ -79,4 +191,5 @@ class WorkerThread {
  private:
   std::thread t_;
   Worker *worker_;
+  int cpu_;
 };
@@ -0,0 +1,48 @@
+#include "background_job_stats.h"
+
+#include <gtest/gtest.h>
+
+static const uint64_t kSecond = 1000000;
+
+TEST(RollingCounters, Sum) {
+  RollingCounters counters(2);
+  std::vector<uint64_t> sums;
+  counters.Add(1000 * kSecond, 0, 1);
+  counters.Add(1000 * kSecond, 1, 10);
+  counters.Add(1100 * kSecond, 0, 2);
+  counters.Sum(1100 * kSecond, 60, &sums);
+  EXPECT_EQ(sums, std::vector<uint64_t>({2, 0}));
+  counters.Sum(1100 * kSecond, 300, &sums);
+  EXPECT_EQ(sums, std::vector<uint64_t>({3, 10}));
+  // the slot of the first round is overwritten by the later one, and the second is still in the window
+  uint64_t next_round = 1000 * kSecond + RollingCounters::kSlots * RollingCounters::kSlotSeconds * kSecond;
+  counters.Add(next_round, 0, 4);
+  counters.Sum(next_round, 900, &sums);
+  EXPECT_EQ(sums, std::vector<uint64_t>({6, 0}));
+  counters.Sum(next_round, 0, &sums);
+  EXPECT_EQ(sums, std::vector<uint64_t>({7, 10}));
+}
+
+TEST(BackgroundJobStats, GetInfo) {
+  BackgroundJobStats stats;
+  uint64_t now = 1000 * kSecond;
+  stats.RecordFlushBegin(1, now);
+  stats.RecordFlushCompleted("default", 1, 4096, now + 500);
+  stats.RecordCompaction("default", 1, 2000, 300, 200, 250, now);
+  stats.RecordStallChanged("default", BackgroundJobStats::kStallNormal, BackgroundJobStats::kStallDelayed, now);
+  stats.RecordStallChanged("default", BackgroundJobStats::kStallDelayed, BackgroundJobStats::kStallStopped,
+                           now + 100);
+  stats.RecordBackgroundError(BackgroundJobStats::kErrorCompaction, now);
+  std::string info;
+  stats.GetInfo(now + 1000, &info);
+  EXPECT_NE(info.find("flush_default_1m:count=1,duration_us=500,output_bytes=4096\r\n"), std::string::npos);
+  EXPECT_NE(info.find("compaction_default_L1_all:count=1,duration_us=2000,input_bytes=300,output_bytes=250,"
+                      "read_amp=3.00,write_amp=2.50\r\n"), std::string::npos);
+  EXPECT_NE(info.find("stall_default_1m:delayed=1,delayed_us=100,stopped=1,stopped_us=0\r\n"), std::string::npos);
+  EXPECT_NE(info.find("stall_default_condition:stopped,since_us=900\r\n"), std::string::npos);
+  EXPECT_NE(info.find("background_errors_5m:flush=0,compaction=1,writecallback=0,memtable=0\r\n"), std::string::npos);
+  // the events are out of the window of 15 minutes
+  stats.GetInfo(now + 1000 * kSecond, &info);
+  EXPECT_NE(info.find("flush_default_15m:count=0,duration_us=0,output_bytes=0\r\n"), std::string::npos);
+  EXPECT_NE(info.find("flush_default_all:count=1,duration_us=500,output_bytes=4096\r\n"), std::string::npos);
+}
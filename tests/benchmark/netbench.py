@@ -0,0 +1,458 @@
+#!/usr/bin/env python
+"""End-to-end network benchmark of kvrocks.
+
+It drives the RESP traffic with the configurable connections, pipeline depth
+and command mixes through the parser, worker and reply path, and writes the
+results as json, so the results of two builds could be compared:
+
+    python netbench.py --bin ../../build/kvrocks --output base.json
+    python netbench.py --bin ../../build/kvrocks --output new.json --compare base.json
+
+The servers were started from tests/scripts/test-{master,slave}.conf with --bin,
+or the running servers(see tests/scripts/setup-env.sh) were used without it.
+"""
+from __future__ import print_function, division
+
+import argparse
+import json
+import multiprocessing
+import os
+import random
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+PWD = os.path.dirname(os.path.realpath(__file__))
+SCRIPTS_DIR = os.path.join(PWD, '../scripts')
+PASSWORD = 'foobared'
+
+WORKLOADS = {
+    'set': [('set', 100)],
+    'get': [('get', 100)],
+    'mixed': [('get', 50), ('set', 30), ('hset', 10), ('hget', 10)],
+    'hash': [('hset', 50), ('hget', 50)],
+    'zset': [('zadd', 50), ('zscore', 50)],
+    'list': [('rpush', 50), ('lindex', 50)],
+    'set_type': [('sadd', 50), ('sismember', 50)],
+    'blocking': None,
+    'pubsub': None,
+    'replication': None,
+}
+DEFAULT_WORKLOADS = 'set,get,mixed,hash,zset,list,set_type,blocking,pubsub'
+
+
+def encode(*args):
+    out = [b'*' + str(len(args)).encode() + b'\r\n']
+    for arg in args:
+        if not isinstance(arg, bytes):
+            arg = str(arg).encode()
+        out.append(b'$' + str(len(arg)).encode() + b'\r\n' + arg + b'\r\n')
+    return b''.join(out)
+
+
+class Client(object):
+    """Client was a minimal blocking RESP client, the replies of the pipelined
+    commands were read in order without being decoded into the python objects"""
+
+    def __init__(self, host, port, password=None):
+        self.sock = socket.create_connection((host, port))
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.buf = b''
+        if password:
+            self.execute('auth', password)
+
+    def close(self):
+        self.sock.close()
+
+    def send(self, data):
+        self.sock.sendall(data)
+
+    def _fill(self):
+        data = self.sock.recv(65536)
+        if not data:
+            raise IOError('the connection was closed by the server')
+        self.buf += data
+
+    def _readline(self):
+        while True:
+            pos = self.buf.find(b'\r\n')
+            if pos >= 0:
+                line, self.buf = self.buf[:pos], self.buf[pos + 2:]
+                return line
+            self._fill()
+
+    def read_reply(self):
+        line = self._readline()
+        prefix, rest = line[:1], line[1:]
+        if prefix in (b'+', b':'):
+            return rest
+        if prefix == b'-':
+            raise RuntimeError(rest.decode())
+        if prefix == b'$':
+            size = int(rest)
+            if size < 0:
+                return None
+            while len(self.buf) < size + 2:
+                self._fill()
+            value, self.buf = self.buf[:size], self.buf[size + 2:]
+            return value
+        if prefix == b'*':
+            size = int(rest)
+            return None if size < 0 else [self.read_reply() for _ in range(size)]
+        raise RuntimeError('invalid reply: %r' % line)
+
+    def execute(self, *args):
+        self.send(encode(*args))
+        return self.read_reply()
+
+
+def now_us():
+    return time.time() * 1000000
+
+
+def percentile(sorted_values, pct):
+    if not sorted_values:
+        return 0
+    index = min(len(sorted_values) - 1, int(len(sorted_values) * pct / 100))
+    return sorted_values[index]
+
+
+def make_command(name, key, member, value):
+    if name == 'set':
+        return encode('set', key, value)
+    if name == 'get':
+        return encode('get', key)
+    if name == 'hset':
+        return encode('hset', key + ':h', member, value)
+    if name == 'hget':
+        return encode('hget', key + ':h', member)
+    if name == 'zadd':
+        return encode('zadd', key + ':z', member, member)
+    if name == 'zscore':
+        return encode('zscore', key + ':z', member)
+    if name == 'rpush':
+        return encode('rpush', key + ':l', value)
+    if name == 'lindex':
+        return encode('lindex', key + ':l', member)
+    if name == 'sadd':
+        return encode('sadd', key + ':s', member)
+    if name == 'sismember':
+        return encode('sismember', key + ':s', member)
+    raise ValueError('unknown command: ' + name)
+
+
+def pick(mix, rand):
+    n = rand.randint(1, sum(weight for _, weight in mix))
+    for name, weight in mix:
+        n -= weight
+        if n <= 0:
+            return name
+    return mix[-1][0]
+
+
+def run_mix_client(opts, mix, seed, queue):
+    """run_mix_client sends the pipelined batches until the duration was reached,
+    and the latency was the round trip of the whole batch"""
+    rand = random.Random(seed)
+    value = b'x' * opts.value_size
+    latencies = []
+    ops = errors = 0
+    client = Client(opts.host, opts.port, PASSWORD)
+    deadline = time.time() + opts.duration
+    while time.time() < deadline:
+        batch = []
+        for _ in range(opts.pipeline):
+            key = 'netbench:%d' % rand.randint(0, opts.keys - 1)
+            member = rand.randint(0, opts.members - 1)
+            batch.append(make_command(pick(mix, rand), key, member, value))
+        start = now_us()
+        client.send(b''.join(batch))
+        for _ in batch:
+            try:
+                client.read_reply()
+            except RuntimeError:
+                errors += 1
+        latencies.append(now_us() - start)
+        ops += len(batch)
+    client.close()
+    queue.put((ops, errors, latencies))
+
+
+def run_blocking_client(opts, seed, queue):
+    """the consumers were blocked on BLPOP of their own key, and the producer in the
+    same process pushes the item, so the latency was the wakeup of the blocked client"""
+    key = 'netbench:blocking:%d' % seed
+    consumer = Client(opts.host, opts.port, PASSWORD)
+    producer = Client(opts.host, opts.port, PASSWORD)
+    latencies = []
+    ops = errors = 0
+    deadline = time.time() + opts.duration
+    while time.time() < deadline:
+        start = now_us()
+        consumer.send(encode('blpop', key, 1))
+        producer.execute('rpush', key, 'item')
+        if consumer.read_reply() is None:
+            errors += 1
+        latencies.append(now_us() - start)
+        ops += 1
+    consumer.close()
+    producer.close()
+    queue.put((ops, errors, latencies))
+
+
+def run_subscriber(opts, channel, ready, queue):
+    client = Client(opts.host, opts.port, PASSWORD)
+    client.execute('subscribe', channel)
+    ready.set()
+    latencies = []
+    while True:
+        reply = client.read_reply()
+        if reply[2] == b'stop':
+            break
+        latencies.append(now_us() - float(reply[2]))
+    client.close()
+    queue.put((len(latencies), 0, latencies))
+
+
+def run_pubsub(opts):
+    """one publisher fans out the messages to every subscriber, the latency was
+    from the publishing to the delivery, measured by the timestamp in the message"""
+    channel = 'netbench:channel'
+    queue = multiprocessing.Queue()
+    procs = []
+    for _ in range(opts.num_conns):
+        ready = multiprocessing.Event()
+        proc = multiprocessing.Process(target=run_subscriber, args=(opts, channel, ready, queue))
+        proc.start()
+        ready.wait()
+        procs.append(proc)
+    publisher = Client(opts.host, opts.port, PASSWORD)
+    start = time.time()
+    while time.time() < start + opts.duration:
+        batch = [encode('publish', channel, repr(now_us())) for _ in range(opts.pipeline)]
+        publisher.send(b''.join(batch))
+        for _ in batch:
+            publisher.read_reply()
+    publisher.execute('publish', channel, 'stop')
+    publisher.close()
+    return collect(queue, procs, time.time() - start)
+
+
+def collect(queue, procs, elapsed):
+    ops = errors = 0
+    latencies = []
+    for _ in procs:
+        n, e, l = queue.get()
+        ops += n
+        errors += e
+        latencies.extend(l)
+    for proc in procs:
+        proc.join()
+    latencies.sort()
+    return {
+        'ops': ops,
+        'errors': errors,
+        'seconds': round(elapsed, 3),
+        'qps': round(ops / elapsed, 1) if elapsed > 0 else 0,
+        'p50_us': int(percentile(latencies, 50)),
+        'p99_us': int(percentile(latencies, 99)),
+        'p999_us': int(percentile(latencies, 99.9)),
+        'max_us': int(latencies[-1]) if latencies else 0,
+    }
+
+
+def run_clients(opts, target, args_of):
+    queue = multiprocessing.Queue()
+    procs = []
+    start = time.time()
+    for i in range(opts.num_conns):
+        proc = multiprocessing.Process(target=target, args=args_of(i) + (queue,))
+        proc.start()
+        procs.append(proc)
+    return collect(queue, procs, time.time() - start)
+
+
+def slave_lag(client):
+    info = client.execute('info', 'replication').decode()
+    lags = [int(field.split('=')[1]) for line in info.split('\r\n') if line.startswith('slave')
+            for field in line.split(',') if field.startswith('lag=')]
+    return max(lags) if lags else None
+
+
+def run_replication(opts):
+    """write to the master with the mixed workload, and sample the lag(in sequences)
+    of the slaves meanwhile, then measure the time of the slaves catching up"""
+    queue = multiprocessing.Queue()
+    procs = []
+    mix = [('set', 60), ('hset', 20), ('rpush', 20)]
+    start = time.time()
+    for i in range(opts.num_conns):
+        proc = multiprocessing.Process(target=run_mix_client, args=(opts, mix, i, queue))
+        proc.start()
+        procs.append(proc)
+    client = Client(opts.host, opts.port, PASSWORD)
+    lags = []
+    while any(proc.is_alive() for proc in procs) and time.time() < start + opts.duration:
+        lag = slave_lag(client)
+        if lag is None:
+            raise RuntimeError('no slave was connected to the master')
+        lags.append(lag)
+        time.sleep(0.1)
+    result = collect(queue, procs, time.time() - start)
+    catch_up_start = time.time()
+    while slave_lag(client) > 0 and time.time() < catch_up_start + 60:
+        time.sleep(0.01)
+    client.close()
+    result['max_lag'] = max(lags) if lags else 0
+    result['avg_lag'] = round(sum(lags) / len(lags), 1) if lags else 0
+    result['catch_up_ms'] = int((time.time() - catch_up_start) * 1000)
+    return result
+
+
+def run_workload(opts, name):
+    if name == 'blocking':
+        return run_clients(opts, run_blocking_client, lambda i: (opts, i))
+    if name == 'pubsub':
+        return run_pubsub(opts)
+    if name == 'replication':
+        return run_replication(opts)
+    return run_clients(opts, run_mix_client, lambda i: (opts, WORKLOADS[name], i))
+
+
+def wait_for_port(port, timeout=30):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(('127.0.0.1', port)).close()
+            return
+        except socket.error:
+            time.sleep(0.1)
+    raise RuntimeError('the server on port %d was not ready' % port)
+
+
+def start_server(bin_path, conf_name, work_dir):
+    """start the server from the test config, which was rewritten to run in the foreground
+    and put the db into the work dir"""
+    name = conf_name.split('.')[0]
+    db_dir = os.path.join(work_dir, name)
+    conf_path = os.path.join(work_dir, conf_name)
+    port = None
+    with open(os.path.join(SCRIPTS_DIR, conf_name)) as src, open(conf_path, 'w') as dst:
+        for line in src:
+            if line.startswith('daemonize '):
+                line = 'daemonize no\n'
+            elif line.startswith('dir '):
+                line = 'dir %s\n' % db_dir
+            elif line.startswith('port '):
+                port = int(line.split()[1])
+            dst.write(line)
+    proc = subprocess.Popen([bin_path, '-c', conf_path])
+    wait_for_port(port)
+    return proc
+
+
+def compare(base_path, results, threshold):
+    """print the qps and p99 changes from the base results, and return the regressions
+    which the qps dropped more than the threshold(percent)"""
+    with open(base_path) as f:
+        base = dict((r['name'], r) for r in json.load(f)['results'])
+    regressions = []
+    print('\n%-24s %12s %12s %8s %10s %10s' % ('workload', 'base_qps', 'qps', 'change', 'base_p99', 'p99'))
+    for r in results:
+        b = base.get(r['name'])
+        if not b or not b['qps']:
+            continue
+        change = (r['qps'] - b['qps']) * 100 / b['qps']
+        print('%-24s %12.1f %12.1f %7.1f%% %10d %10d' % (r['name'], b['qps'], r['qps'], change,
+                                                         b['p99_us'], r['p99_us']))
+        if change < -threshold:
+            regressions.append(r['name'])
+    return regressions
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description='end-to-end network benchmark of kvrocks')
+    parser.add_argument('--bin', help='the kvrocks binary, use the running servers if not set')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=6666)
+    parser.add_argument('--workloads', default=DEFAULT_WORKLOADS,
+                        help='workloads separated by comma, from: ' + ','.join(sorted(WORKLOADS)))
+    parser.add_argument('--connections', default='1,16', help='connection counts separated by comma')
+    parser.add_argument('--pipelines', default='1,16', help='pipeline depths separated by comma')
+    parser.add_argument('--duration', type=float, default=5, help='seconds of each run')
+    parser.add_argument('--keys', type=int, default=10000)
+    parser.add_argument('--members', type=int, default=100)
+    parser.add_argument('--value-size', type=int, default=64)
+    parser.add_argument('--output', help='write the json results into the file')
+    parser.add_argument('--compare', help='compare with the json results of the base build')
+    parser.add_argument('--threshold', type=float, default=10,
+                        help='the max percent of qps drop before it was treated as regression')
+    return parser.parse_args()
+
+
+def main():
+    opts = parse_args()
+    workloads = opts.workloads.split(',')
+    for name in workloads:
+        if name not in WORKLOADS:
+            print('unknown workload: ' + name)
+            return 1
+
+    servers = []
+    work_dir = None
+    if opts.bin:
+        work_dir = tempfile.mkdtemp(prefix='kvrocks-netbench-')
+        servers.append(start_server(opts.bin, 'test-master.conf', work_dir))
+        if 'replication' in workloads:
+            servers.append(start_server(opts.bin, 'test-slave.conf', work_dir))
+            time.sleep(1)
+    try:
+        server_info = Client(opts.host, opts.port, PASSWORD).execute('info', 'server').decode()
+        info = dict(line.split(':', 1) for line in server_info.split('\r\n') if ':' in line)
+        results = []
+        connection_counts = [int(n) for n in opts.connections.split(',')]
+        for name in workloads:
+            for connections in connection_counts:
+                # the blocking clients wait for the reply before the next push
+                pipelines = [1] if name == 'blocking' else [int(n) for n in opts.pipelines.split(',')]
+                for pipeline in pipelines:
+                    opts.num_conns, opts.pipeline = connections, pipeline
+                    result = run_workload(opts, name)
+                    result['name'] = '%s/c%d/p%d' % (name, connections, pipeline)
+                    results.append(result)
+                    print('%-24s qps=%-10.1f p50=%dus p99=%dus p99.9=%dus max=%dus errors=%d%s' % (
+                        result['name'], result['qps'], result['p50_us'], result['p99_us'],
+                        result['p999_us'], result['max_us'], result['errors'],
+                        ' max_lag=%d catch_up=%dms' % (result['max_lag'], result['catch_up_ms'])
+                        if 'max_lag' in result else ''))
+    finally:
+        for server in servers:
+            server.terminate()
+            server.wait()
+        if work_dir:
+            shutil.rmtree(work_dir, ignore_errors=True)
+
+    report = {
+        'version': info.get('version'),
+        'git_sha1': info.get('git_sha1'),
+        'time': int(time.time()),
+        'options': {'duration': opts.duration, 'keys': opts.keys, 'members': opts.members,
+                    'value_size': opts.value_size},
+        'results': results,
+    }
+    if opts.output:
+        with open(opts.output, 'w') as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+    if opts.compare:
+        regressions = compare(opts.compare, results, opts.threshold)
+        if regressions:
+            print('\nregressions: ' + ', '.join(regressions))
+            return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
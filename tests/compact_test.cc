@@ -5,6 +5,7 @@
 #include "redis_metadata.h"
 #include "redis_hash.h"
 #include "redis_zset.h"
+#include "compaction_checker.h"
 
 TEST(Compact, Filter) {
   Config config;
@@ -74,3 +75,36 @@ TEST(Compact, Filter) {
 
   delete zset;
 }
+
+TEST(Compact, PickCompactionFiles) {
+  Config config;
+  config.db_dir = "compactcheckerdb";
+  config.backup_dir = "compactcheckerdb/backup";
+
+  auto storage = new Engine::Storage(&config);
+  Status s = storage->Open();
+  assert(s.IsOK());
+
+  int ret;
+  auto hash = new Redis::Hash(storage, "test_compaction_checker");
+  std::vector<Slice> fields;
+  std::vector<std::string> field_strs;
+  for (int i = 0; i < 20000; i++) field_strs.emplace_back("field" + std::to_string(i));
+  for (const auto &field : field_strs) {
+    hash->Set("hash_key", field, "value", &ret);
+    fields.emplace_back(field);
+  }
+  rocksdb::DB *db = storage->GetDB();
+  auto cf_handle = storage->GetCFHandle("default");
+  db->Flush(rocksdb::FlushOptions(), cf_handle);
+  hash->Delete("hash_key", fields, &ret);
+  db->Flush(rocksdb::FlushOptions(), cf_handle);
+  delete hash;
+
+  CompactionChecker checker(storage);
+  EXPECT_FALSE(checker.IsCompactionBehind());
+  EXPECT_EQ(checker.PickCompactionFiles(0.3, 4), 1);
+  // the tombstones are dropped by the compaction
+  EXPECT_EQ(checker.PickCompactionFiles(0.3, 4), 0);
+  delete storage;
+}
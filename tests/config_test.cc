@@ -1,5 +1,6 @@
 #include "config.h"
 #include "server.h"
+#include <fstream>
 #include <map>
 #include <vector>
 #include <gtest/gtest.h>
@@ -15,12 +16,27 @@ TEST(Config, Profiling) {
       {"profiling-sample-record-max-len" , "1"},
       {"profiling-sample-record-threshold-ms" , "50"},
       {"profiling-sample-commands" , "get,set"},
+      {"perf-stats-sample-ratio" , "10"},
+      {"hotkeys-sample-ratio" , "10"},
+      {"active-expire-keys-per-sec" , "1000"},
+      {"sortedint-block-size" , "128"},
+      {"streaming-reply-min-elements" , "100"},
+      {"lua-time-limit" , "1000"},
+      {"rocksdb.scan_readahead_size" , "1048576"},
+      {"compaction-checker-range" , "22-5"},
+      {"io-rate-limit-peak-qps" , "10000"},
+      {"namespace-max-qps" , "1000"},
+      {"namespace-max-net-out-mb" , "10"},
+      {"client-output-buffer-limit" , "normal 0 0 0 pubsub 16 4 30 monitor 256 64 60"},
+      {"tcp-nodelay" , "no"},
+      {"tcp-sndbuf" , "65536"},
+      {"tcp-rcvbuf" , "65536"},
   };
   std::vector<std::string> values;
   for (const auto &iter : cases) {
     config.Set(iter.first, iter.second, &srv);
     config.Get(iter.first, &values);
-    ASSERT_EQ(values.size(), 2);
+    ASSERT_EQ(values.size(), 2u);
     EXPECT_EQ(values[0], iter.first);
     EXPECT_EQ(values[1], iter.second);
   }
@@ -29,13 +45,54 @@ TEST(Config, Profiling) {
   for (const auto &iter : cases) {
     config.Set(iter.first, iter.second, &srv);
     config.Get(iter.first, &values);
-    ASSERT_EQ(values.size(), 2);
+    ASSERT_EQ(values.size(), 2u);
     EXPECT_EQ(values[0], iter.first);
     EXPECT_EQ(values[1], iter.second);
   }
   unlink(path);
 }
 
+TEST(Config, DBPaths) {
+  const char *path = "dbpaths.conf";
+  {
+    std::ofstream file(path);
+    file << "dir dbpathsdir\nrocksdb.db_paths /mnt/hdd/kvrocks:0\n";
+  }
+  Config config;
+  EXPECT_FALSE(config.Load(path).IsOK());
+  {
+    std::ofstream file(path);
+    file << "dir dbpathsdir\nrocksdb.db_paths dbpathsdir/db/:1024,/mnt/hdd/kvrocks:0\n";
+  }
+  Config new_config;
+  EXPECT_TRUE(new_config.Load(path).IsOK());
+  unlink(path);
+}
+
+TEST(Config, TCPOptions) {
+  const char *path = "tcpoptions.conf";
+  for (const auto &option : {"tcp-sndbuf", "tcp-rcvbuf", "tcp-defer-accept"}) {
+    for (const auto &value : {"abc", "-1"}) {
+      {
+        std::ofstream file(path);
+        file << "dir tcpoptionsdir\n" << option << " " << value << "\n";
+      }
+      Config config;
+      EXPECT_FALSE(config.Load(path).IsOK()) << option << " " << value;
+    }
+  }
+  {
+    std::ofstream file(path);
+    file << "dir tcpoptionsdir\ntcp-sndbuf 65536\ntcp-rcvbuf 32768\ntcp-defer-accept 5\n";
+  }
+  Config config;
+  ASSERT_TRUE(config.Load(path).IsOK());
+  EXPECT_EQ(65536, config.tcp_sndbuf);
+  EXPECT_EQ(32768, config.tcp_rcvbuf);
+  EXPECT_EQ(5, config.tcp_defer_accept);
+  unlink(path);
+}
+
 TEST(Namespace, Add) {
   Config config;
   EXPECT_TRUE(!config.AddNamespace("ns", "t0").IsOK());
@@ -58,3 +58,29 @@ def test_bitpos():
     assert(ret == 1024*8)
     ret = conn.delete(key)
     assert(ret == 1)
+
+def test_msetbit():
+    key = "test_msetbit"
+    conn = get_redis_conn()
+    ret = conn.execute_command("MSETBIT", key, 0, 1, 1024*8+1, 1, 0, 0)
+    assert(ret == [0, 0, 1])
+    ret = conn.getbit(key, 1024*8+1)
+    assert(ret == 1)
+    ret = conn.bitcount(key)
+    assert(ret == 1)
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_setbitrange():
+    key = "test_setbitrange"
+    conn = get_redis_conn()
+    ret = conn.execute_command("SETBITRANGE", key, 3, 1024*8+4, 1)
+    assert(ret == 1024*8+2)
+    ret = conn.execute_command("SETBITRANGE", key, 0, 7, 0)
+    assert(ret == 5)
+    ret = conn.bitcount(key)
+    assert(ret == 1024*8-3)
+    ret = conn.getbit(key, 1024*8+5)
+    assert(ret == 0)
+    ret = conn.delete(key)
+    assert(ret == 1)
@@ -5,6 +5,11 @@ import redis
 PWD = os.path.dirname(os.path.realpath(__file__))
 WORKDIR = os.path.join(PWD,'../')
 
+UNIX_SOCKET_PATH = "/tmp/kvrocks-test-master.sock"
+
+def get_redis_unix_conn():
+    return redis.Redis(unix_socket_path=UNIX_SOCKET_PATH, password="foobared")
+
 def get_redis_conn(master=True):
     if master:
         r = redis.Redis("127.0.0.1", 6666, 0, "foobared")
@@ -0,0 +1,43 @@
+import redis
+from assert_helper import *
+from conn import *
+
+def test_geoadd():
+    key = "test_geoadd"
+    conn = get_redis_conn()
+    ret = conn.execute_command("geoadd", key, 13.361389, 38.115556, "Palermo", 15.087269, 37.502669, "Catania")
+    assert(ret == 2)
+    assert_raise(redis.ResponseError, conn.execute_command, "geoadd", key, 200, 100, "invalid")
+    ret = conn.execute_command("geodist", key, "Palermo", "Catania", "km")
+    assert(ret == "166.2742")
+    ret = conn.execute_command("geohash", key, "Palermo", "Catania")
+    assert(ret == ["sqc8b49rny0", "sqdtr74hyu0"])
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_georadius():
+    key = "test_georadius"
+    conn = get_redis_conn()
+    conn.execute_command("geoadd", key, 13.361389, 38.115556, "Palermo", 15.087269, 37.502669, "Catania")
+    ret = conn.execute_command("georadius", key, 15, 37, 200, "km", "asc")
+    assert(ret == ["Catania", "Palermo"])
+    ret = conn.execute_command("georadius", key, 15, 37, 200, "km", "withdist", "asc")
+    assert(ret == [["Catania", "56.4413"], ["Palermo", "190.4424"]])
+    ret = conn.execute_command("georadiusbymember", key, "Palermo", 100, "km")
+    assert(ret == ["Palermo"])
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_geosearch():
+    key = "test_geosearch"
+    dest = "test_geosearch_dest"
+    conn = get_redis_conn()
+    conn.execute_command("geoadd", key, 13.361389, 38.115556, "Palermo", 15.087269, 37.502669, "Catania")
+    ret = conn.execute_command("geosearch", key, "fromlonlat", 15, 37, "bybox", 400, 400, "km", "asc")
+    assert(ret == ["Catania", "Palermo"])
+    ret = conn.execute_command("geosearchstore", dest, key, "frommember", "Palermo", "byradius", 200, "km")
+    assert(ret == 2)
+    ret = conn.zcard(dest)
+    assert(ret == 2)
+    ret = conn.delete(key, dest)
+    assert(ret == 2)
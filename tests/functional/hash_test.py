@@ -164,3 +164,25 @@ def test_hscan():
 
     ret = conn.delete(key)
     assert (ret == 1)
+
+
+def test_hgetall_streaming():
+    key = "test_hgetall_streaming"
+    conn = get_redis_conn()
+    # larger than the streaming-reply-min-elements and the output high watermark
+    kvs = {'kkk-%s' % i: 'v' * 100 + str(i) for i in range(50000)}
+    for i in range(0, 50000, 1000):
+        ret = conn.hmset(key, {'kkk-%s' % j: kvs['kkk-%s' % j] for j in range(i, i + 1000)})
+        assert(ret == True)
+    pipe = conn.pipeline(transaction=False)
+    pipe.hgetall(key)
+    pipe.hkeys(key)
+    pipe.hvals(key)
+    pipe.hlen(key)
+    ret = pipe.execute()
+    assert(ret[0] == kvs)
+    assert(sorted(ret[1]) == sorted(kvs.keys()))
+    assert(sorted(ret[2]) == sorted(kvs.values()))
+    assert(ret[3] == len(kvs))
+    ret = conn.delete(key)
+    assert(ret == 1)
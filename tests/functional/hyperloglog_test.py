@@ -0,0 +1,54 @@
+import redis
+from assert_helper import *
+from conn import *
+
+def test_pfadd():
+    key = "test_pfadd"
+    conn = get_redis_conn()
+    ret = conn.pfadd(key, "a", "b", "c")
+    assert(ret == 1)
+    ret = conn.pfadd(key, "a", "b")
+    assert(ret == 0)
+    ret = conn.pfcount(key)
+    assert(ret == 3)
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_pfcount():
+    key = "test_pfcount"
+    conn = get_redis_conn()
+    elements = ["element-%d" % i for i in range(10000)]
+    for i in range(0, len(elements), 1000):
+        conn.pfadd(key, *elements[i:i+1000])
+    ret = conn.pfcount(key)
+    assert(abs(ret - 10000) < 300)
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_pfmerge():
+    key1 = "test_pfmerge1"
+    key2 = "test_pfmerge2"
+    dest = "test_pfmerge_dest"
+    conn = get_redis_conn()
+    conn.pfadd(key1, "a", "b", "c")
+    conn.pfadd(key2, "c", "d")
+    ret = conn.pfmerge(dest, key1, key2)
+    assert(ret == True)
+    ret = conn.pfcount(dest)
+    assert(ret == 4)
+    ret = conn.pfcount(key1, key2)
+    assert(ret == 4)
+    conn.set(key1, "v")
+    assert_raise(redis.ResponseError, conn.pfadd, key1, "a")
+    ret = conn.delete(key1, key2, dest)
+    assert(ret == 3)
+
+
+def test_hyperloglog_type():
+    key = "test_hyperloglog_type"
+    conn = get_redis_conn()
+    conn.pfadd(key, "a")
+    ret = conn.type(key)
+    assert(ret == "string")
+    ret = conn.delete(key)
+    assert(ret == 1)
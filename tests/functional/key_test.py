@@ -291,6 +291,31 @@ def test_scan():
     assert (ret == 1)
 
 
+def test_keys_and_scan_with_pattern():
+    conn = get_redis_conn()
+    keys = ["test_pattern:1:a", "test_pattern:2:b", "test_pattern:3:a"]
+    for key in keys:
+        conn.set(key, "bar")
+    conn.hset("test_pattern:4:a", "f", "v")
+
+    ret = conn.execute_command("KEYS", "test_pattern:*:a")
+    assert (sorted(ret) == ["test_pattern:1:a", "test_pattern:3:a", "test_pattern:4:a"])
+    ret = conn.execute_command("KEYS", "test_pattern:[12]:?")
+    assert (sorted(ret) == ["test_pattern:1:a", "test_pattern:2:b"])
+
+    found = []
+    cursor = "0"
+    while True:
+        cursor, ret = conn.execute_command("SCAN", cursor, "MATCH", "test_pattern:*:a", "COUNT", 1, "TYPE", "string")
+        found.extend(ret)
+        if cursor == "0":
+            break
+    assert (sorted(found) == ["test_pattern:1:a", "test_pattern:3:a"])
+
+    ret = conn.delete(*(keys + ["test_pattern:4:a"]))
+    assert (ret == 4)
+
+
 def test_flushdb():
     key = "test_flushdb"
     key_zset = key + "_zset"
@@ -359,3 +384,21 @@ def test_flushall():
     assert (ret == False)
     ret = conn.exists(key_zset)
     assert (ret == False)
+
+
+def test_cluster_keys_in_slot():
+    conn = get_redis_conn()
+    keys = ["{test_cluster_slot}a", "{test_cluster_slot}b", "{test_cluster_slot}c"]
+    slot = conn.execute_command("cluster", "keyslot", keys[0])
+    for key in keys:
+        assert (conn.set(key, "bar"))
+        assert (conn.execute_command("cluster", "keyslot", key) == slot)
+    ret = conn.execute_command("cluster", "countkeysinslot", slot)
+    assert (ret >= 3)
+    ret = conn.execute_command("cluster", "getkeysinslot", slot, 2)
+    assert (len(ret) == 2)
+    ret = conn.execute_command("cluster", "getkeysinslot", slot, 100)
+    assert (set(keys) <= set(ret))
+
+    ret = conn.delete(*keys)
+    assert (ret == 3)
@@ -234,3 +234,26 @@ def test_bpop():
     ret = conn.lpush(key, "b")
     assert(ret == 1)
 
+
+def bpop_waiter(key, results):
+    conn = get_redis_conn()
+    results.append(conn.execute_command("blpop", key, 5))
+
+
+def test_bpop_multiple_waiters():
+    key = "test_bpop_multiple_waiters"
+    conn = get_redis_conn()
+    results = []
+    waiters = [threading.Thread(target=bpop_waiter, args=(key, results)) for _ in range(3)]
+    for waiter in waiters:
+        waiter.start()
+
+    time.sleep(1)
+    # each pushed element was served to one waiter, and the rest timed out
+    ret = conn.rpush(key, "a", "b")
+    assert(ret == 2)
+    for waiter in waiters:
+        waiter.join()
+    assert(sorted(results, key=lambda x: x or "") == [None, "a", "b"])
+    ret = conn.llen(key)
+    assert(ret == 0)
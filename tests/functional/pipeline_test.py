@@ -15,3 +15,36 @@ def test_pipeline_without_transaction():
     assert(ret == [1, 1, 1, 1, 4])
     ret = conn.delete(key)
     assert(ret == 1)
+
+def test_pipeline_with_transaction():
+    key = "test_pipeline_with_transaction"
+    conn = get_redis_conn()
+    pipe = conn.pipeline(True)
+    pipe.hset(key, "f1", "v1")
+    pipe.hset(key, "f1", "v2")
+    pipe.hset(key, "f2", "v3")
+    pipe.hlen(key)
+    pipe.hget(key, "f1")
+    ret = pipe.execute()
+    assert(ret == [1, 0, 1, 2, "v2"])
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_transaction_aborted_by_watched_key():
+    key = "test_transaction_aborted_by_watched_key"
+    conn = get_redis_conn()
+    other_conn = get_redis_conn()
+    pipe = conn.pipeline(True)
+    pipe.watch(key)
+    other_conn.set(key, "v1")
+    pipe.multi()
+    pipe.set(key, "v2")
+    try:
+        pipe.execute()
+        assert(False)
+    except redis.WatchError:
+        pass
+    ret = conn.get(key)
+    assert(ret == "v1")
+    ret = conn.delete(key)
+    assert(ret == 1)
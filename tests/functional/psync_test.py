@@ -155,3 +155,56 @@ def test_psync_bitmap():
 
     ret = conn.delete(key)
     assert(ret == 1)
+
+def test_psync_read_your_writes():
+    key = "test_psync_read_your_writes"
+    conn = get_redis_conn()
+    conn_slave = get_redis_conn(False)
+    ret = conn.set(key, "bar")
+    assert(ret == True)
+    seq = conn.execute_command("lastseq")
+    assert(seq > 0)
+    ret = conn.execute_command("wait", 1, 1000)
+    assert(ret == 1)
+    ret = conn_slave.execute_command("waitseq", seq, 1000)
+    assert(ret >= seq)
+    value = conn_slave.get(key)
+    assert(value == "bar")
+    ret = conn_slave.execute_command("waitseq", seq + 1000000, 10)
+    assert(ret < seq + 1000000)
+
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_psync_waitseq_parks_the_connection():
+    conn_slave = get_redis_conn(False)
+    seq = conn_slave.execute_command("waitseq", 0, 0)
+    pipe = conn_slave.pipeline(transaction=False)
+    pipe.execute_command("waitseq", seq + 1000000, 200)
+    pipe.ping()
+    start = time.time()
+    ret = pipe.execute()
+    # the commands after the parked one are executed after it replies
+    assert(ret[0] < seq + 1000000)
+    assert(ret[1] == True)
+    assert(time.time() - start >= 0.2)
+
+def test_psync_semi_sync_ack():
+    key = "test_psync_semi_sync_ack"
+    conn = get_redis_conn()
+    conn_slave = get_redis_conn(False)
+    ret = conn.config_set("repl-min-ack-slaves", 1)
+    assert(ret == True)
+    try:
+        ret = conn.set(key, "bar")
+        assert(ret == True)
+        # the reply was held til the slave has applied the write
+        value = conn_slave.get(key)
+        assert(value == "bar")
+        info = conn.info("replication")
+        assert(info["slave0"]["ack_offset"] >= conn.execute_command("lastseq"))
+    finally:
+        conn.config_set("repl-min-ack-slaves", 0)
+
+    ret = conn.delete(key)
+    assert(ret == 1)
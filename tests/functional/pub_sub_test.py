@@ -23,7 +23,7 @@ def psubscribe(pattern, master=True):
     p.psubscribe(pattern)
 
     for item in p.listen():
-        if item['type'] == "message":
+        if item['type'] == "pmessage":
             assert (item['data'] == "a")
             p.punsubscribe()
             break
@@ -50,6 +50,27 @@ def test_replication():
     assert (ret == [])
 
 
+def test_replication_in_multi():
+    channel = "test_publish_in_multi"
+
+    y = threading.Thread(target=subscribe, args=(channel, False))
+    y.start()
+
+    time.sleep(1)
+
+    # the publish is in the middle of the batch of EXEC
+    conn = get_redis_conn()
+    pipe = conn.pipeline(transaction=True)
+    pipe.set("test_publish_in_multi_key", "v")
+    pipe.publish(channel, "a")
+    pipe.delete("test_publish_in_multi_key")
+    ret = pipe.execute()
+    assert (ret == [True, 0, 1])
+
+    y.join(10)
+    assert (not y.is_alive())
+
+
 def test_pubsub_channels():
     channel = "test_pubsub_channels"
     channel_two = "two_test_pubsub_channels"
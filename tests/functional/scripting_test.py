@@ -0,0 +1,66 @@
+import redis
+from assert_helper import *
+from conn import *
+
+def test_eval():
+    key = "test_eval"
+    conn = get_redis_conn()
+    ret = conn.eval("return redis.call('set', KEYS[1], ARGV[1])", 1, key, "v1")
+    assert(ret == "OK")
+    ret = conn.eval("return redis.call('get', KEYS[1])", 1, key)
+    assert(ret == "v1")
+    ret = conn.eval("return {1, 2, 'a', false}", 0)
+    assert(ret == [1, 2, "a", None])
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_evalsha():
+    key = "test_evalsha"
+    conn = get_redis_conn()
+    sha = conn.script_load("return redis.call('incrby', KEYS[1], ARGV[1])")
+    ret = conn.script_exists(sha, "0" * 40)
+    assert(ret == [True, False])
+    ret = conn.evalsha(sha, 1, key, 2)
+    assert(ret == 2)
+    ret = conn.evalsha(sha, 1, key, 3)
+    assert(ret == 5)
+    ret = conn.script_flush()
+    assert(ret == True)
+    assert_raise(redis.exceptions.NoScriptError, conn.evalsha, sha, 1, key, 1)
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_eval_error_discards_writes():
+    key = "test_eval_error_discards_writes"
+    conn = get_redis_conn()
+    script = "redis.call('set', KEYS[1], 'v1'); return redis.call('lpush', KEYS[1], 'a')"
+    assert_raise(redis.ResponseError, conn.eval, script, 1, key)
+    ret = conn.exists(key)
+    assert(ret == 0)
+    script = "redis.call('set', KEYS[1], 'v1'); return redis.pcall('lpush', KEYS[1], 'a')"
+    assert_raise(redis.ResponseError, conn.eval, script, 1, key)
+    ret = conn.get(key)
+    assert(ret == "v1")
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_eval_disallowed_commands():
+    conn = get_redis_conn()
+    assert_raise(redis.ResponseError, conn.eval, "return redis.call('eval', 'return 1', 0)", 0)
+    assert_raise(redis.ResponseError, conn.eval, "return redis.call('blpop', 'k', 0)", 0)
+
+def test_eval_error_under_exec_discards_its_writes():
+    key = "test_eval_error_under_exec_discards_its_writes"
+    conn = get_redis_conn()
+    pipe = conn.pipeline(transaction=True)
+    pipe.set(key + "_other", "v0")
+    pipe.eval("redis.call('set', KEYS[1], 'v1'); return redis.call('lpush', KEYS[1], 'a')", 1, key)
+    ret = pipe.execute(raise_on_error=False)
+    assert(ret[0] == True)
+    assert(isinstance(ret[1], redis.ResponseError))
+    ret = conn.exists(key)
+    assert(ret == 0)
+    ret = conn.get(key + "_other")
+    assert(ret == "v0")
+    ret = conn.delete(key + "_other")
+    assert(ret == 1)
@@ -70,6 +70,31 @@ def test_srandmember():
     assert (ret == 1)
 
 
+def test_srandmember_and_spop_sampling():
+    conn = get_redis_conn()
+    key = "test_srandmember_sampling"
+    members = ["m%d" % i for i in range(200)]
+    ret = conn.sadd(key, *members)
+    assert (ret == 200)
+
+    picked = set()
+    for _ in range(50):
+        ret = conn.srandmember(key)
+        assert (ret in members)
+        picked.add(ret)
+    assert (len(picked) > 1)
+
+    ret = conn.execute_command("SRANDMEMBER", key, 10)
+    assert (len(set(ret)) == 10)
+    ret = conn.execute_command("SPOP", key, 10)
+    assert (len(set(ret)) == 10)
+    ret = conn.scard(key)
+    assert (ret == 190)
+
+    ret = conn.delete(key)
+    assert (ret == 1)
+
+
 def test_smembers():
     conn = get_redis_conn()
     key = "test_smembers"
@@ -195,3 +220,20 @@ def test_sscan():
 
     ret = conn.delete(key)
     assert(ret == 1)
+
+
+def test_smembers_streaming():
+    conn = get_redis_conn()
+    key = "test_smembers_streaming"
+    members = set('member-%s' % i for i in range(20000))
+    ret = conn.sadd(key, *members)
+    assert(ret == len(members))
+    pipe = conn.pipeline(transaction=False)
+    pipe.smembers(key)
+    pipe.scard(key)
+    ret = pipe.execute()
+    assert(ret[0] == members)
+    assert(ret[1] == len(members))
+
+    ret = conn.delete(key)
+    assert (ret == 1)
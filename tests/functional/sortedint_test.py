@@ -69,4 +69,19 @@ def test_sirevrange():
     assert (ret == ['2', '1'])
 
     ret = conn.delete(key)
-    assert(ret == 1)
\ No newline at end of file
+    assert(ret == 1)
+
+
+def test_siexists():
+    conn = get_redis_conn()
+    key = "test_siexists"
+    ret = conn.delete(key)
+    ret = conn.execute_command("siadd", key, 1, 2, 3, 60)
+    assert (ret == 4)
+    ret = conn.execute_command("siexists", key, 3, 4, 60, 1)
+    assert (ret == [1, 0, 1, 1])
+    ret = conn.execute_command("siexists", "test_siexists_missing", 1)
+    assert (ret == [0])
+
+    ret = conn.delete(key)
+    assert(ret == 1)
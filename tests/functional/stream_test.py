@@ -0,0 +1,97 @@
+import redis
+import threading
+import time
+from assert_helper import *
+from conn import *
+
+def test_xadd_xrange():
+    key = "test_xadd_xrange"
+    conn = get_redis_conn()
+    ret = conn.xadd(key, {"f1": "v1"}, id="1-1")
+    assert(ret == "1-1")
+    ret = conn.xadd(key, {"f2": "v2"}, id="2-1")
+    assert(ret == "2-1")
+    assert_raise(redis.ResponseError, conn.xadd, key, {"f": "v"}, id="1-1")
+    ret = conn.xlen(key)
+    assert(ret == 2)
+    ret = conn.xrange(key)
+    assert(ret == [("1-1", {"f1": "v1"}), ("2-1", {"f2": "v2"})])
+    ret = conn.xrevrange(key, count=1)
+    assert(ret == [("2-1", {"f2": "v2"})])
+    ret = conn.xdel(key, "1-1")
+    assert(ret == 1)
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_xtrim():
+    key = "test_xtrim"
+    conn = get_redis_conn()
+    for i in range(1, 201):
+        conn.xadd(key, {"f": i}, id="%d-0" % i)
+    ret = conn.xtrim(key, 10)
+    assert(ret == 190)
+    ret = conn.xrange(key, count=1)
+    assert(ret[0][0] == "191-0")
+    conn.xadd(key, {"f": "v"}, id="300-0", maxlen=5)
+    ret = conn.xlen(key)
+    assert(ret == 5)
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_xread_block():
+    key = "test_xread_block"
+    conn = get_redis_conn()
+    ret = conn.xread({key: "$"})
+    assert(ret == [] or ret is None)
+
+    def add_later():
+        time.sleep(0.2)
+        get_redis_conn().xadd(key, {"f": "v"}, id="1-0")
+    t = threading.Thread(target=add_later)
+    t.start()
+    ret = conn.xread({key: "$"}, block=2000)
+    t.join()
+    assert(ret == [[key, [("1-0", {"f": "v"})]]])
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_xread_block_in_multi():
+    key = "test_xread_block_in_multi"
+    conn = get_redis_conn()
+    pipe = conn.pipeline(transaction=True)
+    pipe.xread({key: "$"}, block=2000)
+    start = time.time()
+    ret = pipe.execute()
+    # the BLOCK is ignored in the transaction
+    assert(time.time() - start < 1)
+    assert(ret == [None] or ret == [[]])
+
+def test_empty_stream():
+    key = "test_empty_stream"
+    conn = get_redis_conn()
+    conn.xadd(key, {"f": "v"}, id="1-0")
+    ret = conn.xdel(key, "1-0")
+    assert(ret == 1)
+    ret = conn.type(key)
+    assert(ret == "stream")
+    assert_raise(redis.ResponseError, conn.xadd, key, {"f": "v"}, id="1-0")
+    ret = conn.delete(key)
+    assert(ret == 1)
+
+def test_xreadgroup():
+    key = "test_xreadgroup"
+    conn = get_redis_conn()
+    ret = conn.xgroup_create(key, "g", id="$", mkstream=True)
+    assert(ret == True)
+    conn.xadd(key, {"f": "v1"}, id="1-0")
+    conn.xadd(key, {"f": "v2"}, id="2-0")
+    ret = conn.xreadgroup("g", "c1", {key: ">"}, count=1)
+    assert(ret == [[key, [("1-0", {"f": "v1"})]]])
+    ret = conn.xpending(key, "g")
+    assert(ret["pending"] == 1)
+    ret = conn.xack(key, "g", "1-0")
+    assert(ret == 1)
+    ret = conn.xgroup_destroy(key, "g")
+    assert(ret == 1)
+    ret = conn.delete(key)
+    assert(ret == 1)
@@ -170,3 +170,40 @@ def test_incr_by_float():
     ret = conn.delete(key)
     assert(ret == 1)
 
+
+def test_blob_string():
+    key = "test_blob_string"
+    conn = get_redis_conn()
+    ret = conn.config_set("string-blob-min-size", 16)
+    assert(ret == True)
+    try:
+        big = "a" * 64
+        ret = conn.set(key, big)
+        assert(ret == True)
+        ret = conn.get(key)
+        assert(ret == big)
+        ret = conn.append(key, "b")
+        assert(ret == 65)
+        ret = conn.setrange(key, 1, "xyz")
+        assert(ret == 65)
+        ret = conn.get(key)
+        assert(ret == "axyz" + "a" * 60 + "b")
+        ret = conn.set(key + "_small", "short")
+        assert(ret == True)
+        ret = conn.mget([key, key + "_small", key + "_missing"])
+        assert(ret == ["axyz" + "a" * 60 + "b", "short", None])
+        ret = conn.expire(key, 100)
+        assert(ret == True)
+        ret = conn.ttl(key)
+        assert(ret >= 99 and ret <= 100)
+        ret = conn.strlen(key)
+        assert(ret == 65)
+        # the value shrunk below the min size is inlined again
+        ret = conn.set(key, "short")
+        assert(ret == True)
+        ret = conn.get(key)
+        assert(ret == "short")
+    finally:
+        conn.config_set("string-blob-min-size", 0)
+    ret = conn.delete(key, key + "_small")
+    assert(ret == 2)
@@ -0,0 +1,24 @@
+import redis
+from assert_helper import *
+from conn import *
+
+def test_unixsocket():
+    key = "test_unixsocket"
+    conn = get_redis_unix_conn()
+    ret = conn.ping()
+    assert(ret == True)
+    ret = conn.set(key, "bar")
+    assert(ret == True)
+    # the writes are served by the same workers as the tcp connections
+    ret = get_redis_conn().get(key)
+    assert(ret == "bar")
+
+    # the address of the unix socket connections is the path of the socket
+    id = conn.execute_command("client", "id")
+    clients = conn.execute_command("client", "list")
+    line = [l for l in clients.split("\n") if ("id=%d " % id) in l]
+    assert(len(line) == 1)
+    assert(("addr=%s:0 " % UNIX_SOCKET_PATH) in line[0])
+
+    ret = conn.delete(key)
+    assert(ret == 1)
@@ -382,3 +382,25 @@ def test_zinterstore():
     ret = conn.delete(key2)
     assert (ret == 1)
 
+
+def test_zrangebyscore_in_multi():
+    key = "test_zrangebyscore_in_multi"
+    other_key = "test_zrangebyscore_in_multi_other"
+    conn = get_redis_conn()
+    ret = conn.zadd(key, {"one": 1, "two": 2})
+    assert (ret == 2)
+    pipe = conn.pipeline(transaction=True)
+    pipe.zadd(key, {"ten": 10})
+    pipe.zadd(other_key, {"other": 1})
+    pipe.zrangebyscore(key, 0, 5)
+    pipe.zrangebylex(key, "-", "[three")
+    pipe.zremrangebyscore(key, 0, 1)
+    ret = pipe.execute()
+    assert (ret == [1, 1, ["one", "two"], ["one", "ten"], 1])
+    ret = conn.zrange(key, 0, -1)
+    assert (ret == ["two", "ten"])
+
+    ret = conn.delete(key)
+    assert (ret == 1)
+    ret = conn.delete(other_key)
+    assert (ret == 1)
@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "key_stats.h"
+
+TEST(KeyStats, TopKeys) {
+  TopKeys top(2);
+  top.Offer("a", 1);
+  top.Offer("b", 3);
+  top.Offer("c", 1);
+  EXPECT_EQ(top.Size(), 2u);
+  top.Offer("c", 2);
+  std::vector<KeyCount> keys;
+  top.GetTop(10, &keys);
+  ASSERT_EQ(keys.size(), 2u);
+  EXPECT_EQ(keys[0].key, "b");
+  EXPECT_EQ(keys[1].key, "c");
+
+  TopKeys other(2);
+  other.Offer("c", 5, kRedisHash);
+  top.Merge(other);
+  top.GetTop(1, &keys);
+  ASSERT_EQ(keys.size(), 1u);
+  EXPECT_EQ(keys[0].key, "c");
+  EXPECT_EQ(keys[0].count, 7u);
+
+  top.Decay();
+  top.GetTop(10, &keys);
+  EXPECT_EQ(keys[0].count, 3u);
+  top.Clear();
+  EXPECT_EQ(top.Size(), 0u);
+}
+
+TEST(KeyStats, CountMinSketch) {
+  CountMinSketch sketch(64, 4);
+  for (int i = 0; i < 100; i++) sketch.Add("hot");
+  for (int i = 0; i < 100; i++) sketch.Add("key" + std::to_string(i));
+  EXPECT_GE(sketch.Estimate("hot"), 100u);
+  EXPECT_LT(sketch.Estimate("key1"), 100u);
+  sketch.Decay();
+  EXPECT_GE(sketch.Estimate("hot"), 50u);
+  sketch.Clear();
+  EXPECT_EQ(sketch.Estimate("hot"), 0u);
+}
+
+TEST(KeyStats, HotKeys) {
+  HotKeys hot_keys(4);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&hot_keys, i]() {
+      for (int j = 0; j < 1000; j++) {
+        hot_keys.Record("ns", "hot");
+        hot_keys.Record("ns", "key" + std::to_string(i * 1000 + j));
+        hot_keys.Record("other", "other_hot");
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+
+  std::vector<KeyCount> keys;
+  hot_keys.GetHotKeys("ns", 1, &keys);
+  ASSERT_EQ(keys.size(), 1u);
+  EXPECT_EQ(keys[0].key, "hot");
+  EXPECT_GE(keys[0].count, 4000u);
+  hot_keys.GetHotKeys("other", 10, &keys);
+  ASSERT_FALSE(keys.empty());
+  EXPECT_EQ(keys[0].key, "other_hot");
+
+  hot_keys.Reset();
+  hot_keys.GetHotKeys("ns", 10, &keys);
+  EXPECT_TRUE(keys.empty());
+}
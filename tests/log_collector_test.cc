@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <thread>
+#include <vector>
+
 #include "log_collector.h"
+#include "redis_reply.h"
 
 TEST(LogCollector, PushEntry) {
   LogCollector<PerfEntry> perf_log;
@@ -15,3 +19,39 @@ TEST(LogCollector, PushEntry) {
   perf_log.Reset();
   EXPECT_EQ(perf_log.Size(), 0);
 }
+
+TEST(LogCollector, MemoryUsage) {
+  LogCollector<SlowEntry> slow_log;
+  slow_log.SetMaxEntries(2);
+  EXPECT_EQ(slow_log.MemoryUsage(), 0u);
+  auto entry = new SlowEntry();
+  entry->args = {"set", "key", std::string(1024, 'v')};
+  size_t entry_usage = entry->MemoryUsage();
+  EXPECT_GT(entry_usage, 1024u);
+  slow_log.PushEntry(entry);
+  EXPECT_EQ(slow_log.MemoryUsage(), entry_usage);
+  slow_log.PushEntry(new SlowEntry());
+  slow_log.PushEntry(new SlowEntry());
+  EXPECT_LT(slow_log.MemoryUsage(), entry_usage);
+  slow_log.Reset();
+  EXPECT_EQ(slow_log.MemoryUsage(), 0u);
+}
+
+TEST(LogCollector, MergeThreads) {
+  LogCollector<SlowEntry> slow_log;
+  slow_log.SetMaxEntries(4);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&slow_log]() {
+      for (int j = 0; j < 10; j++) slow_log.PushEntry(new SlowEntry());
+    });
+  }
+  for (auto &t : threads) t.join();
+  slow_log.PushEntry(new SlowEntry());
+  EXPECT_EQ(slow_log.Size(), 4);
+  // the latest entries of all threads are merged by the id
+  std::string entries = slow_log.GetLatestEntries(2);
+  std::string prefix = Redis::MultiLen(2) + Redis::MultiLen(4) + Redis::Integer(41);
+  EXPECT_EQ(entries.substr(0, prefix.size()), prefix);
+  EXPECT_NE(entries.find(Redis::MultiLen(4) + Redis::Integer(40)), std::string::npos);
+}
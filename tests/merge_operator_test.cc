@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "merge_operator.h"
+
+static bool fullMerge(const Engine::CounterMergeOperator &op, const rocksdb::Slice *existing,
+                      const std::vector<int64_t> &increments, std::string *new_value) {
+  std::vector<std::string> operands;
+  for (auto increment : increments) operands.emplace_back(Engine::CounterMergeOperator::EncodeOperand(increment));
+  std::vector<rocksdb::Slice> operand_list(operands.begin(), operands.end());
+  rocksdb::Slice existing_operand;
+  rocksdb::MergeOperator::MergeOperationInput merge_in("key", existing, operand_list, nullptr);
+  rocksdb::MergeOperator::MergeOperationOutput merge_out(*new_value, existing_operand);
+  return op.FullMergeV2(merge_in, &merge_out);
+}
+
+TEST(CounterMergeOperator, FullMerge) {
+  Engine::CounterMergeOperator op(0);
+  std::string new_value;
+  rocksdb::Slice existing("10");
+  ASSERT_TRUE(fullMerge(op, &existing, {1, 2, -5}, &new_value));
+  EXPECT_EQ(new_value, "8");
+  ASSERT_TRUE(fullMerge(op, nullptr, {1, 2}, &new_value));
+  EXPECT_EQ(new_value, "3");
+  existing = rocksdb::Slice("abc");
+  ASSERT_TRUE(fullMerge(op, &existing, {1}, &new_value));
+  EXPECT_EQ(new_value, "abc");
+  existing = rocksdb::Slice("9223372036854775806");
+  ASSERT_TRUE(fullMerge(op, &existing, {1, 1, -2}, &new_value));
+  EXPECT_EQ(new_value, "9223372036854775805");
+}
+
+TEST(CounterMergeOperator, FullMergeWithHeader) {
+  Engine::CounterMergeOperator op(5);
+  std::string new_value;
+  std::string existing_bytes("\x01\x00\x00\x00\x00" "41", 7);
+  rocksdb::Slice existing(existing_bytes);
+  ASSERT_TRUE(fullMerge(op, &existing, {1}, &new_value));
+  EXPECT_EQ(new_value, std::string("\x01\x00\x00\x00\x00" "42", 7));
+  ASSERT_TRUE(fullMerge(op, nullptr, {1}, &new_value));
+  ASSERT_EQ(new_value.size(), 6u);
+  EXPECT_EQ(new_value.substr(5), "1");
+}
+
+TEST(CounterMergeOperator, PartialMerge) {
+  Engine::CounterMergeOperator op(0);
+  std::string new_value;
+  auto left = Engine::CounterMergeOperator::EncodeOperand(3);
+  auto right = Engine::CounterMergeOperator::EncodeOperand(-1);
+  ASSERT_TRUE(op.PartialMerge("key", left, right, &new_value, nullptr));
+  EXPECT_EQ(new_value, Engine::CounterMergeOperator::EncodeOperand(2));
+  left = Engine::CounterMergeOperator::EncodeOperand(INT64_MAX);
+  right = Engine::CounterMergeOperator::EncodeOperand(1);
+  EXPECT_FALSE(op.PartialMerge("key", left, right, &new_value, nullptr));
+  EXPECT_FALSE(op.PartialMerge("key", "abc", right, &new_value, nullptr));
+}
+
+TEST(CounterMergeOperator, ParseValue) {
+  int64_t n = 0;
+  EXPECT_TRUE(Engine::CounterMergeOperator::ParseValue("-12", &n));
+  EXPECT_EQ(n, -12);
+  EXPECT_FALSE(Engine::CounterMergeOperator::ParseValue("", &n));
+  EXPECT_FALSE(Engine::CounterMergeOperator::ParseValue("x1", &n));
+  EXPECT_FALSE(Engine::CounterMergeOperator::ParseValue("99999999999999999999", &n));
+}
@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+
+#include "metadata_cache.h"
+
+TEST(MetadataCache, GetAndErase) {
+  MetadataCache cache(1024 * 1024);
+  std::string bytes;
+  EXPECT_FALSE(cache.Get("key", &bytes));
+  cache.Insert("key", "value", cache.Generation("key"));
+  EXPECT_TRUE(cache.Get("key", &bytes));
+  EXPECT_EQ("value", bytes);
+  cache.Erase("key");
+  EXPECT_FALSE(cache.Get("key", &bytes));
+  EXPECT_EQ(1u, cache.GetHits());
+  EXPECT_EQ(2u, cache.GetMisses());
+}
+
+TEST(MetadataCache, StaleInsert) {
+  MetadataCache cache(1024 * 1024);
+  std::string bytes;
+  auto generation = cache.Generation("key");
+  // the key is written after the reader loaded it from db
+  cache.Erase("key");
+  cache.Insert("key", "stale", generation);
+  EXPECT_FALSE(cache.Get("key", &bytes));
+}
+
+TEST(MetadataCache, Evict) {
+  MetadataCache cache(16 * 1024, 0);
+  for (int i = 0; i < 1024; i++) {
+    auto key = "key" + std::to_string(i);
+    cache.Insert(key, std::string(64, 'v'), cache.Generation(key));
+  }
+  EXPECT_LE(cache.GetUsage(), cache.GetCapacity());
+  std::string bytes;
+  EXPECT_TRUE(cache.Get("key1023", &bytes));
+  EXPECT_FALSE(cache.Get("key0", &bytes));
+  cache.SetCapacity(0);
+  EXPECT_EQ(0u, cache.GetUsage());
+}
+
+TEST(MetadataCache, GetHotKeys) {
+  MetadataCache cache(1024 * 1024, 0);
+  for (int i = 0; i < 10; i++) {
+    auto key = "key" + std::to_string(i);
+    cache.Insert(key, "value", cache.Generation(key));
+  }
+  std::string bytes;
+  EXPECT_TRUE(cache.Get("key0", &bytes));
+  std::vector<std::string> keys;
+  cache.GetHotKeys(3, &keys);
+  ASSERT_EQ(3u, keys.size());
+  EXPECT_EQ("key0", keys[0]);
+  EXPECT_EQ("key9", keys[1]);
+  EXPECT_EQ("key8", keys[2]);
+  cache.GetHotKeys(100, &keys);
+  EXPECT_EQ(10u, keys.size());
+}
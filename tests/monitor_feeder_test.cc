@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "monitor_feeder.h"
+
+static std::unique_ptr<MonitorRecord> newRecord(const std::string &ns, const std::vector<std::string> &args) {
+  std::unique_ptr<MonitorRecord> record(new MonitorRecord);
+  record->time = {1, 2};
+  record->conn_id = 1;
+  record->ns = ns;
+  record->addr = "127.0.0.1:6666";
+  record->args = args;
+  return record;
+}
+
+TEST(MonitorFeeder, Deliver) {
+  MonitorFeeder feeder;
+  std::mutex mu;
+  std::condition_variable cond;
+  std::vector<std::string> lines;
+  feeder.Start([&](const std::shared_ptr<MonitorRecords> &records) {
+    std::lock_guard<std::mutex> guard(mu);
+    for (const auto &record : *records) lines.emplace_back(record->line);
+    cond.notify_all();
+  });
+  for (int i = 0; i < 100; i++) {
+    EXPECT_TRUE(feeder.Feed(newRecord("ns", {"set", "key", std::to_string(i)})));
+  }
+  {
+    std::unique_lock<std::mutex> lock(mu);
+    cond.wait_for(lock, std::chrono::seconds(5), [&]() { return lines.size() == 100; });
+  }
+  feeder.Stop();
+  feeder.Join();
+  ASSERT_EQ(lines.size(), 100u);
+  EXPECT_EQ(lines[0], "+1.2 [ns 127.0.0.1:6666] \"set\" \"key\" \"0\"\r\n");
+  EXPECT_EQ(lines[99], "+1.2 [ns 127.0.0.1:6666] \"set\" \"key\" \"99\"\r\n");
+}
+
+TEST(MonitorFeeder, DropWhenFull) {
+  MonitorFeeder feeder(2);
+  EXPECT_TRUE(feeder.Feed(newRecord("ns", {"get", "a"})));
+  EXPECT_TRUE(feeder.Feed(newRecord("ns", {"get", "b"})));
+  EXPECT_FALSE(feeder.Feed(newRecord("ns", {"get", "c"})));
+  EXPECT_EQ(feeder.GetDropped(), 1u);
+}
+
+TEST(MonitorFilter, Match) {
+  auto record = newRecord("ns", {"SET", "key", "value"});
+  MonitorFilter filter;
+  EXPECT_TRUE(filter.Match(*record, "ns", false));
+  EXPECT_FALSE(filter.Match(*record, "other", false));
+  EXPECT_TRUE(filter.Match(*record, "__namespace", true));
+  filter.commands = {"get"};
+  EXPECT_FALSE(filter.Match(*record, "ns", false));
+  filter.commands = {"get", "set"};
+  EXPECT_TRUE(filter.Match(*record, "ns", false));
+  filter.ns = "other";
+  EXPECT_FALSE(filter.Match(*record, "__namespace", true));
+}
@@ -0,0 +1,33 @@
+#include "namespace_quota.h"
+
+#include <gtest/gtest.h>
+
+TEST(NamespaceQuota, Acquire) {
+  NamespaceQuota quota;
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(quota.Acquire(10, 0, 100));
+  }
+  EXPECT_FALSE(quota.Acquire(10, 0, 100));
+  EXPECT_EQ(quota.GetThrottled(), 1u);
+  // the budget is refilled in the next second
+  EXPECT_TRUE(quota.Acquire(10, 0, 101));
+  EXPECT_EQ(quota.GetCalls(), 11u);
+
+  quota.IncrOutBytes(1024);
+  EXPECT_FALSE(quota.Acquire(0, 1024, 101));
+  EXPECT_TRUE(quota.Acquire(0, 0, 101));
+  EXPECT_TRUE(quota.Acquire(0, 1024, 102));
+  EXPECT_EQ(quota.GetOutBytes(), 1024u);
+}
+
+TEST(NamespaceQuota, Get) {
+  NamespaceQuotas quotas;
+  auto quota = quotas.Get("ns1");
+  EXPECT_EQ(quotas.Get("ns1"), quota);
+  EXPECT_NE(quotas.Get("ns2"), quota);
+  std::vector<std::pair<std::string, NamespaceQuota *>> all;
+  quotas.GetAll(&all);
+  ASSERT_EQ(all.size(), 2u);
+  EXPECT_EQ(all[0].first, "ns1");
+  EXPECT_EQ(all[1].first, "ns2");
+}
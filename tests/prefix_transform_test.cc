@@ -0,0 +1,25 @@
+#include <gtest/gtest.h>
+#include "redis_metadata.h"
+#include "prefix_transform.h"
+
+TEST(SubKeyPrefixTransform, Transform) {
+  Engine::SubKeyPrefixTransform transform;
+  std::string ns_key, prefix, sub_key;
+  ComposeNamespaceKey("ns", "key", &ns_key);
+  InternalKey(ns_key, "", 10).Encode(&prefix);
+  InternalKey(ns_key, "field", 10).Encode(&sub_key);
+  ASSERT_TRUE(transform.InDomain(sub_key));
+  EXPECT_EQ(prefix, transform.Transform(sub_key).ToString());
+  EXPECT_EQ(prefix, transform.Transform(prefix).ToString());
+  EXPECT_TRUE(transform.InRange(prefix));
+  EXPECT_FALSE(transform.InRange(sub_key));
+
+  // another version of the same key should have the different prefix
+  InternalKey(ns_key, "field", 11).Encode(&sub_key);
+  EXPECT_NE(prefix, transform.Transform(sub_key).ToString());
+
+  // the truncated keys are out of the domain
+  EXPECT_FALSE(transform.InDomain(""));
+  EXPECT_FALSE(transform.InDomain(prefix.substr(0, prefix.size() - 1)));
+  EXPECT_FALSE(transform.InDomain(ns_key));
+}
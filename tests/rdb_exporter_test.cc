@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+
+#include "../tools/kvrocks2redis/rdb_exporter.h"
+
+TEST(RdbExporter, EncodeLength) {
+  std::vector<std::pair<uint64_t, std::string>> cases = {
+      {0, std::string("\x00", 1)},
+      {63, "\x3f"},
+      {64, "\x40\x40"},
+      {16383, "\x7f\xff"},
+      {16384, std::string("\x80\x00\x00\x40\x00", 5)},
+      {UINT32_MAX, "\x80\xff\xff\xff\xff"},
+      {static_cast<uint64_t>(UINT32_MAX) + 1, std::string("\x81\x00\x00\x00\x01\x00\x00\x00\x00", 9)},
+  };
+  for (const auto &c : cases) {
+    std::string dst;
+    RdbExporter::EncodeLength(&dst, c.first);
+    EXPECT_EQ(c.second, dst) << c.first;
+  }
+  std::string dst;
+  RdbExporter::EncodeString(&dst, "abc");
+  EXPECT_EQ("\x03" "abc", dst);
+}
+
+TEST(RdbExporter, EncodeBinaryDouble) {
+  // the ZSET2 scores are the little endian IEEE 754 doubles
+  std::string dst;
+  RdbExporter::EncodeBinaryDouble(&dst, 1.5);
+  EXPECT_EQ(std::string("\x00\x00\x00\x00\x00\x00\xf8\x3f", 8), dst);
+  dst.clear();
+  RdbExporter::EncodeBinaryDouble(&dst, -2);
+  EXPECT_EQ(std::string("\x00\x00\x00\x00\x00\x00\x00\xc0", 8), dst);
+}
+
+TEST(RdbExporter, EncodeEntry) {
+  std::string values, entry;
+  RdbExporter::EncodeString(&values, "v");
+  RdbExporter::EncodeEntry(&entry, RdbExporter::kTypeString, "key", 0, 0, values);
+  EXPECT_EQ(std::string("\x00\x03" "key\x01v", 7), entry);
+
+  // the expire in seconds is written as the EXPIRETIME_MS in little endian before the entry
+  entry.clear();
+  RdbExporter::EncodeEntry(&entry, RdbExporter::kTypeString, "key", 10, 0, values);
+  EXPECT_EQ(std::string("\xfc\x10\x27\x00\x00\x00\x00\x00\x00\x00\x03" "key\x01v", 16), entry);
+
+  // the length of the elements is prepended to the values of the collections
+  values.clear();
+  entry.clear();
+  RdbExporter::EncodeString(&values, "m");
+  RdbExporter::EncodeBinaryDouble(&values, 1.5);
+  RdbExporter::EncodeEntry(&entry, RdbExporter::kTypeZSet2, "z", 0, 1, values);
+  EXPECT_EQ(std::string("\x05\x01z\x01\x01m\x00\x00\x00\x00\x00\x00\xf8\x3f", 14), entry);
+}
+
+TEST(RdbExporter, ReverseBits) {
+  EXPECT_EQ(0x80, RdbExporter::ReverseBits(0x01));
+  EXPECT_EQ(0x01, RdbExporter::ReverseBits(0x80));
+  EXPECT_EQ(0xF0, RdbExporter::ReverseBits(0x0F));
+  EXPECT_EQ(0x05, RdbExporter::ReverseBits(0xA0));
+  EXPECT_EQ(0xFF, RdbExporter::ReverseBits(0xFF));
+}
+
+TEST(RdbExporter, Finish) {
+  std::string dir = "rdbexporterdir";
+  mkdir(dir.c_str(), 0755);
+  std::vector<std::string> files;
+  {
+    RdbExporter exporter(dir, "dump.rdb", 2);
+    // the parts are joined in the order of the parts rather than the appends
+    ASSERT_TRUE(exporter.Append(1, "ns", "b").IsOK());
+    ASSERT_TRUE(exporter.Append(0, "ns", "a").IsOK());
+    ASSERT_TRUE(exporter.Finish(&files).IsOK());
+  }
+  ASSERT_EQ(std::vector<std::string>({dir + "/ns_dump.rdb"}), files);
+  std::ifstream in(files[0]);
+  std::stringstream content;
+  content << in.rdbuf();
+  EXPECT_EQ(std::string("REDIS0009\xfe\x00" "ab\xff\x00\x00\x00\x00\x00\x00\x00\x00", 22), content.str());
+  remove(files[0].c_str());
+  rmdir(dir.c_str());
+}
@@ -0,0 +1,15 @@
+#include "redis_slot.h"
+
+#include <gtest/gtest.h>
+
+TEST(Slot, GetSlotNumFromKey) {
+  EXPECT_EQ(Crc16("123456789", 9), 0x31C3);
+  EXPECT_EQ(GetSlotNumFromKey("somekey"), 11058);
+  EXPECT_EQ(GetSlotNumFromKey("foo{hash_tag}"), 2515);
+  EXPECT_EQ(GetSlotNumFromKey("{user1000}.following"), GetSlotNumFromKey("{user1000}.followers"));
+  EXPECT_EQ(GetSlotNumFromKey("{user1000}.following"), GetSlotNumFromKey("user1000"));
+  EXPECT_EQ(GetSlotNumFromKey("foo{bar}{zap}"), GetSlotNumFromKey("bar"));
+  // the whole key is hashed if the hash tag is empty or not closed
+  EXPECT_EQ(GetSlotNumFromKey("foo{}{bar}"), Crc16("foo{}{bar}", 10) & (kClusterSlots - 1));
+  EXPECT_EQ(GetSlotNumFromKey("foo{bar"), Crc16("foo{bar", 7) & (kClusterSlots - 1));
+}
@@ -1,4 +1,5 @@
 #include "lock_manager.h"
+#include <atomic>
 #include <thread>
 #include <gtest/gtest.h>
 
@@ -9,4 +10,57 @@ TEST(LockManager, LockKey) {
     locks.Lock(key);
     locks.UnLock(key);
   }
-}
\ No newline at end of file
+}
+TEST(LockManager, MultiLockKeys) {
+  LockManager locks(2);
+  std::vector<rocksdb::Slice> keys = {"abc", "123", "456", "abc", "789", "xyz"};
+  // keys more than slots must be hashed into the same slot, and shouldn't be locked twice
+  auto slots = locks.MultiLock(keys);
+  EXPECT_LE(slots.size(), locks.Size());
+  for (size_t i = 1; i < slots.size(); i++) {
+    EXPECT_LT(slots[i-1], slots[i]);
+  }
+  locks.MultiUnLock(slots);
+  EXPECT_EQ(1u, locks.GetMultiLockCount());
+}
+
+TEST(LockManager, SharedLockKey) {
+  LockManager locks(8);
+  locks.RLock("abc");
+  locks.RLock("abc");
+  locks.RUnLock("abc");
+  locks.RUnLock("abc");
+  locks.Lock("abc");
+  locks.UnLock("abc");
+  EXPECT_EQ(0u, locks.GetContendedCount());
+}
+
+TEST(LockManager, TransactionLocks) {
+  LockManager locks(8);
+  locks.BeginTransaction();
+  EXPECT_TRUE(locks.InTransaction());
+  // the locks are reentrant in the transaction and kept until the end of it
+  locks.Lock("abc");
+  locks.Lock("abc");
+  locks.UnLock("abc");
+  locks.RLock("abc");
+  auto slots = locks.MultiLock({"abc", "123"});
+  EXPECT_TRUE(slots.empty());
+  locks.MultiUnLock(slots);
+  uint64_t contended = locks.GetContendedCount();
+  std::atomic<bool> locked{false};
+  std::thread t([&locks, &locked]() {
+    EXPECT_FALSE(locks.InTransaction());
+    locks.Lock("abc");
+    locked = true;
+    locks.UnLock("abc");
+  });
+  // the other thread is counted as contended before it waits for the lock kept by the transaction
+  while (locks.GetContendedCount() == contended) std::this_thread::yield();
+  EXPECT_FALSE(locked);
+  locks.EndTransaction();
+  t.join();
+  EXPECT_TRUE(locked);
+  EXPECT_FALSE(locks.InTransaction());
+  EXPECT_EQ(contended + 1, locks.GetContendedCount());
+}
@@ -0,0 +1,72 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "stats.h"
+
+TEST(LatencyHistogram, Bucket) {
+  for (uint64_t latency : {0, 1, 3, 4, 7, 8, 9, 100, 1000, 123456789}) {
+    int index = LatencyHistogram::BucketIndex(latency);
+    EXPECT_GE(LatencyHistogram::BucketUpperBound(index), latency);
+    if (index > 0) {
+      EXPECT_LT(LatencyHistogram::BucketUpperBound(index - 1), latency);
+    }
+  }
+  EXPECT_EQ(LatencyHistogram::kBuckets - 1, LatencyHistogram::BucketIndex(UINT64_MAX));
+}
+
+TEST(Stats, LatencyPercentile) {
+  Stats stats(2);
+  auto record = [&stats]() {
+    for (uint64_t i = 1; i <= 1000; i++) stats.IncrLatency(i, 1);
+  };
+  std::thread t(record);
+  record();
+  t.join();
+
+  std::vector<uint64_t> buckets;
+  uint64_t max;
+  ASSERT_FALSE(stats.GetLatencyHistogram(0, &buckets, &max));
+  ASSERT_TRUE(stats.GetLatencyHistogram(1, &buckets, &max));
+  EXPECT_EQ(1000u, max);
+  uint64_t total = 0;
+  for (const auto &n : buckets) total += n;
+  EXPECT_EQ(2000u, total);
+  uint64_t p50 = LatencyHistogram::Percentile(buckets, 50, max);
+  EXPECT_GE(p50, 500u);
+  EXPECT_LE(p50, 625u);
+  EXPECT_EQ(1000u, LatencyHistogram::Percentile(buckets, 100, max));
+}
+
+TEST(Stats, ExitedThreads) {
+  Stats stats(2);
+  // the blocks of the exited threads are merged into the stats and freed
+  for (int i = 0; i < 8; i++) {
+    std::thread t([&stats]() {
+      stats.IncrCalls(1);
+      stats.IncrLatency(10, 1);
+      stats.IncrInbondBytes(3);
+    });
+    t.join();
+  }
+  EXPECT_EQ(8u, stats.GetTotalCalls());
+  EXPECT_EQ(24u, stats.GetInbondBytes());
+  std::vector<uint64_t> calls, latency;
+  stats.GetCommandStats(&calls, &latency);
+  EXPECT_EQ(8u, calls[1]);
+  EXPECT_EQ(80u, latency[1]);
+  std::vector<uint64_t> buckets;
+  uint64_t max;
+  ASSERT_TRUE(stats.GetLatencyHistogram(1, &buckets, &max));
+  EXPECT_EQ(10u, max);
+  EXPECT_EQ(8u, buckets[LatencyHistogram::BucketIndex(10)]);
+
+  // the thread switching to another stats retires its block of the previous one
+  {
+    Stats other(2);
+    other.IncrCalls(0);
+    stats.IncrCalls(0);
+    other.IncrCalls(0);
+    EXPECT_EQ(2u, other.GetTotalCalls());
+  }
+  EXPECT_EQ(9u, stats.GetTotalCalls());
+}
@@ -0,0 +1,334 @@
+#include <gtest/gtest.h>
+#include <rocksdb/db.h>
+#include <rocksdb/sst_file_writer.h>
+
+#include "config.h"
+#include "storage.h"
+#include "redis_hash.h"
+#include "redis_set.h"
+#include "redis_stream.h"
+
+TEST(Storage, MigrateToTypeColumnFamilies) {
+  Config config;
+  config.db_dir = "typecfsdb";
+  config.backup_dir = "typecfsdb/backup";
+  rocksdb::DestroyDB(config.db_dir, rocksdb::Options());
+
+  int ret;
+  std::string ns = "test_type_cfs", value;
+  {
+    Engine::Storage storage(&config);
+    ASSERT_TRUE(storage.Open().IsOK());
+    EXPECT_FALSE(storage.IsTypeCFsEnabled());
+    Redis::Hash hash(&storage, ns);
+    hash.Set("hash_key", "f1", "v1", &ret);
+    hash.Set("hash_key", "f2", "v2", &ret);
+    Redis::Set set(&storage, ns);
+    set.Add("set_key", {"m1", "m2"}, &ret);
+  }
+
+  config.type_column_families = true;
+  {
+    Engine::Storage storage(&config);
+    ASSERT_TRUE(storage.Open().IsOK());
+    EXPECT_TRUE(storage.IsTypeCFsEnabled());
+    Redis::Hash hash(&storage, ns);
+    EXPECT_TRUE(hash.Get("hash_key", "f1", &value).ok());
+    EXPECT_EQ("v1", value);
+    hash.Set("hash_key", "f3", "v3", &ret);
+    EXPECT_TRUE(hash.Get("hash_key", "f3", &value).ok());
+    EXPECT_EQ("v3", value);
+    Redis::Set set(&storage, ns);
+    std::vector<std::string> members;
+    set.Members("set_key", &members);
+    EXPECT_EQ(2u, members.size());
+
+    // all subkeys are moved out of the default column family
+    rocksdb::ReadOptions read_options;
+    read_options.total_order_seek = true;
+    std::unique_ptr<rocksdb::Iterator> iter(
+        storage.GetDB()->NewIterator(read_options, storage.GetCFHandle("default")));
+    iter->SeekToFirst();
+    EXPECT_FALSE(iter->Valid());
+  }
+
+  // the type column families can't be disabled after the subkeys are moved
+  config.type_column_families = false;
+  {
+    Engine::Storage storage(&config);
+    EXPECT_FALSE(storage.Open().IsOK());
+  }
+}
+
+TEST(Storage, SlaveFollowsSubKeyLayout) {
+  Config config;
+  config.db_dir = "typecfsslavedb";
+  config.backup_dir = "typecfsslavedb/backup";
+  rocksdb::DestroyDB(config.db_dir, rocksdb::Options());
+
+  int ret;
+  std::string ns = "test_type_cfs_slave", value;
+  {
+    Engine::Storage storage(&config);
+    ASSERT_TRUE(storage.Open().IsOK());
+    Redis::Hash hash(&storage, ns);
+    hash.Set("hash_key", "f1", "v1", &ret);
+  }
+
+  // the slave never migrates the subkeys, since its sequence must follow the master
+  config.type_column_families = true;
+  config.master_host = "127.0.0.1";
+  Engine::Storage storage(&config);
+  ASSERT_TRUE(storage.Open().IsOK());
+  EXPECT_FALSE(storage.IsTypeCFsEnabled());
+  auto seq = storage.LatestSeq();
+  Redis::Hash hash(&storage, ns);
+  EXPECT_TRUE(hash.Get("hash_key", "f1", &value).ok());
+
+  // and it switches to the type column families once the master writes them
+  rocksdb::WriteBatch batch;
+  batch.Put(storage.GetCFHandle("hash"), "k", "v");
+  ASSERT_TRUE(storage.WriteBatch(std::string(batch.Data())).IsOK());
+  EXPECT_EQ(seq + 1, storage.LatestSeq());
+  EXPECT_TRUE(storage.IsTypeCFsEnabled());
+}
+
+TEST(Storage, StreamWithTypeColumnFamilies) {
+  Config config;
+  config.db_dir = "typecfsstreamdb";
+  config.backup_dir = "typecfsstreamdb/backup";
+  config.type_column_families = true;
+  rocksdb::DestroyDB(config.db_dir, rocksdb::Options());
+
+  int ret;
+  std::string ns = "test_type_cfs_stream", value;
+  Redis::StreamAddOptions options;
+  Redis::StreamEntryID id;
+  {
+    Engine::Storage storage(&config);
+    ASSERT_TRUE(storage.Open().IsOK());
+    Redis::Stream stream(&storage, ns);
+    ASSERT_TRUE(stream.Add("stream_key", options, {"f1", "v1"}, &id).ok());
+    ASSERT_TRUE(stream.Add("stream_key", options, {"f2", "v2"}, &id).ok());
+    Redis::Hash hash(&storage, ns);
+    hash.Set("hash_key", "f1", "v1", &ret);
+  }
+
+  // the stream stays in the default column family after the restarts
+  for (int i = 0; i < 2; i++) {
+    Engine::Storage storage(&config);
+    ASSERT_TRUE(storage.Open().IsOK());
+    Redis::Stream stream(&storage, ns);
+    std::vector<Redis::StreamEntry> entries;
+    ASSERT_TRUE(stream.Range("stream_key", Redis::StreamEntryID::Min(), Redis::StreamEntryID::Max(),
+                             0, false, &entries).ok());
+    ASSERT_EQ(2u, entries.size());
+    EXPECT_EQ(id, entries[1].id);
+    EXPECT_EQ("v2", entries[1].values[1]);
+    Redis::Hash hash(&storage, ns);
+    EXPECT_TRUE(hash.Get("hash_key", "f1", &value).ok());
+    EXPECT_EQ("v1", value);
+  }
+}
+
+TEST(Storage, CacheOnlyReads) {
+  Config config;
+  config.db_dir = "cacheonlydb";
+  config.backup_dir = "cacheonlydb/backup";
+  rocksdb::DestroyDB(config.db_dir, rocksdb::Options());
+
+  Engine::Storage storage(&config);
+  ASSERT_TRUE(storage.Open().IsOK());
+  auto cf_handle = storage.GetCFHandle("default");
+  rocksdb::WriteBatch batch;
+  batch.Put(cf_handle, "key", "value");
+  ASSERT_TRUE(storage.Write(rocksdb::WriteOptions(), &batch).ok());
+  std::string value;
+
+  // the memtable is in the memory
+  storage.BeginCacheOnlyReads();
+  EXPECT_TRUE(storage.Get(rocksdb::ReadOptions(), cf_handle, "key", &value).ok());
+  EXPECT_TRUE(storage.EndCacheOnlyReads());
+  EXPECT_EQ("value", value);
+
+  // the block of the flushed key isn't in the block cache until it is read
+  ASSERT_TRUE(storage.GetDB()->Flush(rocksdb::FlushOptions(), cf_handle).ok());
+  storage.BeginCacheOnlyReads();
+  EXPECT_TRUE(storage.Get(rocksdb::ReadOptions(), cf_handle, "key", &value).IsIncomplete());
+  EXPECT_FALSE(storage.EndCacheOnlyReads());
+  storage.BeginCacheOnlyReads();
+  {
+    std::unique_ptr<rocksdb::Iterator> iter(storage.NewIterator(rocksdb::ReadOptions(), cf_handle));
+    iter->SeekToFirst();
+    EXPECT_FALSE(iter->Valid());
+  }
+  EXPECT_FALSE(storage.EndCacheOnlyReads());
+
+  EXPECT_TRUE(storage.Get(rocksdb::ReadOptions(), cf_handle, "key", &value).ok());
+  storage.BeginCacheOnlyReads();
+  EXPECT_TRUE(storage.Get(rocksdb::ReadOptions(), cf_handle, "key", &value).ok());
+  EXPECT_TRUE(storage.EndCacheOnlyReads());
+  EXPECT_EQ("value", value);
+}
+
+TEST(Storage, ReportWrittenKeys) {
+  Config config;
+  config.db_dir = "writtenkeysdb";
+  config.backup_dir = "writtenkeysdb/backup";
+  rocksdb::DestroyDB(config.db_dir, rocksdb::Options());
+
+  Engine::Storage storage(&config);
+  ASSERT_TRUE(storage.Open().IsOK());
+  std::vector<std::vector<std::string>> reports;
+  storage.SetWrittenKeysHandler([&reports](const std::vector<std::string> &ns_keys) {
+    reports.emplace_back(ns_keys);
+  });
+  std::string ns = "test_tracking", ns_key;
+  int ret;
+  Redis::Hash hash(&storage, ns);
+  // the writes aren't reported without the trackers
+  hash.Set("hash_key", "f1", "v1", &ret);
+  EXPECT_TRUE(reports.empty());
+
+  storage.IncrKeyTrackers();
+  hash.Set("hash_key", "f2", "v2", &ret);
+  ComposeNamespaceKey(ns, "hash_key", &ns_key);
+  ASSERT_EQ(1u, reports.size());
+  EXPECT_EQ(std::vector<std::string>{ns_key}, reports[0]);
+  // the batches applied by the slave are reported as well
+  rocksdb::WriteBatch batch;
+  batch.Delete(storage.GetCFHandle("metadata"), ns_key);
+  ASSERT_TRUE(storage.WriteBatch(std::string(batch.Data())).IsOK());
+  ASSERT_EQ(2u, reports.size());
+  EXPECT_EQ(std::vector<std::string>{ns_key}, reports[1]);
+  storage.DecrKeyTrackers();
+  hash.Set("hash_key", "f3", "v3", &ret);
+  EXPECT_EQ(2u, reports.size());
+  storage.SetWrittenKeysHandler(nullptr);
+}
+
+TEST(Storage, ReplicationID) {
+  Config config;
+  config.dir = "replicationiddb";
+  config.db_dir = "replicationiddb/db";
+  config.backup_dir = "replicationiddb/backup";
+  rocksdb::DestroyDB(config.db_dir, rocksdb::Options());
+  rocksdb::Env::Default()->CreateDirIfMissing(config.dir);
+  rocksdb::Env::Default()->DeleteFile(config.dir + "/replication_id");
+
+  Engine::Storage::ReplicationID replid;
+  {
+    Engine::Storage storage(&config);
+    ASSERT_TRUE(storage.Open().IsOK());
+    // the slave without the id is checked by the sequence only
+    EXPECT_TRUE(storage.GetReplicationID().id.empty());
+    EXPECT_TRUE(storage.CheckReplicationID("", 1).IsOK());
+    auto id = storage.EnsureReplicationID();
+    EXPECT_EQ(40u, id.size());
+    EXPECT_EQ(id, storage.EnsureReplicationID());
+    EXPECT_TRUE(storage.CheckReplicationID(id, 1).IsOK());
+    EXPECT_FALSE(storage.CheckReplicationID("other", 1).IsOK());
+
+    // the former id is valid til the sequence when it is shifted
+    auto last_seq = storage.LatestSeq();
+    storage.ShiftReplicationID();
+    replid = storage.GetReplicationID();
+    EXPECT_NE(id, replid.id);
+    EXPECT_EQ(id, replid.prev_id);
+    EXPECT_TRUE(storage.CheckReplicationID(replid.id, last_seq + 1).IsOK());
+    EXPECT_TRUE(storage.CheckReplicationID(id, last_seq + 1).IsOK());
+    EXPECT_FALSE(storage.CheckReplicationID(id, last_seq + 2).IsOK());
+  }
+
+  // the id is loaded after the db is reopened
+  Engine::Storage storage(&config);
+  ASSERT_TRUE(storage.Open().IsOK());
+  auto loaded = storage.GetReplicationID();
+  EXPECT_EQ(replid.id, loaded.id);
+  EXPECT_EQ(replid.prev_id, loaded.prev_id);
+  EXPECT_EQ(replid.prev_id_last_seq, loaded.prev_id_last_seq);
+  storage.SetReplicationID("");
+  EXPECT_TRUE(storage.GetReplicationID().id.empty());
+}
+
+TEST(Storage, MetadataMemtableBloom) {
+  Config config;
+  config.db_dir = "metadatabloomdb";
+  config.backup_dir = "metadatabloomdb/backup";
+  config.rocksdb_options.metadata_memtable_bloom = true;
+  rocksdb::DestroyDB(config.db_dir, rocksdb::Options());
+
+  Engine::Storage storage(&config);
+  ASSERT_TRUE(storage.Open().IsOK());
+  int ret;
+  std::string value;
+  Redis::Hash hash(&storage, "test_metadata_hash");
+  std::vector<std::string> user_keys = {"key1", "key2", "key3", "other"};
+  for (const auto &user_key : user_keys) {
+    hash.Set(user_key, "field", "value", &ret);
+  }
+  EXPECT_TRUE(hash.Get("key2", "field", &value).ok());
+  EXPECT_EQ("value", value);
+  EXPECT_TRUE(hash.Get("key4", "field", &value).IsNotFound());
+
+  // the metadata is still iterated in order with the prefix extractor of the whole key
+  std::vector<std::string> keys;
+  hash.Keys("key", &keys);
+  EXPECT_EQ(3u, keys.size());
+  hash.Scan("", 10, "", &keys);
+  EXPECT_EQ(user_keys, keys);
+}
+
+TEST(Storage, RestoreFromBackupFilesFallback) {
+  Config config;
+  config.dir = "restorefallbackdb";
+  config.db_dir = "restorefallbackdb/db";
+  config.backup_dir = "restorefallbackdb/backup";
+  rocksdb::DestroyDB(config.db_dir, rocksdb::Options());
+  rocksdb::Env::Default()->CreateDirIfMissing(config.dir);
+
+  int ret;
+  std::string value;
+  Engine::Storage storage(&config);
+  ASSERT_TRUE(storage.Open().IsOK());
+  Redis::Hash hash(&storage, "test_restore_fallback");
+  hash.Set("hash_key", "field", "value", &ret);
+  ASSERT_TRUE(storage.CreateBackup().IsOK());
+
+  // the missing file fails the restore, and the db is left closed rather than dangling
+  EXPECT_FALSE(storage.RestoreFromBackupFiles({{"private/1/MISSING", 0}}).IsOK());
+  EXPECT_TRUE(storage.IsClosed());
+  ASSERT_TRUE(storage.RestoreFromBackup().IsOK());
+  EXPECT_FALSE(storage.IsClosed());
+  Redis::Hash restored(&storage, "test_restore_fallback");
+  EXPECT_TRUE(restored.Get("hash_key", "field", &value).ok());
+  EXPECT_EQ("value", value);
+}
+
+TEST(Storage, PersistIngestedSeq) {
+  Config config;
+  config.db_dir = "ingestedseqdb";
+  config.backup_dir = "ingestedseqdb/backup";
+  rocksdb::DestroyDB(config.db_dir, rocksdb::Options());
+
+  std::string sst_path = "ingestedseq.sst";
+  rocksdb::SstFileWriter writer(rocksdb::EnvOptions(), rocksdb::Options());
+  ASSERT_TRUE(writer.Open(sst_path).ok());
+  ASSERT_TRUE(writer.Put("ingested_key", "value").ok());
+  ASSERT_TRUE(writer.Finish().ok());
+
+  rocksdb::SequenceNumber ingested_seq;
+  {
+    Engine::Storage storage(&config);
+    ASSERT_TRUE(storage.Open().IsOK());
+    EXPECT_EQ(0u, storage.GetIngestedSeq());
+    ASSERT_TRUE(storage.IngestSSTFiles("default", {sst_path}).IsOK());
+    ingested_seq = storage.GetIngestedSeq();
+    EXPECT_GT(ingested_seq, 0u);
+  }
+  // the slaves synced before the ingestion are still refused after the restart
+  Engine::Storage storage(&config);
+  ASSERT_TRUE(storage.Open().IsOK());
+  EXPECT_EQ(ingested_seq, storage.GetIngestedSeq());
+  rocksdb::Env::Default()->DeleteFile(sst_path);
+}
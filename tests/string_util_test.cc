@@ -44,4 +44,64 @@ TEST(StringUtil, Split) {
   ASSERT_EQ(expected, array);
   Util::Split("a\tb\nc\t\nd   ", " \t\n", &array);
   ASSERT_EQ(expected, array);
-}
\ No newline at end of file
+  Util::Split("  a  \t  b  c         \t\t           d                    \t", " \t", &array);
+  ASSERT_EQ(expected, array);
+}
+
+TEST(StringUtil, FindCRLF) {
+  // cover the CRLF at the boundaries of the SSE2/AVX2 blocks and the tails
+  for (size_t len = 2; len < 100; len++) {
+    for (size_t pos = 0; pos + 1 < len; pos++) {
+      std::string input(len, 'a');
+      input[pos] = '\r';
+      input[pos + 1] = '\n';
+      ASSERT_EQ(pos, Util::FindCRLF(input.data(), input.size()));
+    }
+    std::string input(len, '\r');
+    ASSERT_EQ(len, Util::FindCRLF(input.data(), input.size()));
+    input.back() = '\n';
+    ASSERT_EQ(len - 2, Util::FindCRLF(input.data(), input.size()));
+  }
+  std::string input = "a\rb\nc\n\r\r\n";
+  ASSERT_EQ(7u, Util::FindCRLF(input.data(), input.size()));
+  ASSERT_EQ(0u, Util::FindCRLF(input.data(), 0));
+}
+
+TEST(StringUtil, FindFirstOf) {
+  for (size_t len = 1; len < 100; len++) {
+    for (size_t pos = 0; pos < len; pos++) {
+      std::string input(len, 'a');
+      input[pos] = '\t';
+      ASSERT_EQ(pos, Util::FindFirstOf(input.data(), input.size(), " \t"));
+      ASSERT_EQ(len, Util::FindFirstOf(input.data(), input.size(), " "));
+      // the chars more than 4 aren't vectorized
+      ASSERT_EQ(pos, Util::FindFirstOf(input.data(), input.size(), "bcde\t"));
+    }
+  }
+  ASSERT_EQ(3u, Util::FindFirstOf("abc", 3, ""));
+}
+
+TEST(StringUtil, ParseCPUList) {
+  std::vector<int> cpus;
+  std::vector<int> expected = {0, 1, 2, 3, 8, 10, 11};
+  ASSERT_TRUE(Util::ParseCPUList("0-3,8,10-11", &cpus).IsOK());
+  ASSERT_EQ(expected, cpus);
+  ASSERT_FALSE(Util::ParseCPUList("3-1", &cpus).IsOK());
+  ASSERT_FALSE(Util::ParseCPUList("a-b", &cpus).IsOK());
+}
+
+TEST(StringUtil, GlobLiteralPrefix) {
+  bool match_all = false;
+  ASSERT_EQ("user:", Util::GlobLiteralPrefix("user:*", &match_all));
+  ASSERT_TRUE(match_all);
+  ASSERT_EQ("user:", Util::GlobLiteralPrefix("user:*:session", &match_all));
+  ASSERT_FALSE(match_all);
+  ASSERT_EQ("", Util::GlobLiteralPrefix("*", &match_all));
+  ASSERT_TRUE(match_all);
+  ASSERT_EQ("a*b", Util::GlobLiteralPrefix("a\\*b?", &match_all));
+  ASSERT_FALSE(match_all);
+  ASSERT_EQ("key", Util::GlobLiteralPrefix("key", &match_all));
+  ASSERT_FALSE(match_all);
+  ASSERT_EQ("ke", Util::GlobLiteralPrefix("ke[yz]*", &match_all));
+  ASSERT_FALSE(match_all);
+}
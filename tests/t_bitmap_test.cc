@@ -47,6 +47,25 @@ TEST_F(RedisBitmapTest, BitCount) {
   bitmap->Del(key_);
 }
 
+TEST_F(RedisBitmapTest, BitCountFullBytes) {
+  bool bit = false;
+  // the bytes would be 0xff, which are negative as char
+  for (uint32_t offset = 0; offset < 16; offset++) {
+    bitmap->SetBit(key_, offset, true, &bit);
+  }
+  for (uint32_t offset = 3*1024*8; offset < 3*1024*8+8; offset++) {
+    bitmap->SetBit(key_, offset, true, &bit);
+  }
+  uint32_t cnt;
+  bitmap->BitCount(key_, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 24u);
+  bitmap->BitCount(key_, 1, 1, &cnt);
+  EXPECT_EQ(cnt, 8u);
+  bitmap->BitCount(key_, 3*1024, 3*1024+1, &cnt);
+  EXPECT_EQ(cnt, 8u);
+  bitmap->Del(key_);
+}
+
 TEST_F(RedisBitmapTest, BitPosClearBit) {
   int pos;
   bool old_bit;
@@ -73,3 +92,110 @@ TEST_F(RedisBitmapTest, BitPosSetBit) {
   }
   bitmap->Del(key_);
 }
+
+TEST_F(RedisBitmapTest, BitOp) {
+  std::string src_key1 = "test_bitop_src1", src_key2 = "test_bitop_src2";
+  bool bit;
+  uint32_t offsets1[] = {0, 1, 1024*8, 3*1024*8};
+  uint32_t offsets2[] = {1, 2, 3*1024*8, 5*1024*8};
+  for (const auto &offset : offsets1) bitmap->SetBit(src_key1, offset, true, &bit);
+  for (const auto &offset : offsets2) bitmap->SetBit(src_key2, offset, true, &bit);
+  std::vector<Slice> op_keys = {src_key1, src_key2};
+  int64_t len;
+  uint32_t cnt;
+  bitmap->BitOp(Redis::kBitOpAnd, "and", key_, op_keys, &len);
+  EXPECT_EQ(len, 5*1024+1);
+  bitmap->BitCount(key_, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 2u);
+  bitmap->GetBit(key_, 3*1024*8, &bit);
+  EXPECT_TRUE(bit);
+  bitmap->BitOp(Redis::kBitOpOr, "or", key_, op_keys, &len);
+  bitmap->BitCount(key_, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 6u);
+  bitmap->BitOp(Redis::kBitOpXor, "xor", key_, op_keys, &len);
+  bitmap->BitCount(key_, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 4u);
+  bitmap->GetBit(key_, 1, &bit);
+  EXPECT_FALSE(bit);
+  bitmap->BitOp(Redis::kBitOpNot, "not", key_, {src_key2}, &len);
+  EXPECT_EQ(len, 5*1024+1);
+  bitmap->BitCount(key_, 0, -1, &cnt);
+  EXPECT_EQ(cnt, (5u*1024+1)*8-4);
+  bitmap->Del(src_key1);
+  bitmap->Del(src_key2);
+  bitmap->Del(key_);
+}
+
+TEST_F(RedisBitmapTest, BitField) {
+  std::vector<Redis::BitfieldResult> rets;
+  Redis::BitfieldOperation set_op;
+  set_op.type = Redis::BitfieldOperation::kSet;
+  set_op.bits = 8;
+  set_op.offset = 1024*8-4;  // cross the segments
+  set_op.value = 200;
+  Redis::BitfieldOperation get_op = set_op;
+  get_op.type = Redis::BitfieldOperation::kGet;
+  get_op.is_signed = true;
+  Redis::BitfieldOperation incr_op = set_op;
+  incr_op.type = Redis::BitfieldOperation::kIncrBy;
+  incr_op.value = 100;
+  incr_op.overflow = Redis::kBitfieldOverflowSat;
+  bitmap->BitField(key_, {set_op, get_op, incr_op}, &rets);
+  ASSERT_EQ(rets.size(), 3u);
+  EXPECT_EQ(rets[0].second, 0);
+  EXPECT_EQ(rets[1].second, 200-256);
+  EXPECT_EQ(rets[2].second, 255);
+  incr_op.overflow = Redis::kBitfieldOverflowFail;
+  bitmap->BitField(key_, {incr_op}, &rets);
+  EXPECT_FALSE(rets[0].first);
+  incr_op.overflow = Redis::kBitfieldOverflowWrap;
+  bitmap->BitField(key_, {incr_op}, &rets);
+  EXPECT_EQ(rets[0].second, 99);
+  bool bit;
+  bitmap->GetBit(key_, 1024*8-4+1, &bit);  // 99 = 0b01100011
+  EXPECT_TRUE(bit);
+  bitmap->GetBit(key_, 1024*8-4+2, &bit);
+  EXPECT_TRUE(bit);
+  bitmap->GetBit(key_, 1024*8-4+3, &bit);
+  EXPECT_FALSE(bit);
+  bitmap->Del(key_);
+}
+
+TEST_F(RedisBitmapTest, MSetBit) {
+  std::vector<std::pair<uint32_t, bool>> bits = {{0, true}, {1024*8+1, true}, {0, false}, {3*1024*8, true}};
+  std::vector<bool> old_bits;
+  bitmap->MSetBit(key_, bits, &old_bits);
+  std::vector<bool> expected_old_bits = {false, false, true, false};
+  EXPECT_EQ(old_bits, expected_old_bits);
+  uint32_t cnt;
+  bitmap->BitCount(key_, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 2u);
+  bool bit;
+  bitmap->GetBit(key_, 0, &bit);
+  EXPECT_FALSE(bit);
+  bitmap->GetBit(key_, 1024*8+1, &bit);
+  EXPECT_TRUE(bit);
+  bitmap->GetBit(key_, 3*1024*8, &bit);
+  EXPECT_TRUE(bit);
+  bitmap->Del(key_);
+}
+
+TEST_F(RedisBitmapTest, SetBitRange) {
+  uint32_t changed, cnt;
+  bitmap->SetBitRange(key_, 3, 2*1024*8+4, true, &changed);  // cross the segments
+  EXPECT_EQ(changed, 2u*1024*8+2);
+  bitmap->BitCount(key_, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 2u*1024*8+2);
+  bitmap->SetBitRange(key_, 0, 9, true, &changed);
+  EXPECT_EQ(changed, 3u);
+  bitmap->SetBitRange(key_, 5, 5, false, &changed);
+  EXPECT_EQ(changed, 1u);
+  bool bit;
+  bitmap->GetBit(key_, 5, &bit);
+  EXPECT_FALSE(bit);
+  bitmap->GetBit(key_, 2*1024*8+4, &bit);
+  EXPECT_TRUE(bit);
+  bitmap->GetBit(key_, 2*1024*8+5, &bit);
+  EXPECT_FALSE(bit);
+  bitmap->Del(key_);
+}
@@ -15,4 +15,23 @@ TEST(Util, EncodeAndDecodeDouble) {
     prev_bytes.assign(bytes);
     ASSERT_EQ(value, got);
   }
-}
\ No newline at end of file
+}
+TEST(Util, EncodeAndDecodeVarint) {
+  std::vector<uint64_t> values = {0, 1, 127, 128, 300, 16383, 16384, 1ULL << 35,
+                                  std::numeric_limits<uint64_t>::max()};
+  std::string bytes;
+  for (auto value : values) PutVarint64(&bytes, value);
+  EXPECT_EQ(0, bytes[0]);
+  rocksdb::Slice input(bytes);
+  for (auto value : values) {
+    uint64_t got;
+    ASSERT_TRUE(GetVarint64(&input, &got));
+    EXPECT_EQ(value, got);
+  }
+  EXPECT_TRUE(input.empty());
+  uint64_t got;
+  std::string truncated;
+  PutVarint64(&truncated, 300);
+  rocksdb::Slice truncated_input(truncated.data(), 1);
+  EXPECT_FALSE(GetVarint64(&truncated_input, &got));
+}
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "test_base.h"
+#include "redis_geo.h"
+
+class RedisGeoTest : public TestBase {
+ protected:
+  explicit RedisGeoTest() : TestBase() {
+    geo = new Redis::Geo(storage_, "geo_ns");
+  }
+  ~RedisGeoTest() {
+    delete geo;
+  }
+  void SetUp() override {
+    key_ = "test_geo_key";
+    std::vector<GeoPoint> geo_points(2);
+    geo_points[0].longitude = 13.361389;
+    geo_points[0].latitude = 38.115556;
+    geo_points[0].member = "Palermo";
+    geo_points[1].longitude = 15.087269;
+    geo_points[1].latitude = 37.502669;
+    geo_points[1].member = "Catania";
+    int ret = 0;
+    geo->Add(key_, &geo_points, 0, &ret);
+  }
+  void TearDown() override {
+    geo->Del(key_);
+  }
+
+ protected:
+  Redis::Geo *geo;
+};
+
+TEST_F(RedisGeoTest, PosAndHash) {
+  std::map<std::string, GeoPoint> geo_points;
+  geo->Pos(key_, {"Palermo", "missing"}, &geo_points);
+  ASSERT_EQ(1U, geo_points.size());
+  EXPECT_LT(std::fabs(geo_points["Palermo"].longitude - 13.361389), 0.0001);
+  EXPECT_LT(std::fabs(geo_points["Palermo"].latitude - 38.115556), 0.0001);
+  std::vector<std::string> geo_hashes;
+  geo->Hash(key_, {"Palermo", "Catania", "missing"}, &geo_hashes);
+  EXPECT_EQ(std::vector<std::string>({"sqc8b49rny0", "sqdtr74hyu0", ""}), geo_hashes);
+}
+
+TEST_F(RedisGeoTest, Dist) {
+  double dist = 0;
+  geo->Dist(key_, "Palermo", "Catania", &dist);
+  EXPECT_LT(std::fabs(dist - 166274.1516), 0.001);
+  EXPECT_TRUE(geo->Dist(key_, "Palermo", "missing", &dist).IsNotFound());
+}
+
+TEST_F(RedisGeoTest, Search) {
+  GeoShape shape;
+  shape.xy[0] = 15;
+  shape.xy[1] = 37;
+  shape.radius = 200;
+  shape.conversion = Redis::Geo::GetUnitConversion(kDistanceKilometers);
+  std::vector<GeoPoint> geo_points;
+  geo->Search(key_, shape, 0, false, kSortASC, "", false, &geo_points);
+  ASSERT_EQ(2U, geo_points.size());
+  EXPECT_EQ("Catania", geo_points[0].member);
+  EXPECT_EQ("Palermo", geo_points[1].member);
+  shape.radius = 100;
+  geo->Search(key_, shape, 0, false, kSortNone, "", false, &geo_points);
+  ASSERT_EQ(1U, geo_points.size());
+  EXPECT_EQ("Catania", geo_points[0].member);
+
+  shape.type = kGeoShapeTypeRectangle;
+  shape.width = 400;
+  shape.height = 400;
+  geo->Search(key_, shape, 1, false, kSortNone, "", false, &geo_points);
+  ASSERT_EQ(1U, geo_points.size());
+  EXPECT_EQ("Catania", geo_points[0].member);
+}
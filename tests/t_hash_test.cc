@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <algorithm>
 
 #include "test_base.h"
 #include "redis_hash.h"
@@ -133,4 +134,55 @@ TEST_F(RedisHashTest, HIncrByFloat) {
   value = std::stof(bytes);
   EXPECT_FLOAT_EQ(32*1.2, value);
   hash->Del(key_);
-}
\ No newline at end of file
+}
+TEST_F(RedisHashTest, InlineFields) {
+  config_->hash_inline_max_entries = 3;
+  int ret;
+  for (size_t i = 0; i < fields_.size(); i++) {
+    hash->Set(key_, fields_[i], values_[i], &ret);
+    EXPECT_EQ(1, ret);
+  }
+  std::string got;
+  hash->Get(key_, fields_[1], &got);
+  EXPECT_EQ(values_[1], got);
+  std::vector<FieldValue> fvs;
+  hash->GetAll(key_, &fvs);
+  EXPECT_EQ(fields_.size(), fvs.size());
+  std::vector<std::string> scan_fields;
+  hash->Scan(key_, fields_[0].ToString(), 10, "", &scan_fields);
+  EXPECT_EQ(fields_.size() - 1, scan_fields.size());
+
+  // the fields would be moved out to the sub keys after the hash grows
+  int64_t incr;
+  hash->IncrBy(key_, "test-hash-incr", 2, &incr);
+  EXPECT_EQ(2, incr);
+  config_->hash_inline_max_entries = 0;
+  uint32_t size;
+  hash->Size(key_, &size);
+  EXPECT_EQ(fields_.size() + 1, size);
+  for (size_t i = 0; i < fields_.size(); i++) {
+    hash->Get(key_, fields_[i], &got);
+    EXPECT_EQ(values_[i], got);
+  }
+  hash->GetAll(key_, &fvs);
+  EXPECT_EQ(fields_.size() + 1, fvs.size());
+  hash->Del(key_);
+}
+
+TEST_F(RedisHashTest, ScanWithIteratorToken) {
+  int ret;
+  for (int i = 0; i < 10; i++) {
+    hash->Set(key_, "scan-field-" + std::to_string(i), "value", &ret);
+  }
+  std::string cursor;
+  std::vector<std::string> all_fields, fields;
+  do {
+    fields.clear();
+    hash->Scan(key_, cursor, 3, "", &fields, "1|hscan");
+    all_fields.insert(all_fields.end(), fields.begin(), fields.end());
+    if (!fields.empty()) cursor = fields.back();
+  } while (!fields.empty());
+  EXPECT_EQ(10u, all_fields.size());
+  EXPECT_TRUE(std::is_sorted(all_fields.begin(), all_fields.end()));
+  hash->Del(key_);
+}
@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "test_base.h"
+#include "redis_hyperloglog.h"
+
+class RedisHyperLogLogTest : public TestBase {
+ protected:
+  explicit RedisHyperLogLogTest() : TestBase() {
+    hll = new Redis::HyperLogLog(storage_, "hll_ns");
+  }
+  ~RedisHyperLogLogTest() {
+    delete hll;
+  }
+  void SetUp() override {
+    key_ = "test_hll_key";
+  }
+  void TearDown() override {}
+
+  void addElements(const std::string &key, int begin, int end) {
+    std::vector<std::string> elements;
+    for (int i = begin; i < end; i++) elements.emplace_back("element-" + std::to_string(i));
+    std::vector<Slice> slices(elements.begin(), elements.end());
+    int ret = 0;
+    hll->Add(key, slices, &ret);
+  }
+
+ protected:
+  Redis::HyperLogLog *hll;
+};
+
+TEST_F(RedisHyperLogLogTest, AddAndCount) {
+  int ret = 0;
+  hll->Add(key_, {"a", "b", "c"}, &ret);
+  EXPECT_EQ(1, ret);
+  hll->Add(key_, {"a", "b"}, &ret);
+  EXPECT_EQ(0, ret);
+  uint64_t count = 0;
+  hll->Count({key_}, &count);
+  EXPECT_EQ(3U, count);
+  hll->Del(key_);
+  hll->Count({key_}, &count);
+  EXPECT_EQ(0U, count);
+}
+
+TEST_F(RedisHyperLogLogTest, SparseToDense) {
+  // the accuracy should be kept across the promotion from the sparse to the dense registers
+  int sizes[] = {100, 400, 1000, 10000, 100000};
+  int added = 0;
+  for (const auto &size : sizes) {
+    addElements(key_, added, size);
+    added = size;
+    uint64_t count = 0;
+    hll->Count({key_}, &count);
+    EXPECT_LT(std::fabs(static_cast<double>(count) - size), size * 0.03);
+  }
+  hll->Del(key_);
+}
+
+TEST_F(RedisHyperLogLogTest, Merge) {
+  std::string key1 = key_ + "1", key2 = key_ + "2", dest = key_ + "dest";
+  addElements(key1, 0, 6000);
+  addElements(key2, 4000, 10000);
+  uint64_t count = 0, union_count = 0;
+  hll->Count({key1, key2}, &union_count);
+  EXPECT_LT(std::fabs(static_cast<double>(union_count) - 10000), 300);
+  hll->Merge(dest, {key1, key2});
+  hll->Count({dest}, &count);
+  EXPECT_EQ(union_count, count);
+  hll->Del(key1);
+  hll->Del(key2);
+  hll->Del(dest);
+}
+
+TEST(HyperLogLog, MergeRegisters) {
+  uint8_t dst[19], src[19];
+  for (int i = 0; i < 19; i++) {
+    dst[i] = static_cast<uint8_t>(i * 7 % 52);
+    src[i] = static_cast<uint8_t>(i * 11 % 52);
+  }
+  uint8_t expected[19];
+  for (int i = 0; i < 19; i++) expected[i] = std::max(dst[i], src[i]);
+  Redis::HyperLogLog::MergeRegisters(dst, src, 19);
+  for (int i = 0; i < 19; i++) EXPECT_EQ(expected[i], dst[i]);
+}
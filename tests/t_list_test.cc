@@ -133,4 +133,51 @@ TEST_F(RedisListTest, RPopLPush) {
   }
   list->Del(key_);
   list->Del(dst);
-}
\ No newline at end of file
+}
+TEST_F(RedisListTest, ChunkedList) {
+  config_->list_chunk_size = 2;
+  int ret;
+  std::vector<Slice> elems = {"a", "b", "c", "d", "e"};
+  list->Push(key_, elems, false, &ret);
+  EXPECT_EQ(5, ret);
+  std::vector<Slice> left_elems = {"z"};
+  list->Push(key_, left_elems, true, &ret);
+  EXPECT_EQ(6, ret);
+  std::string elem;
+  list->Index(key_, 0, &elem);
+  EXPECT_EQ("z", elem);
+  list->Index(key_, -1, &elem);
+  EXPECT_EQ("e", elem);
+
+  // the full chunk would be split by the middle insert
+  list->Insert(key_, "c", "x", true, &ret);
+  EXPECT_EQ(7, ret);
+  std::vector<std::string> range_elems;
+  list->Range(key_, 0, -1, &range_elems);
+  std::vector<std::string> expected = {"z", "a", "b", "x", "c", "d", "e"};
+  EXPECT_EQ(expected, range_elems);
+  list->Range(key_, 2, 4, &range_elems);
+  expected = {"b", "x", "c"};
+  EXPECT_EQ(expected, range_elems);
+
+  list->Rem(key_, 0, "b", &ret);
+  EXPECT_EQ(1, ret);
+  list->Set(key_, 1, "y");
+  list->Range(key_, 0, -1, &range_elems);
+  expected = {"z", "y", "x", "c", "d", "e"};
+  EXPECT_EQ(expected, range_elems);
+
+  list->Trim(key_, 1, 3);
+  list->Range(key_, 0, -1, &range_elems);
+  expected = {"y", "x", "c"};
+  EXPECT_EQ(expected, range_elems);
+  list->Pop(key_, &elem, true);
+  EXPECT_EQ("y", elem);
+  list->Pop(key_, &elem, false);
+  EXPECT_EQ("c", elem);
+  uint32_t len;
+  list->Size(key_, &len);
+  EXPECT_EQ(1u, len);
+  list->Del(key_);
+  config_->list_chunk_size = 0;
+}
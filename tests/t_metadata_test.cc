@@ -1,6 +1,11 @@
 #include "redis_metadata.h"
 #include "redis_hash.h"
 #include "test_base.h"
+#include <sys/time.h>
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+#include <vector>
 #include <gtest/gtest.h>
 
 TEST(InternalKey, EncodeAndDecode) {
@@ -21,6 +26,56 @@ TEST(InternalKey, EncodeAndDecode) {
   EXPECT_EQ(ikey, ikey1);
 }
 
+TEST(InternalKey, Builder) {
+  std::string ns_key;
+  ComposeNamespaceKey("namespace", "test-metadata-key", &ns_key);
+  InternalKeyBuilder builder(ns_key, 12);
+  std::string bytes;
+  for (const auto &sub_key : {"a", "test-metadata-long-sub-key", "", "b"}) {
+    InternalKey(ns_key, sub_key, 12).Encode(&bytes);
+    ASSERT_EQ(bytes, builder.Build(sub_key).ToString());
+  }
+  InternalKey(ns_key, "", 12).Encode(&bytes);
+  ASSERT_EQ(bytes, builder.Prefix().ToString());
+  InternalKey(ns_key, "scoremember", 12).Encode(&bytes);
+  ASSERT_EQ(bytes, builder.Build("score", "member").ToString());
+  InternalKey ikey(builder.Build("sub-key"));
+  ASSERT_EQ(ikey.GetNamespace(), "namespace");
+  ASSERT_EQ(ikey.GetKey(), "test-metadata-key");
+  ASSERT_EQ(ikey.GetSubKey(), "sub-key");
+  ASSERT_EQ(ikey.GetVersion(), 12u);
+}
+
+TEST(Metadata, DecodeExpired) {
+  bool expired;
+  std::vector<std::pair<Metadata, bool>> cases;
+  Metadata string_md(kRedisString);
+  string_md.expire = 100;
+  cases.emplace_back(string_md, true);
+  string_md.expire = 0;
+  cases.emplace_back(string_md, false);
+  HashMetadata hash_md;
+  hash_md.size = 0;
+  cases.emplace_back(hash_md, true);
+  hash_md.size = 3;
+  cases.emplace_back(hash_md, false);
+  hash_md.expire = 300;
+  cases.emplace_back(hash_md, false);
+  hash_md.expire = 100;
+  cases.emplace_back(hash_md, true);
+  for (auto &c : cases) {
+    std::string bytes;
+    c.first.Encode(&bytes);
+    ASSERT_TRUE(Metadata::DecodeExpired(bytes, 200, &expired));
+    ASSERT_EQ(c.second, expired);
+  }
+  ASSERT_FALSE(Metadata::DecodeExpired("abc", 200, &expired));
+  std::string bytes;
+  hash_md.expire = 0;
+  hash_md.Encode(&bytes);
+  ASSERT_FALSE(Metadata::DecodeExpired(Slice(bytes.data(), 10), 200, &expired));
+}
+
 TEST(Metadata, EncodeAndDeocde) {
   std::string string_bytes;
   Metadata string_md(kRedisString);
@@ -43,6 +98,59 @@ TEST(Metadata, EncodeAndDeocde) {
   ASSERT_EQ(list_md, list_md1);
 }
 
+TEST(Metadata, DecodeStringBlob) {
+  uint64_t version;
+  uint32_t size;
+  std::string bytes;
+  Metadata string_md(kRedisString);
+  string_md.Encode(&bytes);
+  bytes.append("a short value of the string");
+  ASSERT_FALSE(DecodeStringBlob(bytes, &version, &size));
+  bytes.clear();
+  string_md.flags |= kStringBlobFlag;
+  string_md.Encode(&bytes);
+  PutFixed64(&bytes, 42);
+  PutFixed32(&bytes, 65536);
+  ASSERT_TRUE(DecodeStringBlob(bytes, &version, &size));
+  ASSERT_EQ(version, 42u);
+  ASSERT_EQ(size, 65536u);
+  ASSERT_FALSE(DecodeStringBlob(Slice(bytes.data(), 10), &version, &size));
+}
+
+TEST(Metadata, GenerateVersion) {
+  Metadata decoded(kRedisHash, false);
+  EXPECT_EQ(decoded.version, 0U);
+  std::vector<uint64_t> versions;
+  for (int i = 0; i < 10000; i++) {
+    Metadata md(kRedisHash);
+    versions.emplace_back(md.version);
+  }
+  for (size_t i = 1; i < versions.size(); i++) {
+    ASSERT_GT(versions[i], versions[i-1]);
+  }
+  timeval now;
+  gettimeofday(&now, nullptr);
+  // the coarse clock may be behind by a few ticks
+  EXPECT_LE(std::abs(static_cast<int64_t>(Metadata(kRedisHash).Time().tv_sec - now.tv_sec)), 1);
+}
+
+TEST(Metadata, GenerateVersionConcurrently) {
+  const int n_threads = 8, n_versions = 10000;
+  std::vector<std::vector<uint64_t>> versions(n_threads);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < n_threads; i++) {
+    threads.emplace_back([&versions, i] {
+      for (int j = 0; j < n_versions; j++) versions[i].emplace_back(Metadata(kRedisHash).version);
+    });
+  }
+  for (auto &t : threads) t.join();
+  std::vector<uint64_t> all;
+  for (const auto &v : versions) all.insert(all.end(), v.begin(), v.end());
+  std::sort(all.begin(), all.end());
+  EXPECT_EQ(all.end(), std::adjacent_find(all.begin(), all.end()));
+  EXPECT_EQ(static_cast<size_t>(n_threads * n_versions), all.size());
+}
+
 class RedisTypeTest : public TestBase {
 public:
   RedisTypeTest() :TestBase() {
@@ -93,4 +201,94 @@ TEST_F(RedisTypeTest, Expire) {
   redis->TTL(key_, &ttl);
   ASSERT_TRUE(ttl >= 1 && ttl <= 2);
   sleep(2);
-}
\ No newline at end of file
+}
+TEST_F(RedisTypeTest, ExpireKeys) {
+  int ret;
+  std::vector<FieldValue> fvs;
+  for (size_t i = 0; i < fields_.size(); i++) {
+    fvs.emplace_back(FieldValue{fields_[i].ToString(), values_[i].ToString()});
+  }
+  std::vector<std::string> keys = {"expire-keys-1", "expire-keys-2", "expire-keys-3", "expire-keys-4"};
+  for (const auto &key : keys) {
+    rocksdb::Status s = hash->MSet(key, fvs, false, &ret);
+    EXPECT_TRUE(s.ok());
+  }
+  redis->Expire(keys[0], 1);  // expired
+  redis->Expire(keys[2], 1);  // expired
+  std::string cursor;
+  uint64_t n_deleted = 0, total_deleted = 0;
+  int n_cycles = 0;
+  do {
+    rocksdb::Status s = redis->ExpireKeys(&cursor, 1, 10, &n_deleted);
+    EXPECT_TRUE(s.ok());
+    total_deleted += n_deleted;
+    n_cycles++;
+  } while (!cursor.empty());
+  EXPECT_GE(total_deleted, 2u);
+  EXPECT_GE(n_cycles, static_cast<int>(keys.size()));
+
+  std::string ns_key, value;
+  for (size_t i = 0; i < keys.size(); i++) {
+    redis->AppendNamespacePrefix(keys[i], &ns_key);
+    rocksdb::Status s = storage_->GetDB()->Get(rocksdb::ReadOptions(), storage_->GetCFHandle("metadata"),
+                                               ns_key, &value);
+    EXPECT_EQ(i % 2 == 1, s.ok());
+  }
+  redis->Del(keys[1]);
+  redis->Del(keys[3]);
+}
+
+TEST_F(RedisTypeTest, MDel) {
+  int ret;
+  std::vector<FieldValue> fvs;
+  for (size_t i = 0; i < fields_.size(); i++) {
+    fvs.emplace_back(FieldValue{fields_[i].ToString(), values_[i].ToString()});
+  }
+  std::vector<std::string> keys = {"mdel-keys-1", "mdel-keys-2", "mdel-keys-3"};
+  for (const auto &key : keys) {
+    rocksdb::Status s = hash->MSet(key, fvs, false, &ret);
+    EXPECT_TRUE(s.ok());
+  }
+  redis->Expire(keys[2], 1);  // expired
+  std::vector<Slice> del_keys = {keys[0], keys[1], keys[0], keys[2], "mdel-keys-none"};
+  EXPECT_TRUE(redis->Exists(del_keys, &ret).ok());
+  EXPECT_EQ(3, ret);
+  // the duplicated key is deleted once, and the expired key isn't counted
+  EXPECT_TRUE(redis->MDel(del_keys, &ret).ok());
+  EXPECT_EQ(2, ret);
+  EXPECT_TRUE(redis->Exists(del_keys, &ret).ok());
+  EXPECT_EQ(0, ret);
+  EXPECT_TRUE(redis->MDel(del_keys, &ret).ok());
+  EXPECT_EQ(0, ret);
+}
+
+TEST_F(RedisTypeTest, DumpAndRestorePayload) {
+  int ret;
+  std::vector<FieldValue> fvs;
+  for (size_t i = 0; i < fields_.size(); i++) {
+    fvs.emplace_back(FieldValue{fields_[i].ToString(), values_[i].ToString()});
+  }
+  rocksdb::Status s = hash->MSet(key_, fvs, false, &ret);
+  EXPECT_TRUE(s.ok());
+  std::string payload;
+  s = redis->DumpPayload(key_, &payload);
+  ASSERT_TRUE(s.ok());
+  bool busy = false;
+  s = redis->RestorePayload(key_, payload, 0, false, &busy);
+  EXPECT_TRUE(s.ok() && busy);
+  std::string restored_key = "test-restored-key";
+  s = redis->RestorePayload(restored_key, payload, 0, false, &busy);
+  EXPECT_TRUE(s.ok() && !busy);
+  std::vector<FieldValue> restored_fvs;
+  hash->GetAll(restored_key, &restored_fvs);
+  ASSERT_EQ(restored_fvs.size(), fvs.size());
+  for (size_t i = 0; i < fvs.size(); i++) {
+    EXPECT_EQ(restored_fvs[i].field, fvs[i].field);
+    EXPECT_EQ(restored_fvs[i].value, fvs[i].value);
+  }
+  payload[payload.size() / 2] ^= 0x1;
+  s = redis->RestorePayload(restored_key, payload, 0, true, &busy);
+  EXPECT_TRUE(s.IsCorruption());
+  redis->Del(key_);
+  redis->Del(restored_key);
+}
@@ -63,6 +63,25 @@ TEST_F(RedisSetTest, IsMember) {
   set->Del(key_);
 }
 
+TEST_F(RedisSetTest, MIsMember) {
+  int ret;
+  std::vector<int> exists;
+  rocksdb::Status s = set->Add(key_, fields_, &ret);
+  EXPECT_TRUE(s.ok() && static_cast<int>(fields_.size()) == ret);
+  std::vector<Slice> members(fields_);
+  members.emplace_back("foo");
+  s = set->MIsMember(key_, members, &exists);
+  EXPECT_TRUE(s.ok() && exists.size() == members.size());
+  for (size_t i = 0; i < fields_.size(); i++) {
+    EXPECT_EQ(1, exists[i]);
+  }
+  EXPECT_EQ(0, exists.back());
+  set->Del(key_);
+  s = set->MIsMember(key_, members, &exists);
+  EXPECT_TRUE(s.ok() && exists.size() == members.size());
+  EXPECT_EQ(0, exists[0]);
+}
+
 TEST_F(RedisSetTest, Move) {
   int ret;
   rocksdb::Status s = set->Add(key_, fields_, &ret);
@@ -47,3 +47,64 @@ TEST_F(RedisSortedintTest, Range) {
   EXPECT_TRUE(s.ok() && static_cast<int>(ids_.size()) == ret);
   sortedint->Del(key_);
 }
+
+TEST_F(RedisSortedintTest, MExist) {
+  int ret;
+  sortedint->Add(key_, ids_, &ret);
+  std::vector<int> exists;
+  rocksdb::Status s = sortedint->MExist(key_, {4, 5, 1, 0}, &exists);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(std::vector<int>({1, 0, 1, 0}), exists);
+  sortedint->Del(key_);
+  s = sortedint->MExist(key_, {1, 2}, &exists);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(std::vector<int>({0, 0}), exists);
+}
+
+TEST_F(RedisSortedintTest, EncodeAndDecodeBlock) {
+  std::vector<uint64_t> ids = {3, 4, 200, 1ULL << 40, std::numeric_limits<uint64_t>::max()};
+  std::string value;
+  Redis::Sortedint::EncodeBlock(ids.begin(), ids.end(), &value);
+  std::vector<uint64_t> got;
+  EXPECT_TRUE(Redis::Sortedint::DecodeBlock(value, &got));
+  EXPECT_EQ(ids, got);
+  EXPECT_FALSE(Redis::Sortedint::DecodeBlock(Slice(value.data(), value.size() - 1), &got));
+}
+
+TEST_F(RedisSortedintTest, Blocks) {
+  config_->sortedint_block_size = 4;
+  int ret;
+  std::vector<uint64_t> ids;
+  for (uint64_t id = 10; id <= 100; id += 10) ids.emplace_back(id);
+  rocksdb::Status s = sortedint->Add(key_, ids, &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(10, ret);
+  // the ids before the first block, in the middle of the full block and the duplicated ones
+  s = sortedint->Add(key_, {5, 15, 15, 20, 105}, &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(3, ret);
+  sortedint->Card(key_, &ret);
+  EXPECT_EQ(13, ret);
+
+  std::vector<uint64_t> got;
+  s = sortedint->Range(key_, 0, 0, 0, false, &got);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(std::vector<uint64_t>({5, 10, 15, 20, 30, 40, 50, 60, 70, 80, 90, 100, 105}), got);
+  s = sortedint->Range(key_, 20, 1, 3, false, &got);
+  EXPECT_EQ(std::vector<uint64_t>({40, 50, 60}), got);
+  s = sortedint->Range(key_, 0, 2, 3, true, &got);
+  EXPECT_EQ(std::vector<uint64_t>({90, 80, 70}), got);
+  s = sortedint->Range(key_, 55, 0, 3, true, &got);
+  EXPECT_EQ(std::vector<uint64_t>({50, 40, 30}), got);
+
+  s = sortedint->Remove(key_, {5, 10, 15, 20, 30, 1000}, &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(5, ret);
+  s = sortedint->Range(key_, 0, 0, 0, false, &got);
+  EXPECT_EQ(std::vector<uint64_t>({40, 50, 60, 70, 80, 90, 100, 105}), got);
+  std::vector<int> exists;
+  sortedint->MExist(key_, {40, 45, 105, 10, 100}, &exists);
+  EXPECT_EQ(std::vector<int>({1, 0, 1, 0, 1}), exists);
+  sortedint->Del(key_);
+  config_->sortedint_block_size = 0;
+}
@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "test_base.h"
+#include "redis_stream.h"
+
+class RedisStreamTest : public TestBase {
+ protected:
+  explicit RedisStreamTest() : TestBase() {
+    stream = new Redis::Stream(storage_, "stream_ns");
+  }
+  ~RedisStreamTest() {
+    delete stream;
+  }
+  void SetUp() override {
+    key_ = "test_stream_key";
+  }
+  void TearDown() override {}
+
+  void addEntries(uint64_t n) {
+    Redis::StreamAddOptions options;
+    options.auto_id = false;
+    Redis::StreamEntryID id;
+    for (uint64_t i = 1; i <= n; i++) {
+      options.id = Redis::StreamEntryID(i, 0);
+      stream->Add(key_, options, {"field", std::to_string(i)}, &id);
+    }
+  }
+
+ protected:
+  Redis::Stream *stream;
+};
+
+TEST_F(RedisStreamTest, ParseID) {
+  Redis::StreamEntryID id;
+  EXPECT_TRUE(Redis::StreamEntryID::Parse("123-45", 0, &id));
+  EXPECT_EQ(Redis::StreamEntryID(123, 45), id);
+  EXPECT_TRUE(Redis::StreamEntryID::Parse("123", UINT64_MAX, &id));
+  EXPECT_EQ(Redis::StreamEntryID(123, UINT64_MAX), id);
+  EXPECT_FALSE(Redis::StreamEntryID::Parse("-1", 0, &id));
+  EXPECT_FALSE(Redis::StreamEntryID::Parse("1-a", 0, &id));
+  EXPECT_FALSE(Redis::StreamEntryID::Parse("", 0, &id));
+}
+
+TEST_F(RedisStreamTest, AddAndRange) {
+  Redis::StreamAddOptions options;
+  Redis::StreamEntryID id1, id2;
+  stream->Add(key_, options, {"f1", "v1"}, &id1);
+  stream->Add(key_, options, {"f2", ""}, &id2);
+  EXPECT_TRUE(id1 < id2);
+  options.auto_id = false;
+  options.id = id1;
+  Redis::StreamEntryID id;
+  EXPECT_FALSE(stream->Add(key_, options, {"f", "v"}, &id).ok());
+  uint64_t len = 0;
+  stream->Len(key_, &len);
+  EXPECT_EQ(2U, len);
+
+  std::vector<Redis::StreamEntry> entries;
+  stream->Range(key_, Redis::StreamEntryID::Min(), Redis::StreamEntryID::Max(), 0, false, &entries);
+  ASSERT_EQ(2U, entries.size());
+  EXPECT_EQ(id1, entries[0].id);
+  EXPECT_EQ(std::vector<std::string>({"f2", ""}), entries[1].values);
+  stream->Range(key_, Redis::StreamEntryID::Min(), Redis::StreamEntryID::Max(), 1, true, &entries);
+  ASSERT_EQ(1U, entries.size());
+  EXPECT_EQ(id2, entries[0].id);
+  stream->Del(key_);
+}
+
+TEST_F(RedisStreamTest, DeleteAndTrim) {
+  addEntries(300);
+  uint64_t ret = 0, len = 0;
+  stream->DeleteEntries(key_, {Redis::StreamEntryID(1, 0), Redis::StreamEntryID(1, 0),
+                               Redis::StreamEntryID(1000, 0)}, &ret);
+  EXPECT_EQ(1U, ret);
+  // the trimming of many entries is done by the range deletion
+  stream->Trim(key_, 10, &ret);
+  EXPECT_EQ(289U, ret);
+  stream->Len(key_, &len);
+  EXPECT_EQ(10U, len);
+  std::vector<Redis::StreamEntry> entries;
+  stream->Range(key_, Redis::StreamEntryID::Min(), Redis::StreamEntryID::Max(), 0, false, &entries);
+  ASSERT_EQ(10U, entries.size());
+  EXPECT_EQ(Redis::StreamEntryID(291, 0), entries[0].id);
+  stream->Trim(key_, 8, &ret);
+  EXPECT_EQ(2U, ret);
+  stream->Range(key_, Redis::StreamEntryID::Min(), Redis::StreamEntryID::Max(), 0, false, &entries);
+  ASSERT_EQ(8U, entries.size());
+  EXPECT_EQ(Redis::StreamEntryID(293, 0), entries[0].id);
+  stream->Del(key_);
+}
+
+TEST_F(RedisStreamTest, ConsumerGroup) {
+  addEntries(5);
+  EXPECT_TRUE(stream->CreateGroup(key_, "group", false, Redis::StreamEntryID::Min(), false).ok());
+  EXPECT_FALSE(stream->CreateGroup(key_, "group", false, Redis::StreamEntryID::Min(), false).ok());
+
+  std::vector<Redis::StreamEntry> entries;
+  stream->ReadGroup(key_, "group", "c1", true, Redis::StreamEntryID(), 2, false, &entries);
+  ASSERT_EQ(2U, entries.size());
+  EXPECT_EQ(Redis::StreamEntryID(1, 0), entries[0].id);
+  stream->ReadGroup(key_, "group", "c2", true, Redis::StreamEntryID(), 0, false, &entries);
+  ASSERT_EQ(3U, entries.size());
+  EXPECT_EQ(Redis::StreamEntryID(3, 0), entries[0].id);
+
+  std::vector<Redis::StreamPendingEntry> pending;
+  stream->Pending(key_, "group", Redis::StreamEntryID::Min(), Redis::StreamEntryID::Max(), 0, "", &pending);
+  EXPECT_EQ(5U, pending.size());
+  uint64_t ret = 0;
+  stream->Ack(key_, "group", {Redis::StreamEntryID(1, 0), Redis::StreamEntryID(3, 0)}, &ret);
+  EXPECT_EQ(2U, ret);
+  stream->Pending(key_, "group", Redis::StreamEntryID::Min(), Redis::StreamEntryID::Max(), 0, "c1", &pending);
+  ASSERT_EQ(1U, pending.size());
+  EXPECT_EQ(Redis::StreamEntryID(2, 0), pending[0].id);
+
+  // the history of the consumer is read from its pending entries
+  stream->DeleteEntries(key_, {Redis::StreamEntryID(4, 0)}, &ret);
+  stream->ReadGroup(key_, "group", "c2", false, Redis::StreamEntryID::Min(), 0, false, &entries);
+  ASSERT_EQ(2U, entries.size());
+  EXPECT_TRUE(entries[0].deleted);
+  EXPECT_EQ(Redis::StreamEntryID(5, 0), entries[1].id);
+  // the entries read from the history are delivered again
+  stream->Pending(key_, "group", Redis::StreamEntryID(5, 0), Redis::StreamEntryID(5, 0), 0, "", &pending);
+  ASSERT_EQ(1U, pending.size());
+  EXPECT_EQ(2U, pending[0].delivery_count);
+
+  int destroyed = 0;
+  stream->DestroyGroup(key_, "group", &destroyed);
+  EXPECT_EQ(1, destroyed);
+  EXPECT_FALSE(stream->Pending(key_, "group", Redis::StreamEntryID::Min(), Redis::StreamEntryID::Max(),
+                               0, "", &pending).ok());
+  stream->Del(key_);
+}
+
+TEST_F(RedisStreamTest, EmptyStream) {
+  addEntries(3);
+  uint64_t ret = 0, len = 0;
+  stream->Trim(key_, 0, &ret);
+  EXPECT_EQ(3U, ret);
+  // the empty stream is kept with its last id
+  stream->Len(key_, &len);
+  EXPECT_EQ(0U, len);
+  RedisType type;
+  stream->Type(key_, &type);
+  EXPECT_EQ(kRedisStream, type);
+  Redis::StreamEntryID id;
+  stream->LastID(key_, &id);
+  EXPECT_EQ(Redis::StreamEntryID(3, 0), id);
+  Redis::StreamAddOptions options;
+  options.auto_id = false;
+  options.id = Redis::StreamEntryID(2, 0);
+  EXPECT_FALSE(stream->Add(key_, options, {"field", "value"}, &id).ok());
+  EXPECT_TRUE(stream->CreateGroup(key_, "group", true, Redis::StreamEntryID::Min(), false).ok());
+  stream->Del(key_);
+}
@@ -1,4 +1,8 @@
 #include <redis_string.h>
+#include <algorithm>
+#include <ctime>
+#include <memory>
+#include <thread>
 #include "test_base.h"
 #include "redis_string.h"
 
@@ -89,6 +93,42 @@ TEST_F(RedisStringTest, IncrBy) {
 
 }
 
+TEST_F(RedisStringTest, IncrByMergeMode) {
+  config_->counter_merge_mode = true;
+  int64_t ret;
+  // the new key is incremented as usual, and the rest are merged
+  string->IncrBy(key_, 1, &ret);
+  std::vector<std::vector<int64_t>> replies(4);
+  std::vector<std::thread> threads;
+  for (auto &thread_replies : replies) {
+    threads.emplace_back([this, &thread_replies]() {
+      int64_t n;
+      for (int i = 0; i < 1000; i++) {
+        if (string->IncrBy(key_, 1, &n).ok()) thread_replies.emplace_back(n);
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  // each increment replies its own result
+  std::vector<int64_t> all_replies;
+  for (const auto &thread_replies : replies) {
+    all_replies.insert(all_replies.end(), thread_replies.begin(), thread_replies.end());
+  }
+  std::sort(all_replies.begin(), all_replies.end());
+  ASSERT_EQ(4000u, all_replies.size());
+  for (size_t i = 0; i < all_replies.size(); i++) EXPECT_EQ(static_cast<int64_t>(i + 2), all_replies[i]);
+  std::string value;
+  string->Get(key_, &value);
+  EXPECT_EQ("4001", value);
+  // the overflow is rejected before it's merged
+  rocksdb::Status s = string->IncrBy(key_, INT64_MAX, &ret);
+  EXPECT_TRUE(s.IsInvalidArgument());
+  string->Get(key_, &value);
+  EXPECT_EQ("4001", value);
+  string->Del(key_);
+  config_->counter_merge_mode = false;
+}
+
 TEST_F(RedisStringTest, GetSet) {
   std::vector<Slice> values = {"a", "b", "c", "d"};
   for(size_t i = 0; i < values.size(); i++) {
@@ -177,6 +217,62 @@ TEST_F(RedisStringTest, SetRange) {
   string->SetRange(key_, 15, "1", &ret);
   EXPECT_EQ(16, ret);
   string->Get(key_, &value);
-  EXPECT_EQ(16, value.size());
+  EXPECT_EQ(16u, value.size());
+  string->Del(key_);
+}
+TEST_F(RedisStringTest, BlobValue) {
+  config_->string_blob_min_size = 16;
+  int ret;
+  std::string value, big(64, 'a');
+  auto blob_cf_handle = storage_->GetCFHandle("blob");
+  auto count_blobs = [this, blob_cf_handle]() {
+    std::unique_ptr<rocksdb::Iterator> iter(storage_->GetDB()->NewIterator(rocksdb::ReadOptions(), blob_cf_handle));
+    int n = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) n++;
+    return n;
+  };
+  EXPECT_TRUE(string->Set(key_, big).ok());
+  EXPECT_TRUE(string->Get(key_, &value).ok());
+  EXPECT_EQ(big, value);
+  EXPECT_EQ(1, count_blobs());
+
+  // the values which grow past the min size are separated as well
+  string->Set("test-small-key", "short");
+  string->Append("test-small-key", big, &ret);
+  EXPECT_EQ(69, ret);
+  string->Get("test-small-key", &value);
+  EXPECT_EQ("short" + big, value);
+  string->Append(key_, "b", &ret);
+  EXPECT_EQ(65, ret);
+  string->SetRange(key_, 1, "xyz", &ret);
+  EXPECT_EQ(65, ret);
+  string->Get(key_, &value);
+  EXPECT_EQ("axyz" + std::string(60, 'a') + "b", value);
+
+  std::vector<Slice> keys = {key_, "test-small-key", "test-missing-key"};
+  std::vector<std::string> values;
+  auto statuses = string->MGet(keys, &values);
+  ASSERT_EQ(3u, statuses.size());
+  EXPECT_TRUE(statuses[0].ok());
+  EXPECT_EQ("axyz" + std::string(60, 'a') + "b", values[0]);
+  EXPECT_EQ("short" + big, values[1]);
+  EXPECT_TRUE(statuses[2].IsNotFound());
+
+  // the expire only rewrites the metadata, and the blob is still read by it
+  string->Expire(key_, static_cast<int>(std::time(nullptr)) + 100);
+  int ttl;
+  string->TTL(key_, &ttl);
+  EXPECT_TRUE(ttl >= 99 && ttl <= 100);
+  string->Get(key_, &value);
+  EXPECT_EQ(65u, value.size());
+
+  // the stale blobs of the overwritten and deleted strings are dropped by the compaction
+  string->Set(key_, "short");
+  string->Del("test-small-key");
+  EXPECT_TRUE(storage_->Compact(nullptr, nullptr).ok());
+  EXPECT_EQ(0, count_blobs());
+  string->Get(key_, &value);
+  EXPECT_EQ("short", value);
   string->Del(key_);
-}
\ No newline at end of file
+  config_->string_blob_min_size = 0;
+}
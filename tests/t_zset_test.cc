@@ -216,6 +216,56 @@ TEST_F(RedisZSetTest, RangeByScoreWithLimit) {
   zset->Del(key_);
 }
 
+TEST_F(RedisZSetTest, RangeByScoreBounds) {
+  int ret;
+  // the empty member has the score key which equals to the score bound
+  std::vector<MemberScore> mscores = {{"", 1}, {"a", 1}, {"b", 2}, {"c", -0.0}, {"d", 0}, {"e", 3}};
+  zset->Add(key_, 0, &mscores, &ret);
+  EXPECT_EQ(6, ret);
+
+  ZRangeSpec spec;
+  spec.min = 0;
+  spec.max = 1;
+  zset->RangeByScore(key_, spec, &mscores, nullptr);
+  EXPECT_EQ(4u, mscores.size());
+  spec.maxex = true;
+  spec.reversed = true;
+  zset->RangeByScore(key_, spec, &mscores, nullptr);
+  ASSERT_EQ(2u, mscores.size());
+  EXPECT_EQ("d", mscores[0].member);
+  EXPECT_EQ("c", mscores[1].member);
+  spec.min = 1;
+  spec.max = 2;
+  spec.maxex = false;
+  zset->RangeByScore(key_, spec, &mscores, nullptr);
+  ASSERT_EQ(3u, mscores.size());
+  EXPECT_EQ("b", mscores[0].member);
+  EXPECT_EQ("a", mscores[1].member);
+  EXPECT_EQ("", mscores[2].member);
+  spec.minex = true;
+  spec.reversed = false;
+  zset->RangeByScore(key_, spec, &mscores, nullptr);
+  ASSERT_EQ(1u, mscores.size());
+  EXPECT_EQ("b", mscores[0].member);
+
+  ZRangeLexSpec lex_spec;
+  lex_spec.min = "a";
+  lex_spec.minex = true;
+  lex_spec.max = "d";
+  lex_spec.maxex = true;
+  std::vector<std::string> members;
+  zset->RangeByLex(key_, lex_spec, &members, nullptr);
+  ASSERT_EQ(2u, members.size());
+  EXPECT_EQ("b", members[0]);
+  EXPECT_EQ("c", members[1]);
+  lex_spec.min = "";
+  lex_spec.minex = false;
+  lex_spec.max_infinite = true;
+  zset->RangeByLex(key_, lex_spec, &members, nullptr);
+  EXPECT_EQ(6u, members.size());
+  zset->Del(key_);
+}
+
 TEST_F(RedisZSetTest, RemRangeByScore) {
   int ret;
   std::vector<MemberScore> mscores;
@@ -289,4 +339,120 @@ TEST_F(RedisZSetTest, Rank) {
     EXPECT_EQ(-1, rank);
   }
   zset->Del(key_);
-}
\ No newline at end of file
+}
+TEST_F(RedisZSetTest, RankWithRankIndex) {
+  config_->zset_rank_index = true;
+  int ret;
+  std::vector<MemberScore> mscores;
+  for (size_t i = 0; i < fields_.size(); i++) {
+    mscores.emplace_back(MemberScore{fields_[i].ToString(), scores_[i]});
+  }
+  zset->Add(key_, 0, &mscores, &ret);
+  EXPECT_EQ(static_cast<int>(fields_.size()), ret);
+  for (size_t i = 0; i < fields_.size(); i++) {
+    int rank;
+    zset->Rank(key_, fields_[i], false, &rank);
+    EXPECT_EQ(i, rank);
+    zset->Rank(key_, fields_[i], true, &rank);
+    EXPECT_EQ(i, static_cast<int>(fields_.size()-rank-1));
+  }
+  std::vector<MemberScore> range_mscores;
+  zset->Range(key_, 3, 5, 0, &range_mscores);
+  EXPECT_EQ(3u, range_mscores.size());
+  for (size_t i = 0; i < range_mscores.size(); i++) {
+    EXPECT_EQ(fields_[i+3].ToString(), range_mscores[i].member);
+  }
+  zset->Range(key_, 1, 2, ZSET_REVERSED, &range_mscores);
+  EXPECT_EQ(2u, range_mscores.size());
+  EXPECT_EQ(fields_[fields_.size()-2].ToString(), range_mscores[0].member);
+  EXPECT_EQ(fields_[fields_.size()-3].ToString(), range_mscores[1].member);
+
+  // the rank index should be updated after removing the members
+  zset->RemoveRangeByRank(key_, 1, 2, &ret);
+  EXPECT_EQ(2, ret);
+  int rank;
+  zset->Rank(key_, fields_[3], false, &rank);
+  EXPECT_EQ(1, rank);
+  zset->Rank(key_, fields_[fields_.size()-1], false, &rank);
+  EXPECT_EQ(static_cast<int>(fields_.size()-3), rank);
+  zset->Del(key_);
+  config_->zset_rank_index = false;
+}
+
+TEST_F(RedisZSetTest, UnionAndInterStore) {
+  int ret;
+  // more members than one chunk, so the destination is written in multiple batches
+  std::vector<MemberScore> mscores1, mscores2;
+  for (int i = 0; i < 3000; i++) {
+    mscores1.emplace_back(MemberScore{"member-" + std::to_string(i), static_cast<double>(i)});
+    if (i % 2 == 0) mscores2.emplace_back(MemberScore{"member-" + std::to_string(i), 1});
+  }
+  mscores2.emplace_back(MemberScore{"only-in-key2", 1});
+  zset->Add("zset_store_key1", 0, &mscores1, &ret);
+  zset->Add("zset_store_key2", 0, &mscores2, &ret);
+  std::vector<KeyWeight> keys_weights = {{"zset_store_key1", 1}, {"zset_store_key2", 2}};
+
+  int size;
+  rocksdb::Status s = zset->UnionStore("zset_store_dst", keys_weights, kAggregateSum, &size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(3001, size);
+  zset->Card("zset_store_dst", &ret);
+  EXPECT_EQ(3001, ret);
+  double score;
+  zset->Score("zset_store_dst", "member-10", &score);
+  EXPECT_EQ(12, score);
+  zset->Score("zset_store_dst", "member-11", &score);
+  EXPECT_EQ(11, score);
+  zset->Score("zset_store_dst", "only-in-key2", &score);
+  EXPECT_EQ(2, score);
+
+  // the destination is one of the sources
+  s = zset->InterStore("zset_store_dst", {{"zset_store_dst", 1}, {"zset_store_key2", 1}}, kAggregateMax, &size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1501, size);
+  zset->Card("zset_store_dst", &ret);
+  EXPECT_EQ(1501, ret);
+  zset->Score("zset_store_dst", "member-10", &score);
+  EXPECT_EQ(12, score);
+  s = zset->Score("zset_store_dst", "member-11", &score);
+  EXPECT_TRUE(s.IsNotFound());
+
+  s = zset->InterStore("zset_store_dst2", {{"zset_store_key1", 1}, {"zset_store_missing", 1}}, kAggregateSum, &size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, size);
+  zset->Del("zset_store_key1");
+  zset->Del("zset_store_key2");
+  zset->Del("zset_store_dst");
+}
+
+TEST_F(RedisZSetTest, RangeInTxn) {
+  int ret;
+  std::vector<MemberScore> mscores = {{"one", 1}, {"two", 2}};
+  zset->Add(key_, 0, &mscores, &ret);
+  storage_->BeginTxn();
+  // the members out of the range and of the other key are only in the transaction batch
+  mscores = {{"ten", 10}};
+  zset->Add(key_, 0, &mscores, &ret);
+  mscores = {{"other", 1}};
+  zset->Add("zset_txn_other_key", 0, &mscores, &ret);
+  ZRangeSpec spec;
+  spec.min = 0;
+  spec.max = 5;
+  zset->RangeByScore(key_, spec, &mscores, nullptr);
+  ASSERT_EQ(2u, mscores.size());
+  EXPECT_EQ("one", mscores[0].member);
+  EXPECT_EQ("two", mscores[1].member);
+  spec.reversed = true;
+  zset->RangeByScore(key_, spec, &mscores, nullptr);
+  ASSERT_EQ(2u, mscores.size());
+  EXPECT_EQ("two", mscores[0].member);
+  ZRangeLexSpec lex_spec;
+  lex_spec.min = "a";
+  lex_spec.max = "three";
+  std::vector<std::string> members;
+  zset->RangeByLex(key_, lex_spec, &members, nullptr);
+  EXPECT_EQ(std::vector<std::string>({"one", "ten"}), members);
+  EXPECT_TRUE(storage_->CommitTxn().ok());
+  zset->Del(key_);
+  zset->Del("zset_txn_other_key");
+}
@@ -0,0 +1,36 @@
+#include <gtest/gtest.h>
+#include "redis_metadata.h"
+#include "table_properties_collector.h"
+
+TEST(NamespaceStatsCollector, CollectAndDecode) {
+  Engine::NamespaceStatsCollector collector;
+  std::string ns_key, value;
+  Metadata metadata(kRedisString);
+  metadata.Encode(&value);
+  for (int i = 0; i < 10; i++) {
+    ComposeNamespaceKey("ns1", "key" + std::to_string(i), &ns_key);
+    collector.AddUserKey(ns_key, value, rocksdb::kEntryPut, 0, 0);
+  }
+  ComposeNamespaceKey("ns1", "key0", &ns_key);
+  collector.AddUserKey(ns_key, "", rocksdb::kEntryDelete, 0, 0);
+  metadata.expire = 1000;
+  metadata.Encode(&value);
+  for (int i = 0; i < 5; i++) {
+    ComposeNamespaceKey("ns2", "key" + std::to_string(i), &ns_key);
+    collector.AddUserKey(ns_key, value, rocksdb::kEntryPut, 0, 0);
+  }
+
+  rocksdb::UserCollectedProperties props;
+  collector.Finish(&props);
+  std::map<std::string, Engine::NamespaceKeyStats> stats;
+  // decode twice to sum the stats like from two sst files
+  ASSERT_TRUE(Engine::DecodeNamespaceKeyStats(props[Engine::kNamespaceStatsPropertyName], &stats));
+  ASSERT_TRUE(Engine::DecodeNamespaceKeyStats(props[Engine::kNamespaceStatsPropertyName], &stats));
+  ASSERT_EQ(2u, stats.size());
+  EXPECT_EQ(20u, stats["ns1"].n_put);
+  EXPECT_EQ(2u, stats["ns1"].n_delete);
+  EXPECT_EQ(0u, stats["ns1"].n_expires);
+  EXPECT_EQ(10u, stats["ns2"].n_put);
+  EXPECT_EQ(10u, stats["ns2"].n_expires);
+  EXPECT_EQ(10000u, stats["ns2"].expire_sum);
+}
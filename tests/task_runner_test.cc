@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include <atomic>
+#include <vector>
 #include "task_runner.h"
 
 TEST(TaskRunner, PublishOverflow) {
@@ -46,4 +47,28 @@ TEST(TaskRunner, Run) {
   ASSERT_EQ(100, counter);
   tr.Stop();
   tr.Join();
-}
\ No newline at end of file
+}
+TEST(TaskRunner, HighPriorityFirst) {
+  std::vector<int> order;
+  TaskRunner tr(1, 16);
+
+  Status s;
+  Task t;
+  for(int i = 0; i < 6; i++) {
+    t.callback = [&order, i](void *arg) { order.emplace_back(i); };
+    t.high_priority = i >= 3;
+    s = tr.Publish(t);
+    ASSERT_TRUE(s.IsOK());
+  }
+  tr.Start();
+  sleep(1);
+  tr.Stop();
+  tr.Join();
+  std::vector<int> expected = {3, 4, 5, 0, 1, 2};
+  ASSERT_EQ(expected, order);
+
+  TaskRunnerStats stats;
+  tr.GetStats(&stats);
+  ASSERT_EQ(0u, stats.queued_tasks);
+  ASSERT_EQ(6u, stats.executed_tasks);
+}
@@ -0,0 +1,43 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include "tracing.h"
+
+TEST(Trace, SpanTimer) {
+  // nothing is traced without the attached trace
+  {
+    TraceSpanTimer timer(Trace::kLockWait);
+  }
+  EXPECT_EQ(nullptr, Trace::Current());
+
+  Trace trace("get", Trace::NowUS());
+  Trace::Attach(&trace);
+  {
+    TraceSpanTimer timer(Trace::kStorageRead);
+    usleep(2000);
+  }
+  Trace::Attach(nullptr);
+  uint64_t span = trace.spans[Trace::kStorageRead];
+  EXPECT_GE(span, 2000u);
+  // the timer without the attached trace adds nothing
+  {
+    TraceSpanTimer timer(Trace::kStorageRead);
+    usleep(2000);
+  }
+  EXPECT_EQ(span, trace.spans[Trace::kStorageRead]);
+  EXPECT_EQ(0u, trace.spans[Trace::kLockWait]);
+  trace.Mark(Trace::kExecuted);
+  EXPECT_GE(trace.stages[Trace::kExecuted], trace.spans[Trace::kStorageRead]);
+}
+
+TEST(Trace, Sample) {
+  EXPECT_FALSE(Trace::Sample(0));
+  EXPECT_TRUE(Trace::Sample(100));
+  int sampled = 0;
+  for (int i = 0; i < 10000; i++) {
+    if (Trace::Sample(10)) sampled++;
+  }
+  EXPECT_GT(sampled, 500);
+  EXPECT_LT(sampled, 1500);
+}
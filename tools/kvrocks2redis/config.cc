@@ -52,6 +52,23 @@ Status Config::parseConfigFromString(std::string input) {
         break;
       }
     }
+  } else if (size == 2 && args[0] == "parallel-export-threads") {
+    parallel_export_threads = std::atoi(args[1].c_str());
+    if (parallel_export_threads < 1 || parallel_export_threads > 64) {
+      return Status(Status::NotOK, "parallel-export-threads value should between 1 and 64");
+    }
+  } else if (size == 2 && args[0] == "streaming-mode") {
+    int i;
+    if ((i = yesnotoi(args[1])) == -1) {
+      return Status(Status::NotOK, "argument must be 'yes' or 'no'");
+    }
+    streaming_mode = (i == 1);
+  } else if (size == 2 && args[0] == "rdb-export-mode") {
+    int i;
+    if ((i = yesnotoi(args[1])) == -1) {
+      return Status(Status::NotOK, "argument must be 'yes' or 'no'");
+    }
+    rdb_export_mode = (i == 1);
   } else if (size >= 3 && args[0] == "kvrocks") {
     kvrocks_host = args[1];
     // we use port + 1 as repl port, so incr the kvrocks port here
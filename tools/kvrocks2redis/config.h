@@ -17,10 +17,14 @@ struct Config {
  public:
   int loglevel = 0;
   bool daemonize = false;
+  int parallel_export_threads = 4;
+  bool streaming_mode = false;
+  bool rdb_export_mode = false;
 
   std::string dir = "/tmp/ev";
   std::string db_dir = dir + "/db";
   std::string aof_file_name = "appendonly.aof";
+  std::string rdb_file_name = "dump.rdb";
   std::string next_offset_file_name = "last_next_offset.txt";
   std::string next_seq_file_path = dir + "/last_next_seq.txt";
 
@@ -4,6 +4,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <csignal>
+#include <memory>
 
 #include "../../src/config.h"
 #include "../../src/worker.h"
@@ -13,6 +14,7 @@
 
 #include "sync.h"
 #include "redis_writer.h"
+#include "stream_writer.h"
 #include "parser.h"
 #include "config.h"
 #include "version.h"
@@ -140,10 +142,15 @@ int main(int argc, char *argv[]) {
 
   Server srv(&storage, &kvrocks_config);
 
-  RedisWriter writer(&config);
-  Parser parser(&storage, &writer);
+  std::unique_ptr<Writer> writer;
+  if (config.streaming_mode) {
+    writer = std::unique_ptr<Writer>(new StreamWriter(&config));
+  } else {
+    writer = std::unique_ptr<Writer>(new RedisWriter(&config));
+  }
+  Parser parser(&storage, writer.get(), config.parallel_export_threads);
 
-  Sync sync(&srv, &writer, &parser, &config);
+  Sync sync(&srv, writer.get(), &parser, &config);
   hup_handler = [&sync, &opts]() {
     if (!sync.IsStopped()) {
       LOG(INFO) << "Bye Bye";
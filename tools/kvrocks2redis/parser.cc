@@ -1,22 +1,112 @@
 #include <glog/logging.h>
 
 #include <rocksdb/write_batch.h>
+#include <algorithm>
+#include <memory>
+#include <thread>
 
 #include "../../src/redis_bitmap.h"
+#include "../../src/redis_list.h"
+#include "../../src/util.h"
 #include "parser.h"
 #include "util.h"
 
+// the elements of the complex keys are sent by the multi-elements commands, like HMSET
+// and ZADD with many pairs, and the commands are appended to the aof in batches
+static const size_t kMaxElementsPerCommand = 128;
+static const size_t kMaxCommandsPerWrite = 64;
+
+// the subkeys are in the default or the type column families
+static bool isSubKeyColumnFamily(uint32_t column_family_id) {
+  return column_family_id == kColumnFamilyIDDefault
+      || (column_family_id >= kColumnFamilyIDHash && column_family_id <= kColumnFamilyIDZSet);
+}
+
 Status Parser::ParseFullDB() {
   rocksdb::DB *db_ = storage_->GetDB();
   if (!lastest_snapshot_) lastest_snapshot_ = new LatestSnapShot(db_);
+
+  auto s = forEachRange([this](const std::string &start, const std::string &stop, int) {
+    return parseRange(start, stop);
+  });
+  delete lastest_snapshot_;
+  lastest_snapshot_ = nullptr;
+  return s;
+}
+
+Status Parser::ExportRdb(const std::string &dir, const std::string &file_name, std::vector<std::string> *files,
+                         rocksdb::SequenceNumber *next_seq) {
+  rocksdb::DB *db_ = storage_->GetDB();
+  if (!lastest_snapshot_) lastest_snapshot_ = new LatestSnapShot(db_);
+  *next_seq = lastest_snapshot_->GetSnapShot()->GetSequenceNumber() + 1;
+
+  // the parts are at most one per thread, the fewer ranges leave some of them empty
+  RdbExporter exporter(dir, file_name, std::max(n_threads_, 1));
+  auto s = forEachRange([this, &exporter](const std::string &start, const std::string &stop, int part) {
+    return exportRange(start, stop, part, &exporter);
+  });
+  delete lastest_snapshot_;
+  lastest_snapshot_ = nullptr;
+  if (!s.IsOK()) return s;
+  return exporter.Finish(files);
+}
+
+Status Parser::forEachRange(const std::function<Status(const std::string &, const std::string &, int)> &callback) {
+  std::vector<std::string> split_keys;
+  splitMetadataRanges(n_threads_, &split_keys);
+  std::vector<Status> results(split_keys.size() + 1);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i <= split_keys.size(); i++) {
+    std::string start = i == 0 ? "" : split_keys[i - 1];
+    std::string stop = i == split_keys.size() ? "" : split_keys[i];
+    threads.emplace_back([start, stop, i, &callback, &results]() {
+      Util::ThreadSetName("export-parser");
+      results[i] = callback(start, stop, static_cast<int>(i));
+    });
+  }
+  for (auto &t : threads) t.join();
+
+  for (const auto &s : results) {
+    if (!s.IsOK()) return s;
+  }
+  return Status::OK();
+}
+
+// the ranges are split by the smallest keys of the metadata files, so they hold the
+// similar number of the files, it's approximate but good enough to balance the threads
+void Parser::splitMetadataRanges(int n, std::vector<std::string> *split_keys) {
+  split_keys->clear();
+  if (n <= 1) return;
+  std::vector<rocksdb::LiveFileMetaData> files_meta;
+  storage_->GetDB()->GetLiveFilesMetaData(&files_meta);
+  std::vector<std::string> smallest_keys;
+  for (const auto &meta : files_meta) {
+    if (meta.column_family_name == "metadata") smallest_keys.emplace_back(meta.smallestkey);
+  }
+  std::sort(smallest_keys.begin(), smallest_keys.end());
+  if (smallest_keys.size() < 2) return;
+  size_t step = std::max<size_t>(smallest_keys.size() / n, 1);
+  for (size_t i = step; i < smallest_keys.size(); i += step) {
+    if (split_keys->size() + 1 >= static_cast<size_t>(n)) break;
+    if (!split_keys->empty() && split_keys->back() == smallest_keys[i]) continue;
+    split_keys->emplace_back(smallest_keys[i]);
+  }
+}
+
+Status Parser::parseRange(const std::string &start, const std::string &stop) {
+  rocksdb::DB *db_ = storage_->GetDB();
   rocksdb::ColumnFamilyHandle *metadata_cf_handle_ = storage_->GetCFHandle("metadata");
 
-  rocksdb::ReadOptions read_options;
-  read_options.snapshot = lastest_snapshot_->GetSnapShot();
-  read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options, metadata_cf_handle_);
-  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
-    Metadata metadata(kRedisNone);
+  auto read_options = storage_->ScanReadOptions(lastest_snapshot_->GetSnapShot(), metadata_cf_handle_);
+  std::unique_ptr<rocksdb::Iterator> iter(db_->NewIterator(read_options, metadata_cf_handle_));
+  if (start.empty()) {
+    iter->SeekToFirst();
+  } else {
+    iter->Seek(start);
+  }
+  for (; iter->Valid(); iter->Next()) {
+    if (!stop.empty() && iter->key().compare(stop) >= 0) break;
+    Metadata metadata(kRedisNone, false);
     metadata.Decode(iter->value().ToString());
     if (metadata.Expired()) {  // ignore the expired key
       continue;
@@ -29,27 +119,32 @@ Status Parser::ParseFullDB() {
     }
     if (!s.IsOK()) return s;
   }
-  delete iter;
-  delete lastest_snapshot_;
-  lastest_snapshot_ = nullptr;
-
   return Status::OK();
 }
 
 Status Parser::parseSimpleKV(const Slice &ns_key, const Slice &value, int expire) {
-  std::string op, ns, user_key;
+  std::string ns, user_key;
   ExtractNamespaceKey(ns_key, &ns, &user_key);
-  std::string output;
-  output = Rocksdb2Redis::Command2RESP(
-      {"SET", user_key, value.ToString().substr(5, value.size() - 5)});
-  Status s = writer_->Write(ns, {output});
-  if (!s.IsOK()) return s;
-
+  std::vector<std::string> outputs;
+  uint64_t blob_version;
+  uint32_t blob_size;
+  if (DecodeStringBlob(value, &blob_version, &blob_size)) {
+    // the large value is separated into the blob column family, read it at the same snapshot
+    std::string blob_key, blob;
+    InternalKey(ns_key, "", blob_version).Encode(&blob_key);
+    rocksdb::ReadOptions read_options;
+    read_options.snapshot = lastest_snapshot_->GetSnapShot();
+    auto s = storage_->GetDB()->Get(read_options, storage_->GetCFHandle("blob"), blob_key, &blob);
+    if (!s.ok()) return Status(Status::NotOK, "failed to read the blob of the string: " + s.ToString());
+    outputs.emplace_back(Rocksdb2Redis::Command2RESP({"SET", user_key, blob}));
+  } else {
+    outputs.emplace_back(Rocksdb2Redis::Command2RESP(
+        {"SET", user_key, value.ToString().substr(5, value.size() - 5)}));
+  }
   if (expire > 0) {
-    output = Rocksdb2Redis::Command2RESP({"EXPIREAT", user_key, std::to_string(expire)});
-    s = writer_->Write(ns, {output});
+    outputs.emplace_back(Rocksdb2Redis::Command2RESP({"EXPIREAT", user_key, std::to_string(expire)}));
   }
-  return s;
+  return writer_->Write(ns, outputs);
 }
 
 Status Parser::parseComplexKV(const Slice &ns_key, const Metadata &metadata) {
@@ -58,70 +153,303 @@ Status Parser::parseComplexKV(const Slice &ns_key, const Metadata &metadata) {
     return Status(Status::NotOK, "unknown metadata type: " + std::to_string(type));
   }
 
-  std::string ns, prefix_key, user_key, sub_key, value, output;
+  std::string ns, prefix_key, user_key, sub_key, value;
   ExtractNamespaceKey(ns_key, &ns, &user_key);
   InternalKey(ns_key, "", metadata.version).Encode(&prefix_key);
+  if (type == kRedisList && (metadata.flags & kListChunkedFlag)) {
+    return parseChunkedList(ns_key, metadata);
+  }
+  if (type == kRedisHash && (metadata.flags & kHashInlineFlag)) {
+    return parseInlineHash(ns_key);
+  }
+
+  const char *command = nullptr;
+  switch (type) {
+    case kRedisHash: command = "HMSET";
+      break;
+    case kRedisSet: command = "SADD";
+      break;
+    case kRedisList: command = "RPUSH";
+      break;
+    case kRedisZSet: command = "ZADD";
+      break;
+    default: break;
+  }
+  // the elements are sent by the multi-elements commands, and the commands are written in batches
+  std::vector<std::string> outputs;
+  std::vector<std::string> command_args;
+  size_t n_elements = 0;
+  auto flush_command = [&]() {
+    if (n_elements == 0) return;
+    outputs.emplace_back(Rocksdb2Redis::Command2RESP(command_args));
+    n_elements = 0;
+  };
+  Status s;
 
   rocksdb::DB *db_ = storage_->GetDB();
-  rocksdb::ReadOptions read_options;
-  read_options.snapshot = lastest_snapshot_->GetSnapShot();
-  read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options);
+  auto read_options = storage_->ScanReadOptions(lastest_snapshot_->GetSnapShot());
+  read_options.prefix_same_as_start = true;
+  std::unique_ptr<rocksdb::Iterator> iter(db_->NewIterator(read_options, storage_->GetSubKeyCFHandle(type)));
   for (iter->Seek(prefix_key); iter->Valid(); iter->Next()) {
     if (!iter->key().starts_with(prefix_key)) {
       break;
     }
-    Status s;
     InternalKey ikey(iter->key());
     sub_key = ikey.GetSubKey().ToString();
     value = iter->value().ToString();
-    switch (type) {
-      case kRedisHash:output = Rocksdb2Redis::Command2RESP({"HSET", user_key, sub_key, value});
-        break;
-      case kRedisSet:output = Rocksdb2Redis::Command2RESP({"SADD", user_key, sub_key});
-        break;
-      case kRedisList:output = Rocksdb2Redis::Command2RESP({"RPUSH", user_key, value});
-        break;
-      case kRedisZSet: {
-        double score = DecodeDouble(value.data());
-        output = Rocksdb2Redis::Command2RESP({"ZADD", user_key, std::to_string(score), sub_key});
-        break;
-      }
-      case kRedisBitmap: {
-        int index = std::stoi(sub_key);
-        s = Parser::parseBitmapSegment(ns, user_key, index, value);
-        break;
+    if (type == kRedisBitmap) {
+      parseBitmapSegment(user_key, std::stoi(sub_key), value, &outputs);
+    } else {
+      if (n_elements == 0) command_args = {command, user_key};
+      switch (type) {
+        case kRedisHash:
+          command_args.emplace_back(sub_key);
+          command_args.emplace_back(value);
+          break;
+        case kRedisSet:
+          command_args.emplace_back(sub_key);
+          break;
+        case kRedisList:
+          command_args.emplace_back(value);
+          break;
+        case kRedisZSet:
+          command_args.emplace_back(std::to_string(DecodeDouble(value.data())));
+          command_args.emplace_back(sub_key);
+          break;
+        default: break;  // should never get here
       }
-      default:break;  // should never get here
+      if (++n_elements >= kMaxElementsPerCommand) flush_command();
     }
-    if (type != kRedisBitmap) {
-      s = writer_->Write(ns, {output});
+    if (outputs.size() >= kMaxCommandsPerWrite) {
+      s = writer_->Write(ns, outputs);
+      if (!s.IsOK()) return s;
+      outputs.clear();
     }
-    if (!s.IsOK()) return s;
   }
+  flush_command();
 
   if (metadata.expire > 0) {
-    output = Rocksdb2Redis::Command2RESP({"EXPIREAT", user_key, std::to_string(metadata.expire)});
-    Status s = writer_->Write(ns, {output});
-    if (!s.IsOK()) return s;
+    outputs.emplace_back(Rocksdb2Redis::Command2RESP({"EXPIREAT", user_key, std::to_string(metadata.expire)}));
   }
+  if (outputs.empty()) return Status::OK();
+  return writer_->Write(ns, outputs);
+}
+
+// the index entries of the chunked list are ordered by position, while the chunk data by id
+Status Parser::parseChunkedList(const Slice &ns_key, const Metadata &metadata) {
+  std::string ns, user_key, prefix_key, data_key, sub_key, value;
+  ExtractNamespaceKey(ns_key, &ns, &user_key);
+  InternalKey(ns_key, "", metadata.version).Encode(&prefix_key);
 
+  rocksdb::DB *db_ = storage_->GetDB();
+  auto read_options = storage_->ScanReadOptions(lastest_snapshot_->GetSnapShot());
+  read_options.prefix_same_as_start = true;
+  Status s;
+  auto subkey_cf_handle = storage_->GetSubKeyCFHandle(kRedisList);
+  auto iter = db_->NewIterator(read_options, subkey_cf_handle);
+  for (iter->Seek(prefix_key); iter->Valid() && iter->key().starts_with(prefix_key); iter->Next()) {
+    InternalKey ikey(iter->key());
+    if (!Redis::List::IsChunkIndexSubKey(ikey.GetSubKey())) continue;
+    uint64_t id;
+    uint32_t count;
+    Redis::List::DecodeChunkIndex(iter->value(), &id, &count);
+    Redis::List::EncodeChunkDataSubKey(id, &sub_key);
+    InternalKey(ns_key, sub_key, metadata.version).Encode(&data_key);
+    if (!db_->Get(read_options, subkey_cf_handle, data_key, &value).ok()) continue;
+    std::vector<std::string> elems;
+    Redis::List::DecodeChunk(value, &elems);
+    std::vector<std::string> command_args{"RPUSH", user_key};
+    command_args.insert(command_args.end(), elems.begin(), elems.end());
+    s = writer_->Write(ns, {Rocksdb2Redis::Command2RESP(command_args)});
+    if (!s.IsOK()) break;
+  }
   delete iter;
-  return Status::OK();
+  if (!s.IsOK()) return s;
+
+  if (metadata.expire > 0) {
+    s = writer_->Write(ns, {Rocksdb2Redis::Command2RESP({"EXPIREAT", user_key, std::to_string(metadata.expire)})});
+  }
+  return s;
 }
 
-Status Parser::parseBitmapSegment(const Slice &ns, const Slice &user_key, int index, const Slice &bitmap) {
-  Status s;
+Status Parser::parseInlineHash(const Slice &ns_key) {
+  std::string ns, user_key, bytes;
+  ExtractNamespaceKey(ns_key, &ns, &user_key);
+  rocksdb::DB *db_ = storage_->GetDB();
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = lastest_snapshot_->GetSnapShot();
+  auto s = db_->Get(read_options, storage_->GetCFHandle("metadata"), ns_key, &bytes);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  HashMetadata metadata(false);
+  metadata.Decode(bytes);
+
+  std::vector<std::string> outputs;
+  WriteBatchExtractor::InlineHashCommands(user_key, metadata, &outputs);
+  return writer_->Write(ns, outputs);
+}
+
+void Parser::parseBitmapSegment(const Slice &user_key, int index, const Slice &bitmap,
+                                std::vector<std::string> *outputs) {
   for (size_t i = 0; i < bitmap.size(); i++) {
     if (bitmap[i] == 0) continue;  // ignore zero byte
     for (int j = 0; j < 8; j++) {
       if (!(bitmap[i] & (1 << j))) continue;  // ignore zero bit
-      s = writer_->Write(ns.ToString(), {Rocksdb2Redis::Command2RESP(
-          {"SETBIT", user_key.ToString(), std::to_string(index * 8 + i * 8 + j), "1"})
-      });
-      if (!s.IsOK()) return s;
+      outputs->emplace_back(Rocksdb2Redis::Command2RESP(
+          {"SETBIT", user_key.ToString(), std::to_string(index * 8 + i * 8 + j), "1"}));
     }
   }
+}
+
+Status Parser::exportRange(const std::string &start, const std::string &stop, int part, RdbExporter *exporter) {
+  auto read_options = storage_->ScanReadOptions(lastest_snapshot_->GetSnapShot(), storage_->GetCFHandle("metadata"));
+  std::unique_ptr<rocksdb::Iterator> iter(storage_->GetDB()->NewIterator(read_options,
+                                                                        storage_->GetCFHandle("metadata")));
+  if (start.empty()) {
+    iter->SeekToFirst();
+  } else {
+    iter->Seek(start);
+  }
+  std::string ns, user_key, entry;
+  for (; iter->Valid(); iter->Next()) {
+    if (!stop.empty() && iter->key().compare(stop) >= 0) break;
+    Metadata metadata(kRedisNone, false);
+    metadata.Decode(iter->value().ToString());
+    if (metadata.Expired()) continue;
+    entry.clear();
+    auto s = encodeRdbEntry(iter->key(), iter->value(), metadata, &entry);
+    if (!s.IsOK()) return s;
+    if (entry.empty()) continue;
+    ExtractNamespaceKey(iter->key(), &ns, &user_key);
+    s = exporter->Append(part, ns, entry);
+    if (!s.IsOK()) return s;
+  }
+  return Status::OK();
+}
+
+Status Parser::encodeRdbEntry(const Slice &ns_key, const Slice &raw_metadata, const Metadata &metadata,
+                              std::string *entry) {
+  std::string ns, user_key, prefix_key, values;
+  ExtractNamespaceKey(ns_key, &ns, &user_key);
+  RedisType type = metadata.Type();
+  rocksdb::DB *db_ = storage_->GetDB();
+  auto read_options = storage_->ScanReadOptions(lastest_snapshot_->GetSnapShot());
+
+  if (type == kRedisString) {
+    uint64_t blob_version;
+    uint32_t blob_size;
+    std::string value;
+    if (DecodeStringBlob(raw_metadata, &blob_version, &blob_size)) {
+      std::string blob_key;
+      InternalKey(ns_key, "", blob_version).Encode(&blob_key);
+      auto s = db_->Get(read_options, storage_->GetCFHandle("blob"), blob_key, &value);
+      if (!s.ok()) return Status(Status::NotOK, "failed to read the blob of the string: " + s.ToString());
+    } else {
+      value = raw_metadata.ToString().substr(5);
+    }
+    RdbExporter::EncodeString(&values, value);
+    RdbExporter::EncodeEntry(entry, RdbExporter::kTypeString, user_key, metadata.expire, 0, values);
+    return Status::OK();
+  }
+  if (type == kRedisHash && (metadata.flags & kHashInlineFlag)) {
+    HashMetadata hash_metadata(false);
+    hash_metadata.Decode(raw_metadata.ToString());
+    for (const auto &iter : hash_metadata.inline_fields) {
+      RdbExporter::EncodeString(&values, iter.first);
+      RdbExporter::EncodeString(&values, iter.second);
+    }
+    uint64_t n = hash_metadata.inline_fields.size();
+    if (n > 0) RdbExporter::EncodeEntry(entry, RdbExporter::kTypeHash, user_key, metadata.expire, n, values);
+    return Status::OK();
+  }
+  if (type < kRedisHash || type > kRedisBitmap) {
+    LOG(WARNING) << "[kvrocks2redis] Skipped the key: " << user_key << " in namespace: " << ns
+                 << ", the type: " << type << " wasn't supported by the rdb";
+    return Status::OK();
+  }
+
+  // the elements are counted while they are encoded rather than taken from the size of
+  // the metadata, so the length before them always matched the elements in the snapshot
+  uint64_t n = 0;
+  std::string bitmap, data_key, chunk;
+  std::vector<std::string> elems;
+  bool chunked = type == kRedisList && (metadata.flags & kListChunkedFlag);
+  auto subkey_cf_handle = storage_->GetSubKeyCFHandle(type);
+  InternalKey(ns_key, "", metadata.version).Encode(&prefix_key);
+  read_options.prefix_same_as_start = true;
+  std::unique_ptr<rocksdb::Iterator> iter(db_->NewIterator(read_options, subkey_cf_handle));
+  for (iter->Seek(prefix_key); iter->Valid() && iter->key().starts_with(prefix_key); iter->Next()) {
+    InternalKey ikey(iter->key());
+    Slice sub_key = ikey.GetSubKey();
+    switch (type) {
+      case kRedisHash:
+        RdbExporter::EncodeString(&values, sub_key);
+        RdbExporter::EncodeString(&values, iter->value());
+        n++;
+        break;
+      case kRedisSet:
+        RdbExporter::EncodeString(&values, sub_key);
+        n++;
+        break;
+      case kRedisZSet:
+        RdbExporter::EncodeString(&values, sub_key);
+        RdbExporter::EncodeBinaryDouble(&values, DecodeDouble(iter->value().data()));
+        n++;
+        break;
+      case kRedisList: {
+        if (!chunked) {
+          RdbExporter::EncodeString(&values, iter->value());
+          n++;
+          break;
+        }
+        // the index entries are ordered by position, and the chunk data is read by its id
+        if (!Redis::List::IsChunkIndexSubKey(sub_key)) break;
+        uint64_t id;
+        uint32_t count;
+        Redis::List::DecodeChunkIndex(iter->value(), &id, &count);
+        std::string chunk_sub_key;
+        Redis::List::EncodeChunkDataSubKey(id, &chunk_sub_key);
+        InternalKey(ns_key, chunk_sub_key, metadata.version).Encode(&data_key);
+        // the missing chunk would lose its elements silently, so the export is failed
+        auto s = db_->Get(read_options, subkey_cf_handle, data_key, &chunk);
+        if (!s.ok()) return Status(Status::NotOK, "failed to read the chunk of the list: " + s.ToString());
+        Redis::List::DecodeChunk(chunk, &elems);
+        for (const auto &elem : elems) RdbExporter::EncodeString(&values, elem);
+        n += elems.size();
+        break;
+      }
+      case kRedisBitmap: {
+        // the segments are ordered by the string of the byte offset, so they are placed by the offset
+        size_t offset = std::stoul(sub_key.ToString());
+        Slice segment = iter->value();
+        if (bitmap.size() < offset + segment.size()) bitmap.resize(offset + segment.size(), '\0');
+        for (size_t i = 0; i < segment.size(); i++) {
+          bitmap[offset + i] = static_cast<char>(RdbExporter::ReverseBits(static_cast<uint8_t>(segment[i])));
+        }
+        break;
+      }
+      default: break;
+    }
+  }
+  if (!iter->status().ok()) return Status(Status::NotOK, "failed to iterate the subkeys: " + iter->status().ToString());
+
+  if (type == kRedisBitmap) {
+    if (bitmap.empty()) return Status::OK();
+    RdbExporter::EncodeString(&values, bitmap);
+    RdbExporter::EncodeEntry(entry, RdbExporter::kTypeString, user_key, metadata.expire, 0, values);
+    return Status::OK();
+  }
+  if (n == 0) return Status::OK();
+  uint8_t rdb_type = RdbExporter::kTypeHash;
+  switch (type) {
+    case kRedisSet: rdb_type = RdbExporter::kTypeSet;
+      break;
+    case kRedisZSet: rdb_type = RdbExporter::kTypeZSet2;
+      break;
+    case kRedisList: rdb_type = RdbExporter::kTypeList;
+      break;
+    default: break;
+  }
+  RdbExporter::EncodeEntry(entry, rdb_type, user_key, metadata.expire, n, values);
   return Status::OK();
 }
 
@@ -151,20 +479,52 @@ rocksdb::Status WriteBatchExtractor::PutCF(uint32_t column_family_id, const Slic
   if (column_family_id == kColumnFamilyIDZSetScore) {
     return rocksdb::Status::OK();
   }
+  // the blob is put before the metadata of the string in the same batch
+  if (column_family_id == kColumnFamilyIDBlob) {
+    blobs_[key.ToString()] = value.ToString();
+    return rocksdb::Status::OK();
+  }
 
   std::string ns, user_key, sub_key;
   std::vector<std::string> command_args;
   if (column_family_id == kColumnFamilyIDMetadata) {
     ExtractNamespaceKey(key, &ns, &user_key);
-    Metadata metadata(kRedisNone);
+    Metadata metadata(kRedisNone, false);
     metadata.Decode(value.ToString());
     if (metadata.Type() == kRedisString) {
-      command_args = {"SET", user_key, value.ToString().substr(5, value.size() - 5)};
-      aof_strings_[ns].emplace_back(Rocksdb2Redis::Command2RESP(command_args));
+      uint64_t blob_version;
+      uint32_t blob_size;
+      std::string blob_key;
+      bool is_blob = DecodeStringBlob(value, &blob_version, &blob_size);
+      if (is_blob) InternalKey(key, "", blob_version).Encode(&blob_key);
+      auto blob_iter = is_blob ? blobs_.find(blob_key) : blobs_.end();
+      if (!is_blob) {
+        command_args = {"SET", user_key, value.ToString().substr(5, value.size() - 5)};
+        aof_strings_[ns].emplace_back(Rocksdb2Redis::Command2RESP(command_args));
+      } else if (blob_iter != blobs_.end()) {
+        command_args = {"SET", user_key, blob_iter->second};
+        aof_strings_[ns].emplace_back(Rocksdb2Redis::Command2RESP(command_args));
+        blobs_.erase(blob_iter);
+      }
+      // the blob is absent while the metadata is rewritten by EXPIRE, then only the expire is sent
       if (metadata.expire > 0) {
         command_args = {"EXPIREAT", user_key, std::to_string(metadata.expire)};
         aof_strings_[ns].emplace_back(Rocksdb2Redis::Command2RESP(command_args));
       }
+    } else if (metadata.Type() == kRedisBitmap && log_data_.GetArguments()->size() >= 4
+        && std::stoi((*log_data_.GetArguments())[0]) == kRedisCmdBitOp) {
+      // dest bitmap of bitop is rewritten with a new version, replay the command
+      // instead of the segments, since the missing segments of dest are zero
+      auto args = log_data_.GetArguments();
+      command_args = {"BITOP", (*args)[1], user_key};
+      command_args.insert(command_args.end(), args->begin() + 3, args->end());
+      aof_strings_[ns].emplace_back(Rocksdb2Redis::Command2RESP(command_args));
+    } else if (metadata.Type() == kRedisHash && (metadata.flags & kHashInlineFlag)) {
+      // the inlined fields are rewritten as a whole, so replace the hash with them
+      HashMetadata hash_metadata(false);
+      hash_metadata.Decode(value.ToString());
+      aof_strings_[ns].emplace_back(Rocksdb2Redis::Command2RESP({"DEL", user_key}));
+      InlineHashCommands(user_key, hash_metadata, &aof_strings_[ns]);
     } else if (metadata.expire > 0) {
       auto args = log_data_.GetArguments();
       if (args->size() > 0) {
@@ -179,7 +539,7 @@ rocksdb::Status WriteBatchExtractor::PutCF(uint32_t column_family_id, const Slic
     return rocksdb::Status::OK();
   }
 
-  if (column_family_id == kColumnFamilyIDDefault) {
+  if (isSubKeyColumnFamily(column_family_id)) {
     InternalKey ikey(key);
     user_key = ikey.GetKey().ToString();
     sub_key = ikey.GetSubKey().ToString();
@@ -193,6 +553,10 @@ rocksdb::Status WriteBatchExtractor::PutCF(uint32_t column_family_id, const Slic
           LOG(ERROR) << "Fail to parse write_batch in putcf type list : args error ,should at least contain cmd";
           return rocksdb::Status::OK();
         }
+        if (Redis::List::IsChunkSubKey(sub_key)) {
+          if (firstSeen_) parseChunkedListCommand(user_key, *args, &command_args);
+          break;
+        }
         RedisCommand cmd = static_cast<RedisCommand >(std::stoi((*args)[0]));
         switch (cmd) {
           case kRedisCmdLSet:
@@ -230,6 +594,34 @@ rocksdb::Status WriteBatchExtractor::PutCF(uint32_t column_family_id, const Slic
           LOG(ERROR) << "Fail to parse write_batch in putcf cmd setbit : args error ,should contain setbit offset";
           return rocksdb::Status::OK();
         }
+        if (args->size() > 1) {
+          // bitop is replayed with the metadata, and bitfield logs the final value of fields
+          RedisCommand cmd = static_cast<RedisCommand >(std::stoi((*args)[0]));
+          if (cmd == kRedisCmdBitField && firstSeen_) {
+            command_args = {"BITFIELD", user_key};
+            command_args.insert(command_args.end(), args->begin() + 1, args->end());
+            firstSeen_ = false;
+          } else if (cmd == kRedisCmdSetBitRange && firstSeen_ && args->size() == 4) {
+            // the whole bytes of the range are the same in any bit order, so they are replayed by
+            // the setrange, and the bits at the edges of the range by the bitfield
+            uint32_t start = std::stoul((*args)[1]), stop = std::stoul((*args)[2]);
+            uint64_t first_byte = (start + 7) / 8, last_byte = (static_cast<uint64_t>(stop) + 1) / 8;
+            command_args = {"BITFIELD", user_key};
+            for (uint64_t offset = start; offset <= stop; offset++) {
+              if (offset == first_byte * 8 && first_byte < last_byte) {
+                std::string bytes(last_byte - first_byte, (*args)[3] == "1" ? '\xff' : '\0');
+                aof_strings_[ns].emplace_back(Rocksdb2Redis::Command2RESP(
+                    {"SETRANGE", user_key, std::to_string(first_byte), bytes}));
+                offset = last_byte * 8 - 1;
+                continue;
+              }
+              command_args.insert(command_args.end(), {"SET", "u1", std::to_string(offset), (*args)[3]});
+            }
+            if (command_args.size() == 2) command_args.clear();
+            firstSeen_ = false;
+          }
+          break;
+        }
         bool bit_value = Redis::Bitmap::GetBitFromValueAndOffset(value.ToString(), std::stoi((*args)[0]));
         command_args = {"SETBIT", user_key, (*args)[0], bit_value ? "1" : "0"};
         break;
@@ -254,7 +646,7 @@ rocksdb::Status WriteBatchExtractor::DeleteCF(uint32_t column_family_id, const S
   if (column_family_id == kColumnFamilyIDMetadata) {
     ExtractNamespaceKey(key, &ns, &user_key);
     command_args = {"DEL", user_key};
-  } else if (column_family_id == kColumnFamilyIDDefault) {
+  } else if (isSubKeyColumnFamily(column_family_id)) {
     InternalKey ikey(key);
     user_key = ikey.GetKey().ToString();
     sub_key = ikey.GetSubKey().ToString();
@@ -272,6 +664,10 @@ rocksdb::Status WriteBatchExtractor::DeleteCF(uint32_t column_family_id, const S
           LOG(ERROR) << "Fail to parse write_batch in DeleteCF type list : args error ,should contain cmd";
           return rocksdb::Status::OK();
         }
+        if (Redis::List::IsChunkSubKey(sub_key)) {
+          if (firstSeen_) parseChunkedListCommand(user_key, *args, &command_args);
+          break;
+        }
         RedisCommand cmd = static_cast<RedisCommand >(std::stoi((*args)[0]));
         switch (cmd) {
           case kRedisCmdLTrim:
@@ -307,3 +703,78 @@ rocksdb::Status WriteBatchExtractor::DeleteCF(uint32_t column_family_id, const S
   }
   return rocksdb::Status::OK();
 }
+
+rocksdb::Status WriteBatchExtractor::MergeCF(uint32_t column_family_id, const Slice &key, const Slice &value) {
+  // the operand is the fixed64 of the increment, see Engine::CounterMergeOperator
+  if (value.size() != 8) return rocksdb::Status::OK();
+  std::string ns, user_key, increment = std::to_string(static_cast<int64_t>(DecodeFixed64(value.data())));
+  std::vector<std::string> command_args;
+  if (column_family_id == kColumnFamilyIDMetadata) {
+    ExtractNamespaceKey(key, &ns, &user_key);
+    command_args = {"INCRBY", user_key, increment};
+  } else if (isSubKeyColumnFamily(column_family_id) && log_data_.GetRedisType() == kRedisHash) {
+    InternalKey ikey(key);
+    user_key = ikey.GetKey().ToString();
+    ns = ikey.GetNamespace().ToString();
+    command_args = {"HINCRBY", user_key, ikey.GetSubKey().ToString(), increment};
+  }
+  if (!command_args.empty()) {
+    aof_strings_[ns].emplace_back(Rocksdb2Redis::Command2RESP(command_args));
+  }
+  return rocksdb::Status::OK();
+}
+
+// The chunked list rewrites the whole chunk on every change, so the command is
+// replayed from the arguments in the log data, once per write batch.
+void WriteBatchExtractor::parseChunkedListCommand(const std::string &user_key,
+                                                  const std::vector<std::string> &args,
+                                                  std::vector<std::string> *command_args) {
+  firstSeen_ = false;
+  RedisCommand cmd = static_cast<RedisCommand >(std::stoi(args[0]));
+  switch (cmd) {
+    case kRedisCmdLPush:
+    case kRedisCmdRPush:
+      if (args.size() < 2) break;
+      *command_args = {cmd == kRedisCmdLPush ? "LPUSH" : "RPUSH", user_key};
+      command_args->insert(command_args->end(), args.begin() + 1, args.end());
+      return;
+    case kRedisCmdLPop:
+    case kRedisCmdRPop:
+      *command_args = {cmd == kRedisCmdLPop ? "LPOP" : "RPOP", user_key};
+      return;
+    case kRedisCmdLSet:
+      if (args.size() < 3) break;
+      *command_args = {"LSET", user_key, args[1], args[2]};
+      return;
+    case kRedisCmdLInsert:
+      if (args.size() < 4) break;
+      *command_args = {"LINSERT", user_key, args[1] == "1" ? "before" : "after", args[2], args[3]};
+      return;
+    case kRedisCmdLRem:
+      if (args.size() < 3) break;
+      *command_args = {"LREM", user_key, args[1], args[2]};
+      return;
+    case kRedisCmdLTrim:
+      if (args.size() < 3) break;
+      *command_args = {"LTRIM", user_key, args[1], args[2]};
+      return;
+    default:
+      break;
+  }
+  LOG(ERROR) << "Fail to parse write_batch of the chunked list: args error, cmd " << args[0];
+}
+
+void WriteBatchExtractor::InlineHashCommands(const std::string &user_key, const HashMetadata &metadata,
+                                             std::vector<std::string> *outputs) {
+  if (!metadata.inline_fields.empty()) {
+    std::vector<std::string> command_args = {"HMSET", user_key};
+    for (const auto &iter : metadata.inline_fields) {
+      command_args.emplace_back(iter.first);
+      command_args.emplace_back(iter.second);
+    }
+    outputs->emplace_back(Rocksdb2Redis::Command2RESP(command_args));
+  }
+  if (metadata.expire > 0) {
+    outputs->emplace_back(Rocksdb2Redis::Command2RESP({"EXPIREAT", user_key, std::to_string(metadata.expire)}));
+  }
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <string>
 #include <map>
 #include <vector>
@@ -10,6 +11,7 @@
 #include "../../src/redis_metadata.h"
 
 #include "config.h"
+#include "rdb_exporter.h"
 #include "writer.h"
 
 class LatestSnapShot {
@@ -28,22 +30,42 @@ class LatestSnapShot {
 
 class Parser {
  public:
-  explicit Parser(Engine::Storage *storage, Writer *writer)
-      : storage_(storage), writer_(writer) {
+  explicit Parser(Engine::Storage *storage, Writer *writer, int n_threads = 1)
+      : storage_(storage), writer_(writer), n_threads_(n_threads) {
     lastest_snapshot_ = new LatestSnapShot(storage->GetDB());
   }
   ~Parser() { delete lastest_snapshot_; }
+  // ParseFullDB splits the metadata into the key ranges by the sst files, and parses
+  // them in parallel threads on the same snapshot
   Status ParseFullDB();
+  // ExportRdb encodes the key ranges into the rdb files of the namespaces in parallel threads on the
+  // same snapshot like ParseFullDB, and next_seq is the seq after the snapshot to sync the increments
+  Status ExportRdb(const std::string &dir, const std::string &file_name, std::vector<std::string> *files,
+                   rocksdb::SequenceNumber *next_seq);
   rocksdb::Status ParseWriteBatch(const std::string &batch_string);
 
  protected:
   Engine::Storage *storage_ = nullptr;
   Writer *writer_ = nullptr;
   LatestSnapShot *lastest_snapshot_ = nullptr;
+  int n_threads_ = 1;
 
+  void splitMetadataRanges(int n, std::vector<std::string> *split_keys);
+  // forEachRange runs the callback on the split ranges in parallel threads, and the index of
+  // the range is passed to the callback with its [start, stop)
+  Status forEachRange(const std::function<Status(const std::string &, const std::string &, int)> &callback);
+  // parseRange parses the metadata keys in [start, stop), the empty key is unbounded
+  Status parseRange(const std::string &start, const std::string &stop);
   Status parseSimpleKV(const Slice &ns_key, const Slice &value, int expire);
   Status parseComplexKV(const Slice &ns_key, const Metadata &metadata);
-  Status parseBitmapSegment(const Slice &ns, const Slice &user_key, int index, const Slice &bitmap);
+  Status parseChunkedList(const Slice &ns_key, const Metadata &metadata);
+  Status parseInlineHash(const Slice &ns_key);
+  void parseBitmapSegment(const Slice &user_key, int index, const Slice &bitmap, std::vector<std::string> *outputs);
+  Status exportRange(const std::string &start, const std::string &stop, int part, RdbExporter *exporter);
+  // encodeRdbEntry encodes the key into the rdb entry, the entry is left empty if the key is
+  // empty or its type isn't supported by the redis
+  Status encodeRdbEntry(const Slice &ns_key, const Slice &raw_metadata, const Metadata &metadata,
+                        std::string *entry);
 };
 
 /*
@@ -56,9 +78,18 @@ class WriteBatchExtractor : public rocksdb::WriteBatch::Handler {
                         const Slice &value) override;
 
   rocksdb::Status DeleteCF(uint32_t column_family_id, const Slice &key) override;
+  // MergeCF replays the increment merged by the counter merge mode
+  rocksdb::Status MergeCF(uint32_t column_family_id, const Slice &key, const Slice &value) override;
   std::map<std::string, std::vector<std::string>> *GetAofStrings() { return &aof_strings_; }
+  static void InlineHashCommands(const std::string &user_key, const HashMetadata &metadata,
+                                 std::vector<std::string> *outputs);
  private:
   std::map<std::string, std::vector<std::string>> aof_strings_;
   Redis::WriteBatchLogData log_data_;
+  // blobs_ is the separated string values in the batch, keyed by the blob keys
+  std::map<std::string, std::string> blobs_;
   bool firstSeen_ = true;
+
+  void parseChunkedListCommand(const std::string &user_key, const std::vector<std::string> &args,
+                               std::vector<std::string> *command_args);
 };
@@ -0,0 +1,142 @@
+#include "rdb_exporter.h"
+
+#include <cerrno>
+#include <cstring>
+#include <set>
+
+// the version 9 is loaded by the redis 5.0 and later, and the types of the entries
+// are the plain encodings which are supported by all of them
+static const char kRdbMagic[] = "REDIS0009";
+static const uint8_t kOpcodeExpireTimeMs = 0xFC;
+static const uint8_t kOpcodeSelectDB = 0xFE;
+static const uint8_t kOpcodeEOF = 0xFF;
+
+RdbExporter::RdbExporter(const std::string &dir, const std::string &file_name, int n_parts)
+    : dir_(dir), file_name_(file_name), parts_(n_parts) {}
+
+RdbExporter::~RdbExporter() {
+  for (size_t i = 0; i < parts_.size(); i++) {
+    for (const auto &iter : parts_[i]) {
+      fclose(iter.second);
+      remove(getPartFilePath(static_cast<int>(i), iter.first).c_str());
+    }
+  }
+}
+
+std::string RdbExporter::GetRdbFilePath(const std::string &ns) {
+  return dir_ + "/" + ns + "_" + file_name_;
+}
+
+std::string RdbExporter::getPartFilePath(int part, const std::string &ns) {
+  return GetRdbFilePath(ns) + ".part" + std::to_string(part);
+}
+
+Status RdbExporter::Append(int part, const std::string &ns, const std::string &entry) {
+  auto &files = parts_[part];
+  auto iter = files.find(ns);
+  if (iter == files.end()) {
+    auto path = getPartFilePath(part, ns);
+    FILE *fp = fopen(path.c_str(), "w+");
+    if (!fp) return Status(Status::NotOK, "failed to open " + path + ", err: " + strerror(errno));
+    iter = files.emplace(ns, fp).first;
+  }
+  if (fwrite(entry.data(), 1, entry.size(), iter->second) != entry.size()) {
+    return Status(Status::NotOK, std::string("failed to write the rdb part, err: ") + strerror(errno));
+  }
+  return Status::OK();
+}
+
+Status RdbExporter::Finish(std::vector<std::string> *files) {
+  std::set<std::string> namespaces;
+  for (const auto &part : parts_) {
+    for (const auto &iter : part) namespaces.insert(iter.first);
+  }
+  std::string header(kRdbMagic), footer;
+  header.push_back(static_cast<char>(kOpcodeSelectDB));
+  EncodeLength(&header, 0);
+  // the zero checksum disables the check of the rdb file when it is loaded
+  footer.push_back(static_cast<char>(kOpcodeEOF));
+  footer.append(8, '\0');
+
+  char buf[64 * 1024];
+  files->clear();
+  for (const auto &ns : namespaces) {
+    auto path = GetRdbFilePath(ns);
+    auto tmp_path = path + ".tmp";
+    FILE *out = fopen(tmp_path.c_str(), "w");
+    if (!out) return Status(Status::NotOK, "failed to open " + tmp_path + ", err: " + strerror(errno));
+    bool ok = fwrite(header.data(), 1, header.size(), out) == header.size();
+    for (size_t i = 0; ok && i < parts_.size(); i++) {
+      auto iter = parts_[i].find(ns);
+      if (iter == parts_[i].end()) continue;
+      FILE *in = iter->second;
+      ok = fflush(in) == 0 && fseek(in, 0, SEEK_SET) == 0;
+      size_t n;
+      while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        ok = fwrite(buf, 1, n, out) == n;
+      }
+      ok = ok && !ferror(in);
+      fclose(in);
+      remove(getPartFilePath(static_cast<int>(i), ns).c_str());
+      parts_[i].erase(iter);
+    }
+    ok = ok && fwrite(footer.data(), 1, footer.size(), out) == footer.size();
+    ok = fclose(out) == 0 && ok;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+      remove(tmp_path.c_str());
+      return Status(Status::NotOK, "failed to write " + path + ", err: " + strerror(errno));
+    }
+    files->emplace_back(path);
+  }
+  return Status::OK();
+}
+
+void RdbExporter::EncodeLength(std::string *dst, uint64_t len) {
+  if (len < (1 << 6)) {
+    dst->push_back(static_cast<char>(len));
+  } else if (len < (1 << 14)) {
+    dst->push_back(static_cast<char>(0x40 | (len >> 8)));
+    dst->push_back(static_cast<char>(len & 0xFF));
+  } else {
+    // the 32 or 64 bits length in big endian
+    int n_bytes = len <= UINT32_MAX ? 4 : 8;
+    dst->push_back(static_cast<char>(n_bytes == 4 ? 0x80 : 0x81));
+    for (int i = n_bytes - 1; i >= 0; i--) {
+      dst->push_back(static_cast<char>((len >> (i * 8)) & 0xFF));
+    }
+  }
+}
+
+void RdbExporter::EncodeString(std::string *dst, const rocksdb::Slice &s) {
+  EncodeLength(dst, s.size());
+  dst->append(s.data(), s.size());
+}
+
+void RdbExporter::EncodeBinaryDouble(std::string *dst, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  for (int i = 0; i < 8; i++) {
+    dst->push_back(static_cast<char>((bits >> (i * 8)) & 0xFF));
+  }
+}
+
+uint8_t RdbExporter::ReverseBits(uint8_t b) {
+  b = static_cast<uint8_t>((b & 0xF0) >> 4 | (b & 0x0F) << 4);
+  b = static_cast<uint8_t>((b & 0xCC) >> 2 | (b & 0x33) << 2);
+  return static_cast<uint8_t>((b & 0xAA) >> 1 | (b & 0x55) << 1);
+}
+
+void RdbExporter::EncodeEntry(std::string *dst, uint8_t type, const rocksdb::Slice &user_key, int expire,
+                              uint64_t n_elements, const rocksdb::Slice &value) {
+  if (expire > 0) {
+    uint64_t ms = static_cast<uint64_t>(expire) * 1000;
+    dst->push_back(static_cast<char>(kOpcodeExpireTimeMs));
+    for (int i = 0; i < 8; i++) {
+      dst->push_back(static_cast<char>((ms >> (i * 8)) & 0xFF));
+    }
+  }
+  dst->push_back(static_cast<char>(type));
+  EncodeString(dst, user_key);
+  if (type != kTypeString) EncodeLength(dst, n_elements);
+  dst->append(value.data(), value.size());
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <rocksdb/slice.h>
+
+#include "../../src/status.h"
+
+// RdbExporter writes the keys of each namespace into the redis rdb file, which could be loaded
+// by the redis directly. The key ranges are encoded into the part files by the threads in
+// parallel, one part per range, and Finish joins the parts in the order of the ranges.
+class RdbExporter {
+ public:
+  static const uint8_t kTypeString = 0;
+  static const uint8_t kTypeList = 1;
+  static const uint8_t kTypeSet = 2;
+  static const uint8_t kTypeHash = 4;
+  static const uint8_t kTypeZSet2 = 5;
+
+  // the rdb file of the namespace is <dir>/<ns>_<file_name>
+  RdbExporter(const std::string &dir, const std::string &file_name, int n_parts);
+  ~RdbExporter();
+  // Append writes the encoded entry of the key into the part of the namespace, the part
+  // is only written by one thread, so it's lock free
+  Status Append(int part, const std::string &ns, const std::string &entry);
+  // Finish joins the parts into the rdb files, and returns the paths of them
+  Status Finish(std::vector<std::string> *files);
+  std::string GetRdbFilePath(const std::string &ns);
+
+  static void EncodeLength(std::string *dst, uint64_t len);
+  static void EncodeString(std::string *dst, const rocksdb::Slice &s);
+  static void EncodeBinaryDouble(std::string *dst, double value);
+  // ReverseBits converts the byte of the kvrocks bitmap whose bits are from the lowest, while
+  // the redis bitmap is from the highest
+  static uint8_t ReverseBits(uint8_t b);
+  // EncodeEntry encodes the key with its expire in seconds, the value is encoded by the type,
+  // and the length of elements is prepended to the values of the collections
+  static void EncodeEntry(std::string *dst, uint8_t type, const rocksdb::Slice &user_key, int expire,
+                          uint64_t n_elements, const rocksdb::Slice &value);
+
+ private:
+  std::string dir_;
+  std::string file_name_;
+  // the files of the namespaces of each part
+  std::vector<std::map<std::string, FILE *>> parts_;
+
+  std::string getPartFilePath(int part, const std::string &ns);
+};
@@ -2,6 +2,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/socket.h>
 #include <system_error>
 
 #include "../../src/util.h"
@@ -10,12 +11,21 @@
 #include "util.h"
 
 RedisWriter::RedisWriter(Kvrocks2redis::Config *config) : Writer(config) {
+  // the entries are created before the threads start, so each thread only touches its own
+  for (const auto &iter : config_->tokens) {
+    next_offsets_[iter.first] = 0;
+    next_offset_fds_[iter.first] = -1;
+    redis_fds_[iter.first] = -1;
+  }
   try {
-    t_ = std::thread([this]() {
-      Util::ThreadSetName("redis-writer");
-      this->sync();
-      assert(stop_flag_);
-    });
+    for (const auto &iter : config_->tokens) {
+      const std::string ns = iter.first;
+      threads_.emplace_back([this, ns]() {
+        Util::ThreadSetName("redis-writer");
+        this->sync(ns);
+        assert(stop_flag_);
+      });
+    }
   } catch (const std::system_error &e) {
     LOG(ERROR) << "[kvrocks2redis] Failed to create thread: " << e.what();
     return;
@@ -24,10 +34,10 @@ RedisWriter::RedisWriter(Kvrocks2redis::Config *config) : Writer(config) {
 
 RedisWriter::~RedisWriter() {
   for (const auto &iter : next_offset_fds_) {
-    close(iter.second);
+    if (iter.second >= 0) close(iter.second);
   }
   for (const auto &iter : redis_fds_) {
-    close(iter.second);
+    if (iter.second >= 0) close(iter.second);
   }
 }
 
@@ -61,77 +71,85 @@ void RedisWriter::Stop() {
 
   stop_flag_ = true;  // Stopping procedure is asynchronous,
 
-  t_.join();
+  for (auto &t : threads_) {
+    if (t.joinable()) t.join();
+  }
   // handled by sync func
   LOG(INFO) << "[kvrocks2redis] redis_writer Stopped";
 }
 
-void RedisWriter::sync() {
-  for (const auto &iter : config_->tokens) {
-    Status s = readNextOffsetFromFile(iter.first, &next_offsets_[iter.first]);
-    if (!s.IsOK()) {
-      LOG(ERROR) << s.Msg();
-      return;
-    }
+void RedisWriter::sync(const std::string &ns) {
+  Status s = readNextOffsetFromFile(ns, &next_offsets_[ns]);
+  if (!s.IsOK()) {
+    LOG(ERROR) << s.Msg();
+    return;
   }
+  const auto &server = config_->tokens.at(ns);
 
   size_t chunk_size = 4 * 1024 * 1024;
   char *buffer = new char[chunk_size];
   while (!stop_flag_) {
-    for (const auto &iter : config_->tokens) {
-      Status s = GetAofFd(iter.first);
-      if (!s.IsOK()) {
-        LOG(ERROR) << s.Msg();
-        continue;
-      }
-
-      s = getRedisConn(iter.first, iter.second.host, iter.second.port, iter.second.auth);
-      if (!s.IsOK()) {
-        LOG(ERROR) << s.Msg();
-        continue;
-      }
+    int aof_fd;
+    s = GetAofFd(ns, &aof_fd);
+    if (!s.IsOK()) {
+      LOG(ERROR) << s.Msg();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
 
-      while (true) {
-        auto getted_line_leng = pread(aof_fds_[iter.first], buffer, chunk_size, next_offsets_[iter.first]);
-        if (getted_line_leng <= 0) {
-          if (getted_line_leng < 0 ){
-            LOG(ERROR) << "ERR read aof file : " << strerror(errno);
-          }
-          break;
-        }
+    s = getRedisConn(ns, server.host, server.port, server.auth);
+    if (!s.IsOK()) {
+      LOG(ERROR) << s.Msg();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
 
-        s = Util::SockSend(redis_fds_[iter.first], std::string(buffer, getted_line_leng));
-        if (!s.IsOK()) {
-          LOG(ERROR) << "ERR send data to redis err: " + s.Msg();
+    while (!stop_flag_) {
+      auto getted_line_leng = pread(aof_fd, buffer, chunk_size, next_offsets_[ns]);
+      if (getted_line_leng <= 0) {
+        if (getted_line_leng < 0 ){
+          LOG(ERROR) << "ERR read aof file : " << strerror(errno);
         }
+        break;
+      }
 
-        updateNextOffset(iter.first, next_offsets_[iter.first] + getted_line_leng);
+      s = Util::SockSend(redis_fds_[ns], std::string(buffer, getted_line_leng));
+      if (!s.IsOK()) {
+        LOG(ERROR) << "ERR send data to redis err: " + s.Msg();
       }
+      drainReplies(ns);
 
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      updateNextOffset(ns, next_offsets_[ns] + getted_line_leng);
     }
 
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
   }
 
   delete[] buffer;
 }
 
+// the replies of the pipelined commands are discarded, but they must be read or the
+// target redis would buffer them without limit after the socket buffer is full
+void RedisWriter::drainReplies(const std::string &ns) {
+  char buf[16 * 1024];
+  while (recv(redis_fds_[ns], buf, sizeof(buf), MSG_DONTWAIT) > 0) {}
+}
+
 Status RedisWriter::getRedisConn(const std::string &ns,
                                  const std::string &host,
                                  const uint32_t &port,
                                  const std::string &auth) {
-  auto iter = redis_fds_.find(ns);
-  if (iter == redis_fds_.end()) {
+  if (redis_fds_[ns] < 0) {
     auto s = Util::SockConnect(host, port, &redis_fds_[ns]);
     if (!s.IsOK()) {
       return Status(Status::NotOK, std::string("Failed to connect to redis :") + s.Msg());
     }
 
     if (!auth.empty()) {
-      auto s = authRedis(ns, auth);
+      auto s = AuthRedis(redis_fds_[ns], auth);
       if (!s.IsOK()) {
         close(redis_fds_[ns]);
-        redis_fds_.erase(ns);
+        redis_fds_[ns] = -1;
         return Status(Status::NotOK, s.Msg());
       }
     }
@@ -140,9 +158,9 @@ Status RedisWriter::getRedisConn(const std::string &ns,
   return Status::OK();
 }
 
-Status RedisWriter::authRedis(const std::string &ns, const std::string &auth) {
+Status RedisWriter::AuthRedis(int fd, const std::string &auth) {
   const auto auth_len_str = std::to_string(auth.length());
-  Util::SockSend(redis_fds_[ns], "*2" CRLF "$4" CRLF "auth" CRLF "$" + auth_len_str + CRLF +
+  Util::SockSend(fd, "*2" CRLF "$4" CRLF "auth" CRLF "$" + auth_len_str + CRLF +
       auth + CRLF);
   LOG(INFO) << "[kvrocks2redis] Auth request was sent, waiting for response";
 
@@ -150,7 +168,7 @@ Status RedisWriter::authRedis(const std::string &ns, const std::string &auth) {
   evbuffer *evbuf = evbuffer_new();
   // Read auth response
   while (true) {
-    if (evbuffer_read(evbuf, redis_fds_[ns], -1) <= 0) {
+    if (evbuffer_read(evbuf, fd, -1) <= 0) {
       evbuffer_free(evbuf);
       return Status(Status::NotOK, std::string("read auth response err: ") + strerror(errno));
     }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <glog/logging.h>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <thread>
@@ -15,17 +16,21 @@ class RedisWriter : public Writer {
   Status FlushAll(const std::string &ns) override;
 
   void Stop() override;
+  // AuthRedis sends the auth command to the blocking fd and waits for the reply
+  static Status AuthRedis(int fd, const std::string &auth);
 
  private:
-  std::thread t_;
-  bool stop_flag_ = false;
+  // each namespace is replayed by its own thread and connection, since the commands of
+  // one namespace must be sent in order while the namespaces are independent
+  std::vector<std::thread> threads_;
+  std::atomic<bool> stop_flag_{false};
   std::map<std::string, int> next_offset_fds_;
   std::map<std::string, std::istream::off_type> next_offsets_;
   std::map<std::string, int> redis_fds_;
 
-  void sync();
+  void sync(const std::string &ns);
   Status getRedisConn(const std::string &ns, const std::string &host, const uint32_t &port, const std::string &auth);
-  Status authRedis(const std::string &ns, const std::string &auth);
+  void drainReplies(const std::string &ns);
 
   Status updateNextOffset(const std::string &ns, std::istream::off_type offset);
   Status readNextOffsetFromFile(const std::string &ns, std::istream::off_type *offset);
@@ -0,0 +1,175 @@
+#include "stream_writer.h"
+#include <glog/logging.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <system_error>
+
+#include "../../src/util.h"
+
+#include "redis_writer.h"
+#include "util.h"
+
+// the max bytes of the queued commands of one namespace, and the max bytes sent in one pipeline
+static const size_t kMaxQueuedBytes = 64 * 1024 * 1024;
+static const size_t kMaxSendBytes = 4 * 1024 * 1024;
+
+StreamWriter::StreamWriter(Kvrocks2redis::Config *config) : Writer(config) {
+  for (const auto &iter : config_->tokens) {
+    streams_[iter.first] = std::unique_ptr<Stream>(new Stream);
+  }
+  try {
+    for (const auto &iter : streams_) {
+      const std::string ns = iter.first;
+      Stream *stream = iter.second.get();
+      threads_.emplace_back([this, ns, stream]() {
+        Util::ThreadSetName("stream-writer");
+        this->sync(ns, stream);
+      });
+    }
+  } catch (const std::system_error &e) {
+    LOG(ERROR) << "[kvrocks2redis] Failed to create thread: " << e.what();
+    return;
+  }
+}
+
+StreamWriter::~StreamWriter() {
+  Stop();
+  for (const auto &iter : streams_) {
+    if (iter.second->redis_fd >= 0) close(iter.second->redis_fd);
+  }
+}
+
+Status StreamWriter::Write(const std::string &ns, const std::vector<std::string> &aofs) {
+  auto iter = streams_.find(ns);
+  if (iter == streams_.end()) return Status::OK();  // the namespace isn't synced
+  Stream *stream = iter->second.get();
+
+  std::string buffer;
+  for (const auto &aof : aofs) buffer.append(aof);
+  std::unique_lock<std::mutex> lock(stream->mu);
+  stream->cond.wait(lock, [this, stream]() {
+    return stream->queued_bytes < kMaxQueuedBytes || stop_flag_;
+  });
+  if (stop_flag_) return Status(Status::NotOK, "the stream writer was stopped");
+  stream->queued_bytes += buffer.size();
+  stream->written_bytes += buffer.size();
+  stream->queue.emplace_back(std::move(buffer));
+  stream->cond.notify_all();
+  return Status::OK();
+}
+
+Status StreamWriter::FlushAll(const std::string &ns) {
+  auto iter = streams_.find(ns);
+  if (iter == streams_.end()) return Status::OK();
+  Stream *stream = iter->second.get();
+  {
+    // the queued commands are useless since the target redis would be flushed
+    std::lock_guard<std::mutex> guard(stream->mu);
+    stream->queue.clear();
+    stream->sent_bytes += stream->queued_bytes - stream->sending_bytes;
+    stream->queued_bytes = stream->sending_bytes;
+    stream->cond.notify_all();
+  }
+
+  //Warning: this will flush all redis data
+  return Write(ns, {Rocksdb2Redis::Command2RESP({"FLUSHALL"})});
+}
+
+// the marks are ordered by the namespaces, which are never changed after the writer is created
+std::vector<uint64_t> StreamWriter::WrittenMarks() {
+  std::vector<uint64_t> marks;
+  for (const auto &iter : streams_) {
+    std::lock_guard<std::mutex> guard(iter.second->mu);
+    marks.emplace_back(iter.second->written_bytes);
+  }
+  return marks;
+}
+
+bool StreamWriter::MarksSent(const std::vector<uint64_t> &marks) {
+  if (marks.size() != streams_.size()) return false;
+  size_t i = 0;
+  for (const auto &iter : streams_) {
+    std::lock_guard<std::mutex> guard(iter.second->mu);
+    if (iter.second->sent_bytes < marks[i++]) return false;
+  }
+  return true;
+}
+
+void StreamWriter::Stop() {
+  if (stop_flag_) return;
+
+  stop_flag_ = true;
+  for (const auto &iter : streams_) {
+    std::lock_guard<std::mutex> guard(iter.second->mu);
+    iter.second->cond.notify_all();
+  }
+  for (auto &t : threads_) {
+    if (t.joinable()) t.join();
+  }
+  LOG(INFO) << "[kvrocks2redis] stream_writer Stopped";
+}
+
+void StreamWriter::sync(const std::string &ns, Stream *stream) {
+  const auto &server = config_->tokens.at(ns);
+  std::string buffer;
+  while (!stop_flag_) {
+    auto s = getRedisConn(server, stream);
+    if (!s.IsOK()) {
+      LOG(ERROR) << s.Msg();
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+
+    buffer.clear();
+    {
+      std::unique_lock<std::mutex> lock(stream->mu);
+      stream->cond.wait_for(lock, std::chrono::milliseconds(100), [this, stream]() {
+        return !stream->queue.empty() || stop_flag_;
+      });
+      // pipeline the queued commands, the commands appended by one write are never split
+      while (!stream->queue.empty() && buffer.size() < kMaxSendBytes) {
+        buffer.append(stream->queue.front());
+        stream->queue.pop_front();
+      }
+      stream->sending_bytes = buffer.size();
+    }
+    if (buffer.empty()) continue;
+
+    s = Util::SockSend(stream->redis_fd, buffer);
+    // drain the replies like RedisWriter does, they are useless but must not pile up
+    char reply[16 * 1024];
+    while (s.IsOK() && recv(stream->redis_fd, reply, sizeof(reply), MSG_DONTWAIT) > 0) {}
+
+    std::lock_guard<std::mutex> guard(stream->mu);
+    if (!s.IsOK()) {
+      // resend the commands with the new connection, some of them may be applied twice
+      LOG(ERROR) << "ERR send data to redis err: " + s.Msg();
+      close(stream->redis_fd);
+      stream->redis_fd = -1;
+      stream->queue.emplace_front(std::move(buffer));
+    } else {
+      stream->queued_bytes -= stream->sending_bytes;
+      stream->sent_bytes += stream->sending_bytes;
+    }
+    stream->sending_bytes = 0;
+    stream->cond.notify_all();
+  }
+}
+
+Status StreamWriter::getRedisConn(const Kvrocks2redis::redis_server &server, Stream *stream) {
+  if (stream->redis_fd >= 0) return Status::OK();
+
+  auto s = Util::SockConnect(server.host, server.port, &stream->redis_fd);
+  if (!s.IsOK()) {
+    return Status(Status::NotOK, std::string("Failed to connect to redis :") + s.Msg());
+  }
+  if (!server.auth.empty()) {
+    s = RedisWriter::AuthRedis(stream->redis_fd, server.auth);
+    if (!s.IsOK()) {
+      close(stream->redis_fd);
+      stream->redis_fd = -1;
+      return s;
+    }
+  }
+  return Status::OK();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "writer.h"
+
+// StreamWriter sends the commands to the target redis directly instead of appending them
+// to the aof files, the commands are queued in memory by namespace and sent in pipeline
+// by the thread of the namespace, the Write is blocked while the queue is full.
+class StreamWriter : public Writer {
+ public:
+  explicit StreamWriter(Kvrocks2redis::Config *config);
+  ~StreamWriter();
+  Status Write(const std::string &ns, const std::vector<std::string> &aofs) override;
+  Status FlushAll(const std::string &ns) override;
+  std::vector<uint64_t> WrittenMarks() override;
+  bool MarksSent(const std::vector<uint64_t> &marks) override;
+  void Stop() override;
+
+ private:
+  struct Stream {
+    std::mutex mu;
+    std::condition_variable cond;
+    std::deque<std::string> queue;
+    // the queued bytes include the sending bytes, which are released once sent
+    size_t queued_bytes = 0;
+    size_t sending_bytes = 0;
+    // the total bytes ever written and sent(or dropped by the FLUSHALL), as the marks of the stream
+    uint64_t written_bytes = 0;
+    uint64_t sent_bytes = 0;
+    int redis_fd = -1;
+  };
+  std::vector<std::thread> threads_;
+  std::atomic<bool> stop_flag_{false};
+  std::map<std::string, std::unique_ptr<Stream>> streams_;
+
+  void sync(const std::string &ns, Stream *stream);
+  Status getRedisConn(const Kvrocks2redis::redis_server &server, Stream *stream);
+};
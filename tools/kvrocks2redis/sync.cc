@@ -116,6 +116,8 @@ Sync::CBState Sync::tryPSyncReadCB(bufferevent *bev,
     LOG(INFO) << "[kvrocks2redis] Failed to psync, switch to parseAllLocalStorage";
     LOG(INFO) << line;
     free(line);
+    // the rdb export stops after the next seq is recorded
+    if (self->stop_flag_) return CBState::QUIT;
     // Restart psync state machine
     return CBState::RESTART;
   } else {
@@ -171,6 +173,10 @@ Sync::CBState Sync::incrementBatchLoopCB(
 void Sync::EventTimerCB(int, int16_t, void *ctx) {
   // DLOG(INFO) << "[kvrocks2redis] timer";
   auto self = static_cast<Sync *>(ctx);
+  if (self->config_->streaming_mode && self->next_seq_ > 0) {
+    auto s = self->checkpointNextSeq();
+    if (!s.IsOK()) LOG(ERROR) << "[kvrocks2redis] Failed to checkpoint the next seq: " << s.Msg();
+  }
   if (self->stop_flag_) {
     LOG(INFO) << "[kvrocks2redis] Stop ev loop";
     event_base_loopbreak(self->base_);
@@ -181,6 +187,10 @@ void Sync::EventTimerCB(int, int16_t, void *ctx) {
 }
 
 void Sync::parseKVFromLocalStorage() {
+  if (config_->rdb_export_mode) {
+    exportRdbFromLocalStorage();
+    return;
+  }
   LOG(INFO) << "[kvrocks2redis] Start parsing kv from the local storage";
   for (const auto &iter : config_->tokens) {
     auto s = writer_->FlushAll(iter.first);
@@ -199,11 +209,49 @@ void Sync::parseKVFromLocalStorage() {
   updateNextSeq(storage_->LatestSeq() + 1);
 }
 
+// the rdb files are loaded by the redis out of band, so the next seq of the snapshot is
+// recorded and then stopped, the restart syncs the increments after the snapshot by psync
+void Sync::exportRdbFromLocalStorage() {
+  LOG(INFO) << "[kvrocks2redis] Start exporting the rdb files from the local storage";
+  std::vector<std::string> files;
+  rocksdb::SequenceNumber seq;
+  Status s = parser_->ExportRdb(config_->dir, config_->rdb_file_name, &files, &seq);
+  if (s.IsOK()) s = writeNextSeqToFile(seq);
+  if (!s.IsOK()) {
+    LOG(ERROR) << "[kvrocks2redis] Failed to export the rdb files, encounter error: " << s.Msg();
+  } else {
+    next_seq_ = seq;
+    for (const auto &file : files) LOG(INFO) << "[kvrocks2redis] Exported the rdb file: " << file;
+    LOG(INFO) << "[kvrocks2redis] The next seq: " << seq << " was recorded, load the rdb files into"
+              << " the redis, then restart kvrocks2redis without rdb-export-mode to sync the increments";
+  }
+  stop_flag_ = true;
+}
+
 Status Sync::updateNextSeq(rocksdb::SequenceNumber seq) {
   next_seq_ = seq;
+  if (config_->streaming_mode) return Status::OK();
   return writeNextSeqToFile(seq);
 }
 
+// checkpointNextSeq never waits for the commands to be sent, it marks the written commands and the
+// next seq, and records the seq in the later timer once the commands before the marks are sent
+Status Sync::checkpointNextSeq() {
+  if (checkpoint_seq_ > 0) {
+    if (!writer_->MarksSent(checkpoint_marks_)) return Status::OK();
+    auto s = writeNextSeqToFile(checkpoint_seq_);
+    if (!s.IsOK()) return s;
+    checkpointed_seq_ = checkpoint_seq_;
+    checkpoint_seq_ = 0;
+  }
+  // the commands before the next seq were written while parsing the batches in the event loop
+  if (next_seq_ != checkpointed_seq_) {
+    checkpoint_seq_ = next_seq_;
+    checkpoint_marks_ = writer_->WrittenMarks();
+  }
+  return Status::OK();
+}
+
 Status Sync::readNextSeqFromFile(rocksdb::SequenceNumber *seq) {
   next_seq_fd_ = open(config_->next_seq_file_path.data(), O_RDWR | O_CREAT, 0666);
   if (next_seq_fd_ < 0) {
@@ -215,7 +263,7 @@ Status Sync::readNextSeqFromFile(rocksdb::SequenceNumber *seq) {
   char buf[22];
   memset(buf, '\0', sizeof(buf));
   if (read(next_seq_fd_, buf, sizeof(buf)) > 0) {
-    *seq = static_cast<rocksdb::SequenceNumber>(std::stoi(buf));
+    *seq = static_cast<rocksdb::SequenceNumber>(std::stoull(buf));
   }
 
   return Status::OK();
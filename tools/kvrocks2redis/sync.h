@@ -32,6 +32,10 @@ class Sync : public ReplicationThread {
   ReplState sync_state_;
   int next_seq_fd_;
   rocksdb::SequenceNumber next_seq_ = static_cast<rocksdb::SequenceNumber>(0);
+  // the seq waiting for the commands before the marks to be sent, and the seq recorded last time
+  rocksdb::SequenceNumber checkpoint_seq_ = static_cast<rocksdb::SequenceNumber>(0);
+  rocksdb::SequenceNumber checkpointed_seq_ = static_cast<rocksdb::SequenceNumber>(0);
+  std::vector<uint64_t> checkpoint_marks_;
 
   using CBState = CallbacksStateMachine::State;
   CallbacksStateMachine psync_steps_;
@@ -51,8 +55,12 @@ class Sync : public ReplicationThread {
   static void EventTimerCB(int, int16_t, void *ctx);
 
   void parseKVFromLocalStorage();
+  void exportRdbFromLocalStorage();
 
+  // the next seq is written to file after each batch, except the streaming mode which
+  // checkpoints it periodically after the commands before it are sent
   Status updateNextSeq(rocksdb::SequenceNumber seq);
+  Status checkpointNextSeq();
   Status readNextSeqFromFile(rocksdb::SequenceNumber *seq);
   Status writeNextSeqToFile(rocksdb::SequenceNumber seq);
 };
@@ -10,19 +10,24 @@ Writer::~Writer() {
 }
 
 Status Writer::Write(const std::string &ns, const std::vector<std::string> &aofs) {
-  auto s = GetAofFd(ns);
+  std::string buffer;
+  for (const auto &aof : aofs) buffer.append(aof);
+  std::lock_guard<std::mutex> guard(aof_fds_mu_);
+  auto s = getAofFd(ns);
   if (!s.IsOK()) {
     return Status(Status::NotOK, s.Msg());
   }
-  for (size_t i = 0; i < aofs.size(); i++) {
-    write(aof_fds_[ns], aofs[i].data(), aofs[i].size());
+  // the commands are appended by one write, so they won't be interleaved with the other threads
+  if (write(aof_fds_[ns], buffer.data(), buffer.size()) < 0) {
+    return Status(Status::NotOK, std::string("Failed to write aof file :") + strerror(errno));
   }
 
   return Status::OK();
 }
 
 Status Writer::FlushAll(const std::string &ns) {
-  auto s = GetAofFd(ns, true);
+  std::lock_guard<std::mutex> guard(aof_fds_mu_);
+  auto s = getAofFd(ns, true);
   if (!s.IsOK()) {
     return Status(Status::NotOK, s.Msg());
   }
@@ -30,13 +35,21 @@ Status Writer::FlushAll(const std::string &ns) {
   return Status::OK();
 }
 
-Status Writer::GetAofFd(const std::string &ns, bool truncate) {
+Status Writer::GetAofFd(const std::string &ns, int *fd) {
+  std::lock_guard<std::mutex> guard(aof_fds_mu_);
+  auto s = getAofFd(ns);
+  if (!s.IsOK()) return s;
+  *fd = aof_fds_[ns];
+  return Status::OK();
+}
+
+Status Writer::getAofFd(const std::string &ns, bool truncate) {
   auto aof_fd = aof_fds_.find(ns);
   if (aof_fd == aof_fds_.end()) {
-    return OpenAofFile(ns, truncate);
+    return openAofFile(ns, truncate);
   } else if (truncate) {
     close(aof_fds_[ns]);
-    return OpenAofFile(ns, truncate);
+    return openAofFile(ns, truncate);
   }
   if (aof_fds_[ns] < 0) {
     return Status(Status::NotOK, std::string("Failed to open aof file :") + strerror(errno));
@@ -44,7 +57,7 @@ Status Writer::GetAofFd(const std::string &ns, bool truncate) {
   return Status::OK();
 }
 
-Status Writer::OpenAofFile(const std::string &ns, bool truncate) {
+Status Writer::openAofFile(const std::string &ns, bool truncate) {
   int openmode = O_RDWR | O_CREAT | O_APPEND;
   if (truncate) {
     openmode |= O_TRUNC;
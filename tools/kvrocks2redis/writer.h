@@ -3,24 +3,36 @@
 #include <string>
 #include <map>
 #include <fstream>
+#include <mutex>
 #include <vector>
 
 #include "../../src/status.h"
 
 #include "config.h"
 
+// Writer appends the commands to the aof files of the namespaces, it's safe to write
+// from multiple threads, and the commands of one call are appended together
 class Writer {
  public:
   explicit Writer(Kvrocks2redis::Config *config) : config_(config) {}
-  ~Writer();
+  virtual ~Writer();
   virtual Status Write(const std::string &ns, const std::vector<std::string> &aofs);
   virtual Status FlushAll(const std::string &ns);
+  // WrittenMarks returns the positions of the commands written so far, and MarksSent returns whether
+  // the commands before the marks are sent out, they are trivial for the aof files since the commands
+  // are appended before the Write returns
+  virtual std::vector<uint64_t> WrittenMarks() { return {}; }
+  virtual bool MarksSent(const std::vector<uint64_t> &marks) { return true; }
   virtual void Stop() {};
-  Status OpenAofFile(const std::string &ns, bool truncate);
-  Status GetAofFd(const std::string &ns, bool truncate = false);
+  // GetAofFd returns the fd of the aof file of the namespace, it is opened if not yet
+  Status GetAofFd(const std::string &ns, int *fd);
   std::string GetAofFilePath(const std::string &ns);
 
  protected:
   Kvrocks2redis::Config *config_ = nullptr;
+  std::mutex aof_fds_mu_;
   std::map<std::string, int> aof_fds_;
+
+  Status openAofFile(const std::string &ns, bool truncate);
+  Status getAofFd(const std::string &ns, bool truncate = false);
 };
@@ -0,0 +1,377 @@
+#include <getopt.h>
+#include <glog/logging.h>
+#include <rocksdb/statistics.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../src/config.h"
+#include "../../src/storage.h"
+#include "../../src/stats.h"
+#include "../../src/util.h"
+#include "../../src/redis_bitmap.h"
+#include "../../src/redis_hash.h"
+#include "../../src/redis_list.h"
+#include "../../src/redis_set.h"
+#include "../../src/redis_string.h"
+#include "../../src/redis_zset.h"
+
+const char *kDefaultDBDir = "/tmp/kvrocks_bench";
+const char *kDefaultTypes = "string,hash,zset,list,set,bitmap";
+const char *kBenchNamespace = "__bench";
+
+struct Options {
+  std::string db_dir = kDefaultDBDir;
+  std::vector<std::string> types;
+  int keys = 1000;
+  int members = 100;
+  int value_size = 64;
+  int threads = 4;
+  int ops = 100000;  // the ops of each thread in the mixed phase
+  int read_ratio = 50;
+  bool skip_fill = false;
+  bool show_usage = false;
+};
+
+static void usage(const char *program) {
+  std::cout << program << " benchmark the data type engines against the storage directly\n"
+            << "\t-d db dir, default is " << kDefaultDBDir << ", an empty dir was expected\n"
+            << "\t-t types separated by comma, default is " << kDefaultTypes << "\n"
+            << "\t-k number of keys, default is 1000\n"
+            << "\t-m number of members of each key, default is 100\n"
+            << "\t-v value size, default is 64\n"
+            << "\t-c number of threads, default is 4\n"
+            << "\t-n number of ops of each thread in the mixed phase, default is 100000\n"
+            << "\t-r read ratio(0~100) of the mixed phase, default is 50\n"
+            << "\t-s skip the fill phase, the data must be filled by the previous run\n"
+            << "\t-h help\n";
+  exit(0);
+}
+
+static int parseInt(const char *arg, int min, int max) {
+  int64_t n;
+  auto s = Util::StringToNum(arg, &n, min, max);
+  if (!s.IsOK()) {
+    std::cout << "Invalid argument: " << arg << ", " << s.Msg() << std::endl;
+    exit(1);
+  }
+  return static_cast<int>(n);
+}
+
+static Options parseCommandLineOptions(int argc, char **argv) {
+  int ch;
+  Options opts;
+  Util::Split(kDefaultTypes, ",", &opts.types);
+  while ((ch = ::getopt(argc, argv, "d:t:k:m:v:c:n:r:sh")) != -1) {
+    switch (ch) {
+      case 'd': opts.db_dir = optarg;
+        break;
+      case 't': opts.types.clear();
+        Util::Split(Util::ToLower(optarg), ",", &opts.types);
+        break;
+      case 'k': opts.keys = parseInt(optarg, 1, INT_MAX);
+        break;
+      case 'm': opts.members = parseInt(optarg, 1, INT_MAX);
+        break;
+      case 'v': opts.value_size = parseInt(optarg, 0, 64 * 1024 * 1024);
+        break;
+      case 'c': opts.threads = parseInt(optarg, 1, 1024);
+        break;
+      case 'n': opts.ops = parseInt(optarg, 1, INT_MAX);
+        break;
+      case 'r': opts.read_ratio = parseInt(optarg, 0, 100);
+        break;
+      case 's': opts.skip_fill = true;
+        break;
+      case 'h': opts.show_usage = true;
+        break;
+      default: usage(argv[0]);
+    }
+  }
+  return opts;
+}
+
+// TypeBench wraps the read and write operation of one data type, it's created by each
+// thread so the engines won't be shared between the threads
+class TypeBench {
+ public:
+  virtual ~TypeBench() = default;
+  virtual rocksdb::Status Write(const std::string &key, int member, const std::string &value) = 0;
+  virtual rocksdb::Status Read(const std::string &key, int member) = 0;
+};
+
+class StringBench : public TypeBench {
+ public:
+  explicit StringBench(Engine::Storage *storage) : string_(storage, kBenchNamespace) {}
+  // the members are flattened into the keys, since the string has no member
+  rocksdb::Status Write(const std::string &key, int member, const std::string &value) override {
+    return string_.Set(key + "_" + std::to_string(member), value);
+  }
+  rocksdb::Status Read(const std::string &key, int member) override {
+    std::string value;
+    auto s = string_.Get(key + "_" + std::to_string(member), &value);
+    return s.IsNotFound() ? rocksdb::Status::OK() : s;
+  }
+
+ private:
+  Redis::String string_;
+};
+
+class HashBench : public TypeBench {
+ public:
+  explicit HashBench(Engine::Storage *storage) : hash_(storage, kBenchNamespace) {}
+  rocksdb::Status Write(const std::string &key, int member, const std::string &value) override {
+    int ret;
+    return hash_.Set(key, std::to_string(member), value, &ret);
+  }
+  rocksdb::Status Read(const std::string &key, int member) override {
+    std::string value;
+    auto s = hash_.Get(key, std::to_string(member), &value);
+    return s.IsNotFound() ? rocksdb::Status::OK() : s;
+  }
+
+ private:
+  Redis::Hash hash_;
+};
+
+class ZSetBench : public TypeBench {
+ public:
+  explicit ZSetBench(Engine::Storage *storage) : zset_(storage, kBenchNamespace) {}
+  rocksdb::Status Write(const std::string &key, int member, const std::string &value) override {
+    int ret;
+    std::vector<MemberScore> mscores{MemberScore{std::to_string(member), static_cast<double>(member)}};
+    return zset_.Add(key, 0, &mscores, &ret);
+  }
+  rocksdb::Status Read(const std::string &key, int member) override {
+    double score;
+    auto s = zset_.Score(key, std::to_string(member), &score);
+    return s.IsNotFound() ? rocksdb::Status::OK() : s;
+  }
+
+ private:
+  Redis::ZSet zset_;
+};
+
+class ListBench : public TypeBench {
+ public:
+  explicit ListBench(Engine::Storage *storage) : list_(storage, kBenchNamespace) {}
+  // the list can't be written by the index before it is filled, so the writes are pushes
+  rocksdb::Status Write(const std::string &key, int member, const std::string &value) override {
+    int ret;
+    return list_.Push(key, {value}, false, &ret);
+  }
+  rocksdb::Status Read(const std::string &key, int member) override {
+    std::string elem;
+    auto s = list_.Index(key, member, &elem);
+    return s.IsNotFound() ? rocksdb::Status::OK() : s;
+  }
+
+ private:
+  Redis::List list_;
+};
+
+class SetBench : public TypeBench {
+ public:
+  explicit SetBench(Engine::Storage *storage) : set_(storage, kBenchNamespace) {}
+  rocksdb::Status Write(const std::string &key, int member, const std::string &value) override {
+    int ret;
+    return set_.Add(key, {std::to_string(member)}, &ret);
+  }
+  rocksdb::Status Read(const std::string &key, int member) override {
+    int ret;
+    return set_.IsMember(key, std::to_string(member), &ret);
+  }
+
+ private:
+  Redis::Set set_;
+};
+
+class BitmapBench : public TypeBench {
+ public:
+  explicit BitmapBench(Engine::Storage *storage) : bitmap_(storage, kBenchNamespace) {}
+  rocksdb::Status Write(const std::string &key, int member, const std::string &value) override {
+    bool old_bit;
+    return bitmap_.SetBit(key, static_cast<uint32_t>(member), true, &old_bit);
+  }
+  rocksdb::Status Read(const std::string &key, int member) override {
+    bool bit;
+    return bitmap_.GetBit(key, static_cast<uint32_t>(member), &bit);
+  }
+
+ private:
+  Redis::Bitmap bitmap_;
+};
+
+static std::unique_ptr<TypeBench> newTypeBench(const std::string &type, Engine::Storage *storage) {
+  TypeBench *bench = nullptr;
+  if (type == "string") {
+    bench = new StringBench(storage);
+  } else if (type == "hash") {
+    bench = new HashBench(storage);
+  } else if (type == "zset") {
+    bench = new ZSetBench(storage);
+  } else if (type == "list") {
+    bench = new ListBench(storage);
+  } else if (type == "set") {
+    bench = new SetBench(storage);
+  } else if (type == "bitmap") {
+    bench = new BitmapBench(storage);
+  }
+  return std::unique_ptr<TypeBench>(bench);
+}
+
+struct PhaseResult {
+  uint64_t ops = 0;
+  uint64_t errors = 0;
+  uint64_t max = 0;
+  std::vector<uint64_t> buckets = std::vector<uint64_t>(LatencyHistogram::kBuckets);
+
+  void Add(uint64_t latency) {
+    ops++;
+    buckets[LatencyHistogram::BucketIndex(latency)]++;
+    if (latency > max) max = latency;
+  }
+  void Merge(const PhaseResult &other) {
+    ops += other.ops;
+    errors += other.errors;
+    if (other.max > max) max = other.max;
+    for (size_t i = 0; i < buckets.size(); i++) buckets[i] += other.buckets[i];
+  }
+};
+
+static uint64_t nowMicros() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static std::string benchKey(int index) {
+  return "bench_key_" + std::to_string(index);
+}
+
+static void printResult(const std::string &type, const std::string &phase,
+                        int threads, uint64_t elapsed_us, const PhaseResult &result) {
+  double seconds = elapsed_us / 1000000.0;
+  printf("%-8s %-6s threads=%d ops=%" PRIu64 " errors=%" PRIu64 " elapsed=%.3fs qps=%.0f "
+         "p50=%" PRIu64 "us p99=%" PRIu64 "us p99.9=%" PRIu64 "us max=%" PRIu64 "us\n",
+         type.c_str(), phase.c_str(), threads, result.ops, result.errors, seconds,
+         seconds > 0 ? result.ops / seconds : 0,
+         LatencyHistogram::Percentile(result.buckets, 50, result.max),
+         LatencyHistogram::Percentile(result.buckets, 99, result.max),
+         LatencyHistogram::Percentile(result.buckets, 99.9, result.max),
+         result.max);
+}
+
+// runPhase splits the ops into the threads, the fill phase writes each member of
+// the keys once, and the mixed phase reads or writes the random members
+static void runPhase(Engine::Storage *storage, const Options &opts, const std::string &type, bool fill) {
+  std::vector<PhaseResult> results(opts.threads);
+  std::vector<std::thread> threads;
+  const std::string value(opts.value_size, 'x');
+  uint64_t start = nowMicros();
+  for (int t = 0; t < opts.threads; t++) {
+    threads.emplace_back([&, t]() {
+      auto bench = newTypeBench(type, storage);
+      auto &result = results[t];
+      std::minstd_rand engine(static_cast<uint32_t>(t + 1));
+      auto record = [&result](uint64_t begin, const rocksdb::Status &s) {
+        result.Add(nowMicros() - begin);
+        if (!s.ok()) result.errors++;
+      };
+      if (fill) {
+        // the keys are partitioned by the threads, so the members are in order inside the key
+        for (int k = t; k < opts.keys; k += opts.threads) {
+          auto key = benchKey(k);
+          for (int m = 0; m < opts.members; m++) {
+            uint64_t begin = nowMicros();
+            record(begin, bench->Write(key, m, value));
+          }
+        }
+        return;
+      }
+      for (int i = 0; i < opts.ops; i++) {
+        auto key = benchKey(static_cast<int>(engine() % opts.keys));
+        int member = static_cast<int>(engine() % opts.members);
+        bool is_read = static_cast<int>(engine() % 100) < opts.read_ratio;
+        uint64_t begin = nowMicros();
+        record(begin, is_read ? bench->Read(key, member) : bench->Write(key, member, value));
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+  uint64_t elapsed = nowMicros() - start;
+
+  PhaseResult total;
+  for (const auto &result : results) total.Merge(result);
+  printResult(type, fill ? "fill" : "mixed", opts.threads, elapsed, total);
+}
+
+static void printRocksDBStats(Engine::Storage *storage) {
+  auto db = storage->GetDB();
+  auto stats = db->GetDBOptions().statistics;
+  if (!stats) return;
+  std::vector<rocksdb::Tickers> tickers = {
+      rocksdb::BLOCK_CACHE_HIT, rocksdb::BLOCK_CACHE_MISS,
+      rocksdb::BLOOM_FILTER_USEFUL, rocksdb::MEMTABLE_HIT, rocksdb::MEMTABLE_MISS,
+      rocksdb::NUMBER_KEYS_WRITTEN, rocksdb::NUMBER_KEYS_READ,
+      rocksdb::BYTES_WRITTEN, rocksdb::BYTES_READ, rocksdb::WAL_FILE_BYTES,
+      rocksdb::COMPACT_READ_BYTES, rocksdb::COMPACT_WRITE_BYTES, rocksdb::FLUSH_WRITE_BYTES,
+      rocksdb::STALL_MICROS,
+  };
+  std::cout << "\n# RocksDB statistics\n";
+  for (const auto ticker : tickers) {
+    for (const auto &iter : rocksdb::TickersNameMap) {
+      if (iter.first != ticker) continue;
+      std::cout << iter.second << ": " << stats->getTickerCount(ticker) << "\n";
+    }
+  }
+  std::string value;
+  for (const auto &cf_handle : storage->GetCFHandles()) {
+    db->GetProperty(cf_handle, "rocksdb.num-files-at-level0", &value);
+    std::cout << "[" << cf_handle->GetName() << "] level0_files: " << value;
+    db->GetProperty(cf_handle, "rocksdb.estimate-num-keys", &value);
+    std::cout << ", estimate_keys: " << value << "\n";
+  }
+}
+
+int main(int argc, char *argv[]) {
+  google::InitGoogleLogging("kvrocks_bench");
+
+  auto opts = parseCommandLineOptions(argc, argv);
+  if (opts.show_usage) usage(argv[0]);
+  std::vector<std::string> types;
+  Util::Split(kDefaultTypes, ",", &types);
+  std::set<std::string> known_types(types.begin(), types.end());
+  for (const auto &type : opts.types) {
+    if (known_types.find(type) == known_types.end()) {
+      std::cout << "Unknown type: " << type << std::endl;
+      exit(1);
+    }
+  }
+
+  Config config;
+  config.db_dir = opts.db_dir;
+  config.backup_dir = opts.db_dir + "/backup";
+  Engine::Storage storage(&config);
+  auto s = storage.Open();
+  if (!s.IsOK()) {
+    std::cout << "Failed to open the storage: " << s.Msg() << std::endl;
+    exit(1);
+  }
+  std::cout << "keys=" << opts.keys << " members=" << opts.members << " value_size=" << opts.value_size
+            << " threads=" << opts.threads << " ops=" << opts.ops << " read_ratio=" << opts.read_ratio << "\n\n";
+  for (const auto &type : opts.types) {
+    if (!opts.skip_fill) runPhase(&storage, opts, type, true);
+    runPhase(&storage, opts, type, false);
+  }
+  printRocksDBStats(&storage);
+  return 0;
+}
@@ -0,0 +1,327 @@
+#include <getopt.h>
+#include <glog/logging.h>
+#include <rocksdb/env.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/options.h>
+#include <rocksdb/sst_file_writer.h>
+#include <rocksdb/table.h>
+
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../src/config.h"
+#include "../../src/encoding.h"
+#include "../../src/redis_metadata.h"
+#include "../../src/status.h"
+#include "../../src/util.h"
+
+const char *kMetadataCFName = "metadata";
+const char *kZSetScoreCFName = "zset_score";
+
+struct Options {
+  std::string input = "-";
+  std::string output_dir;
+  std::string ns = kDefaultNamespace;
+  bool type_cfs = false;
+  int max_entries = 4 * 1024 * 1024;  // the entries of all column families in one round of the files
+  bool show_usage = false;
+};
+
+static void usage(const char *program) {
+  std::cout << program << " build the sst files of the kvrocks format from the csv records, and the files"
+            << " were ingested by the INGEST command\n"
+            << "\t-i input csv file, default is - to read the stdin\n"
+            << "\t-o output dir of the sst files, it must exist and be readable by the kvrocks\n"
+            << "\t-n namespace of the keys, default is " << kDefaultNamespace << "\n"
+            << "\t-T write the subkeys into the column families of their type, it must be the same as"
+            << " the type-column-families of the kvrocks\n"
+            << "\t-e max entries in memory before the sst files were written, default is 4194304\n"
+            << "\t-h help\n"
+            << "The records were one per line, and the fields were quoted by \" if they have the commas:\n"
+            << "\tstring,key,value\n"
+            << "\thash,key,field,value\n"
+            << "\tset,key,member\n"
+            << "\tzset,key,score,member\n"
+            << "\texpireat,key,unix_timestamp\n"
+            << "The records of one key must be adjacent, like the output of the sort by the key.\n";
+  exit(0);
+}
+
+static int parseInt(const char *arg, int min, int max) {
+  int64_t n;
+  auto s = Util::StringToNum(arg, &n, min, max);
+  if (!s.IsOK()) {
+    std::cout << "Invalid argument: " << arg << ", " << s.Msg() << std::endl;
+    exit(1);
+  }
+  return static_cast<int>(n);
+}
+
+static Options parseCommandLineOptions(int argc, char **argv) {
+  int ch;
+  Options opts;
+  while ((ch = ::getopt(argc, argv, "i:o:n:e:Th")) != -1) {
+    switch (ch) {
+      case 'i': opts.input = optarg;
+        break;
+      case 'o': opts.output_dir = optarg;
+        break;
+      case 'n': opts.ns = optarg;
+        break;
+      case 'e': opts.max_entries = parseInt(optarg, 1, INT_MAX);
+        break;
+      case 'T': opts.type_cfs = true;
+        break;
+      case 'h': opts.show_usage = true;
+        break;
+      default: usage(argv[0]);
+    }
+  }
+  return opts;
+}
+
+// splitCSVLine splits the line by the commas, the quoted field could have the commas, and
+// the quote is escaped by doubling it. It returns false if the quote isn't closed.
+static bool splitCSVLine(const std::string &line, std::vector<std::string> *fields) {
+  fields->clear();
+  std::string field;
+  bool quoted = false;
+  for (size_t i = 0; i < line.size(); i++) {
+    char c = line[i];
+    if (quoted) {
+      if (c != '"') {
+        field.push_back(c);
+      } else if (i + 1 < line.size() && line[i + 1] == '"') {
+        field.push_back('"');
+        i++;
+      } else {
+        quoted = false;
+      }
+    } else if (c == '"') {
+      quoted = true;
+    } else if (c == ',') {
+      fields->emplace_back(std::move(field));
+      field.clear();
+    } else {
+      field.push_back(c);
+    }
+  }
+  if (quoted) return false;
+  fields->emplace_back(std::move(field));
+  return true;
+}
+
+// SSTBuilder collects the records of the adjacent keys, and writes them into the sorted sst files
+// of each column family once there're too many entries. The key is never split between the rounds
+// of the files, so the metadata and its subkeys are always ingested together.
+class SSTBuilder {
+ public:
+  explicit SSTBuilder(const Options &opts) : opts_(opts) {
+    rocksdb::BlockBasedTableOptions table_opts;
+    table_opts.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, false));
+    sst_opts_.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table_opts));
+  }
+
+  Status Add(const std::vector<std::string> &fields) {
+    if (fields.size() < 3) return Status(Status::NotOK, "too few fields");
+    const auto &type_name = fields[0];
+    std::string ns_key;
+    ComposeNamespaceKey(opts_.ns, fields[1], &ns_key);
+    if (ns_key != ns_key_) {
+      auto s = flushKey();
+      if (!s.IsOK()) return s;
+      ns_key_ = ns_key;
+    }
+    if (type_name == "expireat") {
+      int64_t expire;
+      auto s = Util::StringToNum(fields[2], &expire, 0, INT32_MAX);
+      if (!s.IsOK()) return s;
+      expire_ = static_cast<int>(expire);
+      return Status::OK();
+    }
+    // type name => type and the number of fields
+    static const std::map<std::string, std::pair<RedisType, size_t>> kTypes = {
+        {"string", {kRedisString, 3}},
+        {"hash", {kRedisHash, 4}},
+        {"set", {kRedisSet, 3}},
+        {"zset", {kRedisZSet, 4}},
+    };
+    auto type_iter = kTypes.find(type_name);
+    if (type_iter == kTypes.end()) return Status(Status::NotOK, "unknown type: " + type_name);
+    RedisType type = type_iter->second.first;
+    if (fields.size() != type_iter->second.second) return Status(Status::NotOK, "wrong number of fields");
+    if (type_ != kRedisNone && type_ != type) return Status(Status::NotOK, "the key has the records of other type");
+    type_ = type;
+    switch (type) {
+      case kRedisString: value_ = fields[2];
+        break;
+      case kRedisHash: members_[fields[2]] = fields[3];
+        break;
+      case kRedisSet: members_[fields[2]].clear();
+        break;
+      default: {
+        char *end = nullptr;
+        double score = std::strtod(fields[2].c_str(), &end);
+        if (fields[2].empty() || *end != '\0') return Status(Status::NotOK, "the score is not a valid float");
+        std::string score_bytes;
+        PutDouble(&score_bytes, score);
+        members_[fields[3]] = score_bytes;
+      }
+    }
+    return Status::OK();
+  }
+
+  Status Finish() {
+    auto s = flushKey();
+    if (!s.IsOK()) return s;
+    return flushFiles();
+  }
+
+  // GetFiles returns the sst files of each column family in the order they must be ingested
+  const std::map<std::string, std::vector<std::string>> &GetFiles() { return files_; }
+  uint64_t GetKeyNum() { return n_keys_; }
+
+ private:
+  const Options &opts_;
+  rocksdb::Options sst_opts_;
+  std::string ns_key_;
+  RedisType type_ = kRedisNone;
+  int expire_ = 0;
+  std::string value_;
+  std::map<std::string, std::string> members_;
+  // column family name => sorted entries of the current round
+  std::map<std::string, std::map<std::string, std::string>> entries_;
+  size_t n_entries_ = 0;
+  int n_rounds_ = 0;
+  uint64_t n_keys_ = 0;
+  std::map<std::string, std::vector<std::string>> files_;
+
+  std::string subKeyCFName(RedisType type) {
+    if (!opts_.type_cfs) return "default";
+    return type == kRedisHash ? "hash" : (type == kRedisSet ? "set" : "zset");
+  }
+
+  void addEntry(const std::string &cf_name, const std::string &key, const std::string &value) {
+    entries_[cf_name][key] = value;
+    n_entries_++;
+  }
+
+  Status flushKey() {
+    // the expire alone isn't a key
+    if (type_ == kRedisNone) {
+      expire_ = 0;
+      return Status::OK();
+    }
+    Metadata metadata(type_);
+    metadata.expire = expire_;
+    std::string bytes, sub_key;
+    if (type_ == kRedisString) {
+      metadata.Encode(&bytes);
+      bytes.append(value_);
+    } else {
+      metadata.size = static_cast<uint32_t>(members_.size());
+      metadata.Encode(&bytes);
+      auto cf_name = subKeyCFName(type_);
+      for (const auto &member : members_) {
+        InternalKey(ns_key_, member.first, metadata.version).Encode(&sub_key);
+        addEntry(cf_name, sub_key, member.second);
+        if (type_ != kRedisZSet) continue;
+        InternalKey(ns_key_, member.second + member.first, metadata.version).Encode(&sub_key);
+        addEntry(kZSetScoreCFName, sub_key, "");
+      }
+    }
+    addEntry(kMetadataCFName, ns_key_, bytes);
+    n_keys_++;
+    type_ = kRedisNone;
+    expire_ = 0;
+    value_.clear();
+    members_.clear();
+    if (n_entries_ >= static_cast<size_t>(opts_.max_entries)) return flushFiles();
+    return Status::OK();
+  }
+
+  Status flushFiles() {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-%06d.sst", n_rounds_++);
+    for (const auto &iter : entries_) {
+      if (iter.second.empty()) continue;
+      std::string path = opts_.output_dir + "/" + iter.first + suffix;
+      rocksdb::SstFileWriter writer(rocksdb::EnvOptions(), sst_opts_);
+      auto s = writer.Open(path);
+      for (auto entry = iter.second.begin(); s.ok() && entry != iter.second.end(); entry++) {
+        s = writer.Put(entry->first, entry->second);
+      }
+      if (s.ok()) s = writer.Finish();
+      if (!s.ok()) return Status(Status::NotOK, "failed to write " + path + ", err: " + s.ToString());
+      files_[iter.first].emplace_back(path);
+    }
+    entries_.clear();
+    n_entries_ = 0;
+    return Status::OK();
+  }
+};
+
+int main(int argc, char *argv[]) {
+  google::InitGoogleLogging("kvrocks_sst_builder");
+
+  auto opts = parseCommandLineOptions(argc, argv);
+  if (opts.show_usage) usage(argv[0]);
+  if (opts.output_dir.empty()) {
+    std::cout << "The output dir was required" << std::endl;
+    exit(1);
+  }
+  std::ifstream input_file;
+  if (opts.input != "-") {
+    input_file.open(opts.input);
+    if (!input_file.is_open()) {
+      std::cout << "Failed to open the input file: " << opts.input << std::endl;
+      exit(1);
+    }
+  }
+  std::istream &input = opts.input == "-" ? std::cin : input_file;
+
+  SSTBuilder builder(opts);
+  std::string line;
+  std::vector<std::string> fields;
+  uint64_t line_no = 0;
+  while (std::getline(input, line)) {
+    line_no++;
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (line.empty()) continue;
+    Status s = Status(Status::NotOK, "the quote wasn't closed");
+    if (splitCSVLine(line, &fields)) s = builder.Add(fields);
+    if (!s.IsOK()) {
+      std::cout << "Failed to build the line " << line_no << ", err: " << s.Msg() << std::endl;
+      exit(1);
+    }
+  }
+  auto s = builder.Finish();
+  if (!s.IsOK()) {
+    std::cout << "Failed to finish the sst files, err: " << s.Msg() << std::endl;
+    exit(1);
+  }
+
+  // the subkeys are ingested before the metadata, so the keys are never seen without their subkeys
+  std::cerr << "Built " << builder.GetKeyNum() << " keys, ingest them by the commands:\n";
+  const auto &files = builder.GetFiles();
+  for (const auto &iter : files) {
+    if (iter.first == kMetadataCFName) continue;
+    std::cout << "INGEST " << iter.first;
+    for (const auto &file : iter.second) std::cout << " " << file;
+    std::cout << "\n";
+  }
+  auto metadata_files = files.find(kMetadataCFName);
+  if (metadata_files != files.end()) {
+    std::cout << "INGEST " << kMetadataCFName;
+    for (const auto &file : metadata_files->second) std::cout << " " << file;
+    std::cout << "\n";
+  }
+  return 0;
+}